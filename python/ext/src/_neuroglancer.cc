@@ -8,14 +8,248 @@
 
 #include "Python.h"
 #include "numpy/arrayobject.h"
+#include "compress_segmentation.h"
+#include "decompress_segmentation.h"
+#include "downsample.h"
+#include "downsample_segmentation.h"
+#include "encoded_chunk_cache.h"
+#include "mesh_objects.h"
 #include "on_demand_object_mesh_generator.h"
+#include "precomputed_mesh_export.h"
+#include "relabel_segmentation.h"
+#include "sharded_mesh_export.h"
+#include "sharded_segmentation_export.h"
+#include "sharding.h"
+#include "skeletonize.h"
+#include "trace_events.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <vector>
 #define MODULE_NAME "_neuroglancer"
 
+// With Python 3.9 or later, the module uses multi-phase initialization (PEP
+// 489), and its types are heap types created for each module object and stored
+// in its state, so that it can be loaded in several interpreters.  Older
+// versions create the module once per process, with the same heap types.
+#if PY_VERSION_HEX >= 0x03090000
+#define NEUROGLANCER_MODULE_STATE 1
+#else
+#define NEUROGLANCER_MODULE_STATE 0
+#endif
+
 namespace neuroglancer {
+
+// Types of a module object.  None of them can be subclassed, so the type of an
+// instance is the one created by the module.
+struct ModuleState {
+  PyObject* encoded_mesh_type;
+  PyObject* object_mesh_generator_type;
+  PyObject* skeleton_generator_type;
+  PyObject* encoded_chunk_cache_type;
+};
+
+#if !NEUROGLANCER_MODULE_STATE
+static ModuleState legacy_module_state;
+#endif
+
+// Returns the state of the module that created the type of `self`.
+static ModuleState* GetModuleState(PyObject* self) {
+#if NEUROGLANCER_MODULE_STATE
+  return static_cast<ModuleState*>(PyType_GetModuleState(Py_TYPE(self)));
+#else
+  return &legacy_module_state;
+#endif
+}
+
+// Returns a new reference to a type of `module` created from `spec`, or
+// nullptr with an exception set.
+static PyObject* CreateType(PyObject* module, PyType_Spec* spec) {
+#if NEUROGLANCER_MODULE_STATE
+  return PyType_FromModuleAndSpec(module, spec, nullptr);
+#else
+  return PyType_FromSpec(spec);
+#endif
+}
+
+// Frees `obj`, an instance of a type created by CreateType, once its members
+// have been destroyed.  Since Python 3.8, instances of heap types own a
+// reference to their type.
+static void FreeObject(PyObject* obj) {
+  PyTypeObject* type = Py_TYPE(obj);
+  type->tp_free(obj);
+#if PY_VERSION_HEX >= 0x03080000
+  Py_DECREF(type);
+#endif
+}
+
+#if NEUROGLANCER_MODULE_STATE
+// Returns true if called from the main interpreter, or false with an exception
+// set.  Callbacks from native worker threads acquire the GIL with
+// PyGILState_Ensure, which attaches them to the main interpreter, so methods
+// that call back from worker threads are only supported there.
+static bool CheckMainInterpreter(const char* name) {
+  if (PyInterpreterState_Get() == PyInterpreterState_Main()) return true;
+  PyErr_Format(PyExc_RuntimeError,
+               "%s is only supported in the main interpreter", name);
+  return false;
+}
+#endif
+namespace pywrap_sharding {
+
+// Sets the hash and encodings of `*sharding` from their names in the JSON
+// sharding specification, and validates it.  Returns false with an exception
+// set if they are invalid.
+static bool ParseShardingSpec(const char* hash,
+                              const char* minishard_index_encoding,
+                              const char* data_encoding,
+                              sharding::ShardingSpec* sharding) {
+  using ShardingSpec = sharding::ShardingSpec;
+  if (!std::strcmp(hash, "murmurhash3_x86_128")) {
+    sharding->hash = ShardingSpec::Hash::kMurmurHash3_x86_128;
+  } else if (!std::strcmp(hash, "identity")) {
+    sharding->hash = ShardingSpec::Hash::kIdentity;
+  } else {
+    PyErr_SetString(PyExc_ValueError,
+                    "hash must be one of 'murmurhash3_x86_128' or 'identity'");
+    return false;
+  }
+  const char* names[2] = {minishard_index_encoding, data_encoding};
+  ShardingSpec::Encoding* encodings[2] = {&sharding->minishard_index_encoding,
+                                          &sharding->data_encoding};
+  for (int i = 0; i < 2; ++i) {
+    if (!std::strcmp(names[i], "raw")) {
+      *encodings[i] = ShardingSpec::Encoding::kRaw;
+    } else if (!std::strcmp(names[i], "gzip")) {
+      *encodings[i] = ShardingSpec::Encoding::kGzip;
+    } else {
+      PyErr_SetString(PyExc_ValueError,
+                      "encodings must be one of 'raw' or 'gzip'");
+      return false;
+    }
+  }
+  std::string error;
+  if (!sharding->Validate(&error)) {
+    PyErr_SetString(PyExc_ValueError, error.c_str());
+    return false;
+  }
+  return true;
+}
+
+static PyObject* have_gzip(PyObject* module, PyObject* args) {
+  return PyBool_FromLong(sharding::HaveGzip());
+}
+
+static PyObject* gzip_compress(PyObject* module, PyObject* args) {
+  Py_buffer buffer;
+  if (!PyArg_ParseTuple(args, "s*:gzip_compress", &buffer)) {
+    return nullptr;
+  }
+  std::string output;
+  bool valid;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  valid = sharding::GzipCompress(static_cast<const char*>(buffer.buf),
+                                 buffer.len, &output);
+
+  Py_END_ALLOW_THREADS;
+
+  PyBuffer_Release(&buffer);
+  if (!valid) {
+    PyErr_SetString(PyExc_ValueError,
+                    sharding::HaveGzip()
+                        ? "gzip compression failed"
+                        : "gzip compression requires zlib, which is not "
+                          "available");
+    return nullptr;
+  }
+  return PyBytes_FromStringAndSize(output.data(), output.size());
+}
+
+}  // namespace pywrap_sharding
+
+namespace pywrap_encoded_mesh {
+
+// Read-only buffer that shares ownership of an encoded mesh, which allows the
+// mesh to be returned to Python without copying it.
+struct Obj {
+  PyObject_HEAD std::shared_ptr<const std::string> mesh;
+};
+
+static int getbuffer(Obj* self, Py_buffer* view, int flags) {
+  return PyBuffer_FillInfo(view, reinterpret_cast<PyObject*>(self),
+                           const_cast<char*>(self->mesh->data()),
+                           self->mesh->size(), /*readonly=*/1, flags);
+}
+
+static void tp_dealloc(Obj* obj) {
+  obj->mesh.~shared_ptr();
+  FreeObject(reinterpret_cast<PyObject*>(obj));
+}
+
+// Returns a new reference to a read-only memoryview of `mesh`, or None if
+// `mesh` is empty.  `owner` is an instance of a type of the module, whose
+// EncodedMesh type is used.
+static PyObject* MakeMemoryView(PyObject* owner,
+                                std::shared_ptr<const std::string> mesh) {
+  if (mesh->empty()) {
+    Py_RETURN_NONE;
+  }
+  Obj* obj = PyObject_New(
+      Obj, reinterpret_cast<PyTypeObject*>(
+               GetModuleState(owner)->encoded_mesh_type));
+  if (!obj) {
+    return nullptr;
+  }
+  new (&obj->mesh) std::shared_ptr<const std::string>(std::move(mesh));
+  PyObject* view = PyMemoryView_FromObject(reinterpret_cast<PyObject*>(obj));
+  Py_DECREF(obj);
+  return view;
+}
+
+static PyType_Slot slots[] = {
+    {Py_tp_dealloc, reinterpret_cast<void*>(&tp_dealloc)},
+    {Py_tp_doc, const_cast<char*>("EncodedMesh")},
+#if NEUROGLANCER_MODULE_STATE
+    {Py_bf_getbuffer, reinterpret_cast<void*>(&getbuffer)},
+#endif
+    {0, nullptr},
+};
+
+static PyType_Spec spec = {MODULE_NAME ".EncodedMesh", sizeof(Obj), 0,
+                           Py_TPFLAGS_DEFAULT, slots};
+
+// Returns a new reference to the type, or nullptr with an exception set.
+static PyObject* CreateType(PyObject* module) {
+  PyObject* type = neuroglancer::CreateType(module, &spec);
+  if (!type) return nullptr;
+  auto* heap_type = reinterpret_cast<PyHeapTypeObject*>(type);
+#if !NEUROGLANCER_MODULE_STATE
+  // Buffer slots of a PyType_Spec are ignored before Python 3.9.
+  heap_type->as_buffer.bf_getbuffer =
+      reinterpret_cast<getbufferproc>(&getbuffer);
+#endif
+  // Instances are only created by MakeMemoryView.
+  heap_type->ht_type.tp_new = nullptr;
+  return type;
+}
+}  // namespace pywrap_encoded_mesh
+
 namespace pywrap_on_demand_object_mesh_generator {
 
+// Number of threads used to compute the unsimplified meshes at construction
+// when the num_threads keyword is not specified, or 0 to use the number of
+// hardware threads.
+static std::atomic<int> default_num_threads(0);
+
 struct Obj {
   PyObject_HEAD meshing::OnDemandObjectMeshGenerator impl;
+  // Reference to the label array, retained in lazy mode or if the cache size is
+  // limited, since meshes are then computed from it on demand.
+  PyObject* data;
 };
 
 static PyObject* tp_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
@@ -24,56 +258,323 @@ static PyObject* tp_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
   self = reinterpret_cast<Obj*>(type->tp_alloc(type, 0));
   if (self) {
     new (&self->impl) meshing::OnDemandObjectMeshGenerator();
+    self->data = nullptr;
   }
   return reinterpret_cast<PyObject*>(self);
 }
 
+// Returns a new reference to `array_argument` as a 3-d integer ndarray, or
+// nullptr with an exception set.
+static PyArrayObject* ConvertLabelArray(PyObject* array_argument) {
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(PyArray_CheckFromAny(
+      array_argument, /*dtype=*/nullptr, /*min_depth=*/3, /*max_depth=*/3,
+      /*requirements=*/NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED,
+      /*context=*/nullptr));
+  if (!array) {
+    return nullptr;
+  }
+  auto* descr = PyArray_DESCR(array);
+  if ((descr->kind != 'i' && descr->kind != 'u') ||
+      (descr->elsize != 1 && descr->elsize != 2 && descr->elsize != 4 &&
+       descr->elsize != 8)) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError,
+                    "ndarray must have 8-, 16-, 32-, or 64-bit integer type");
+    return nullptr;
+  }
+  return array;
+}
+
+// Computes the strides of `array`, in the order x, y, z.
+static void GetStridesInElements(PyArrayObject* array, int64_t strides[3]) {
+  const int elsize = PyArray_DESCR(array)->elsize;
+  npy_intp* strides_in_bytes = PyArray_STRIDES(array);
+  for (int i = 0; i < 3; ++i) {
+    strides[i] = strides_in_bytes[2 - i] / elsize;
+  }
+}
+
+// Converts `argument`, None or an array-like of (label, object_id) pairs, to
+// label equivalences, set to nullptr if there are none.  Arrays of other
+// integer types, e.g. int64, are cast like Python ints.  Returns false with an
+// exception set on failure.
+static bool ConvertEquivalences(
+    PyObject* argument,
+    std::shared_ptr<const meshing::LabelEquivalences>* equivalences) {
+  equivalences->reset();
+  if (argument == Py_None) return true;
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(
+      PyArray_FROMANY(argument, NPY_UINT64, 1, 2,
+                      NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST));
+  if (!array) {
+    return false;
+  }
+  const npy_intp size = PyArray_SIZE(array);
+  if (size != 0 &&
+      (PyArray_NDIM(array) != 2 || PyArray_DIMS(array)[1] != 2)) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError,
+                    "equivalences must be a sequence of (label, object_id) "
+                    "pairs");
+    return false;
+  }
+  const uint64_t* data = static_cast<const uint64_t*>(PyArray_DATA(array));
+  std::vector<std::pair<uint64_t, uint64_t>> pairs(size / 2);
+  for (npy_intp i = 0; i < size / 2; ++i) {
+    pairs[i] = {data[2 * i], data[2 * i + 1]};
+  }
+  Py_DECREF(array);
+  if (!pairs.empty()) {
+    *equivalences =
+        std::make_shared<meshing::LabelEquivalences>(std::move(pairs));
+  }
+  return true;
+}
+
+// Converts `argument`, None or an array-like of object ids, to the sorted set of
+// allowed object ids, set to nullptr if None.  Arrays of other integer types,
+// e.g. int64, are cast like Python ints.  Returns false with an exception set
+// on failure.
+static bool ConvertAllowedIds(
+    PyObject* argument, std::shared_ptr<const std::vector<uint64_t>>* ids) {
+  ids->reset();
+  if (argument == Py_None) return true;
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(
+      PyArray_FROMANY(argument, NPY_UINT64, 0, 1,
+                      NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST));
+  if (!array) {
+    return false;
+  }
+  const uint64_t* data = static_cast<const uint64_t*>(PyArray_DATA(array));
+  auto sorted_ids =
+      std::make_shared<std::vector<uint64_t>>(data, data + PyArray_SIZE(array));
+  Py_DECREF(array);
+  std::sort(sorted_ids->begin(), sorted_ids->end());
+  sorted_ids->erase(std::unique(sorted_ids->begin(), sorted_ids->end()),
+                    sorted_ids->end());
+  *ids = std::move(sorted_ids);
+  return true;
+}
+
 static int tp_init(Obj* self, PyObject* args, PyObject* kwds) {
   PyObject* array_argument;
   float voxel_size[3];
   float offset[3];
   meshing::SimplifyOptions simplify_options;
+  meshing::MeshingOptions meshing_options;
   int lock_boundary_vertices = simplify_options.lock_boundary_vertices;
+  int lazy = meshing_options.lazy;
+  int optimize_vertex_cache = meshing_options.optimize_vertex_cache;
+  int compact_meshes = meshing_options.compact_meshes;
+  int relayout_labels = meshing_options.relayout_labels;
+  int shrink_unsimplified_meshes = meshing_options.shrink_unsimplified_meshes;
+  int release_memory_after_build = meshing_options.release_memory_after_build;
+  int voxel_faces = meshing_options.voxel_faces;
   static const char* kw_list[] = {"data",
                                   "voxel_size",
                                   "offset",
                                   "max_quadrics_error",
                                   "max_normal_angle_deviation",
                                   "lock_boundary_vertices",
+                                  "lazy",
+                                  "block_size",
+                                  "num_lods",
+                                  "lod_quadrics_error_factor",
+                                  "max_cache_bytes",
+                                  "encoding",
+                                  "simplifier",
+                                  "max_triangles",
+                                  "max_triangle_ratio",
+                                  "max_mesh_bytes",
+                                  "partition_triangles",
+                                  "optimize_vertex_cache",
+                                  "num_threads",
+                                  "equivalences",
+                                  "object_ids",
+                                  "compact_meshes",
+                                  "meshing_engine",
+                                  "cache_directory",
+                                  "vertex_normals",
+                                  "background",
+                                  "simplifier_queue",
+                                  "preview_factor",
+                                  "relayout_labels",
+                                  "shrink_unsimplified_meshes",
+                                  "release_memory_after_build",
+                                  "voxel_faces",
                                   nullptr};
+  long long block_size[3] = {0, 0, 0};
+  long long preview_factor[3] = {0, 0, 0};
+  long long max_cache_bytes = 0;
+  const char* encoding = "raw";
+  const char* simplifier = "openmesh";
+  const char* simplifier_queue = "indexed";
+  const char* meshing_engine = "marching_cubes";
+  const char* cache_directory = "";
+  const char* vertex_normals = "none";
+  long long max_triangles = 0;
+  long long max_mesh_bytes = 0;
+  long long partition_triangles = 0;
+  int num_threads = -1;
+  int background = meshing_options.background;
+  PyObject* equivalences_argument = Py_None;
+  PyObject* object_ids_argument = Py_None;
   if (!PyArg_ParseTupleAndKeywords(
-          args, kwds, "O(fff)(fff)|ddi:__init__", const_cast<char**>(kw_list),
-          &array_argument, voxel_size, voxel_size + 1, voxel_size + 2, offset,
-          offset + 1, offset + 2, &simplify_options.max_quadrics_error,
+          args, kwds,
+          "O(fff)(fff)|ddii(LLL)idLssLdLLiiOOisssis(LLL)iiii:__init__",
+          const_cast<char**>(kw_list), &array_argument, voxel_size,
+          voxel_size + 1, voxel_size + 2, offset, offset + 1, offset + 2,
+          &simplify_options.max_quadrics_error,
           &simplify_options.max_normal_angle_deviation,
-          &lock_boundary_vertices)) {
+          &lock_boundary_vertices, &lazy, block_size, block_size + 1,
+          block_size + 2, &simplify_options.num_lods,
+          &simplify_options.lod_quadrics_error_factor, &max_cache_bytes,
+          &encoding, &simplifier, &max_triangles,
+          &simplify_options.max_triangle_ratio, &max_mesh_bytes,
+          &partition_triangles, &optimize_vertex_cache, &num_threads,
+          &equivalences_argument, &object_ids_argument, &compact_meshes,
+          &meshing_engine, &cache_directory, &vertex_normals, &background,
+          &simplifier_queue, preview_factor, preview_factor + 1,
+          preview_factor + 2, &relayout_labels, &shrink_unsimplified_meshes,
+          &release_memory_after_build, &voxel_faces)) {
+    return -1;
+  }
+  if (simplify_options.num_lods < 1) {
+    PyErr_SetString(PyExc_ValueError, "num_lods must be positive");
+    return -1;
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (block_size[i] < 0 || (block_size[i] == 0) != (block_size[0] == 0)) {
+      PyErr_SetString(PyExc_ValueError,
+                      "block_size must consist of 3 positive integers");
+      return -1;
+    }
+    meshing_options.block_size[i] = block_size[i];
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (preview_factor[i] < 0 ||
+        (preview_factor[i] == 0) != (preview_factor[0] == 0)) {
+      PyErr_SetString(PyExc_ValueError,
+                      "preview_factor must consist of 3 positive integers");
+      return -1;
+    }
+    meshing_options.preview_factor[i] = preview_factor[i];
+  }
+  if (max_cache_bytes < 0) {
+    PyErr_SetString(PyExc_ValueError, "max_cache_bytes must be non-negative");
+    return -1;
+  }
+  meshing_options.max_cache_bytes = static_cast<size_t>(max_cache_bytes);
+  if (max_triangles < 0 || simplify_options.max_triangle_ratio < 0 ||
+      max_mesh_bytes < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "max_triangles, max_triangle_ratio and max_mesh_bytes "
+                    "must be non-negative");
+    return -1;
+  }
+  simplify_options.max_triangles = static_cast<size_t>(max_triangles);
+  simplify_options.max_mesh_bytes = static_cast<size_t>(max_mesh_bytes);
+  if (partition_triangles < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "partition_triangles must be non-negative");
+    return -1;
+  }
+  simplify_options.partition_triangles =
+      static_cast<size_t>(partition_triangles);
+  if (!std::strcmp(encoding, "raw")) {
+    meshing_options.encoding = meshing::MeshEncoding::kRaw;
+  } else if (!std::strcmp(encoding, "quantized16")) {
+    meshing_options.encoding = meshing::MeshEncoding::kQuantized16;
+  } else if (!std::strcmp(encoding, "quantized10")) {
+    meshing_options.encoding = meshing::MeshEncoding::kQuantized10;
+  } else {
+    PyErr_SetString(PyExc_ValueError,
+                    "encoding must be one of 'raw', 'quantized16', or "
+                    "'quantized10'");
+    return -1;
+  }
+  if (!std::strcmp(vertex_normals, "none")) {
+    meshing_options.vertex_normals = meshing::VertexNormalEncoding::kNone;
+  } else if (!std::strcmp(vertex_normals, "octahedral8")) {
+    meshing_options.vertex_normals =
+        meshing::VertexNormalEncoding::kOctahedral8;
+  } else if (!std::strcmp(vertex_normals, "octahedral16")) {
+    meshing_options.vertex_normals =
+        meshing::VertexNormalEncoding::kOctahedral16;
+  } else {
+    PyErr_SetString(PyExc_ValueError,
+                    "vertex_normals must be one of 'none', 'octahedral8', or "
+                    "'octahedral16'");
+    return -1;
+  }
+  if (!std::strcmp(simplifier, "openmesh")) {
+    simplify_options.engine = meshing::SimplifierEngine::kOpenMesh;
+  } else if (!std::strcmp(simplifier, "flat")) {
+    simplify_options.engine = meshing::SimplifierEngine::kFlatArrays;
+  } else {
+    PyErr_SetString(PyExc_ValueError,
+                    "simplifier must be one of 'openmesh' or 'flat'");
+    return -1;
+  }
+  if (!std::strcmp(simplifier_queue, "indexed")) {
+    simplify_options.queue = meshing::SimplifierQueue::kIndexedHeap;
+  } else if (!std::strcmp(simplifier_queue, "lazy")) {
+    simplify_options.queue = meshing::SimplifierQueue::kLazyHeap;
+  } else {
+    PyErr_SetString(PyExc_ValueError,
+                    "simplifier_queue must be one of 'indexed' or 'lazy'");
+    return -1;
+  }
+  if (simplify_options.partition_triangles != 0 &&
+      simplify_options.engine != meshing::SimplifierEngine::kFlatArrays) {
+    PyErr_SetString(PyExc_ValueError,
+                    "partition_triangles requires simplifier='flat'");
+    return -1;
+  }
+  if (!std::strcmp(meshing_engine, "marching_cubes")) {
+    meshing_options.engine = meshing::MeshingEngine::kMarchingCubes;
+  } else if (!std::strcmp(meshing_engine, "flying_edges")) {
+    meshing_options.engine = meshing::MeshingEngine::kFlyingEdges;
+  } else {
+    PyErr_SetString(PyExc_ValueError,
+                    "meshing_engine must be one of 'marching_cubes' or "
+                    "'flying_edges'");
     return -1;
   }
   simplify_options.lock_boundary_vertices =
       static_cast<bool>(lock_boundary_vertices);
-  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(PyArray_CheckFromAny(
-      array_argument, /*dtype=*/nullptr, /*min_depth=*/3, /*max_depth=*/3,
-      /*requirements=*/NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED,
-      /*context=*/nullptr));
-  if (!array) {
+  if (num_threads < -1) {
+    PyErr_SetString(PyExc_ValueError, "num_threads must be non-negative");
     return -1;
   }
-  auto* descr = PyArray_DESCR(array);
-  if ((descr->kind != 'i' && descr->kind != 'u') ||
-      (descr->elsize != 1 && descr->elsize != 2 && descr->elsize != 4 &&
-       descr->elsize != 8)) {
-    Py_DECREF(array);
-    PyErr_SetString(PyExc_ValueError,
-                    "ndarray must have 8-, 16-, 32-, or 64-bit integer type");
+  meshing_options.num_threads =
+      num_threads == -1 ? default_num_threads.load() : num_threads;
+  meshing_options.lazy = static_cast<bool>(lazy);
+  meshing_options.optimize_vertex_cache =
+      static_cast<bool>(optimize_vertex_cache);
+  meshing_options.compact_meshes = static_cast<bool>(compact_meshes);
+  meshing_options.relayout_labels = static_cast<bool>(relayout_labels);
+  meshing_options.shrink_unsimplified_meshes =
+      static_cast<bool>(shrink_unsimplified_meshes);
+  meshing_options.release_memory_after_build =
+      static_cast<bool>(release_memory_after_build);
+  meshing_options.voxel_faces = static_cast<bool>(voxel_faces);
+  meshing_options.cache_directory = cache_directory;
+  meshing_options.background = static_cast<bool>(background);
+  if (!ConvertEquivalences(equivalences_argument,
+                           &meshing_options.equivalences) ||
+      !ConvertAllowedIds(object_ids_argument, &meshing_options.allowed_ids)) {
     return -1;
   }
-
+  PyArrayObject* array = ConvertLabelArray(array_argument);
+  if (!array) {
+    return -1;
+  }
+  auto* descr = PyArray_DESCR(array);
   npy_intp* dims = PyArray_DIMS(array);
   int64_t size_int64[] = {dims[2], dims[1], dims[0]};
-  npy_intp* strides_in_bytes = PyArray_STRIDES(array);
-  int64_t strides_in_elements[] = {strides_in_bytes[2] / descr->elsize,
-                                   strides_in_bytes[1] / descr->elsize,
-                                   strides_in_bytes[0] / descr->elsize};
+  int64_t strides_in_elements[3];
+  GetStridesInElements(array, strides_in_elements);
 
   meshing::OnDemandObjectMeshGenerator impl;
 
@@ -83,22 +584,26 @@ static int tp_init(Obj* self, PyObject* args, PyObject* kwds) {
     case 1:
       impl = meshing::OnDemandObjectMeshGenerator(
           static_cast<const uint8_t*>(PyArray_DATA(array)), size_int64,
-          strides_in_elements, voxel_size, offset, simplify_options);
+          strides_in_elements, voxel_size, offset, simplify_options,
+          meshing_options);
       break;
     case 2:
       impl = meshing::OnDemandObjectMeshGenerator(
           static_cast<const uint16_t*>(PyArray_DATA(array)), size_int64,
-          strides_in_elements, voxel_size, offset, simplify_options);
+          strides_in_elements, voxel_size, offset, simplify_options,
+          meshing_options);
       break;
     case 4:
       impl = meshing::OnDemandObjectMeshGenerator(
           static_cast<const uint32_t*>(PyArray_DATA(array)), size_int64,
-          strides_in_elements, voxel_size, offset, simplify_options);
+          strides_in_elements, voxel_size, offset, simplify_options,
+          meshing_options);
       break;
     case 8:
       impl = meshing::OnDemandObjectMeshGenerator(
           static_cast<const uint64_t*>(PyArray_DATA(array)), size_int64,
-          strides_in_elements, voxel_size, offset, simplify_options);
+          strides_in_elements, voxel_size, offset, simplify_options,
+          meshing_options);
       break;
   }
 
@@ -106,11 +611,26 @@ static int tp_init(Obj* self, PyObject* args, PyObject* kwds) {
 
   self->impl = impl;
 
-  Py_DECREF(array);
+  Py_CLEAR(self->data);
+  if (meshing_options.lazy || meshing_options.max_cache_bytes != 0 ||
+      meshing_options.background) {
+    // Transfer ownership of the reference to `self`.
+    self->data = reinterpret_cast<PyObject*>(array);
+  } else {
+    Py_DECREF(array);
+  }
   return 0;
 }
 
-static void tp_dealloc(Obj* obj) { obj->impl.~OnDemandObjectMeshGenerator(); }
+static void tp_dealloc(Obj* obj) {
+  // Destroying the last reference to the generator waits for a background
+  // build to stop.
+  Py_BEGIN_ALLOW_THREADS;
+  obj->impl.~OnDemandObjectMeshGenerator();
+  Py_END_ALLOW_THREADS;
+  Py_CLEAR(obj->data);
+  FreeObject(reinterpret_cast<PyObject*>(obj));
+}
 
 static PyObject* get_mesh(Obj* self, PyObject* args) {
   auto impl = self->impl;
@@ -119,93 +639,2900 @@ static PyObject* get_mesh(Obj* self, PyObject* args) {
     return nullptr;
   }
   uint64_t object_id;
-  if (!PyArg_ParseTuple(args, "K:get_mesh", &object_id)) {
+  int lod = 0;
+  if (!PyArg_ParseTuple(args, "K|i:get_mesh", &object_id, &lod)) {
+    return nullptr;
+  }
+  if (lod < 0 || lod >= impl.num_lods()) {
+    PyErr_SetString(PyExc_ValueError, "Invalid level of detail.");
     return nullptr;
   }
 
-  const std::string* encoded_mesh = nullptr;
+  std::shared_ptr<const std::string> encoded_mesh;
 
   Py_BEGIN_ALLOW_THREADS;
 
-  encoded_mesh = &self->impl.GetSimplifiedMesh(object_id);
+  // Use the local copy, which keeps the generator alive even if `self` is
+  // concurrently re-initialized.
+  encoded_mesh = impl.GetSimplifiedMesh(object_id, lod);
 
   Py_END_ALLOW_THREADS;
 
-  if (encoded_mesh->empty()) {
-    Py_RETURN_NONE;
-  }
-  return PyBytes_FromStringAndSize(encoded_mesh->data(), encoded_mesh->size());
+  return pywrap_encoded_mesh::MakeMemoryView(reinterpret_cast<PyObject*>(self),
+                                             std::move(encoded_mesh));
 }
 
-static PyMethodDef methods[] = {
-    {"get_mesh", reinterpret_cast<PyCFunction>(&get_mesh), METH_VARARGS,
-     "Retrieve the encoded mesh for an object."},
-    {NULL} /* Sentinel */
-};
+static PyObject* get_gzipped_mesh(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  uint64_t object_id;
+  int lod = 0;
+  if (!PyArg_ParseTuple(args, "K|i:get_gzipped_mesh", &object_id, &lod)) {
+    return nullptr;
+  }
+  if (lod < 0 || lod >= impl.num_lods()) {
+    PyErr_SetString(PyExc_ValueError, "Invalid level of detail.");
+    return nullptr;
+  }
+  if (!sharding::HaveGzip()) {
+    PyErr_SetString(PyExc_ValueError,
+                    "gzip compression requires zlib, which is not available");
+    return nullptr;
+  }
 
-static void register_type(PyObject* module) {
-  static PyTypeObject t = {
-      PyVarObject_HEAD_INIT(NULL, 0)             /*ob_size*/
-      MODULE_NAME ".OnDemandObjectMeshGenerator", /*tp_name*/
-      sizeof(Obj),                                /*tp_basicsize*/
-  };
-  t.tp_flags = Py_TPFLAGS_DEFAULT;
-  t.tp_init = reinterpret_cast<initproc>(&tp_init);
-  t.tp_new = tp_new;
-  t.tp_dealloc = reinterpret_cast<void (*)(PyObject*)>(&tp_dealloc);
-  t.tp_doc = "OnDemandObjectMeshGenerator";
-  t.tp_methods = methods;
-  if (PyType_Ready(&t) < 0) return;
-  Py_INCREF(&t);
-  PyModule_AddObject(module, "OnDemandObjectMeshGenerator",
-                     reinterpret_cast<PyObject*>(&t));
+  std::shared_ptr<const std::string> encoded_mesh;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  encoded_mesh = impl.GetGzippedMesh(object_id, lod);
+
+  Py_END_ALLOW_THREADS;
+
+  return pywrap_encoded_mesh::MakeMemoryView(reinterpret_cast<PyObject*>(self),
+                                             std::move(encoded_mesh));
 }
-}  // namespace pywrap_on_demand_object_mesh_generator
 
+static PyObject* get_preview_mesh(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  uint64_t object_id;
+  if (!PyArg_ParseTuple(args, "K:get_preview_mesh", &object_id)) {
+    return nullptr;
+  }
+
+  std::shared_ptr<const std::string> encoded_mesh;
 
-// The following Python2/3 compatibility code was derived from py3c.
-// Copyright (c) 2015, Red Hat, Inc. and/or its affiliates
-// Licensed under the MIT license.
-#if PY_MAJOR_VERSION >= 3
-#define MODULE_INIT_FUNC(name) \
-  extern "C" DLL_PUBLIC PyObject * PyInit_ ## name(void)
-#else
-#define PyModuleDef_HEAD_INIT 0
+  Py_BEGIN_ALLOW_THREADS;
 
-typedef struct PyModuleDef {
-    int m_base;
-    const char* m_name;
-    const char* m_doc;
-    Py_ssize_t m_size;
-    PyMethodDef *m_methods;
-} PyModuleDef;
+  encoded_mesh = impl.GetPreviewMesh(object_id);
+
+  Py_END_ALLOW_THREADS;
 
-#define PyModule_Create(def) \
-    Py_InitModule3((def)->m_name, (def)->m_methods, (def)->m_doc)
+  return pywrap_encoded_mesh::MakeMemoryView(reinterpret_cast<PyObject*>(self),
+                                             std::move(encoded_mesh));
+}
 
-#define MODULE_INIT_FUNC(name) \
-    static PyObject *PyInit_ ## name(void); \
-    extern "C" DLL_PUBLIC void init ## name(void) { PyInit_ ## name(); } \
-    static PyObject *PyInit_ ## name(void)
+static PyObject* request_mesh(Obj* self, PyObject* args, PyObject* kwds) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  uint64_t object_id;
+  int lod;
+  PyObject* callback;
+  int priority = 0;
+  int gzip = 0;
+  static const char* kw_list[] = {"object_id", "lod",  "callback",
+                                  "priority",  "gzip", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "KiO|ip:request_mesh",
+                                   const_cast<char**>(kw_list), &object_id,
+                                   &lod, &callback, &priority, &gzip)) {
+    return nullptr;
+  }
+  if (lod < 0 || lod >= impl.num_lods()) {
+    PyErr_SetString(PyExc_ValueError, "Invalid level of detail.");
+    return nullptr;
+  }
+  if (gzip && !sharding::HaveGzip()) {
+    PyErr_SetString(PyExc_ValueError,
+                    "gzip compression requires zlib, which is not available");
+    return nullptr;
+  }
+  if (!PyCallable_Check(callback)) {
+    PyErr_SetString(PyExc_TypeError, "callback must be callable");
+    return nullptr;
+  }
+#if NEUROGLANCER_MODULE_STATE
+  if (!CheckMainInterpreter("request_mesh")) return nullptr;
+#endif
+#if PY_VERSION_HEX < 0x03070000
+  // Worker threads acquire the GIL to call the callback.
+  PyEval_InitThreads();
+#endif
+  // Retain `self`, which retains the label array from which the mesh may be
+  // computed, and `callback` until the callback has been called.
+  Py_INCREF(self);
+  Py_INCREF(callback);
+  impl.RequestSimplifiedMesh(
+      object_id, lod, priority,
+      [self, callback](std::shared_ptr<const std::string> encoded_mesh) {
+        PyGILState_STATE gil_state = PyGILState_Ensure();
+        PyObject* view = pywrap_encoded_mesh::MakeMemoryView(
+            reinterpret_cast<PyObject*>(self), std::move(encoded_mesh));
+        PyObject* result =
+            view ? PyObject_CallFunctionObjArgs(callback, view, nullptr)
+                 : nullptr;
+        if (result) {
+          Py_DECREF(result);
+        } else {
+          // There is no caller to which to propagate the exception.
+          PyErr_WriteUnraisable(callback);
+        }
+        Py_XDECREF(view);
+        Py_DECREF(callback);
+        Py_DECREF(self);
+        PyGILState_Release(gil_state);
+      },
+      gzip != 0);
+  Py_RETURN_NONE;
+}
 
+static PyObject* request_mesh_fragments(Obj* self, PyObject* args,
+                                        PyObject* kwds) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  uint64_t object_id;
+  int lod;
+  PyObject* callback;
+  unsigned long long fragment_triangles;
+  int priority = 0;
+  static const char* kw_list[] = {"object_id", "lod", "callback",
+                                  "fragment_triangles", "priority", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "KiOK|i:request_mesh_fragments",
+                                   const_cast<char**>(kw_list), &object_id,
+                                   &lod, &callback, &fragment_triangles,
+                                   &priority)) {
+    return nullptr;
+  }
+  if (lod < 0 || lod >= impl.num_lods()) {
+    PyErr_SetString(PyExc_ValueError, "Invalid level of detail.");
+    return nullptr;
+  }
+  if (!PyCallable_Check(callback)) {
+    PyErr_SetString(PyExc_TypeError, "callback must be callable");
+    return nullptr;
+  }
+#if NEUROGLANCER_MODULE_STATE
+  if (!CheckMainInterpreter("request_mesh_fragments")) return nullptr;
+#endif
+#if PY_VERSION_HEX < 0x03070000
+  PyEval_InitThreads();
 #endif
+  Py_INCREF(self);
+  Py_INCREF(callback);
+  impl.RequestMeshFragments(
+      object_id, lod, priority, fragment_triangles,
+      [self, callback](std::shared_ptr<const std::string> fragment) {
+        PyGILState_STATE gil_state = PyGILState_Ensure();
+        const bool last = !fragment;
+        PyObject* view;
+        if (last) {
+          view = Py_None;
+          Py_INCREF(view);
+        } else {
+          view = pywrap_encoded_mesh::MakeMemoryView(
+              reinterpret_cast<PyObject*>(self), std::move(fragment));
+        }
+        PyObject* result =
+            view ? PyObject_CallFunctionObjArgs(callback, view, nullptr)
+                 : nullptr;
+        if (result) {
+          Py_DECREF(result);
+        } else {
+          PyErr_WriteUnraisable(callback);
+        }
+        Py_XDECREF(view);
+        if (last) {
+          Py_DECREF(callback);
+          Py_DECREF(self);
+        }
+        PyGILState_Release(gil_state);
+      });
+  Py_RETURN_NONE;
+}
+
+static PyObject* get_meshes(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  PyObject* ids_argument;
+  int lod = 0;
+  if (!PyArg_ParseTuple(args, "O|i:get_meshes", &ids_argument, &lod)) {
+    return nullptr;
+  }
+  if (lod < 0 || lod >= impl.num_lods()) {
+    PyErr_SetString(PyExc_ValueError, "Invalid level of detail.");
+    return nullptr;
+  }
+  PyObject* ids_sequence =
+      PySequence_Fast(ids_argument, "object ids must be iterable");
+  if (!ids_sequence) {
+    return nullptr;
+  }
+  const Py_ssize_t num_objects = PySequence_Fast_GET_SIZE(ids_sequence);
+  std::vector<uint64_t> object_ids(num_objects);
+  for (Py_ssize_t i = 0; i < num_objects; ++i) {
+    object_ids[i] = PyLong_AsUnsignedLongLong(
+        PySequence_Fast_GET_ITEM(ids_sequence, i));
+    if (PyErr_Occurred()) {
+      Py_DECREF(ids_sequence);
+      return nullptr;
+    }
+  }
+  Py_DECREF(ids_sequence);
 
+  std::vector<std::shared_ptr<const std::string>> encoded_meshes(num_objects);
 
-MODULE_INIT_FUNC(_neuroglancer) {
-  static PyMethodDef module_methods[] = {
-      {NULL} /* Sentinel */
-  };
-  static struct PyModuleDef moduledef = {
-    PyModuleDef_HEAD_INIT,
-    "_neuroglancer", /* m_name */
-    "Neuroglancer C extension module.", /* m_doc */
-    -1, /* m_size */
-    module_methods
-  };
-  import_array1(nullptr);
-  PyObject* m = PyModule_Create(&moduledef);
-  pywrap_on_demand_object_mesh_generator::register_type(m);
-  return m;
+  Py_BEGIN_ALLOW_THREADS;
+
+  impl.GetSimplifiedMeshes(object_ids.data(), object_ids.size(), lod,
+                           encoded_meshes.data());
+
+  Py_END_ALLOW_THREADS;
+
+  PyObject* result = PyDict_New();
+  if (!result) {
+    return nullptr;
+  }
+  for (Py_ssize_t i = 0; i < num_objects; ++i) {
+    PyObject* key = PyLong_FromUnsignedLongLong(object_ids[i]);
+    PyObject* value = pywrap_encoded_mesh::MakeMemoryView(
+        reinterpret_cast<PyObject*>(self), std::move(encoded_meshes[i]));
+    if (!key || !value || PyDict_SetItem(result, key, value) < 0) {
+      Py_XDECREF(key);
+      Py_XDECREF(value);
+      Py_DECREF(result);
+      return nullptr;
+    }
+    Py_DECREF(key);
+    Py_DECREF(value);
+  }
+  return result;
+}
+
+static PyObject* update_region(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  PyObject* array_argument;
+  long long region_start[3], region_end[3];
+  if (!PyArg_ParseTuple(args, "O(LLL)(LLL):update_region", &array_argument,
+                        region_start, region_start + 1, region_start + 2,
+                        region_end, region_end + 1, region_end + 2)) {
+    return nullptr;
+  }
+  PyArrayObject* array = ConvertLabelArray(array_argument);
+  if (!array) {
+    return nullptr;
+  }
+  npy_intp* dims = PyArray_DIMS(array);
+  const auto size = impl.volume_size();
+  if (dims[2] != size[0] || dims[1] != size[1] || dims[0] != size[2]) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError,
+                    "ndarray must have the same shape as the original data");
+    return nullptr;
+  }
+  int64_t strides_in_elements[3];
+  GetStridesInElements(array, strides_in_elements);
+  int64_t start_int64[3], end_int64[3];
+  for (int i = 0; i < 3; ++i) {
+    start_int64[i] = region_start[i];
+    end_int64[i] = region_end[i];
+  }
+
+  meshing::OnDemandObjectMeshGenerator updated_impl;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  switch (PyArray_DESCR(array)->elsize) {
+    case 1:
+      updated_impl = impl.UpdateRegion(
+          static_cast<const uint8_t*>(PyArray_DATA(array)),
+          strides_in_elements, start_int64, end_int64);
+      break;
+    case 2:
+      updated_impl = impl.UpdateRegion(
+          static_cast<const uint16_t*>(PyArray_DATA(array)),
+          strides_in_elements, start_int64, end_int64);
+      break;
+    case 4:
+      updated_impl = impl.UpdateRegion(
+          static_cast<const uint32_t*>(PyArray_DATA(array)),
+          strides_in_elements, start_int64, end_int64);
+      break;
+    case 8:
+      updated_impl = impl.UpdateRegion(
+          static_cast<const uint64_t*>(PyArray_DATA(array)),
+          strides_in_elements, start_int64, end_int64);
+      break;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (!updated_impl) {
+    Py_DECREF(array);
+    Py_RETURN_NONE;
+  }
+  Obj* result = reinterpret_cast<Obj*>(tp_new(Py_TYPE(self), nullptr, nullptr));
+  if (!result) {
+    Py_DECREF(array);
+    return nullptr;
+  }
+  result->impl = updated_impl;
+  // Meshes of the updated generator are computed from the array on demand.
+  result->data = reinterpret_cast<PyObject*>(array);
+  return reinterpret_cast<PyObject*>(result);
+}
+
+static PyObject* update_equivalences(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  PyObject* array_argument;
+  PyObject* equivalences_argument;
+  if (!PyArg_ParseTuple(args, "OO:update_equivalences", &array_argument,
+                        &equivalences_argument)) {
+    return nullptr;
+  }
+  std::shared_ptr<const meshing::LabelEquivalences> equivalences;
+  if (!ConvertEquivalences(equivalences_argument, &equivalences)) {
+    return nullptr;
+  }
+  PyArrayObject* array = ConvertLabelArray(array_argument);
+  if (!array) {
+    return nullptr;
+  }
+  npy_intp* dims = PyArray_DIMS(array);
+  const auto size = impl.volume_size();
+  if (dims[2] != size[0] || dims[1] != size[1] || dims[0] != size[2]) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError,
+                    "ndarray must have the same shape as the original data");
+    return nullptr;
+  }
+  int64_t strides_in_elements[3];
+  GetStridesInElements(array, strides_in_elements);
+
+  meshing::OnDemandObjectMeshGenerator updated_impl;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  switch (PyArray_DESCR(array)->elsize) {
+    case 1:
+      updated_impl = impl.UpdateEquivalences(
+          static_cast<const uint8_t*>(PyArray_DATA(array)),
+          strides_in_elements, equivalences);
+      break;
+    case 2:
+      updated_impl = impl.UpdateEquivalences(
+          static_cast<const uint16_t*>(PyArray_DATA(array)),
+          strides_in_elements, equivalences);
+      break;
+    case 4:
+      updated_impl = impl.UpdateEquivalences(
+          static_cast<const uint32_t*>(PyArray_DATA(array)),
+          strides_in_elements, equivalences);
+      break;
+    case 8:
+      updated_impl = impl.UpdateEquivalences(
+          static_cast<const uint64_t*>(PyArray_DATA(array)),
+          strides_in_elements, equivalences);
+      break;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (!updated_impl) {
+    Py_DECREF(array);
+    Py_RETURN_NONE;
+  }
+  Obj* result = reinterpret_cast<Obj*>(tp_new(Py_TYPE(self), nullptr, nullptr));
+  if (!result) {
+    Py_DECREF(array);
+    return nullptr;
+  }
+  result->impl = updated_impl;
+  // Meshes of the updated generator are computed from the array on demand.
+  result->data = reinterpret_cast<PyObject*>(array);
+  return reinterpret_cast<PyObject*>(result);
+}
+
+static PyObject* release_unsimplified_meshes(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  PyObject* array_argument;
+  if (!PyArg_ParseTuple(args, "O:release_unsimplified_meshes",
+                        &array_argument)) {
+    return nullptr;
+  }
+  PyArrayObject* array = ConvertLabelArray(array_argument);
+  if (!array) {
+    return nullptr;
+  }
+  npy_intp* dims = PyArray_DIMS(array);
+  const auto size = impl.volume_size();
+  if (dims[2] != size[0] || dims[1] != size[1] || dims[0] != size[2]) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError,
+                    "ndarray must have the same shape as the original data");
+    return nullptr;
+  }
+  int64_t strides_in_elements[3];
+  GetStridesInElements(array, strides_in_elements);
+
+  meshing::OnDemandObjectMeshGenerator updated_impl;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  switch (PyArray_DESCR(array)->elsize) {
+    case 1:
+      updated_impl = impl.ReleaseUnsimplifiedMeshes(
+          static_cast<const uint8_t*>(PyArray_DATA(array)),
+          strides_in_elements);
+      break;
+    case 2:
+      updated_impl = impl.ReleaseUnsimplifiedMeshes(
+          static_cast<const uint16_t*>(PyArray_DATA(array)),
+          strides_in_elements);
+      break;
+    case 4:
+      updated_impl = impl.ReleaseUnsimplifiedMeshes(
+          static_cast<const uint32_t*>(PyArray_DATA(array)),
+          strides_in_elements);
+      break;
+    case 8:
+      updated_impl = impl.ReleaseUnsimplifiedMeshes(
+          static_cast<const uint64_t*>(PyArray_DATA(array)),
+          strides_in_elements);
+      break;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (!updated_impl) {
+    Py_DECREF(array);
+    Py_RETURN_NONE;
+  }
+  Obj* result = reinterpret_cast<Obj*>(tp_new(Py_TYPE(self), nullptr, nullptr));
+  if (!result) {
+    Py_DECREF(array);
+    return nullptr;
+  }
+  result->impl = updated_impl;
+  // Meshes of the new generator are computed from the array on demand.
+  result->data = reinterpret_cast<PyObject*>(array);
+  return reinterpret_cast<PyObject*>(result);
+}
+
+static PyObject* precompute_all(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  int num_threads = 0;
+  if (!PyArg_ParseTuple(args, "|i:precompute_all", &num_threads)) {
+    return nullptr;
+  }
+  if (num_threads < 0) {
+    PyErr_SetString(PyExc_ValueError, "num_threads must be non-negative");
+    return nullptr;
+  }
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  impl.PrecomputeAll(num_threads);
+
+  Py_END_ALLOW_THREADS;
+
+  Py_RETURN_NONE;
+}
+
+static PyObject* precompute_in_background(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+#if NEUROGLANCER_MODULE_STATE
+  if (!CheckMainInterpreter("precompute_in_background")) return nullptr;
+#endif
+#if PY_VERSION_HEX < 0x03070000
+  PyEval_InitThreads();
+#endif
+  // Retain `self`, which retains the label array from which the meshes may be
+  // computed, until the queued computations are done.
+  Py_INCREF(self);
+  auto done = [self] {
+    PyGILState_STATE gil_state = PyGILState_Ensure();
+    Py_DECREF(self);
+    PyGILState_Release(gil_state);
+  };
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  impl.PrecomputeInBackground(done);
+
+  Py_END_ALLOW_THREADS;
+
+  Py_RETURN_NONE;
+}
+
+static PyObject* cancel_background(Obj* self, PyObject* args) {
+  if (!self->impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  self->impl.CancelBackground();
+  Py_RETURN_NONE;
+}
+
+static PyObject* build_progress(Obj* self, PyObject* args) {
+  if (!self->impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  return PyFloat_FromDouble(self->impl.build_progress());
+}
+
+static PyObject* is_built(Obj* self, PyObject* args) {
+  if (!self->impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  return PyBool_FromLong(self->impl.IsBuilt());
+}
+
+static PyObject* build_cancelled(Obj* self, PyObject* args) {
+  if (!self->impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  return PyBool_FromLong(self->impl.build_cancelled());
+}
+
+static PyObject* cancel_build(Obj* self, PyObject* args) {
+  if (!self->impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  self->impl.CancelBuild();
+  Py_RETURN_NONE;
+}
+
+static PyObject* wait_until_built(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  impl.WaitUntilBuilt();
+
+  Py_END_ALLOW_THREADS;
+
+  return PyBool_FromLong(impl.IsBuilt());
+}
+
+static PyObject* get_cache_statistics(Obj* self, PyObject* args) {
+  if (!self->impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  const auto statistics = self->impl.GetCacheStatistics();
+  using ULL = unsigned long long;
+  return Py_BuildValue(
+      "{sKsKsKsKsKsKsKsK}", "hits", static_cast<ULL>(statistics.hits),
+      "misses", static_cast<ULL>(statistics.misses), "disk_hits",
+      static_cast<ULL>(statistics.disk_hits), "disk_writes",
+      static_cast<ULL>(statistics.disk_writes), "shared_hits",
+      static_cast<ULL>(statistics.shared_hits), "evictions",
+      static_cast<ULL>(statistics.evictions), "num_cached",
+      static_cast<ULL>(statistics.num_cached), "num_bytes",
+      static_cast<ULL>(statistics.num_bytes));
+}
+
+static PyObject* get_memory_statistics(Obj* self, PyObject* args) {
+  if (!self->impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  const auto statistics = self->impl.GetMemoryStatistics();
+  using ULL = unsigned long long;
+  return Py_BuildValue(
+      "{sKsKsKsKsKsKsKsKsK}", "construction_bytes",
+      static_cast<ULL>(statistics.construction_bytes),
+      "peak_construction_bytes",
+      static_cast<ULL>(statistics.peak_construction_bytes),
+      "unsimplified_bytes", static_cast<ULL>(statistics.unsimplified_bytes),
+      "cached_bytes", static_cast<ULL>(statistics.cached_bytes),
+      "preview_bytes", static_cast<ULL>(statistics.preview_bytes),
+      "simplification_bytes",
+      static_cast<ULL>(statistics.simplification_bytes),
+      "peak_simplification_bytes",
+      static_cast<ULL>(statistics.peak_simplification_bytes),
+      "label_copy_bytes", static_cast<ULL>(statistics.label_copy_bytes),
+      "index_bytes", static_cast<ULL>(statistics.index_bytes));
+}
+
+static PyObject* stats(Obj* self, PyObject* args) {
+  if (!self->impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  const auto m = self->impl.GetMeshingStatistics();
+  const auto c = self->impl.GetCacheStatistics();
+  using ULL = unsigned long long;
+  return Py_BuildValue(
+      "{sKsKsKsKsKsKsKsKsKsKsKsKsKsKsKsKsKsKsKsKsKsKsK}", "march_ns",
+      static_cast<ULL>(m.march_ns), "convert_ns",
+      static_cast<ULL>(m.convert_ns), "simplify_ns",
+      static_cast<ULL>(m.simplify_ns), "encode_ns",
+      static_cast<ULL>(m.encode_ns), "num_objects",
+      static_cast<ULL>(m.num_objects), "triangles_in",
+      static_cast<ULL>(m.triangles_in), "triangles_out",
+      static_cast<ULL>(m.triangles_out), "bytes_out",
+      static_cast<ULL>(m.bytes_out), "slowest_object_id",
+      static_cast<ULL>(m.slowest_object_id), "slowest_object_ns",
+      static_cast<ULL>(m.slowest_object_ns), "largest_object_id",
+      static_cast<ULL>(m.largest_object_id), "largest_object_triangles",
+      static_cast<ULL>(m.largest_object_triangles), "unsimplified_bytes",
+      static_cast<ULL>(m.unsimplified_bytes), "queued_requests",
+      static_cast<ULL>(m.queued_requests), "queued_background",
+      static_cast<ULL>(m.queued_background), "hits",
+      static_cast<ULL>(c.hits), "misses", static_cast<ULL>(c.misses),
+      "disk_hits", static_cast<ULL>(c.disk_hits), "disk_writes",
+      static_cast<ULL>(c.disk_writes), "shared_hits",
+      static_cast<ULL>(c.shared_hits), "evictions",
+      static_cast<ULL>(c.evictions), "num_cached",
+      static_cast<ULL>(c.num_cached), "num_bytes",
+      static_cast<ULL>(c.num_bytes));
+}
+
+static PyObject* export_precomputed(Obj* self, PyObject* args,
+                                    PyObject* kwds) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  const char* directory;
+  meshing::PrecomputedMeshExportOptions options;
+  long long max_pending_bytes = options.max_pending_bytes;
+  auto& fragment_size = options.fragment_size;
+  static const char* kw_list[] = {"directory",   "lod",
+                                  "fragment_size", "num_threads",
+                                  "num_writer_threads", "max_pending_bytes",
+                                  nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "s|i(fff)iiL:export_precomputed",
+          const_cast<char**>(kw_list), &directory, &options.lod,
+          &fragment_size[0], &fragment_size[1], &fragment_size[2],
+          &options.num_threads, &options.num_writer_threads,
+          &max_pending_bytes)) {
+    return nullptr;
+  }
+  if (options.lod < 0 || options.lod >= impl.num_lods()) {
+    PyErr_SetString(PyExc_ValueError, "Invalid level of detail.");
+    return nullptr;
+  }
+  if (impl.encoding() != meshing::MeshEncoding::kRaw ||
+      impl.vertex_normals() != meshing::VertexNormalEncoding::kNone) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Precomputed meshes require encoding='raw' and "
+                    "vertex_normals='none'.");
+    return nullptr;
+  }
+  if (options.num_threads < 0 || options.num_writer_threads < 1 ||
+      max_pending_bytes < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "num_threads and max_pending_bytes must be non-negative, "
+                    "and num_writer_threads must be positive");
+    return nullptr;
+  }
+  options.max_pending_bytes = static_cast<size_t>(max_pending_bytes);
+  const std::string directory_string = directory;
+  std::string error;
+  bool ok;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  ok = meshing::ExportPrecomputedMeshes(impl, directory_string, options,
+                                        &error);
+
+  Py_END_ALLOW_THREADS;
+
+  if (!ok) {
+    PyErr_SetString(PyExc_IOError, error.c_str());
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject* export_sharded_multiresolution(Obj* self, PyObject* args,
+                                                PyObject* kwds) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  const char* directory;
+  const char* hash = "murmurhash3_x86_128";
+  meshing::MultiresolutionMeshExportOptions options;
+  auto& sharding = options.sharding;
+  long long max_pending_bytes = options.max_pending_bytes;
+  static const char* kw_list[] = {"directory",
+                                  "vertex_quantization_bits",
+                                  "lod_scale_multiplier",
+                                  "preshift_bits",
+                                  "minishard_bits",
+                                  "shard_bits",
+                                  "hash",
+                                  "draco_compression_level",
+                                  "num_threads",
+                                  "max_pending_bytes",
+                                  nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "s|ifiiisiiL:export_sharded_multiresolution",
+          const_cast<char**>(kw_list), &directory,
+          &options.vertex_quantization_bits, &options.lod_scale_multiplier,
+          &sharding.preshift_bits, &sharding.minishard_bits,
+          &sharding.shard_bits, &hash, &options.draco_compression_level,
+          &options.num_threads, &max_pending_bytes)) {
+    return nullptr;
+  }
+  if (!pywrap_sharding::ParseShardingSpec(hash, "raw", "raw", &sharding)) {
+    return nullptr;
+  }
+  if (impl.encoding() != meshing::MeshEncoding::kRaw ||
+      impl.vertex_normals() != meshing::VertexNormalEncoding::kNone) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Multi-resolution meshes require encoding='raw' and "
+                    "vertex_normals='none'.");
+    return nullptr;
+  }
+  if (options.vertex_quantization_bits != 10 &&
+      options.vertex_quantization_bits != 16) {
+    PyErr_SetString(PyExc_ValueError,
+                    "vertex_quantization_bits must be 10 or 16");
+    return nullptr;
+  }
+  if (options.num_threads < 0 || max_pending_bytes < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "num_threads and max_pending_bytes must be non-negative");
+    return nullptr;
+  }
+  if (!meshing::HaveDracoEncoder()) {
+    PyErr_SetString(PyExc_NotImplementedError,
+                    "Multi-resolution meshes require the extension to be "
+                    "built with Draco (NEUROGLANCER_DRACO_DIR)");
+    return nullptr;
+  }
+  options.max_pending_bytes = static_cast<size_t>(max_pending_bytes);
+  const std::string directory_string = directory;
+  std::string error;
+  bool ok;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  ok = meshing::ExportShardedMultiresolutionMeshes(impl, directory_string,
+                                                   options, &error);
+
+  Py_END_ALLOW_THREADS;
+
+  if (!ok) {
+    PyErr_SetString(PyExc_IOError, error.c_str());
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
+// Returns a new reference to an uninitialized C-contiguous array, or null on
+// error.
+static PyArrayObject* MakeArray(int ndim, npy_intp* dims, int type_num) {
+  return reinterpret_cast<PyArrayObject*>(
+      PyArray_Empty(ndim, dims, PyArray_DescrFromType(type_num), 0));
+}
+
+static PyObject* object_statistics(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  std::vector<meshing::ObjectStatistics> statistics;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  statistics = impl.GetObjectStatistics();
+
+  Py_END_ALLOW_THREADS;
+
+  npy_intp dims[2] = {static_cast<npy_intp>(statistics.size()), 3};
+  PyArrayObject* object_ids = MakeArray(1, dims, NPY_UINT64);
+  PyArrayObject* start = MakeArray(2, dims, NPY_INT64);
+  PyArrayObject* end = MakeArray(2, dims, NPY_INT64);
+  PyArrayObject* num_voxels = MakeArray(1, dims, NPY_INT64);
+  PyArrayObject* num_boundary_cubes = MakeArray(1, dims, NPY_INT64);
+  PyArrayObject* surface_area = MakeArray(1, dims, NPY_FLOAT64);
+  PyObject* result = nullptr;
+  if (object_ids && start && end && num_voxels && num_boundary_cubes &&
+      surface_area) {
+    for (size_t i = 0; i < statistics.size(); ++i) {
+      const auto& object = statistics[i];
+      static_cast<uint64_t*>(PyArray_DATA(object_ids))[i] = object.object_id;
+      for (int j = 0; j < 3; ++j) {
+        static_cast<int64_t*>(PyArray_DATA(start))[i * 3 + j] = object.start[j];
+        static_cast<int64_t*>(PyArray_DATA(end))[i * 3 + j] = object.end[j];
+      }
+      static_cast<int64_t*>(PyArray_DATA(num_voxels))[i] = object.num_voxels;
+      static_cast<int64_t*>(PyArray_DATA(num_boundary_cubes))[i] =
+          object.num_boundary_cubes;
+      static_cast<double*>(PyArray_DATA(surface_area))[i] =
+          object.surface_area;
+    }
+    result = Py_BuildValue("{sOsOsOsOsOsO}", "object_ids", object_ids, "start",
+                           start, "end", end, "num_voxels", num_voxels,
+                           "num_boundary_cubes", num_boundary_cubes,
+                           "surface_area", surface_area);
+  }
+  Py_XDECREF(object_ids);
+  Py_XDECREF(start);
+  Py_XDECREF(end);
+  Py_XDECREF(num_voxels);
+  Py_XDECREF(num_boundary_cubes);
+  Py_XDECREF(surface_area);
+  return result;
+}
+
+static PyObject* set_default_num_threads(PyObject* module, PyObject* args) {
+  int num_threads;
+  if (!PyArg_ParseTuple(args, "i:set_default_mesh_num_threads",
+                        &num_threads)) {
+    return nullptr;
+  }
+  if (num_threads < 0) {
+    PyErr_SetString(PyExc_ValueError, "num_threads must be non-negative");
+    return nullptr;
+  }
+  default_num_threads = num_threads;
+  Py_RETURN_NONE;
+}
+
+static PyObject* get_default_num_threads(PyObject* module, PyObject* args) {
+  return PyLong_FromLong(default_num_threads.load());
+}
+
+static PyObject* set_shared_store_bytes(PyObject* module, PyObject* args) {
+  long long max_bytes;
+  if (!PyArg_ParseTuple(args, "L:set_shared_mesh_store_bytes", &max_bytes)) {
+    return nullptr;
+  }
+  if (max_bytes < 0) {
+    PyErr_SetString(PyExc_ValueError, "max_bytes must be non-negative");
+    return nullptr;
+  }
+  meshing::SetSharedMeshStoreCapacity(static_cast<size_t>(max_bytes));
+  Py_RETURN_NONE;
+}
+
+static PyObject* get_shared_store_bytes(PyObject* module, PyObject* args) {
+  return PyLong_FromUnsignedLongLong(
+      static_cast<unsigned long long>(meshing::GetSharedMeshStoreCapacity()));
+}
+
+static PyObject* set_shared_segment(PyObject* module, PyObject* args) {
+  const char* path;
+  long long max_bytes = 0;
+  if (!PyArg_ParseTuple(args, "z|L:set_shared_mesh_segment", &path,
+                        &max_bytes)) {
+    return nullptr;
+  }
+  if (max_bytes < 0) {
+    PyErr_SetString(PyExc_ValueError, "max_bytes must be non-negative");
+    return nullptr;
+  }
+  std::string error;
+  bool valid;
+  Py_BEGIN_ALLOW_THREADS;
+  valid = meshing::SetSharedMeshSegment(path ? path : "",
+                                        static_cast<size_t>(max_bytes), &error);
+  Py_END_ALLOW_THREADS;
+  if (!valid) {
+    PyErr_SetString(PyExc_ValueError, error.c_str());
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject* release_free_memory(PyObject* module, PyObject* args) {
+  bool released;
+  Py_BEGIN_ALLOW_THREADS;
+  released = meshing::ReleaseFreeMemory();
+  Py_END_ALLOW_THREADS;
+  return PyBool_FromLong(released);
+}
+
+static PyMethodDef methods[] = {
+    {"get_mesh", reinterpret_cast<PyCFunction>(&get_mesh), METH_VARARGS,
+     "Retrieve the encoded mesh for an object, optionally specifying the "
+     "level of detail, as a read-only memoryview, or None if there is no such "
+     "object.  During a background construction, waits only until the object "
+     "is meshed."},
+    {"get_gzipped_mesh", reinterpret_cast<PyCFunction>(&get_gzipped_mesh),
+     METH_VARARGS,
+     "Retrieve the encoded mesh for an object, as by get_mesh, compressed in "
+     "the gzip format, as a read-only memoryview, or None if there is no such "
+     "object.  The compressed meshes of all levels of detail are cached along "
+     "with the meshes.  Raises ValueError if zlib is not available."},
+    {"get_preview_mesh", reinterpret_cast<PyCFunction>(&get_preview_mesh),
+     METH_VARARGS,
+     "Retrieve the encoded preview mesh for an object, computed from the "
+     "labels downsampled by preview_factor, as a read-only memoryview, or "
+     "None if there is no preview or the object has no surface in it.  "
+     "During a background construction, waits only for the preview."},
+    {"get_meshes", reinterpret_cast<PyCFunction>(&get_meshes), METH_VARARGS,
+     "Retrieve the encoded meshes for a sequence of objects, computed in "
+     "parallel, as a dict mapping each object id to a read-only memoryview of "
+     "its encoded mesh, or None if there is no such object."},
+    {"request_mesh", reinterpret_cast<PyCFunction>(&request_mesh),
+     METH_VARARGS | METH_KEYWORDS,
+     "Request the encoded mesh for an object at the specified level of "
+     "detail without waiting for it to be computed: callback is called with "
+     "the same result as get_mesh, immediately if the mesh is cached and "
+     "otherwise from a native worker thread once it has been computed.  "
+     "Requests are served by a pool of worker threads shared by all "
+     "generators, higher priority (default 0) first.  If gzip is true, the "
+     "result is as by get_gzipped_mesh, also compressed on the worker "
+     "thread."},
+    {"request_mesh_fragments",
+     reinterpret_cast<PyCFunction>(&request_mesh_fragments),
+     METH_VARARGS | METH_KEYWORDS,
+     "Request the encoded mesh for an object at the specified level of "
+     "detail as independently encoded spatial fragments of about "
+     "fragment_triangles unsimplified triangles each, simplified with their "
+     "boundaries locked: callback is called from a native worker thread with "
+     "each fragment as soon as it is computed, and then with None.  A cached "
+     "mesh, or that of an object of at most fragment_triangles triangles, is "
+     "passed as a single fragment, and no fragment is passed if there is no "
+     "mesh.  Requests are queued with request_mesh."},
+    {"update_region", reinterpret_cast<PyCFunction>(&update_region),
+     METH_VARARGS,
+     "Return a generator for updated data that differs from the original data "
+     "only within the region [start, end), specified in the reverse order of "
+     "the array dimensions, reusing the cached meshes of unaffected objects.  "
+     "Returns None if not supported by this generator."},
+    {"update_equivalences",
+     reinterpret_cast<PyCFunction>(&update_equivalences), METH_VARARGS,
+     "Return a generator for the same data, which must be passed again, under "
+     "new label equivalences, specified as a sequence of (label, object_id) "
+     "pairs or None, reusing the cached meshes of objects whose set of labels "
+     "is unchanged.  Returns None if not supported by this generator."},
+    {"release_unsimplified_meshes",
+     reinterpret_cast<PyCFunction>(&release_unsimplified_meshes),
+     METH_VARARGS,
+     "Return a generator for the same data, which must be passed again, that "
+     "retains none of the unsimplified meshes of this generator, sharing its "
+     "cached and preview meshes, and computes all other meshes from the data "
+     "on demand.  The memory of the unsimplified meshes is released once this "
+     "generator is no longer referenced.  Returns None if not supported by "
+     "this generator."},
+    {"precompute_all", reinterpret_cast<PyCFunction>(&precompute_all),
+     METH_VARARGS,
+     "Compute the meshes of all objects in parallel, largest first, using the "
+     "specified number of threads, or the number of hardware threads if 0."},
+    {"precompute_in_background",
+     reinterpret_cast<PyCFunction>(&precompute_in_background), METH_NOARGS,
+     "Queue the computation of the meshes of all objects, in the same order "
+     "as precompute_all, on the worker threads of request_mesh at a lower "
+     "priority than any request, and return immediately."},
+    {"cancel_background", reinterpret_cast<PyCFunction>(&cancel_background),
+     METH_NOARGS,
+     "Cancel the computations queued by precompute_in_background that have "
+     "not yet started."},
+    {"build_progress", reinterpret_cast<PyCFunction>(&build_progress),
+     METH_NOARGS,
+     "Return the fraction in [0, 1] of the construction of a generator "
+     "created with background=True that is done, counted in z planes "
+     "scanned and marched, or 1 if it is built."},
+    {"is_built", reinterpret_cast<PyCFunction>(&is_built), METH_NOARGS,
+     "Return whether construction has completed without being cancelled."},
+    {"cancel_build", reinterpret_cast<PyCFunction>(&cancel_build),
+     METH_NOARGS,
+     "Stop a background construction at the next z slab.  The meshes of "
+     "objects completed before cancellation remain available; other meshes "
+     "are empty and update_region and update_equivalences return None."},
+    {"build_cancelled", reinterpret_cast<PyCFunction>(&build_cancelled),
+     METH_NOARGS,
+     "Return whether a background construction stopped due to cancel_build."},
+    {"wait_until_built", reinterpret_cast<PyCFunction>(&wait_until_built),
+     METH_NOARGS,
+     "Wait for a background construction to complete or stop, and return "
+     "is_built()."},
+    {"get_cache_statistics",
+     reinterpret_cast<PyCFunction>(&get_cache_statistics), METH_NOARGS,
+     "Return a dict of mesh cache hit, miss, and eviction counts, and the "
+     "number and total encoded size of the cached meshes."},
+    {"get_memory_statistics",
+     reinterpret_cast<PyCFunction>(&get_memory_statistics), METH_NOARGS,
+     "Return a dict of the memory currently retained by the generator, in "
+     "bytes: the working memory of the march at construction "
+     "(construction_bytes) and its peak, the unsimplified meshes not yet "
+     "simplified (unsimplified_bytes), the cached meshes including gzipped "
+     "copies (cached_bytes), the preview meshes (preview_bytes), an estimate "
+     "of the temporaries of simplifications in progress "
+     "(simplification_bytes) and its peak, the relayout_labels copy "
+     "(label_copy_bytes), and the per-object indices (index_bytes).  "
+     "preview_bytes and index_bytes are 0 until construction is done."},
+    {"stats", reinterpret_cast<PyCFunction>(&stats), METH_NOARGS,
+     "Return a dict of cumulative meshing phase times in nanoseconds "
+     "(march_ns, convert_ns, simplify_ns, encode_ns), the number of objects "
+     "computed and their total input and output triangles and encoded bytes, "
+     "the slowest and largest objects, the memory retained by unsimplified "
+     "meshes (unsimplified_bytes), the numbers of queued requests and "
+     "background computations, and the mesh cache statistics."},
+    {"export_precomputed", reinterpret_cast<PyCFunction>(&export_precomputed),
+     METH_VARARGS | METH_KEYWORDS,
+     "Write the meshes of all objects at the specified level of detail "
+     "(default 0) to an existing directory in the legacy precomputed mesh "
+     "format, computing them with num_threads threads (default 0, meaning "
+     "the number of hardware threads) and writing the files with "
+     "num_writer_threads threads (default 4).  If fragment_size, a sequence "
+     "of 3 positive sizes in the units of voxel_size, is specified, each mesh "
+     "is split into fragments by a grid of cells of that size.  Computation "
+     "waits while more than max_pending_bytes of files await writing.  "
+     "Requires encoding='raw' and vertex_normals='none'."},
+    {"export_sharded_multiresolution",
+     reinterpret_cast<PyCFunction>(&export_sharded_multiresolution),
+     METH_VARARGS | METH_KEYWORDS,
+     "Write the meshes of all objects to an existing directory in the sharded "
+     "multi-resolution (neuroglancer_multilod_draco) format, with one level "
+     "of detail for each level of the generator, as Draco-encoded fragments "
+     "with vertex_quantization_bits (default 16) bits per coordinate.  The "
+     "sharding is specified by preshift_bits, minishard_bits, shard_bits "
+     "(default 0) and hash ('murmurhash3_x86_128' or 'identity').  Meshes are "
+     "computed with num_threads threads (default 0, meaning the number of "
+     "hardware threads), and computation waits while more than "
+     "max_pending_bytes of encoded objects await writing.  Requires "
+     "encoding='raw', vertex_normals='none' and an extension built with "
+     "Draco."},
+    {"object_statistics", reinterpret_cast<PyCFunction>(&object_statistics),
+     METH_NOARGS,
+     "Return a dict of per-object statistics gathered while scanning and "
+     "meshing the volume, as arrays in increasing order of object id: "
+     "object_ids; start and end, of shape (num_objects, 3), the half-open "
+     "bounding box of each object in voxels, in the reverse order of the array "
+     "dimensions, or empty if not known; num_voxels; num_boundary_cubes, the "
+     "number of 2x2x2 voxel cubes containing both the object and some other "
+     "object or background; and surface_area, the area of the unsimplified "
+     "mesh in the units of voxel_size.  Counts and areas are -1 if not known: "
+     "bounding boxes and voxel counts are not computed in chunked mode unless "
+     "max_cache_bytes is set, boundary cube counts are not computed in lazy or "
+     "chunked mode, and surface areas are not computed in lazy mode."},
+    {NULL} /* Sentinel */
+};
+
+static PyType_Slot slots[] = {
+    {Py_tp_init, reinterpret_cast<void*>(&tp_init)},
+    {Py_tp_new, reinterpret_cast<void*>(&tp_new)},
+    {Py_tp_dealloc, reinterpret_cast<void*>(&tp_dealloc)},
+    {Py_tp_doc, const_cast<char*>("OnDemandObjectMeshGenerator")},
+    {Py_tp_methods, methods},
+    {0, nullptr},
+};
+
+static PyType_Spec spec = {MODULE_NAME ".OnDemandObjectMeshGenerator",
+                           sizeof(Obj), 0, Py_TPFLAGS_DEFAULT, slots};
+
+// Returns a new reference to the type, or nullptr with an exception set.
+static PyObject* CreateType(PyObject* module) {
+  return neuroglancer::CreateType(module, &spec);
+}
+}  // namespace pywrap_on_demand_object_mesh_generator
+
+namespace pywrap_on_demand_skeleton_generator {
+
+struct Obj {
+  PyObject_HEAD meshing::OnDemandSkeletonGenerator impl;
+  // Reference to the label array, from which skeletons are computed on demand.
+  PyObject* data;
+};
+
+static PyObject* tp_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+  Obj* self = reinterpret_cast<Obj*>(type->tp_alloc(type, 0));
+  if (self) {
+    new (&self->impl) meshing::OnDemandSkeletonGenerator();
+    self->data = nullptr;
+  }
+  return reinterpret_cast<PyObject*>(self);
+}
+
+static int tp_init(Obj* self, PyObject* args, PyObject* kwds) {
+  using pywrap_on_demand_object_mesh_generator::ConvertEquivalences;
+  using pywrap_on_demand_object_mesh_generator::ConvertLabelArray;
+  using pywrap_on_demand_object_mesh_generator::GetStridesInElements;
+  PyObject* array_argument;
+  PyObject* equivalences_argument = Py_None;
+  meshing::SkeletonizeOptions options;
+  float* voxel_size = options.voxel_size;
+  static const char* kw_list[] = {"data",
+                                  "voxel_size",
+                                  "invalidation_scale",
+                                  "invalidation_constant",
+                                  "penalty_scale",
+                                  "penalty_exponent",
+                                  "equivalences",
+                                  nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "O|(fff)ffffO:OnDemandSkeletonGenerator",
+          const_cast<char**>(kw_list), &array_argument, voxel_size,
+          voxel_size + 1, voxel_size + 2, &options.invalidation_scale,
+          &options.invalidation_constant, &options.penalty_scale,
+          &options.penalty_exponent, &equivalences_argument)) {
+    return -1;
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (!(voxel_size[i] > 0)) {
+      PyErr_SetString(PyExc_ValueError,
+                      "voxel_size must consist of 3 positive numbers");
+      return -1;
+    }
+  }
+  if (!(options.invalidation_scale >= 0) ||
+      !(options.invalidation_constant >= 0) || !(options.penalty_scale >= 0) ||
+      !(options.penalty_exponent >= 0)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "invalidation_scale, invalidation_constant, penalty_scale "
+                    "and penalty_exponent must be non-negative");
+    return -1;
+  }
+  std::shared_ptr<const meshing::LabelEquivalences> equivalences;
+  if (!ConvertEquivalences(equivalences_argument, &equivalences)) {
+    return -1;
+  }
+  PyArrayObject* array = ConvertLabelArray(array_argument);
+  if (!array) {
+    return -1;
+  }
+  auto* descr = PyArray_DESCR(array);
+  npy_intp* dims = PyArray_DIMS(array);
+  int64_t size_int64[] = {dims[2], dims[1], dims[0]};
+  int64_t strides_in_elements[3];
+  GetStridesInElements(array, strides_in_elements);
+
+  meshing::OnDemandSkeletonGenerator impl;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  switch (descr->elsize) {
+    case 1:
+      impl = meshing::OnDemandSkeletonGenerator(
+          static_cast<const uint8_t*>(PyArray_DATA(array)), size_int64,
+          strides_in_elements, options, equivalences);
+      break;
+    case 2:
+      impl = meshing::OnDemandSkeletonGenerator(
+          static_cast<const uint16_t*>(PyArray_DATA(array)), size_int64,
+          strides_in_elements, options, equivalences);
+      break;
+    case 4:
+      impl = meshing::OnDemandSkeletonGenerator(
+          static_cast<const uint32_t*>(PyArray_DATA(array)), size_int64,
+          strides_in_elements, options, equivalences);
+      break;
+    case 8:
+      impl = meshing::OnDemandSkeletonGenerator(
+          static_cast<const uint64_t*>(PyArray_DATA(array)), size_int64,
+          strides_in_elements, options, equivalences);
+      break;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  self->impl = impl;
+
+  // Transfer ownership of the reference to `self`.
+  Py_CLEAR(self->data);
+  self->data = reinterpret_cast<PyObject*>(array);
+  return 0;
+}
+
+static void tp_dealloc(Obj* obj) {
+  obj->impl.~OnDemandSkeletonGenerator();
+  Py_CLEAR(obj->data);
+  FreeObject(reinterpret_cast<PyObject*>(obj));
+}
+
+static PyObject* get_skeleton(Obj* self, PyObject* args) {
+  using pywrap_on_demand_object_mesh_generator::MakeArray;
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  uint64_t object_id;
+  if (!PyArg_ParseTuple(args, "K:get_skeleton", &object_id)) {
+    return nullptr;
+  }
+
+  std::shared_ptr<const meshing::Skeleton> skeleton;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  // Use the local copy, which keeps the label array alive even if `self` is
+  // concurrently re-initialized.
+  skeleton = impl.GetSkeleton(object_id);
+
+  Py_END_ALLOW_THREADS;
+
+  if (!skeleton) {
+    Py_RETURN_NONE;
+  }
+  npy_intp dims[2] = {static_cast<npy_intp>(skeleton->num_vertices()), 3};
+  PyArrayObject* vertex_positions = MakeArray(2, dims, NPY_FLOAT32);
+  PyArrayObject* radii = MakeArray(1, dims, NPY_FLOAT32);
+  dims[0] = static_cast<npy_intp>(skeleton->edges.size() / 2);
+  dims[1] = 2;
+  PyArrayObject* edges = MakeArray(2, dims, NPY_UINT32);
+  PyObject* result = nullptr;
+  if (vertex_positions && radii && edges) {
+    std::copy(skeleton->vertex_positions.begin(),
+              skeleton->vertex_positions.end(),
+              static_cast<float*>(PyArray_DATA(vertex_positions)));
+    std::copy(skeleton->radii.begin(), skeleton->radii.end(),
+              static_cast<float*>(PyArray_DATA(radii)));
+    std::copy(skeleton->edges.begin(), skeleton->edges.end(),
+              static_cast<uint32_t*>(PyArray_DATA(edges)));
+    result = Py_BuildValue("(OOO)", vertex_positions, edges, radii);
+  }
+  Py_XDECREF(vertex_positions);
+  Py_XDECREF(radii);
+  Py_XDECREF(edges);
+  return result;
+}
+
+static PyObject* object_ids(Obj* self, PyObject* args) {
+  using pywrap_on_demand_object_mesh_generator::MakeArray;
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  const auto& ids = impl.object_ids();
+  npy_intp dims[1] = {static_cast<npy_intp>(ids.size())};
+  PyArrayObject* array = MakeArray(1, dims, NPY_UINT64);
+  if (!array) return nullptr;
+  std::copy(ids.begin(), ids.end(),
+            static_cast<uint64_t*>(PyArray_DATA(array)));
+  return reinterpret_cast<PyObject*>(array);
+}
+
+static PyMethodDef methods[] = {
+    {"get_skeleton", reinterpret_cast<PyCFunction>(&get_skeleton),
+     METH_VARARGS,
+     "Retrieve the skeleton of an object, computed when first requested and "
+     "then cached, as a tuple (vertex_positions, edges, radii) of arrays of "
+     "shape (num_vertices, 3), (num_edges, 2) and (num_vertices,), with "
+     "positions in voxels in the reverse order of the array dimensions and "
+     "radii, the distance from each vertex to the boundary of the object, in "
+     "the units of voxel_size.  Returns None if there is no such object or its "
+     "bounding box has 2^32 voxels or more."},
+    {"object_ids", reinterpret_cast<PyCFunction>(&object_ids), METH_NOARGS,
+     "Return the sorted ids of the objects of the volume as a uint64 array."},
+    {NULL} /* Sentinel */
+};
+
+static PyType_Slot slots[] = {
+    {Py_tp_init, reinterpret_cast<void*>(&tp_init)},
+    {Py_tp_new, reinterpret_cast<void*>(&tp_new)},
+    {Py_tp_dealloc, reinterpret_cast<void*>(&tp_dealloc)},
+    {Py_tp_doc, const_cast<char*>("OnDemandSkeletonGenerator")},
+    {Py_tp_methods, methods},
+    {0, nullptr},
+};
+
+static PyType_Spec spec = {MODULE_NAME ".OnDemandSkeletonGenerator",
+                           sizeof(Obj), 0, Py_TPFLAGS_DEFAULT, slots};
+
+// Returns a new reference to the type, or nullptr with an exception set.
+static PyObject* CreateType(PyObject* module) {
+  return neuroglancer::CreateType(module, &spec);
+}
+}  // namespace pywrap_on_demand_skeleton_generator
+
+namespace pywrap_encoded_chunk_cache {
+
+struct Obj {
+  PyObject_HEAD std::unique_ptr<EncodedChunkCache> impl;
+};
+
+static PyObject* tp_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+  Obj* self = reinterpret_cast<Obj*>(type->tp_alloc(type, 0));
+  if (self) {
+    new (&self->impl) std::unique_ptr<EncodedChunkCache>();
+  }
+  return reinterpret_cast<PyObject*>(self);
+}
+
+static int tp_init(Obj* self, PyObject* args, PyObject* kwds) {
+  long long max_bytes;
+  static const char* kw_list[] = {"max_bytes", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "L:EncodedChunkCache",
+                                   const_cast<char**>(kw_list), &max_bytes)) {
+    return -1;
+  }
+  if (max_bytes < 0) {
+    PyErr_SetString(PyExc_ValueError, "max_bytes must be non-negative");
+    return -1;
+  }
+  self->impl.reset(new EncodedChunkCache(static_cast<size_t>(max_bytes)));
+  return 0;
+}
+
+static void tp_dealloc(Obj* obj) {
+  obj->impl.~unique_ptr();
+  FreeObject(reinterpret_cast<PyObject*>(obj));
+}
+
+// Converts `argument`, a sequence of integers, to `bound`.  Returns false with
+// an exception set on failure.
+static bool ConvertBound(PyObject* argument, std::vector<int64_t>* bound) {
+  PyObject* sequence = PySequence_Fast(argument, "bounds must be sequences");
+  if (!sequence) {
+    return false;
+  }
+  const Py_ssize_t size = PySequence_Fast_GET_SIZE(sequence);
+  bound->resize(size);
+  for (Py_ssize_t i = 0; i < size; ++i) {
+    (*bound)[i] = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(sequence, i));
+  }
+  Py_DECREF(sequence);
+  return !PyErr_Occurred();
+}
+
+// Converts the `start` and `end` arguments of a box.  Returns false with an
+// exception set on failure.
+static bool ConvertBox(PyObject* start_argument, PyObject* end_argument,
+                       std::vector<int64_t>* start,
+                       std::vector<int64_t>* end) {
+  if (!ConvertBound(start_argument, start) ||
+      !ConvertBound(end_argument, end)) {
+    return false;
+  }
+  if (start->size() != end->size()) {
+    PyErr_SetString(PyExc_ValueError, "start and end must have the same rank");
+    return false;
+  }
+  return true;
+}
+
+static bool CheckInitialized(Obj* self) {
+  if (!self->impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return false;
+  }
+  return true;
+}
+
+static PyObject* get(Obj* self, PyObject* args) {
+  const char* key;
+  if (!CheckInitialized(self) || !PyArg_ParseTuple(args, "s:get", &key)) {
+    return nullptr;
+  }
+  auto chunk = self->impl->Find(key);
+  if (!chunk) {
+    Py_RETURN_NONE;
+  }
+  return pywrap_encoded_mesh::MakeMemoryView(reinterpret_cast<PyObject*>(self),
+                                             std::move(chunk));
+}
+
+static PyObject* generation(Obj* self, PyObject* args) {
+  if (!CheckInitialized(self)) {
+    return nullptr;
+  }
+  return PyLong_FromUnsignedLongLong(
+      static_cast<unsigned long long>(self->impl->generation()));
+}
+
+static PyObject* insert(Obj* self, PyObject* args) {
+  const char* key;
+  unsigned long long generation;
+  PyObject *start_argument, *end_argument;
+  Py_buffer buffer;
+  if (!CheckInitialized(self) ||
+      !PyArg_ParseTuple(args, "sKOOs*:insert", &key, &generation,
+                        &start_argument, &end_argument, &buffer)) {
+    return nullptr;
+  }
+  std::vector<int64_t> start, end;
+  if (!ConvertBox(start_argument, end_argument, &start, &end)) {
+    PyBuffer_Release(&buffer);
+    return nullptr;
+  }
+  std::string key_string(key);
+  // Empty chunks would be returned by get as None, so they are not cached.
+  if (buffer.len != 0) {
+    Py_BEGIN_ALLOW_THREADS;
+    self->impl->Insert(key_string, generation, std::move(start),
+                       std::move(end),
+                       std::make_shared<const std::string>(
+                           static_cast<const char*>(buffer.buf), buffer.len));
+    Py_END_ALLOW_THREADS;
+  }
+  PyBuffer_Release(&buffer);
+  Py_RETURN_NONE;
+}
+
+static PyObject* invalidate(Obj* self, PyObject* args, PyObject* kwds) {
+  PyObject *start_argument = Py_None, *end_argument = Py_None;
+  static const char* kw_list[] = {"start", "end", nullptr};
+  if (!CheckInitialized(self) ||
+      !PyArg_ParseTupleAndKeywords(args, kwds, "|OO:invalidate",
+                                   const_cast<char**>(kw_list),
+                                   &start_argument, &end_argument)) {
+    return nullptr;
+  }
+  if (start_argument == Py_None || end_argument == Py_None) {
+    self->impl->Clear();
+    Py_RETURN_NONE;
+  }
+  std::vector<int64_t> start, end;
+  if (!ConvertBox(start_argument, end_argument, &start, &end)) {
+    return nullptr;
+  }
+  self->impl->Invalidate(start, end);
+  Py_RETURN_NONE;
+}
+
+static PyObject* get_statistics(Obj* self, PyObject* args) {
+  if (!CheckInitialized(self)) {
+    return nullptr;
+  }
+  const auto statistics = self->impl->GetStatistics();
+  using ULL = unsigned long long;
+  return Py_BuildValue("{sKsKsKsK}", "hits",
+                       static_cast<ULL>(statistics.hits), "misses",
+                       static_cast<ULL>(statistics.misses), "num_cached",
+                       static_cast<ULL>(statistics.num_cached), "num_bytes",
+                       static_cast<ULL>(statistics.num_bytes));
+}
+
+static PyMethodDef methods[] = {
+    {"get", reinterpret_cast<PyCFunction>(&get), METH_VARARGS,
+     "Return the cached chunk with the specified key as a read-only "
+     "memoryview, or None if it is not cached."},
+    {"generation", reinterpret_cast<PyCFunction>(&generation), METH_NOARGS,
+     "Return the current generation, which must be obtained before reading "
+     "the data from which a chunk is computed and passed to insert."},
+    {"insert", reinterpret_cast<PyCFunction>(&insert), METH_VARARGS,
+     "Cache a chunk, specified by its key, the generation obtained before it "
+     "was computed, the start and end of the box of the data from which it "
+     "was computed, and a buffer of its encoded contents, which is copied.  "
+     "The chunk is not cached if the data was invalidated since generation "
+     "was obtained.  The least recently used chunks are evicted once the "
+     "total size exceeds max_bytes."},
+    {"invalidate", reinterpret_cast<PyCFunction>(&invalidate),
+     METH_VARARGS | METH_KEYWORDS,
+     "Remove the chunks whose box intersects [start, end), or all chunks if "
+     "start and end are not specified."},
+    {"get_statistics", reinterpret_cast<PyCFunction>(&get_statistics),
+     METH_NOARGS,
+     "Return a dict of cache hit and miss counts, and the number and total "
+     "size of the cached chunks."},
+    {NULL} /* Sentinel */
+};
+
+static PyType_Slot slots[] = {
+    {Py_tp_init, reinterpret_cast<void*>(&tp_init)},
+    {Py_tp_new, reinterpret_cast<void*>(&tp_new)},
+    {Py_tp_dealloc, reinterpret_cast<void*>(&tp_dealloc)},
+    {Py_tp_doc, const_cast<char*>(
+         "EncodedChunkCache(max_bytes): thread-safe cache of encoded chunks "
+         "keyed by strings, bounded by their total size.")},
+    {Py_tp_methods, methods},
+    {0, nullptr},
+};
+
+static PyType_Spec spec = {MODULE_NAME ".EncodedChunkCache", sizeof(Obj), 0,
+                           Py_TPFLAGS_DEFAULT, slots};
+
+// Returns a new reference to the type, or nullptr with an exception set.
+static PyObject* CreateType(PyObject* module) {
+  return neuroglancer::CreateType(module, &spec);
+}
+}  // namespace pywrap_encoded_chunk_cache
+
+namespace pywrap_compress_segmentation {
+
+static PyObject* compress_segmentation(PyObject* self, PyObject* args,
+                                       PyObject* kwds) {
+  PyObject* array_argument;
+  ptrdiff_t block_size[3];
+  int num_threads = 1;
+  PyObject* out_argument = Py_None;
+  int share_tables = 0;
+  static const char* kw_list[] = {"data", "block_size", "num_threads", "out",
+                                  "share_tables", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "O(nnn)|iOp:compress_segmentation",
+          const_cast<char**>(kw_list), &array_argument, block_size,
+          block_size + 1, block_size + 2, &num_threads, &out_argument,
+          &share_tables)) {
+    return nullptr;
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (block_size[i] <= 0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "block_size must consist of 3 positive integers");
+      return nullptr;
+    }
+  }
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(PyArray_CheckFromAny(
+      array_argument, /*dtype=*/nullptr, /*min_depth=*/3, /*max_depth=*/4,
+      /*requirements=*/NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED,
+      /*context=*/nullptr));
+  if (!array) {
+    return nullptr;
+  }
+  auto* descr = PyArray_DESCR(array);
+  if ((descr->kind != 'i' && descr->kind != 'u') ||
+      (descr->elsize != 1 && descr->elsize != 2 && descr->elsize != 4 &&
+       descr->elsize != 8)) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError,
+                    "ndarray must have 8-, 16-, 32- or 64-bit integer type");
+    return nullptr;
+  }
+  // Unlike for OnDemandObjectMeshGenerator, the dimensions are taken in the
+  // order x, y, z, channel, since chunks are served in Fortran order.
+  const int ndim = PyArray_NDIM(array);
+  ptrdiff_t volume_size[4] = {1, 1, 1, 1}, strides[4] = {0, 0, 0, 0};
+  for (int i = 0; i < ndim; ++i) {
+    volume_size[i] = PyArray_DIMS(array)[i];
+    strides[i] = PyArray_STRIDES(array)[i] / descr->elsize;
+  }
+  // Plan the encoding to determine its exact size, then write it directly to
+  // the output bytes object or buffer.
+  // 8- and 16-bit labels are read directly and encoded with the uint32 table
+  // layout.
+  const int elsize = descr->elsize;
+  compress_segmentation::CompressionPlan<uint8_t> plan8;
+  compress_segmentation::CompressionPlan<uint16_t> plan16;
+  compress_segmentation::CompressionPlan<uint32_t> plan32;
+  compress_segmentation::CompressionPlan<uint64_t> plan64;
+  size_t size;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  switch (elsize) {
+    case 1:
+      compress_segmentation::PlanChannels(
+          static_cast<const uint8_t*>(PyArray_DATA(array)), strides,
+          volume_size, block_size, &plan8, num_threads, share_tables != 0);
+      size = plan8.size;
+      break;
+    case 2:
+      compress_segmentation::PlanChannels(
+          static_cast<const uint16_t*>(PyArray_DATA(array)), strides,
+          volume_size, block_size, &plan16, num_threads, share_tables != 0);
+      size = plan16.size;
+      break;
+    case 4:
+      compress_segmentation::PlanChannels(
+          static_cast<const uint32_t*>(PyArray_DATA(array)), strides,
+          volume_size, block_size, &plan32, num_threads, share_tables != 0);
+      size = plan32.size;
+      break;
+    default:
+      compress_segmentation::PlanChannels(
+          static_cast<const uint64_t*>(PyArray_DATA(array)), strides,
+          volume_size, block_size, &plan64, num_threads, share_tables != 0);
+      size = plan64.size;
+      break;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  Py_DECREF(array);
+  const size_t num_bytes = size * sizeof(uint32_t);
+  PyObject* result;
+  Py_buffer out_buffer;
+  uint32_t* output;
+  std::vector<uint32_t> unaligned_output;
+  if (out_argument == Py_None) {
+    result = PyBytes_FromStringAndSize(nullptr, num_bytes);
+    if (!result) {
+      return nullptr;
+    }
+    output = reinterpret_cast<uint32_t*>(PyBytes_AS_STRING(result));
+  } else {
+    if (PyObject_GetBuffer(out_argument, &out_buffer,
+                           PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS) == -1) {
+      return nullptr;
+    }
+    if (static_cast<size_t>(out_buffer.len) < num_bytes) {
+      PyBuffer_Release(&out_buffer);
+      PyErr_Format(PyExc_ValueError,
+                   "out buffer of %zd bytes is smaller than the %zu bytes of "
+                   "the encoding",
+                   out_buffer.len, num_bytes);
+      return nullptr;
+    }
+    result = PyLong_FromSize_t(num_bytes);
+    if (!result) {
+      PyBuffer_Release(&out_buffer);
+      return nullptr;
+    }
+    if (reinterpret_cast<uintptr_t>(out_buffer.buf) % alignof(uint32_t)) {
+      unaligned_output.resize(size);
+      output = unaligned_output.data();
+    } else {
+      output = static_cast<uint32_t*>(out_buffer.buf);
+    }
+  }
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  switch (elsize) {
+    case 1:
+      compress_segmentation::WriteChannels(plan8, output);
+      break;
+    case 2:
+      compress_segmentation::WriteChannels(plan16, output);
+      break;
+    case 4:
+      compress_segmentation::WriteChannels(plan32, output);
+      break;
+    default:
+      compress_segmentation::WriteChannels(plan64, output);
+      break;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (out_argument != Py_None) {
+    if (!unaligned_output.empty()) {
+      std::memcpy(out_buffer.buf, unaligned_output.data(), num_bytes);
+    }
+    PyBuffer_Release(&out_buffer);
+  }
+  return result;
+}
+
+static PyObject* choose_block_size(PyObject* self, PyObject* args,
+                                   PyObject* kwds) {
+  PyObject* array_argument;
+  ptrdiff_t chunk_size[3];
+  PyObject* candidates_argument;
+  Py_ssize_t max_samples = 16;
+  int num_threads = 1;
+  static const char* kw_list[] = {"data", "chunk_size", "candidates",
+                                  "max_samples", "num_threads", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "O(nnn)O|ni:choose_compressed_segmentation_block_size",
+          const_cast<char**>(kw_list), &array_argument, chunk_size,
+          chunk_size + 1, chunk_size + 2, &candidates_argument, &max_samples,
+          &num_threads)) {
+    return nullptr;
+  }
+  if (chunk_size[0] <= 0 || chunk_size[1] <= 0 || chunk_size[2] <= 0 ||
+      max_samples <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "chunk_size must consist of 3 positive integers and "
+                    "max_samples must be positive");
+    return nullptr;
+  }
+  PyObject* candidates_sequence = PySequence_Fast(
+      candidates_argument, "candidates must be a sequence of block sizes");
+  if (!candidates_sequence) {
+    return nullptr;
+  }
+  const Py_ssize_t num_candidates =
+      PySequence_Fast_GET_SIZE(candidates_sequence);
+  std::vector<std::array<ptrdiff_t, 3>> candidates(num_candidates);
+  for (Py_ssize_t i = 0; i < num_candidates; ++i) {
+    auto& candidate = candidates[i];
+    if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(candidates_sequence, i),
+                          "nnn;candidates must consist of 3 positive integers",
+                          &candidate[0], &candidate[1], &candidate[2])) {
+      Py_DECREF(candidates_sequence);
+      return nullptr;
+    }
+    if (candidate[0] <= 0 || candidate[1] <= 0 || candidate[2] <= 0) {
+      Py_DECREF(candidates_sequence);
+      PyErr_SetString(PyExc_ValueError,
+                      "candidates must consist of 3 positive integers");
+      return nullptr;
+    }
+  }
+  Py_DECREF(candidates_sequence);
+  if (candidates.empty()) {
+    PyErr_SetString(PyExc_ValueError, "candidates must not be empty");
+    return nullptr;
+  }
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(PyArray_CheckFromAny(
+      array_argument, /*dtype=*/nullptr, /*min_depth=*/3, /*max_depth=*/3,
+      /*requirements=*/NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED,
+      /*context=*/nullptr));
+  if (!array) {
+    return nullptr;
+  }
+  auto* descr = PyArray_DESCR(array);
+  if ((descr->kind != 'i' && descr->kind != 'u') ||
+      (descr->elsize != 1 && descr->elsize != 2 && descr->elsize != 4 &&
+       descr->elsize != 8)) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError,
+                    "ndarray must have 8-, 16-, 32- or 64-bit integer type");
+    return nullptr;
+  }
+  // As for compress_segmentation, the dimensions are taken in the order x, y,
+  // z.
+  ptrdiff_t volume_size[3], strides[3];
+  for (int i = 0; i < 3; ++i) {
+    volume_size[i] = PyArray_DIMS(array)[i];
+    strides[i] = PyArray_STRIDES(array)[i] / descr->elsize;
+  }
+  const int elsize = descr->elsize;
+  const void* data = PyArray_DATA(array);
+  const auto* candidate_sizes =
+      reinterpret_cast<const ptrdiff_t(*)[3]>(candidates.data());
+  size_t index;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  switch (elsize) {
+    case 1:
+      index = compress_segmentation::ChooseBlockSize(
+          static_cast<const uint8_t*>(data), strides, volume_size, chunk_size,
+          candidate_sizes, candidates.size(), max_samples, num_threads);
+      break;
+    case 2:
+      index = compress_segmentation::ChooseBlockSize(
+          static_cast<const uint16_t*>(data), strides, volume_size,
+          chunk_size, candidate_sizes, candidates.size(), max_samples,
+          num_threads);
+      break;
+    case 4:
+      index = compress_segmentation::ChooseBlockSize(
+          static_cast<const uint32_t*>(data), strides, volume_size,
+          chunk_size, candidate_sizes, candidates.size(), max_samples,
+          num_threads);
+      break;
+    default:
+      index = compress_segmentation::ChooseBlockSize(
+          static_cast<const uint64_t*>(data), strides, volume_size,
+          chunk_size, candidate_sizes, candidates.size(), max_samples,
+          num_threads);
+      break;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  Py_DECREF(array);
+  return PyLong_FromSize_t(index);
+}
+
+// Obtains the encoded words of `buffer`, copying them to `*copy` if `buffer`
+// is not 4-byte aligned.  Returns nullptr with an exception set if the size of
+// `buffer` is not a multiple of 4 bytes.
+static const uint32_t* GetEncodedWords(const Py_buffer& buffer,
+                                       std::vector<uint32_t>* copy) {
+  if (buffer.len % sizeof(uint32_t) != 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "compressed_segmentation data must consist of 32-bit "
+                    "words");
+    return nullptr;
+  }
+  if (reinterpret_cast<uintptr_t>(buffer.buf) % alignof(uint32_t) == 0) {
+    return static_cast<const uint32_t*>(buffer.buf);
+  }
+  copy->resize(buffer.len / sizeof(uint32_t));
+  std::memcpy(copy->data(), buffer.buf, buffer.len);
+  return copy->data();
+}
+
+// Checks the volume size, block size and dtype arguments of the decoding
+// functions.  Returns false with an exception set if they are invalid.
+static bool ValidateDecodeArguments(const ptrdiff_t volume_size[4],
+                                    const ptrdiff_t block_size[3],
+                                    PyArray_Descr* descr) {
+  for (int i = 0; i < 4; ++i) {
+    if (volume_size[i] < 0 || (i < 3 && block_size[i] <= 0)) {
+      PyErr_SetString(PyExc_ValueError,
+                      "volume_size must consist of 4 non-negative integers "
+                      "and block_size of 3 positive integers");
+      return false;
+    }
+  }
+  if ((descr->kind != 'i' && descr->kind != 'u') ||
+      (descr->elsize != 4 && descr->elsize != 8)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "dtype must be a 32- or 64-bit integer type");
+    return false;
+  }
+  return true;
+}
+
+// Releases the data buffer and dtype arguments of the decoding functions.
+struct DecodeArgumentsReleaser {
+  Py_buffer* buffer;
+  PyArray_Descr* descr;
+  ~DecodeArgumentsReleaser() {
+    Py_DECREF(descr);
+    PyBuffer_Release(buffer);
+  }
+};
+
+static PyObject* decompress_segmentation(PyObject* self, PyObject* args,
+                                         PyObject* kwds) {
+  Py_buffer buffer;
+  ptrdiff_t volume_size[4], block_size[3];
+  PyArray_Descr* descr;
+  PyObject* start_argument = Py_None;
+  PyObject* end_argument = Py_None;
+  static const char* kw_list[] = {"data",  "volume_size", "dtype",
+                                  "block_size", "start", "end", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "s*(nnnn)O&(nnn)|OO:decompress_segmentation",
+          const_cast<char**>(kw_list), &buffer, volume_size, volume_size + 1,
+          volume_size + 2, volume_size + 3, &PyArray_DescrConverter, &descr,
+          block_size, block_size + 1, block_size + 2, &start_argument,
+          &end_argument)) {
+    return nullptr;
+  }
+  DecodeArgumentsReleaser releaser{&buffer, descr};
+  if (!ValidateDecodeArguments(volume_size, block_size, descr)) {
+    return nullptr;
+  }
+  ptrdiff_t start[3] = {0, 0, 0};
+  ptrdiff_t end[3] = {volume_size[0], volume_size[1], volume_size[2]};
+  if (start_argument != Py_None &&
+      !PyArg_ParseTuple(start_argument, "nnn", start, start + 1, start + 2)) {
+    return nullptr;
+  }
+  if (end_argument != Py_None &&
+      !PyArg_ParseTuple(end_argument, "nnn", end, end + 1, end + 2)) {
+    return nullptr;
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (start[i] < 0 || start[i] > end[i] || end[i] > volume_size[i]) {
+      PyErr_SetString(PyExc_ValueError,
+                      "start and end must satisfy "
+                      "0 <= start <= end <= volume_size");
+      return nullptr;
+    }
+  }
+  std::vector<uint32_t> copy;
+  const uint32_t* words = GetEncodedWords(buffer, &copy);
+  if (!words) {
+    return nullptr;
+  }
+  const size_t num_words = buffer.len / sizeof(uint32_t);
+
+  // The output has dimensions x, y, z, channel in Fortran order, matching the
+  // argument of compress_segmentation.
+  npy_intp dims[4] = {end[0] - start[0], end[1] - start[1], end[2] - start[2],
+                      volume_size[3]};
+  Py_INCREF(descr);
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(
+      PyArray_Empty(4, dims, descr, /*fortran=*/1));
+  if (!array) {
+    return nullptr;
+  }
+  ptrdiff_t output_strides[4];
+  for (int i = 0; i < 4; ++i) {
+    output_strides[i] = PyArray_STRIDES(array)[i] / descr->elsize;
+  }
+  bool valid;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  if (descr->elsize == 4) {
+    valid = compress_segmentation::DecompressChannels(
+        words, num_words, volume_size, block_size, start, end, output_strides,
+        static_cast<uint32_t*>(PyArray_DATA(array)));
+  } else {
+    valid = compress_segmentation::DecompressChannels(
+        words, num_words, volume_size, block_size, start, end, output_strides,
+        static_cast<uint64_t*>(PyArray_DATA(array)));
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (!valid) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError, "invalid compressed_segmentation data");
+    return nullptr;
+  }
+  return reinterpret_cast<PyObject*>(array);
+}
+
+static PyObject* read_value(PyObject* self, PyObject* args, PyObject* kwds) {
+  Py_buffer buffer;
+  ptrdiff_t volume_size[4], block_size[3], position[4];
+  PyArray_Descr* descr;
+  static const char* kw_list[] = {"data",       "volume_size", "dtype",
+                                  "block_size", "position",    nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds,
+          "s*(nnnn)O&(nnn)(nnnn):read_compressed_segmentation_value",
+          const_cast<char**>(kw_list), &buffer, volume_size, volume_size + 1,
+          volume_size + 2, volume_size + 3, &PyArray_DescrConverter, &descr,
+          block_size, block_size + 1, block_size + 2, position, position + 1,
+          position + 2, position + 3)) {
+    return nullptr;
+  }
+  DecodeArgumentsReleaser releaser{&buffer, descr};
+  if (!ValidateDecodeArguments(volume_size, block_size, descr)) {
+    return nullptr;
+  }
+  for (int i = 0; i < 4; ++i) {
+    if (position[i] < 0 || position[i] >= volume_size[i]) {
+      PyErr_SetString(PyExc_ValueError, "position must be within volume_size");
+      return nullptr;
+    }
+  }
+  std::vector<uint32_t> copy;
+  const uint32_t* words = GetEncodedWords(buffer, &copy);
+  if (!words) {
+    return nullptr;
+  }
+  const size_t num_words = buffer.len / sizeof(uint32_t);
+  uint64_t value;
+  bool valid;
+  if (descr->elsize == 4) {
+    uint32_t value32 = 0;
+    valid = compress_segmentation::ReadValue(words, num_words, volume_size,
+                                             block_size, position, &value32);
+    value = value32;
+  } else {
+    valid = compress_segmentation::ReadValue(words, num_words, volume_size,
+                                             block_size, position, &value);
+  }
+  if (!valid) {
+    PyErr_SetString(PyExc_ValueError, "invalid compressed_segmentation data");
+    return nullptr;
+  }
+  return PyLong_FromUnsignedLongLong(value);
+}
+
+static PyObject* count_labels(PyObject* self, PyObject* args,
+                              PyObject* kwds) {
+  Py_buffer buffer;
+  ptrdiff_t volume_size[4], block_size[3];
+  PyArray_Descr* descr;
+  static const char* kw_list[] = {"data", "volume_size", "dtype", "block_size",
+                                  nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "s*(nnnn)O&(nnn):compressed_segmentation_label_counts",
+          const_cast<char**>(kw_list), &buffer, volume_size, volume_size + 1,
+          volume_size + 2, volume_size + 3, &PyArray_DescrConverter, &descr,
+          block_size, block_size + 1, block_size + 2)) {
+    return nullptr;
+  }
+  DecodeArgumentsReleaser releaser{&buffer, descr};
+  if (!ValidateDecodeArguments(volume_size, block_size, descr)) {
+    return nullptr;
+  }
+  std::vector<uint32_t> copy;
+  const uint32_t* words = GetEncodedWords(buffer, &copy);
+  if (!words) {
+    return nullptr;
+  }
+  const size_t num_words = buffer.len / sizeof(uint32_t);
+  std::vector<uint32_t> labels32;
+  std::vector<uint64_t> labels64, counts;
+  bool valid;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  if (descr->elsize == 4) {
+    valid = compress_segmentation::CountLabels(
+        words, num_words, volume_size, block_size, &labels32, &counts);
+  } else {
+    valid = compress_segmentation::CountLabels(
+        words, num_words, volume_size, block_size, &labels64, &counts);
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (!valid) {
+    PyErr_SetString(PyExc_ValueError, "invalid compressed_segmentation data");
+    return nullptr;
+  }
+  npy_intp dims[1] = {static_cast<npy_intp>(counts.size())};
+  Py_INCREF(descr);
+  PyArrayObject* labels_array =
+      reinterpret_cast<PyArrayObject*>(PyArray_Empty(1, dims, descr, 0));
+  PyArrayObject* counts_array = reinterpret_cast<PyArrayObject*>(
+      PyArray_Empty(1, dims, PyArray_DescrFromType(NPY_UINT64), 0));
+  PyObject* result = nullptr;
+  if (labels_array && counts_array) {
+    if (descr->elsize == 4) {
+      std::copy(labels32.begin(), labels32.end(),
+                static_cast<uint32_t*>(PyArray_DATA(labels_array)));
+    } else {
+      std::copy(labels64.begin(), labels64.end(),
+                static_cast<uint64_t*>(PyArray_DATA(labels_array)));
+    }
+    std::copy(counts.begin(), counts.end(),
+              static_cast<uint64_t*>(PyArray_DATA(counts_array)));
+    result = Py_BuildValue("(OO)", labels_array, counts_array);
+  }
+  Py_XDECREF(labels_array);
+  Py_XDECREF(counts_array);
+  return result;
+}
+
+// Converts the keys and values of the dict `mapping` to labels of type
+// `Label`.  Returns false with an exception set if one is not an integer
+// representable as a `Label`.
+template <class Label>
+static bool ConvertLabelMapping(PyObject* mapping,
+                                std::unordered_map<Label, Label>* result) {
+  PyObject* key;
+  PyObject* value;
+  Py_ssize_t pos = 0;
+  while (PyDict_Next(mapping, &pos, &key, &value)) {
+    const unsigned long long key_label = PyLong_AsUnsignedLongLong(key);
+    if (key_label == static_cast<unsigned long long>(-1) && PyErr_Occurred()) {
+      return false;
+    }
+    const unsigned long long value_label = PyLong_AsUnsignedLongLong(value);
+    if (value_label == static_cast<unsigned long long>(-1) &&
+        PyErr_Occurred()) {
+      return false;
+    }
+    if (static_cast<Label>(key_label) != key_label ||
+        static_cast<Label>(value_label) != value_label) {
+      PyErr_SetString(PyExc_OverflowError,
+                      "mapping contains a label out of range of dtype");
+      return false;
+    }
+    (*result)[static_cast<Label>(key_label)] = static_cast<Label>(value_label);
+  }
+  return true;
+}
+
+static PyObject* relabel(PyObject* self, PyObject* args, PyObject* kwds) {
+  Py_buffer buffer;
+  ptrdiff_t volume_size[4], block_size[3];
+  PyArray_Descr* descr;
+  PyObject* mapping_argument;
+  static const char* kw_list[] = {"data",       "volume_size", "dtype",
+                                  "block_size", "mapping",     nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "s*(nnnn)O&(nnn)O!:relabel_compressed_segmentation",
+          const_cast<char**>(kw_list), &buffer, volume_size, volume_size + 1,
+          volume_size + 2, volume_size + 3, &PyArray_DescrConverter, &descr,
+          block_size, block_size + 1, block_size + 2, &PyDict_Type,
+          &mapping_argument)) {
+    return nullptr;
+  }
+  DecodeArgumentsReleaser releaser{&buffer, descr};
+  if (!ValidateDecodeArguments(volume_size, block_size, descr)) {
+    return nullptr;
+  }
+  std::unordered_map<uint32_t, uint32_t> mapping32;
+  std::unordered_map<uint64_t, uint64_t> mapping64;
+  if (descr->elsize == 4 ? !ConvertLabelMapping(mapping_argument, &mapping32)
+                         : !ConvertLabelMapping(mapping_argument, &mapping64)) {
+    return nullptr;
+  }
+  std::vector<uint32_t> copy;
+  const uint32_t* words = GetEncodedWords(buffer, &copy);
+  if (!words) {
+    return nullptr;
+  }
+  const size_t num_words = buffer.len / sizeof(uint32_t);
+  std::vector<uint32_t> output;
+  bool valid;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  if (descr->elsize == 4) {
+    valid = compress_segmentation::RelabelChannels(
+        words, num_words, volume_size, block_size, mapping32, &output);
+  } else {
+    valid = compress_segmentation::RelabelChannels(
+        words, num_words, volume_size, block_size, mapping64, &output);
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (!valid) {
+    PyErr_SetString(PyExc_ValueError, "invalid compressed_segmentation data");
+    return nullptr;
+  }
+  return PyBytes_FromStringAndSize(reinterpret_cast<const char*>(output.data()),
+                                   output.size() * sizeof(uint32_t));
+}
+
+static PyObject* update(PyObject* self, PyObject* args, PyObject* kwds) {
+  Py_buffer buffer;
+  PyObject* array_argument;
+  ptrdiff_t block_size[3], start[3], end[3];
+  int compact = 0;
+  static const char* kw_list[] = {"data",  "labels", "block_size", "start",
+                                  "end",   "compact", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "s*O(nnn)(nnn)(nnn)|p:update_compressed_segmentation",
+          const_cast<char**>(kw_list), &buffer, &array_argument, block_size,
+          block_size + 1, block_size + 2, start, start + 1, start + 2, end,
+          end + 1, end + 2, &compact)) {
+    return nullptr;
+  }
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(PyArray_CheckFromAny(
+      array_argument, /*dtype=*/nullptr, /*min_depth=*/3, /*max_depth=*/4,
+      /*requirements=*/NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED,
+      /*context=*/nullptr));
+  if (!array) {
+    PyBuffer_Release(&buffer);
+    return nullptr;
+  }
+  // Releases the arguments on return.
+  struct Releaser {
+    Py_buffer* buffer;
+    PyArrayObject* array;
+    ~Releaser() {
+      Py_DECREF(array);
+      PyBuffer_Release(buffer);
+    }
+  } releaser{&buffer, array};
+  auto* descr = PyArray_DESCR(array);
+  // As for compress_segmentation, the dimensions are taken in the order x, y,
+  // z, channel.
+  const int ndim = PyArray_NDIM(array);
+  ptrdiff_t volume_size[4] = {1, 1, 1, 1}, strides[4] = {0, 0, 0, 0};
+  for (int i = 0; i < ndim; ++i) {
+    volume_size[i] = PyArray_DIMS(array)[i];
+    strides[i] = PyArray_STRIDES(array)[i] / descr->elsize;
+  }
+  if (!ValidateDecodeArguments(volume_size, block_size, descr)) {
+    return nullptr;
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (start[i] < 0 || start[i] > end[i] || end[i] > volume_size[i]) {
+      PyErr_SetString(PyExc_ValueError,
+                      "start and end must satisfy "
+                      "0 <= start <= end <= labels.shape");
+      return nullptr;
+    }
+  }
+  std::vector<uint32_t> copy;
+  const uint32_t* words = GetEncodedWords(buffer, &copy);
+  if (!words) {
+    return nullptr;
+  }
+  const size_t num_words = buffer.len / sizeof(uint32_t);
+  std::vector<uint32_t> output;
+  bool valid;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  if (descr->elsize == 4) {
+    valid = compress_segmentation::UpdateChannels(
+        words, num_words, static_cast<const uint32_t*>(PyArray_DATA(array)),
+        strides, volume_size, block_size, start, end, compact != 0, &output);
+  } else {
+    valid = compress_segmentation::UpdateChannels(
+        words, num_words, static_cast<const uint64_t*>(PyArray_DATA(array)),
+        strides, volume_size, block_size, start, end, compact != 0, &output);
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (!valid) {
+    PyErr_SetString(PyExc_ValueError, "invalid compressed_segmentation data");
+    return nullptr;
+  }
+  return PyBytes_FromStringAndSize(reinterpret_cast<const char*>(output.data()),
+                                   output.size() * sizeof(uint32_t));
+}
+
+static PyObject* downsample_compressed(PyObject* self, PyObject* args,
+                                       PyObject* kwds) {
+  Py_buffer buffer;
+  ptrdiff_t volume_size[4], block_size[3], factor[3];
+  PyArray_Descr* descr;
+  int num_threads = 1;
+  static const char* kw_list[] = {"data",       "volume_size", "dtype",
+                                  "block_size", "factor",      "num_threads",
+                                  nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds,
+          "s*(nnnn)O&(nnn)(nnn)|i:downsample_compressed_segmentation",
+          const_cast<char**>(kw_list), &buffer, volume_size, volume_size + 1,
+          volume_size + 2, volume_size + 3, &PyArray_DescrConverter, &descr,
+          block_size, block_size + 1, block_size + 2, factor, factor + 1,
+          factor + 2, &num_threads)) {
+    return nullptr;
+  }
+  DecodeArgumentsReleaser releaser{&buffer, descr};
+  if (!ValidateDecodeArguments(volume_size, block_size, descr)) {
+    return nullptr;
+  }
+  if (factor[0] <= 0 || factor[1] <= 0 || factor[2] <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "factor must consist of 3 positive integers");
+    return nullptr;
+  }
+  std::vector<uint32_t> copy;
+  const uint32_t* words = GetEncodedWords(buffer, &copy);
+  if (!words) {
+    return nullptr;
+  }
+  const size_t num_words = buffer.len / sizeof(uint32_t);
+  std::vector<uint32_t> output;
+  bool valid;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  if (descr->elsize == 4) {
+    valid = compress_segmentation::DownsampleChannels<uint32_t>(
+        words, num_words, volume_size, block_size, factor, &output,
+        num_threads);
+  } else {
+    valid = compress_segmentation::DownsampleChannels<uint64_t>(
+        words, num_words, volume_size, block_size, factor, &output,
+        num_threads);
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (!valid) {
+    PyErr_SetString(PyExc_ValueError, "invalid compressed_segmentation data");
+    return nullptr;
+  }
+  return PyBytes_FromStringAndSize(reinterpret_cast<const char*>(output.data()),
+                                   output.size() * sizeof(uint32_t));
+}
+
+static PyObject* export_sharded_segmentation(PyObject* self, PyObject* args,
+                                             PyObject* kwds) {
+  PyObject* array_argument;
+  const char* directory;
+  const char* hash = "murmurhash3_x86_128";
+  const char* minishard_index_encoding = "raw";
+  const char* data_encoding = "raw";
+  compress_segmentation::ShardedSegmentationExportOptions options;
+  auto& sharding = options.sharding;
+  long long max_pending_bytes = options.max_pending_bytes;
+  static const char* kw_list[] = {"data",
+                                  "directory",
+                                  "chunk_size",
+                                  "block_size",
+                                  "preshift_bits",
+                                  "minishard_bits",
+                                  "shard_bits",
+                                  "hash",
+                                  "minishard_index_encoding",
+                                  "data_encoding",
+                                  "num_threads",
+                                  "max_pending_bytes",
+                                  nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "Os|(nnn)(nnn)iiisssiL:export_sharded_segmentation",
+          const_cast<char**>(kw_list), &array_argument, &directory,
+          options.chunk_size, options.chunk_size + 1, options.chunk_size + 2,
+          options.block_size, options.block_size + 1, options.block_size + 2,
+          &sharding.preshift_bits, &sharding.minishard_bits,
+          &sharding.shard_bits, &hash, &minishard_index_encoding,
+          &data_encoding, &options.num_threads, &max_pending_bytes)) {
+    return nullptr;
+  }
+  if (!pywrap_sharding::ParseShardingSpec(hash, minishard_index_encoding,
+                                          data_encoding, &sharding)) {
+    return nullptr;
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (options.chunk_size[i] <= 0 || options.block_size[i] <= 0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "chunk_size and block_size must consist of 3 positive "
+                      "integers");
+      return nullptr;
+    }
+  }
+  if (options.num_threads < 0 || max_pending_bytes < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "num_threads and max_pending_bytes must be non-negative");
+    return nullptr;
+  }
+  options.max_pending_bytes = static_cast<size_t>(max_pending_bytes);
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(PyArray_CheckFromAny(
+      array_argument, /*dtype=*/nullptr, /*min_depth=*/3, /*max_depth=*/3,
+      /*requirements=*/NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED,
+      /*context=*/nullptr));
+  if (!array) {
+    return nullptr;
+  }
+  auto* descr = PyArray_DESCR(array);
+  if ((descr->kind != 'i' && descr->kind != 'u') ||
+      (descr->elsize != 1 && descr->elsize != 2 && descr->elsize != 4 &&
+       descr->elsize != 8)) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError,
+                    "ndarray must have 8-, 16-, 32- or 64-bit integer type");
+    return nullptr;
+  }
+  // As for compress_segmentation, the dimensions are taken in the order x, y,
+  // z.
+  ptrdiff_t volume_size[3], strides[3];
+  for (int i = 0; i < 3; ++i) {
+    volume_size[i] = PyArray_DIMS(array)[i];
+    strides[i] = PyArray_STRIDES(array)[i] / descr->elsize;
+  }
+  const int elsize = descr->elsize;
+  const void* data = PyArray_DATA(array);
+  const std::string directory_string = directory;
+  std::string error;
+  bool ok;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  switch (elsize) {
+    case 1:
+      ok = compress_segmentation::ExportShardedSegmentation(
+          static_cast<const uint8_t*>(data), strides, volume_size,
+          directory_string, options, &error);
+      break;
+    case 2:
+      ok = compress_segmentation::ExportShardedSegmentation(
+          static_cast<const uint16_t*>(data), strides, volume_size,
+          directory_string, options, &error);
+      break;
+    case 4:
+      ok = compress_segmentation::ExportShardedSegmentation(
+          static_cast<const uint32_t*>(data), strides, volume_size,
+          directory_string, options, &error);
+      break;
+    default:
+      ok = compress_segmentation::ExportShardedSegmentation(
+          static_cast<const uint64_t*>(data), strides, volume_size,
+          directory_string, options, &error);
+      break;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  Py_DECREF(array);
+  if (!ok) {
+    PyErr_SetString(PyExc_IOError, error.c_str());
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
+}  // namespace pywrap_compress_segmentation
+
+namespace pywrap_downsample {
+
+struct DownsampleArguments {
+  bool mode;
+  PyArrayObject* input;
+  const ptrdiff_t* shape;
+  const ptrdiff_t* input_strides;
+  const ptrdiff_t* factor;
+  PyArrayObject* output;
+  const ptrdiff_t* output_strides;
+};
+
+template <class T>
+static void Downsample(const DownsampleArguments& a) {
+  const int rank = PyArray_NDIM(a.input);
+  const T* input = static_cast<const T*>(PyArray_DATA(a.input));
+  T* output = static_cast<T*>(PyArray_DATA(a.output));
+  if (a.mode) {
+    downsample::DownsampleWithMode(input, rank, a.shape, a.input_strides,
+                                   a.factor, output, a.output_strides);
+  } else {
+    downsample::DownsampleWithAveraging(input, rank, a.shape, a.input_strides,
+                                        a.factor, output, a.output_strides);
+  }
+}
+
+template <class Signed, class Unsigned>
+static void DownsampleInteger(bool is_signed, const DownsampleArguments& a) {
+  if (is_signed) {
+    Downsample<Signed>(a);
+  } else {
+    Downsample<Unsigned>(a);
+  }
+}
+
+static PyObject* downsample(PyObject* self, PyObject* args, PyObject* kwds) {
+  PyObject* array_argument;
+  PyObject* factor_argument;
+  const char* method = "average";
+  PyObject* out_argument = Py_None;
+  static const char* kw_list[] = {"data", "factor", "method", "out", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|sO:downsample",
+                                   const_cast<char**>(kw_list),
+                                   &array_argument, &factor_argument, &method,
+                                   &out_argument)) {
+    return nullptr;
+  }
+  bool mode;
+  if (!std::strcmp(method, "average")) {
+    mode = false;
+  } else if (!std::strcmp(method, "mode")) {
+    mode = true;
+  } else {
+    PyErr_SetString(PyExc_ValueError, "method must be 'average' or 'mode'");
+    return nullptr;
+  }
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(PyArray_CheckFromAny(
+      array_argument, /*dtype=*/nullptr, /*min_depth=*/0, /*max_depth=*/0,
+      /*requirements=*/NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED,
+      /*context=*/nullptr));
+  if (!array) {
+    return nullptr;
+  }
+  auto* descr = PyArray_DESCR(array);
+  const int elsize = descr->elsize;
+  const bool is_integer = descr->kind == 'i' || descr->kind == 'u';
+  if (!((is_integer &&
+         (elsize == 1 || elsize == 2 || elsize == 4 || elsize == 8)) ||
+        (!mode && descr->kind == 'f' && (elsize == 4 || elsize == 8)))) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError,
+                    mode ? "ndarray must have 8-, 16-, 32- or 64-bit integer "
+                           "type"
+                         : "ndarray must have 8-, 16-, 32- or 64-bit integer "
+                           "or 32- or 64-bit float type");
+    return nullptr;
+  }
+  const int ndim = PyArray_NDIM(array);
+  std::vector<ptrdiff_t> shape(ndim), input_strides(ndim), factor(ndim),
+      output_strides(ndim);
+  std::vector<npy_intp> output_shape(ndim);
+  PyObject* factor_sequence =
+      PySequence_Fast(factor_argument, "factor must be a sequence");
+  if (!factor_sequence) {
+    Py_DECREF(array);
+    return nullptr;
+  }
+  if (PySequence_Fast_GET_SIZE(factor_sequence) != ndim) {
+    Py_DECREF(factor_sequence);
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError,
+                    "factor must have one element per dimension of data");
+    return nullptr;
+  }
+  for (int i = 0; i < ndim; ++i) {
+    factor[i] = PyNumber_AsSsize_t(
+        PySequence_Fast_GET_ITEM(factor_sequence, i), PyExc_OverflowError);
+    if (factor[i] == -1 && PyErr_Occurred()) {
+      Py_DECREF(factor_sequence);
+      Py_DECREF(array);
+      return nullptr;
+    }
+    if (factor[i] <= 0) {
+      Py_DECREF(factor_sequence);
+      Py_DECREF(array);
+      PyErr_SetString(PyExc_ValueError, "factor must be positive");
+      return nullptr;
+    }
+    shape[i] = PyArray_DIMS(array)[i];
+    input_strides[i] = PyArray_STRIDES(array)[i] / elsize;
+    output_shape[i] = (shape[i] + factor[i] - 1) / factor[i];
+  }
+  Py_DECREF(factor_sequence);
+
+  PyArrayObject* output;
+  if (out_argument == Py_None) {
+    Py_INCREF(descr);
+    output = reinterpret_cast<PyArrayObject*>(PyArray_Empty(
+        ndim, output_shape.data(), descr, PyArray_ISFORTRAN(array)));
+    if (!output) {
+      Py_DECREF(array);
+      return nullptr;
+    }
+  } else {
+    if (!PyArray_Check(out_argument)) {
+      Py_DECREF(array);
+      PyErr_SetString(PyExc_TypeError, "out must be an ndarray");
+      return nullptr;
+    }
+    output = reinterpret_cast<PyArrayObject*>(out_argument);
+    if (!PyArray_EquivTypes(PyArray_DESCR(output), descr) ||
+        !PyArray_ISNOTSWAPPED(output) || !PyArray_ISALIGNED(output) ||
+        !PyArray_ISWRITEABLE(output) || PyArray_NDIM(output) != ndim ||
+        !std::equal(output_shape.begin(), output_shape.end(),
+                    PyArray_DIMS(output))) {
+      Py_DECREF(array);
+      PyErr_SetString(PyExc_ValueError,
+                      "out must be a writable, aligned ndarray of the dtype "
+                      "of data and the downsampled shape");
+      return nullptr;
+    }
+    Py_INCREF(output);
+  }
+  for (int i = 0; i < ndim; ++i) {
+    output_strides[i] = PyArray_STRIDES(output)[i] / elsize;
+  }
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  const DownsampleArguments arguments{mode,
+                                      array,
+                                      shape.data(),
+                                      input_strides.data(),
+                                      factor.data(),
+                                      output,
+                                      output_strides.data()};
+  // Mode compares values bitwise, so it always uses the unsigned kernels.
+  const bool is_signed = descr->kind == 'i' && !mode;
+  if (descr->kind == 'f') {
+    if (elsize == 4) {
+      Downsample<float>(arguments);
+    } else {
+      Downsample<double>(arguments);
+    }
+  } else {
+    switch (elsize) {
+      case 1:
+        DownsampleInteger<int8_t, uint8_t>(is_signed, arguments);
+        break;
+      case 2:
+        DownsampleInteger<int16_t, uint16_t>(is_signed, arguments);
+        break;
+      case 4:
+        DownsampleInteger<int32_t, uint32_t>(is_signed, arguments);
+        break;
+      default:
+        DownsampleInteger<int64_t, uint64_t>(is_signed, arguments);
+        break;
+    }
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  Py_DECREF(array);
+  return reinterpret_cast<PyObject*>(output);
+}
+
+}  // namespace pywrap_downsample
+
+namespace pywrap_trace_events {
+
+static PyObject* set_tracing_enabled(PyObject* module, PyObject* args) {
+  int enabled;
+  if (!PyArg_ParseTuple(args, "p:set_tracing_enabled", &enabled)) {
+    return nullptr;
+  }
+  trace_events::SetEnabled(enabled);
+  Py_RETURN_NONE;
+}
+
+static PyObject* get_chrome_trace(PyObject* module, PyObject* args,
+                                  PyObject* kwds) {
+  static const char* kw_list[] = {"clear", nullptr};
+  int clear = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|p:get_chrome_trace",
+                                   const_cast<char**>(kw_list), &clear)) {
+    return nullptr;
+  }
+  std::string json;
+  Py_BEGIN_ALLOW_THREADS;
+  json = trace_events::GetChromeTraceJson(clear);
+  Py_END_ALLOW_THREADS;
+  return PyUnicode_FromStringAndSize(json.data(), json.size());
+}
+
+}  // namespace pywrap_trace_events
+
+static PyMethodDef module_methods[] = {
+    {"have_gzip", reinterpret_cast<PyCFunction>(&pywrap_sharding::have_gzip),
+     METH_NOARGS,
+     "Return whether gzip compression is supported, which requires the "
+     "module to be built with zlib."},
+    {"gzip_compress",
+     reinterpret_cast<PyCFunction>(&pywrap_sharding::gzip_compress),
+     METH_VARARGS,
+     "Return the contents of a buffer compressed in the gzip format, "
+     "compressing them with the GIL released.  Raises ValueError if zlib "
+     "is not available."},
+    {"compress_segmentation",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_compress_segmentation::compress_segmentation),
+     METH_VARARGS | METH_KEYWORDS,
+     "Encode a 3-d (x, y, z) or 4-d (x, y, z, channel) 8-, 16-, 32- or "
+     "64-bit integer array in the compressed_segmentation format with the "
+     "specified block size, returning bytes; 8- and 16-bit arrays are "
+     "encoded as uint32.  Blocks are encoded with num_threads threads "
+     "(default 1), or the number of hardware threads if 0; the output does "
+     "not depend on the number of threads.  If out is specified, the "
+     "encoding is instead written to the start of that writable buffer, "
+     "and the number of bytes written is returned.  If share_tables is "
+     "true, tables used by several channels are written only once, in the "
+     "last of those channels."},
+    {"choose_compressed_segmentation_block_size",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_compress_segmentation::choose_block_size),
+     METH_VARARGS | METH_KEYWORDS,
+     "Return the index of the (x, y, z) block size among candidates with "
+     "which up to max_samples (default 16) evenly spaced chunks of "
+     "chunk_size of a 3-d (x, y, z) integer array encode most compactly in "
+     "the compressed_segmentation format, planning with num_threads "
+     "threads (default 1)."},
+    {"decompress_segmentation",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_compress_segmentation::decompress_segmentation),
+     METH_VARARGS | METH_KEYWORDS,
+     "Decode compressed_segmentation data of the specified (x, y, z, "
+     "channel) volume_size, dtype and block size, returning a 4-d "
+     "Fortran-order ndarray.  If start and end (x, y, z) are specified, "
+     "only that box of each channel is decoded."},
+    {"set_default_mesh_num_threads",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_on_demand_object_mesh_generator::set_default_num_threads),
+     METH_VARARGS,
+     "Set the number of threads with which OnDemandObjectMeshGenerator "
+     "computes the unsimplified meshes at construction when its "
+     "num_threads keyword is not specified, or 0 (the initial default) to "
+     "use the number of hardware threads."},
+    {"get_default_mesh_num_threads",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_on_demand_object_mesh_generator::get_default_num_threads),
+     METH_NOARGS,
+     "Return the value set by set_default_mesh_num_threads."},
+    {"set_shared_mesh_store_bytes",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_on_demand_object_mesh_generator::set_shared_store_bytes),
+     METH_VARARGS,
+     "Set the maximum total encoded size of the process-wide store of "
+     "simplified meshes shared by all OnDemandObjectMeshGenerator "
+     "instances, keyed by the unsimplified surface of each object and the "
+     "options, or 0 (the initial default) to disable it.  A generator "
+     "recreated after the labels change then reuses the meshes of the "
+     "objects whose surfaces are unchanged."},
+    {"get_shared_mesh_store_bytes",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_on_demand_object_mesh_generator::get_shared_store_bytes),
+     METH_NOARGS,
+     "Return the value set by set_shared_mesh_store_bytes."},
+    {"set_shared_mesh_segment",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_on_demand_object_mesh_generator::set_shared_segment),
+     METH_VARARGS,
+     "Attach the process to a cache of simplified meshes in the shared "
+     "memory segment backed by the file path, e.g. in /dev/shm, created "
+     "with a total size of max_bytes if it does not exist, or detach it if "
+     "path is None.  All processes attached to the same file reuse the "
+     "meshes simplified by any of them.  Raises ValueError on failure."},
+    {"release_free_memory",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_on_demand_object_mesh_generator::release_free_memory),
+     METH_NOARGS,
+     "Return memory freed by the process, e.g. by released meshes, to the "
+     "operating system where the allocator supports it (glibc), and return "
+     "whether any was returned."},
+    {"set_tracing_enabled",
+     reinterpret_cast<PyCFunction>(&pywrap_trace_events::set_tracing_enabled),
+     METH_VARARGS,
+     "Start or stop recording trace spans of the native meshing, "
+     "simplification, encoding and compression code in per-thread ring "
+     "buffers.  Disabled initially."},
+    {"get_chrome_trace",
+     reinterpret_cast<PyCFunction>(&pywrap_trace_events::get_chrome_trace),
+     METH_VARARGS | METH_KEYWORDS,
+     "Return the recorded trace spans as a JSON string in the Chrome trace "
+     "event format, which chrome://tracing and Perfetto can load.  Spans are "
+     "tagged with the object id, as a string, and a size, e.g. the number of "
+     "triangles.  "
+     "If clear is true, the returned spans are discarded."},
+    {"read_compressed_segmentation_value",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_compress_segmentation::read_value),
+     METH_VARARGS | METH_KEYWORDS,
+     "Return the value at the (x, y, z, channel) position of "
+     "compressed_segmentation data of the specified (x, y, z, channel) "
+     "volume_size, dtype and block size, without decoding other values."},
+    {"compressed_segmentation_label_counts",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_compress_segmentation::count_labels),
+     METH_VARARGS | METH_KEYWORDS,
+     "Return the distinct labels, in increasing order, of all channels of "
+     "compressed_segmentation data of the specified (x, y, z, channel) "
+     "volume_size, dtype and block size, and the number of voxels of each, "
+     "as a pair of ndarrays, without decoding the data."},
+    {"relabel_compressed_segmentation",
+     reinterpret_cast<PyCFunction>(&pywrap_compress_segmentation::relabel),
+     METH_VARARGS | METH_KEYWORDS,
+     "Return compressed_segmentation data of the specified (x, y, z, "
+     "channel) volume_size, dtype and block size with each label that is a "
+     "key of the dict mapping replaced by its value, rewriting the value "
+     "tables without decoding the data."},
+    {"update_compressed_segmentation",
+     reinterpret_cast<PyCFunction>(&pywrap_compress_segmentation::update),
+     METH_VARARGS | METH_KEYWORDS,
+     "Return compressed_segmentation data of the specified block size "
+     "updated for a change of the labels within the (x, y, z) box [start, "
+     "end) of each channel, given the updated 3-d (x, y, z) or 4-d (x, y, "
+     "z, channel) 32- or 64-bit integer labels.  Only the blocks "
+     "intersecting the box are re-encoded, and appended to the data; if "
+     "compact is true, the data of the replaced blocks is removed."},
+    {"downsample_compressed_segmentation",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_compress_segmentation::downsample_compressed),
+     METH_VARARGS | METH_KEYWORDS,
+     "Return the compressed_segmentation encoding, with the same block "
+     "size, of compressed_segmentation data of the specified (x, y, z, "
+     "channel) volume_size, dtype and block size downsampled by the "
+     "(x, y, z) factor with the mode of each window.  Blocks with a single "
+     "value are not decoded.  Blocks are processed with num_threads "
+     "threads (default 1), or the number of hardware threads if 0."},
+    {"export_sharded_segmentation",
+     reinterpret_cast<PyCFunction>(
+         &pywrap_compress_segmentation::export_sharded_segmentation),
+     METH_VARARGS | METH_KEYWORDS,
+     "Write a 3-d (x, y, z) 8-, 16-, 32- or 64-bit integer array as the "
+     "chunks of chunk_size (default (64, 64, 64)) of a sharded precomputed "
+     "volume with the compressed_segmentation encoding and the specified "
+     "block size (default (8, 8, 8)) to the existing directory, which "
+     "should be the key of the scale; the info file is not written.  Chunks "
+     "are identified by their compressed Morton codes.  The sharding is "
+     "specified by preshift_bits, minishard_bits, shard_bits, hash "
+     "('murmurhash3_x86_128' or 'identity'), and minishard_index_encoding "
+     "and data_encoding ('raw' or 'gzip'; gzip requires zlib).  Chunks are "
+     "encoded with num_threads threads, or the number of hardware threads "
+     "if 0, while the shard files are written sequentially, holding at "
+     "most about max_pending_bytes of encoded chunks."},
+    {"downsample",
+     reinterpret_cast<PyCFunction>(&pywrap_downsample::downsample),
+     METH_VARARGS | METH_KEYWORDS,
+     "Downsample an ndarray by the specified factor along each dimension, "
+     "reducing each window, clipped at the upper bounds, to its mean "
+     "(method='average', the default, rounded toward zero for integer "
+     "types) or its most frequent value (method='mode', for integer "
+     "segmentation labels, with ties broken in favor of the value that "
+     "occurs first in C order).  The output has shape "
+     "ceil(data.shape / factor).  If out is specified, the result is "
+     "written to that ndarray, which is returned."},
+    {NULL} /* Sentinel */
+};
+
+// Creates the types of `module` and stores them in its state.  Returns 0, or
+// -1 with an exception set.
+static int ExecModule(PyObject* module) {
+  import_array1(-1);
+  ModuleState* state;
+#if NEUROGLANCER_MODULE_STATE
+  state = static_cast<ModuleState*>(PyModule_GetState(module));
+#else
+  state = &legacy_module_state;
+#endif
+  struct TypeEntry {
+    const char* name;
+    PyObject* (*create)(PyObject* module);
+    PyObject** slot;
+  };
+  const TypeEntry entries[] = {
+      {"EncodedMesh", &pywrap_encoded_mesh::CreateType,
+       &state->encoded_mesh_type},
+      {"OnDemandObjectMeshGenerator",
+       &pywrap_on_demand_object_mesh_generator::CreateType,
+       &state->object_mesh_generator_type},
+      {"OnDemandSkeletonGenerator",
+       &pywrap_on_demand_skeleton_generator::CreateType,
+       &state->skeleton_generator_type},
+      {"EncodedChunkCache", &pywrap_encoded_chunk_cache::CreateType,
+       &state->encoded_chunk_cache_type},
+  };
+  for (const TypeEntry& entry : entries) {
+    PyObject* type = entry.create(module);
+    if (!type) return -1;
+    Py_INCREF(type);
+    *entry.slot = type;
+    // Steals the reference to `type` on success.
+    if (PyModule_AddObject(module, entry.name, type) < 0) {
+      Py_DECREF(type);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+#if NEUROGLANCER_MODULE_STATE
+static int TraverseModule(PyObject* module, visitproc visit, void* arg) {
+  ModuleState* state = static_cast<ModuleState*>(PyModule_GetState(module));
+  Py_VISIT(state->encoded_mesh_type);
+  Py_VISIT(state->object_mesh_generator_type);
+  Py_VISIT(state->skeleton_generator_type);
+  Py_VISIT(state->encoded_chunk_cache_type);
+  return 0;
+}
+
+static int ClearModule(PyObject* module) {
+  ModuleState* state = static_cast<ModuleState*>(PyModule_GetState(module));
+  Py_CLEAR(state->encoded_mesh_type);
+  Py_CLEAR(state->object_mesh_generator_type);
+  Py_CLEAR(state->skeleton_generator_type);
+  Py_CLEAR(state->encoded_chunk_cache_type);
+  return 0;
+}
+
+static void FreeModule(void* module) {
+  ClearModule(static_cast<PyObject*>(module));
+}
+
+static PyModuleDef_Slot module_slots[] = {
+    {Py_mod_exec, reinterpret_cast<void*>(&ExecModule)},
+#if PY_VERSION_HEX >= 0x030D0000
+    // The native generators and the chunk cache synchronize internally, so the
+    // module does not rely on the GIL.  As with other Python objects, a
+    // generator or cache must not be re-initialized with __init__ while it is
+    // used by other threads.
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, nullptr},
+};
+#endif
+
+static PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT,
+    MODULE_NAME,                         /* m_name */
+    "Neuroglancer C extension module.", /* m_doc */
+#if NEUROGLANCER_MODULE_STATE
+    sizeof(ModuleState), /* m_size */
+    module_methods,      /* m_methods */
+    module_slots,        /* m_slots */
+    &TraverseModule,     /* m_traverse */
+    &ClearModule,        /* m_clear */
+    &FreeModule,         /* m_free */
+#else
+    -1,             /* m_size */
+    module_methods, /* m_methods */
+#endif
+};
+
+extern "C" DLL_PUBLIC PyObject* PyInit__neuroglancer(void) {
+#if NEUROGLANCER_MODULE_STATE
+  return PyModuleDef_Init(&module_def);
+#else
+  PyObject* module = PyModule_Create(&module_def);
+  if (!module) return nullptr;
+  if (ExecModule(module) < 0) {
+    Py_DECREF(module);
+    return nullptr;
+  }
+  return module;
+#endif
 }
 
 }  // namespace neuroglancer
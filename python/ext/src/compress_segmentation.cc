@@ -15,8 +15,11 @@
  */
 
 #include "compress_segmentation.h"
+#include "parallel_for.h"
+#include "trace_events.h"
 
 #include <algorithm>
+#include <thread>
 #include <unordered_map>
 
 namespace neuroglancer {
@@ -31,123 +34,666 @@ void WriteBlockHeader(size_t encoded_value_base_offset,
   output[1] = encoded_value_base_offset;
 }
 
+namespace {
+
+// Maximum number of distinct values of a block for which values are looked up
+// by linear search rather than with a hash table.  Typical segmentation blocks
+// contain only a few distinct values, for which a linear search of a short
+// array is faster than hashing and avoids allocating hash table nodes.
+constexpr size_t kMaxLinearSearchValues = 16;
+
+// Distinct values of a block, in increasing order, and the index of each value
+// in that order.
 template <class Label>
-void EncodeBlock(const Label* input, const ptrdiff_t input_strides[3],
-                 const ptrdiff_t block_size[3], const ptrdiff_t actual_size[3],
-                 size_t base_offset, size_t* encoded_bits_output,
-                 size_t* table_offset_output, EncodedValueCache<Label>* cache,
-                 std::vector<uint32_t>* output_vec) {
-  if (actual_size[0] * actual_size[1] * actual_size[2] == 0) {
-    *encoded_bits_output = 0;
-    *table_offset_output = 0;
-    return;
-  }
+struct BlockTable {
+  std::vector<Label> values;
+  // Maps each value to its index, only if there are more than
+  // `kMaxLinearSearchValues` values.
+  std::unordered_map<Label, uint32_t> indices;
 
-  constexpr size_t num_32bit_words_per_label =
-      (sizeof(Label) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+  bool use_indices() const { return values.size() > kMaxLinearSearchValues; }
 
-  std::unordered_map<Label, uint32_t> seen_values;
-  std::vector<Label> seen_values_inv;
+  // Returns the index of `value`, which must be in the table.
+  uint32_t GetIndex(Label value) const {
+    if (use_indices()) return indices.at(value);
+    return static_cast<uint32_t>(
+        std::find(values.begin(), values.end(), value) - values.begin());
+  }
+};
 
-  // First determine the distinct values.
+// Computes the table of the block of size `actual_size` at `input`.
+template <class Label>
+void ComputeBlockTable(const Label* input, const ptrdiff_t input_strides[3],
+                       const ptrdiff_t actual_size[3],
+                       BlockTable<Label>* table) {
+  auto& seen_values = table->indices;
+  auto& seen_values_inv = table->values;
+  seen_values.clear();
+  seen_values_inv.clear();
 
   // Initialize previous_value such that it is guaranteed not to equal to the
   // first value.
   Label previous_value = input[0] + 1;
-  {
-    auto* input_z = input;
-    for (size_t z = 0; z < actual_size[2]; ++z) {
-      auto* input_y = input_z;
-      for (size_t y = 0; y < actual_size[1]; ++y) {
-        auto* input_x = input_y;
-        for (size_t x = 0; x < actual_size[0]; ++x) {
-          auto value = *input_x;
-          // If this value matches the previous value, we can skip the more
-          // expensive hash table lookup.
-          if (value != previous_value) {
-            previous_value = value;
-            if (seen_values.emplace(value, 0).second) {
+  auto* input_z = input;
+  for (size_t z = 0; z < actual_size[2]; ++z) {
+    auto* input_y = input_z;
+    for (size_t y = 0; y < actual_size[1]; ++y) {
+      auto* input_x = input_y;
+      for (size_t x = 0; x < actual_size[0]; ++x) {
+        auto value = *input_x;
+        // If this value matches the previous value, we can skip the more
+        // expensive lookup.
+        if (value != previous_value) {
+          previous_value = value;
+          if (!table->use_indices()) {
+            if (std::find(seen_values_inv.begin(), seen_values_inv.end(),
+                          value) == seen_values_inv.end()) {
               seen_values_inv.push_back(value);
+              if (table->use_indices()) {
+                // Switch to the hash table.
+                for (auto v : seen_values_inv) seen_values.emplace(v, 0);
+              }
             }
+          } else if (seen_values.emplace(value, 0).second) {
+            seen_values_inv.push_back(value);
           }
-
-          input_x += input_strides[0];
         }
-        input_y += input_strides[1];
+
+        input_x += input_strides[0];
       }
-      input_z += input_strides[2];
+      input_y += input_strides[1];
     }
+    input_z += input_strides[2];
   }
 
   std::sort(seen_values_inv.begin(), seen_values_inv.end());
-  for (size_t i = 0; i < seen_values_inv.size(); ++i) {
-    seen_values[seen_values_inv[i]] = static_cast<uint32_t>(i);
+  if (table->use_indices()) {
+    for (size_t i = 0; i < seen_values_inv.size(); ++i) {
+      seen_values[seen_values_inv[i]] = static_cast<uint32_t>(i);
+    }
   }
+}
 
-  // Determine number of bits with which to encode each index.
+// Returns the number of bits with which to encode each index into a table of
+// `num_values` values.
+size_t GetEncodedBits(size_t num_values) {
   size_t encoded_bits = 0;
-  if (seen_values.size() != 1) {
+  if (num_values != 1) {
     encoded_bits = 1;
-    while ((1 << encoded_bits) < seen_values.size()) {
+    while ((1 << encoded_bits) < num_values) {
       encoded_bits *= 2;
     }
   }
+  return encoded_bits;
+}
+
+// Returns the number of 32-bit words of the encoded values of a block.
+size_t GetEncodedSize(size_t encoded_bits, const ptrdiff_t block_size[3]) {
+  return (encoded_bits * block_size[0] * block_size[1] * block_size[2] + 31) /
+         32;
+}
+
+// Returns the index of `value` in `table`.  Consecutive equal values are
+// common, so the index of the previous value is cached in `previous_value` and
+// `index`.
+template <class Label>
+inline uint32_t LookupIndex(Label value, const BlockTable<Label>& table,
+                            Label* previous_value, uint32_t* index) {
+  if (value != *previous_value) {
+    *previous_value = value;
+    *index = table.GetIndex(value);
+  }
+  return *index;
+}
+
+// Writes the encoded values of a block to `output` using `Bits` bits per
+// index.
+//
+// Since `Bits` divides 32, no index straddles a 32-bit word.  Each word is
+// assembled in a register, carrying over from one x-row to the next, and
+// stored once; positions of the block beyond `actual_size` are left 0.
+// Within a row, a word assembled from indices that all equal the previous
+// value, as is typical, is a replicated constant.  When `kContiguous` is true,
+// the x stride of the input is 1 and the comparison loop vectorizes.
+template <size_t Bits, bool kContiguous, class Label>
+void WriteEncodedValuesWithBits(const Label* input,
+                                const ptrdiff_t input_strides[3],
+                                const ptrdiff_t block_size[3],
+                                const ptrdiff_t actual_size[3],
+                                const BlockTable<Label>& table,
+                                uint32_t* output) {
+  constexpr size_t kIndicesPerWord = 32 / Bits;
+  // Multiplying an index by this value replicates it into every position of
+  // a word.
+  constexpr uint32_t kReplicate =
+      static_cast<uint32_t>(0xffffffffull / ((uint64_t(1) << Bits) - 1));
+  const ptrdiff_t stride = kContiguous ? 1 : input_strides[0];
+  const size_t size = actual_size[0];
+  Label previous_value = table.values[0];
+  uint32_t index = 0;
+  // Word being assembled, its offset in `output`, and the position within it
+  // of the next index.
+  uint32_t word = 0;
+  size_t word_offset = 0;
+  size_t word_position = 0;
+  auto* input_z = input;
+  for (ptrdiff_t z = 0; z < actual_size[2]; ++z) {
+    auto* input_y = input_z;
+    for (ptrdiff_t y = 0; y < actual_size[1]; ++y) {
+      const size_t position = block_size[0] * (y + block_size[1] * z);
+      if (position / kIndicesPerWord != word_offset) {
+        output[word_offset] = word;
+        word = 0;
+        word_offset = position / kIndicesPerWord;
+      }
+      word_position = position % kIndicesPerWord;
+      size_t x = 0;
+      while (true) {
+        if (word_position == 0) {
+          for (; x + kIndicesPerWord <= size; x += kIndicesPerWord) {
+            const Label* word_input = input_y + x * stride;
+            bool uniform = true;
+            for (size_t j = 0; j < kIndicesPerWord; ++j) {
+              uniform &= (word_input[j * stride] == previous_value);
+            }
+            if (uniform) {
+              output[word_offset++] = index * kReplicate;
+              continue;
+            }
+            for (size_t j = 0; j < kIndicesPerWord; ++j) {
+              word |= LookupIndex(word_input[j * stride], table,
+                                  &previous_value, &index)
+                      << (j * Bits);
+            }
+            output[word_offset++] = word;
+            word = 0;
+          }
+        }
+        if (x == size) break;
+        word |= LookupIndex(input_y[x * stride], table, &previous_value,
+                            &index)
+                << (word_position * Bits);
+        ++x;
+        if (++word_position == kIndicesPerWord) {
+          output[word_offset++] = word;
+          word = 0;
+          word_position = 0;
+        }
+      }
+      input_y += input_strides[1];
+    }
+    input_z += input_strides[2];
+  }
+  if (word_position != 0) output[word_offset] = word;
+}
+
+template <size_t Bits, class Label>
+void WriteEncodedValuesWithBits(const Label* input,
+                                const ptrdiff_t input_strides[3],
+                                const ptrdiff_t block_size[3],
+                                const ptrdiff_t actual_size[3],
+                                const BlockTable<Label>& table,
+                                uint32_t* output) {
+  if (input_strides[0] == 1) {
+    WriteEncodedValuesWithBits<Bits, true>(input, input_strides, block_size,
+                                           actual_size, table, output);
+  } else {
+    WriteEncodedValuesWithBits<Bits, false>(input, input_strides, block_size,
+                                            actual_size, table, output);
+  }
+}
+
+// Writes the encoded values of a block to `output`, which must be zeroed.
+template <class Label>
+void WriteEncodedValues(const Label* input, const ptrdiff_t input_strides[3],
+                        const ptrdiff_t block_size[3],
+                        const ptrdiff_t actual_size[3],
+                        const BlockTable<Label>& table, size_t encoded_bits,
+                        uint32_t* output) {
+  switch (encoded_bits) {
+    case 0:
+      // All indices are 0.
+      return;
+#define DO_CASE(BITS)                                                        \
+  case BITS:                                                                 \
+    WriteEncodedValuesWithBits<BITS>(input, input_strides, block_size,       \
+                                     actual_size, table, output);            \
+    return;                                                                  \
+/**/
+    DO_CASE(1)
+    DO_CASE(2)
+    DO_CASE(4)
+    DO_CASE(8)
+    DO_CASE(16)
+    DO_CASE(32)
+#undef DO_CASE
+  }
+}
+
+// Writes the 32-bit words of the table `values` to `output`.
+template <class Label>
+void WriteTableWords(const Label* values, size_t num_values, uint32_t* output) {
+  constexpr size_t num_32bit_words_per_label =
+      (sizeof(Label) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+  for (size_t i = 0; i < num_values; ++i) {
+    for (int word_i = 0; word_i < num_32bit_words_per_label; ++word_i) {
+      output[word_i] = static_cast<uint32_t>(values[i] >> (32 * word_i));
+    }
+    output += num_32bit_words_per_label;
+  }
+}
+
+template <class Label>
+constexpr size_t GetTableSize(size_t num_values) {
+  return num_values * ((sizeof(Label) + sizeof(uint32_t) - 1) /
+                       sizeof(uint32_t));
+}
+
+}  // namespace
+
+template <class Label>
+void EncodeBlock(const Label* input, const ptrdiff_t input_strides[3],
+                 const ptrdiff_t block_size[3], const ptrdiff_t actual_size[3],
+                 size_t base_offset, size_t* encoded_bits_output,
+                 size_t* table_offset_output, EncodedValueCache<Label>* cache,
+                 std::vector<uint32_t>* output_vec) {
+  if (actual_size[0] * actual_size[1] * actual_size[2] == 0) {
+    *encoded_bits_output = 0;
+    *table_offset_output = 0;
+    return;
+  }
+
+  BlockTable<Label> table;
+  ComputeBlockTable(input, input_strides, actual_size, &table);
+  const size_t encoded_bits = GetEncodedBits(table.values.size());
   *encoded_bits_output = encoded_bits;
-  const size_t encoded_size_32bits =
-      (encoded_bits * block_size[0] * block_size[1] * block_size[2] + 31) / 32;
+  const size_t encoded_size_32bits = GetEncodedSize(encoded_bits, block_size);
 
   const size_t encoded_value_base_offset = output_vec->size();
   size_t elements_to_write = encoded_size_32bits;
-
-  bool write_table;
-  {
-    auto it = cache->find(seen_values_inv);
-    if (it == cache->end()) {
-      write_table = true;
-      elements_to_write += seen_values.size() * num_32bit_words_per_label;
-      *table_offset_output =
-          encoded_value_base_offset + encoded_size_32bits - base_offset;
-    } else {
-      write_table = false;
-      *table_offset_output = it->second;
-    }
+  auto it = cache->find(table.values);
+  const bool write_table = (it == cache->end());
+  if (write_table) {
+    elements_to_write += GetTableSize<Label>(table.values.size());
+    *table_offset_output =
+        encoded_value_base_offset + encoded_size_32bits - base_offset;
+    cache->emplace(table.values, *table_offset_output);
+  } else {
+    *table_offset_output = it->second;
   }
 
   output_vec->resize(encoded_value_base_offset + elements_to_write);
   uint32_t* output = output_vec->data() + encoded_value_base_offset;
-  // Write encoded representation.
-  {
-    auto* input_z = input;
-    for (size_t z = 0; z < actual_size[2]; ++z) {
-      auto* input_y = input_z;
-      for (size_t y = 0; y < actual_size[1]; ++y) {
-        auto* input_x = input_y;
-        for (size_t x = 0; x < actual_size[0]; ++x) {
-          auto value = *input_x;
-          uint32_t index = seen_values.at(value);
-          size_t output_offset = x + block_size[0] * (y + block_size[1] * z);
-          output[output_offset * encoded_bits / 32] |=
-              (index << (output_offset * encoded_bits % 32));
-
-          input_x += input_strides[0];
-        }
-        input_y += input_strides[1];
+  WriteEncodedValues(input, input_strides, block_size, actual_size, table,
+                     encoded_bits, output);
+  if (write_table) {
+    WriteTableWords(table.values.data(), table.values.size(),
+                    output + encoded_size_32bits);
+  }
+}
+
+namespace {
+
+// Returns the position of the block with index `block_offset` and the number
+// of values of the block within the volume.
+void GetBlockBounds(size_t block_offset, const ptrdiff_t grid_size[3],
+                    const ptrdiff_t volume_size[3],
+                    const ptrdiff_t block_size[3],
+                    const ptrdiff_t input_strides[3],
+                    ptrdiff_t* input_offset, ptrdiff_t actual_size[3]) {
+  ptrdiff_t block[3];
+  block[0] = block_offset % grid_size[0];
+  block[1] = block_offset / grid_size[0] % grid_size[1];
+  block[2] = block_offset / grid_size[0] / grid_size[1];
+  *input_offset = 0;
+  for (size_t i = 0; i < 3; ++i) {
+    auto pos = block[i] * block_size[i];
+    actual_size[i] = std::min(block_size[i], volume_size[i] - pos);
+    *input_offset += pos * input_strides[i];
+  }
+}
+
+// Returns the number of blocks, and sets `grid_size` to the number of blocks
+// along each dimension.
+size_t GetGridSize(const ptrdiff_t volume_size[3],
+                   const ptrdiff_t block_size[3], ptrdiff_t grid_size[3]) {
+  size_t num_blocks = 1;
+  for (size_t i = 0; i < 3; ++i) {
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+    num_blocks *= grid_size[i];
+  }
+  return num_blocks;
+}
+
+// Returns the number of ranges into which `num_blocks` blocks are split for
+// processing with `num_threads` threads.  Several ranges per thread balance
+// the load if the number of distinct values varies.
+size_t GetNumBlockRanges(size_t num_blocks, int num_threads) {
+  if (num_threads == 1 || num_blocks <= 1) return 1;
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  return std::min(num_blocks, static_cast<size_t>(num_threads) * 4);
+}
+
+// Calls `fn(range_i, begin, end)` for each of the `num_ranges` consecutive
+// ranges [begin, end) of blocks covering [0, num_blocks), in parallel using
+// `num_threads` threads.
+template <class Fn>
+void ForEachBlockRange(size_t num_blocks, size_t num_ranges, int num_threads,
+                       const Fn& fn) {
+  const auto get_range_begin = [&](size_t range_i) {
+    return num_blocks * range_i / num_ranges;
+  };
+  if (num_ranges == 1) {
+    fn(size_t(0), size_t(0), num_blocks);
+    return;
+  }
+  ParallelFor(num_ranges, num_threads, [&](size_t range_i) {
+    fn(range_i, get_range_begin(range_i), get_range_begin(range_i + 1));
+  });
+}
+
+// Computes the tables and encoded values of the blocks [begin, end), and
+// appends them to those of `range`.  The end offsets of each block within
+// `range` are stored in `plan`.
+template <class Label>
+void EncodeBlockRange(const Label* input, const ptrdiff_t input_strides[3],
+                      const ptrdiff_t volume_size[3],
+                      const ptrdiff_t block_size[3],
+                      const ptrdiff_t grid_size[3], size_t begin, size_t end,
+                      ChannelPlan<Label>* range, ChannelPlan<Label>* plan) {
+  BlockTable<Label> table;
+  for (size_t block_offset = begin; block_offset < end; ++block_offset) {
+    ptrdiff_t input_offset, actual_size[3];
+    GetBlockBounds(block_offset, grid_size, volume_size, block_size,
+                   input_strides, &input_offset, actual_size);
+    if (actual_size[0] * actual_size[1] * actual_size[2] != 0) {
+      ComputeBlockTable(input + input_offset, input_strides, actual_size,
+                        &table);
+      const size_t encoded_bits = GetEncodedBits(table.values.size());
+      const size_t encoded_offset = range->encoded_values.size();
+      range->encoded_values.resize(encoded_offset +
+                                   GetEncodedSize(encoded_bits, block_size));
+      WriteEncodedValues(input + input_offset, input_strides, block_size,
+                         actual_size, table, encoded_bits,
+                         range->encoded_values.data() + encoded_offset);
+      range->table_values.insert(range->table_values.end(),
+                                 table.values.begin(), table.values.end());
+    }
+    plan->encoded_values_end[block_offset] = range->encoded_values.size();
+    plan->table_values_end[block_offset] = range->table_values.size();
+  }
+}
+
+// Computes the tables and encoded values of all blocks of a channel into
+// `plan`, in parallel using `num_threads` threads.
+template <class Label>
+void ComputeChannelBlocks(const Label* input,
+                          const ptrdiff_t input_strides[3],
+                          const ptrdiff_t volume_size[3],
+                          const ptrdiff_t block_size[3],
+                          ChannelPlan<Label>* plan, int num_threads) {
+  ptrdiff_t grid_size[3];
+  const size_t num_blocks = GetGridSize(volume_size, block_size, grid_size);
+  const size_t num_ranges = GetNumBlockRanges(num_blocks, num_threads);
+  plan->encoded_values_end.resize(num_blocks);
+  plan->table_values_end.resize(num_blocks);
+
+  // Compute the tables and encoded values of ranges of blocks in parallel,
+  // then concatenate them in order.
+  std::vector<ChannelPlan<Label>> ranges(num_ranges);
+  const auto get_range_begin = [&](size_t range_i) {
+    return num_blocks * range_i / num_ranges;
+  };
+  ForEachBlockRange(num_blocks, num_ranges, num_threads,
+                    [&](size_t range_i, size_t begin, size_t end) {
+                      EncodeBlockRange(input, input_strides, volume_size,
+                                       block_size, grid_size, begin, end,
+                                       &ranges[range_i], plan);
+                    });
+  plan->encoded_values.swap(ranges[0].encoded_values);
+  plan->table_values.swap(ranges[0].table_values);
+  for (size_t range_i = 1; range_i < num_ranges; ++range_i) {
+    auto& range = ranges[range_i];
+    const size_t encoded_values_begin = plan->encoded_values.size();
+    const size_t table_values_begin = plan->table_values.size();
+    for (size_t i = get_range_begin(range_i);
+         i < get_range_begin(range_i + 1); ++i) {
+      plan->encoded_values_end[i] += encoded_values_begin;
+      plan->table_values_end[i] += table_values_begin;
+    }
+    plan->encoded_values.insert(plan->encoded_values.end(),
+                                range.encoded_values.begin(),
+                                range.encoded_values.end());
+    plan->table_values.insert(plan->table_values.end(),
+                              range.table_values.begin(),
+                              range.table_values.end());
+    // Release the memory of the range once it is copied.
+    range = ChannelPlan<Label>();
+  }
+}
+
+// Returns a hash of the table `values`.
+template <class Label>
+uint64_t HashTable(const Label* values, size_t size) {
+  uint64_t hash = size;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ static_cast<uint64_t>(values[i])) * 0x100000001b3ull;
+  }
+  hash ^= hash >> 32;
+  hash *= 0xbf58476d1ce4e5b9ull;
+  return hash ^ (hash >> 29);
+}
+
+// Table written to the output.
+template <class Label>
+struct CachedTable {
+  // Values of the table, which are not owned.
+  const Label* values = nullptr;
+  size_t size = 0;
+  uint64_t hash = 0;
+  // Channel in which the table is written, and its offset relative to the
+  // start of that channel.
+  size_t channel = 0;
+  size_t offset = 0;
+};
+
+// Set of the tables written to the output, for sharing identical tables.
+//
+// Unlike EncodedValueCache, entries refer to the values of the tables, which
+// are already stored in a plan, rather than copying them, and are stored in a
+// single array with linear probing rather than in a node per entry.
+template <class Label>
+class TableCache {
+ public:
+  // Returns the table equal to `values`, or nullptr if there is none.
+  const CachedTable<Label>* Find(const Label* values, size_t size,
+                                 uint64_t hash) const {
+    if (slots_.empty()) return nullptr;
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const auto& slot = slots_[i];
+      if (!slot.values) return nullptr;
+      if (slot.hash == hash && slot.size == size &&
+          std::equal(values, values + size, slot.values)) {
+        return &slot;
       }
-      input_z += input_strides[2];
     }
   }
 
-  // Write table
-  if (write_table) {
-    output =
-        output_vec->data() + encoded_value_base_offset + encoded_size_32bits;
-    for (auto value : seen_values_inv) {
-      for (int word_i = 0; word_i < num_32bit_words_per_label; ++word_i) {
-        output[word_i] = static_cast<uint32_t>(value >> (32 * word_i));
+  // Adds `table`, which must not be equal to an existing table.
+  void Insert(const CachedTable<Label>& table) {
+    if ((num_tables_ + 1) * 2 > slots_.size()) {
+      std::vector<CachedTable<Label>> old_slots(
+          std::max(size_t(16), slots_.size() * 2));
+      old_slots.swap(slots_);
+      for (const auto& slot : old_slots) {
+        if (slot.values) InsertSlot(slot);
+      }
+    }
+    InsertSlot(table);
+    ++num_tables_;
+  }
+
+ private:
+  void InsertSlot(const CachedTable<Label>& table) {
+    const size_t mask = slots_.size() - 1;
+    size_t i = table.hash & mask;
+    while (slots_[i].values) i = (i + 1) & mask;
+    slots_[i] = table;
+  }
+
+  std::vector<CachedTable<Label>> slots_;
+  size_t num_tables_ = 0;
+};
+
+// Reference from the header of a block to a table written in a later channel,
+// whose offset is known once the sizes of all channels are.
+struct ForwardTableReference {
+  size_t channel;
+  size_t block_offset;
+  size_t table_channel;
+  size_t table_offset;
+};
+
+// Lays out the encoded values and tables of channel `channel_i` in block
+// order, sharing identical tables exactly as EncodeBlock does.  Sets the block
+// headers, `writes_table` and `size` of `plan`.
+//
+// If `later_tables` is not null, a table that is not already written in this
+// channel but is in `later_tables` is not written; instead, a reference to it
+// is appended to `forward_references` and the block header is left to be
+// completed.
+template <class Label>
+void LayOutChannel(size_t channel_i, const TableCache<Label>* later_tables,
+                   ChannelPlan<Label>* plan,
+                   std::vector<ForwardTableReference>* forward_references) {
+  const size_t num_blocks = plan->table_values_end.size();
+  plan->headers.resize(num_blocks * kBlockHeaderSize);
+  plan->writes_table.assign(num_blocks, false);
+  TableCache<Label> cache;
+  size_t size = num_blocks * kBlockHeaderSize;
+  size_t encoded_begin = 0, table_begin = 0;
+  for (size_t block_offset = 0; block_offset < num_blocks; ++block_offset) {
+    const size_t encoded_end = plan->encoded_values_end[block_offset];
+    const size_t table_end = plan->table_values_end[block_offset];
+    const size_t encoded_value_base_offset = size;
+    size += encoded_end - encoded_begin;
+    size_t encoded_bits = 0, table_offset = 0;
+    if (table_end != table_begin) {
+      const Label* values = plan->table_values.data() + table_begin;
+      const size_t num_values = table_end - table_begin;
+      const uint64_t hash = HashTable(values, num_values);
+      encoded_bits = GetEncodedBits(num_values);
+      const CachedTable<Label>* cached;
+      if ((cached = cache.Find(values, num_values, hash))) {
+        table_offset = cached->offset;
+      } else if (later_tables &&
+                 (cached = later_tables->Find(values, num_values, hash))) {
+        forward_references->push_back(ForwardTableReference{
+            channel_i, block_offset, cached->channel, cached->offset});
+      } else {
+        plan->writes_table[block_offset] = true;
+        table_offset = size;
+        CachedTable<Label> table;
+        table.values = values;
+        table.size = num_values;
+        table.hash = hash;
+        table.channel = channel_i;
+        table.offset = table_offset;
+        cache.Insert(table);
+        size += GetTableSize<Label>(num_values);
       }
-      output += num_32bit_words_per_label;
     }
-    cache->emplace(seen_values_inv, *table_offset_output);
+    WriteBlockHeader(encoded_value_base_offset, table_offset, encoded_bits,
+                     &plan->headers[block_offset * kBlockHeaderSize]);
+    encoded_begin = encoded_end;
+    table_begin = table_end;
+  }
+  plan->size = size;
+}
+
+// Lays out all channels of `plan`, sharing tables across channels.
+//
+// Table offsets are relative to the start of the channel and unsigned, so a
+// block can only refer to a table written in the same or a later channel.
+// Channels are therefore laid out in reverse order, and a table used by
+// several channels is written only in the last of them.  Returns false,
+// leaving the layout incomplete, if an offset to a table in a later channel
+// does not fit in 24 bits.
+template <class Label>
+bool LayOutSharedChannels(CompressionPlan<Label>* plan) {
+  const size_t num_channels = plan->channels.size();
+  TableCache<Label> later_tables;
+  std::vector<ForwardTableReference> forward_references;
+  for (size_t channel_i = num_channels; channel_i-- > 0;) {
+    auto& channel = plan->channels[channel_i];
+    LayOutChannel(channel_i, &later_tables, &channel, &forward_references);
+    size_t table_begin = 0;
+    for (size_t block_offset = 0; block_offset < channel.writes_table.size();
+         ++block_offset) {
+      const size_t table_end = channel.table_values_end[block_offset];
+      if (channel.writes_table[block_offset]) {
+        CachedTable<Label> table;
+        table.values = channel.table_values.data() + table_begin;
+        table.size = table_end - table_begin;
+        table.hash = HashTable(table.values, table.size);
+        table.channel = channel_i;
+        table.offset = channel.headers[block_offset * kBlockHeaderSize] &
+                       0xffffff;
+        later_tables.Insert(table);
+      }
+      table_begin = table_end;
+    }
+  }
+  std::vector<size_t> channel_offsets(num_channels);
+  plan->size = num_channels;
+  for (size_t channel_i = 0; channel_i < num_channels; ++channel_i) {
+    channel_offsets[channel_i] = plan->size;
+    plan->size += plan->channels[channel_i].size;
+  }
+  for (const auto& reference : forward_references) {
+    const size_t table_offset = channel_offsets[reference.table_channel] +
+                                reference.table_offset -
+                                channel_offsets[reference.channel];
+    if (table_offset >= (size_t(1) << 24)) return false;
+    uint32_t* header = &plan->channels[reference.channel]
+                            .headers[reference.block_offset * kBlockHeaderSize];
+    header[0] |= table_offset;
+  }
+  return true;
+}
+
+}  // namespace
+
+template <class Label>
+void PlanChannel(const Label* input, const ptrdiff_t input_strides[3],
+                 const ptrdiff_t volume_size[3], const ptrdiff_t block_size[3],
+                 ChannelPlan<Label>* plan, int num_threads) {
+  ComputeChannelBlocks(input, input_strides, volume_size, block_size, plan,
+                       num_threads);
+  LayOutChannel<Label>(0, nullptr, plan, nullptr);
+}
+
+template <class Label>
+void WriteChannel(const ChannelPlan<Label>& plan, uint32_t* output) {
+  const size_t num_blocks = plan.headers.size() / kBlockHeaderSize;
+  std::copy(plan.headers.begin(), plan.headers.end(), output);
+  size_t encoded_begin = 0, table_begin = 0;
+  for (size_t block_offset = 0; block_offset < num_blocks; ++block_offset) {
+    const uint32_t* header = &plan.headers[block_offset * kBlockHeaderSize];
+    const size_t encoded_end = plan.encoded_values_end[block_offset];
+    const size_t table_end = plan.table_values_end[block_offset];
+    std::copy(plan.encoded_values.begin() + encoded_begin,
+              plan.encoded_values.begin() + encoded_end, output + header[1]);
+    if (plan.writes_table[block_offset]) {
+      WriteTableWords(plan.table_values.data() + table_begin,
+                      table_end - table_begin,
+                      output + (header[0] & 0xffffff));
+    }
+    encoded_begin = encoded_end;
+    table_begin = table_end;
   }
 }
 
@@ -155,41 +701,46 @@ template <class Label>
 void CompressChannel(const Label* input, const ptrdiff_t input_strides[3],
                      const ptrdiff_t volume_size[3],
                      const ptrdiff_t block_size[3],
-                     std::vector<uint32_t>* output) {
-  EncodedValueCache<Label> cache;
+                     std::vector<uint32_t>* output, int num_threads) {
+  trace_events::Span span("CompressChannel", "voxels",
+                          volume_size[0] * volume_size[1] * volume_size[2]);
+  ChannelPlan<Label> plan;
+  PlanChannel(input, input_strides, volume_size, block_size, &plan,
+              num_threads);
   const size_t base_offset = output->size();
-  ptrdiff_t grid_size[3];
-  size_t block_index_size = kBlockHeaderSize;
-  for (size_t i = 0; i < 3; ++i) {
-    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
-    block_index_size *= grid_size[i];
+  output->resize(base_offset + plan.size);
+  WriteChannel(plan, output->data() + base_offset);
+}
+
+template <class Label>
+void PlanChannels(const Label* input, const ptrdiff_t input_strides[4],
+                  const ptrdiff_t volume_size[4],
+                  const ptrdiff_t block_size[3], CompressionPlan<Label>* plan,
+                  int num_threads, bool share_tables) {
+  const size_t num_channels = volume_size[3];
+  plan->channels.resize(num_channels);
+  for (size_t channel_i = 0; channel_i < num_channels; ++channel_i) {
+    ComputeChannelBlocks(input + input_strides[3] * channel_i, input_strides,
+                         volume_size, block_size, &plan->channels[channel_i],
+                         num_threads);
   }
-  output->resize(base_offset + block_index_size);
-  ptrdiff_t block[3];
-  for (block[2] = 0; block[2] < grid_size[2]; ++block[2]) {
-    for (block[1] = 0; block[1] < grid_size[1]; ++block[1]) {
-      for (block[0] = 0; block[0] < grid_size[0]; ++block[0]) {
-        const size_t block_offset =
-            block[0] + grid_size[0] * (block[1] + grid_size[1] * block[2]);
-        ptrdiff_t actual_size[3];
-        ptrdiff_t input_offset = 0;
-        size_t num_values = 1;
-        for (size_t i = 0; i < 3; ++i) {
-          auto pos = block[i] * block_size[i];
-          actual_size[i] = std::min(block_size[i], volume_size[i] - pos);
-          input_offset += pos * input_strides[i];
-          num_values *= actual_size[i];
-        }
-        const size_t encoded_value_base_offset = output->size() - base_offset;
-        size_t encoded_bits, table_offset;
-        EncodeBlock(input + input_offset, input_strides, block_size,
-                    actual_size, base_offset, &encoded_bits, &table_offset,
-                    &cache, output);
-        WriteBlockHeader(
-            encoded_value_base_offset, table_offset, encoded_bits,
-            &(*output)[base_offset + block_offset * kBlockHeaderSize]);
-      }
-    }
+  if (share_tables && num_channels > 1 && LayOutSharedChannels(plan)) return;
+  plan->size = num_channels;
+  for (size_t channel_i = 0; channel_i < num_channels; ++channel_i) {
+    auto& channel = plan->channels[channel_i];
+    LayOutChannel<Label>(channel_i, nullptr, &channel, nullptr);
+    plan->size += channel.size;
+  }
+}
+
+template <class Label>
+void WriteChannels(const CompressionPlan<Label>& plan, uint32_t* output) {
+  const size_t num_channels = plan.channels.size();
+  size_t offset = num_channels;
+  for (size_t channel_i = 0; channel_i < num_channels; ++channel_i) {
+    output[channel_i] = offset;
+    WriteChannel(plan.channels[channel_i], output + offset);
+    offset += plan.channels[channel_i].size;
   }
 }
 
@@ -197,13 +748,108 @@ template <class Label>
 void CompressChannels(const Label* input, const ptrdiff_t input_strides[4],
                       const ptrdiff_t volume_size[4],
                       const ptrdiff_t block_size[3],
-                      std::vector<uint32_t>* output) {
-  output->resize(volume_size[3]);
-  for (size_t channel_i = 0; channel_i < volume_size[3]; ++channel_i) {
-    (*output)[channel_i] = output->size();
-    CompressChannel(input + input_strides[3] * channel_i, input_strides,
-                    volume_size, block_size, output);
+                      std::vector<uint32_t>* output, int num_threads,
+                      bool share_tables) {
+  trace_events::Span span(
+      "CompressChannels", "voxels",
+      volume_size[0] * volume_size[1] * volume_size[2] * volume_size[3]);
+  CompressionPlan<Label> plan;
+  PlanChannels(input, input_strides, volume_size, block_size, &plan,
+               num_threads, share_tables);
+  output->resize(plan.size);
+  WriteChannels(plan, output->data());
+}
+
+template <class Label>
+size_t ChooseBlockSize(const Label* input, const ptrdiff_t input_strides[3],
+                       const ptrdiff_t volume_size[3],
+                       const ptrdiff_t chunk_size[3],
+                       const ptrdiff_t (*candidates)[3], size_t num_candidates,
+                       size_t max_samples, int num_threads) {
+  ptrdiff_t grid_size[3];
+  const size_t num_chunks = GetGridSize(volume_size, chunk_size, grid_size);
+  const size_t num_samples = std::min(num_chunks, max_samples);
+  std::vector<size_t> sizes(num_candidates, 0);
+  ChannelPlan<Label> plan;
+  for (size_t sample_i = 0; sample_i < num_samples; ++sample_i) {
+    ptrdiff_t input_offset, sample_size[3];
+    GetBlockBounds(sample_i * num_chunks / num_samples, grid_size,
+                   volume_size, chunk_size, input_strides, &input_offset,
+                   sample_size);
+    for (size_t candidate_i = 0; candidate_i < num_candidates; ++candidate_i) {
+      plan = ChannelPlan<Label>();
+      PlanChannel(input + input_offset, input_strides, sample_size,
+                  candidates[candidate_i], &plan, num_threads);
+      sizes[candidate_i] += plan.size;
+    }
+  }
+  return std::min_element(sizes.begin(), sizes.end()) - sizes.begin();
+}
+
+template <class Label>
+StreamingChannelEncoder<Label>::StreamingChannelEncoder(
+    const ptrdiff_t volume_size[3], const ptrdiff_t block_size[3],
+    int num_threads)
+    : num_threads_(num_threads) {
+  std::copy(volume_size, volume_size + 3, volume_size_);
+  std::copy(block_size, block_size + 3, block_size_);
+  ptrdiff_t grid_size[3];
+  size_ = GetGridSize(volume_size, block_size, grid_size) * kBlockHeaderSize;
+  headers_.resize(size_);
+}
+
+template <class Label>
+ptrdiff_t StreamingChannelEncoder<Label>::next_slab_depth() const {
+  return std::min(block_size_[2], volume_size_[2] - next_z_);
+}
+
+template <class Label>
+void StreamingChannelEncoder<Label>::AddSlab(const Label* input,
+                                             const ptrdiff_t input_strides[3],
+                                             std::vector<uint32_t>* output) {
+  const ptrdiff_t slab_size[3] = {volume_size_[0], volume_size_[1],
+                                  next_slab_depth()};
+  ComputeChannelBlocks(input, input_strides, slab_size, block_size_, &slab_,
+                       num_threads_);
+  // Lay out the blocks of the slab as LayOutChannel does, but with tables
+  // shared across all slabs.
+  const size_t num_blocks = slab_.table_values_end.size();
+  const size_t first_block =
+      next_z_ / block_size_[2] * num_blocks * kBlockHeaderSize;
+  output->clear();
+  size_t encoded_begin = 0, table_begin = 0;
+  std::vector<Label> values;
+  for (size_t block_i = 0; block_i < num_blocks; ++block_i) {
+    const size_t encoded_end = slab_.encoded_values_end[block_i];
+    const size_t table_end = slab_.table_values_end[block_i];
+    const size_t encoded_value_base_offset = size_ + output->size();
+    output->insert(output->end(), slab_.encoded_values.begin() + encoded_begin,
+                   slab_.encoded_values.begin() + encoded_end);
+    size_t encoded_bits = 0, table_offset = 0;
+    if (table_end != table_begin) {
+      values.assign(slab_.table_values.begin() + table_begin,
+                    slab_.table_values.begin() + table_end);
+      encoded_bits = GetEncodedBits(values.size());
+      auto it = tables_.find(values);
+      if (it != tables_.end()) {
+        table_offset = it->second;
+      } else {
+        table_offset = size_ + output->size();
+        const size_t table_size = GetTableSize<Label>(values.size());
+        output->resize(output->size() + table_size);
+        WriteTableWords(values.data(), values.size(),
+                        output->data() + output->size() - table_size);
+        tables_.emplace(std::move(values), table_offset);
+        values.clear();
+      }
+    }
+    WriteBlockHeader(encoded_value_base_offset, table_offset, encoded_bits,
+                     &headers_[first_block + block_i * kBlockHeaderSize]);
+    encoded_begin = encoded_end;
+    table_begin = table_end;
   }
+  size_ += output->size();
+  next_z_ += slab_size[2];
 }
 
 #define DO_INSTANTIATE(Label)                                        \
@@ -213,16 +859,38 @@ void CompressChannels(const Label* input, const ptrdiff_t input_strides[4],
       size_t base_offset, size_t* encoded_bits_output,               \
       size_t* table_offset_output, EncodedValueCache<Label>* cache,  \
       std::vector<uint32_t>* output_vec);                            \
+  template void PlanChannel<Label>(                                  \
+      const Label* input, const ptrdiff_t input_strides[3],          \
+      const ptrdiff_t volume_size[3], const ptrdiff_t block_size[3], \
+      ChannelPlan<Label>* plan, int num_threads);                    \
+  template void WriteChannel<Label>(const ChannelPlan<Label>& plan, \
+                                    uint32_t* output);               \
+  template void PlanChannels<Label>(                                 \
+      const Label* input, const ptrdiff_t input_strides[4],          \
+      const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3], \
+      CompressionPlan<Label>* plan, int num_threads,                 \
+      bool share_tables);                                            \
+  template void WriteChannels<Label>(                                \
+      const CompressionPlan<Label>& plan, uint32_t* output);         \
   template void CompressChannel<Label>(                              \
       const Label* input, const ptrdiff_t input_strides[3],          \
       const ptrdiff_t volume_size[3], const ptrdiff_t block_size[3], \
-      std::vector<uint32_t>* output);                                \
+      std::vector<uint32_t>* output, int num_threads);               \
   template void CompressChannels<Label>(                             \
       const Label* input, const ptrdiff_t input_strides[4],          \
       const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3], \
-      std::vector<uint32_t>* output);                                \
+      std::vector<uint32_t>* output, int num_threads,                \
+      bool share_tables);                                            \
+  template size_t ChooseBlockSize<Label>(                            \
+      const Label* input, const ptrdiff_t input_strides[3],          \
+      const ptrdiff_t volume_size[3], const ptrdiff_t chunk_size[3], \
+      const ptrdiff_t(*candidates)[3], size_t num_candidates,        \
+      size_t max_samples, int num_threads);                          \
+  template class StreamingChannelEncoder<Label>;                     \
 /**/
 
+DO_INSTANTIATE(uint8_t)
+DO_INSTANTIATE(uint16_t)
 DO_INSTANTIATE(uint32_t)
 DO_INSTANTIATE(uint64_t)
 
@@ -17,7 +17,9 @@
 // Implements encoding into the compressed segmentation format described at
 // https://github.com/google/neuroglancer/tree/master/src/neuroglancer/sliceview/compressed_segmentation.
 //
-// Only uint32 and uint64 volumes are supported.
+// uint8, uint16, uint32 and uint64 volumes are supported.  uint8 and uint16
+// volumes are read directly, and encoded with the uint32 table layout, so
+// their encoding is identical to that of the same volume widened to uint32.
 
 // Compress a 3-D label array by splitting in a grid of fixed-size blocks, and
 // encoding each block using a per-block table of label values.  The number of
@@ -121,6 +123,70 @@ void EncodeBlock(const Label* input, const ptrdiff_t input_strides[3],
                  size_t* table_offset_output, EncodedValueCache<Label>* cache,
                  std::vector<uint32_t>* output_vec);
 
+// Encoding of a single channel, computed by PlanChannel, from which the
+// exact size of the output is known before it is written.
+template <class Label>
+struct ChannelPlan {
+  // Number of 32-bit words of the encoded channel.
+  size_t size = 0;
+  // Encoded values of each block, concatenated in block order.
+  std::vector<uint32_t> encoded_values;
+  // Distinct values of each block, in increasing order, concatenated in block
+  // order.
+  std::vector<Label> table_values;
+  // For each block, the end offsets of its values in encoded_values and
+  // table_values.
+  std::vector<size_t> encoded_values_end;
+  std::vector<size_t> table_values_end;
+  // Block headers, as written to the output.
+  std::vector<uint32_t> headers;
+  // For each block, whether its table is written following its encoded
+  // values, rather than shared with an earlier block.
+  std::vector<bool> writes_table;
+};
+
+// Encoding of multiple channels, computed by PlanChannels.
+template <class Label>
+struct CompressionPlan {
+  // Number of 32-bit words of the encoded channels, including the channel
+  // offsets.
+  size_t size = 0;
+  std::vector<ChannelPlan<Label>> channels;
+};
+
+// Computes the tables and encoded values of the blocks of a single channel,
+// and the layout of its encoding, which determines its exact size.  This is
+// the only pass over the input.
+//
+// The arguments are as for CompressChannel.
+template <class Label>
+void PlanChannel(const Label* input, const ptrdiff_t input_strides[3],
+                 const ptrdiff_t volume_size[3], const ptrdiff_t block_size[3],
+                 ChannelPlan<Label>* plan, int num_threads = 1);
+
+// Writes the encoding of a single channel to the `plan.size` 32-bit words at
+// `output`.  The existing content of `output` is ignored.
+template <class Label>
+void WriteChannel(const ChannelPlan<Label>& plan, uint32_t* output);
+
+// Computes the encoding of multiple channels, as for PlanChannel.
+//
+// The arguments are as for CompressChannels.
+template <class Label>
+void PlanChannels(const Label* input, const ptrdiff_t input_strides[4],
+                  const ptrdiff_t volume_size[4],
+                  const ptrdiff_t block_size[3], CompressionPlan<Label>* plan,
+                  int num_threads = 1, bool share_tables = false);
+
+// Writes the encoding of multiple channels to the `plan.size` 32-bit words at
+// `output`.  The existing content of `output` is ignored.
+//
+// Together with PlanChannels, this allows encoding into a caller-provided
+// buffer of the exact size, such as a Python bytes object, without an
+// intermediate copy of the output.
+template <class Label>
+void WriteChannels(const CompressionPlan<Label>& plan, uint32_t* output);
+
 // Encodes a single channel.
 //
 // Args:
@@ -134,15 +200,24 @@ void EncodeBlock(const Label* input, const ptrdiff_t input_strides[3],
 //   block_size: Extent of the x, y, and z dimensions of the block.
 //
 //   output: Vector to which output will be appended.
+//
+//   num_threads: Number of threads with which to encode blocks, or 0 to use
+//       the number of hardware threads.  If not 1, the tables and encoded
+//       values of ranges of blocks are computed in parallel, and then
+//       concatenated with the same table deduplication as sequential
+//       encoding.  The output does not depend on the number of threads.
+//
+// The output is planned with PlanChannel before it is written, so that
+// `output` is resized only once.
 template <class Label>
 void CompressChannel(const Label* input, const ptrdiff_t input_strides[3],
                      const ptrdiff_t volume_size[3],
                      const ptrdiff_t block_size[3],
-                     std::vector<uint32_t>* output);
+                     std::vector<uint32_t>* output, int num_threads = 1);
 
 // Encodes multiple channels.
 //
-// Each channel is encoded independently.
+// Unless share_tables is true, each channel is encoded independently.
 //
 // The output starts with num_channels (=volume_size[3]) uint32 values
 // specifying the starting offset of the encoding of each channel (the first
@@ -161,11 +236,98 @@ void CompressChannel(const Label* input, const ptrdiff_t input_strides[3],
 //
 //   output: Vector where output will be stored.  Any existing content is
 //       cleared.
+//
+//   num_threads: Number of threads with which to encode each channel, as for
+//       CompressChannel.
+//
+//   share_tables: If true, a table used by blocks of several channels is
+//       written only once, in the last of those channels, and blocks of
+//       earlier channels refer to it with an offset beyond the end of their
+//       channel.  Since table offsets are relative to the start of the
+//       channel, such output is valid for decoders that, like the Neuroglancer
+//       client and DecompressChannels, read each channel from the full
+//       encoded buffer.  If an offset would not fit in the 24 bits of the
+//       block header, the channels are encoded independently.
 template <class Label>
 void CompressChannels(const Label* input, const ptrdiff_t input_strides[4],
                       const ptrdiff_t volume_size[4],
                       const ptrdiff_t block_size[3],
-                      std::vector<uint32_t>* output);
+                      std::vector<uint32_t>* output, int num_threads = 1,
+                      bool share_tables = false);
+
+// Chooses the block size of a volume from `num_candidates` candidates, for
+// the encoder to adapt to the density of the labels: sparse labels encode
+// more compactly with larger blocks, and dense labels with smaller blocks of
+// fewer bits per value.  The format records the block size once per volume
+// scale rather than per chunk, so a single size is chosen for all chunks.
+//
+// Up to `max_samples` chunks of `chunk_size` of the single channel `input`,
+// evenly spaced in chunk order, are planned with each candidate, as by
+// PlanChannel with `num_threads` threads.  Returns the index of the candidate
+// with the smallest total encoded size, preferring earlier candidates in case
+// of a tie.
+//
+// The other arguments are as for CompressChannel.
+template <class Label>
+size_t ChooseBlockSize(const Label* input, const ptrdiff_t input_strides[3],
+                       const ptrdiff_t volume_size[3],
+                       const ptrdiff_t chunk_size[3],
+                       const ptrdiff_t (*candidates)[3], size_t num_candidates,
+                       size_t max_samples, int num_threads = 1);
+
+// Encodes a single channel exactly as CompressChannel does, from z-slabs of
+// the volume supplied in order, so that the input need only be available one
+// row of blocks at a time, e.g. as it is generated.
+//
+// The encoding consists of `header_size()` words of block headers, which are
+// complete only once all slabs are encoded, followed by the words produced by
+// each call to AddSlab, in order.  A caller streaming the encoding, e.g. to a
+// file, reserves the header words, appends the words of each slab, and
+// finally writes `headers()` to the reserved words.  Besides the input slab,
+// memory is bounded by the encoding of one row of blocks, the block headers
+// and one copy of each distinct table.
+template <class Label>
+class StreamingChannelEncoder {
+ public:
+  // Args:
+  //   volume_size: Extent of the x, y, and z dimensions of the volume.
+  //
+  //   block_size: Extent of the x, y, and z dimensions of the block.
+  //
+  //   num_threads: Number of threads with which to encode the blocks of each
+  //       slab, as for CompressChannel.
+  StreamingChannelEncoder(const ptrdiff_t volume_size[3],
+                          const ptrdiff_t block_size[3], int num_threads = 1);
+
+  // Returns the number of z slices of the next slab: `block_size[2]`, or
+  // fewer for the last slab, or 0 once all slabs are encoded.
+  ptrdiff_t next_slab_depth() const;
+
+  // Encodes the next slab of `next_slab_depth()` z slices at `input`, with
+  // `input_strides` as for CompressChannel.  Any existing content of
+  // `*output` is replaced by the words of the slab.
+  void AddSlab(const Label* input, const ptrdiff_t input_strides[3],
+               std::vector<uint32_t>* output);
+
+  size_t header_size() const { return headers_.size(); }
+
+  // Block headers, as written at the start of the encoding.
+  const std::vector<uint32_t>& headers() const { return headers_; }
+
+ private:
+  ptrdiff_t volume_size_[3];
+  ptrdiff_t block_size_[3];
+  int num_threads_;
+  // First z slice of the next slab.
+  ptrdiff_t next_z_ = 0;
+  // Number of words of the encoding so far, including the block headers.
+  size_t size_;
+  std::vector<uint32_t> headers_;
+  // Offsets of the tables written so far.
+  EncodedValueCache<Label> tables_;
+  // Blocks of the current slab.
+  ChannelPlan<Label> slab_;
+};
 
 }  // namespace compress_segmentation
 }  // namespace neuroglancer
@@ -16,6 +16,8 @@
 
 #include "compress_segmentation.h"
 
+#include <algorithm>
+
 #include "gtest/gtest.h"
 
 namespace neuroglancer {
@@ -113,6 +115,96 @@ TEST(EncodeBlockTest, Basic2) {
   ASSERT_EQ(cache, (EncodedValueCache<uint64_t>{{{3, 4, 5}, 1}}));
 }
 
+// Test 8-bit encoding of a block with more distinct values than are looked up
+// by linear search.
+TEST(EncodeBlockTest, ManyValues) {
+  std::vector<uint64_t> input(32);
+  for (size_t i = 0; i < input.size(); ++i) {
+    input[i] = (i * 7) % 32 + 10;
+  }
+  const ptrdiff_t input_strides[3] = {1, 4, 16};
+  const ptrdiff_t block_size[3] = {4, 4, 2};
+  std::vector<uint32_t> output{1, 2, 3};
+  std::vector<uint32_t> expected{1, 2, 3};
+  expected.resize(3 + 8);
+  for (size_t i = 0; i < input.size(); ++i) {
+    expected[3 + i / 4] |= ((i * 7) % 32) << (8 * (i % 4));
+  }
+  std::vector<uint64_t> table;
+  for (uint64_t value = 10; value < 42; ++value) {
+    table.push_back(value);
+    expected.push_back(value);
+    expected.push_back(0);
+  }
+  size_t encoded_bits;
+  size_t table_offset;
+  EncodedValueCache<uint64_t> cache;
+  EncodeBlock(input.data(), input_strides, block_size, block_size, 3,
+              &encoded_bits, &table_offset, &cache, &output);
+  ASSERT_EQ(8, encoded_bits);
+  ASSERT_EQ(8, table_offset);
+  ASSERT_EQ(expected, output);
+  ASSERT_EQ(cache, (EncodedValueCache<uint64_t>{{table, 8}}));
+}
+
+// Test each encoding width, with rows that do not start or end on 32-bit word
+// boundaries, and with both contiguous and strided x dimensions.
+TEST(EncodeBlockTest, AllWidths) {
+  const ptrdiff_t block_size[3] = {13, 7, 5};
+  const ptrdiff_t actual_size[3] = {11, 7, 4};
+  const size_t num_values = block_size[0] * block_size[1] * block_size[2];
+  const size_t num_actual_values =
+      actual_size[0] * actual_size[1] * actual_size[2];
+  for (size_t expected_bits : {1, 2, 4, 8, 16}) {
+    const size_t num_labels =
+        std::min(size_t(1) << expected_bits, num_actual_values);
+    // Runs of equal values, so that some words are uniform, short enough that
+    // every label occurs.
+    const size_t run_length =
+        std::max(size_t(1), num_actual_values / (2 * num_labels));
+    for (bool transposed : {false, true}) {
+      // The input is stored with x either innermost or outermost.
+      ptrdiff_t input_strides[3] = {1, actual_size[0],
+                                    actual_size[0] * actual_size[1]};
+      if (transposed) {
+        input_strides[2] = 1;
+        input_strides[1] = actual_size[2];
+        input_strides[0] = actual_size[2] * actual_size[1];
+      }
+      std::vector<uint64_t> input(num_actual_values);
+      std::vector<uint32_t> expected{1, 2, 3};
+      expected.resize(3 + (expected_bits * num_values + 31) / 32);
+      for (ptrdiff_t z = 0; z < actual_size[2]; ++z) {
+        for (ptrdiff_t y = 0; y < actual_size[1]; ++y) {
+          for (ptrdiff_t x = 0; x < actual_size[0]; ++x) {
+            const size_t ordinal =
+                x + actual_size[0] * (y + actual_size[1] * z);
+            const size_t index = ordinal / run_length % num_labels;
+            const size_t position = x + block_size[0] * (y + block_size[1] * z);
+            input[x * input_strides[0] + y * input_strides[1] +
+                  z * input_strides[2]] = index * 3 + 1;
+            const size_t bit = position * expected_bits;
+            expected[3 + bit / 32] |= index << (bit % 32);
+          }
+        }
+      }
+      for (size_t index = 0; index < num_labels; ++index) {
+        expected.push_back(index * 3 + 1);
+        expected.push_back(0);
+      }
+      std::vector<uint32_t> output{1, 2, 3};
+      size_t encoded_bits;
+      size_t table_offset;
+      EncodedValueCache<uint64_t> cache;
+      EncodeBlock(input.data(), input_strides, block_size, actual_size, 3,
+                  &encoded_bits, &table_offset, &cache, &output);
+      ASSERT_EQ(expected_bits, encoded_bits);
+      ASSERT_EQ(expected, output)
+          << "bits=" << expected_bits << ", transposed=" << transposed;
+    }
+  }
+}
+
 TEST(CompressChannelTest, Basic) {
   std::vector<uint64_t> input{4, 3, 5, 4, 1, 3, 3, 3};
   const ptrdiff_t input_strides[3] = {1, 2, 4};
@@ -224,6 +316,158 @@ TEST(CompressChannelTest, BasicCached32) {
   ASSERT_EQ(expected, output);
 }
 
+// Parallel encoding deduplicates tables across ranges of blocks exactly as
+// sequential encoding does.
+TEST(CompressChannelTest, ParallelBasicCached) {
+  std::vector<uint64_t> input{
+      4, 3, 5, 4,  //
+      1, 3, 3, 3,  //
+      3, 1, 1, 1,  //
+      5, 5, 3, 4,  //
+  };
+  const ptrdiff_t input_strides[3] = {1, 2, 4};
+  const ptrdiff_t volume_size[3] = {2, 2, 4};
+  const ptrdiff_t block_size[3] = {2, 2, 1};
+  std::vector<uint32_t> expected{1, 2, 3};
+  CompressChannel(input.data(), input_strides, volume_size, block_size,
+                  &expected);
+  for (int num_threads : {0, 2, 4}) {
+    std::vector<uint32_t> output{1, 2, 3};
+    CompressChannel(input.data(), input_strides, volume_size, block_size,
+                    &output, num_threads);
+    EXPECT_EQ(expected, output) << "num_threads=" << num_threads;
+  }
+}
+
+TEST(CompressChannelsTest, ParallelMatchesSequential) {
+  // Labels from a small set that varies slowly, so that many blocks share
+  // tables, with partial blocks at the upper bounds.
+  const ptrdiff_t volume_size[4] = {37, 21, 19, 2};
+  const ptrdiff_t input_strides[4] = {1, 37, 37 * 21, 37 * 21 * 19};
+  const ptrdiff_t block_size[3] = {8, 8, 4};
+  std::vector<uint64_t> input(37 * 21 * 19 * 2);
+  uint64_t state = 1;
+  for (auto& value : input) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    value = (state >> 60) < 2 ? (state >> 40) % 16 : 3;
+  }
+  std::vector<uint32_t> expected;
+  CompressChannels(input.data(), input_strides, volume_size, block_size,
+                   &expected);
+  for (int num_threads : {2, 3, 8}) {
+    std::vector<uint32_t> output;
+    CompressChannels(input.data(), input_strides, volume_size, block_size,
+                     &output, num_threads);
+    EXPECT_EQ(expected, output) << "num_threads=" << num_threads;
+  }
+}
+
+// Writing a planned encoding to a caller-provided buffer produces the same
+// output as CompressChannels, regardless of the prior buffer content.
+TEST(CompressChannelsTest, PlanAndWrite) {
+  const ptrdiff_t volume_size[4] = {21, 13, 9, 3};
+  const ptrdiff_t input_strides[4] = {1, 21, 21 * 13, 21 * 13 * 9};
+  const ptrdiff_t block_size[3] = {8, 4, 4};
+  std::vector<uint32_t> input(21 * 13 * 9 * 3);
+  for (size_t i = 0; i < input.size(); ++i) {
+    input[i] = static_cast<uint32_t>((i / 7) % 5 + (i / 1000) * 3);
+  }
+  std::vector<uint32_t> expected;
+  CompressChannels(input.data(), input_strides, volume_size, block_size,
+                   &expected);
+  for (int num_threads : {1, 3}) {
+    CompressionPlan<uint32_t> plan;
+    PlanChannels(input.data(), input_strides, volume_size, block_size, &plan,
+                 num_threads);
+    ASSERT_EQ(expected.size(), plan.size);
+    std::vector<uint32_t> output(plan.size, 0xdeadbeef);
+    WriteChannels(plan, output.data());
+    EXPECT_EQ(expected, output) << "num_threads=" << num_threads;
+  }
+}
+
+// Tests that narrow labels are encoded as if widened to uint32.
+template <class Label>
+void TestNarrowLabels() {
+  const ptrdiff_t volume_size[4] = {21, 13, 9, 2};
+  const ptrdiff_t input_strides[4] = {1, 21, 21 * 13, 21 * 13 * 9};
+  const ptrdiff_t block_size[3] = {8, 4, 4};
+  std::vector<Label> input(21 * 13 * 9 * 2);
+  std::vector<uint32_t> widened(input.size());
+  for (size_t i = 0; i < input.size(); ++i) {
+    input[i] = static_cast<Label>((i / 7) % 5 + (i / 100) * 37);
+    widened[i] = input[i];
+  }
+  std::vector<uint32_t> expected, output;
+  CompressChannels(widened.data(), input_strides, volume_size, block_size,
+                   &expected);
+  CompressChannels(input.data(), input_strides, volume_size, block_size,
+                   &output);
+  EXPECT_EQ(expected, output);
+}
+
+TEST(CompressChannelsTest, Uint8) { TestNarrowLabels<uint8_t>(); }
+
+TEST(CompressChannelsTest, Uint16) { TestNarrowLabels<uint16_t>(); }
+
+// A volume of a single label encodes most compactly with the largest blocks,
+// and one of constant 4x4x4 cubes of distinct labels with blocks of that size.
+TEST(ChooseBlockSizeTest, AdaptsToLabelDensity) {
+  const ptrdiff_t volume_size[3] = {32, 32, 24};
+  const ptrdiff_t input_strides[3] = {1, 32, 32 * 32};
+  const ptrdiff_t chunk_size[3] = {16, 16, 16};
+  const ptrdiff_t candidates[3][3] = {{8, 8, 8}, {4, 4, 4}, {16, 16, 16}};
+  std::vector<uint64_t> input(32 * 32 * 24, 5);
+  EXPECT_EQ(2u, ChooseBlockSize(input.data(), input_strides, volume_size,
+                                chunk_size, candidates, 3, 4));
+  for (ptrdiff_t z = 0; z < volume_size[2]; ++z) {
+    for (ptrdiff_t y = 0; y < volume_size[1]; ++y) {
+      for (ptrdiff_t x = 0; x < volume_size[0]; ++x) {
+        input[x + 32 * (y + 32 * z)] = 1 + x / 4 + 8 * (y / 4 + 8 * (z / 4));
+      }
+    }
+  }
+  EXPECT_EQ(1u, ChooseBlockSize(input.data(), input_strides, volume_size,
+                                chunk_size, candidates, 3, 100, 2));
+}
+
+// Encoding z-slabs in turn produces the same encoding as CompressChannel, with
+// tables shared across slabs.
+TEST(StreamingChannelEncoderTest, MatchesCompressChannel) {
+  const ptrdiff_t volume_size[3] = {21, 13, 19};
+  const ptrdiff_t input_strides[3] = {1, 21, 21 * 13};
+  const ptrdiff_t block_size[3] = {8, 4, 4};
+  std::vector<uint64_t> input(21 * 13 * 19);
+  uint64_t state = 1;
+  for (auto& value : input) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    value = (state >> 60) < 2 ? (state >> 40) % 16 : 3;
+  }
+  std::vector<uint32_t> expected;
+  CompressChannel(input.data(), input_strides, volume_size, block_size,
+                  &expected);
+  for (int num_threads : {1, 3}) {
+    StreamingChannelEncoder<uint64_t> encoder(volume_size, block_size,
+                                              num_threads);
+    std::vector<uint32_t> output(encoder.header_size()), slab;
+    ptrdiff_t z = 0, depth;
+    while ((depth = encoder.next_slab_depth()) != 0) {
+      EXPECT_EQ(std::min(ptrdiff_t(4), volume_size[2] - z), depth);
+      // Each slab is provided as a separate copy.
+      const std::vector<uint64_t> slab_input(
+          input.begin() + z * input_strides[2],
+          input.begin() + (z + depth) * input_strides[2]);
+      encoder.AddSlab(slab_input.data(), input_strides, &slab);
+      output.insert(output.end(), slab.begin(), slab.end());
+      z += depth;
+    }
+    EXPECT_EQ(volume_size[2], z);
+    std::copy(encoder.headers().begin(), encoder.headers().end(),
+              output.begin());
+    EXPECT_EQ(expected, output) << "num_threads=" << num_threads;
+  }
+}
+
 }  // namespace
 }  // namespace compress_segmentation
 }  // namespace neuroglancer
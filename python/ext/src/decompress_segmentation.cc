@@ -0,0 +1,392 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "decompress_segmentation.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace neuroglancer {
+namespace compress_segmentation {
+
+namespace {
+
+constexpr size_t kBlockHeaderSize = 2;
+
+template <class Label>
+constexpr size_t NumWordsPerLabel() {
+  return (sizeof(Label) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+}
+
+template <class Label>
+Label ReadTableEntry(const uint32_t* entry) {
+  Label value = 0;
+  for (size_t word_i = 0; word_i < NumWordsPerLabel<Label>(); ++word_i) {
+    value |= static_cast<Label>(entry[word_i]) << (32 * word_i);
+  }
+  return value;
+}
+
+// Decodes the box [start, end), relative to the origin of the block, of the
+// block with header `header` of the channel at `input`.  `output` points to
+// the output element for `start`.
+template <class Label>
+bool DecompressBlock(const uint32_t* input, size_t input_size,
+                     const uint32_t header[2], const ptrdiff_t block_size[3],
+                     const ptrdiff_t start[3], const ptrdiff_t end[3],
+                     const ptrdiff_t output_strides[3], Label* output) {
+  constexpr size_t num_32bit_words_per_label = NumWordsPerLabel<Label>();
+  const size_t table_offset = header[0] & 0xffffff;
+  const size_t encoded_bits = header[0] >> 24;
+  const size_t encoded_value_offset = header[1] & 0xffffff;
+  if (table_offset >= input_size) return false;
+  // The format does not record the size of the table, so indices are only
+  // checked against the end of the input.
+  const size_t max_table_size =
+      (input_size - table_offset) / num_32bit_words_per_label;
+  if (max_table_size == 0) return false;
+  const uint32_t* table = input + table_offset;
+
+  if (encoded_bits == 0) {
+    const Label value = ReadTableEntry<Label>(table);
+    auto* output_z = output;
+    for (ptrdiff_t z = start[2]; z < end[2]; ++z) {
+      auto* output_y = output_z;
+      for (ptrdiff_t y = start[1]; y < end[1]; ++y) {
+        auto* output_x = output_y;
+        for (ptrdiff_t x = start[0]; x < end[0]; ++x) {
+          *output_x = value;
+          output_x += output_strides[0];
+        }
+        output_y += output_strides[1];
+      }
+      output_z += output_strides[2];
+    }
+    return true;
+  }
+
+  switch (encoded_bits) {
+    case 1:
+    case 2:
+    case 4:
+    case 8:
+    case 16:
+    case 32:
+      break;
+    default:
+      return false;
+  }
+  const size_t encoded_size =
+      (encoded_bits * block_size[0] * block_size[1] * block_size[2] + 31) / 32;
+  if (encoded_value_offset > input_size ||
+      input_size - encoded_value_offset < encoded_size) {
+    return false;
+  }
+  const uint32_t* encoded_values = input + encoded_value_offset;
+  const uint32_t mask =
+      static_cast<uint32_t>((uint64_t(1) << encoded_bits) - 1);
+  auto* output_z = output;
+  for (ptrdiff_t z = start[2]; z < end[2]; ++z) {
+    auto* output_y = output_z;
+    for (ptrdiff_t y = start[1]; y < end[1]; ++y) {
+      auto* output_x = output_y;
+      size_t bit =
+          encoded_bits * (start[0] + block_size[0] * (y + block_size[1] * z));
+      for (ptrdiff_t x = start[0]; x < end[0]; ++x) {
+        const size_t index = (encoded_values[bit / 32] >> (bit % 32)) & mask;
+        if (index >= max_table_size) return false;
+        *output_x = ReadTableEntry<Label>(table +
+                                          index * num_32bit_words_per_label);
+        bit += encoded_bits;
+        output_x += output_strides[0];
+      }
+      output_y += output_strides[1];
+    }
+    output_z += output_strides[2];
+  }
+  return true;
+}
+
+}  // namespace
+
+template <class Label>
+bool DecompressChannel(const uint32_t* input, size_t input_size,
+                       const ptrdiff_t volume_size[3],
+                       const ptrdiff_t block_size[3], const ptrdiff_t start[3],
+                       const ptrdiff_t end[3],
+                       const ptrdiff_t output_strides[3], Label* output) {
+  ptrdiff_t grid_size[3];
+  size_t block_index_size = kBlockHeaderSize;
+  for (size_t i = 0; i < 3; ++i) {
+    if (start[i] >= end[i]) return true;
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+    block_index_size *= grid_size[i];
+  }
+  if (block_index_size > input_size) return false;
+  ptrdiff_t grid_start[3], grid_end[3];
+  for (size_t i = 0; i < 3; ++i) {
+    grid_start[i] = start[i] / block_size[i];
+    grid_end[i] = (end[i] + block_size[i] - 1) / block_size[i];
+  }
+  for (ptrdiff_t bz = grid_start[2]; bz < grid_end[2]; ++bz) {
+    for (ptrdiff_t by = grid_start[1]; by < grid_end[1]; ++by) {
+      for (ptrdiff_t bx = grid_start[0]; bx < grid_end[0]; ++bx) {
+        const ptrdiff_t block[3] = {bx, by, bz};
+        // Bounds of the intersection of the block and the box, relative to
+        // the origin of the block.
+        ptrdiff_t block_start[3], block_end[3];
+        Label* block_output = output;
+        for (size_t i = 0; i < 3; ++i) {
+          const ptrdiff_t origin = block[i] * block_size[i];
+          block_start[i] = std::max(start[i], origin) - origin;
+          block_end[i] = std::min(end[i], origin + block_size[i]) - origin;
+          block_output +=
+              (origin + block_start[i] - start[i]) * output_strides[i];
+        }
+        const size_t block_offset =
+            bx + grid_size[0] * (by + grid_size[1] * bz);
+        if (!DecompressBlock(input, input_size,
+                             input + block_offset * kBlockHeaderSize,
+                             block_size, block_start, block_end,
+                             output_strides, block_output)) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+template <class Label>
+bool DecompressChannels(const uint32_t* input, size_t input_size,
+                        const ptrdiff_t volume_size[4],
+                        const ptrdiff_t block_size[3],
+                        const ptrdiff_t start[3], const ptrdiff_t end[3],
+                        const ptrdiff_t output_strides[4], Label* output) {
+  if (static_cast<size_t>(volume_size[3]) > input_size) return false;
+  for (ptrdiff_t channel_i = 0; channel_i < volume_size[3]; ++channel_i) {
+    const size_t channel_offset = input[channel_i];
+    if (channel_offset > input_size) return false;
+    if (!DecompressChannel(input + channel_offset, input_size - channel_offset,
+                           volume_size, block_size, start, end,
+                           output_strides,
+                           output + output_strides[3] * channel_i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <class Label>
+bool ReadValue(const uint32_t* input, size_t input_size,
+               const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3],
+               const ptrdiff_t position[4], Label* value) {
+  if (static_cast<size_t>(position[3]) >= input_size) return false;
+  const size_t channel_offset = input[position[3]];
+  if (channel_offset > input_size) return false;
+  const ptrdiff_t end[3] = {position[0] + 1, position[1] + 1, position[2] + 1};
+  const ptrdiff_t output_strides[3] = {0, 0, 0};
+  return DecompressChannel(input + channel_offset, input_size - channel_offset,
+                           volume_size, block_size, position, end,
+                           output_strides, value);
+}
+
+template <class Label>
+bool ReadUniformBlockValue(const uint32_t* input, size_t input_size,
+                           const ptrdiff_t volume_size[3],
+                           const ptrdiff_t block_size[3],
+                           const ptrdiff_t block[3], bool* uniform,
+                           Label* value) {
+  ptrdiff_t grid_size[3];
+  for (size_t i = 0; i < 3; ++i) {
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+  }
+  const size_t block_offset =
+      block[0] + grid_size[0] * (block[1] + grid_size[1] * block[2]);
+  if ((block_offset + 1) * kBlockHeaderSize > input_size) return false;
+  const uint32_t* header = input + block_offset * kBlockHeaderSize;
+  if (header[0] >> 24) {
+    *uniform = false;
+    return true;
+  }
+  const size_t table_offset = header[0] & 0xffffff;
+  if (table_offset > input_size ||
+      input_size - table_offset < NumWordsPerLabel<Label>()) {
+    return false;
+  }
+  *uniform = true;
+  *value = ReadTableEntry<Label>(input + table_offset);
+  return true;
+}
+
+namespace {
+
+// Adds the number of voxels within the volume of each label of the block at
+// grid position `block` of the channel at `input` to `counts`.
+// `index_counts` is used as scratch space.
+template <class Label>
+bool CountBlockLabels(const uint32_t* input, size_t input_size,
+                      const ptrdiff_t volume_size[3],
+                      const ptrdiff_t block_size[3],
+                      const ptrdiff_t grid_size[3], const ptrdiff_t block[3],
+                      std::vector<uint64_t>* index_counts,
+                      std::unordered_map<Label, uint64_t>* counts) {
+  constexpr size_t num_32bit_words_per_label = NumWordsPerLabel<Label>();
+  const size_t block_offset =
+      block[0] + grid_size[0] * (block[1] + grid_size[1] * block[2]);
+  const uint32_t* header = input + block_offset * kBlockHeaderSize;
+  const size_t table_offset = header[0] & 0xffffff;
+  const size_t encoded_bits = header[0] >> 24;
+  const size_t encoded_value_offset = header[1] & 0xffffff;
+  if (table_offset >= input_size) return false;
+  const size_t max_table_size =
+      (input_size - table_offset) / num_32bit_words_per_label;
+  if (max_table_size == 0) return false;
+  const uint32_t* table = input + table_offset;
+  ptrdiff_t actual_size[3];
+  for (size_t i = 0; i < 3; ++i) {
+    actual_size[i] = std::min(block_size[i],
+                              volume_size[i] - block[i] * block_size[i]);
+  }
+  if (encoded_bits == 0) {
+    (*counts)[ReadTableEntry<Label>(table)] +=
+        actual_size[0] * actual_size[1] * actual_size[2];
+    return true;
+  }
+  switch (encoded_bits) {
+    case 1:
+    case 2:
+    case 4:
+    case 8:
+    case 16:
+    case 32:
+      break;
+    default:
+      return false;
+  }
+  const size_t encoded_size =
+      (encoded_bits * block_size[0] * block_size[1] * block_size[2] + 31) / 32;
+  if (encoded_value_offset > input_size ||
+      input_size - encoded_value_offset < encoded_size) {
+    return false;
+  }
+  const uint32_t* encoded_values = input + encoded_value_offset;
+  const uint32_t mask =
+      static_cast<uint32_t>((uint64_t(1) << encoded_bits) - 1);
+  // Indices are bounded by the table, and for up to 16 bits by the encoding.
+  const size_t max_index_count =
+      std::min(max_table_size, size_t(1) << std::min(encoded_bits, size_t(16)));
+  index_counts->assign(max_index_count, 0);
+  for (ptrdiff_t z = 0; z < actual_size[2]; ++z) {
+    for (ptrdiff_t y = 0; y < actual_size[1]; ++y) {
+      size_t bit = encoded_bits * block_size[0] * (y + block_size[1] * z);
+      for (ptrdiff_t x = 0; x < actual_size[0]; ++x, bit += encoded_bits) {
+        const size_t index = (encoded_values[bit / 32] >> (bit % 32)) & mask;
+        if (index >= max_index_count) {
+          if (index >= max_table_size) return false;
+          index_counts->resize(index + 1);
+        }
+        ++(*index_counts)[index];
+      }
+    }
+  }
+  for (size_t index = 0; index < index_counts->size(); ++index) {
+    const uint64_t count = (*index_counts)[index];
+    if (count == 0) continue;
+    (*counts)[ReadTableEntry<Label>(
+        table + index * num_32bit_words_per_label)] += count;
+  }
+  return true;
+}
+
+}  // namespace
+
+template <class Label>
+bool CountLabels(const uint32_t* input, size_t input_size,
+                 const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3],
+                 std::vector<Label>* labels, std::vector<uint64_t>* counts) {
+  if (static_cast<size_t>(volume_size[3]) > input_size) return false;
+  ptrdiff_t grid_size[3];
+  size_t block_index_size = kBlockHeaderSize;
+  for (size_t i = 0; i < 3; ++i) {
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+    block_index_size *= grid_size[i];
+  }
+  std::unordered_map<Label, uint64_t> label_counts;
+  std::vector<uint64_t> index_counts;
+  for (ptrdiff_t channel_i = 0; channel_i < volume_size[3]; ++channel_i) {
+    const size_t channel_offset = input[channel_i];
+    if (channel_offset > input_size ||
+        input_size - channel_offset < block_index_size) {
+      return false;
+    }
+    ptrdiff_t block[3];
+    for (block[2] = 0; block[2] < grid_size[2]; ++block[2]) {
+      for (block[1] = 0; block[1] < grid_size[1]; ++block[1]) {
+        for (block[0] = 0; block[0] < grid_size[0]; ++block[0]) {
+          if (!CountBlockLabels(input + channel_offset,
+                                input_size - channel_offset, volume_size,
+                                block_size, grid_size, block, &index_counts,
+                                &label_counts)) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  labels->clear();
+  labels->reserve(label_counts.size());
+  for (const auto& p : label_counts) labels->push_back(p.first);
+  std::sort(labels->begin(), labels->end());
+  counts->resize(labels->size());
+  for (size_t i = 0; i < labels->size(); ++i) {
+    (*counts)[i] = label_counts[(*labels)[i]];
+  }
+  return true;
+}
+
+#define DO_INSTANTIATE(Label)                                               \
+  template bool DecompressChannel<Label>(                                   \
+      const uint32_t* input, size_t input_size,                             \
+      const ptrdiff_t volume_size[3], const ptrdiff_t block_size[3],        \
+      const ptrdiff_t start[3], const ptrdiff_t end[3],                     \
+      const ptrdiff_t output_strides[3], Label* output);                    \
+  template bool DecompressChannels<Label>(                                  \
+      const uint32_t* input, size_t input_size,                             \
+      const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3],        \
+      const ptrdiff_t start[3], const ptrdiff_t end[3],                     \
+      const ptrdiff_t output_strides[4], Label* output);                    \
+  template bool ReadValue<Label>(                                           \
+      const uint32_t* input, size_t input_size,                             \
+      const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3],        \
+      const ptrdiff_t position[4], Label* value);                           \
+  template bool ReadUniformBlockValue<Label>(                               \
+      const uint32_t* input, size_t input_size,                             \
+      const ptrdiff_t volume_size[3], const ptrdiff_t block_size[3],        \
+      const ptrdiff_t block[3], bool* uniform, Label* value);               \
+  template bool CountLabels<Label>(                                         \
+      const uint32_t* input, size_t input_size,                             \
+      const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3],        \
+      std::vector<Label>* labels, std::vector<uint64_t>* counts);           \
+/**/
+
+DO_INSTANTIATE(uint32_t)
+DO_INSTANTIATE(uint64_t)
+
+#undef DO_INSTANTIATE
+
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
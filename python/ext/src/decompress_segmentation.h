@@ -0,0 +1,136 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Implements decoding of the compressed segmentation format produced by
+// compress_segmentation.h.
+//
+// Values are read directly from the block headers, encoded values and tables,
+// so that a sub-box or a single voxel can be read without decoding the rest of
+// the chunk.  The input is validated as it is read: all functions return false
+// if an offset or index refers beyond the end of the input, or if a block
+// header specifies an invalid number of encoding bits.
+//
+// Only uint32 and uint64 volumes are supported.
+
+#ifndef NEUROGLANCER_DECOMPRESS_SEGMENTATION_H_
+#define NEUROGLANCER_DECOMPRESS_SEGMENTATION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace neuroglancer {
+namespace compress_segmentation {
+
+// Decodes the box [start, end) of a single channel.
+//
+// Args:
+//
+//   input: Pointer to the start of the encoded channel.
+//
+//   input_size: Number of 32-bit words available at input.
+//
+//   volume_size: Extent of the x, y, and z dimensions of the channel.
+//
+//   block_size: Extent of the x, y, and z dimensions of the block.
+//
+//   start, end: Bounds of the box to decode, which must satisfy
+//       0 <= start <= end <= volume_size.
+//
+//   output_strides: Stride in Label units between consecutive elements of the
+//       output in the x, y, and z dimensions.
+//
+//   output: Pointer to the output element for position start.
+//
+// Returns false if the input is invalid.
+template <class Label>
+bool DecompressChannel(const uint32_t* input, size_t input_size,
+                       const ptrdiff_t volume_size[3],
+                       const ptrdiff_t block_size[3], const ptrdiff_t start[3],
+                       const ptrdiff_t end[3],
+                       const ptrdiff_t output_strides[3], Label* output);
+
+// Decodes the box [start, end) of each channel of the output of
+// CompressChannels.
+//
+// Args:
+//
+//   input: Pointer to the start of the encoded channels.
+//
+//   input_size: Number of 32-bit words available at input.
+//
+//   volume_size: Extent of the x, y, z, and channel dimensions.
+//
+//   block_size: Extent of the x, y, and z dimensions of the block.
+//
+//   start, end: Bounds of the box of each channel to decode.
+//
+//   output_strides: Stride in Label units between consecutive elements of the
+//       output in the x, y, z, and channel dimensions.
+//
+//   output: Pointer to the output element for position start of channel 0.
+//
+// Returns false if the input is invalid.
+template <class Label>
+bool DecompressChannels(const uint32_t* input, size_t input_size,
+                        const ptrdiff_t volume_size[4],
+                        const ptrdiff_t block_size[3],
+                        const ptrdiff_t start[3], const ptrdiff_t end[3],
+                        const ptrdiff_t output_strides[4], Label* output);
+
+// Reads the value at `position` (x, y, z, channel), which must be within
+// volume_size, of the output of CompressChannels, reading only the header of
+// the containing block, one word of its encoded values, and one table entry.
+//
+// Returns false if the input is invalid.
+template <class Label>
+bool ReadValue(const uint32_t* input, size_t input_size,
+               const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3],
+               const ptrdiff_t position[4], Label* value);
+
+// Reads the header of the block at grid position `block` (x, y, z) of a single
+// channel, as for DecompressChannel.  If the block is encoded with 0 bits, i.e.
+// all of its voxels have the same value, sets `*uniform` to true and `*value`
+// to that value.  Otherwise sets `*uniform` to false, without validating the
+// encoded values.
+//
+// Returns false if the input is invalid.
+template <class Label>
+bool ReadUniformBlockValue(const uint32_t* input, size_t input_size,
+                           const ptrdiff_t volume_size[3],
+                           const ptrdiff_t block_size[3],
+                           const ptrdiff_t block[3], bool* uniform,
+                           Label* value);
+
+// Computes the distinct labels of all channels of the output of
+// CompressChannels, in increasing order, and the number of voxels of each,
+// without decoding the labels of each voxel.  A block encoded with 0 bits
+// contributes all of its voxels within the volume to its single label; for
+// other blocks, a histogram of the encoded indices of the voxels within the
+// volume is computed, and only the table entries of the indices that occur
+// are read.
+//
+// Returns false if the input is invalid, leaving `labels` and `counts`
+// unspecified.
+template <class Label>
+bool CountLabels(const uint32_t* input, size_t input_size,
+                 const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3],
+                 std::vector<Label>* labels, std::vector<uint64_t>* counts);
+
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_DECOMPRESS_SEGMENTATION_H_
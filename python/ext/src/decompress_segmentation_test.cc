@@ -0,0 +1,201 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "decompress_segmentation.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "compress_segmentation.h"
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace compress_segmentation {
+namespace {
+
+// Volume with partial blocks at the upper bounds, and blocks of each encoding
+// width up to 8 bits.
+constexpr ptrdiff_t kVolumeSize[4] = {19, 13, 11, 2};
+constexpr ptrdiff_t kInputStrides[4] = {1, 19, 19 * 13, 19 * 13 * 11};
+constexpr ptrdiff_t kBlockSize[3] = {8, 4, 4};
+
+template <class Label>
+std::vector<Label> MakeVolume() {
+  std::vector<Label> input(kVolumeSize[0] * kVolumeSize[1] * kVolumeSize[2] *
+                           kVolumeSize[3]);
+  for (ptrdiff_t c = 0; c < kVolumeSize[3]; ++c) {
+    for (ptrdiff_t z = 0; z < kVolumeSize[2]; ++z) {
+      for (ptrdiff_t y = 0; y < kVolumeSize[1]; ++y) {
+        for (ptrdiff_t x = 0; x < kVolumeSize[0]; ++x) {
+          const size_t num_labels = size_t(1) << (z / 4 * 3 + c);
+          input[x * kInputStrides[0] + y * kInputStrides[1] +
+                z * kInputStrides[2] + c * kInputStrides[3]] =
+              static_cast<Label>((x + 3 * y) % num_labels * 0x100000001ull);
+        }
+      }
+    }
+  }
+  return input;
+}
+
+template <class Label>
+void TestRoundTrip() {
+  const auto input = MakeVolume<Label>();
+  std::vector<uint32_t> encoded;
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &encoded);
+
+  // Full volume.
+  {
+    std::vector<Label> output(input.size());
+    const ptrdiff_t start[3] = {0, 0, 0};
+    ASSERT_TRUE(DecompressChannels(encoded.data(), encoded.size(),
+                                   kVolumeSize, kBlockSize, start, kVolumeSize,
+                                   kInputStrides, output.data()));
+    EXPECT_EQ(input, output);
+  }
+
+  // Sub-box not aligned to blocks, written in transposed order.
+  {
+    const ptrdiff_t start[3] = {3, 1, 2};
+    const ptrdiff_t end[3] = {18, 10, 11};
+    const ptrdiff_t size[3] = {15, 9, 9};
+    const ptrdiff_t output_strides[4] = {size[2] * size[1], size[2], 1,
+                                         size[0] * size[1] * size[2]};
+    std::vector<Label> output(size[0] * size[1] * size[2] * kVolumeSize[3]);
+    ASSERT_TRUE(DecompressChannels(encoded.data(), encoded.size(),
+                                   kVolumeSize, kBlockSize, start, end,
+                                   output_strides, output.data()));
+    for (ptrdiff_t c = 0; c < kVolumeSize[3]; ++c) {
+      for (ptrdiff_t z = 0; z < size[2]; ++z) {
+        for (ptrdiff_t y = 0; y < size[1]; ++y) {
+          for (ptrdiff_t x = 0; x < size[0]; ++x) {
+            ASSERT_EQ(input[(x + start[0]) * kInputStrides[0] +
+                            (y + start[1]) * kInputStrides[1] +
+                            (z + start[2]) * kInputStrides[2] +
+                            c * kInputStrides[3]],
+                      output[x * output_strides[0] + y * output_strides[1] +
+                             z * output_strides[2] + c * output_strides[3]]);
+          }
+        }
+      }
+    }
+  }
+
+  // Single values.
+  for (ptrdiff_t c = 0; c < kVolumeSize[3]; ++c) {
+    for (ptrdiff_t z = 0; z < kVolumeSize[2]; ++z) {
+      const ptrdiff_t position[4] = {(z * 5) % kVolumeSize[0],
+                                     (z * 3) % kVolumeSize[1], z, c};
+      Label value;
+      ASSERT_TRUE(ReadValue(encoded.data(), encoded.size(), kVolumeSize,
+                            kBlockSize, position, &value));
+      EXPECT_EQ(input[position[0] * kInputStrides[0] +
+                      position[1] * kInputStrides[1] +
+                      position[2] * kInputStrides[2] +
+                      position[3] * kInputStrides[3]],
+                value);
+    }
+  }
+}
+
+TEST(DecompressChannelsTest, RoundTrip32) { TestRoundTrip<uint32_t>(); }
+
+TEST(DecompressChannelsTest, RoundTrip64) { TestRoundTrip<uint64_t>(); }
+
+TEST(DecompressChannelsTest, SharedTables) {
+  // Channels with the same labels, so that all tables of channel 0 are shared
+  // with channel 1.
+  auto input = MakeVolume<uint64_t>();
+  std::copy(input.begin(), input.begin() + kInputStrides[3],
+            input.begin() + kInputStrides[3]);
+  std::vector<uint32_t> independent, shared;
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &independent);
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &shared, /*num_threads=*/1, /*share_tables=*/true);
+  EXPECT_LT(shared.size(), independent.size());
+  std::vector<uint64_t> output(input.size());
+  const ptrdiff_t start[3] = {0, 0, 0};
+  ASSERT_TRUE(DecompressChannels(shared.data(), shared.size(), kVolumeSize,
+                                 kBlockSize, start, kVolumeSize, kInputStrides,
+                                 output.data()));
+  EXPECT_EQ(input, output);
+}
+
+template <class Label>
+void TestCountLabels(bool share_tables) {
+  const auto input = MakeVolume<Label>();
+  std::vector<uint32_t> encoded;
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &encoded, /*num_threads=*/1, share_tables);
+  std::map<Label, uint64_t> expected;
+  for (const Label value : input) ++expected[value];
+  std::vector<Label> labels;
+  std::vector<uint64_t> counts;
+  ASSERT_TRUE(CountLabels(encoded.data(), encoded.size(), kVolumeSize,
+                          kBlockSize, &labels, &counts));
+  ASSERT_EQ(labels.size(), counts.size());
+  std::map<Label, uint64_t> actual;
+  for (size_t i = 0; i < labels.size(); ++i) {
+    actual[labels[i]] = counts[i];
+  }
+  EXPECT_TRUE(std::is_sorted(labels.begin(), labels.end()));
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(CountLabelsTest, Uint32) { TestCountLabels<uint32_t>(false); }
+
+TEST(CountLabelsTest, Uint64) { TestCountLabels<uint64_t>(false); }
+
+TEST(CountLabelsTest, SharedTables) { TestCountLabels<uint64_t>(true); }
+
+TEST(DecompressChannelsTest, Invalid) {
+  const auto input = MakeVolume<uint64_t>();
+  std::vector<uint32_t> encoded;
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &encoded);
+  std::vector<uint64_t> output(input.size());
+  const ptrdiff_t start[3] = {0, 0, 0};
+
+  // Truncated input.
+  for (size_t size : {size_t(0), size_t(1), size_t(10), encoded.size() / 2,
+                      encoded.size() - 1}) {
+    EXPECT_FALSE(DecompressChannels(encoded.data(), size, kVolumeSize,
+                                    kBlockSize, start, kVolumeSize,
+                                    kInputStrides, output.data()))
+        << "size=" << size;
+    std::vector<uint64_t> labels, counts;
+    EXPECT_FALSE(CountLabels(encoded.data(), size, kVolumeSize, kBlockSize,
+                             &labels, &counts))
+        << "size=" << size;
+  }
+
+  // Invalid number of encoding bits.
+  auto invalid = encoded;
+  invalid[invalid[0]] = (invalid[invalid[0]] & 0xffffff) | (3 << 24);
+  EXPECT_FALSE(DecompressChannels(invalid.data(), invalid.size(), kVolumeSize,
+                                  kBlockSize, start, kVolumeSize,
+                                  kInputStrides, output.data()));
+  std::vector<uint64_t> labels, counts;
+  EXPECT_FALSE(CountLabels(invalid.data(), invalid.size(), kVolumeSize,
+                           kBlockSize, &labels, &counts));
+}
+
+}  // namespace
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
@@ -0,0 +1,259 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "downsample.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace neuroglancer {
+namespace downsample {
+
+namespace {
+
+// Type in which the sums of DownsampleWithAveraging are accumulated.
+template <class T>
+struct Accumulator {
+  using type = double;
+};
+template <>
+struct Accumulator<int8_t> {
+  using type = int64_t;
+};
+template <>
+struct Accumulator<uint8_t> {
+  using type = uint64_t;
+};
+template <>
+struct Accumulator<int16_t> {
+  using type = int64_t;
+};
+template <>
+struct Accumulator<uint16_t> {
+  using type = uint64_t;
+};
+template <>
+struct Accumulator<int32_t> {
+  using type = int64_t;
+};
+template <>
+struct Accumulator<uint32_t> {
+  using type = uint64_t;
+};
+
+// Calls `reduce_row(rows, output_row)` for each row of output elements along
+// the last dimension, where `rows` are the input rows, along the last
+// dimension, of the windows of the output row, in C order.
+template <class T, class ReduceRow>
+void ForEachOutputRow(const T* input, int rank, const ptrdiff_t* input_shape,
+                      const ptrdiff_t* input_strides, const ptrdiff_t* factor,
+                      T* output, const ptrdiff_t* output_strides,
+                      ReduceRow reduce_row) {
+  for (int i = 0; i < rank; ++i) {
+    if (input_shape[i] == 0) return;
+  }
+  const int last = rank - 1;
+  std::vector<ptrdiff_t> output_index(rank, 0), window_index(rank, 0),
+      window_size(rank);
+  std::vector<const T*> rows;
+  while (true) {
+    const T* window_origin = input;
+    T* output_row = output;
+    for (int i = 0; i < last; ++i) {
+      const ptrdiff_t start = output_index[i] * factor[i];
+      window_origin += start * input_strides[i];
+      output_row += output_index[i] * output_strides[i];
+      window_size[i] = std::min(factor[i], input_shape[i] - start);
+    }
+    rows.clear();
+    while (true) {
+      const T* row = window_origin;
+      for (int i = 0; i < last; ++i) row += window_index[i] * input_strides[i];
+      rows.push_back(row);
+      int i = last - 1;
+      for (; i >= 0; --i) {
+        if (++window_index[i] < window_size[i]) break;
+        window_index[i] = 0;
+      }
+      if (i < 0) break;
+    }
+    reduce_row(rows, output_row);
+    int i = last - 1;
+    for (; i >= 0; --i) {
+      if (++output_index[i] < (input_shape[i] + factor[i] - 1) / factor[i]) {
+        break;
+      }
+      output_index[i] = 0;
+    }
+    if (i < 0) break;
+  }
+}
+
+// Adds the sum of each window of `factor` elements of `row`, of `size`
+// elements with stride `stride`, to the corresponding element of `sums`.
+// Windows of 1 and 2 contiguous elements, the common cases, have their own
+// loops so that they are vectorized.
+template <class T, class Acc>
+void AddRowSums(const T* row, ptrdiff_t size, ptrdiff_t stride,
+                ptrdiff_t factor, Acc* sums) {
+  const ptrdiff_t num_full = size / factor;
+  if (stride == 1 && factor == 1) {
+    for (ptrdiff_t x = 0; x < size; ++x) sums[x] += row[x];
+    return;
+  }
+  if (stride == 1 && factor == 2) {
+    for (ptrdiff_t x = 0; x < num_full; ++x) {
+      sums[x] += static_cast<Acc>(row[2 * x]) + static_cast<Acc>(row[2 * x + 1]);
+    }
+  } else {
+    for (ptrdiff_t x = 0; x < num_full; ++x) {
+      Acc sum = 0;
+      for (ptrdiff_t k = 0; k < factor; ++k) {
+        sum += row[(x * factor + k) * stride];
+      }
+      sums[x] += sum;
+    }
+  }
+  for (ptrdiff_t k = num_full * factor; k < size; ++k) {
+    sums[num_full] += row[k * stride];
+  }
+}
+
+// Returns the most frequent of the `n > 0` elements of `values`, breaking
+// ties in favor of the earliest.
+template <class T>
+T ComputeMode(const T* values, ptrdiff_t n) {
+  const T first = values[0];
+  ptrdiff_t i = 1;
+  while (i < n && values[i] == first) ++i;
+  if (i == n) return first;
+  T best = first;
+  ptrdiff_t best_count = 0;
+  for (i = 0; i < n; ++i) {
+    // No later value can occur more than `n - i` times.
+    if (best_count >= n - i) break;
+    const T value = values[i];
+    if (std::find(values, values + i, value) != values + i) continue;
+    const ptrdiff_t count = std::count(values + i, values + n, value);
+    if (count > best_count) {
+      best = value;
+      best_count = count;
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+template <class T>
+void DownsampleWithAveraging(const T* input, int rank,
+                             const ptrdiff_t* input_shape,
+                             const ptrdiff_t* input_strides,
+                             const ptrdiff_t* factor, T* output,
+                             const ptrdiff_t* output_strides) {
+  using Acc = typename Accumulator<T>::type;
+  if (rank == 0) {
+    *output = *input;
+    return;
+  }
+  const int last = rank - 1;
+  const ptrdiff_t size = input_shape[last], stride = input_strides[last],
+                  row_factor = factor[last];
+  const ptrdiff_t num_outputs = (size + row_factor - 1) / row_factor;
+  const ptrdiff_t num_full = size / row_factor;
+  std::vector<Acc> sums(num_outputs);
+  ForEachOutputRow(
+      input, rank, input_shape, input_strides, factor, output, output_strides,
+      [&](const std::vector<const T*>& rows, T* output_row) {
+        std::fill(sums.begin(), sums.end(), Acc(0));
+        for (const T* row : rows) {
+          AddRowSums(row, size, stride, row_factor, sums.data());
+        }
+        const ptrdiff_t num_rows = rows.size();
+        for (ptrdiff_t x = 0; x < num_outputs; ++x) {
+          const ptrdiff_t count =
+              num_rows * (x < num_full ? row_factor : size - x * row_factor);
+          output_row[x * output_strides[last]] =
+              static_cast<T>(sums[x] / static_cast<Acc>(count));
+        }
+      });
+}
+
+template <class T>
+void DownsampleWithMode(const T* input, int rank, const ptrdiff_t* input_shape,
+                        const ptrdiff_t* input_strides,
+                        const ptrdiff_t* factor, T* output,
+                        const ptrdiff_t* output_strides) {
+  if (rank == 0) {
+    *output = *input;
+    return;
+  }
+  const int last = rank - 1;
+  const ptrdiff_t size = input_shape[last], stride = input_strides[last],
+                  row_factor = factor[last];
+  const ptrdiff_t num_outputs = (size + row_factor - 1) / row_factor;
+  std::vector<T> values;
+  ForEachOutputRow(
+      input, rank, input_shape, input_strides, factor, output, output_strides,
+      [&](const std::vector<const T*>& rows, T* output_row) {
+        const ptrdiff_t max_window_size = rows.size() * row_factor;
+        values.resize(max_window_size);
+        for (ptrdiff_t x = 0; x < num_outputs; ++x) {
+          const ptrdiff_t start = x * row_factor;
+          const ptrdiff_t end = std::min(start + row_factor, size);
+          ptrdiff_t n = 0;
+          for (const T* row : rows) {
+            for (ptrdiff_t k = start; k < end; ++k) {
+              values[n++] = row[k * stride];
+            }
+          }
+          output_row[x * output_strides[last]] = ComputeMode(values.data(), n);
+        }
+      });
+}
+
+#define DO_INSTANTIATE_AVERAGING(T)                                        \
+  template void DownsampleWithAveraging<T>(                                \
+      const T* input, int rank, const ptrdiff_t* input_shape,              \
+      const ptrdiff_t* input_strides, const ptrdiff_t* factor, T* output,  \
+      const ptrdiff_t* output_strides);                                    \
+/**/
+DO_INSTANTIATE_AVERAGING(int8_t)
+DO_INSTANTIATE_AVERAGING(uint8_t)
+DO_INSTANTIATE_AVERAGING(int16_t)
+DO_INSTANTIATE_AVERAGING(uint16_t)
+DO_INSTANTIATE_AVERAGING(int32_t)
+DO_INSTANTIATE_AVERAGING(uint32_t)
+DO_INSTANTIATE_AVERAGING(int64_t)
+DO_INSTANTIATE_AVERAGING(uint64_t)
+DO_INSTANTIATE_AVERAGING(float)
+DO_INSTANTIATE_AVERAGING(double)
+#undef DO_INSTANTIATE_AVERAGING
+
+#define DO_INSTANTIATE_MODE(T)                                             \
+  template void DownsampleWithMode<T>(                                     \
+      const T* input, int rank, const ptrdiff_t* input_shape,              \
+      const ptrdiff_t* input_strides, const ptrdiff_t* factor, T* output,  \
+      const ptrdiff_t* output_strides);                                    \
+/**/
+DO_INSTANTIATE_MODE(uint8_t)
+DO_INSTANTIATE_MODE(uint16_t)
+DO_INSTANTIATE_MODE(uint32_t)
+DO_INSTANTIATE_MODE(uint64_t)
+#undef DO_INSTANTIATE_MODE
+
+}  // namespace downsample
+}  // namespace neuroglancer
@@ -0,0 +1,67 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Downsampling of n-dimensional arrays, as used to serve the downsampled
+// scales of a LocalVolume.
+//
+// The input of shape `input_shape` is divided into windows of `factor`
+// elements along each dimension, clipped at the upper bounds, and each window
+// is reduced to one element of the output, of shape
+// ceil(input_shape / factor).  Strides are in elements, and may be negative.
+//
+// Each row of windows along the last dimension is reduced at once, so the
+// inner loops run over contiguous elements when the last dimension is
+// contiguous.
+
+#ifndef NEUROGLANCER_DOWNSAMPLE_H_
+#define NEUROGLANCER_DOWNSAMPLE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace neuroglancer {
+namespace downsample {
+
+// Sets each output element to the mean of its window, rounded toward zero
+// for integer types.  Sums are accumulated in int64 or uint64 for integer
+// types of up to 32 bits, and in double otherwise.
+//
+// T must be one of int8_t, uint8_t, int16_t, uint16_t, int32_t, uint32_t,
+// int64_t, uint64_t, float, double.
+template <class T>
+void DownsampleWithAveraging(const T* input, int rank,
+                             const ptrdiff_t* input_shape,
+                             const ptrdiff_t* input_strides,
+                             const ptrdiff_t* factor, T* output,
+                             const ptrdiff_t* output_strides);
+
+// Sets each output element to the most frequent value of its window, as is
+// appropriate for segmentation labels.  Ties are broken in favor of the value
+// that occurs first in the window, in C order, so that the result equals that
+// of striding when all values of a window are distinct.  Values are compared
+// bitwise.
+//
+// T must be one of uint8_t, uint16_t, uint32_t, uint64_t.
+template <class T>
+void DownsampleWithMode(const T* input, int rank, const ptrdiff_t* input_shape,
+                        const ptrdiff_t* input_strides,
+                        const ptrdiff_t* factor, T* output,
+                        const ptrdiff_t* output_strides);
+
+}  // namespace downsample
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_DOWNSAMPLE_H_
@@ -0,0 +1,175 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "downsample_segmentation.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "compress_segmentation.h"
+#include "decompress_segmentation.h"
+#include "downsample.h"
+#include "parallel_for.h"
+
+namespace neuroglancer {
+namespace compress_segmentation {
+
+namespace {
+
+// Downsamples the block at grid position `block` of a single channel into
+// `output`, the downsampled channel with x, y, z strides `output_strides`.
+// `buffer` holds the decoded values of the block if it has more than one
+// value.
+template <class Label>
+bool DownsampleBlock(const uint32_t* input, size_t input_size,
+                     const ptrdiff_t volume_size[3],
+                     const ptrdiff_t block_size[3], const ptrdiff_t factor[3],
+                     const ptrdiff_t block[3],
+                     const ptrdiff_t output_strides[3], Label* output,
+                     std::vector<Label>* buffer) {
+  ptrdiff_t start[3], end[3], actual_size[3], output_size[3];
+  Label* block_output = output;
+  for (size_t i = 0; i < 3; ++i) {
+    start[i] = block[i] * block_size[i];
+    end[i] = std::min(start[i] + block_size[i], volume_size[i]);
+    actual_size[i] = end[i] - start[i];
+    output_size[i] = (actual_size[i] + factor[i] - 1) / factor[i];
+    block_output += start[i] / factor[i] * output_strides[i];
+  }
+  bool uniform;
+  Label value;
+  if (!ReadUniformBlockValue(input, input_size, volume_size, block_size, block,
+                             &uniform, &value)) {
+    return false;
+  }
+  if (uniform) {
+    for (ptrdiff_t z = 0; z < output_size[2]; ++z) {
+      for (ptrdiff_t y = 0; y < output_size[1]; ++y) {
+        Label* row = block_output + y * output_strides[1] +
+                     z * output_strides[2];
+        for (ptrdiff_t x = 0; x < output_size[0]; ++x) {
+          row[x * output_strides[0]] = value;
+        }
+      }
+    }
+    return true;
+  }
+  buffer->resize(actual_size[0] * actual_size[1] * actual_size[2]);
+  const ptrdiff_t buffer_strides[3] = {1, actual_size[0],
+                                       actual_size[0] * actual_size[1]};
+  if (!DecompressChannel(input, input_size, volume_size, block_size, start,
+                         end, buffer_strides, buffer->data())) {
+    return false;
+  }
+  downsample::DownsampleWithMode(buffer->data(), 3, actual_size,
+                                 buffer_strides, factor, block_output,
+                                 output_strides);
+  return true;
+}
+
+// Downsamples a single channel into `output`, as for DownsampleChannels.
+template <class Label>
+bool DownsampleChannel(const uint32_t* input, size_t input_size,
+                       const ptrdiff_t volume_size[3],
+                       const ptrdiff_t block_size[3],
+                       const ptrdiff_t factor[3],
+                       const ptrdiff_t output_strides[3], Label* output,
+                       int num_threads) {
+  bool blocks_aligned = true;
+  ptrdiff_t grid_size[3];
+  for (size_t i = 0; i < 3; ++i) {
+    blocks_aligned = blocks_aligned && block_size[i] % factor[i] == 0;
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+  }
+  if (!blocks_aligned) {
+    std::vector<Label> buffer(volume_size[0] * volume_size[1] *
+                              volume_size[2]);
+    const ptrdiff_t buffer_strides[3] = {1, volume_size[0],
+                                         volume_size[0] * volume_size[1]};
+    const ptrdiff_t start[3] = {0, 0, 0};
+    if (!DecompressChannel(input, input_size, volume_size, block_size, start,
+                           volume_size, buffer_strides, buffer.data())) {
+      return false;
+    }
+    downsample::DownsampleWithMode(buffer.data(), 3, volume_size,
+                                   buffer_strides, factor, output,
+                                   output_strides);
+    return true;
+  }
+  // Each z-row of blocks writes a disjoint region of the output.
+  std::atomic<bool> valid(true);
+  ParallelFor(grid_size[1] * grid_size[2], num_threads, [&](size_t row) {
+    std::vector<Label> buffer;
+    ptrdiff_t block[3] = {0, static_cast<ptrdiff_t>(row % grid_size[1]),
+                          static_cast<ptrdiff_t>(row / grid_size[1])};
+    for (block[0] = 0; block[0] < grid_size[0] && valid; ++block[0]) {
+      if (!DownsampleBlock(input, input_size, volume_size, block_size, factor,
+                           block, output_strides, output, &buffer)) {
+        valid = false;
+      }
+    }
+  });
+  return valid;
+}
+
+}  // namespace
+
+template <class Label>
+bool DownsampleChannels(const uint32_t* input, size_t input_size,
+                        const ptrdiff_t volume_size[4],
+                        const ptrdiff_t block_size[3],
+                        const ptrdiff_t factor[3],
+                        std::vector<uint32_t>* output, int num_threads) {
+  ptrdiff_t output_size[4], output_strides[4];
+  size_t num_elements = 1;
+  for (size_t i = 0; i < 4; ++i) {
+    output_size[i] =
+        i < 3 ? (volume_size[i] + factor[i] - 1) / factor[i] : volume_size[i];
+    output_strides[i] = num_elements;
+    num_elements *= output_size[i];
+  }
+  if (static_cast<size_t>(volume_size[3]) > input_size) return false;
+  std::vector<Label> downsampled(num_elements);
+  for (ptrdiff_t channel_i = 0; channel_i < volume_size[3]; ++channel_i) {
+    const size_t channel_offset = input[channel_i];
+    if (channel_offset > input_size) return false;
+    if (!DownsampleChannel(input + channel_offset, input_size - channel_offset,
+                           volume_size, block_size, factor, output_strides,
+                           downsampled.data() + channel_i * output_strides[3],
+                           num_threads)) {
+      return false;
+    }
+  }
+  CompressChannels(downsampled.data(), output_strides, output_size, block_size,
+                   output, num_threads);
+  return true;
+}
+
+#define DO_INSTANTIATE(Label)                                        \
+  template bool DownsampleChannels<Label>(                           \
+      const uint32_t* input, size_t input_size,                      \
+      const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3], \
+      const ptrdiff_t factor[3], std::vector<uint32_t>* output,      \
+      int num_threads);                                              \
+/**/
+
+DO_INSTANTIATE(uint32_t)
+DO_INSTANTIATE(uint64_t)
+
+#undef DO_INSTANTIATE
+
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
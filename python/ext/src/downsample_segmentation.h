@@ -0,0 +1,73 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Implements mode downsampling of volumes in the compressed segmentation
+// format produced by compress_segmentation.h, producing the encoding of the
+// next scale without decoding blocks that have a single value.
+//
+// Only uint32 and uint64 volumes are supported.
+
+#ifndef NEUROGLANCER_DOWNSAMPLE_SEGMENTATION_H_
+#define NEUROGLANCER_DOWNSAMPLE_SEGMENTATION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace neuroglancer {
+namespace compress_segmentation {
+
+// Downsamples each channel of the output of CompressChannels by `factor`, as
+// by DownsampleWithMode applied to the decoded (x, y, z) volume, and encodes
+// the result of size ceil(volume_size / factor) with the same block size.
+//
+// If `block_size` is a multiple of `factor` along each dimension, so that
+// each window lies within a single block, the value of the windows of a
+// block encoded with 0 bits is read from its table, and only the other blocks
+// are decoded.  Otherwise each channel is decoded in full.
+//
+// Args:
+//
+//   input: Pointer to the start of the encoded channels.
+//
+//   input_size: Number of 32-bit words available at input.
+//
+//   volume_size: Extent of the x, y, z, and channel dimensions.
+//
+//   block_size: Extent of the x, y, and z dimensions of the block, of both
+//       the input and the output.
+//
+//   factor: Positive downsampling factor of the x, y, and z dimensions.
+//
+//   output: Vector where output will be stored.  Any existing content is
+//       cleared.
+//
+//   num_threads: Number of threads with which to downsample and encode the
+//       blocks of each channel, as for CompressChannel.
+//
+// Returns false if the input is invalid, leaving `output` unspecified.
+template <class Label>
+bool DownsampleChannels(const uint32_t* input, size_t input_size,
+                        const ptrdiff_t volume_size[4],
+                        const ptrdiff_t block_size[3],
+                        const ptrdiff_t factor[3],
+                        std::vector<uint32_t>* output, int num_threads = 1);
+
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_DOWNSAMPLE_SEGMENTATION_H_
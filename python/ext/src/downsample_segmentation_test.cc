@@ -0,0 +1,114 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "downsample_segmentation.h"
+
+#include <vector>
+
+#include "compress_segmentation.h"
+#include "downsample.h"
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace compress_segmentation {
+namespace {
+
+// Volume with partial blocks at the upper bounds, in which most blocks have a
+// single value.
+constexpr ptrdiff_t kVolumeSize[4] = {37, 21, 19, 2};
+constexpr ptrdiff_t kInputStrides[4] = {1, 37, 37 * 21, 37 * 21 * 19};
+constexpr ptrdiff_t kBlockSize[3] = {8, 4, 4};
+
+template <class Label>
+void TestMatchesDecodedDownsampling() {
+  std::vector<Label> input(kVolumeSize[0] * kVolumeSize[1] * kVolumeSize[2] *
+                           kVolumeSize[3]);
+  for (ptrdiff_t c = 0; c < kVolumeSize[3]; ++c) {
+    for (ptrdiff_t z = 0; z < kVolumeSize[2]; ++z) {
+      for (ptrdiff_t y = 0; y < kVolumeSize[1]; ++y) {
+        for (ptrdiff_t x = 0; x < kVolumeSize[0]; ++x) {
+          // Labels constant within each block, except where the hash of the
+          // block selects per-voxel labels.
+          const uint64_t block = x / 8 + 5 * (y / 4 + 6 * (z / 4)) + 37 * c;
+          const uint64_t label = block * 0x9e3779b97f4a7c15ull % 7 < 2
+                                     ? (x * 7 + y * 3 + z) % 5
+                                     : block * 0x100000001ull;
+          input[x + kInputStrides[1] * y + kInputStrides[2] * z +
+                kInputStrides[3] * c] = static_cast<Label>(label);
+        }
+      }
+    }
+  }
+  std::vector<uint32_t> encoded;
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &encoded);
+  // Aligned to the blocks, and not.
+  for (const auto& factor : {std::vector<ptrdiff_t>{2, 2, 2},
+                             std::vector<ptrdiff_t>{4, 1, 2},
+                             std::vector<ptrdiff_t>{3, 2, 2}}) {
+    ptrdiff_t output_size[4], output_strides[4];
+    for (size_t i = 0; i < 4; ++i) {
+      output_size[i] = i < 3 ? (kVolumeSize[i] + factor[i] - 1) / factor[i]
+                             : kVolumeSize[i];
+      output_strides[i] = i == 0 ? 1 : output_strides[i - 1] *
+                                           output_size[i - 1];
+    }
+    std::vector<Label> downsampled(output_strides[3] * output_size[3]);
+    for (ptrdiff_t c = 0; c < kVolumeSize[3]; ++c) {
+      downsample::DownsampleWithMode(
+          input.data() + c * kInputStrides[3], 3, kVolumeSize, kInputStrides,
+          factor.data(), downsampled.data() + c * output_strides[3],
+          output_strides);
+    }
+    std::vector<uint32_t> expected;
+    CompressChannels(downsampled.data(), output_strides, output_size,
+                     kBlockSize, &expected);
+    for (int num_threads : {1, 3}) {
+      std::vector<uint32_t> output;
+      ASSERT_TRUE(DownsampleChannels<Label>(encoded.data(), encoded.size(),
+                                            kVolumeSize, kBlockSize,
+                                            factor.data(), &output,
+                                            num_threads));
+      EXPECT_EQ(expected, output)
+          << "factor=" << factor[0] << "," << factor[1] << "," << factor[2]
+          << " num_threads=" << num_threads;
+    }
+  }
+}
+
+TEST(DownsampleChannelsTest, Uint32) {
+  TestMatchesDecodedDownsampling<uint32_t>();
+}
+
+TEST(DownsampleChannelsTest, Uint64) {
+  TestMatchesDecodedDownsampling<uint64_t>();
+}
+
+TEST(DownsampleChannelsTest, Invalid) {
+  std::vector<uint32_t> input(kVolumeSize[0] * kVolumeSize[1] *
+                              kVolumeSize[2] * kVolumeSize[3], 1);
+  std::vector<uint32_t> encoded, output;
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &encoded);
+  const ptrdiff_t factor[3] = {2, 2, 2};
+  EXPECT_FALSE(DownsampleChannels<uint32_t>(encoded.data(), encoded.size() / 2,
+                                            kVolumeSize, kBlockSize, factor,
+                                            &output));
+}
+
+}  // namespace
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
@@ -0,0 +1,164 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "downsample.h"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace downsample {
+namespace {
+
+TEST(DownsampleWithAveragingTest, Uint8) {
+  // 3x5 input, factor 2x2, so that the last row and column of windows are
+  // clipped.
+  const std::vector<uint8_t> input = {
+      1,  2,  3,  4,  250,  //
+      5,  6,  7,  8,  251,  //
+      9,  10, 11, 12, 13,   //
+  };
+  const ptrdiff_t input_shape[2] = {3, 5}, input_strides[2] = {5, 1};
+  const ptrdiff_t factor[2] = {2, 2}, output_strides[2] = {3, 1};
+  std::vector<uint8_t> output(6);
+  DownsampleWithAveraging(input.data(), 2, input_shape, input_strides, factor,
+                          output.data(), output_strides);
+  EXPECT_EQ(std::vector<uint8_t>({3, 5, 250, 9, 11, 13}), output);
+}
+
+TEST(DownsampleWithAveragingTest, NegativeRoundsTowardZero) {
+  const std::vector<int16_t> input = {-1, -2, 5, -4, -3};
+  const ptrdiff_t input_shape[1] = {5}, input_strides[1] = {1};
+  const ptrdiff_t factor[1] = {2}, output_strides[1] = {1};
+  std::vector<int16_t> output(3);
+  DownsampleWithAveraging(input.data(), 1, input_shape, input_strides, factor,
+                          output.data(), output_strides);
+  EXPECT_EQ(std::vector<int16_t>({-1, 0, -3}), output);
+}
+
+TEST(DownsampleWithAveragingTest, Float) {
+  const std::vector<float> input = {1, 2, 4, 0.5f, 0.25f, 7};
+  const ptrdiff_t input_shape[2] = {2, 3}, input_strides[2] = {3, 1};
+  const ptrdiff_t factor[2] = {2, 3}, output_strides[2] = {1, 1};
+  float output;
+  DownsampleWithAveraging(input.data(), 2, input_shape, input_strides, factor,
+                          &output, output_strides);
+  EXPECT_EQ(14.75f / 6, output);
+}
+
+TEST(DownsampleWithModeTest, TiesFavorFirst) {
+  // 2x4 input with factor 2x2: the first window has a unique mode, the second
+  // is a tie, broken in favor of 9, which occurs first.
+  const std::vector<uint64_t> input = {
+      1, 2, 9, 8,  //
+      2, 2, 8, 9,  //
+  };
+  const ptrdiff_t input_shape[2] = {2, 4}, input_strides[2] = {4, 1};
+  const ptrdiff_t factor[2] = {2, 2}, output_strides[2] = {2, 1};
+  std::vector<uint64_t> output(2);
+  DownsampleWithMode(input.data(), 2, input_shape, input_strides, factor,
+                     output.data(), output_strides);
+  EXPECT_EQ(std::vector<uint64_t>({2, 9}), output);
+}
+
+// Compares against a direct computation on random 3-d arrays, with the
+// dimensions in Fortran order so that the last dimension is not contiguous,
+// and with few distinct values so that the modes are meaningful.
+TEST(DownsampleWithModeTest, Random) {
+  std::mt19937 rng(1);
+  for (int trial = 0; trial < 50; ++trial) {
+    ptrdiff_t input_shape[3], factor[3], output_shape[3];
+    for (int i = 0; i < 3; ++i) {
+      input_shape[i] = rng() % 9 + 1;
+      factor[i] = rng() % 4 + 1;
+      output_shape[i] = (input_shape[i] + factor[i] - 1) / factor[i];
+    }
+    const ptrdiff_t input_strides[3] = {1, input_shape[0],
+                                        input_shape[0] * input_shape[1]};
+    const ptrdiff_t output_strides[3] = {1, output_shape[0],
+                                         output_shape[0] * output_shape[1]};
+    std::vector<uint32_t> input(input_shape[0] * input_shape[1] *
+                                input_shape[2]);
+    for (auto& v : input) v = rng() % 3;
+    std::vector<uint32_t> output(output_shape[0] * output_shape[1] *
+                                 output_shape[2]);
+    DownsampleWithMode(input.data(), 3, input_shape, input_strides, factor,
+                       output.data(), output_strides);
+    std::vector<uint32_t> averaged(output.size());
+    DownsampleWithAveraging(input.data(), 3, input_shape, input_strides,
+                            factor, averaged.data(), output_strides);
+    for (ptrdiff_t x = 0; x < output_shape[0]; ++x) {
+      for (ptrdiff_t y = 0; y < output_shape[1]; ++y) {
+        for (ptrdiff_t z = 0; z < output_shape[2]; ++z) {
+          std::map<uint32_t, int> counts;
+          uint32_t expected_mode = 0;
+          int best_count = 0;
+          uint64_t sum = 0, count = 0;
+          for (ptrdiff_t i = x * factor[0];
+               i < std::min(input_shape[0], (x + 1) * factor[0]); ++i) {
+            for (ptrdiff_t j = y * factor[1];
+                 j < std::min(input_shape[1], (y + 1) * factor[1]); ++j) {
+              for (ptrdiff_t k = z * factor[2];
+                   k < std::min(input_shape[2], (z + 1) * factor[2]); ++k) {
+                const uint32_t v = input[i * input_strides[0] +
+                                         j * input_strides[1] +
+                                         k * input_strides[2]];
+                best_count = std::max(best_count, ++counts[v]);
+                sum += v;
+                ++count;
+              }
+            }
+          }
+          // The first value, in C order, of those with the maximum count.
+          for (ptrdiff_t i = x * factor[0], done = 0;
+               !done && i < std::min(input_shape[0], (x + 1) * factor[0]);
+               ++i) {
+            for (ptrdiff_t j = y * factor[1];
+                 !done && j < std::min(input_shape[1], (y + 1) * factor[1]);
+                 ++j) {
+              for (ptrdiff_t k = z * factor[2];
+                   k < std::min(input_shape[2], (z + 1) * factor[2]); ++k) {
+                const uint32_t v = input[i * input_strides[0] +
+                                         j * input_strides[1] +
+                                         k * input_strides[2]];
+                if (counts[v] == best_count) {
+                  expected_mode = v;
+                  done = 1;
+                  break;
+                }
+              }
+            }
+          }
+          const ptrdiff_t offset = x * output_strides[0] +
+                                   y * output_strides[1] +
+                                   z * output_strides[2];
+          EXPECT_EQ(expected_mode, output[offset])
+              << "trial=" << trial << " x=" << x << " y=" << y << " z=" << z;
+          EXPECT_EQ(sum / count, averaged[offset])
+              << "trial=" << trial << " x=" << x << " y=" << y << " z=" << z;
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace downsample
+}  // namespace neuroglancer
@@ -0,0 +1,103 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "encoded_chunk_cache.h"
+
+#include <iterator>
+#include <utility>
+
+namespace neuroglancer {
+
+EncodedChunkCache::Chunk EncodedChunkCache::Find(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    ++misses_;
+    return nullptr;
+  }
+  ++hits_;
+  lru_list_.splice(lru_list_.begin(), lru_list_, it->second.lru_position);
+  return it->second.chunk;
+}
+
+uint64_t EncodedChunkCache::generation() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return generation_;
+}
+
+void EncodedChunkCache::Insert(const std::string& key, uint64_t generation,
+                               std::vector<int64_t> start,
+                               std::vector<int64_t> end, Chunk chunk) {
+  const size_t num_bytes = chunk->size();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (generation != generation_ || num_bytes > max_bytes_ ||
+      entries_.count(key)) {
+    return;
+  }
+  lru_list_.push_front(key);
+  entries_[key] = Entry{std::move(chunk), std::move(start), std::move(end),
+                        lru_list_.begin()};
+  num_bytes_ += num_bytes;
+  while (num_bytes_ > max_bytes_) {
+    Erase(entries_.find(lru_list_.back()));
+  }
+}
+
+void EncodedChunkCache::Invalidate(const std::vector<int64_t>& start,
+                                   const std::vector<int64_t>& end) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++generation_;
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    const Entry& entry = it->second;
+    // Boxes of a different rank are conservatively treated as intersecting.
+    bool intersects = true;
+    if (entry.start.size() == start.size()) {
+      for (size_t i = 0; intersects && i < start.size(); ++i) {
+        intersects = entry.start[i] < end[i] && start[i] < entry.end[i];
+      }
+    }
+    auto next = std::next(it);
+    if (intersects) Erase(it);
+    it = next;
+  }
+}
+
+void EncodedChunkCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++generation_;
+  entries_.clear();
+  lru_list_.clear();
+  num_bytes_ = 0;
+}
+
+EncodedChunkCache::Statistics EncodedChunkCache::GetStatistics() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Statistics statistics;
+  statistics.num_cached = entries_.size();
+  statistics.num_bytes = num_bytes_;
+  statistics.hits = hits_;
+  statistics.misses = misses_;
+  return statistics;
+}
+
+void EncodedChunkCache::Erase(
+    std::unordered_map<std::string, Entry>::iterator it) {
+  num_bytes_ -= it->second.chunk->size();
+  lru_list_.erase(it->second.lru_position);
+  entries_.erase(it);
+}
+
+}  // namespace neuroglancer
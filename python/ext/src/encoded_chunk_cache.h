@@ -0,0 +1,104 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEUROGLANCER_ENCODED_CHUNK_CACHE_H_
+#define NEUROGLANCER_ENCODED_CHUNK_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace neuroglancer {
+
+// Thread-safe cache of encoded chunks served from an in-memory volume, keyed
+// by a string identifying the request (e.g. its bounds, scale and format).
+// The least recently used chunks are evicted once their total size exceeds
+// the capacity.
+//
+// Each chunk records the box of the volume from which it was computed, so that
+// a modification of the volume only invalidates the chunks intersecting the
+// modified region.  A chunk computed concurrently with an invalidation is not
+// stored, since it may reflect the old data: the caller obtains generation()
+// before reading the volume, and passes it to Insert.
+class EncodedChunkCache {
+ public:
+  using Chunk = std::shared_ptr<const std::string>;
+
+  struct Statistics {
+    size_t num_cached = 0;
+    size_t num_bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+
+  explicit EncodedChunkCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+  EncodedChunkCache(const EncodedChunkCache&) = delete;
+  EncodedChunkCache& operator=(const EncodedChunkCache&) = delete;
+
+  // Returns the cached chunk with the specified key, or null if not cached.
+  Chunk Find(const std::string& key);
+
+  // Returns the current generation, which is incremented by each
+  // invalidation.
+  uint64_t generation();
+
+  // Stores `chunk`, computed from the box [start, end) of the volume when the
+  // generation was `generation`, unless the volume has been invalidated since,
+  // the key is already cached, or the chunk alone exceeds the capacity.
+  void Insert(const std::string& key, uint64_t generation,
+              std::vector<int64_t> start, std::vector<int64_t> end,
+              Chunk chunk);
+
+  // Removes the chunks whose box intersects [start, end), and those whose box
+  // has a different rank.
+  void Invalidate(const std::vector<int64_t>& start,
+                  const std::vector<int64_t>& end);
+
+  // Removes all chunks.
+  void Clear();
+
+  Statistics GetStatistics();
+
+ private:
+  struct Entry {
+    Chunk chunk;
+    std::vector<int64_t> start, end;
+    std::list<std::string>::iterator lru_position;
+  };
+
+  // Must be called with `mutex_` held.
+  void Erase(std::unordered_map<std::string, Entry>::iterator it);
+
+  std::mutex mutex_;
+  const size_t max_bytes_;
+  size_t num_bytes_ = 0;
+  uint64_t generation_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  std::unordered_map<std::string, Entry> entries_;
+  // Keys of the cached chunks, most recently used first.
+  std::list<std::string> lru_list_;
+};
+
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_ENCODED_CHUNK_CACHE_H_
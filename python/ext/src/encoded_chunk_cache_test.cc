@@ -0,0 +1,74 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "encoded_chunk_cache.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace {
+
+EncodedChunkCache::Chunk MakeChunk(size_t size, char c) {
+  return std::make_shared<const std::string>(size, c);
+}
+
+TEST(EncodedChunkCacheTest, EvictsLeastRecentlyUsed) {
+  EncodedChunkCache cache(10);
+  const uint64_t generation = cache.generation();
+  cache.Insert("a", generation, {0}, {1}, MakeChunk(4, 'a'));
+  cache.Insert("b", generation, {1}, {2}, MakeChunk(4, 'b'));
+  ASSERT_TRUE(cache.Find("a"));
+  EXPECT_EQ("aaaa", *cache.Find("a"));
+  // Evicts "b", which was used less recently than "a".
+  cache.Insert("c", generation, {2}, {3}, MakeChunk(4, 'c'));
+  EXPECT_FALSE(cache.Find("b"));
+  EXPECT_TRUE(cache.Find("a"));
+  EXPECT_TRUE(cache.Find("c"));
+  // A chunk larger than the capacity is not stored.
+  cache.Insert("d", generation, {3}, {4}, MakeChunk(11, 'd'));
+  EXPECT_FALSE(cache.Find("d"));
+  const auto statistics = cache.GetStatistics();
+  EXPECT_EQ(2u, statistics.num_cached);
+  EXPECT_EQ(8u, statistics.num_bytes);
+  EXPECT_EQ(4u, statistics.hits);
+  EXPECT_EQ(2u, statistics.misses);
+}
+
+TEST(EncodedChunkCacheTest, InvalidatesIntersectingChunks) {
+  EncodedChunkCache cache(100);
+  const uint64_t generation = cache.generation();
+  cache.Insert("a", generation, {0, 0}, {4, 4}, MakeChunk(1, 'a'));
+  cache.Insert("b", generation, {4, 0}, {8, 4}, MakeChunk(1, 'b'));
+  cache.Insert("c", generation, {0, 4}, {4, 8}, MakeChunk(1, 'c'));
+  cache.Invalidate({3, 0}, {4, 4});
+  EXPECT_FALSE(cache.Find("a"));
+  EXPECT_TRUE(cache.Find("b"));
+  EXPECT_TRUE(cache.Find("c"));
+  // A chunk computed before the invalidation is not stored.
+  cache.Insert("a", generation, {0, 0}, {4, 4}, MakeChunk(1, 'a'));
+  EXPECT_FALSE(cache.Find("a"));
+  cache.Insert("a", cache.generation(), {0, 0}, {4, 4}, MakeChunk(1, 'a'));
+  EXPECT_TRUE(cache.Find("a"));
+  cache.Clear();
+  EXPECT_FALSE(cache.Find("b"));
+  EXPECT_EQ(0u, cache.GetStatistics().num_bytes);
+}
+
+}  // namespace
+}  // namespace neuroglancer
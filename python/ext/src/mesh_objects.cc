@@ -16,126 +16,1658 @@
 
 #include "mesh_objects.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
-#ifdef USE_OMP
-#include <omp.h>
-#endif
+#include "decompress_segmentation.h"
+#include "parallel_for.h"
+#include "trace_events.h"
 
 namespace neuroglancer {
 namespace meshing {
 
+namespace {
+
+// Returns the number of consecutive cubes following the uniform cube at
+// `labels` that are also uniform with label `value`, counted in whole blocks
+// of kBlockSize cubes.  At most `max_count` cubes are counted.
+//
+// Requires a unit x stride.  The `row_offsets` are the offsets of the four
+// cube corners with an x offset of 0.
+//
+// The fixed-size inner loop over contiguous rows is compiled to vector compares
+// at -O3, which makes skipping the interior of objects much cheaper than
+// testing the corners of every cube.
 template <class Label>
-void MeshObjects(const Label* labels, const Vector3d& size,
-                 const Vector3d& strides_arg,
-                 std::unordered_map<uint64_t, TriangleMesh>* output) {
-  if (size[0] * size[1] * size[2] == 0) {
-    return;
+int64_t CountUniformCubes(const Label* labels, const ptrdiff_t row_offsets[4],
+                          Label value, int64_t max_count) {
+  constexpr int64_t kBlockSize = 16;
+  int64_t count = 0;
+  for (; count + kBlockSize <= max_count; count += kBlockSize) {
+    Label diff = 0;
+    for (int row = 0; row < 4; ++row) {
+      // The voxels at x offsets 0 and 1 of the current cube are already known
+      // to equal `value`.
+      const Label* row_labels = labels + row_offsets[row] + count + 2;
+      for (int64_t i = 0; i < kBlockSize; ++i) {
+        diff |= row_labels[i] ^ value;
+      }
+    }
+    if (diff) break;
+  }
+  return count;
+}
+
+// Calls AddCube for each distinct non-zero label among `label_at_corners`,
+// the labels of the corners of the cube at `position`, in the order of
+// cube_corner_position_offsets, that is not present at all corners.
+// `get_mesh` is therefore called exactly once per boundary cube of each label.
+template <class GetMesh>
+void AddCubeLabels(const Vector3d& position,
+                   const std::array<uint64_t, 8>& label_at_corners,
+                   const voxel_mesh_generator::VertexPositionMap& map,
+                   voxel_mesh_generator::SequentialVertexMap* vertex_map,
+                   GetMesh& get_mesh) {
+  for (int i = 0; i < 8; ++i) {
+    const auto label_i = label_at_corners[i];
+    // Skip label 0 (background component).
+    if (label_i == 0) continue;
+    // Determine if this label occurred at a prior corner index, in which case
+    // we don't need to process it again.
+    bool label_already_seen = false;
+    for (int j = 0; j < i; ++j) {
+      if (label_at_corners[j] == label_i) {
+        label_already_seen = true;
+        break;
+      }
+    }
+    if (label_already_seen) continue;
+    uint8_t corners_present = 0;
+    for (int j = i; j < 8; ++j) {
+      if (label_at_corners[j] == label_i) {
+        corners_present |= (1 << j);
+      }
+    }
+    // With equivalences, a cube of distinct labels may lie entirely within a
+    // single object, in which case it contributes no surface.
+    if (corners_present == 0xff) continue;
+    TriangleMesh* mesh = get_mesh(label_i);
+    if (!mesh) continue;
+    voxel_mesh_generator::AddCube(position, corners_present, map, vertex_map,
+                                  mesh);
+  }
+}
+
+// Label mapper for MarchCubePlane that leaves labels unchanged.
+struct IdentityLabelMapper {
+  uint64_t operator()(uint64_t label) const { return label; }
+};
+
+// Label mapper for MarchCubePlane that maps labels to object ids.  Successive
+// calls usually request the same label, so the last lookup is cached.
+class EquivalentLabelMapper {
+ public:
+  explicit EquivalentLabelMapper(const LabelEquivalences& equivalences)
+      : equivalences_(equivalences) {}
+
+  uint64_t operator()(uint64_t label) {
+    if (label != cached_label_) {
+      cached_label_ = label;
+      cached_object_id_ = equivalences_.Find(label);
+    }
+    return cached_object_id_;
   }
-  auto strides = strides_arg;
 
+ private:
+  const LabelEquivalences& equivalences_;
+  // Label 0 always maps to 0.
+  uint64_t cached_label_ = 0;
+  uint64_t cached_object_id_ = 0;
+};
+
+// Marches over the plane of cubes at `z`, whose first corners are at
+// `labels_z`, of a volume with `num_cubes` cubes along each dimension.  Each
+// row of cubes is read through four row pointers, and the labels of the x + 1
+// face of each cube are carried over as the x face of the next cube, so that
+// only four labels are loaded per cube.  The labels of each cube that is not
+// uniform are mapped by `map_label` before calling AddCubeLabels.
+//
+// If `kUnitXStride` is true, `strides[0]` must be 1.  The row pointers then
+// advance by a constant, and runs of uniform cubes are skipped a block at a
+// time by CountUniformCubes.
+template <bool kUnitXStride, class Label, class MapLabel, class GetMesh>
+void MarchCubePlane(const Label* labels_z, const Vector3d& strides,
+                    const Vector3d& num_cubes, int64_t z,
+                    const voxel_mesh_generator::VertexPositionMap& map,
+                    voxel_mesh_generator::SequentialVertexMap* vertex_map,
+                    MapLabel& map_label, GetMesh& get_mesh) {
+  const ptrdiff_t x_stride = kUnitXStride ? 1 : strides[0];
+
+  // Offsets of the rows of corners 0, 3, 4 and 7, which have an x offset of 0.
+  const ptrdiff_t row_offsets[4] = {0, strides[1], strides[2],
+                                    strides[1] + strides[2]};
+
+  auto const* labels_y = labels_z;
+  for (int64_t y = 0; y < num_cubes[1]; ++y, labels_y += strides[1]) {
+    const Label* const rows[4] = {
+        labels_y + row_offsets[0], labels_y + row_offsets[1],
+        labels_y + row_offsets[2], labels_y + row_offsets[3]};
+    // Labels of corners 0, 3, 4 and 7 of the current cube.
+    Label face[4] = {rows[0][0], rows[1][0], rows[2][0], rows[3][0]};
+    for (int64_t x = 0; x < num_cubes[0]; ++x) {
+      // Labels of corners 1, 2, 5 and 6 of the current cube, which are
+      // corners 0, 3, 4 and 7 of the next cube.
+      const ptrdiff_t next_offset = (x + 1) * x_stride;
+      const Label next[4] = {rows[0][next_offset], rows[1][next_offset],
+                             rows[2][next_offset], rows[3][next_offset]};
+      const Label value = face[0];
+      if (((face[1] ^ value) | (face[2] ^ value) | (face[3] ^ value) |
+           (next[0] ^ value) | (next[1] ^ value) | (next[2] ^ value) |
+           (next[3] ^ value)) == 0) {
+        if (kUnitXStride) {
+          // Skip the rest of the run of uniform cubes a block at a time.  The
+          // x + 1 face of the last skipped cube is again `value`, so `face`
+          // remains valid.
+          x += CountUniformCubes(labels_y + x, row_offsets, value,
+                                 num_cubes[0] - x - 1);
+        }
+        continue;
+      }
+      const std::array<uint64_t, 8> label_at_corners = {
+          {map_label(face[0]), map_label(next[0]), map_label(next[1]),
+           map_label(face[1]), map_label(face[2]), map_label(next[2]),
+           map_label(next[3]), map_label(face[3])}};
+      AddCubeLabels(Vector3d{x, y, z}, label_at_corners, map, vertex_map,
+                    get_mesh);
+      for (int i = 0; i < 4; ++i) face[i] = next[i];
+    }
+  }
+}
+
+// Implementation of MeshRegion; see MarchCubePlane for `kUnitXStride` and
+// `map_label`.
+template <bool kUnitXStride, class Label, class MapLabel, class GetMesh>
+void MeshRegionImpl(const Label* labels, const Vector3d& size,
+                    const Vector3d& strides, MapLabel map_label,
+                    GetMesh get_mesh) {
   voxel_mesh_generator::VertexPositionMap map(size);
 
   // We iterate over 2*2*2 voxel cubes.
   Vector3d adjusted_size = size;
   for (auto& x : adjusted_size) x -= 1;
 
-  ptrdiff_t corner_label_offset[8];
-  for (int i = 0; i < 8; ++i) {
-    auto const& cube_corner_position_offset =
-        voxel_mesh_generator::cube_corner_position_offsets[i];
-    ptrdiff_t offset = 0;
+  voxel_mesh_generator::SequentialVertexMap vertex_map(map);
+
+  auto const* labels_z = labels;
+  for (int64_t z = 0; z < adjusted_size[2]; ++z, labels_z += strides[2]) {
+    MarchCubePlane<kUnitXStride>(labels_z, strides, adjusted_size, z, map,
+                                 &vertex_map, map_label, get_mesh);
+  }
+}
+
+// Implementation of MeshRegion for a specific label mapper.
+template <class Label, class MapLabel, class GetMesh>
+void MeshRegionWithMapper(const Label* labels, const Vector3d& size,
+                          const Vector3d& strides, MapLabel map_label,
+                          GetMesh get_mesh) {
+  if (strides[0] == 1) {
+    MeshRegionImpl<true>(labels, size, strides, std::move(map_label),
+                         std::move(get_mesh));
+  } else {
+    MeshRegionImpl<false>(labels, size, strides, std::move(map_label),
+                          std::move(get_mesh));
+  }
+}
+
+// Marches over every 2x2x2 voxel cube of the volume of the specified `size`,
+// calling AddCube once per distinct non-zero object id contained within the
+// cube, where the object id of a label is given by `equivalences` if not null,
+// or is the label itself.
+//
+// `get_mesh(object_id)` returns the TriangleMesh to which the surface of the
+// object is added, or nullptr if the object should be skipped.
+//
+// The common case of a unit x stride, which includes the blocks read by
+// MeshObjectsChunked, is compiled separately from the general case, as is the
+// common case of no equivalences.
+template <class Label, class GetMesh>
+void MeshRegion(const Label* labels, const Vector3d& size,
+                const Vector3d& strides,
+                const LabelEquivalences* equivalences, GetMesh get_mesh) {
+  if (equivalences && !equivalences->empty()) {
+    MeshRegionWithMapper(labels, size, strides,
+                         EquivalentLabelMapper(*equivalences),
+                         std::move(get_mesh));
+  } else {
+    MeshRegionWithMapper(labels, size, strides, IdentityLabelMapper(),
+                         std::move(get_mesh));
+  }
+}
+
+// `get_mesh` function for MeshRegion that stores the mesh of each label densely,
+// as specified by a DenseLabelMap, and skips labels not in the map.  Successive
+// calls usually request the same label, so the last lookup is cached.
+//
+// If `cube_counts` is not null, the calls for each label, which are its
+// boundary cubes, are also counted densely.
+class DenseMeshGetter {
+ public:
+  DenseMeshGetter(const DenseLabelMap& label_map,
+                  std::vector<TriangleMesh>* meshes,
+                  std::vector<uint64_t>* cube_counts = nullptr)
+      : label_map_(label_map), meshes_(meshes), cube_counts_(cube_counts) {}
+
+  TriangleMesh* operator()(uint64_t label) {
+    if (label != cached_label_) {
+      cached_label_ = label;
+      cached_index_ = label_map_.Find(label);
+      cached_mesh_ = cached_index_ == -1 ? nullptr : &(*meshes_)[cached_index_];
+    }
+    if (cube_counts_ && cached_mesh_) ++(*cube_counts_)[cached_index_];
+    return cached_mesh_;
+  }
+
+ private:
+  const DenseLabelMap& label_map_;
+  std::vector<TriangleMesh>* meshes_;
+  std::vector<uint64_t>* cube_counts_;
+  // Label 0 is never requested.
+  uint64_t cached_label_ = 0;
+  int64_t cached_index_ = -1;
+  TriangleMesh* cached_mesh_ = nullptr;
+};
+
+constexpr uint64_t kMaxDirectIndexSize = 1 << 16;
+}  // namespace
+
+DenseLabelMap::DenseLabelMap(std::vector<uint64_t> ids)
+    : ids_(std::move(ids)) {
+  // Only use a direct lookup table if it is reasonably dense.
+  const size_t direct_index_size =
+      std::lower_bound(ids_.begin(), ids_.end(), kMaxDirectIndexSize) -
+      ids_.begin();
+  if (direct_index_size == 0) return;
+  direct_index_.assign(ids_[direct_index_size - 1] + 1, -1);
+  for (size_t i = 0; i < direct_index_size; ++i) {
+    direct_index_[ids_[i]] = static_cast<int32_t>(i);
+  }
+}
+
+LabelEquivalences::LabelEquivalences(
+    std::vector<std::pair<uint64_t, uint64_t>> pairs) {
+  pairs.erase(std::remove_if(pairs.begin(), pairs.end(),
+                             [](const std::pair<uint64_t, uint64_t>& p) {
+                               return p.first == 0;
+                             }),
+              pairs.end());
+  std::sort(pairs.begin(), pairs.end());
+  labels_.reserve(pairs.size());
+  object_ids_.reserve(pairs.size());
+  for (const auto& p : pairs) {
+    labels_.push_back(p.first);
+    object_ids_.push_back(p.second);
+  }
+}
+
+std::vector<uint64_t> ComputeObjectIds(const std::vector<uint64_t>& labels,
+                                       const LabelEquivalences& equivalences) {
+  std::vector<uint64_t> ids;
+  ids.reserve(labels.size());
+  for (const uint64_t label : labels) {
+    const uint64_t id = equivalences.Find(label);
+    if (id != 0) ids.push_back(id);
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  return ids;
+}
+
+void MeshFragmentMerger::Append(const TriangleMesh& fragment,
+                                const Vector3d& region_start,
+                                const Vector3d& region_size) {
+  const uint64_t kEmptyKey =
+      voxel_mesh_generator::VertexIndexHashMap::kEmptyKey;
+  const size_t num_vertices = fragment.vertex_positions.size();
+  // Key of each vertex on the region boundary, or kEmptyKey.
+  std::vector<uint64_t> keys(num_vertices, kEmptyKey);
+  size_t num_boundary_vertices = 0;
+  for (size_t i = 0; i < num_vertices; ++i) {
+    const auto& vertex = fragment.vertex_positions[i];
+    bool on_boundary = false;
+    for (int j = 0; j < 3; ++j) {
+      if (vertex[j] == 0 || vertex[j] == region_size[j] - 1) {
+        on_boundary = true;
+      }
+    }
+    if (!on_boundary) continue;
+    // Vertex coordinates are multiples of 0.5, so twice the coordinates are
+    // exact integers.  21 bits per dimension suffices for any volume we can
+    // mesh.
+    uint64_t key = 0;
+    for (int j = 0; j < 3; ++j) {
+      key = (key << 21) |
+            static_cast<uint64_t>(
+                (vertex[j] + static_cast<float>(region_start[j])) * 2);
+    }
+    keys[i] = key;
+    ++num_boundary_vertices;
+  }
+  boundary_vertices_.Reserve(boundary_vertices_.size() +
+                             num_boundary_vertices);
+  std::vector<TriangleMesh::VertexIndex> index_map(num_vertices);
+  auto& vertex_positions = output_->vertex_positions;
+  for (size_t i = 0; i < num_vertices; ++i) {
+    const auto new_index =
+        static_cast<TriangleMesh::VertexIndex>(vertex_positions.size());
+    if (keys[i] != kEmptyKey) {
+      bool inserted;
+      index_map[i] = boundary_vertices_.FindOrInsert(keys[i], new_index,
+                                                     &inserted);
+      if (!inserted) continue;
+    } else {
+      index_map[i] = new_index;
+    }
+    auto vertex = fragment.vertex_positions[i];
+    for (int j = 0; j < 3; ++j) {
+      vertex[j] += static_cast<float>(region_start[j]);
+    }
+    vertex_positions.push_back(vertex);
+  }
+  output_->triangles.reserve(output_->triangles.size() +
+                             fragment.triangles.size());
+  for (auto const& triangle : fragment.triangles) {
+    output_->triangles.push_back(
+        {{index_map[triangle[0]], index_map[triangle[1]],
+          index_map[triangle[2]]}});
+  }
+}
+
+namespace {
+
+// Stores `value` as a T at index `i` of the array of T starting at `output`.
+template <class T>
+void StoreElement(uint64_t value, size_t i, uint8_t* output) {
+  const T v = static_cast<T>(value);
+  std::memcpy(output + i * sizeof(T), &v, sizeof(T));
+}
+
+template <class T>
+uint64_t LoadElement(size_t i, const uint8_t* input) {
+  T v;
+  std::memcpy(&v, input + i * sizeof(T), sizeof(T));
+  return v;
+}
+
+}  // namespace
+
+CompactTriangleMesh::CompactTriangleMesh(const TriangleMesh& mesh) {
+  num_vertices_ = static_cast<uint32_t>(mesh.vertex_positions.size());
+  num_triangles_ = static_cast<uint32_t>(mesh.triangles.size());
+  if (num_triangles_ == 0) return;
+  std::array<int64_t, 3> max_position;
+  for (int j = 0; j < 3; ++j) {
+    origin_[j] = std::numeric_limits<int64_t>::max();
+    max_position[j] = std::numeric_limits<int64_t>::min();
+  }
+  for (const auto& vertex : mesh.vertex_positions) {
+    for (int j = 0; j < 3; ++j) {
+      const int64_t v = std::llround(vertex[j] * 2);
+      origin_[j] = std::min(origin_[j], v);
+      max_position[j] = std::max(max_position[j], v);
+    }
+  }
+  for (int j = 0; j < 3; ++j) {
+    if (max_position[j] - origin_[j] > 0xffff) wide_positions_ = true;
+  }
+  wide_indices_ = num_vertices_ > 0x10000;
+  const size_t position_bytes = GetPositionBytes();
+  const size_t index_bytes =
+      size_t(num_triangles_) * 3 * (wide_indices_ ? 4 : 2);
+  data_.resize(position_bytes + index_bytes);
+  uint8_t* positions = data_.data();
+  for (size_t i = 0; i < num_vertices_; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      const uint64_t v =
+          std::llround(mesh.vertex_positions[i][j] * 2) - origin_[j];
+      if (wide_positions_) {
+        StoreElement<uint32_t>(v, i * 3 + j, positions);
+      } else {
+        StoreElement<uint16_t>(v, i * 3 + j, positions);
+      }
+    }
+  }
+  uint8_t* indices = data_.data() + position_bytes;
+  for (size_t i = 0; i < num_triangles_; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      if (wide_indices_) {
+        StoreElement<uint32_t>(mesh.triangles[i][j], i * 3 + j, indices);
+      } else {
+        StoreElement<uint16_t>(mesh.triangles[i][j], i * 3 + j, indices);
+      }
+    }
+  }
+}
+
+void CompactTriangleMesh::Decode(TriangleMesh* mesh) const {
+  mesh->vertex_positions.resize(num_vertices_);
+  mesh->triangles.resize(num_triangles_);
+  if (num_triangles_ == 0) return;
+  const uint8_t* positions = data_.data();
+  for (size_t i = 0; i < num_vertices_; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      const uint64_t v = wide_positions_
+                             ? LoadElement<uint32_t>(i * 3 + j, positions)
+                             : LoadElement<uint16_t>(i * 3 + j, positions);
+      mesh->vertex_positions[i][j] =
+          static_cast<float>(static_cast<int64_t>(v) + origin_[j]) * 0.5f;
+    }
+  }
+  const size_t position_bytes = GetPositionBytes();
+  const uint8_t* indices = data_.data() + position_bytes;
+  for (size_t i = 0; i < num_triangles_; ++i) {
     for (int j = 0; j < 3; ++j) {
-      offset += strides[j] * cube_corner_position_offset[j];
+      mesh->triangles[i][j] = static_cast<TriangleMesh::VertexIndex>(
+          wide_indices_ ? LoadElement<uint32_t>(i * 3 + j, indices)
+                        : LoadElement<uint16_t>(i * 3 + j, indices));
+    }
+  }
+}
+
+double ComputeSurfaceArea(const TriangleMesh& mesh, const float scale[3]) {
+  double area = 0;
+  const auto& positions = mesh.vertex_positions;
+  for (const auto& triangle : mesh.triangles) {
+    double edges[2][3];
+    for (int i = 0; i < 2; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        edges[i][j] = (double(positions[triangle[i + 1]][j]) -
+                       positions[triangle[0]][j]) *
+                      scale[j];
+      }
+    }
+    double squared_norm = 0;
+    for (int j = 0; j < 3; ++j) {
+      const double c = edges[0][(j + 1) % 3] * edges[1][(j + 2) % 3] -
+                       edges[0][(j + 2) % 3] * edges[1][(j + 1) % 3];
+      squared_norm += c * c;
+    }
+    area += std::sqrt(squared_norm);
+  }
+  return area / 2;
+}
+
+namespace {
+
+// Vertex at the midpoint of a voxel edge whose endpoints belong to different
+// objects, as computed by MeshObjectsFlyingEdges.  Each edge is owned by the
+// row of voxels that contains its lower endpoint.
+struct EdgeVertex {
+  // Position of the lower endpoint along the row.
+  uint32_t x;
+  // Dimension along which the edge lies.
+  uint32_t axis;
+  // Dense index of the object.
+  uint32_t object;
+  // Index of the vertex in the mesh of the object once it is emitted, and
+  // until then the index of the object in FlyingEdgesRow::objects.
+  uint32_t vertex_index;
+};
+
+// Boundary cube of an object, as computed by MeshObjectsFlyingEdges.
+struct CubeObject {
+  // Position of the first corner of the cube along its row.
+  uint32_t x;
+  // Dense index of the object, and its index in FlyingEdgesRow::objects.
+  uint32_t object;
+  uint32_t row_object;
+  // Corners of the cube that belong to the object, as for AddCube.
+  uint8_t corners_present;
+};
+
+// Vertices, triangles and boundary cubes of an object within a row.  The
+// prefix sums over the rows replace the numbers of vertices and triangles by
+// the index of the first of them in the mesh of the object.
+struct RowObject {
+  uint32_t object;
+  uint32_t num_cubes;
+  uint64_t vertex_start;
+  uint64_t triangle_start;
+};
+
+// State of MeshObjectsFlyingEdges for the row of voxels at (y, z), and for the
+// row of cubes whose first corners are in it.
+template <class Label>
+struct FlyingEdgesRow {
+  // The x edges of the row whose endpoints differ lie within [edge_begin,
+  // edge_end), and the voxels before and after are `first_label` and
+  // `last_label`, respectively.
+  int64_t edge_begin;
+  int64_t edge_end;
+  Label first_label;
+  Label last_label;
+
+  // Vertices of the edges owned by the row, in order of x and then axis.
+  std::vector<EdgeVertex> vertices;
+
+  // Boundary cubes of each object in the row of cubes, in order of x.
+  std::vector<CubeObject> cubes;
+
+  // Objects of `vertices` and `cubes`, in order of first appearance.
+  std::vector<RowObject> objects;
+};
+
+// Returns the dense index of an object id in a DenseLabelMap, or -1 if it is
+// not in the map.  Successive calls usually request the same id, so the last
+// lookup is cached.
+class CachedObjectFinder {
+ public:
+  explicit CachedObjectFinder(const DenseLabelMap& label_map)
+      : label_map_(label_map) {}
+
+  int64_t operator()(uint64_t id) {
+    if (id != cached_id_) {
+      cached_id_ = id;
+      cached_index_ = label_map_.Find(id);
+    }
+    return cached_index_;
+  }
+
+ private:
+  const DenseLabelMap& label_map_;
+  // Id 0 is never in the map.
+  uint64_t cached_id_ = 0;
+  int64_t cached_index_ = -1;
+};
+
+// Lists the distinct objects of a row in FlyingEdgesRow::objects, and returns
+// the index of each, by way of an open-addressed hash table of the indices.
+// Successive calls usually request the same object, so the last lookup is
+// cached.
+class RowObjectIndexer {
+ public:
+  explicit RowObjectIndexer(std::vector<RowObject>* objects)
+      : objects_(objects) {}
+
+  uint32_t operator()(uint32_t object) {
+    if (object == cached_object_) return cached_index_;
+    if (2 * (objects_->size() + 1) > slots_.size()) Grow();
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = Hash(object) & mask;; slot = (slot + 1) & mask) {
+      uint32_t& index = slots_[slot];
+      if (index == kEmptySlot) {
+        index = static_cast<uint32_t>(objects_->size());
+        objects_->push_back({object, 0, 0, 0});
+      } else if ((*objects_)[index].object != object) {
+        continue;
+      }
+      cached_object_ = object;
+      cached_index_ = index;
+      return index;
+    }
+  }
+
+ private:
+  static constexpr uint32_t kEmptySlot = std::numeric_limits<uint32_t>::max();
+
+  static size_t Hash(uint32_t object) { return object * 0x9e3779b1u; }
+
+  void Grow() {
+    slots_.assign(std::max(size_t(16), slots_.size() * 2), kEmptySlot);
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = 0; i < objects_->size(); ++i) {
+      size_t slot = Hash((*objects_)[i].object) & mask;
+      while (slots_[slot] != kEmptySlot) slot = (slot + 1) & mask;
+      slots_[slot] = static_cast<uint32_t>(i);
+    }
+  }
+
+  std::vector<RowObject>* objects_;
+  std::vector<uint32_t> slots_;
+  uint32_t cached_object_ = std::numeric_limits<uint32_t>::max();
+  uint32_t cached_index_ = 0;
+};
+
+constexpr uint32_t RowObjectIndexer::kEmptySlot;
+
+// Calls `fn(object, corners_present)` once for each object of `label_map`
+// whose labels, as mapped by `map_label`, are present at some but not all of
+// the `corner_labels` of a cube that is not uniform, as AddCubeLabels does.
+template <class Label, class MapLabel, class Fn>
+void ForEachCubeObject(const Label corner_labels[8], MapLabel& map_label,
+                       CachedObjectFinder& find_object, Fn fn) {
+  uint64_t ids[8];
+  for (int i = 0; i < 8; ++i) ids[i] = map_label(corner_labels[i]);
+  for (int i = 0; i < 8; ++i) {
+    const uint64_t id = ids[i];
+    if (id == 0) continue;
+    bool already_seen = false;
+    for (int j = 0; j < i; ++j) {
+      if (ids[j] == id) {
+        already_seen = true;
+        break;
+      }
+    }
+    if (already_seen) continue;
+    uint8_t corners_present = 0;
+    for (int j = i; j < 8; ++j) {
+      if (ids[j] == id) corners_present |= (1 << j);
+    }
+    if (corners_present == 0xff) continue;
+    const int64_t object = find_object(id);
+    if (object == -1) continue;
+    fn(static_cast<uint32_t>(object), corners_present);
+  }
+}
+
+// Implementation of MeshObjects for MeshingEngine::kFlyingEdges, with labels
+// mapped to object ids by `map_label` as for MarchCubePlane.
+//
+// Every pass runs in parallel over the rows of voxels:
+//
+// 1. The first and last x edges of each row whose endpoint labels differ are
+//    found, which bounds the non-uniform cubes of each row of cubes by those
+//    of the four rows of voxels containing its corners.
+//
+// 2. Within those bounds, the edges owned by each row whose endpoints belong
+//    to different objects are recorded as vertices of both objects, and the
+//    boundary cubes of each object are recorded with the corners it occupies,
+//    from which the triangle table gives its number of triangles.
+//
+// After prefix sums of the per-row counts, which determine the final size of
+// every mesh and the range of it that each row fills, the vertices and then
+// the triangles of each row are written to their ranges.  Each boundary cube
+// finds the vertices of its edges among those of its four rows, which are
+// sorted by x, by advancing a cursor into each.  The meshes are identical to
+// those of marching cubes up to vertex and triangle order.
+template <class Label, class MapLabel>
+void MeshObjectsFlyingEdges(const Label* labels, const Vector3d& size,
+                            const Vector3d& strides,
+                            const DenseLabelMap& label_map,
+                            const MapLabel& map_label, int num_threads,
+                            std::vector<TriangleMesh>* output,
+                            std::vector<uint64_t>* boundary_cube_counts) {
+  using voxel_mesh_generator::cube_corner_position_offsets;
+  const int64_t nx = size[0], ny = size[1], nz = size[2];
+  // Without cubes, there are no surfaces.
+  if (nx < 2 || ny < 2 || nz < 2) return;
+  const ptrdiff_t x_stride = strides[0];
+  const size_t num_rows = ny * nz;
+  std::vector<FlyingEdgesRow<Label>> rows(num_rows);
+  const auto get_row_labels = [&](size_t row_i) {
+    const int64_t y = row_i % ny, z = row_i / ny;
+    return labels + y * strides[1] + z * strides[2];
+  };
+
+  // Offsets of the four rows of voxels of a row of cubes relative to the
+  // first, indexed by y offset + 2 * z offset.
+  const size_t row_offsets[4] = {0, 1, size_t(ny), size_t(ny) + 1};
+
+  // Cube edge index of the edges owned by each of the four rows of a row of
+  // cubes, by x offset and axis, or -1 for edges outside the cube.
+  int cube_edges[4][2][3];
+  std::fill(&cube_edges[0][0][0], &cube_edges[0][0][0] + 4 * 2 * 3, -1);
+  for (int edge_i = 0; edge_i < 12; ++edge_i) {
+    const int* corners =
+        voxel_mesh_generator::GetCubeEdgeCornerIndices(edge_i);
+    const auto& a = cube_corner_position_offsets[corners[0]];
+    const auto& b = cube_corner_position_offsets[corners[1]];
+    const int axis = a[0] != b[0] ? 0 : a[1] != b[1] ? 1 : 2;
+    cube_edges[a[1] + 2 * a[2]][a[0]][axis] = edge_i;
+  }
+  // Number of triangles of each cube case.
+  uint8_t case_triangle_counts[256];
+  for (int corners_present = 0; corners_present < 256; ++corners_present) {
+    const int* edges =
+        voxel_mesh_generator::GetCubeTriangleEdges(corners_present);
+    int count = 0;
+    while (edges[count * 3] != -1) ++count;
+    case_triangle_counts[corners_present] = static_cast<uint8_t>(count);
+  }
+
+  // Pass 1: classify the x edges of each row.
+  ParallelFor(num_rows, num_threads, [&](size_t row_i) {
+    auto& row = rows[row_i];
+    const Label* row_labels = get_row_labels(row_i);
+    row.first_label = row_labels[0];
+    row.last_label = row_labels[(nx - 1) * x_stride];
+    row.edge_begin = nx - 1;
+    row.edge_end = 0;
+    for (int64_t x = 0; x + 1 < nx; ++x) {
+      if (row_labels[x * x_stride] != row_labels[(x + 1) * x_stride]) {
+        row.edge_begin = x;
+        break;
+      }
+    }
+    for (int64_t x = nx - 1; x > row.edge_begin; --x) {
+      if (row_labels[(x - 1) * x_stride] != row_labels[x * x_stride]) {
+        row.edge_end = x;
+        break;
+      }
+    }
+  });
+
+  // Pass 2: record the vertices and boundary cubes of each row, and count
+  // them by object.
+  ParallelFor(num_rows, num_threads, [&](size_t row_i) {
+    auto& row = rows[row_i];
+    const int64_t y = row_i % ny, z = row_i / ny;
+    const bool has_y = y + 1 < ny, has_z = z + 1 < nz;
+    // Bounds of the cubes with a corner in this row that are not uniform.
+    // Beyond them, the rows sharing edges and cubes with this row are each
+    // uniform with the same label.
+    int64_t begin = row.edge_begin, end = row.edge_end;
+    for (int i = 1; i < 4; ++i) {
+      if (((i & 1) && !has_y) || ((i & 2) && !has_z)) continue;
+      const auto& other = rows[row_i + row_offsets[i]];
+      begin = std::min(begin, other.edge_begin);
+      end = std::max(end, other.edge_end);
+      if (other.first_label != row.first_label) begin = 0;
+      if (other.last_label != row.last_label) end = nx - 1;
+    }
+    if (begin >= end) return;
+
+    MapLabel row_map_label = map_label;
+    CachedObjectFinder find_object(label_map);
+    RowObjectIndexer index_row_object(&row.objects);
+    const Label* row_labels[4];
+    for (int i = 0; i < 4; ++i) {
+      row_labels[i] = nullptr;
+      if (((i & 1) && !has_y) || ((i & 2) && !has_z)) continue;
+      row_labels[i] = get_row_labels(row_i + row_offsets[i]);
+    }
+    const auto add_edge = [&](int64_t x, uint32_t axis, Label a, Label b) {
+      if (a == b) return;
+      const uint64_t ids[2] = {row_map_label(a), row_map_label(b)};
+      if (ids[0] == ids[1]) return;
+      for (const uint64_t id : ids) {
+        if (id == 0) continue;
+        const int64_t object = find_object(id);
+        if (object == -1) continue;
+        const uint32_t row_object =
+            index_row_object(static_cast<uint32_t>(object));
+        ++row.objects[row_object].vertex_start;
+        row.vertices.push_back({static_cast<uint32_t>(x), axis,
+                                static_cast<uint32_t>(object), row_object});
+      }
+    };
+    // The edges along y and z at `end` may still differ.
+    const int64_t edge_end = std::min(end + 1, nx);
+    for (int64_t x = begin; x < edge_end; ++x) {
+      const Label label = row_labels[0][x * x_stride];
+      if (x >= row.edge_begin && x < row.edge_end) {
+        add_edge(x, 0, label, row_labels[0][(x + 1) * x_stride]);
+      }
+      if (has_y) add_edge(x, 1, label, row_labels[1][x * x_stride]);
+      if (has_z) add_edge(x, 2, label, row_labels[2][x * x_stride]);
+    }
+
+    if (has_y && has_z) {
+      // Labels of the corners of the current cube with x offset 0 and 1, in
+      // the order of `row_offsets`, as in MarchCubePlane.
+      Label face[4], next[4];
+      for (int i = 0; i < 4; ++i) face[i] = row_labels[i][begin * x_stride];
+      for (int64_t x = begin; x < end; ++x) {
+        Label diff = 0;
+        for (int i = 0; i < 4; ++i) {
+          next[i] = row_labels[i][(x + 1) * x_stride];
+          diff |= (face[i] ^ face[0]) | (next[i] ^ face[0]);
+        }
+        if (diff != 0) {
+          const Label corner_labels[8] = {face[0], next[0], next[1], face[1],
+                                          face[2], next[2], next[3], face[3]};
+          ForEachCubeObject(corner_labels, row_map_label, find_object,
+                            [&](uint32_t object, uint8_t corners_present) {
+                              const uint32_t row_object =
+                                  index_row_object(object);
+                              auto& counts = row.objects[row_object];
+                              ++counts.num_cubes;
+                              counts.triangle_start +=
+                                  case_triangle_counts[corners_present];
+                              row.cubes.push_back({static_cast<uint32_t>(x),
+                                                   object, row_object,
+                                                   corners_present});
+                            });
+        }
+        for (int i = 0; i < 4; ++i) face[i] = next[i];
+      }
+    }
+  });
+
+  // Assign each row its range of each mesh, in order of the rows.
+  std::vector<uint64_t> num_vertices(label_map.size()),
+      num_triangles(label_map.size());
+  for (auto& row : rows) {
+    for (auto& row_object : row.objects) {
+      const uint32_t object = row_object.object;
+      const uint64_t row_vertices = row_object.vertex_start;
+      const uint64_t row_triangles = row_object.triangle_start;
+      row_object.vertex_start = num_vertices[object];
+      row_object.triangle_start = num_triangles[object];
+      num_vertices[object] += row_vertices;
+      num_triangles[object] += row_triangles;
+      if (boundary_cube_counts) {
+        (*boundary_cube_counts)[object] += row_object.num_cubes;
+      }
+    }
+  }
+  ParallelFor(label_map.size(), num_threads, [&](size_t object) {
+    auto& mesh = (*output)[object];
+    mesh.vertex_positions.resize(num_vertices[object]);
+    mesh.triangles.resize(num_triangles[object]);
+  });
+
+  // Pass 3: emit the vertices of each row.
+  ParallelFor(num_rows, num_threads, [&](size_t row_i) {
+    auto& row = rows[row_i];
+    const float y = static_cast<float>(row_i % ny);
+    const float z = static_cast<float>(row_i / ny);
+    for (auto& vertex : row.vertices) {
+      vertex.vertex_index = static_cast<uint32_t>(
+          row.objects[vertex.vertex_index].vertex_start++);
+      auto& position =
+          (*output)[vertex.object].vertex_positions[vertex.vertex_index];
+      position = {{static_cast<float>(vertex.x), y, z}};
+      position[vertex.axis] += 0.5f;
+    }
+  });
+
+  // Pass 4: emit the triangles of each row of cubes.
+  ParallelFor(num_rows, num_threads, [&](size_t row_i) {
+    auto& row = rows[row_i];
+    if (row.cubes.empty()) return;
+    const EdgeVertex* cursors[4];
+    const EdgeVertex* row_ends[4];
+    for (int i = 0; i < 4; ++i) {
+      const auto& vertices = rows[row_i + row_offsets[i]].vertices;
+      cursors[i] = vertices.data();
+      row_ends[i] = vertices.data() + vertices.size();
+    }
+    // Vertices of each edge of the current cube: at most one per endpoint.
+    const EdgeVertex* edge_vertices[12][2];
+    int num_edge_vertices[12];
+    for (size_t cube_i = 0; cube_i < row.cubes.size(); ++cube_i) {
+      const auto& cube = row.cubes[cube_i];
+      if (cube_i == 0 || cube.x != row.cubes[cube_i - 1].x) {
+        std::fill_n(num_edge_vertices, 12, 0);
+        for (int i = 0; i < 4; ++i) {
+          while (cursors[i] != row_ends[i] && cursors[i]->x < cube.x) {
+            ++cursors[i];
+          }
+          for (const EdgeVertex* v = cursors[i];
+               v != row_ends[i] && v->x <= cube.x + 1; ++v) {
+            const int edge_i = cube_edges[i][v->x - cube.x][v->axis];
+            if (edge_i == -1) continue;
+            edge_vertices[edge_i][num_edge_vertices[edge_i]++] = v;
+          }
+        }
+      }
+      const auto get_vertex = [&](int edge_i) {
+        // The vertex is present by construction.
+        const EdgeVertex* const* v = edge_vertices[edge_i];
+        return (v[0]->object == cube.object ? v[0] : v[1])->vertex_index;
+      };
+      auto& mesh = (*output)[cube.object];
+      auto& row_object = row.objects[cube.row_object];
+      const int* edges =
+          voxel_mesh_generator::GetCubeTriangleEdges(cube.corners_present);
+      for (int i = 0; edges[i] != -1; i += 3) {
+        auto& triangle = mesh.triangles[row_object.triangle_start++];
+        // Reversed, as by AddCube.
+        for (int j = 0; j < 3; ++j) triangle[2 - j] = get_vertex(edges[i + j]);
+      }
+    }
+  });
+}
+
+// Returns the index of the lowest set bit of a non-zero `word`, by de Bruijn
+// multiplication.
+inline int LowestSetBit(uint64_t word) {
+  static const int kDeBruijnBitIndex[64] = {
+      0,  1,  48, 2,  57, 49, 28, 3,  61, 58, 50, 42, 38, 29, 17, 4,
+      62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+      63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+      46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9,  13, 8,  7,  6};
+  return kDeBruijnBitIndex[((word & (~word + 1)) * 0x03f79d71b4cb0a89ull) >>
+                           58];
+}
+
+// Packed bitmap of the cubes of a volume that are not uniform, which are the
+// only cubes that can contribute to a surface, with a row of 64-bit words per
+// row of cubes, and the number of such cubes in each z plane of cubes.
+//
+// In a typical segmentation only a few percent of cubes are not uniform, so
+// marching over the bitmap visits far fewer cubes than MarchCubePlane, and the
+// plane counts permit dividing the marching among threads by the number of
+// boundary cubes rather than by volume.
+class BoundaryCubeBitmap {
+ public:
+  // Computes the bitmap of a volume with `num_cubes` cubes along each
+  // dimension, in parallel over the planes of cubes.
+  template <class Label>
+  BoundaryCubeBitmap(const Label* labels, const Vector3d& strides,
+                     const Vector3d& num_cubes, int num_threads)
+      : num_cubes_(num_cubes),
+        words_per_row_((num_cubes[0] + 63) / 64),
+        words_(words_per_row_ * num_cubes[1] * num_cubes[2]),
+        plane_counts_(num_cubes[2]) {
+    ParallelFor(num_cubes[2], num_threads, [&](size_t z) {
+      if (strides[0] == 1) {
+        ComputePlane<true>(labels, strides, z);
+      } else {
+        ComputePlane<false>(labels, strides, z);
+      }
+    });
+  }
+
+  const Vector3d& num_cubes() const { return num_cubes_; }
+
+  // Returns the words of the row of cubes at (y, z).  Bit i of word w is set
+  // if cube x = 64 * w + i is not uniform.
+  const uint64_t* row(int64_t y, int64_t z) const {
+    return &words_[words_per_row_ * (y + num_cubes_[1] * z)];
+  }
+
+  int64_t words_per_row() const { return words_per_row_; }
+
+  const std::vector<int64_t>& plane_counts() const { return plane_counts_; }
+
+  size_t num_bytes() const {
+    return words_.size() * sizeof(uint64_t) +
+           plane_counts_.size() * sizeof(int64_t);
+  }
+
+ private:
+  // The fixed-size inner loop over up to 64 cubes compiles to vector compares
+  // if `kUnitXStride` is true, in which case `strides[0]` must be 1.
+  template <bool kUnitXStride, class Label>
+  void ComputePlane(const Label* labels, const Vector3d& strides, int64_t z) {
+    const ptrdiff_t x_stride = kUnitXStride ? 1 : strides[0];
+    int64_t count = 0;
+    for (int64_t y = 0; y < num_cubes_[1]; ++y) {
+      const Label* r0 = labels + y * strides[1] + z * strides[2];
+      const Label* r1 = r0 + strides[1];
+      const Label* r2 = r0 + strides[2];
+      const Label* r3 = r1 + strides[2];
+      uint64_t* words = &words_[words_per_row_ * (y + num_cubes_[1] * z)];
+      for (int64_t w = 0; w < words_per_row_; ++w) {
+        const int64_t begin = 64 * w;
+        const int64_t n = std::min(int64_t(64), num_cubes_[0] - begin);
+        uint8_t mixed[64];
+        for (int64_t i = 0; i < n; ++i) {
+          const ptrdiff_t a = (begin + i) * x_stride;
+          const ptrdiff_t b = a + x_stride;
+          const Label value = r0[a];
+          mixed[i] = ((r0[b] ^ value) | (r1[a] ^ value) | (r1[b] ^ value) |
+                      (r2[a] ^ value) | (r2[b] ^ value) | (r3[a] ^ value) |
+                      (r3[b] ^ value)) != 0;
+        }
+        uint64_t word = 0;
+        for (int64_t i = 0; i < n; ++i) {
+          word |= uint64_t(mixed[i]) << i;
+          count += mixed[i];
+        }
+        words[w] = word;
+      }
+    }
+    plane_counts_[z] = count;
+  }
+
+  Vector3d num_cubes_;
+  int64_t words_per_row_;
+  std::vector<uint64_t> words_;
+  std::vector<int64_t> plane_counts_;
+};
+
+// Same as MeshRegionImpl over the slab of cubes [z_begin, z_end) of the volume
+// of `bitmap`, but marching only over the cubes that are not uniform.  Vertex
+// positions are relative to the slab, whose labels start at `labels`.  The
+// cubes are visited in the same order as by MarchCubePlane, so the meshes are
+// identical.
+template <class Label, class MapLabel, class GetMesh>
+void MeshBoundaryCubes(const Label* labels, const Vector3d& strides,
+                       const BoundaryCubeBitmap& bitmap, int64_t z_begin,
+                       int64_t z_end, MapLabel map_label, GetMesh get_mesh) {
+  const Vector3d& num_cubes = bitmap.num_cubes();
+  voxel_mesh_generator::VertexPositionMap map(
+      Vector3d{num_cubes[0] + 1, num_cubes[1] + 1, z_end - z_begin + 1});
+  voxel_mesh_generator::SequentialVertexMap vertex_map(map);
+  const ptrdiff_t x_stride = strides[0];
+  for (int64_t z = z_begin; z < z_end; ++z) {
+    const Label* labels_z = labels + (z - z_begin) * strides[2];
+    for (int64_t y = 0; y < num_cubes[1]; ++y) {
+      const Label* r0 = labels_z + y * strides[1];
+      const Label* r1 = r0 + strides[1];
+      const Label* r2 = r0 + strides[2];
+      const Label* r3 = r1 + strides[2];
+      const uint64_t* words = bitmap.row(y, z);
+      for (int64_t w = 0; w < bitmap.words_per_row(); ++w) {
+        for (uint64_t bits = words[w]; bits; bits &= bits - 1) {
+          const int64_t x = 64 * w + LowestSetBit(bits);
+          const ptrdiff_t a = x * x_stride;
+          const ptrdiff_t b = a + x_stride;
+          const std::array<uint64_t, 8> label_at_corners = {
+              {map_label(r0[a]), map_label(r0[b]), map_label(r1[b]),
+               map_label(r1[a]), map_label(r2[a]), map_label(r2[b]),
+               map_label(r3[b]), map_label(r3[a])}};
+          AddCubeLabels(Vector3d{x, y, z - z_begin}, label_at_corners, map,
+                        &vertex_map, get_mesh);
+        }
+      }
+    }
+  }
+}
+
+// Counts memory in MeshingProgress::working_bytes, if `progress` is not null,
+// until it is released or the counter is destroyed.
+class ScopedWorkingBytes {
+ public:
+  explicit ScopedWorkingBytes(MeshingProgress* progress)
+      : progress_(progress) {}
+  ~ScopedWorkingBytes() { Add(-num_bytes_); }
+
+  void Add(int64_t num_bytes) {
+    if (!progress_ || num_bytes == 0) return;
+    num_bytes_ += num_bytes;
+    progress_->working_bytes.Add(num_bytes);
+  }
+
+ private:
+  MeshingProgress* progress_;
+  std::atomic<int64_t> num_bytes_{0};
+};
+
+// Divides the planes of cubes of `bitmap` into `num_slabs` slabs, each
+// containing about the same number of boundary cubes, and returns the first
+// plane of each slab followed by the number of planes.  Every slab is at least
+// one plane thick.
+std::vector<int64_t> BalanceSlabs(const BoundaryCubeBitmap& bitmap,
+                                  int64_t num_slabs) {
+  const auto& plane_counts = bitmap.plane_counts();
+  const int64_t num_planes = plane_counts.size();
+  int64_t total = 0;
+  for (const int64_t count : plane_counts) total += count;
+  std::vector<int64_t> slab_start(num_slabs + 1);
+  slab_start[num_slabs] = num_planes;
+  int64_t z = 0, prefix = 0;
+  for (int64_t slab = 1; slab < num_slabs; ++slab) {
+    // Planes must remain for the remaining slabs.
+    const int64_t max_z = num_planes - (num_slabs - slab);
+    const int64_t target = total * slab / num_slabs;
+    while (z < max_z && (z <= slab_start[slab - 1] || prefix < target)) {
+      prefix += plane_counts[z++];
+    }
+    slab_start[slab] = z;
+  }
+  return slab_start;
+}
+
+}  // namespace
+
+template <class Label>
+void MeshObjects(const Label* labels, const Vector3d& size,
+                 const Vector3d& strides, const DenseLabelMap& label_map,
+                 std::vector<TriangleMesh>* output, int num_threads,
+                 const LabelEquivalences* equivalences,
+                 std::vector<uint64_t>* boundary_cube_counts,
+                 MeshingEngine engine, MeshingProgress* progress) {
+  trace_events::Span span("MeshObjects", "voxels",
+                          size[0] * size[1] * size[2]);
+  output->clear();
+  output->resize(label_map.size());
+  if (boundary_cube_counts) {
+    boundary_cube_counts->assign(label_map.size(), 0);
+  }
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const int64_t num_cube_z = std::max(int64_t(0), size[2] - 1);
+  // Reports all objects as done once the whole volume has been marched.
+  const auto finish = [&] {
+    if (!progress) return;
+    progress->marched_planes = num_cube_z;
+    if (progress->object_done) {
+      ParallelFor(label_map.size(), num_threads, progress->object_done);
+    }
+  };
+  if (progress && progress->cancelled) {
+    return;
+  }
+  if (size[0] * size[1] * size[2] == 0) {
+    finish();
+    return;
+  }
+  if (engine == MeshingEngine::kFlyingEdges) {
+    if (equivalences && !equivalences->empty()) {
+      MeshObjectsFlyingEdges(labels, size, strides, label_map,
+                             EquivalentLabelMapper(*equivalences), num_threads,
+                             output, boundary_cube_counts);
+    } else {
+      MeshObjectsFlyingEdges(labels, size, strides, label_map,
+                             IdentityLabelMapper(), num_threads, output,
+                             boundary_cube_counts);
+    }
+    finish();
+    return;
+  }
+
+  // Each thread marches over its own z slab of cubes.  Adjacent slabs share
+  // one z plane of voxels.  The number of slabs is limited so that they are on
+  // average at least kMinSlabCubes thick, since more slabs cost more to merge
+  // than they save.
+  constexpr int64_t kMinSlabCubes = 16;
+  const bool merge_early = progress && progress->bounding_boxes;
+  const int64_t num_slabs = std::max(
+      int64_t(1), std::min<int64_t>(num_threads * (merge_early ? 4 : 1),
+                                    num_cube_z / kMinSlabCubes));
+  // Any memory still counted is released on return.
+  ScopedWorkingBytes working_bytes(progress);
+  if (num_slabs == 1) {
+    working_bytes.Add(
+        voxel_mesh_generator::SequentialVertexMap::GetNumBytes(size));
+    MeshRegion(labels, size, strides, equivalences,
+               DenseMeshGetter(label_map, output, boundary_cube_counts));
+    finish();
+    return;
+  }
+  std::vector<std::vector<TriangleMesh>> slab_meshes(num_slabs);
+  // Boundary cube counts of each slab, since slabs share no cubes.
+  std::vector<std::vector<uint64_t>> slab_cube_counts(
+      boundary_cube_counts ? num_slabs : 0);
+  // A pre-pass over the volume, which is evenly divided among the threads,
+  // finds the boundary cubes, by which the slabs are then balanced.
+  std::unique_ptr<BoundaryCubeBitmap> bitmap;
+  std::vector<int64_t> slab_start;
+  {
+    trace_events::Span bitmap_span("MeshObjects.bitmap", "cube_planes",
+                                   num_cube_z);
+    bitmap.reset(new BoundaryCubeBitmap(
+        labels, strides, Vector3d{size[0] - 1, size[1] - 1, num_cube_z},
+        num_threads));
+    working_bytes.Add(bitmap->num_bytes());
+    slab_start = BalanceSlabs(*bitmap, num_slabs);
+  }
+
+  // Merges the fragments and counts of an object from slabs [start, end).
+  const auto merge = [&](size_t object_i, int64_t start, int64_t end) {
+    MeshFragmentMerger merger(&(*output)[object_i]);
+    for (int64_t slab = start; slab < end; ++slab) {
+      if (boundary_cube_counts) {
+        (*boundary_cube_counts)[object_i] += slab_cube_counts[slab][object_i];
+      }
+      auto& fragment = slab_meshes[slab][object_i];
+      if (fragment.triangles.empty()) continue;
+      merger.Append(fragment, Vector3d{0, 0, slab_start[slab]},
+                    Vector3d{size[0], size[1],
+                             slab_start[slab + 1] - slab_start[slab] + 1});
+      // Release the fragment as soon as it has been merged.
+      working_bytes.Add(-static_cast<int64_t>(fragment.num_retained_bytes()));
+      fragment = TriangleMesh();
+    }
+  };
+
+  // If merging early, the range of slabs containing the cubes of each object,
+  // and the number of those slabs not yet marched, guarded by `merge_mutex`.
+  std::vector<std::pair<int64_t, int64_t>> object_slabs;
+  std::vector<int64_t> remaining_slabs;
+  std::mutex merge_mutex;
+  if (merge_early) {
+    const auto& boxes = *progress->bounding_boxes;
+    const auto find_slab = [&](int64_t cube_z) {
+      cube_z = std::min(std::max(cube_z, int64_t(0)), num_cube_z - 1);
+      return std::upper_bound(slab_start.begin(), slab_start.end(), cube_z) -
+             slab_start.begin() - 1;
+    };
+    object_slabs.resize(label_map.size());
+    remaining_slabs.resize(label_map.size());
+    for (size_t object_i = 0; object_i < label_map.size(); ++object_i) {
+      const auto& box = boxes[object_i];
+      // The cubes containing voxel plane z are z - 1 and z.
+      auto& slabs = object_slabs[object_i];
+      slabs.first = find_slab(box.start[2] - 1);
+      slabs.second = find_slab(box.end[2] - 1) + 1;
+      remaining_slabs[object_i] =
+          std::max(int64_t(0), slabs.second - slabs.first);
+    }
+  }
+
+  ParallelFor(num_slabs, num_threads, [&](size_t slab) {
+    if (progress && progress->cancelled) return;
+    trace_events::Span slab_span("MeshObjects.slab", "cube_planes",
+                                 slab_start[slab + 1] - slab_start[slab]);
+    auto& cur_meshes = slab_meshes[slab];
+    cur_meshes.resize(label_map.size());
+    std::vector<uint64_t>* cur_cube_counts = nullptr;
+    if (boundary_cube_counts) {
+      cur_cube_counts = &slab_cube_counts[slab];
+      cur_cube_counts->resize(label_map.size());
+    }
+    const int64_t vertex_map_bytes =
+        voxel_mesh_generator::SequentialVertexMap::GetNumBytes(size);
+    working_bytes.Add(
+        vertex_map_bytes +
+        label_map.size() * (sizeof(TriangleMesh) +
+                            (cur_cube_counts ? sizeof(uint64_t) : 0)));
+    const Label* slab_labels = labels + slab_start[slab] * strides[2];
+    DenseMeshGetter get_mesh(label_map, &cur_meshes, cur_cube_counts);
+    if (equivalences && !equivalences->empty()) {
+      MeshBoundaryCubes(slab_labels, strides, *bitmap, slab_start[slab],
+                        slab_start[slab + 1],
+                        EquivalentLabelMapper(*equivalences), get_mesh);
+    } else {
+      MeshBoundaryCubes(slab_labels, strides, *bitmap, slab_start[slab],
+                        slab_start[slab + 1], IdentityLabelMapper(), get_mesh);
+    }
+    int64_t fragment_bytes = 0;
+    for (const auto& fragment : cur_meshes) {
+      fragment_bytes += fragment.num_retained_bytes();
+    }
+    working_bytes.Add(fragment_bytes - vertex_map_bytes);
+    if (progress) {
+      progress->marched_planes += slab_start[slab + 1] - slab_start[slab];
+    }
+    if (!merge_early) return;
+    std::vector<size_t> done_objects;
+    {
+      std::lock_guard<std::mutex> lock(merge_mutex);
+      for (size_t object_i = 0; object_i < label_map.size(); ++object_i) {
+        const auto& slabs = object_slabs[object_i];
+        if (static_cast<int64_t>(slab) >= slabs.first &&
+            static_cast<int64_t>(slab) < slabs.second &&
+            --remaining_slabs[object_i] == 0) {
+          done_objects.push_back(object_i);
+        }
+      }
+    }
+    // The slabs that contain these objects are done, and no other slab
+    // touches their fragments.
+    for (const size_t object_i : done_objects) {
+      if (progress->cancelled) return;
+      const auto& slabs = object_slabs[object_i];
+      merge(object_i, slabs.first, slabs.second);
+      if (progress->object_done) progress->object_done(object_i);
     }
-    corner_label_offset[i] = offset;
+  });
+  working_bytes.Add(-static_cast<int64_t>(bitmap->num_bytes()));
+  bitmap.reset();
+  if (progress && progress->cancelled) return;
+  if (merge_early) {
+    // Objects without voxels have no slabs.
+    for (size_t object_i = 0; object_i < label_map.size(); ++object_i) {
+      if (object_slabs[object_i].second <= object_slabs[object_i].first &&
+          progress->object_done) {
+        progress->object_done(object_i);
+      }
+    }
+    return;
+  }
+
+  {
+    // Merge the per-slab fragments of each object.
+    trace_events::Span merge_span("MeshObjects.merge", "objects",
+                                  label_map.size());
+    ParallelFor(label_map.size(), num_threads,
+                [&](size_t object_i) { merge(object_i, 0, num_slabs); });
   }
+  finish();
+}
 
+template <class Label>
+void MeshObjects(const Label* labels, const Vector3d& size,
+                 const Vector3d& strides,
+                 std::unordered_map<uint64_t, TriangleMesh>* output,
+                 int num_threads, const LabelEquivalences* equivalences,
+                 const std::vector<uint64_t>* allowed_ids,
+                 MeshingEngine engine) {
   output->clear();
+  std::vector<uint64_t> ids = ComputeDistinctLabels(labels, size, strides);
+  if (equivalences) ids = ComputeObjectIds(ids, *equivalences);
+  if (allowed_ids) {
+    std::vector<uint64_t> all_ids = std::move(ids);
+    ids.clear();
+    std::set_intersection(all_ids.begin(), all_ids.end(),
+                          allowed_ids->begin(), allowed_ids->end(),
+                          std::back_inserter(ids));
+  }
+  DenseLabelMap label_map(std::move(ids));
+  std::vector<TriangleMesh> meshes;
+  MeshObjects(labels, size, strides, label_map, &meshes, num_threads,
+              equivalences, /*boundary_cube_counts=*/nullptr, engine);
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    if (meshes[i].triangles.empty()) continue;
+    output->emplace(label_map.ids()[i], std::move(meshes[i]));
+  }
+}
 
-#ifdef USE_OMP
-#pragma omp parallel
-#endif
+template <class Label>
+void MeshObjectsChunked(const ReadLabelsFunction<Label>& read_labels,
+                        const Vector3d& size, const Vector3d& block_size,
+                        std::unordered_map<uint64_t, TriangleMesh>* output,
+                        int num_threads,
+                        const LabelEquivalences* equivalences,
+                        const std::vector<uint64_t>* allowed_ids) {
+  output->clear();
+  for (int i = 0; i < 3; ++i) {
+    if (size[i] == 0) return;
+  }
+  std::unordered_map<uint64_t, MeshFragmentMerger> mergers;
+  std::unordered_map<uint64_t, TriangleMesh> block_meshes;
+  std::vector<Label> block_labels;
+  Vector3d grid_size;
+  for (int i = 0; i < 3; ++i) {
+    // There are size - 1 cubes along each dimension.
+    grid_size[i] = std::max(int64_t(1), (size[i] - 1 + block_size[i] - 1) /
+                                            block_size[i]);
+  }
+  Vector3d block;
+  for (block[2] = 0; block[2] < grid_size[2]; ++block[2]) {
+    for (block[1] = 0; block[1] < grid_size[1]; ++block[1]) {
+      for (block[0] = 0; block[0] < grid_size[0]; ++block[0]) {
+        BoundingBox box;
+        Vector3d region_size;
+        for (int i = 0; i < 3; ++i) {
+          box.start[i] = block[i] * block_size[i];
+          // Include one extra voxel to overlap the next block.
+          box.end[i] = std::min(box.start[i] + block_size[i] + 1, size[i]);
+          region_size[i] = box.end[i] - box.start[i];
+        }
+        block_labels.resize(region_size[0] * region_size[1] * region_size[2]);
+        read_labels(box, block_labels.data());
+        MeshObjects(block_labels.data(), region_size,
+                    Vector3d{1, region_size[0],
+                             region_size[0] * region_size[1]},
+                    &block_meshes, num_threads, equivalences, allowed_ids);
+        for (auto& p : block_meshes) {
+          auto it = mergers.find(p.first);
+          if (it == mergers.end()) {
+            it = mergers
+                     .emplace(p.first,
+                              MeshFragmentMerger(&(*output)[p.first]))
+                     .first;
+          }
+          it->second.Append(p.second, box.start, region_size);
+        }
+      }
+    }
+  }
+}
+
+template <class Label>
+bool MeshCompressedChannel(const uint32_t* input, size_t input_size,
+                           const Vector3d& size, const Vector3d& block_size,
+                           std::unordered_map<uint64_t, TriangleMesh>* output) {
+  output->clear();
+  ptrdiff_t volume_size[3], compressed_block_size[3], grid_size[3];
+  for (int i = 0; i < 3; ++i) {
+    // There are no cubes unless there are at least 2 voxels along each
+    // dimension.
+    if (size[i] < 2) return true;
+    volume_size[i] = size[i];
+    compressed_block_size[i] = block_size[i];
+    grid_size[i] = (size[i] + block_size[i] - 1) / block_size[i];
+  }
+
+  // Whether all blocks of each z layer of blocks are encoded with 0 bits and
+  // the same value, and that value.
+  std::vector<char> layer_uniform(grid_size[2], 1);
+  std::vector<Label> layer_values(grid_size[2]);
   {
-#ifdef USE_OMP
-    uint64_t num_threads = omp_get_num_threads();
-    uint64_t thread_num = omp_get_thread_num();
-#endif
-    std::unordered_map<uint64_t, TriangleMesh> cur_meshes;
-
-    voxel_mesh_generator::SequentialVertexMap vertex_map(map);
-
-    auto const* labels_z = labels;
-    for (int64_t z = 0; z < adjusted_size[2]; ++z, labels_z += strides[2]) {
-      auto const* labels_y = labels_z;
-      for (int64_t y = 0; y < adjusted_size[1]; ++y, labels_y += strides[1]) {
-        auto const* labels_x = labels_y;
-        for (int64_t x = 0; x < adjusted_size[0]; ++x, labels_x += strides[0]) {
-          // We need to call AddCube once per distinct non-zero label
-          // contained within the 2x2x2 voxel region.  This thread will only
-          // handle labels equivalent to thread_num (mod num_threads).
-          std::array<uint64_t, 8> label_at_corners;
-          label_at_corners[0] = labels_x[corner_label_offset[0]];
-          bool not_all_same = false;
-          for (int i = 1; i < 8; ++i) {
-            auto label = label_at_corners[i] = labels_x[corner_label_offset[i]];
-            if (label != label_at_corners[0]) {
-              not_all_same = true;
-            }
+    ptrdiff_t block[3];
+    for (block[2] = 0; block[2] < grid_size[2]; ++block[2]) {
+      for (block[1] = 0; block[1] < grid_size[1]; ++block[1]) {
+        for (block[0] = 0; block[0] < grid_size[0]; ++block[0]) {
+          bool uniform;
+          Label value = 0;
+          if (!compress_segmentation::ReadUniformBlockValue(
+                  input, input_size, volume_size, compressed_block_size, block,
+                  &uniform, &value)) {
+            return false;
           }
-          if (!not_all_same) {
-            continue;
+          if (block[0] == 0 && block[1] == 0) {
+            layer_values[block[2]] = value;
           }
-          for (int i = 0; i < 8; ++i) {
-            const auto label_i = label_at_corners[i];
-            // Skip label 0 (background component).
-            // Also skip objects not assigned to this thread.
-            if (label_i != 0
-#ifdef USE_OMP
-                && label_i % num_threads == thread_num
-#endif
-                ) {
-              // Determine if this label occurred at a prior corner index, in
-              // which case we don't need to process it again.
-              bool label_already_seen = false;
-              for (int j = 0; j < i; ++j) {
-                if (label_at_corners[j] == label_i) {
-                  label_already_seen = true;
-                  break;
-                }
-              }
-              if (!label_already_seen) {
-                uint8_t corners_present = 0;
-                for (int j = i; j < 8; ++j) {
-                  if (label_at_corners[j] == label_i) {
-                    corners_present |= (1 << j);
-                  }
-                }
-                voxel_mesh_generator::AddCube(Vector3d{x, y, z},
-                                              corners_present, map, &vertex_map,
-                                              &cur_meshes[label_i]);
-              }
-            }
+          if (!uniform || value != layer_values[block[2]]) {
+            layer_uniform[block[2]] = 0;
           }
         }
       }
     }
+  }
 
-#ifdef USE_OMP
-#pragma omp critical
-#endif
-    {
-      for (auto& p : cur_meshes) {
-        output->emplace(p.first, std::move(p.second));
+  // The two voxel planes of the current plane of cubes are decoded into
+  // alternating halves of `planes`.
+  const ptrdiff_t plane_size = size[0] * size[1];
+  std::vector<Label> planes(2 * plane_size);
+  int64_t decoded_z[2] = {-1, -1};
+  const auto decode_plane = [&](int64_t z) {
+    const int64_t half = z & 1;
+    if (decoded_z[half] == z) return true;
+    const ptrdiff_t start[3] = {0, 0, z};
+    const ptrdiff_t end[3] = {volume_size[0], volume_size[1], z + 1};
+    const ptrdiff_t strides[3] = {1, volume_size[0], plane_size};
+    if (!compress_segmentation::DecompressChannel(
+            input, input_size, volume_size, compressed_block_size, start, end,
+            strides, planes.data() + half * plane_size)) {
+      return false;
+    }
+    decoded_z[half] = z;
+    return true;
+  };
+
+  voxel_mesh_generator::VertexPositionMap map(size);
+  voxel_mesh_generator::SequentialVertexMap vertex_map(map);
+  // Successive calls usually request the same label, so the last lookup is
+  // cached.  Pointers to the elements of an unordered_map remain valid as it
+  // grows.
+  uint64_t cached_label = 0;
+  TriangleMesh* cached_mesh = nullptr;
+  const auto get_mesh = [&](uint64_t label) {
+    if (label != cached_label) {
+      cached_label = label;
+      cached_mesh = &(*output)[label];
+    }
+    return cached_mesh;
+  };
+
+  IdentityLabelMapper map_label;
+  const Vector3d num_cubes{size[0] - 1, size[1] - 1, size[2] - 1};
+  for (int64_t z = 0; z < num_cubes[2]; ++z) {
+    // The cubes are all uniform if both voxel planes lie in layers of blocks
+    // with the same single value.
+    const int64_t layer = z / block_size[2];
+    const int64_t next_layer = (z + 1) / block_size[2];
+    if (layer_uniform[layer] && layer_uniform[next_layer] &&
+        layer_values[layer] == layer_values[next_layer]) {
+      continue;
+    }
+    if (!decode_plane(z) || !decode_plane(z + 1)) return false;
+    // The z stride alternates in sign, since plane z + 1 is in the other
+    // half of `planes`.
+    const ptrdiff_t z_stride = (z & 1) ? -plane_size : plane_size;
+    MarchCubePlane<true>(planes.data() + (z & 1) * plane_size,
+                         Vector3d{1, size[0], z_stride}, num_cubes, z, map,
+                         &vertex_map, map_label, get_mesh);
+  }
+  return true;
+}
+
+template <class Label>
+std::vector<uint64_t> ComputeDistinctLabels(const Label* labels,
+                                            const Vector3d& size,
+                                            const Vector3d& strides) {
+  std::vector<uint64_t> ids;
+  // Number of elements of `ids` known to be sorted and unique.
+  size_t num_unique = 0;
+  const auto compact = [&] {
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    num_unique = ids.size();
+  };
+  Label previous_label = 0;
+  auto const* labels_z = labels;
+  for (int64_t z = 0; z < size[2]; ++z, labels_z += strides[2]) {
+    auto const* labels_y = labels_z;
+    for (int64_t y = 0; y < size[1]; ++y, labels_y += strides[1]) {
+      auto const* labels_x = labels_y;
+      for (int64_t x = 0; x < size[0]; ++x, labels_x += strides[0]) {
+        const Label label = *labels_x;
+        // Only record the first label of each run.
+        if (label == previous_label) continue;
+        previous_label = label;
+        if (label == 0) continue;
+        ids.push_back(label);
+        // Bound the memory used by duplicates.
+        if (ids.size() >= 2 * num_unique + 4096) compact();
+      }
+    }
+  }
+  compact();
+  ids.shrink_to_fit();
+  return ids;
+}
+
+template <class Label>
+void CopyLabelsXFastest(const Label* labels, const Vector3d& size,
+                        const Vector3d& strides, Label* output,
+                        int num_threads) {
+  // A tile of 16^3 voxels reads at most 256 runs of 16 labels along each
+  // dimension, which fit in the L1 cache together with the output rows.
+  constexpr int64_t kTileSize = 16;
+  int64_t num_tiles[3];
+  for (int i = 0; i < 3; ++i) {
+    num_tiles[i] = (size[i] + kTileSize - 1) / kTileSize;
+  }
+  // Tiles are claimed in output order, so that concurrent threads write
+  // nearby rows.
+  ParallelFor(num_tiles[0] * num_tiles[1] * num_tiles[2], num_threads,
+              [&](size_t tile_index) {
+    int64_t start[3], end[3];
+    int64_t remaining = static_cast<int64_t>(tile_index);
+    for (int i = 0; i < 3; ++i) {
+      start[i] = (remaining % num_tiles[i]) * kTileSize;
+      end[i] = std::min(start[i] + kTileSize, size[i]);
+      remaining /= num_tiles[i];
+    }
+    for (int64_t z = start[2]; z < end[2]; ++z) {
+      for (int64_t y = start[1]; y < end[1]; ++y) {
+        const Label* input =
+            labels + z * strides[2] + y * strides[1] + start[0] * strides[0];
+        Label* out = output + (z * size[1] + y) * size[0] + start[0];
+        for (int64_t x = start[0]; x < end[0]; ++x, input += strides[0]) {
+          *(out++) = *input;
+        }
+      }
+    }
+  });
+}
+
+template <class Label>
+void ComputeBoundingBoxes(const Label* labels, const Vector3d& size,
+                          const Vector3d& strides,
+                          const DenseLabelMap& label_map,
+                          std::vector<BoundingBox>* output,
+                          std::vector<uint64_t>* voxel_counts) {
+  // Initialize to empty boxes.
+  output->assign(
+      label_map.size(),
+      BoundingBox{{size[0], size[1], size[2]}, {0, 0, 0}});
+  if (voxel_counts) voxel_counts->assign(label_map.size(), 0);
+  auto const* labels_z = labels;
+  for (int64_t z = 0; z < size[2]; ++z, labels_z += strides[2]) {
+    auto const* labels_y = labels_z;
+    for (int64_t y = 0; y < size[1]; ++y, labels_y += strides[1]) {
+      auto const* labels_x = labels_y;
+      int64_t x = 0;
+      while (x < size[0]) {
+        // Process a run of identical labels with a single lookup.
+        const Label label = *labels_x;
+        const int64_t run_start = x;
+        do {
+          ++x;
+          labels_x += strides[0];
+        } while (x < size[0] && *labels_x == label);
+        if (label == 0) continue;
+        const int64_t index = label_map.Find(label);
+        if (voxel_counts) (*voxel_counts)[index] += x - run_start;
+        auto& box = (*output)[index];
+        const Vector3d run_begin{run_start, y, z};
+        const Vector3d run_end{x, y + 1, z + 1};
+        for (int i = 0; i < 3; ++i) {
+          box.start[i] = std::min(box.start[i], run_begin[i]);
+          box.end[i] = std::max(box.end[i], run_end[i]);
+        }
       }
     }
   }
 }
 
-#define DO_INSTANTIATE(Label)                                             \
-  template void MeshObjects<Label>(                                       \
-      const Label* labels, const Vector3d& size, const Vector3d& strides, \
-      std::unordered_map<uint64_t, TriangleMesh>* output);                \
+template <class Label>
+void MeshObject(const Label* labels, const Vector3d& size,
+                const Vector3d& strides, uint64_t object_id,
+                const BoundingBox& bounding_box, TriangleMesh* output,
+                const LabelEquivalences* equivalences) {
+  output->clear();
+  // Every cube containing a voxel of the object lies within the bounding box
+  // expanded by one voxel.
+  Vector3d region_start, region_size;
+  ptrdiff_t offset = 0;
+  for (int i = 0; i < 3; ++i) {
+    region_start[i] = std::max(bounding_box.start[i] - 1, int64_t(0));
+    region_size[i] =
+        std::min(bounding_box.end[i] + 1, size[i]) - region_start[i];
+    if (region_size[i] <= 0) return;
+    offset += region_start[i] * strides[i];
+  }
+  MeshRegion(labels + offset, region_size, strides, equivalences,
+             [&](uint64_t id) -> TriangleMesh* {
+               return id == object_id ? output : nullptr;
+             });
+  for (auto& vertex : output->vertex_positions) {
+    for (int i = 0; i < 3; ++i) {
+      vertex[i] += static_cast<float>(region_start[i]);
+    }
+  }
+}
+
+#define DO_INSTANTIATE(Label)                                               \
+  template std::vector<uint64_t> ComputeDistinctLabels<Label>(              \
+      const Label* labels, const Vector3d& size, const Vector3d& strides);  \
+  template void CopyLabelsXFastest<Label>(                                  \
+      const Label* labels, const Vector3d& size, const Vector3d& strides,   \
+      Label* output, int num_threads);                                      \
+  template void MeshObjects<Label>(                                         \
+      const Label* labels, const Vector3d& size, const Vector3d& strides,   \
+      std::unordered_map<uint64_t, TriangleMesh>* output, int num_threads,  \
+      const LabelEquivalences* equivalences,                                \
+      const std::vector<uint64_t>* allowed_ids, MeshingEngine engine);      \
+  template void MeshObjects<Label>(                                         \
+      const Label* labels, const Vector3d& size, const Vector3d& strides,   \
+      const DenseLabelMap& label_map, std::vector<TriangleMesh>* output,    \
+      int num_threads, const LabelEquivalences* equivalences,               \
+      std::vector<uint64_t>* boundary_cube_counts, MeshingEngine engine,    \
+      MeshingProgress* progress);                                           \
+  template void MeshObjectsChunked<Label>(                                  \
+      const ReadLabelsFunction<Label>& read_labels, const Vector3d& size,   \
+      const Vector3d& block_size,                                           \
+      std::unordered_map<uint64_t, TriangleMesh>* output, int num_threads,  \
+      const LabelEquivalences* equivalences,                                \
+      const std::vector<uint64_t>* allowed_ids);                            \
+  template void ComputeBoundingBoxes<Label>(                                \
+      const Label* labels, const Vector3d& size, const Vector3d& strides,   \
+      const DenseLabelMap& label_map, std::vector<BoundingBox>* output,     \
+      std::vector<uint64_t>* voxel_counts);                                 \
+  template void MeshObject<Label>(                                          \
+      const Label* labels, const Vector3d& size, const Vector3d& strides,   \
+      uint64_t object_id, const BoundingBox& bounding_box,                  \
+      TriangleMesh* output, const LabelEquivalences* equivalences);         \
 /**/
 DO_INSTANTIATE(uint8_t)
 DO_INSTANTIATE(uint16_t)
@@ -143,5 +1675,15 @@ DO_INSTANTIATE(uint32_t)
 DO_INSTANTIATE(uint64_t)
 #undef DO_INSTANTIATE
 
+#define DO_INSTANTIATE(Label)                                               \
+  template bool MeshCompressedChannel<Label>(                               \
+      const uint32_t* input, size_t input_size, const Vector3d& size,       \
+      const Vector3d& block_size,                                           \
+      std::unordered_map<uint64_t, TriangleMesh>* output);                  \
+/**/
+DO_INSTANTIATE(uint32_t)
+DO_INSTANTIATE(uint64_t)
+#undef DO_INSTANTIATE
+
 }  // namespace meshing
 }  // namespace neuroglancer
@@ -17,20 +17,368 @@
 #ifndef NEUROGLANCER_MESH_OBJECTS_H_
 #define NEUROGLANCER_MESH_OBJECTS_H_
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "voxel_mesh_generator.h"
 
 namespace neuroglancer {
 namespace meshing {
 
+// Half-open box [start, end) of voxel positions.
+struct BoundingBox {
+  Vector3d start;
+  Vector3d end;
+};
+
+// Maps a sorted set of object ids to dense indices in [0, size()).
+class DenseLabelMap {
+ public:
+  DenseLabelMap() = default;
+
+  // `ids` must be sorted and must not contain duplicates.
+  explicit DenseLabelMap(std::vector<uint64_t> ids);
+
+  const std::vector<uint64_t>& ids() const { return ids_; }
+  size_t size() const { return ids_.size(); }
+
+  size_t num_bytes() const {
+    return ids_.capacity() * sizeof(uint64_t) +
+           direct_index_.capacity() * sizeof(int32_t);
+  }
+
+  // Returns the dense index of `id`, or -1 if `id` is not in the map.
+  int64_t Find(uint64_t id) const {
+    if (id < direct_index_.size()) return direct_index_[id];
+    auto it = std::lower_bound(ids_.begin(), ids_.end(), id);
+    if (it == ids_.end() || *it != id) return -1;
+    return it - ids_.begin();
+  }
+
+ private:
+  std::vector<uint64_t> ids_;
+  // Lookup table indexed directly by id, used for the ids less than 2^16,
+  // which includes all uint8 and uint16 labels.
+  std::vector<int32_t> direct_index_;
+};
+
+// Maps labels to the ids of the objects they belong to, so that agglomerated
+// segments can be meshed without relabeling the volume.  Labels that are not
+// in the map belong to the object with the same id, and label 0 is always
+// background.
+class LabelEquivalences {
+ public:
+  LabelEquivalences() = default;
+
+  // Each element of `pairs` maps a label to an object id.  The labels must be
+  // distinct.  Pairs with label 0 are ignored, and labels mapped to object 0
+  // are treated as background.
+  explicit LabelEquivalences(std::vector<std::pair<uint64_t, uint64_t>> pairs);
+
+  bool empty() const { return labels_.empty(); }
+
+  // Sorted labels that are mapped, and the object id of each.
+  const std::vector<uint64_t>& labels() const { return labels_; }
+  const std::vector<uint64_t>& object_ids() const { return object_ids_; }
+
+  // Returns the id of the object to which `label` belongs.
+  uint64_t Find(uint64_t label) const {
+    auto it = std::lower_bound(labels_.begin(), labels_.end(), label);
+    if (it == labels_.end() || *it != label) return label;
+    return object_ids_[it - labels_.begin()];
+  }
+
+ private:
+  // Sorted labels, and the object id of each.
+  std::vector<uint64_t> labels_;
+  std::vector<uint64_t> object_ids_;
+};
+
+// Returns the sorted list of distinct non-zero object ids of `labels`.
+std::vector<uint64_t> ComputeObjectIds(const std::vector<uint64_t>& labels,
+                                       const LabelEquivalences& equivalences);
+
+// Returns the sorted list of distinct non-zero labels.
+//
+// Label must be one of uint8_t, uint16_t, uint32_t, uint64_t.
+template <class Label>
+std::vector<uint64_t> ComputeDistinctLabels(const Label* labels,
+                                            const Vector3d& size,
+                                            const Vector3d& strides);
+
+// Copies the labels of a volume of the specified `size` and `strides` into
+// `output`, which has room for exactly the number of voxels, stored with x
+// varying fastest and then y, i.e. with strides {1, size[0], size[0] *
+// size[1]}.  MeshObjects is fastest with that layout, whereas an array whose
+// x stride is the largest, e.g. the transpose of a C-order array, costs a
+// cache miss per voxel.
+//
+// The volume is copied in cubic tiles, which are small enough that the cache
+// lines of a tile are read only once whatever the order of `strides`, and the
+// tiles are distributed among up to `num_threads` threads, or the number of
+// hardware threads if 0.
+//
+// Label must be one of uint8_t, uint16_t, uint32_t, uint64_t.
+template <class Label>
+void CopyLabelsXFastest(const Label* labels, const Vector3d& size,
+                        const Vector3d& strides, Label* output,
+                        int num_threads = 1);
+
+// Merges mesh fragments of a single object, computed independently over
+// adjacent regions of a volume, into a single mesh.
+//
+// Vertices on the faces shared by adjacent regions are produced by both
+// fragments; they are identified by position and emitted only once.
+class MeshFragmentMerger {
+ public:
+  explicit MeshFragmentMerger(TriangleMesh* output) : output_(output) {}
+
+  // Appends `fragment`, computed over the region of `region_size` voxels with
+  // origin at `region_start`.  Vertex positions of `fragment` are relative to
+  // `region_start`.
+  void Append(const TriangleMesh& fragment, const Vector3d& region_start,
+              const Vector3d& region_size);
+
+ private:
+  TriangleMesh* output_;
+  // Maps the position of each vertex on a region boundary to its index in
+  // `output_`.
+  voxel_mesh_generator::VertexIndexHashMap boundary_vertices_;
+};
+
+// Immutable copy of a mesh computed by marching cubes, for retaining many such
+// meshes in memory until they are needed.
+//
+// Vertex positions, which are multiples of 0.5, are stored as integer offsets
+// in half voxels from the minimum position of the mesh, with 16 bits per
+// coordinate if they fit and 32 bits otherwise, and vertex indices are stored
+// with 16 bits if there are at most 65536 vertices.  Both are stored in a
+// single allocation of exactly the required size, so that, unlike the growing
+// vectors of a TriangleMesh, there is no unused capacity.  Decoding reproduces
+// the original mesh exactly.
+class CompactTriangleMesh {
+ public:
+  CompactTriangleMesh() = default;
+  explicit CompactTriangleMesh(const TriangleMesh& mesh);
+
+  bool empty() const { return num_triangles_ == 0; }
+  size_t num_vertices() const { return num_vertices_; }
+  size_t num_triangles() const { return num_triangles_; }
+
+  // Memory used by the compact representation.
+  size_t num_bytes() const { return data_.size(); }
+
+  // Memory used by the equivalent TriangleMesh, excluding unused capacity.
+  size_t num_decoded_bytes() const {
+    return num_vertices_ * sizeof(float) * 3 +
+           num_triangles_ * sizeof(TriangleMesh::VertexIndex) * 3;
+  }
+
+  void Decode(TriangleMesh* mesh) const;
+
+ private:
+  // Size of the vertex positions, including padding.
+  size_t GetPositionBytes() const {
+    return (size_t(num_vertices_) * 3 * (wide_positions_ ? 4 : 2) + 3) / 4 * 4;
+  }
+
+  // Minimum vertex position, in half voxels.
+  std::array<int64_t, 3> origin_ = {{0, 0, 0}};
+  uint32_t num_vertices_ = 0;
+  uint32_t num_triangles_ = 0;
+  bool wide_positions_ = false;
+  bool wide_indices_ = false;
+  // Vertex positions, padded to a multiple of 4 bytes, followed by triangle
+  // vertex indices.
+  std::vector<uint8_t> data_;
+};
+
+// Algorithm used by MeshObjects to extract the surfaces.
+enum class MeshingEngine {
+  // Marching cubes over z slabs of the volume, processing each cube with
+  // AddCube; the per-slab fragments are then merged.
+  kMarchingCubes,
+  // Flying edges: a first pass classifies the x edges of each row of voxels,
+  // trims the rows to the cubes that are not uniform, and counts the vertices
+  // and triangles of each object in each row.  Prefix sums over the rows then
+  // assign each row disjoint ranges of the meshes, which are allocated once
+  // and filled in parallel by a second pass.  This scales with the number of
+  // threads regardless of the depth of the volume and requires no merging, at
+  // the cost of retaining the vertices of crossing edges between the passes.
+  kFlyingEdges,
+};
+
 // Computes a surface mesh for each non-zero label.
 //
+// If `equivalences` is not null, labels are first mapped to object ids, and a
+// single surface is computed for the union of the labels of each object, as if
+// the volume had been relabeled.
+//
+// If `allowed_ids` is not null, only the objects whose ids are in the sorted
+// vector `allowed_ids` are meshed.  Cubes containing only other objects then
+// cost just the comparison of their corner labels and one lookup, and no
+// memory is allocated for the surfaces of other objects.
+//
+// With `num_threads` other than 1, the volume is split into z slabs that are
+// meshed in parallel by up to `num_threads` threads, or the number of hardware
+// threads if 0, and the per-slab fragments are then merged.  The resultant
+// meshes are identical up to vertex and triangle order.  The same holds for
+// each `engine`, which with MeshingEngine::kFlyingEdges instead divides the
+// work among the threads by rows of voxels.
+//
 // Label must be one of uint8_t, uint16_t, uint32_t, uint64_t.
 template <class Label>
 void MeshObjects(const Label* labels, const Vector3d& size,
                  const Vector3d& strides,
-                 std::unordered_map<uint64_t, TriangleMesh>* output);
+                 std::unordered_map<uint64_t, TriangleMesh>* output,
+                 int num_threads = 1,
+                 const LabelEquivalences* equivalences = nullptr,
+                 const std::vector<uint64_t>* allowed_ids = nullptr,
+                 MeshingEngine engine = MeshingEngine::kMarchingCubes);
+
+// Number of bytes of memory currently in use for some purpose, and the peak of
+// that number, which may be updated concurrently.
+struct ByteCounter {
+  std::atomic<int64_t> bytes{0};
+  std::atomic<int64_t> peak_bytes{0};
+
+  // Adds `num_bytes`, which is negative once the memory is released.
+  void Add(int64_t num_bytes) {
+    const int64_t total = bytes += num_bytes;
+    int64_t peak = peak_bytes;
+    while (total > peak && !peak_bytes.compare_exchange_weak(peak, total)) {
+    }
+  }
+};
+
+// Progress of the dense MeshObjects below, through which other threads may
+// monitor and cancel it.
+struct MeshingProgress {
+  // Set by any thread to stop the march once the slabs in progress are done.
+  // The meshes not yet reported by `object_done` are then incomplete.
+  std::atomic<bool> cancelled{false};
+  // Number of z planes of cubes marched so far, out of `size[2] - 1`.
+  std::atomic<int64_t> marched_planes{0};
+  // If not null, the bounding boxes of the objects, stored densely.  The
+  // marching cubes engine then uses up to 4 slabs per thread, marched in
+  // increasing z order, and merges the mesh of each object as soon as the
+  // slabs that contain it are done, rather than once all slabs are.
+  const std::vector<BoundingBox>* bounding_boxes = nullptr;
+  // If set, called once the mesh and boundary cube count of the object with
+  // the specified dense index are complete, possibly concurrently by several
+  // threads.  Not called for the remaining objects once cancelled.
+  std::function<void(size_t index)> object_done;
+  // Memory used by the marching cubes engine in addition to the output meshes:
+  // the boundary cube bitmap, the vertex map of each slab being marched, and
+  // the slab fragments not yet merged.  Zero once the march is done.  Not
+  // counted by MeshingEngine::kFlyingEdges.
+  ByteCounter working_bytes;
+};
+
+// Same as above, but stores the mesh of each object densely: the mesh of
+// `label_map.ids()[i]` is stored in `(*output)[i]`.  Only the objects in
+// `label_map` are meshed, e.g. all objects as computed by ComputeDistinctLabels
+// and ComputeObjectIds.  Objects without any surface have an empty mesh.
+//
+// If `boundary_cube_counts` is not null, the number of boundary cubes of each
+// object, i.e. of 2x2x2 voxel cubes that contain both the object and some other
+// object or background, is stored densely in the same order.  These are counted
+// by the march itself, at the cost of one increment per boundary cube.
+//
+// If `progress` is not null, it is updated as the march proceeds.
+template <class Label>
+void MeshObjects(const Label* labels, const Vector3d& size,
+                 const Vector3d& strides, const DenseLabelMap& label_map,
+                 std::vector<TriangleMesh>* output, int num_threads = 1,
+                 const LabelEquivalences* equivalences = nullptr,
+                 std::vector<uint64_t>* boundary_cube_counts = nullptr,
+                 MeshingEngine engine = MeshingEngine::kMarchingCubes,
+                 MeshingProgress* progress = nullptr);
+
+// Returns the total area of the triangles of `mesh`, with the vertex positions
+// multiplied by `scale`, e.g. the voxel size.
+double ComputeSurfaceArea(const TriangleMesh& mesh, const float scale[3]);
+
+// Reads the labels within `box` into `labels`, which has room for exactly the
+// number of voxels in `box`, stored with x varying fastest and then y.
+template <class Label>
+using ReadLabelsFunction =
+    std::function<void(const BoundingBox& box, Label* labels)>;
+
+// Computes a surface mesh for each non-zero label of a volume that need not be
+// in memory, producing the same surfaces as MeshObjects.
+//
+// The volume is processed in blocks of `block_size` cubes.  The labels of each
+// block, which overlap the adjacent blocks by one voxel, are obtained from
+// `read_labels` and meshed independently; the per-block fragments of each
+// object are then merged by MeshFragmentMerger.  Peak memory is therefore
+// bounded by the block size plus the output meshes.  Each block is meshed with
+// `num_threads` threads, `equivalences` and `allowed_ids`, as by MeshObjects.
+//
+// Label must be one of uint8_t, uint16_t, uint32_t, uint64_t.
+template <class Label>
+void MeshObjectsChunked(const ReadLabelsFunction<Label>& read_labels,
+                        const Vector3d& size, const Vector3d& block_size,
+                        std::unordered_map<uint64_t, TriangleMesh>* output,
+                        int num_threads = 1,
+                        const LabelEquivalences* equivalences = nullptr,
+                        const std::vector<uint64_t>* allowed_ids = nullptr);
+
+// Computes a surface mesh for each non-zero label of a single channel of
+// compressed_segmentation data (see decompress_segmentation.h) of the specified
+// `size` and `block_size`, producing the same meshes as MeshObjects without
+// decoding the whole volume.
+//
+// The volume is marched one plane of cubes at a time, and only the two voxel
+// planes of the current plane of cubes are decoded, so memory is bounded by
+// two planes plus the output meshes.  Planes of cubes that lie within layers of
+// blocks all encoded with 0 bits and the same value are skipped without
+// decoding them.
+//
+// Label must be one of uint32_t, uint64_t.  Returns false if the input is
+// invalid, in which case the contents of `output` are unspecified.
+template <class Label>
+bool MeshCompressedChannel(const uint32_t* input, size_t input_size,
+                           const Vector3d& size, const Vector3d& block_size,
+                           std::unordered_map<uint64_t, TriangleMesh>* output);
+
+// Computes the bounding box of each non-zero label.  The bounding box of
+// `label_map.ids()[i]` is stored in `(*output)[i]`.  The `label_map` must
+// contain every non-zero label in the volume.
+//
+// If `voxel_counts` is not null, the number of voxels of each label is stored
+// densely in the same order.  Labels are processed a run at a time, so this
+// costs one addition per run.
+//
+// Label must be one of uint8_t, uint16_t, uint32_t, uint64_t.
+template <class Label>
+void ComputeBoundingBoxes(const Label* labels, const Vector3d& size,
+                          const Vector3d& strides,
+                          const DenseLabelMap& label_map,
+                          std::vector<BoundingBox>* output,
+                          std::vector<uint64_t>* voxel_counts = nullptr);
+
+// Computes the surface mesh for a single object, marching only over the cubes
+// that intersect `bounding_box`, which must contain every voxel of the object.
+// If `equivalences` is not null, the object consists of the labels mapped to
+// `object_id`, as for MeshObjects.
+//
+// The resultant mesh is identical (up to vertex and triangle order) to the mesh
+// computed for the same object by MeshObjects.  Vertex positions are relative
+// to the origin of the full volume, not to `bounding_box`.
+//
+// Label must be one of uint8_t, uint16_t, uint32_t, uint64_t.
+template <class Label>
+void MeshObject(const Label* labels, const Vector3d& size,
+                const Vector3d& strides, uint64_t object_id,
+                const BoundingBox& bounding_box, TriangleMesh* output,
+                const LabelEquivalences* equivalences = nullptr);
 
 }  // namespace meshing
 }  // namespace neuroglancer
@@ -0,0 +1,622 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mesh_objects.h"
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "compress_segmentation.h"
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace meshing {
+namespace {
+
+constexpr ptrdiff_t kBlockSize[3] = {8, 8, 4};
+
+// Volume with partial blocks at the upper bounds.  Two overlapping boxes, one
+// aligned to blocks and one not, on a background that is 0 in the lower half
+// and 1 in the upper half of z, so that there are single-valued blocks
+// adjacent to blocks of the same value, of a different value, and to
+// multi-valued blocks.
+template <class Label>
+std::vector<Label> MakeVolume(const Vector3d& size) {
+  std::vector<Label> labels(size[0] * size[1] * size[2]);
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x) {
+        Label label = z < 12 ? 0 : 1;
+        if (x >= 8 && x < 24 && y >= 8 && y < 16 && z >= 4 && z < 16) {
+          label = 2;
+        }
+        if (x >= 13 && x < 30 && y >= 3 && y < 20 && z >= 9 && z < 18) {
+          label = static_cast<Label>(0x100000003ull);
+        }
+        labels[x + size[0] * (y + size[1] * z)] = label;
+      }
+    }
+  }
+  return labels;
+}
+
+template <class Label>
+void TestMeshCompressedChannel() {
+  const Vector3d size{37, 29, 23};
+  const auto labels = MakeVolume<Label>(size);
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  std::unordered_map<uint64_t, TriangleMesh> expected;
+  MeshObjects(labels.data(), size, strides, &expected);
+
+  const ptrdiff_t input_strides[3] = {1, size[0], size[0] * size[1]};
+  const ptrdiff_t volume_size[3] = {size[0], size[1], size[2]};
+  std::vector<uint32_t> encoded;
+  compress_segmentation::CompressChannel(labels.data(), input_strides,
+                                         volume_size, kBlockSize, &encoded);
+  std::unordered_map<uint64_t, TriangleMesh> actual;
+  ASSERT_TRUE(MeshCompressedChannel<Label>(
+      encoded.data(), encoded.size(), size,
+      Vector3d{kBlockSize[0], kBlockSize[1], kBlockSize[2]}, &actual));
+  ASSERT_EQ(expected.size(), actual.size());
+  for (const auto& p : expected) {
+    auto it = actual.find(p.first);
+    ASSERT_NE(it, actual.end()) << "label=" << p.first;
+    EXPECT_EQ(p.second.vertex_positions, it->second.vertex_positions)
+        << "label=" << p.first;
+    EXPECT_EQ(p.second.triangles, it->second.triangles)
+        << "label=" << p.first;
+  }
+}
+
+TEST(MeshCompressedChannelTest, Uint32) {
+  TestMeshCompressedChannel<uint32_t>();
+}
+
+TEST(MeshCompressedChannelTest, Uint64) {
+  TestMeshCompressedChannel<uint64_t>();
+}
+
+TEST(MeshCompressedChannelTest, Invalid) {
+  const Vector3d size{37, 29, 23};
+  std::unordered_map<uint64_t, TriangleMesh> output;
+  const Vector3d block_size{kBlockSize[0], kBlockSize[1], kBlockSize[2]};
+  std::vector<uint32_t> encoded(10);
+  EXPECT_FALSE(MeshCompressedChannel<uint64_t>(encoded.data(), encoded.size(),
+                                               size, block_size, &output));
+}
+
+// Meshing with equivalences produces the same meshes as meshing the relabeled
+// volume.
+TEST(MeshObjectsTest, Equivalences) {
+  const Vector3d size{21, 18, 40};
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  std::vector<uint32_t> labels(size[0] * size[1] * size[2]);
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x) {
+        labels[x + size[0] * (y + size[1] * z)] = (x / 4 + y / 5 + z / 7) % 7;
+      }
+    }
+  }
+  // Merges 2 and 3 into 1, makes 5 background, and renames 6 to 9.
+  const LabelEquivalences equivalences({{2, 1}, {3, 1}, {5, 0}, {6, 9}});
+  std::vector<uint32_t> relabeled(labels.size());
+  for (size_t i = 0; i < labels.size(); ++i) {
+    relabeled[i] = static_cast<uint32_t>(equivalences.Find(labels[i]));
+  }
+  for (int num_threads : {1, 2}) {
+    std::unordered_map<uint64_t, TriangleMesh> expected, actual;
+    MeshObjects(relabeled.data(), size, strides, &expected, num_threads);
+    MeshObjects(labels.data(), size, strides, &actual, num_threads,
+                &equivalences);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (const auto& p : expected) {
+      auto it = actual.find(p.first);
+      ASSERT_NE(it, actual.end()) << "object=" << p.first;
+      EXPECT_EQ(p.second.vertex_positions, it->second.vertex_positions)
+          << "object=" << p.first;
+      EXPECT_EQ(p.second.triangles, it->second.triangles)
+          << "object=" << p.first;
+    }
+  }
+
+  const BoundingBox box{{0, 0, 0}, size};
+  TriangleMesh expected, actual;
+  MeshObject(relabeled.data(), size, strides, 1, box, &expected);
+  MeshObject(labels.data(), size, strides, 1, box, &actual, &equivalences);
+  EXPECT_FALSE(expected.triangles.empty());
+  EXPECT_EQ(expected.vertex_positions, actual.vertex_positions);
+  EXPECT_EQ(expected.triangles, actual.triangles);
+}
+
+// Meshing a subset of the objects produces the same meshes for those objects
+// as meshing all of them.
+TEST(MeshObjectsTest, AllowedIds) {
+  const Vector3d size{37, 29, 23};
+  const auto labels = MakeVolume<uint64_t>(size);
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  std::unordered_map<uint64_t, TriangleMesh> all;
+  MeshObjects(labels.data(), size, strides, &all);
+  // Includes an id that is not in the volume.
+  const std::vector<uint64_t> allowed_ids = {2, 7, 0x100000003ull};
+  std::unordered_map<uint64_t, TriangleMesh> actual;
+  MeshObjects(labels.data(), size, strides, &actual, /*num_threads=*/1,
+              /*equivalences=*/nullptr, &allowed_ids);
+  ASSERT_EQ(2u, actual.size());
+  for (const uint64_t id : {uint64_t(2), uint64_t(0x100000003ull)}) {
+    auto it = actual.find(id);
+    ASSERT_NE(it, actual.end()) << "object=" << id;
+    EXPECT_EQ(all[id].vertex_positions, it->second.vertex_positions)
+        << "object=" << id;
+    EXPECT_EQ(all[id].triangles, it->second.triangles) << "object=" << id;
+  }
+}
+
+// Voxel and boundary cube counts match those computed directly from the
+// labels.
+TEST(MeshObjectsTest, Statistics) {
+  const Vector3d size{21, 18, 40};
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  std::vector<uint32_t> labels(size[0] * size[1] * size[2]);
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x) {
+        labels[x + size[0] * (y + size[1] * z)] = (x / 4 + y / 5 + z / 7) % 7;
+      }
+    }
+  }
+  const LabelEquivalences equivalences({{2, 1}, {3, 1}, {5, 0}, {6, 9}});
+  const DenseLabelMap label_map(
+      ComputeDistinctLabels(labels.data(), size, strides));
+  const DenseLabelMap object_map(
+      ComputeObjectIds(label_map.ids(), equivalences));
+
+  std::vector<BoundingBox> boxes;
+  std::vector<uint64_t> voxel_counts;
+  ComputeBoundingBoxes(labels.data(), size, strides, label_map, &boxes,
+                       &voxel_counts);
+  std::vector<uint64_t> expected_voxel_counts(label_map.size());
+  for (const uint32_t label : labels) {
+    if (label != 0) ++expected_voxel_counts[label_map.Find(label)];
+  }
+  EXPECT_EQ(expected_voxel_counts, voxel_counts);
+
+  std::vector<uint64_t> expected_cube_counts(object_map.size());
+  for (int64_t z = 0; z + 1 < size[2]; ++z) {
+    for (int64_t y = 0; y + 1 < size[1]; ++y) {
+      for (int64_t x = 0; x + 1 < size[0]; ++x) {
+        std::vector<uint64_t> ids;
+        for (int i = 0; i < 8; ++i) {
+          ids.push_back(equivalences.Find(
+              labels[(x + (i & 1)) + size[0] * ((y + ((i >> 1) & 1)) +
+                                                size[1] * (z + (i >> 2)))]));
+        }
+        std::sort(ids.begin(), ids.end());
+        if (ids.front() == ids.back()) continue;
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        for (const uint64_t id : ids) {
+          if (id != 0) ++expected_cube_counts[object_map.Find(id)];
+        }
+      }
+    }
+  }
+  for (int num_threads : {1, 2}) {
+    std::vector<TriangleMesh> meshes;
+    std::vector<uint64_t> cube_counts;
+    MeshObjects(labels.data(), size, strides, object_map, &meshes, num_threads,
+                &equivalences, &cube_counts);
+    EXPECT_EQ(expected_cube_counts, cube_counts)
+        << "num_threads=" << num_threads;
+  }
+}
+
+// Returns the triangles of `mesh` as vertex positions, each rotated to start
+// at its least vertex, in sorted order, so that meshes that differ only in
+// vertex and triangle order compare equal.
+std::vector<std::array<std::array<float, 3>, 3>> GetSortedTriangles(
+    const TriangleMesh& mesh) {
+  std::vector<std::array<std::array<float, 3>, 3>> triangles;
+  for (const auto& triangle : mesh.triangles) {
+    std::array<std::array<float, 3>, 3> positions;
+    for (int i = 0; i < 3; ++i) {
+      positions[i] = mesh.vertex_positions[triangle[i]];
+    }
+    std::rotate(positions.begin(),
+                std::min_element(positions.begin(), positions.end()),
+                positions.end());
+    triangles.push_back(positions);
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+// Flying edges produces the same surfaces and boundary cube counts as
+// marching cubes, up to vertex and triangle order, for any strides and number
+// of threads.
+TEST(MeshObjectsTest, FlyingEdges) {
+  const Vector3d size{23, 17, 19};
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  std::vector<uint32_t> labels(size[0] * size[1] * size[2]);
+  std::mt19937 generator(1);
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x) {
+        uint32_t label = (x / 3 + y / 4 + z / 5) % 6;
+        if (generator() % 16 == 0) label = generator() % 6;
+        // An object that touches the lower x bound of every row.
+        if (x < 2) label = 4;
+        labels[x + size[0] * (y + size[1] * z)] = label;
+      }
+    }
+  }
+  // The same volume with z varying fastest.
+  const Vector3d transposed_strides{size[2] * size[1], size[2], 1};
+  std::vector<uint32_t> transposed(labels.size());
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x) {
+        transposed[x * transposed_strides[0] + y * transposed_strides[1] + z] =
+            labels[x + size[0] * (y + size[1] * z)];
+      }
+    }
+  }
+  const LabelEquivalences equivalences({{2, 1}, {3, 0}});
+
+  for (const bool use_equivalences : {false, true}) {
+    const LabelEquivalences* cur_equivalences =
+        use_equivalences ? &equivalences : nullptr;
+    std::vector<uint64_t> ids =
+        ComputeDistinctLabels(labels.data(), size, strides);
+    if (use_equivalences) ids = ComputeObjectIds(ids, equivalences);
+    const DenseLabelMap label_map(std::move(ids));
+    std::vector<TriangleMesh> expected;
+    std::vector<uint64_t> expected_cube_counts;
+    MeshObjects(labels.data(), size, strides, label_map, &expected,
+                /*num_threads=*/1, cur_equivalences, &expected_cube_counts);
+    for (const bool use_transposed : {false, true}) {
+      for (const int num_threads : {1, 3}) {
+        SCOPED_TRACE(::testing::Message()
+                     << "use_equivalences=" << use_equivalences
+                     << " use_transposed=" << use_transposed
+                     << " num_threads=" << num_threads);
+        std::vector<TriangleMesh> actual;
+        std::vector<uint64_t> cube_counts;
+        MeshObjects(use_transposed ? transposed.data() : labels.data(), size,
+                    use_transposed ? transposed_strides : strides, label_map,
+                    &actual, num_threads, cur_equivalences, &cube_counts,
+                    MeshingEngine::kFlyingEdges);
+        EXPECT_EQ(expected_cube_counts, cube_counts);
+        ASSERT_EQ(expected.size(), actual.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+          EXPECT_FALSE(expected[i].triangles.empty());
+          EXPECT_EQ(expected[i].vertex_positions.size(),
+                    actual[i].vertex_positions.size())
+              << "object=" << label_map.ids()[i];
+          EXPECT_EQ(GetSortedTriangles(expected[i]),
+                    GetSortedTriangles(actual[i]))
+              << "object=" << label_map.ids()[i];
+        }
+      }
+    }
+  }
+
+  const std::vector<uint64_t> allowed_ids = {4};
+  std::unordered_map<uint64_t, TriangleMesh> expected, actual;
+  MeshObjects(labels.data(), size, strides, &expected, /*num_threads=*/1,
+              /*equivalences=*/nullptr, &allowed_ids);
+  MeshObjects(labels.data(), size, strides, &actual, /*num_threads=*/2,
+              /*equivalences=*/nullptr, &allowed_ids,
+              MeshingEngine::kFlyingEdges);
+  ASSERT_EQ(1u, expected.size());
+  ASSERT_EQ(1u, actual.size());
+  EXPECT_EQ(GetSortedTriangles(expected[4]), GetSortedTriangles(actual[4]));
+
+  // A volume without cubes has no surfaces.
+  const Vector3d flat_size{size[0], size[1], 1};
+  MeshObjects(labels.data(), flat_size, strides, &actual, /*num_threads=*/1,
+              /*equivalences=*/nullptr, /*allowed_ids=*/nullptr,
+              MeshingEngine::kFlyingEdges);
+  EXPECT_TRUE(actual.empty());
+}
+
+// Meshing block by block produces the same surfaces as meshing the whole
+// volume, with the vertices on the faces shared by adjacent blocks emitted
+// once, for block sizes that do and do not divide the number of cubes.
+TEST(MeshObjectsTest, Chunked) {
+  // 31 x 23 x 19 cubes, with objects that cross the boundaries of every block
+  // size below.
+  const Vector3d size{32, 24, 20};
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  const std::vector<uint64_t> labels = MakeVolume<uint64_t>(size);
+  std::vector<BoundingBox> boxes_read;
+  const ReadLabelsFunction<uint64_t> read_labels =
+      [&](const BoundingBox& box, uint64_t* output) {
+        boxes_read.push_back(box);
+        for (int64_t z = box.start[2]; z < box.end[2]; ++z) {
+          for (int64_t y = box.start[1]; y < box.end[1]; ++y) {
+            for (int64_t x = box.start[0]; x < box.end[0]; ++x) {
+              *output++ = labels[x + size[0] * (y + size[1] * z)];
+            }
+          }
+        }
+      };
+  const LabelEquivalences equivalences({{2, 1}});
+  const std::vector<uint64_t> allowed_ids = {2, 0x100000003ull};
+
+  for (const int variant : {0, 1, 2}) {
+    const LabelEquivalences* cur_equivalences =
+        variant == 1 ? &equivalences : nullptr;
+    const std::vector<uint64_t>* cur_allowed_ids =
+        variant == 2 ? &allowed_ids : nullptr;
+    std::unordered_map<uint64_t, TriangleMesh> expected;
+    MeshObjects(labels.data(), size, strides, &expected, /*num_threads=*/1,
+                cur_equivalences, cur_allowed_ids);
+    ASSERT_FALSE(expected.empty());
+    for (const Vector3d& block_size :
+         {Vector3d{8, 8, 4}, Vector3d{31, 23, 19}, Vector3d{5, 7, 3},
+          Vector3d{64, 64, 64}}) {
+      for (const int num_threads : {1, 2}) {
+        SCOPED_TRACE(::testing::Message()
+                     << "variant=" << variant << " block_size="
+                     << block_size[0] << "," << block_size[1] << ","
+                     << block_size[2] << " num_threads=" << num_threads);
+        boxes_read.clear();
+        std::unordered_map<uint64_t, TriangleMesh> actual;
+        MeshObjectsChunked(read_labels, size, block_size, &actual,
+                           num_threads, cur_equivalences, cur_allowed_ids);
+        // The blocks cover the cubes exactly once.
+        int64_t num_cubes = 0;
+        for (const BoundingBox& box : boxes_read) {
+          int64_t block_cubes = 1;
+          for (int i = 0; i < 3; ++i) {
+            EXPECT_LE(box.end[i] - box.start[i], block_size[i] + 1);
+            block_cubes *= box.end[i] - box.start[i] - 1;
+          }
+          num_cubes += block_cubes;
+        }
+        EXPECT_EQ((size[0] - 1) * (size[1] - 1) * (size[2] - 1), num_cubes);
+        ASSERT_EQ(expected.size(), actual.size());
+        for (const auto& p : expected) {
+          const TriangleMesh& mesh = actual[p.first];
+          EXPECT_EQ(p.second.vertex_positions.size(),
+                    mesh.vertex_positions.size())
+              << "object=" << p.first;
+          EXPECT_EQ(GetSortedTriangles(p.second), GetSortedTriangles(mesh))
+              << "object=" << p.first;
+        }
+      }
+    }
+  }
+}
+
+// With bounding boxes, the mesh of each object is complete when reported done,
+// before the slabs of other objects are marched, and cancellation stops the
+// march.
+TEST(MeshObjectsTest, Progress) {
+  const Vector3d size{12, 10, 130};
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  std::vector<uint32_t> labels(size[0] * size[1] * size[2]);
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x) {
+        // Layers of objects 1-7 around a column of object 10 spanning all z.
+        uint32_t label = 1 + z / 20;
+        if (x >= 4 && x < 8 && y >= 3 && y < 7) label = 10;
+        labels[x + size[0] * (y + size[1] * z)] = label;
+      }
+    }
+  }
+  const DenseLabelMap label_map(
+      ComputeDistinctLabels(labels.data(), size, strides));
+  std::vector<BoundingBox> boxes;
+  ComputeBoundingBoxes(labels.data(), size, strides, label_map, &boxes);
+  std::vector<TriangleMesh> expected;
+  std::vector<uint64_t> expected_cube_counts;
+  MeshObjects(labels.data(), size, strides, label_map, &expected,
+              /*num_threads=*/1, /*equivalences=*/nullptr,
+              &expected_cube_counts);
+
+  for (const int num_threads : {1, 2}) {
+    SCOPED_TRACE(::testing::Message() << "num_threads=" << num_threads);
+    std::vector<TriangleMesh> actual;
+    std::vector<uint64_t> cube_counts;
+    std::mutex mutex;
+    std::vector<int> num_done(label_map.size());
+    MeshingProgress progress;
+    progress.bounding_boxes = &boxes;
+    progress.object_done = [&](size_t index) {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++num_done[index];
+      EXPECT_EQ(GetSortedTriangles(expected[index]),
+                GetSortedTriangles(actual[index]));
+      EXPECT_EQ(expected_cube_counts[index], cube_counts[index]);
+    };
+    MeshObjects(labels.data(), size, strides, label_map, &actual, num_threads,
+                /*equivalences=*/nullptr, &cube_counts,
+                MeshingEngine::kMarchingCubes, &progress);
+    EXPECT_EQ(std::vector<int>(label_map.size(), 1), num_done);
+    EXPECT_EQ(size[2] - 1, progress.marched_planes);
+  }
+
+  // Cancelling once the first object is done leaves the column undone.
+  std::vector<TriangleMesh> actual;
+  std::atomic<int> num_done(0);
+  MeshingProgress progress;
+  progress.bounding_boxes = &boxes;
+  progress.object_done = [&](size_t index) {
+    ++num_done;
+    progress.cancelled = true;
+  };
+  MeshObjects(labels.data(), size, strides, label_map, &actual,
+              /*num_threads=*/1, /*equivalences=*/nullptr,
+              /*boundary_cube_counts=*/nullptr, MeshingEngine::kMarchingCubes,
+              &progress);
+  EXPECT_EQ(1, num_done);
+  EXPECT_LT(progress.marched_planes, size[2] - 1);
+  EXPECT_TRUE(actual[label_map.Find(10)].triangles.empty());
+}
+
+// The working memory of the march is counted while marching, and is all
+// released once done, whether or not the meshes are merged early.
+TEST(MeshObjectsTest, WorkingBytes) {
+  const Vector3d size{20, 16, 80};
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  std::vector<uint32_t> labels(size[0] * size[1] * size[2]);
+  for (size_t i = 0; i < labels.size(); ++i) {
+    labels[i] = 1 + (i % 7) / 3 + i / 1000;
+  }
+  const DenseLabelMap label_map(
+      ComputeDistinctLabels(labels.data(), size, strides));
+  std::vector<BoundingBox> boxes;
+  ComputeBoundingBoxes(labels.data(), size, strides, label_map, &boxes);
+  for (const bool merge_early : {false, true}) {
+    SCOPED_TRACE(::testing::Message() << "merge_early=" << merge_early);
+    std::vector<TriangleMesh> meshes;
+    MeshingProgress progress;
+    if (merge_early) progress.bounding_boxes = &boxes;
+    std::atomic<int64_t> bytes_when_done{-1};
+    progress.object_done = [&](size_t index) {
+      bytes_when_done = progress.working_bytes.bytes.load();
+    };
+    MeshObjects(labels.data(), size, strides, label_map, &meshes,
+                /*num_threads=*/2, /*equivalences=*/nullptr,
+                /*boundary_cube_counts=*/nullptr,
+                MeshingEngine::kMarchingCubes, &progress);
+    EXPECT_EQ(0, progress.working_bytes.bytes);
+    // At least the vertex map of one slab and the bitmap.
+    EXPECT_GE(progress.working_bytes.peak_bytes,
+              static_cast<int64_t>(
+                  voxel_mesh_generator::SequentialVertexMap::GetNumBytes(
+                      size)));
+    EXPECT_GT(bytes_when_done, 0);
+  }
+}
+
+// Slabs balanced by boundary cubes, when nearly all of them lie in a few z
+// planes, produce the same surfaces and counts as a single slab, for rows
+// spanning more than one word of the boundary cube bitmap and for a non-unit
+// x stride.
+TEST(MeshObjectsTest, UnbalancedBoundaryCubes) {
+  const Vector3d size{70, 6, 100};
+  std::vector<uint16_t> labels(size[0] * size[1] * size[2]);
+  std::vector<uint16_t> transposed(labels.size());
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x) {
+        uint16_t label = z < 50 ? 1 : 2;
+        if (z >= 90) label = (x * 7 + y * 3 + z) % 5;
+        labels[x + size[0] * (y + size[1] * z)] = label;
+        transposed[z + size[2] * (y + size[1] * x)] = label;
+      }
+    }
+  }
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  const Vector3d transposed_strides{size[1] * size[2], size[2], 1};
+  const DenseLabelMap label_map(
+      ComputeDistinctLabels(labels.data(), size, strides));
+  const LabelEquivalences equivalences({{3, 1}});
+  for (const LabelEquivalences* cur_equivalences :
+       {static_cast<const LabelEquivalences*>(nullptr), &equivalences}) {
+    std::vector<TriangleMesh> expected;
+    std::vector<uint64_t> expected_cube_counts;
+    MeshObjects(labels.data(), size, strides, label_map, &expected,
+                /*num_threads=*/1, cur_equivalences, &expected_cube_counts);
+    for (const bool transpose : {false, true}) {
+      SCOPED_TRACE(::testing::Message() << "transpose=" << transpose);
+      std::vector<TriangleMesh> actual;
+      std::vector<uint64_t> cube_counts;
+      MeshObjects(transpose ? transposed.data() : labels.data(), size,
+                  transpose ? transposed_strides : strides, label_map, &actual,
+                  /*num_threads=*/4, cur_equivalences, &cube_counts);
+      EXPECT_EQ(expected_cube_counts, cube_counts);
+      ASSERT_EQ(expected.size(), actual.size());
+      for (size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(GetSortedTriangles(expected[i]),
+                  GetSortedTriangles(actual[i]))
+            << "object=" << label_map.ids()[i];
+      }
+    }
+  }
+}
+
+TEST(CopyLabelsXFastestTest, ReversedStrides) {
+  // Sizes that are not multiples of the tile size, stored with z varying
+  // fastest, as the transpose of a C-order array.
+  const Vector3d size{37, 29, 23};
+  const auto labels = MakeVolume<uint64_t>(size);
+  const Vector3d strides{size[1] * size[2], size[2], 1};
+  std::vector<uint64_t> transposed(labels.size());
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x) {
+        transposed[x * strides[0] + y * strides[1] + z] =
+            labels[(z * size[1] + y) * size[0] + x];
+      }
+    }
+  }
+  for (int num_threads : {1, 4}) {
+    std::vector<uint64_t> output(labels.size());
+    CopyLabelsXFastest(transposed.data(), size, strides, output.data(),
+                       num_threads);
+    EXPECT_EQ(labels, output);
+  }
+}
+
+TEST(ComputeSurfaceAreaTest, Scaled) {
+  TriangleMesh mesh;
+  mesh.vertex_positions = {{{0, 0, 0}}, {{1, 0, 0}}, {{0, 1, 0}}, {{0, 0, 1}}};
+  mesh.triangles = {{{0, 1, 2}}, {{0, 3, 1}}};
+  const float scale[3] = {3, 4, 5};
+  EXPECT_DOUBLE_EQ(3 * 4 / 2.0 + 3 * 5 / 2.0, ComputeSurfaceArea(mesh, scale));
+}
+
+TEST(CompactTriangleMeshTest, RoundTrip) {
+  const Vector3d size{37, 29, 23};
+  const auto labels = MakeVolume<uint32_t>(size);
+  std::unordered_map<uint64_t, TriangleMesh> meshes;
+  MeshObjects(labels.data(), size, Vector3d{1, size[0], size[0] * size[1]},
+              &meshes);
+  // Also exercise 32-bit positions and indices.
+  TriangleMesh large;
+  for (int i = 0; i < 0x10001; ++i) {
+    large.vertex_positions.push_back({{i * 1.5f, 0.5f, -3.0f}});
+  }
+  large.triangles = {{{0, 0x10000, 7}}, {{3, 2, 1}}};
+  meshes[7] = large;
+  for (const auto& p : meshes) {
+    const CompactTriangleMesh compact(p.second);
+    EXPECT_EQ(p.second.triangles.size(), compact.num_triangles());
+    EXPECT_EQ(p.second.num_bytes(), compact.num_decoded_bytes());
+    TriangleMesh decoded;
+    compact.Decode(&decoded);
+    EXPECT_EQ(p.second.vertex_positions, decoded.vertex_positions)
+        << "label=" << p.first;
+    EXPECT_EQ(p.second.triangles, decoded.triangles) << "label=" << p.first;
+    if (p.first != 7) {
+      // 16-bit positions and indices, plus padding.
+      EXPECT_LE(compact.num_bytes(), p.second.num_bytes() / 2 + 2)
+          << "label=" << p.first;
+    }
+  }
+  EXPECT_TRUE(CompactTriangleMesh(TriangleMesh()).empty());
+}
+
+}  // namespace
+}  // namespace meshing
+}  // namespace neuroglancer
@@ -0,0 +1,622 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks of the native compressed segmentation encoder and of the
+// meshing pipeline: CompressChannels, MeshObjects with each MeshingEngine,
+// MeshCompressedChannel, CountLabels and DownsampleChannels of encoded volumes,
+// SimplifyTriangleMesh, MeshObjectVoxelFaces, and the encoding of simplified
+// meshes by OnDemandObjectMeshGenerator.
+//
+// Usage:
+//
+//   native_benchmark [--filter=SUBSTRING] [--repetitions=N]
+//                    [--raw=PATH:X,Y,Z:BYTES_PER_VOXEL] [--trace=PATH]
+//
+// Each benchmark is run over synthetic label volumes of varying object count,
+// object size and anisotropy, and over the little-endian raw volumes given by
+// --raw, stored with x varying fastest.  Only the benchmarks whose name
+// contains the --filter substring are run.  The best time of the repetitions
+// is reported.  With --trace, the trace spans of the benchmarks are written
+// to PATH in the Chrome trace event format; only the latest spans of each
+// thread are retained.
+//
+// Peak memory is the peak resident set size of the process so far, so the
+// peak of a single benchmark is obtained by selecting it with --filter.
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "compress_segmentation.h"
+#include "decompress_segmentation.h"
+#include "downsample.h"
+#include "downsample_segmentation.h"
+#include "mesh_objects.h"
+#include "on_demand_object_mesh_generator.h"
+#include "quadric_simplifier.h"
+#include "trace_events.h"
+#include "voxel_faces.h"
+#include "voxel_mesh_generator.h"
+
+namespace neuroglancer {
+namespace {
+
+using meshing::TriangleMesh;
+using meshing::Vector3d;
+
+struct Volume {
+  std::string name;
+  Vector3d size;
+  std::vector<uint64_t> labels;
+};
+
+// Returns a volume of roughly convex objects of about `object_size` voxels
+// along each dimension, with wavy boundaries so that the surfaces are not
+// axis-aligned.  Label 0 is used for a thin background shell around each
+// object.
+Volume MakeSyntheticVolume(const std::string& name, const Vector3d& size,
+                           const std::array<double, 3>& object_size) {
+  Volume volume;
+  volume.name = name;
+  volume.size = size;
+  volume.labels.resize(size[0] * size[1] * size[2]);
+  size_t i = 0;
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x, ++i) {
+        const double p[3] = {
+            x + 0.2 * object_size[0] * std::sin(y * 0.21 + z * 0.13),
+            y + 0.2 * object_size[1] * std::sin(z * 0.17 + x * 0.11),
+            z + 0.2 * object_size[2] * std::sin(x * 0.19 + y * 0.23)};
+        uint64_t label = 1;
+        bool background = false;
+        for (int d = 0; d < 3; ++d) {
+          const double cell = std::floor(p[d] / object_size[d]);
+          const double fraction = p[d] / object_size[d] - cell;
+          background = background || fraction < 0.05;
+          label = label * 1000003 + static_cast<uint64_t>(cell + 1000);
+        }
+        volume.labels[i] = background ? 0 : label;
+      }
+    }
+  }
+  return volume;
+}
+
+template <class Label>
+void ReadRawLabels(std::ifstream* file, size_t num_voxels,
+                   std::vector<uint64_t>* labels) {
+  std::vector<Label> raw(num_voxels);
+  file->read(reinterpret_cast<char*>(raw.data()), num_voxels * sizeof(Label));
+  labels->assign(raw.begin(), raw.end());
+}
+
+// Reads a volume specified as PATH:X,Y,Z:BYTES_PER_VOXEL.  Returns false if
+// the specification is invalid or the file cannot be read.
+bool ReadRawVolume(const std::string& spec, Volume* volume) {
+  const size_t bytes_begin = spec.rfind(':');
+  if (bytes_begin == std::string::npos || bytes_begin == 0) return false;
+  const size_t size_begin = spec.rfind(':', bytes_begin - 1);
+  if (size_begin == std::string::npos || size_begin == 0) return false;
+  long long x, y, z;
+  int bytes_per_voxel;
+  if (std::sscanf(spec.c_str() + size_begin, ":%lld,%lld,%lld:%d", &x, &y, &z,
+                  &bytes_per_voxel) != 4 ||
+      x <= 0 || y <= 0 || z <= 0) {
+    return false;
+  }
+  volume->name = spec.substr(0, size_begin);
+  volume->size = {x, y, z};
+  std::ifstream file(volume->name, std::ios::binary);
+  if (!file) return false;
+  const size_t num_voxels = x * y * z;
+  switch (bytes_per_voxel) {
+    case 1:
+      ReadRawLabels<uint8_t>(&file, num_voxels, &volume->labels);
+      break;
+    case 2:
+      ReadRawLabels<uint16_t>(&file, num_voxels, &volume->labels);
+      break;
+    case 4:
+      ReadRawLabels<uint32_t>(&file, num_voxels, &volume->labels);
+      break;
+    case 8:
+      ReadRawLabels<uint64_t>(&file, num_voxels, &volume->labels);
+      break;
+    default:
+      return false;
+  }
+  return static_cast<bool>(file);
+}
+
+// Returns the peak resident set size of the process in bytes.
+size_t GetPeakMemory() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss;
+#else
+  return usage.ru_maxrss * size_t(1024);
+#endif
+}
+
+// Returns the best wall-clock time in seconds of `repetitions` calls to `fn`.
+double TimeBest(int repetitions, const std::function<void()>& fn) {
+  double best = 0;
+  for (int i = 0; i < repetitions; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    if (i == 0 || seconds < best) best = seconds;
+  }
+  return best;
+}
+
+void PrintResult(const char* benchmark, const Volume& volume, double seconds,
+                 const char* rate_unit, double rate_count,
+                 const std::string& details) {
+  std::printf("%-20s %-24s %10.3f ms %12.4g %s/s %8.1f MiB peak  %s\n",
+              benchmark, volume.name.c_str(), seconds * 1e3,
+              rate_count / seconds, rate_unit,
+              GetPeakMemory() / (1024.0 * 1024.0), details.c_str());
+  std::fflush(stdout);
+}
+
+size_t GetNumVoxels(const Volume& volume) {
+  return volume.size[0] * volume.size[1] * volume.size[2];
+}
+
+void BenchmarkCompressChannels(const Volume& volume, int repetitions) {
+  const ptrdiff_t volume_size[4] = {volume.size[0], volume.size[1],
+                                    volume.size[2], 1};
+  const ptrdiff_t strides[4] = {1, volume.size[0],
+                                volume.size[0] * volume.size[1],
+                                volume.size[0] * volume.size[1] *
+                                    volume.size[2]};
+  const ptrdiff_t block_size[3] = {8, 8, 8};
+  std::vector<uint32_t> output;
+  const double seconds = TimeBest(repetitions, [&] {
+    compress_segmentation::CompressChannels(volume.labels.data(), strides,
+                                            volume_size, block_size, &output);
+  });
+  const double ratio = static_cast<double>(volume.labels.size()) *
+                       sizeof(uint64_t) / (output.size() * sizeof(uint32_t));
+  PrintResult("CompressChannels", volume, seconds, "voxels",
+              GetNumVoxels(volume), "ratio=" + std::to_string(ratio));
+}
+
+size_t CountTriangles(const std::vector<TriangleMesh>& meshes) {
+  size_t num_triangles = 0;
+  for (const auto& mesh : meshes) num_triangles += mesh.triangles.size();
+  return num_triangles;
+}
+
+// Computes the meshes of all objects of `volume` with `num_threads` threads
+// and `engine`.
+void ComputeMeshes(
+    const Volume& volume, std::vector<TriangleMesh>* meshes,
+    int num_threads = 1,
+    meshing::MeshingEngine engine = meshing::MeshingEngine::kMarchingCubes) {
+  const Vector3d strides{1, volume.size[0], volume.size[0] * volume.size[1]};
+  meshing::DenseLabelMap label_map(meshing::ComputeDistinctLabels(
+      volume.labels.data(), volume.size, strides));
+  meshing::MeshObjects(volume.labels.data(), volume.size, strides, label_map,
+                       meshes, num_threads, /*equivalences=*/nullptr,
+                       /*boundary_cube_counts=*/nullptr, engine);
+}
+
+void BenchmarkMeshObjectsWithThreads(
+    const char* name, const Volume& volume, int repetitions, int num_threads,
+    meshing::MeshingEngine engine = meshing::MeshingEngine::kMarchingCubes) {
+  std::vector<TriangleMesh> meshes;
+  const double seconds = TimeBest(repetitions, [&] {
+    meshes.clear();
+    ComputeMeshes(volume, &meshes, num_threads, engine);
+  });
+  const size_t num_triangles = CountTriangles(meshes);
+  const int64_t triangles_per_second = num_triangles / seconds;
+  PrintResult(name, volume, seconds, "voxels", GetNumVoxels(volume),
+              "objects=" + std::to_string(meshes.size()) +
+                  " triangles=" + std::to_string(num_triangles) +
+                  " triangles/s=" + std::to_string(triangles_per_second));
+}
+
+void BenchmarkMeshObjects(const Volume& volume, int repetitions) {
+  BenchmarkMeshObjectsWithThreads("MeshObjects", volume, repetitions, 1);
+}
+
+// Same as above, but with the number of hardware threads.
+void BenchmarkMeshObjectsParallel(const Volume& volume, int repetitions) {
+  BenchmarkMeshObjectsWithThreads("MeshObjectsParallel", volume, repetitions,
+                                  0);
+}
+
+void BenchmarkMeshObjectsFlyingEdges(const Volume& volume, int repetitions) {
+  BenchmarkMeshObjectsWithThreads("MeshObjectsFlyingEdges", volume,
+                                  repetitions, 1,
+                                  meshing::MeshingEngine::kFlyingEdges);
+}
+
+// Same as above, but with the number of hardware threads.
+void BenchmarkMeshObjectsFlyingEdgesParallel(const Volume& volume,
+                                             int repetitions) {
+  BenchmarkMeshObjectsWithThreads("MeshObjectsFlyingEdgesParallel", volume,
+                                  repetitions, 0,
+                                  meshing::MeshingEngine::kFlyingEdges);
+}
+
+// Meshes `volume` stored with z varying fastest, as the transpose of a C-order
+// array, after copying it with x varying fastest by CopyLabelsXFastest, and
+// reports the speedup over meshing the strided labels directly.
+void BenchmarkMeshObjectsTransposed(const Volume& volume, int repetitions) {
+  const Vector3d& size = volume.size;
+  const Vector3d strides{size[1] * size[2], size[2], 1};
+  std::vector<uint64_t> transposed(volume.labels.size());
+  size_t i = 0;
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x, ++i) {
+        transposed[x * strides[0] + y * strides[1] + z] = volume.labels[i];
+      }
+    }
+  }
+  meshing::DenseLabelMap label_map(
+      meshing::ComputeDistinctLabels(transposed.data(), size, strides));
+  std::vector<TriangleMesh> meshes;
+  const double strided_seconds = TimeBest(repetitions, [&] {
+    meshes.clear();
+    meshing::MeshObjects(transposed.data(), size, strides, label_map, &meshes);
+  });
+  std::vector<uint64_t> copy(volume.labels.size());
+  const Vector3d copy_strides{1, size[0], size[0] * size[1]};
+  double copy_seconds = 0;
+  const double seconds = TimeBest(repetitions, [&] {
+    meshes.clear();
+    copy_seconds = TimeBest(1, [&] {
+      meshing::CopyLabelsXFastest(transposed.data(), size, strides,
+                                  copy.data(), /*num_threads=*/0);
+    });
+    meshing::MeshObjects(copy.data(), size, copy_strides, label_map, &meshes);
+  });
+  PrintResult("MeshObjectsTransposed", volume, seconds, "voxels",
+              GetNumVoxels(volume),
+              "copy_ms=" + std::to_string(copy_seconds * 1e3) +
+                  " speedup=" + std::to_string(strided_seconds / seconds));
+}
+
+// Meshes the compressed_segmentation encoding of `volume` directly, and
+// reports the speedup over decoding it and meshing the dense labels.
+void BenchmarkMeshCompressed(const Volume& volume, int repetitions) {
+  const ptrdiff_t volume_size[3] = {volume.size[0], volume.size[1],
+                                    volume.size[2]};
+  const ptrdiff_t strides[3] = {1, volume.size[0],
+                                volume.size[0] * volume.size[1]};
+  const ptrdiff_t block_size[3] = {8, 8, 8};
+  std::vector<uint32_t> encoded;
+  compress_segmentation::CompressChannel(volume.labels.data(), strides,
+                                         volume_size, block_size, &encoded);
+  std::unordered_map<uint64_t, TriangleMesh> meshes;
+  const double seconds = TimeBest(repetitions, [&] {
+    meshing::MeshCompressedChannel<uint64_t>(
+        encoded.data(), encoded.size(), volume.size,
+        Vector3d{block_size[0], block_size[1], block_size[2]}, &meshes);
+  });
+  std::vector<uint64_t> labels(volume.labels.size());
+  const ptrdiff_t start[3] = {0, 0, 0};
+  const double decode_seconds = TimeBest(repetitions, [&] {
+    compress_segmentation::DecompressChannel(
+        encoded.data(), encoded.size(), volume_size, block_size, start,
+        volume_size, strides, labels.data());
+    meshing::MeshObjects(labels.data(), volume.size,
+                         Vector3d{strides[0], strides[1], strides[2]},
+                         &meshes);
+  });
+  PrintResult("MeshCompressed", volume, seconds, "voxels",
+              GetNumVoxels(volume),
+              "objects=" + std::to_string(meshes.size()) +
+                  " speedup_vs_decode=" +
+                  std::to_string(decode_seconds / seconds));
+}
+
+// Counts the voxels of each label of the encoded volume with CountLabels,
+// compared with decoding it and counting the sorted labels.
+void BenchmarkCountLabels(const Volume& volume, int repetitions) {
+  const ptrdiff_t volume_size[4] = {volume.size[0], volume.size[1],
+                                    volume.size[2], 1};
+  const ptrdiff_t strides[4] = {1, volume.size[0],
+                                volume.size[0] * volume.size[1],
+                                volume.size[0] * volume.size[1] *
+                                    volume.size[2]};
+  const ptrdiff_t block_size[3] = {8, 8, 8};
+  std::vector<uint32_t> encoded;
+  compress_segmentation::CompressChannels(volume.labels.data(), strides,
+                                          volume_size, block_size, &encoded);
+  std::vector<uint64_t> labels, counts;
+  const double seconds = TimeBest(repetitions, [&] {
+    compress_segmentation::CountLabels(encoded.data(), encoded.size(),
+                                       volume_size, block_size, &labels,
+                                       &counts);
+  });
+  std::vector<uint64_t> decoded(volume.labels.size());
+  const ptrdiff_t start[3] = {0, 0, 0};
+  const double decode_seconds = TimeBest(repetitions, [&] {
+    compress_segmentation::DecompressChannels(
+        encoded.data(), encoded.size(), volume_size, block_size, start,
+        volume_size, strides, decoded.data());
+    std::sort(decoded.begin(), decoded.end());
+    labels.clear();
+    counts.clear();
+    for (size_t i = 0; i < decoded.size(); ++i) {
+      if (i == 0 || decoded[i] != decoded[i - 1]) {
+        labels.push_back(decoded[i]);
+        counts.push_back(0);
+      }
+      ++counts.back();
+    }
+  });
+  PrintResult("CountLabels", volume, seconds, "voxels", GetNumVoxels(volume),
+              "labels=" + std::to_string(labels.size()) +
+                  " speedup_vs_decode=" +
+                  std::to_string(decode_seconds / seconds));
+}
+
+// Downsamples the encoded volume by 2 with DownsampleChannels, compared with
+// decoding, downsampling and encoding it.
+void BenchmarkDownsampleCompressed(const Volume& volume, int repetitions) {
+  const ptrdiff_t volume_size[4] = {volume.size[0], volume.size[1],
+                                    volume.size[2], 1};
+  const ptrdiff_t strides[4] = {1, volume.size[0],
+                                volume.size[0] * volume.size[1],
+                                volume.size[0] * volume.size[1] *
+                                    volume.size[2]};
+  const ptrdiff_t block_size[3] = {8, 8, 8};
+  const ptrdiff_t factor[3] = {2, 2, 2};
+  std::vector<uint32_t> encoded, output;
+  compress_segmentation::CompressChannels(volume.labels.data(), strides,
+                                          volume_size, block_size, &encoded);
+  const double seconds = TimeBest(repetitions, [&] {
+    compress_segmentation::DownsampleChannels<uint64_t>(
+        encoded.data(), encoded.size(), volume_size, block_size, factor,
+        &output);
+  });
+  std::vector<uint64_t> labels(volume.labels.size());
+  ptrdiff_t output_size[4] = {1, 1, 1, 1}, output_strides[4];
+  for (int i = 0; i < 3; ++i) {
+    output_size[i] = (volume_size[i] + factor[i] - 1) / factor[i];
+  }
+  output_strides[0] = 1;
+  for (int i = 1; i < 4; ++i) {
+    output_strides[i] = output_strides[i - 1] * output_size[i - 1];
+  }
+  std::vector<uint64_t> downsampled(output_strides[3]);
+  const ptrdiff_t start[3] = {0, 0, 0};
+  const double decode_seconds = TimeBest(repetitions, [&] {
+    compress_segmentation::DecompressChannels(
+        encoded.data(), encoded.size(), volume_size, block_size, start,
+        volume_size, strides, labels.data());
+    downsample::DownsampleWithMode(labels.data(), 3, volume_size, strides,
+                                   factor, downsampled.data(), output_strides);
+    compress_segmentation::CompressChannels(downsampled.data(),
+                                            output_strides, output_size,
+                                            block_size, &output);
+  });
+  PrintResult("DownsampleCompressed", volume, seconds, "voxels",
+              GetNumVoxels(volume),
+              "speedup_vs_decode=" +
+                  std::to_string(decode_seconds / seconds));
+}
+
+// Simplifies the meshes of all objects with each collapse queue.
+void BenchmarkSimplifyMesh(const Volume& volume, int repetitions) {
+  std::vector<TriangleMesh> meshes;
+  ComputeMeshes(volume, &meshes);
+  const size_t num_triangles = CountTriangles(meshes);
+  const struct {
+    const char* name;
+    meshing::SimplifierQueue queue;
+  } kQueues[] = {{"indexed_heap", meshing::SimplifierQueue::kIndexedHeap},
+                 {"lazy_heap", meshing::SimplifierQueue::kLazyHeap}};
+  for (const auto& queue : kQueues) {
+    meshing::SimplifyOptions options;
+    options.engine = meshing::SimplifierEngine::kFlatArrays;
+    options.queue = queue.queue;
+    size_t num_simplified_triangles = 0;
+    const double seconds = TimeBest(repetitions, [&] {
+      num_simplified_triangles = 0;
+      for (const auto& mesh : meshes) {
+        TriangleMesh simplified = mesh;
+        meshing::SimplifyTriangleMesh(options, &simplified);
+        num_simplified_triangles += simplified.triangles.size();
+      }
+    });
+    PrintResult("SimplifyMesh", volume, seconds, "triangles", num_triangles,
+                std::string(queue.name) + " triangles_out=" +
+                    std::to_string(num_simplified_triangles));
+  }
+}
+
+// Computes the mesh of each object from its bounding box with
+// MeshObjectVoxelFaces, as done on demand by OnDemandObjectMeshGenerator with
+// MeshingOptions::voxel_faces, and compares the time to that of MeshObject
+// followed by SimplifyTriangleMesh, as done otherwise in lazy mode.
+void BenchmarkMeshObjectVoxelFaces(const Volume& volume, int repetitions) {
+  const Vector3d strides{1, volume.size[0], volume.size[0] * volume.size[1]};
+  meshing::DenseLabelMap label_map(meshing::ComputeDistinctLabels(
+      volume.labels.data(), volume.size, strides));
+  std::vector<meshing::BoundingBox> boxes;
+  meshing::ComputeBoundingBoxes(volume.labels.data(), volume.size, strides,
+                                label_map, &boxes);
+  size_t num_triangles = 0;
+  const double seconds = TimeBest(repetitions, [&] {
+    num_triangles = 0;
+    TriangleMesh mesh;
+    for (size_t i = 0; i < boxes.size(); ++i) {
+      if (label_map.ids()[i] == 0) continue;
+      meshing::MeshObjectVoxelFaces(volume.labels.data(), volume.size,
+                                    strides, label_map.ids()[i], boxes[i],
+                                    &mesh);
+      num_triangles += mesh.triangles.size();
+    }
+  });
+  meshing::SimplifyOptions options;
+  options.engine = meshing::SimplifierEngine::kFlatArrays;
+  size_t num_simplified_triangles = 0;
+  const double simplified_seconds = TimeBest(repetitions, [&] {
+    num_simplified_triangles = 0;
+    TriangleMesh mesh;
+    for (size_t i = 0; i < boxes.size(); ++i) {
+      if (label_map.ids()[i] == 0) continue;
+      meshing::MeshObject(volume.labels.data(), volume.size, strides,
+                          label_map.ids()[i], boxes[i], &mesh);
+      meshing::SimplifyTriangleMesh(options, &mesh);
+      num_simplified_triangles += mesh.triangles.size();
+    }
+  });
+  PrintResult("MeshObjectVoxelFaces", volume, seconds, "voxels",
+              GetNumVoxels(volume),
+              "objects=" + std::to_string(boxes.size()) +
+                  " triangles=" + std::to_string(num_triangles) +
+                  " simplified_triangles=" +
+                  std::to_string(num_simplified_triangles) +
+                  " speedup=" + std::to_string(simplified_seconds / seconds));
+}
+
+// Encodes the simplified meshes of all objects with each mesh encoding.  The
+// time reported is that of encoding alone, as measured by the generator.
+void BenchmarkEncodeMesh(const Volume& volume, int repetitions) {
+  const int64_t size[3] = {volume.size[0], volume.size[1], volume.size[2]};
+  const int64_t strides[3] = {1, volume.size[0],
+                              volume.size[0] * volume.size[1]};
+  const float voxel_size[3] = {1, 1, 1};
+  const float offset[3] = {0, 0, 0};
+  meshing::SimplifyOptions simplify_options;
+  simplify_options.engine = meshing::SimplifierEngine::kFlatArrays;
+  const struct {
+    const char* name;
+    meshing::MeshEncoding encoding;
+  } kEncodings[] = {{"raw", meshing::MeshEncoding::kRaw},
+                    {"quantized16", meshing::MeshEncoding::kQuantized16},
+                    {"quantized10", meshing::MeshEncoding::kQuantized10}};
+  for (const auto& encoding : kEncodings) {
+    meshing::MeshingOptions meshing_options;
+    meshing_options.encoding = encoding.encoding;
+    meshing::MeshingStatistics best;
+    for (int i = 0; i < repetitions; ++i) {
+      meshing::OnDemandObjectMeshGenerator generator(
+          volume.labels.data(), size, strides, voxel_size, offset,
+          simplify_options, meshing_options);
+      generator.PrecomputeAll(1);
+      const auto statistics = generator.GetMeshingStatistics();
+      if (i == 0 || statistics.encode_ns < best.encode_ns) best = statistics;
+    }
+    const double seconds = std::max(best.encode_ns, uint64_t(1)) * 1e-9;
+    PrintResult("EncodeMesh", volume, seconds, "triangles", best.triangles_out,
+                std::string(encoding.name) +
+                    " bytes_out=" + std::to_string(best.bytes_out));
+  }
+}
+
+}  // namespace
+}  // namespace neuroglancer
+
+int main(int argc, char** argv) {
+  using neuroglancer::Volume;
+  std::string filter, trace_path;
+  int repetitions = 3;
+  std::vector<Volume> volumes;
+  volumes.push_back(neuroglancer::MakeSyntheticVolume(
+      "many_small_objects", {128, 128, 64}, {{8, 8, 8}}));
+  volumes.push_back(neuroglancer::MakeSyntheticVolume(
+      "few_large_objects", {128, 128, 64}, {{64, 64, 32}}));
+  volumes.push_back(neuroglancer::MakeSyntheticVolume(
+      "anisotropic", {128, 128, 64}, {{32, 32, 4}}));
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (!std::strncmp(arg, "--filter=", 9)) {
+      filter = arg + 9;
+    } else if (!std::strncmp(arg, "--repetitions=", 14)) {
+      repetitions = std::max(1, std::atoi(arg + 14));
+    } else if (!std::strncmp(arg, "--raw=", 6)) {
+      Volume volume;
+      if (!neuroglancer::ReadRawVolume(arg + 6, &volume)) {
+        std::fprintf(stderr, "Failed to read raw volume: %s\n", arg + 6);
+        return 1;
+      }
+      volumes.push_back(std::move(volume));
+    } else if (!std::strncmp(arg, "--trace=", 8)) {
+      trace_path = arg + 8;
+    } else {
+      std::fprintf(stderr,
+                   "Usage: %s [--filter=SUBSTRING] [--repetitions=N] "
+                   "[--raw=PATH:X,Y,Z:BYTES_PER_VOXEL]... [--trace=PATH]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+  const struct {
+    const char* name;
+    void (*fn)(const Volume& volume, int repetitions);
+  } kBenchmarks[] = {
+      {"CompressChannels", &neuroglancer::BenchmarkCompressChannels},
+      {"MeshObjects", &neuroglancer::BenchmarkMeshObjects},
+      {"MeshObjectsParallel", &neuroglancer::BenchmarkMeshObjectsParallel},
+      {"MeshObjectsFlyingEdges",
+       &neuroglancer::BenchmarkMeshObjectsFlyingEdges},
+      {"MeshObjectsFlyingEdgesParallel",
+       &neuroglancer::BenchmarkMeshObjectsFlyingEdgesParallel},
+      {"MeshObjectsTransposed",
+       &neuroglancer::BenchmarkMeshObjectsTransposed},
+      {"MeshCompressed", &neuroglancer::BenchmarkMeshCompressed},
+      {"CountLabels", &neuroglancer::BenchmarkCountLabels},
+      {"DownsampleCompressed",
+       &neuroglancer::BenchmarkDownsampleCompressed},
+      {"SimplifyMesh", &neuroglancer::BenchmarkSimplifyMesh},
+      {"MeshObjectVoxelFaces", &neuroglancer::BenchmarkMeshObjectVoxelFaces},
+      {"EncodeMesh", &neuroglancer::BenchmarkEncodeMesh},
+  };
+  neuroglancer::trace_events::SetEnabled(!trace_path.empty());
+  for (const auto& benchmark : kBenchmarks) {
+    for (const auto& volume : volumes) {
+      const std::string name = std::string(benchmark.name) + "/" + volume.name;
+      if (name.find(filter) == std::string::npos) continue;
+      benchmark.fn(volume, repetitions);
+    }
+  }
+  if (!trace_path.empty()) {
+    std::ofstream trace(trace_path, std::ios::binary);
+    trace << neuroglancer::trace_events::GetChromeTraceJson();
+    if (!trace) {
+      std::fprintf(stderr, "Failed to write trace: %s\n", trace_path.c_str());
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -15,7 +15,16 @@
  */
 
 #include "on_demand_object_mesh_generator.h"
+#include "downsample.h"
 #include "mesh_objects.h"
+#include "parallel_for.h"
+#include "quadric_simplifier.h"
+#include "shared_memory_cache.h"
+#include "sharding.h"
+#include "trace_events.h"
+#include "vertex_cache_optimizer.h"
+#include "voxel_faces.h"
+#include "worker_pool.h"
 
 #include "OpenMesh/Core/Mesh/TriMeshT.hh"
 #if OM_VERSION == 0x10000
@@ -27,12 +36,33 @@
 #include "OpenMesh/Tools/Decimater/ModNormalFlippingT.hh"
 #include "OpenMesh/Tools/Decimater/ModQuadricT.hh"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 #if __APPLE__
 #include <libkern/OSByteOrder.h>
+#define htole16(x) OSSwapHostToLittleInt16(x)
 #define htole32(x) OSSwapHostToLittleInt32(x)
 #elif defined(_WIN32)
+#define htole16(x) (x)
 #define htole32(x) (x)
 #else
 #include <endian.h>
@@ -51,59 +81,106 @@ void ConvertToOpenMeshTriangleMesh(const TriangleMesh& mesh,
                                    OpenMeshTriangleMesh* new_mesh,
                                    const std::array<float, 3>& voxel_size,
                                    const std::array<float, 3>& offset) {
-  for (auto vertex : mesh.vertex_positions) {
-    for (int i = 0; i < 3; ++i) {
-      vertex[i] = (vertex[i] + offset[i]) * voxel_size[i];
-    }
-    new_mesh->add_vertex(OpenMeshTriangleMesh::Point(vertex[0], vertex[1], vertex[2]));
+  // Reserve the kernel arrays up front.  By Euler's formula, a closed surface
+  // has about `num_vertices + num_faces` edges.
+  const size_t num_vertices = mesh.vertex_positions.size();
+  const size_t num_faces = mesh.triangles.size();
+  trace_events::Span span("ConvertToOpenMeshTriangleMesh", "triangles",
+                          num_faces);
+  new_mesh->reserve(num_vertices, num_vertices + num_faces, num_faces);
+  for (auto const& vertex : mesh.vertex_positions) {
+    new_mesh->add_vertex(OpenMeshTriangleMesh::Point(
+        (vertex[0] + offset[0]) * voxel_size[0],
+        (vertex[1] + offset[1]) * voxel_size[1],
+        (vertex[2] + offset[2]) * voxel_size[2]));
   }
-  std::vector<OpenMeshTriangleMesh::VertexHandle> triangle_vhandles(3);
+  // Vertex handles are the dense indices assigned by add_vertex.
+  using VertexHandle = OpenMeshTriangleMesh::VertexHandle;
   for (auto const& triangle : mesh.triangles) {
-    for (int i = 0; i < 3; ++i) {
-      triangle_vhandles[i] = new_mesh->vertex_handle(triangle[i]);
-    }
-    new_mesh->add_face(triangle_vhandles);
+    // Unlike the std::vector overload, this does not allocate per face.
+    new_mesh->add_face(VertexHandle(triangle[0]), VertexHandle(triangle[1]),
+                       VertexHandle(triangle[2]));
 
     // We silently skip triangles that result in degeneracy.
   }
 }
 
-std::string EncodeMesh(const OpenMeshTriangleMesh& mesh) {
+// Accessors that allow the encoders below to write either an
+// OpenMeshTriangleMesh or a TriangleMesh.
+size_t NumVertices(const OpenMeshTriangleMesh& mesh) {
+  return mesh.n_vertices();
+}
+
+size_t NumTriangles(const OpenMeshTriangleMesh& mesh) { return mesh.n_faces(); }
+
+// Calls `fn(const float* position)` for each vertex in order.
+template <class Fn>
+void ForEachVertexPosition(const OpenMeshTriangleMesh& mesh, Fn fn) {
+  for (auto vertex_it = mesh.vertices_begin(); vertex_it != mesh.vertices_end();
+       ++vertex_it) {
+    fn(mesh.point(vertex_it.handle()).data());
+  }
+}
+
+// Calls `fn(uint32_t vertex_index)` for each vertex of each triangle in order.
+template <class Fn>
+void ForEachTriangleVertex(const OpenMeshTriangleMesh& mesh, Fn fn) {
+  for (auto face_it = mesh.faces_begin(); face_it != mesh.faces_end();
+       ++face_it) {
+    auto circ = mesh.cfh_iter(face_it.handle());
+    for (int i = 0; i < 3; ++i, ++circ) {
+      fn(static_cast<uint32_t>(mesh.to_vertex_handle(circ.handle()).idx()));
+    }
+  }
+}
+
+size_t NumVertices(const TriangleMesh& mesh) {
+  return mesh.vertex_positions.size();
+}
+
+size_t NumTriangles(const TriangleMesh& mesh) { return mesh.triangles.size(); }
+
+template <class Fn>
+void ForEachVertexPosition(const TriangleMesh& mesh, Fn fn) {
+  for (const auto& position : mesh.vertex_positions) fn(position.data());
+}
+
+template <class Fn>
+void ForEachTriangleVertex(const TriangleMesh& mesh, Fn fn) {
+  for (const auto& triangle : mesh.triangles) {
+    for (int i = 0; i < 3; ++i) fn(triangle[i]);
+  }
+}
+
+template <class Mesh>
+std::string EncodeRawMesh(const Mesh& mesh) {
   std::string output;
   size_t output_size = sizeof(uint32_t);
   const size_t vertex_offset = output_size;
-  output_size += sizeof(float) * mesh.n_vertices() * 3;
+  output_size += sizeof(float) * NumVertices(mesh) * 3;
   const size_t triangle_offset = output_size;
-  output_size += mesh.n_faces() * 3 * sizeof(uint32_t);
+  output_size += NumTriangles(mesh) * 3 * sizeof(uint32_t);
   output.resize(output_size);
 
   // Write number of vertices.
-  *reinterpret_cast<uint32_t*>(&output[0]) = mesh.n_vertices();
+  *reinterpret_cast<uint32_t*>(&output[0]) = NumVertices(mesh);
 
   // Write vertices.
   {
     float* vertex_buffer = reinterpret_cast<float*>(&output[vertex_offset]);
-    for (auto vertex_it = mesh.vertices_begin();
-         vertex_it != mesh.vertices_end(); ++vertex_it) {
-      auto const& pt = mesh.point(vertex_it.handle());
+    ForEachVertexPosition(mesh, [&](const float* pt) {
       for (int i = 0; i < 3; ++i) {
         *(vertex_buffer++) = pt[i];
       }
-    }
+    });
   }
 
   // Write triangles.
   {
     uint32_t* index_buffer =
         reinterpret_cast<uint32_t*>(&output[triangle_offset]);
-    for (auto face_it = mesh.faces_begin(); face_it != mesh.faces_end();
-         ++face_it) {
-      auto circ = mesh.cfh_iter(face_it.handle());
-      for (int i = 0; i < 3; ++i, ++circ) {
-        auto vh = mesh.to_vertex_handle(circ.handle());
-        *(index_buffer++) = vh.idx();
-      }
-    }
+    ForEachTriangleVertex(mesh,
+                          [&](uint32_t index) { *(index_buffer++) = index; });
   }
   // Encoded mesh is a sequence of 32-bit values.  We need to convert
   // to little endian.
@@ -115,7 +192,273 @@ std::string EncodeMesh(const OpenMeshTriangleMesh& mesh) {
   return output;
 }
 
-bool SimplifyMesh(const SimplifyOptions& options, OpenMeshTriangleMesh* mesh) {
+template <class T>
+void StoreLittleEndian(T value, char* output);
+
+template <>
+void StoreLittleEndian(uint16_t value, char* output) {
+  value = htole16(value);
+  std::memcpy(output, &value, sizeof(value));
+}
+
+template <>
+void StoreLittleEndian(uint32_t value, char* output) {
+  value = htole32(value);
+  std::memcpy(output, &value, sizeof(value));
+}
+
+template <>
+void StoreLittleEndian(float value, char* output) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(value));
+  StoreLittleEndian(bits, output);
+}
+
+template <class Index, class Mesh>
+void EncodeTriangleIndices(const Mesh& mesh, char* output) {
+  ForEachTriangleVertex(mesh, [&](uint32_t index) {
+    StoreLittleEndian(static_cast<Index>(index), output);
+    output += sizeof(Index);
+  });
+}
+
+// Returns the sum of the cross products of the edges of the triangles of each
+// vertex of `mesh`, as for VertexNormalEncoding.
+template <class Mesh>
+std::vector<std::array<float, 3>> ComputeVertexNormals(const Mesh& mesh) {
+  std::vector<std::array<float, 3>> positions;
+  positions.reserve(NumVertices(mesh));
+  ForEachVertexPosition(mesh, [&](const float* position) {
+    positions.push_back({{position[0], position[1], position[2]}});
+  });
+  std::vector<std::array<float, 3>> normals(positions.size(), {{0, 0, 0}});
+  uint32_t triangle[3];
+  int num_vertices = 0;
+  ForEachTriangleVertex(mesh, [&](uint32_t vertex_index) {
+    triangle[num_vertices++] = vertex_index;
+    if (num_vertices < 3) return;
+    num_vertices = 0;
+    float edges[2][3];
+    for (int i = 0; i < 2; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        edges[i][j] = positions[triangle[i + 1]][j] - positions[triangle[0]][j];
+      }
+    }
+    float normal[3];
+    for (int j = 0; j < 3; ++j) {
+      normal[j] = edges[0][(j + 1) % 3] * edges[1][(j + 2) % 3] -
+                  edges[0][(j + 2) % 3] * edges[1][(j + 1) % 3];
+    }
+    for (const uint32_t vertex : triangle) {
+      for (int j = 0; j < 3; ++j) normals[vertex][j] += normal[j];
+    }
+  });
+  return normals;
+}
+
+// Appends the normals of the vertices of `mesh` to `output` in the octahedral
+// encoding with `bits` (8 or 16) bits per integer, padded with zeros to a
+// multiple of 4 bytes.  Vertices without triangles have the encoding (0, 0).
+template <class Mesh>
+void AppendVertexNormals(const Mesh& mesh, int bits, std::string* output) {
+  const auto normals = ComputeVertexNormals(mesh);
+  const size_t integer_size = bits / 8;
+  size_t offset = output->size();
+  output->resize(offset + (normals.size() * 2 * integer_size + 3) / 4 * 4,
+                 '\0');
+  const float max_value = (1 << (bits - 1)) - 1;
+  for (const auto& normal : normals) {
+    const float l1_norm =
+        std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]);
+    float encoded[2] = {0, 0};
+    if (l1_norm > 0) {
+      const float x = normal[0] / l1_norm, y = normal[1] / l1_norm;
+      if (normal[2] < 0) {
+        // Fold the lower hemisphere over the diagonals.
+        encoded[0] = (1 - std::abs(y)) * (x < 0 ? -1 : 1);
+        encoded[1] = (1 - std::abs(x)) * (y < 0 ? -1 : 1);
+      } else {
+        encoded[0] = x;
+        encoded[1] = y;
+      }
+    }
+    for (const float value : encoded) {
+      const long quantized = std::lround(
+          std::min(1.0f, std::max(-1.0f, value)) * max_value);
+      if (bits == 8) {
+        (*output)[offset] = static_cast<char>(static_cast<int8_t>(quantized));
+      } else {
+        StoreLittleEndian(
+            static_cast<uint16_t>(static_cast<int16_t>(quantized)),
+            &(*output)[offset]);
+      }
+      offset += integer_size;
+    }
+  }
+}
+
+// Returns the number of bits per integer of `vertex_normals`, or 0 if none.
+int GetVertexNormalBits(VertexNormalEncoding vertex_normals) {
+  switch (vertex_normals) {
+    case VertexNormalEncoding::kOctahedral8:
+      return 8;
+    case VertexNormalEncoding::kOctahedral16:
+      return 16;
+    case VertexNormalEncoding::kNone:
+    default:
+      return 0;
+  }
+}
+
+// Encodes `mesh` in the MeshEncoding::kQuantized16 or kQuantized10 format,
+// with vertex normals of `normal_bits` bits per integer if non-zero.
+template <class Mesh>
+std::string EncodeQuantizedMesh(const Mesh& mesh, int position_bits,
+                                int normal_bits) {
+  const size_t num_vertices = NumVertices(mesh);
+  const size_t num_triangles = NumTriangles(mesh);
+  std::array<float, 3> origin, scale;
+  {
+    std::array<float, 3> max_position;
+    origin.fill(0);
+    max_position.fill(0);
+    bool first = true;
+    ForEachVertexPosition(mesh, [&](const float* pt) {
+      for (int i = 0; i < 3; ++i) {
+        origin[i] = first ? pt[i] : std::min(origin[i], pt[i]);
+        max_position[i] = first ? pt[i] : std::max(max_position[i], pt[i]);
+      }
+      first = false;
+    });
+    const float max_quantized = (1 << position_bits) - 1;
+    for (int i = 0; i < 3; ++i) {
+      scale[i] = (max_position[i] - origin[i]) / max_quantized;
+    }
+  }
+
+  const size_t header_size = 10 * sizeof(uint32_t);
+  const size_t positions_size =
+      position_bits == 16 ? (num_vertices * 3 * sizeof(uint16_t) + 3) / 4 * 4
+                          : num_vertices * sizeof(uint32_t);
+  const size_t index_size =
+      num_vertices <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+  std::string output(header_size + positions_size +
+                         num_triangles * 3 * index_size,
+                     '\0');
+  char* header = &output[0];
+  StoreLittleEndian(uint32_t(0xffffffff), header);
+  StoreLittleEndian(static_cast<uint32_t>(position_bits | (normal_bits << 8)),
+                    header + 4);
+  StoreLittleEndian(static_cast<uint32_t>(num_vertices), header + 8);
+  StoreLittleEndian(static_cast<uint32_t>(num_triangles), header + 12);
+  for (int i = 0; i < 3; ++i) {
+    StoreLittleEndian(origin[i], header + 16 + 4 * i);
+    StoreLittleEndian(scale[i], header + 28 + 4 * i);
+  }
+
+  {
+    char* position_buffer = &output[header_size];
+    ForEachVertexPosition(mesh, [&](const float* pt) {
+      uint32_t q[3];
+      for (int i = 0; i < 3; ++i) {
+        q[i] = scale[i] == 0
+                   ? 0
+                   : static_cast<uint32_t>(
+                         std::lround((pt[i] - origin[i]) / scale[i]));
+      }
+      if (position_bits == 16) {
+        for (int i = 0; i < 3; ++i) {
+          StoreLittleEndian(static_cast<uint16_t>(q[i]), position_buffer);
+          position_buffer += sizeof(uint16_t);
+        }
+      } else {
+        StoreLittleEndian(q[0] | (q[1] << 10) | (q[2] << 20), position_buffer);
+        position_buffer += sizeof(uint32_t);
+      }
+    });
+  }
+
+  char* index_buffer = &output[header_size + positions_size];
+  if (index_size == sizeof(uint16_t)) {
+    EncodeTriangleIndices<uint16_t>(mesh, index_buffer);
+  } else {
+    EncodeTriangleIndices<uint32_t>(mesh, index_buffer);
+  }
+  if (normal_bits != 0) {
+    output.resize((output.size() + 3) / 4 * 4, '\0');
+    AppendVertexNormals(mesh, normal_bits, &output);
+  }
+  return output;
+}
+
+template <class Mesh>
+std::string EncodeMesh(const Mesh& mesh, MeshEncoding encoding,
+                       VertexNormalEncoding vertex_normals) {
+  trace_events::Span span("EncodeMesh", "triangles", NumTriangles(mesh));
+  const int normal_bits = GetVertexNormalBits(vertex_normals);
+  switch (encoding) {
+    case MeshEncoding::kQuantized16:
+      return EncodeQuantizedMesh(mesh, 16, normal_bits);
+    case MeshEncoding::kQuantized10:
+      return EncodeQuantizedMesh(mesh, 10, normal_bits);
+    case MeshEncoding::kRaw:
+    default: {
+      std::string output = EncodeRawMesh(mesh);
+      if (normal_bits != 0) {
+        AppendVertexNormals(mesh, normal_bits, &output);
+        output.resize(output.size() + 4);
+        StoreLittleEndian(uint32_t(0xffffff00) | normal_bits,
+                          &output[output.size() - 4]);
+      }
+      return output;
+    }
+  }
+}
+
+// Returns the nanoseconds elapsed since `*start`, and resets `*start` to the
+// current time.
+uint64_t LapNanoseconds(std::chrono::steady_clock::time_point* start) {
+  const auto now = std::chrono::steady_clock::now();
+  const auto elapsed = now - *start;
+  *start = now;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+// Encodes `mesh`, first reordering a copy of it as by OptimizeVertexCache if
+// `optimize_vertex_cache` is true.
+template <class Mesh>
+std::string EncodeLod(const Mesh& mesh, MeshEncoding encoding,
+                      bool optimize_vertex_cache,
+                      VertexNormalEncoding vertex_normals) {
+  if (!optimize_vertex_cache) {
+    return EncodeMesh(mesh, encoding, vertex_normals);
+  }
+  TriangleMesh reordered;
+  reordered.vertex_positions.reserve(NumVertices(mesh));
+  ForEachVertexPosition(mesh, [&](const float* position) {
+    reordered.vertex_positions.push_back(
+        {{position[0], position[1], position[2]}});
+  });
+  reordered.triangles.resize(NumTriangles(mesh));
+  size_t i = 0;
+  ForEachTriangleVertex(mesh, [&](uint32_t vertex_index) {
+    reordered.triangles[i / 3][i % 3] = vertex_index;
+    ++i;
+  });
+  {
+    trace_events::Span span("OptimizeVertexCache", "triangles",
+                            reordered.triangles.size());
+    OptimizeVertexCache(&reordered);
+  }
+  return EncodeMesh(reordered, encoding, vertex_normals);
+}
+
+// Simplifies `mesh` according to `options`.  If `max_triangles` is non-zero,
+// simplification continues beyond the maximum quadrics error until the mesh has
+// at most `max_triangles` triangles or no further collapse is legal.
+bool SimplifyMesh(const SimplifyOptions& options, OpenMeshTriangleMesh* mesh,
+                  size_t max_triangles = 0) {
+  trace_events::Span span("SimplifyMesh", "triangles", mesh->n_faces());
   if (options.lock_boundary_vertices) {
     mesh->request_vertex_status();
     for (auto it = mesh->vertices_begin(), end = mesh->vertices_end();
@@ -145,76 +488,2133 @@ bool SimplifyMesh(const SimplifyOptions& options, OpenMeshTriangleMesh* mesh) {
   }
   decimater.decimate_to(0);
   mesh->garbage_collection();
+#if OM_VERSION != 0x10000
+  // The quadrics accumulated so far are retained by the decimater.
+  if (max_triangles != 0 && mesh->n_faces() > max_triangles) {
+    decimater.module(quadrics_module).unset_max_err();
+    decimater.decimate_to_faces(0, max_triangles);
+    mesh->garbage_collection();
+  }
+#endif
   mesh->release_face_normals();
   return true;
 }
 
-struct OnDemandObjectMeshGenerator::Impl {
-  std::unordered_map<uint64_t, TriangleMesh> unsimplified_meshes;
-  std::unordered_map<uint64_t, std::string> simplified_meshes;
-  std::array<float,3> voxel_size, offset;
-  SimplifyOptions simplify_options;
-};
+bool SimplifyMesh(const SimplifyOptions& options, TriangleMesh* mesh,
+                  size_t max_triangles = 0) {
+  trace_events::Span span("SimplifyMesh", "triangles", mesh->triangles.size());
+  SimplifyTriangleMesh(options, mesh, max_triangles);
+  return true;
+}
+
+// Computes and encodes successive levels of detail from `mesh`, which has
+// `num_unsimplified_triangles` triangles, in place.  Adds the simplification
+// and encoding times and the output sizes to `statistics`.
+template <class Mesh>
+void SimplifyAndEncodeLods(SimplifyOptions options,
+                           size_t num_unsimplified_triangles,
+                           MeshEncoding encoding, bool optimize_vertex_cache,
+                           VertexNormalEncoding vertex_normals, Mesh* mesh,
+                           std::string* encoded_lods,
+                           MeshingStatistics* statistics) {
+  size_t max_triangles = options.max_triangles;
+  if (options.max_triangle_ratio > 0) {
+    const size_t ratio_max_triangles = std::max<size_t>(
+        1, options.max_triangle_ratio * num_unsimplified_triangles);
+    max_triangles = max_triangles == 0
+                        ? ratio_max_triangles
+                        : std::min(max_triangles, ratio_max_triangles);
+  }
+  auto lap_start = std::chrono::steady_clock::now();
+  // Each level of detail is derived from the previous level.
+  for (int level = 0; level < options.num_lods; ++level) {
+    if (options.max_quadrics_error >= 0 || max_triangles != 0) {
+      if (!SimplifyMesh(options, mesh, max_triangles)) {
+        // Can't happen.
+        return;
+      }
+    }
+    statistics->simplify_ns += LapNanoseconds(&lap_start);
+    std::string encoded =
+        EncodeLod(*mesh, encoding, optimize_vertex_cache, vertex_normals);
+    statistics->encode_ns += LapNanoseconds(&lap_start);
+    // The encoded size is roughly proportional to the number of triangles, so
+    // this converges after few iterations.
+    while (options.max_mesh_bytes != 0 &&
+           encoded.size() > options.max_mesh_bytes) {
+      const size_t num_triangles = NumTriangles(*mesh);
+      if (num_triangles <= 1) break;
+      const size_t target_triangles = std::max<size_t>(
+          1, std::min<size_t>(num_triangles - 1,
+                              static_cast<double>(num_triangles) *
+                                  options.max_mesh_bytes / encoded.size()));
+      SimplifyMesh(options, mesh, target_triangles);
+      statistics->simplify_ns += LapNanoseconds(&lap_start);
+      if (NumTriangles(*mesh) == num_triangles) {
+        // No further collapse is legal.
+        break;
+      }
+      encoded =
+          EncodeLod(*mesh, encoding, optimize_vertex_cache, vertex_normals);
+      statistics->encode_ns += LapNanoseconds(&lap_start);
+    }
+    statistics->triangles_out += NumTriangles(*mesh);
+    statistics->bytes_out += encoded.size();
+    encoded_lods[level] = std::move(encoded);
+    options.max_quadrics_error *= options.lod_quadrics_error_factor;
+  }
+}
+
+namespace {
+
+// Version of the files stored in MeshingOptions::cache_directory, which is
+// part of the hash that names them, so that files written by versions that
+// encode or simplify meshes differently are ignored.
+constexpr uint64_t kMeshCacheVersion = 1;
+
+// Mixes `value` into `hash`.
+inline uint64_t MixHash(uint64_t hash, uint64_t value) {
+  hash = (hash ^ value) * 0x9e3779b97f4a7c15ull;
+  return hash ^ (hash >> 32);
+}
+
+inline uint64_t MixHash(uint64_t hash, double value) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return MixHash(hash, bits);
+}
 
+// Returns a hash of the label values and the size of the volume, computed
+// over z planes in parallel with `num_threads` threads.
 template <class Label>
-OnDemandObjectMeshGenerator::OnDemandObjectMeshGenerator(
-    const Label* labels, const int64_t* size, const int64_t* strides,
-    const float voxel_size[3], const float offset[3],
-    const SimplifyOptions& simplify_options)
-    : impl_(new Impl) {
+uint64_t HashLabels(const Label* labels, const Vector3d& size,
+                    const Vector3d& strides, int num_threads) {
+  std::vector<uint64_t> plane_hashes(size[2]);
+  ParallelFor(plane_hashes.size(), num_threads, [&](size_t z) {
+    uint64_t hash = z;
+    for (int64_t y = 0; y < size[1]; ++y) {
+      const Label* row = labels + z * strides[2] + y * strides[1];
+      for (int64_t x = 0; x < size[0]; ++x) {
+        hash = MixHash(hash, static_cast<uint64_t>(row[x * strides[0]]));
+      }
+    }
+    plane_hashes[z] = hash;
+  });
+  uint64_t hash = kMeshCacheVersion;
   for (int i = 0; i < 3; ++i) {
-    impl_->voxel_size[i] = voxel_size[i];
-    impl_->offset[i] = offset[i];
+    hash = MixHash(hash, static_cast<uint64_t>(size[i]));
   }
-  impl_->simplify_options = simplify_options;
-  MeshObjects(labels, {size[0], size[1], size[2]},
-              {strides[0], strides[1], strides[2]},
-              &impl_->unsimplified_meshes);
+  for (const uint64_t plane_hash : plane_hashes) {
+    hash = MixHash(hash, plane_hash);
+  }
+  return hash;
+}
+
+// Mixes into `hash` all options that affect the encoded meshes of an object
+// with a given unsimplified mesh.
+uint64_t HashEncodeOptions(uint64_t hash, const float voxel_size[3],
+                           const float offset[3],
+                           const SimplifyOptions& simplify_options,
+                           MeshEncoding encoding, bool optimize_vertex_cache,
+                           VertexNormalEncoding vertex_normals,
+                           bool voxel_faces) {
+  for (int i = 0; i < 3; ++i) {
+    hash = MixHash(hash, static_cast<double>(voxel_size[i]));
+    hash = MixHash(hash, static_cast<double>(offset[i]));
+  }
+  const auto& s = simplify_options;
+  hash = MixHash(hash, s.max_quadrics_error);
+  hash = MixHash(hash, s.max_normal_angle_deviation);
+  hash = MixHash(hash, static_cast<uint64_t>(s.lock_boundary_vertices));
+  hash = MixHash(hash, static_cast<uint64_t>(s.num_lods));
+  hash = MixHash(hash, s.lod_quadrics_error_factor);
+  hash = MixHash(hash, static_cast<uint64_t>(s.max_triangles));
+  hash = MixHash(hash, s.max_triangle_ratio);
+  hash = MixHash(hash, static_cast<uint64_t>(s.max_mesh_bytes));
+  hash = MixHash(hash, static_cast<uint64_t>(s.engine));
+  hash = MixHash(hash, static_cast<uint64_t>(s.partition_triangles));
+  hash = MixHash(hash, static_cast<uint64_t>(s.queue));
+  hash = MixHash(hash, static_cast<uint64_t>(encoding));
+  hash = MixHash(hash, static_cast<uint64_t>(optimize_vertex_cache));
+  hash = MixHash(hash, static_cast<uint64_t>(vertex_normals));
+  // Only mixed in if set, so that the hashes of other meshes are unchanged.
+  if (voxel_faces) hash = MixHash(hash, uint64_t(1));
+  return hash;
 }
 
+// Mixes into `hash` all options that affect the encoded meshes.
+uint64_t HashMeshOptions(uint64_t hash, const float voxel_size[3],
+                         const float offset[3],
+                         const SimplifyOptions& simplify_options,
+                         const MeshingOptions& meshing_options) {
+  hash = HashEncodeOptions(hash, voxel_size, offset, simplify_options,
+                           meshing_options.encoding,
+                           meshing_options.optimize_vertex_cache,
+                           meshing_options.vertex_normals,
+                           meshing_options.voxel_faces);
+  // The lengths separate the labels of the equivalences from the allowed ids.
+  const auto* equivalences = meshing_options.equivalences.get();
+  const size_t num_equivalences = equivalences ? equivalences->labels().size()
+                                               : 0;
+  hash = MixHash(hash, static_cast<uint64_t>(num_equivalences));
+  for (size_t i = 0; i < num_equivalences; ++i) {
+    hash = MixHash(hash, equivalences->labels()[i]);
+    hash = MixHash(hash, equivalences->object_ids()[i]);
+  }
+  const auto* allowed_ids = meshing_options.allowed_ids.get();
+  hash = MixHash(hash, static_cast<uint64_t>(allowed_ids ? 1 : 0));
+  if (allowed_ids) {
+    hash = MixHash(hash, static_cast<uint64_t>(allowed_ids->size()));
+    for (const uint64_t id : *allowed_ids) hash = MixHash(hash, id);
+  }
+  return hash;
+}
 
-const std::string& OnDemandObjectMeshGenerator::GetSimplifiedMesh(
-    uint64_t object_id) {
-  const static std::string empty_string;
+// Files in MeshingOptions::cache_directory store the encoded levels of detail
+// of an object as the uint64le size of each level followed by their contents.
+// Reads the file `path` into `lods`, which has the expected number of levels,
+// and returns true, or leaves `lods` unchanged if the file is missing or
+// invalid.
+bool ReadCachedLods(const std::string& path, std::vector<std::string>* lods) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) return false;
+  const uint64_t file_size = static_cast<uint64_t>(file.tellg());
+  const uint64_t header_size = lods->size() * 8;
+  if (file_size < header_size) return false;
+  std::string header(header_size, '\0');
+  file.seekg(0);
+  file.read(&header[0], header_size);
+  std::vector<std::string> result(lods->size());
+  uint64_t total_size = header_size;
+  for (size_t i = 0; i < result.size(); ++i) {
+    uint64_t lod_size = 0;
+    for (int j = 0; j < 8; ++j) {
+      lod_size |= uint64_t(static_cast<unsigned char>(header[i * 8 + j]))
+                  << (8 * j);
+    }
+    if (lod_size > file_size - total_size) return false;
+    total_size += lod_size;
+    result[i].resize(lod_size);
+  }
+  if (total_size != file_size) return false;
+  for (auto& lod : result) {
+    if (!lod.empty()) file.read(&lod[0], lod.size());
+  }
+  if (!file) return false;
+  lods->swap(result);
+  return true;
+}
+
+// Stores `lods` in the file `path`, which is replaced atomically so that
+// concurrent readers, possibly in other processes, never see a partial file.
+bool WriteCachedLods(const std::string& path,
+                     const std::vector<std::string>& lods) {
+  std::string header(lods.size() * 8, '\0');
+  for (size_t i = 0; i < lods.size(); ++i) {
+    const uint64_t lod_size = lods[i].size();
+    StoreLittleEndian(static_cast<uint32_t>(lod_size), &header[i * 8]);
+    StoreLittleEndian(static_cast<uint32_t>(lod_size >> 32),
+                      &header[i * 8 + 4]);
+  }
+  const std::string temp_path =
+      path + ".tmp" +
+      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+      "_" +
+      std::to_string(
+          std::chrono::steady_clock::now().time_since_epoch().count());
   {
-    auto it = impl_->simplified_meshes.find(object_id);
-    if (it != impl_->simplified_meshes.end()) {
-      return it->second;
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    file.write(header.data(), header.size());
+    for (const auto& lod : lods) file.write(lod.data(), lod.size());
+    file.close();
+    if (!file) {
+      std::remove(temp_path.c_str());
+      return false;
     }
   }
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Returns a hash of the vertex positions and triangles of `mesh`.
+uint64_t HashTriangleMesh(const TriangleMesh& mesh) {
+  uint64_t hash = MixHash(kMeshCacheVersion,
+                          static_cast<uint64_t>(mesh.vertex_positions.size()));
+  for (const auto& position : mesh.vertex_positions) {
+    uint32_t bits[3];
+    std::memcpy(bits, position.data(), sizeof(bits));
+    hash = MixHash(hash, bits[0] | static_cast<uint64_t>(bits[1]) << 32);
+    hash = MixHash(hash, static_cast<uint64_t>(bits[2]));
+  }
+  hash = MixHash(hash, static_cast<uint64_t>(mesh.triangles.size()));
+  for (const auto& triangle : mesh.triangles) {
+    hash = MixHash(hash, triangle[0] | static_cast<uint64_t>(triangle[1])
+                                           << 32);
+    hash = MixHash(hash, static_cast<uint64_t>(triangle[2]));
+  }
+  return hash;
+}
 
-  auto it = impl_->unsimplified_meshes.find(object_id);
+// Process-wide store of the encoded levels of detail of objects, keyed by a
+// hash of their unsimplified mesh and encoding options, which is shared by all
+// generators (see SetSharedMeshStoreCapacity).
+class SharedMeshStore {
+ public:
+  using EncodedLods = std::vector<std::string>;
 
-  if (it == impl_->unsimplified_meshes.end()) {
-    return empty_string;
+  size_t capacity() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_bytes_;
   }
-  TriangleMesh& unsimplified_mesh = it->second;
-  OpenMeshTriangleMesh triangle_mesh;
-  ConvertToOpenMeshTriangleMesh(unsimplified_mesh, &triangle_mesh, impl_->voxel_size,
-                        impl_->offset);
-  impl_->unsimplified_meshes.erase(object_id);
-  auto simplify_options = impl_->simplify_options;
-  if (simplify_options.max_quadrics_error >= 0) {
-    double voxel_volume = 1;
-    for (int i = 0; i < 3; ++i) {
-      voxel_volume *= impl_->voxel_size[i];
+
+  void SetCapacity(size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_bytes_ = max_bytes;
+    Evict();
+  }
+
+  // Returns the stored meshes with the specified key, or null if not stored.
+  std::shared_ptr<const EncodedLods> Find(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end()) return nullptr;
+    lru_list_.splice(lru_list_.begin(), lru_list_, it->second.lru_position);
+    return it->second.meshes;
+  }
+
+  // Stores `meshes` with the specified key, evicting the least recently used
+  // meshes to stay within the capacity.
+  void Insert(uint64_t key, std::shared_ptr<const EncodedLods> meshes) {
+    size_t num_bytes = 0;
+    for (const auto& mesh : *meshes) num_bytes += mesh.size();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (num_bytes > max_bytes_ || entries_.count(key)) return;
+    lru_list_.push_front(key);
+    entries_[key] = Entry{std::move(meshes), num_bytes, lru_list_.begin()};
+    num_bytes_ += num_bytes;
+    Evict();
+  }
+
+ private:
+  struct Entry {
+    std::shared_ptr<const EncodedLods> meshes;
+    size_t num_bytes;
+    std::list<uint64_t>::iterator lru_position;
+  };
+
+  // Must be called with `mutex_` held.
+  void Evict() {
+    while (num_bytes_ > max_bytes_) {
+      auto it = entries_.find(lru_list_.back());
+      num_bytes_ -= it->second.num_bytes;
+      entries_.erase(it);
+      lru_list_.pop_back();
+    }
+  }
+
+  std::mutex mutex_;
+  size_t max_bytes_ = 0;
+  size_t num_bytes_ = 0;
+  std::unordered_map<uint64_t, Entry> entries_;
+  // Keys of the stored meshes, most recently used first.
+  std::list<uint64_t> lru_list_;
+};
+
+// Never destroyed, since generators may still be in use at exit.
+SharedMeshStore& GetSharedMeshStore() {
+  static SharedMeshStore* store = new SharedMeshStore;
+  return *store;
+}
+
+// Shared memory segment set by SetSharedMeshSegment, or null.
+struct SharedMeshSegment {
+  std::mutex mutex;
+  std::shared_ptr<SharedMemoryCache> cache;
+};
+
+SharedMeshSegment& GetSharedMeshSegment() {
+  static SharedMeshSegment* segment = new SharedMeshSegment;
+  return *segment;
+}
+
+// Returns the levels of detail `lods[0, num_lods)` in the format of the files
+// in MeshingOptions::cache_directory.
+std::string SerializeLods(const std::string* lods, int num_lods) {
+  size_t total_size = num_lods * 8;
+  for (int i = 0; i < num_lods; ++i) total_size += lods[i].size();
+  std::string serialized(num_lods * 8, '\0');
+  serialized.reserve(total_size);
+  for (int i = 0; i < num_lods; ++i) {
+    const uint64_t lod_size = lods[i].size();
+    StoreLittleEndian(static_cast<uint32_t>(lod_size), &serialized[i * 8]);
+    StoreLittleEndian(static_cast<uint32_t>(lod_size >> 32),
+                      &serialized[i * 8 + 4]);
+  }
+  for (int i = 0; i < num_lods; ++i) serialized += lods[i];
+  return serialized;
+}
+
+// Parses the output of SerializeLods into `lods[0, num_lods)` and returns
+// true, or leaves `lods` unchanged if `serialized` is invalid.
+bool ParseLods(const std::string& serialized, int num_lods,
+               std::string* lods) {
+  const uint64_t header_size = num_lods * 8;
+  if (serialized.size() < header_size) return false;
+  std::vector<uint64_t> lod_sizes(num_lods);
+  uint64_t total_size = header_size;
+  for (int i = 0; i < num_lods; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      lod_sizes[i] |=
+          uint64_t(static_cast<unsigned char>(serialized[i * 8 + j]))
+          << (8 * j);
+    }
+    if (lod_sizes[i] > serialized.size() - total_size) return false;
+    total_size += lod_sizes[i];
+  }
+  if (total_size != serialized.size()) return false;
+  size_t offset = header_size;
+  for (int i = 0; i < num_lods; ++i) {
+    lods[i].assign(serialized, offset, lod_sizes[i]);
+    offset += lod_sizes[i];
+  }
+  return true;
+}
+
+}  // namespace
+
+struct OnDemandObjectMeshGenerator::Impl {
+  // Encoded simplified levels of detail of a single object.
+  using EncodedLods = std::vector<std::string>;
+
+  // Objects are assigned to lock stripes by dense index.  Each stripe guards
+  // the `in_progress` entries of its objects.
+  static constexpr size_t kNumLockStripes = 64;
+  struct LockStripe {
+    std::mutex mutex;
+    // Notified when an object of the stripe is no longer in progress.
+    std::condition_variable computed;
+  };
+  std::array<LockStripe, kNumLockStripes> lock_stripes;
+
+  LockStripe& GetLockStripe(size_t index) {
+    return lock_stripes[index % kNumLockStripes];
+  }
+
+  // Ids of all objects in the volume.  The following vectors are indexed by
+  // the dense index of each object.
+  DenseLabelMap object_ids;
+  // Unsimplified meshes of the objects that have not yet been simplified.
+  // Only used if not in lazy mode, and only one of these is non-empty,
+  // depending on MeshingOptions::compact_meshes.
+  std::vector<TriangleMesh> unsimplified_meshes;
+  std::vector<CompactTriangleMesh> compact_meshes;
+  // Non-zero while a thread is computing the simplified meshes of an object.
+  std::vector<uint8_t> in_progress;
+  std::array<float,3> voxel_size, offset;
+  SimplifyOptions simplify_options;
+  // Whether meshes are computed by MeshObjectVoxelFaces, in which case they
+  // are encoded without simplification (see MeshingOptions::voxel_faces).
+  bool voxel_faces = false;
+  // Size of the label volume.
+  Vector3d size;
+
+  // Bounding box of each object.  Not computed in chunked mode unless the
+  // cache size is limited.
+  std::vector<BoundingBox> bounding_boxes;
+  // Number of voxels of each object, or -1 if not known.  Computed along with
+  // `bounding_boxes`.
+  std::vector<int64_t> voxel_counts;
+  // Number of boundary cubes and area of the unsimplified surface of each
+  // object, or -1 if not known.  Empty in lazy mode.
+  std::vector<int64_t> boundary_cube_counts;
+  std::vector<double> surface_areas;
+  // Only used in lazy mode or if the cache size is limited.  Computes the
+  // unsimplified mesh of an object.
+  MeshObjectFunction mesh_object;
+  // Copy of the labels made for MeshingOptions::relayout_labels, retained
+  // while `mesh_object` reads it, and its size.
+  std::shared_ptr<void> label_copy;
+  std::atomic<size_t> label_copy_bytes{0};
+
+  // Equivalences by which labels are merged into objects, or null if each
+  // non-zero label is an object.
+  std::shared_ptr<const LabelEquivalences> equivalences;
+  // Sorted ids of the only objects that are meshed, or null if all objects
+  // are meshed.
+  std::shared_ptr<const std::vector<uint64_t>> allowed_ids;
+  // With equivalences or allowed ids, the distinct labels of the volume and
+  // their bounding boxes and voxel counts, from which `object_ids`,
+  // `bounding_boxes` and `voxel_counts` are derived.  Otherwise, these are
+  // empty, since they equal `object_ids`, `bounding_boxes` and `voxel_counts`.
+  DenseLabelMap label_ids;
+  std::vector<BoundingBox> label_boxes;
+  std::vector<int64_t> label_voxel_counts;
+
+  bool labels_are_objects() const { return !equivalences && !allowed_ids; }
+
+  const DenseLabelMap& GetLabelIds() const {
+    return labels_are_objects() ? object_ids : label_ids;
+  }
+
+  const std::vector<BoundingBox>& GetLabelBoxes() const {
+    return labels_are_objects() ? bounding_boxes : label_boxes;
+  }
+
+  const std::vector<int64_t>& GetLabelVoxelCounts() const {
+    return labels_are_objects() ? voxel_counts : label_voxel_counts;
+  }
+
+  // Returns the id of the object to which `label` belongs.
+  uint64_t GetObjectId(uint64_t label) const {
+    return equivalences ? equivalences->Find(label) : label;
+  }
+
+  // Sets the distinct labels of the volume and their bounding boxes and voxel
+  // counts, from which those of the objects are derived.  The voxel count of an
+  // object is not known if that of any of its labels is not.
+  void SetLabels(DenseLabelMap ids, std::vector<BoundingBox> boxes,
+                 std::vector<int64_t> counts) {
+    if (labels_are_objects()) {
+      object_ids = std::move(ids);
+      bounding_boxes = std::move(boxes);
+      voxel_counts = std::move(counts);
+      return;
+    }
+    label_ids = std::move(ids);
+    label_boxes = std::move(boxes);
+    label_voxel_counts = std::move(counts);
+    std::vector<uint64_t> all_ids =
+        equivalences ? ComputeObjectIds(label_ids.ids(), *equivalences)
+                     : label_ids.ids();
+    if (allowed_ids) {
+      std::vector<uint64_t> ids;
+      std::set_intersection(all_ids.begin(), all_ids.end(),
+                            allowed_ids->begin(), allowed_ids->end(),
+                            std::back_inserter(ids));
+      all_ids = std::move(ids);
+    }
+    object_ids = DenseLabelMap(std::move(all_ids));
+    bounding_boxes.assign(object_ids.size(),
+                          BoundingBox{{size[0], size[1], size[2]}, {0, 0, 0}});
+    voxel_counts.assign(object_ids.size(), 0);
+    for (size_t i = 0; i < label_ids.size(); ++i) {
+      const int64_t index = object_ids.Find(GetObjectId(label_ids.ids()[i]));
+      if (index == -1) continue;
+      auto& box = bounding_boxes[index];
+      const auto& label_box = label_boxes[i];
+      for (int j = 0; j < 3; ++j) {
+        box.start[j] = std::min(box.start[j], label_box.start[j]);
+        box.end[j] = std::max(box.end[j], label_box.end[j]);
+      }
+      auto& count = voxel_counts[index];
+      if (label_voxel_counts[i] < 0) {
+        count = -1;
+      } else if (count >= 0) {
+        count += label_voxel_counts[i];
+      }
+    }
+  }
+
+  // Copies the options of `other`, for a generator derived from it.
+  void CopyOptions(const Impl& other) {
+    size = other.size;
+    voxel_size = other.voxel_size;
+    offset = other.offset;
+    simplify_options = other.simplify_options;
+    max_cache_bytes = other.max_cache_bytes;
+    encoding = other.encoding;
+    optimize_vertex_cache = other.optimize_vertex_cache;
+    vertex_normals = other.vertex_normals;
+    allowed_ids = other.allowed_ids;
+    voxel_faces = other.voxel_faces;
+  }
+
+  // Shares the cached meshes of the objects of `other` for which
+  // `share(object_id)` returns true, preserving their recency order, and
+  // copies the statistics of `other`.
+  template <class Share>
+  void ShareCachedMeshes(Impl& other, Share share) {
+    {
+      std::lock_guard<std::mutex> lock(other.cache_mutex);
+      for (auto it = other.lru_list.rbegin(); it != other.lru_list.rend();
+           ++it) {
+        const uint64_t id = other.object_ids.ids()[*it];
+        const int64_t index = object_ids.Find(id);
+        if (index != -1 && share(id)) {
+          InsertCachedMeshes(index, other.cached_meshes[*it]);
+          if (other.gzipped_meshes[*it]) {
+            InsertGzippedMeshes(index, other.cached_meshes[*it],
+                                other.gzipped_meshes[*it]);
+          }
+        }
+      }
+      cache_statistics.hits = other.cache_statistics.hits;
+      cache_statistics.misses = other.cache_statistics.misses;
+      cache_statistics.evictions = other.cache_statistics.evictions;
+      cache_statistics.disk_hits = other.cache_statistics.disk_hits;
+      cache_statistics.disk_writes = other.cache_statistics.disk_writes;
+      cache_statistics.shared_hits = other.cache_statistics.shared_hits;
+    }
+    {
+      std::lock_guard<std::mutex> lock(other.statistics_mutex);
+      meshing_statistics = other.meshing_statistics;
+      meshing_statistics.unsimplified_bytes = 0;
+    }
+  }
+
+  // Copies the boundary cube counts and surface areas of the objects of
+  // `other` for which `share(object_id)` returns true.  Those of all other
+  // objects are not known.
+  template <class Share>
+  void ShareSurfaceStatistics(const Impl& other, Share share) {
+    if (other.surface_areas.empty()) return;
+    boundary_cube_counts.assign(object_ids.size(), -1);
+    surface_areas.assign(object_ids.size(), -1);
+    for (size_t other_index = 0; other_index < other.object_ids.size();
+         ++other_index) {
+      const uint64_t id = other.object_ids.ids()[other_index];
+      const int64_t index = object_ids.Find(id);
+      if (index == -1 || !share(id)) continue;
+      boundary_cube_counts[index] = other.boundary_cube_counts[other_index];
+      surface_areas[index] = other.surface_areas[other_index];
+    }
+  }
+
+  // Guards the cache members below.
+  std::mutex cache_mutex;
+  // Cached simplified meshes of each object, or null if not cached.
+  std::vector<std::shared_ptr<const EncodedLods>> cached_meshes;
+  // Gzip-compressed `cached_meshes` of each object, computed on demand by
+  // GetGzippedMesh, or null.  Evicted along with `cached_meshes`.
+  std::vector<std::shared_ptr<const EncodedLods>> gzipped_meshes;
+  // Dense indices of the cached objects, most recently used first.
+  std::list<size_t> lru_list;
+  // Position of each cached object in `lru_list`.
+  std::vector<std::list<size_t>::iterator> lru_positions;
+  // Maximum total size of the cached meshes, or 0 for no limit.
+  size_t max_cache_bytes = 0;
+  CacheStatistics cache_statistics;
+  MeshEncoding encoding;
+  bool optimize_vertex_cache = false;
+  VertexNormalEncoding vertex_normals = VertexNormalEncoding::kNone;
+
+  // Prefix of the paths of the files in MeshingOptions::cache_directory that
+  // store the meshes of each object, or empty if there is no such directory.
+  std::string disk_cache_prefix;
+
+  std::string GetDiskCachePath(size_t index) const {
+    return disk_cache_prefix + std::to_string(object_ids.ids()[index]);
+  }
+
+  // Encoded preview meshes of the objects (see MeshingOptions::preview_factor),
+  // which are only modified by BuildPreview.
+  std::unordered_map<uint64_t, std::shared_ptr<const std::string>>
+      preview_meshes;
+
+  // Guards `meshing_statistics`.
+  std::mutex statistics_mutex;
+  MeshingStatistics meshing_statistics;
+  // Estimated temporary memory of the simplifications in progress.
+  mutable ByteCounter simplification_bytes;
+
+  // Guards the members below, which track the work queued on the worker pool.
+  std::mutex queue_mutex;
+  uint64_t queued_requests = 0;
+  uint64_t queued_background = 0;
+  // Incremented by CancelBackground.  Each background computation records the
+  // generation at which it was queued, and is skipped if it has changed.
+  uint64_t background_generation = 0;
+
+  // Progress and cancellation of the march at construction.
+  MeshingProgress progress;
+  // Numbers of z planes scanned for the labels and marched at construction,
+  // for build_progress.
+  int64_t build_scan_planes = 0;
+  int64_t build_march_planes = 0;
+  // Thread of a MeshingOptions::background build, which is cancelled and
+  // joined on destruction.
+  std::thread build_thread;
+  // Set once construction is complete or cancelled, with `build_mutex` held.
+  // The members set by construction are not modified afterwards.
+  std::atomic<bool> build_done{true};
+  // Guards the members below, which are only used by a background build.
+  std::mutex build_mutex;
+  std::condition_variable build_changed;
+  // Set once `object_ids`, `bounding_boxes` and the members sized by Resize
+  // are final.
+  bool labels_ready = true;
+  // Set once `preview_meshes` is final.
+  bool preview_ready = true;
+  bool build_cancelled = false;
+  // Whether the unsimplified mesh and statistics of each object are final.
+  std::vector<uint8_t> object_ready;
+
+  ~Impl() {
+    if (build_thread.joinable()) {
+      progress.cancelled = true;
+      build_thread.join();
+    }
+  }
+
+  template <class Label>
+  void Build(const Label* labels, const Vector3d& strides,
+             const MeshingOptions& meshing_options);
+
+  // Computes `preview_meshes` from the labels downsampled by
+  // MeshingOptions::preview_factor.
+  template <class Label>
+  void BuildPreview(const Label* labels, const Vector3d& strides,
+                    const MeshingOptions& meshing_options);
+
+  // Marks the objects as known, once `object_ids`, `bounding_boxes` and the
+  // members sized by Resize are final.
+  void SetLabelsReady() {
+    {
+      std::lock_guard<std::mutex> lock(build_mutex);
+      labels_ready = true;
+    }
+    build_changed.notify_all();
+  }
+
+  // Computes the statistics of the unsimplified mesh of an object, computed
+  // at construction, and converts it to a CompactTriangleMesh if `compact`,
+  // or otherwise shrinks it to fit if `shrink`.
+  void FinishUnsimplifiedMesh(size_t index, bool compact, bool shrink) {
+    auto& mesh = unsimplified_meshes[index];
+    surface_areas[index] = ComputeSurfaceArea(mesh, voxel_size.data());
+    size_t num_bytes;
+    if (compact) {
+      compact_meshes[index] = CompactTriangleMesh(mesh);
+      mesh = TriangleMesh();
+      num_bytes = compact_meshes[index].num_bytes();
+    } else {
+      if (shrink) {
+        mesh.vertex_positions.shrink_to_fit();
+        mesh.triangles.shrink_to_fit();
+      }
+      num_bytes = mesh.num_retained_bytes();
+    }
+    {
+      std::lock_guard<std::mutex> lock(statistics_mutex);
+      meshing_statistics.unsimplified_bytes += num_bytes;
+    }
+    if (build_done) return;
+    {
+      std::lock_guard<std::mutex> lock(build_mutex);
+      object_ready[index] = 1;
+    }
+    build_changed.notify_all();
+  }
+
+  void SetBuildDone() {
+    {
+      std::lock_guard<std::mutex> lock(build_mutex);
+      build_cancelled = progress.cancelled;
+      labels_ready = true;
+      preview_ready = true;
+      build_done = true;
+    }
+    build_changed.notify_all();
+  }
+
+  // Waits until the preview meshes are computed.
+  void WaitForPreview() {
+    if (build_done) return;
+    std::unique_lock<std::mutex> lock(build_mutex);
+    build_changed.wait(lock, [&] { return preview_ready; });
+  }
+
+  void WaitForLabels() {
+    if (build_done) return;
+    std::unique_lock<std::mutex> lock(build_mutex);
+    build_changed.wait(lock, [&] { return labels_ready; });
+  }
+
+  // Waits until the unsimplified mesh of an object is final, and returns
+  // false if the build was cancelled before it was.
+  bool WaitForObject(size_t index) {
+    if (build_done) {
+      return !build_cancelled || object_ready[index];
+    }
+    std::unique_lock<std::mutex> lock(build_mutex);
+    build_changed.wait(lock,
+                       [&] { return build_done || object_ready[index]; });
+    return !build_cancelled || object_ready[index];
+  }
+
+  void WaitForBuild() {
+    if (build_done) return;
+    std::unique_lock<std::mutex> lock(build_mutex);
+    build_changed.wait(lock, [&] { return bool(build_done); });
+  }
+
+  // Adds the counters of the computation of a single object, which took
+  // `object_ns` nanoseconds, to `meshing_statistics`.
+  void RecordStatistics(uint64_t object_id, const MeshingStatistics& object,
+                        uint64_t object_ns) {
+    std::lock_guard<std::mutex> lock(statistics_mutex);
+    auto& total = meshing_statistics;
+    total.march_ns += object.march_ns;
+    total.convert_ns += object.convert_ns;
+    total.simplify_ns += object.simplify_ns;
+    total.encode_ns += object.encode_ns;
+    ++total.num_objects;
+    total.triangles_in += object.triangles_in;
+    total.triangles_out += object.triangles_out;
+    total.bytes_out += object.bytes_out;
+    if (object_ns > total.slowest_object_ns) {
+      total.slowest_object_id = object_id;
+      total.slowest_object_ns = object_ns;
+    }
+    if (object.triangles_in > total.largest_object_triangles) {
+      total.largest_object_id = object_id;
+      total.largest_object_triangles = object.triangles_in;
+    }
+  }
+
+  void Resize(size_t num_objects) {
+    in_progress.resize(num_objects);
+    cached_meshes.resize(num_objects);
+    gzipped_meshes.resize(num_objects);
+    lru_positions.resize(num_objects);
+  }
+
+  // Returns the cached meshes of an object, or null if not cached.  Must be
+  // called with `cache_mutex` held.
+  std::shared_ptr<const EncodedLods> LookupCachedMeshes(size_t index) {
+    const auto& meshes = cached_meshes[index];
+    if (meshes) {
+      lru_list.splice(lru_list.begin(), lru_list, lru_positions[index]);
+      ++cache_statistics.hits;
+    }
+    return meshes;
+  }
+
+  // Adds the meshes of an object to the cache, evicting the least recently
+  // used objects to stay within `max_cache_bytes`.  The inserted object itself
+  // is never evicted.  Must be called with `cache_mutex` held.
+  void InsertCachedMeshes(size_t index,
+                          std::shared_ptr<const EncodedLods> meshes) {
+    cache_statistics.num_bytes += GetEncodedSize(*meshes);
+    ++cache_statistics.num_cached;
+    cached_meshes[index] = std::move(meshes);
+    lru_list.push_front(index);
+    lru_positions[index] = lru_list.begin();
+    EvictLeastRecentlyUsed();
+  }
+
+  // Returns the gzipped cached meshes of an object, or null if not cached.
+  // Must be called with `cache_mutex` held.
+  std::shared_ptr<const EncodedLods> LookupGzippedMeshes(size_t index) {
+    const auto& gzipped = gzipped_meshes[index];
+    if (gzipped) {
+      lru_list.splice(lru_list.begin(), lru_list, lru_positions[index]);
+      ++cache_statistics.hits;
+    }
+    return gzipped;
+  }
+
+  // Adds `gzipped`, the compressed `meshes` of an object, to the cache, unless
+  // `meshes` are no longer cached or were already compressed.  Must be called
+  // with `cache_mutex` held.
+  void InsertGzippedMeshes(size_t index,
+                           const std::shared_ptr<const EncodedLods>& meshes,
+                           std::shared_ptr<const EncodedLods> gzipped) {
+    if (cached_meshes[index] != meshes || gzipped_meshes[index]) return;
+    cache_statistics.num_bytes += GetEncodedSize(*gzipped);
+    gzipped_meshes[index] = std::move(gzipped);
+    EvictLeastRecentlyUsed();
+  }
+
+  // Evicts the least recently used objects, other than the most recently used
+  // one, to stay within `max_cache_bytes`.  Must be called with `cache_mutex`
+  // held.
+  void EvictLeastRecentlyUsed() {
+    if (max_cache_bytes == 0) return;
+    while (cache_statistics.num_bytes > max_cache_bytes &&
+           lru_list.size() > 1) {
+      const size_t evicted_index = lru_list.back();
+      lru_list.pop_back();
+      auto& evicted_meshes = cached_meshes[evicted_index];
+      cache_statistics.num_bytes -= GetEncodedSize(*evicted_meshes);
+      --cache_statistics.num_cached;
+      ++cache_statistics.evictions;
+      evicted_meshes.reset();
+      auto& evicted_gzipped = gzipped_meshes[evicted_index];
+      if (evicted_gzipped) {
+        cache_statistics.num_bytes -= GetEncodedSize(*evicted_gzipped);
+        evicted_gzipped.reset();
+      }
+    }
+  }
+
+  static size_t GetEncodedSize(const EncodedLods& meshes) {
+    size_t num_bytes = 0;
+    for (const auto& mesh : meshes) num_bytes += mesh.size();
+    return num_bytes;
+  }
+
+  // Obtains the unsimplified mesh for the object with the specified dense
+  // index.  A precomputed mesh is no longer retained once taken; if it has
+  // already been taken, e.g. by a computation whose result was since evicted,
+  // the mesh is recomputed from the labels.  Must only be called by the thread
+  // that marked the object as in progress.
+  void TakeUnsimplifiedMesh(size_t index, TriangleMesh* mesh) {
+    if (!unsimplified_meshes.empty() &&
+        !unsimplified_meshes[index].triangles.empty()) {
+      ReleaseUnsimplifiedBytes(unsimplified_meshes[index].num_retained_bytes());
+      *mesh = std::move(unsimplified_meshes[index]);
+      unsimplified_meshes[index] = TriangleMesh();
+    } else if (!compact_meshes.empty() && !compact_meshes[index].empty()) {
+      ReleaseUnsimplifiedBytes(compact_meshes[index].num_bytes());
+      compact_meshes[index].Decode(mesh);
+      compact_meshes[index] = CompactTriangleMesh();
+    } else if (mesh_object) {
+      trace_events::Span span("MeshObject", "triangles");
+      mesh_object(object_ids.ids()[index], bounding_boxes[index], mesh);
+      span.set_size(mesh->triangles.size());
+    }
+  }
+
+  // Copies the unsimplified mesh of an object into `mesh` without releasing
+  // it, or computes it in lazy mode.  Must only be called by the thread that
+  // marked the object as in progress.
+  void CopyUnsimplifiedMesh(size_t index, TriangleMesh* mesh) const {
+    if (!unsimplified_meshes.empty() &&
+        !unsimplified_meshes[index].triangles.empty()) {
+      *mesh = unsimplified_meshes[index];
+    } else if (!compact_meshes.empty() && !compact_meshes[index].empty()) {
+      compact_meshes[index].Decode(mesh);
+    } else if (mesh_object) {
+      trace_events::Span span("MeshObject", "triangles");
+      mesh_object(object_ids.ids()[index], bounding_boxes[index], mesh);
+      span.set_size(mesh->triangles.size());
+    }
+  }
+
+  // Simplifies `mesh`, an unsimplified mesh in voxel coordinates, with
+  // `options`, and stores its `options.num_lods` encoded levels of detail in
+  // `encoded_lods`.  The contents of `mesh` are consumed.  Adds the conversion,
+  // simplification and encoding times and the sizes to `statistics`.  With
+  // `voxel_faces`, every level of detail is `mesh` as is.
+  void SimplifyAndEncode(SimplifyOptions options, TriangleMesh* mesh,
+                         std::string* encoded_lods,
+                         MeshingStatistics* statistics) const {
+    auto lap_start = std::chrono::steady_clock::now();
+    if (voxel_faces) {
+      options.max_quadrics_error = -1;
+      options.max_triangles = 0;
+      options.max_triangle_ratio = 0;
+      options.max_mesh_bytes = 0;
+      options.engine = SimplifierEngine::kFlatArrays;
+    }
+    double voxel_volume = 1;
+    for (int i = 0; i < 3; ++i) {
+      voxel_volume *= voxel_size[i];
+    }
+    options.max_quadrics_error *= voxel_volume * voxel_volume;
+    const size_t num_unsimplified_triangles = mesh->triangles.size();
+    statistics->triangles_in += num_unsimplified_triangles;
+    const int64_t temporary_bytes =
+        EstimateSimplificationBytes(options.engine, *mesh);
+    simplification_bytes.Add(temporary_bytes);
+    if (options.engine == SimplifierEngine::kFlatArrays) {
+      for (auto& vertex : mesh->vertex_positions) {
+        for (int i = 0; i < 3; ++i) {
+          vertex[i] = (vertex[i] + offset[i]) * voxel_size[i];
+        }
+      }
+      statistics->convert_ns += LapNanoseconds(&lap_start);
+      SimplifyAndEncodeLods(options, num_unsimplified_triangles, encoding,
+                            optimize_vertex_cache, vertex_normals, mesh,
+                            encoded_lods, statistics);
+    } else {
+      OpenMeshTriangleMesh triangle_mesh;
+      ConvertToOpenMeshTriangleMesh(*mesh, &triangle_mesh, voxel_size, offset);
+      // Release the memory of the unsimplified mesh before simplifying.
+      *mesh = TriangleMesh();
+      statistics->convert_ns += LapNanoseconds(&lap_start);
+      SimplifyAndEncodeLods(options, num_unsimplified_triangles, encoding,
+                            optimize_vertex_cache, vertex_normals,
+                            &triangle_mesh, encoded_lods, statistics);
+    }
+    simplification_bytes.Add(-temporary_bytes);
+  }
+
+  // Returns an estimate of the peak memory used by SimplifyAndEncode for
+  // `mesh` with `engine`, from the approximate per-vertex and per-triangle
+  // sizes of the halfedge mesh and decimater of SimplifierEngine::kOpenMesh,
+  // or of the flat arrays of SimplifierEngine::kFlatArrays, which are built
+  // alongside `mesh` rather than replacing it.
+  static int64_t EstimateSimplificationBytes(SimplifierEngine engine,
+                                             const TriangleMesh& mesh) {
+    const int64_t num_vertices = mesh.vertex_positions.size();
+    const int64_t num_triangles = mesh.triangles.size();
+    if (engine == SimplifierEngine::kFlatArrays) {
+      return mesh.num_bytes() + num_vertices * 130 + num_triangles * 40;
+    }
+    return num_vertices * 116 + num_triangles * 86;
+  }
+
+  // Releases the unsimplified mesh of an object whose simplified meshes were
+  // obtained without it.  Must only be called by the thread that marked the
+  // object as in progress.
+  void ReleaseUnsimplifiedMesh(size_t index) {
+    if (!unsimplified_meshes.empty()) {
+      ReleaseUnsimplifiedBytes(unsimplified_meshes[index].num_retained_bytes());
+      unsimplified_meshes[index] = TriangleMesh();
+    } else if (!compact_meshes.empty()) {
+      ReleaseUnsimplifiedBytes(compact_meshes[index].num_bytes());
+      compact_meshes[index] = CompactTriangleMesh();
+    }
+  }
+
+  void ReleaseUnsimplifiedBytes(size_t num_bytes) {
+    std::lock_guard<std::mutex> lock(statistics_mutex);
+    meshing_statistics.unsimplified_bytes -= num_bytes;
+  }
+
+  // Returns the number of bytes of the unsimplified mesh of an object, as a
+  // TriangleMesh, or 0 if it is not retained.
+  size_t GetUnsimplifiedMeshBytes(size_t index) const {
+    if (!unsimplified_meshes.empty()) {
+      return unsimplified_meshes[index].num_bytes();
+    }
+    if (!compact_meshes.empty()) {
+      return compact_meshes[index].num_decoded_bytes();
+    }
+    return 0;
+  }
+};
+
+namespace {
+template <class Label>
+OnDemandObjectMeshGenerator::MeshObjectFunction MakeMeshObjectFunction(
+    const Label* labels, const Vector3d& size, const Vector3d& strides,
+    std::shared_ptr<const LabelEquivalences> equivalences, bool voxel_faces) {
+  if (voxel_faces) {
+    return [=](uint64_t object_id, const BoundingBox& bounding_box,
+               TriangleMesh* mesh) {
+      MeshObjectVoxelFaces(labels, size, strides, object_id, bounding_box,
+                           mesh, equivalences.get());
+    };
+  }
+  return [=](uint64_t object_id, const BoundingBox& bounding_box,
+             TriangleMesh* mesh) {
+    MeshObject(labels, size, strides, object_id, bounding_box, mesh,
+               equivalences.get());
+  };
+}
+}  // namespace
+
+template <class Label>
+void OnDemandObjectMeshGenerator::Impl::BuildPreview(
+    const Label* labels, const Vector3d& strides,
+    const MeshingOptions& meshing_options) {
+  const auto& factor = meshing_options.preview_factor;
+  // The downsampling is done with the dimensions in the order z, y, x, so that
+  // its output is in the same layout as the labels, with x varying fastest.
+  Vector3d preview_size;
+  ptrdiff_t input_shape[3], input_strides[3], downsample_factor[3];
+  for (int i = 0; i < 3; ++i) {
+    preview_size[i] = (size[i] + factor[i] - 1) / factor[i];
+    input_shape[2 - i] = size[i];
+    input_strides[2 - i] = strides[i];
+    downsample_factor[2 - i] = factor[i];
+  }
+  const Vector3d preview_strides{1, preview_size[0],
+                                 preview_size[0] * preview_size[1]};
+  const ptrdiff_t output_strides[3] = {preview_strides[2], preview_strides[1],
+                                       preview_strides[0]};
+  std::vector<Label> preview_labels(preview_size[0] * preview_size[1] *
+                                    preview_size[2]);
+  downsample::DownsampleWithMode(labels, 3, input_shape, input_strides,
+                                 downsample_factor, preview_labels.data(),
+                                 output_strides);
+  std::unordered_map<uint64_t, TriangleMesh> meshes;
+  MeshObjects(preview_labels.data(), preview_size, preview_strides, &meshes,
+              meshing_options.num_threads, equivalences.get(),
+              allowed_ids.get(), meshing_options.engine);
+  std::vector<std::pair<const uint64_t, TriangleMesh>*> entries;
+  entries.reserve(meshes.size());
+  for (auto& p : meshes) entries.push_back(&p);
+
+  // Preview voxel `p` covers the voxels [p * factor, (p + 1) * factor), whose
+  // center is at `p * factor + (factor - 1) / 2`, so the preview meshes are
+  // transformed as if by a voxel size and offset scaled to match.
+  std::array<float, 3> preview_voxel_size, preview_offset;
+  double voxel_volume = 1;
+  for (int i = 0; i < 3; ++i) {
+    preview_voxel_size[i] = voxel_size[i] * factor[i];
+    preview_offset[i] = (offset[i] + (factor[i] - 1) * 0.5) / factor[i];
+    voxel_volume *= preview_voxel_size[i];
+  }
+  // Only the first level of detail is computed, and always on the flat arrays,
+  // for speed.
+  SimplifyOptions options = simplify_options;
+  options.num_lods = 1;
+  options.max_quadrics_error *= voxel_volume * voxel_volume;
+  std::vector<std::shared_ptr<const std::string>> encoded(entries.size());
+  ParallelFor(entries.size(), meshing_options.num_threads, [&](size_t i) {
+    TriangleMesh& mesh = entries[i]->second;
+    for (auto& vertex : mesh.vertex_positions) {
+      for (int j = 0; j < 3; ++j) {
+        vertex[j] = (vertex[j] + preview_offset[j]) * preview_voxel_size[j];
+      }
+    }
+    std::string lod;
+    MeshingStatistics statistics;
+    SimplifyAndEncodeLods(options, mesh.triangles.size(), encoding,
+                          optimize_vertex_cache, vertex_normals, &mesh, &lod,
+                          &statistics);
+    mesh = TriangleMesh();
+    encoded[i] = std::make_shared<const std::string>(std::move(lod));
+  });
+  std::unordered_map<uint64_t, std::shared_ptr<const std::string>> result;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    result.emplace(entries[i]->first, std::move(encoded[i]));
+  }
+  {
+    std::lock_guard<std::mutex> lock(build_mutex);
+    preview_meshes = std::move(result);
+    preview_ready = true;
+  }
+  build_changed.notify_all();
+}
+
+template <class Label>
+OnDemandObjectMeshGenerator::OnDemandObjectMeshGenerator(
+    const Label* labels, const int64_t* size, const int64_t* strides,
+    const float voxel_size[3], const float offset[3],
+    const SimplifyOptions& simplify_options,
+    const MeshingOptions& meshing_options)
+    : impl_(new Impl) {
+  impl_->max_cache_bytes = meshing_options.max_cache_bytes;
+  impl_->encoding = meshing_options.encoding;
+  impl_->optimize_vertex_cache = meshing_options.optimize_vertex_cache;
+  impl_->vertex_normals = meshing_options.vertex_normals;
+  impl_->voxel_faces = meshing_options.voxel_faces;
+  for (int i = 0; i < 3; ++i) {
+    impl_->voxel_size[i] = voxel_size[i];
+    impl_->offset[i] = offset[i];
+  }
+  impl_->simplify_options = simplify_options;
+  if (meshing_options.equivalences && !meshing_options.equivalences->empty()) {
+    impl_->equivalences = meshing_options.equivalences;
+  }
+  impl_->allowed_ids = meshing_options.allowed_ids;
+  impl_->size = Vector3d{size[0], size[1], size[2]};
+  const Vector3d strides_vec{strides[0], strides[1], strides[2]};
+  // Set before the build starts, since build_progress reads them.
+  const bool lazy = meshing_options.lazy || meshing_options.voxel_faces;
+  impl_->build_scan_planes =
+      lazy || meshing_options.max_cache_bytes != 0 ||
+              meshing_options.block_size[0] <= 0
+          ? size[2]
+          : 0;
+  impl_->build_march_planes = lazy ? 0 : std::max(int64_t(0), size[2] - 1);
+  if (!meshing_options.background) {
+    impl_->Build(labels, strides_vec, meshing_options);
+    return;
+  }
+  Impl* impl = impl_.get();
+  impl->build_done = false;
+  impl->labels_ready = false;
+  impl->preview_ready = meshing_options.preview_factor[0] <= 0;
+  // The thread does not retain `impl_`, whose destructor joins it.
+  impl->build_thread = std::thread([impl, labels, strides_vec,
+                                    meshing_options] {
+    impl->Build(labels, strides_vec, meshing_options);
+  });
+}
+
+template <class Label>
+void OnDemandObjectMeshGenerator::Impl::Build(
+    const Label* labels, const Vector3d& input_strides,
+    const MeshingOptions& meshing_options) {
+  const std::vector<uint64_t>* allowed_ids_ptr = allowed_ids.get();
+  const LabelEquivalences* equivalences_ptr = equivalences.get();
+  // In lazy mode, and with a limited cache size, meshes are computed (or
+  // recomputed after eviction) from the bounding box of the object.
+  // Voxel-face meshes are always computed on demand.
+  const bool lazy = meshing_options.lazy || meshing_options.voxel_faces;
+  const bool mesh_on_demand = lazy || meshing_options.max_cache_bytes != 0;
+  const bool chunked = !lazy && meshing_options.block_size[0] > 0;
+  // Bounding boxes also permit UpdateRegion.  They are not computed in chunked
+  // mode unless required, since that would require an extra pass over labels
+  // that are likely not in memory.
+  const bool need_bounding_boxes = mesh_on_demand || !chunked;
+  Vector3d strides = input_strides;
+  const Vector3d x_fastest_strides{1, size[0], size[0] * size[1]};
+  if (meshing_options.relayout_labels && !chunked &&
+      strides != x_fastest_strides) {
+    const size_t num_voxels = size[0] * size[1] * size[2];
+    std::shared_ptr<Label> copy(new Label[num_voxels],
+                                std::default_delete<Label[]>());
+    CopyLabelsXFastest(labels, size, strides, copy.get(),
+                       meshing_options.num_threads);
+    labels = copy.get();
+    strides = x_fastest_strides;
+    label_copy = std::move(copy);
+    label_copy_bytes = num_voxels * sizeof(Label);
+  }
+  // The preview is computed first, so that it is available early in a
+  // background build.
+  if (meshing_options.preview_factor[0] > 0) {
+    BuildPreview(labels, strides, meshing_options);
+  }
+  if (!meshing_options.cache_directory.empty()) {
+    const uint64_t hash = HashMeshOptions(
+        HashLabels(labels, size, strides, meshing_options.num_threads),
+        voxel_size.data(), offset.data(), simplify_options, meshing_options);
+    char name[20];
+    std::snprintf(name, sizeof(name), "%016llx.",
+                  static_cast<unsigned long long>(hash));
+    const std::string& directory = meshing_options.cache_directory;
+    disk_cache_prefix =
+        directory + (directory.back() == '/' ? "" : "/") + name;
+  }
+  if (need_bounding_boxes) {
+    DenseLabelMap label_ids(ComputeDistinctLabels(labels, size, strides));
+    std::vector<BoundingBox> label_boxes;
+    std::vector<uint64_t> label_voxel_counts;
+    ComputeBoundingBoxes(labels, size, strides, label_ids, &label_boxes,
+                         &label_voxel_counts);
+    SetLabels(std::move(label_ids), std::move(label_boxes),
+              std::vector<int64_t>(label_voxel_counts.begin(),
+                                   label_voxel_counts.end()));
+    Resize(object_ids.size());
+    if (!build_done) object_ready.assign(object_ids.size(), 0);
+    SetLabelsReady();
+  }
+  if (mesh_on_demand) {
+    mesh_object = MakeMeshObjectFunction(labels, size, strides, equivalences,
+                                         voxel_faces);
+  }
+  const int num_threads = meshing_options.num_threads;
+  const bool compact = meshing_options.compact_meshes;
+  const bool shrink = meshing_options.shrink_unsimplified_meshes;
+  auto march_start = std::chrono::steady_clock::now();
+  if (chunked) {
+    const ReadLabelsFunction<Label> read_labels = [=](const BoundingBox& box,
+                                                      Label* output) {
+      for (int64_t z = box.start[2]; z < box.end[2]; ++z) {
+        for (int64_t y = box.start[1]; y < box.end[1]; ++y) {
+          const Label* input =
+              labels + z * strides[2] + y * strides[1] + box.start[0] * strides[0];
+          for (int64_t x = box.start[0]; x < box.end[0]; ++x) {
+            *(output++) = *input;
+            input += strides[0];
+          }
+        }
+      }
+    };
+    std::unordered_map<uint64_t, TriangleMesh> meshes;
+    MeshObjectsChunked(read_labels, size,
+                       Vector3d{meshing_options.block_size[0],
+                                meshing_options.block_size[1],
+                                meshing_options.block_size[2]},
+                       &meshes, meshing_options.num_threads, equivalences_ptr,
+                       allowed_ids_ptr);
+    if (!need_bounding_boxes) {
+      std::vector<uint64_t> ids;
+      ids.reserve(meshes.size());
+      for (auto const& p : meshes) ids.push_back(p.first);
+      std::sort(ids.begin(), ids.end());
+      object_ids = DenseLabelMap(std::move(ids));
+      Resize(object_ids.size());
+      if (!build_done) object_ready.assign(object_ids.size(), 0);
+    }
+    unsimplified_meshes.resize(object_ids.size());
+    for (auto& p : meshes) {
+      unsimplified_meshes[object_ids.Find(p.first)] = std::move(p.second);
+    }
+    boundary_cube_counts.assign(object_ids.size(), -1);
+    progress.marched_planes = build_march_planes;
+  }
+  const size_t num_objects = object_ids.size();
+  if (!lazy) {
+    surface_areas.resize(num_objects);
+    if (compact) compact_meshes.resize(num_objects);
+  }
+  if (chunked) {
+    if (!progress.cancelled) {
+      ParallelFor(num_objects, num_threads, [&](size_t i) {
+        FinishUnsimplifiedMesh(i, compact, shrink);
+      });
+    }
+  } else if (!lazy) {
+    std::vector<uint64_t> cube_counts;
+    // Objects are merged as soon as they are complete only if they can be
+    // requested concurrently, since that uses more, thinner slabs.
+    if (!build_done) progress.bounding_boxes = &bounding_boxes;
+    progress.object_done = [&](size_t i) {
+      FinishUnsimplifiedMesh(i, compact, shrink);
+    };
+    MeshObjects(labels, size, strides, object_ids, &unsimplified_meshes,
+                meshing_options.num_threads, equivalences_ptr, &cube_counts,
+                meshing_options.engine, &progress);
+    progress.object_done = nullptr;
+    boundary_cube_counts.assign(cube_counts.begin(), cube_counts.end());
+  }
+  // The vector of meshes is only released if no object can be requested
+  // concurrently.
+  if (compact && build_done) {
+    std::vector<TriangleMesh>().swap(unsimplified_meshes);
+  }
+  {
+    std::lock_guard<std::mutex> lock(statistics_mutex);
+    meshing_statistics.march_ns += LapNanoseconds(&march_start);
+  }
+  if (!need_bounding_boxes) SetLabelsReady();
+  if (!mesh_on_demand) {
+    label_copy.reset();
+    label_copy_bytes = 0;
+  }
+  if (meshing_options.release_memory_after_build) ReleaseFreeMemory();
+  SetBuildDone();
+}
+
+template <class Label>
+OnDemandObjectMeshGenerator OnDemandObjectMeshGenerator::UpdateRegion(
+    const Label* labels, const int64_t* strides, const int64_t region_start[3],
+    const int64_t region_end[3]) const {
+  OnDemandObjectMeshGenerator result;
+  Impl& old_impl = *impl_;
+  old_impl.WaitForBuild();
+  if (old_impl.build_cancelled ||
+      old_impl.bounding_boxes.size() != old_impl.object_ids.size()) {
+    return result;
+  }
+  const Vector3d& size = old_impl.size;
+  const Vector3d strides_vec{strides[0], strides[1], strides[2]};
+
+  // Surfaces may change within one voxel of the modified region.
+  BoundingBox margin_region;
+  Vector3d margin_size;
+  bool margin_region_empty = false;
+  ptrdiff_t margin_offset = 0;
+  for (int i = 0; i < 3; ++i) {
+    margin_region.start[i] = std::max(region_start[i] - 1, int64_t(0));
+    margin_region.end[i] = std::min(region_end[i] + 1, size[i]);
+    margin_size[i] = margin_region.end[i] - margin_region.start[i];
+    if (margin_size[i] <= 0) margin_region_empty = true;
+    margin_offset += margin_region.start[i] * strides[i];
+  }
+
+  // Labels now present near the modified region, which may include new
+  // labels.
+  DenseLabelMap margin_ids;
+  std::vector<BoundingBox> margin_boxes;
+  if (!margin_region_empty) {
+    margin_ids = DenseLabelMap(ComputeDistinctLabels(
+        labels + margin_offset, margin_size, strides_vec));
+    ComputeBoundingBoxes(labels + margin_offset, margin_size, strides_vec,
+                         margin_ids, &margin_boxes);
+  }
+
+  result.impl_.reset(new Impl);
+  Impl& impl = *result.impl_;
+  impl.CopyOptions(old_impl);
+  impl.equivalences = old_impl.equivalences;
+  impl.mesh_object = MakeMeshObjectFunction(
+      labels, size, strides_vec, impl.equivalences, impl.voxel_faces);
+  const DenseLabelMap& old_label_ids = old_impl.GetLabelIds();
+  const auto& old_label_boxes = old_impl.GetLabelBoxes();
+  DenseLabelMap label_ids;
+  {
+    std::vector<uint64_t> ids;
+    std::set_union(old_label_ids.ids().begin(), old_label_ids.ids().end(),
+                   margin_ids.ids().begin(), margin_ids.ids().end(),
+                   std::back_inserter(ids));
+    label_ids = DenseLabelMap(std::move(ids));
+  }
+  const size_t num_labels = label_ids.size();
+  std::vector<BoundingBox> label_boxes(
+      num_labels, BoundingBox{{size[0], size[1], size[2]}, {0, 0, 0}});
+  // The voxel counts of affected labels are not known, since the labels that
+  // were replaced are not available.
+  const auto& old_label_voxel_counts = old_impl.GetLabelVoxelCounts();
+  std::vector<int64_t> label_voxel_counts(num_labels, -1);
+
+  // A label is affected if it previously had voxels near the modified region,
+  // as conservatively determined from its bounding box, or if it does now.
+  // The bounding boxes of affected labels are only grown, since the bounding
+  // box need not be tight.
+  std::vector<uint8_t> affected(num_labels);
+  for (size_t old_index = 0; old_index < old_label_ids.size(); ++old_index) {
+    const int64_t index = label_ids.Find(old_label_ids.ids()[old_index]);
+    const auto& box = old_label_boxes[old_index];
+    label_boxes[index] = box;
+    bool intersects = true;
+    for (int i = 0; i < 3; ++i) {
+      intersects = intersects && box.start[i] < margin_region.end[i] &&
+                   margin_region.start[i] < box.end[i];
+    }
+    if (intersects) affected[index] = 1;
+  }
+  for (size_t margin_index = 0; margin_index < margin_ids.size();
+       ++margin_index) {
+    const int64_t index = label_ids.Find(margin_ids.ids()[margin_index]);
+    affected[index] = 1;
+    auto& box = label_boxes[index];
+    const auto& margin_box = margin_boxes[margin_index];
+    for (int i = 0; i < 3; ++i) {
+      box.start[i] = std::min(box.start[i],
+                              margin_box.start[i] + margin_region.start[i]);
+      box.end[i] =
+          std::max(box.end[i], margin_box.end[i] + margin_region.start[i]);
+    }
+  }
+
+  if (!old_label_voxel_counts.empty()) {
+    for (size_t old_index = 0; old_index < old_label_ids.size(); ++old_index) {
+      const int64_t index = label_ids.Find(old_label_ids.ids()[old_index]);
+      if (!affected[index]) {
+        label_voxel_counts[index] = old_label_voxel_counts[old_index];
+      }
+    }
+  }
+
+  // An object is affected if any of its labels is.
+  std::vector<uint64_t> affected_object_ids;
+  for (size_t index = 0; index < num_labels; ++index) {
+    if (affected[index]) {
+      affected_object_ids.push_back(impl.GetObjectId(label_ids.ids()[index]));
+    }
+  }
+  std::sort(affected_object_ids.begin(), affected_object_ids.end());
+  impl.SetLabels(std::move(label_ids), std::move(label_boxes),
+                 std::move(label_voxel_counts));
+  impl.Resize(impl.object_ids.size());
+
+  // Share the cached meshes of unaffected objects.  The meshes of all other
+  // objects are computed on demand.
+  const auto unaffected = [&](uint64_t object_id) {
+    return !std::binary_search(affected_object_ids.begin(),
+                               affected_object_ids.end(), object_id);
+  };
+  impl.ShareCachedMeshes(old_impl, unaffected);
+  impl.ShareSurfaceStatistics(old_impl, unaffected);
+  return result;
+}
+
+template <class Label>
+OnDemandObjectMeshGenerator OnDemandObjectMeshGenerator::UpdateEquivalences(
+    const Label* labels, const int64_t* strides,
+    std::shared_ptr<const LabelEquivalences> equivalences) const {
+  OnDemandObjectMeshGenerator result;
+  Impl& old_impl = *impl_;
+  old_impl.WaitForBuild();
+  if (old_impl.build_cancelled ||
+      old_impl.bounding_boxes.size() != old_impl.object_ids.size()) {
+    return result;
+  }
+  const Vector3d strides_vec{strides[0], strides[1], strides[2]};
+
+  result.impl_.reset(new Impl);
+  Impl& impl = *result.impl_;
+  impl.CopyOptions(old_impl);
+  if (equivalences && !equivalences->empty()) {
+    impl.equivalences = std::move(equivalences);
+  }
+  impl.mesh_object = MakeMeshObjectFunction(
+      labels, impl.size, strides_vec, impl.equivalences, impl.voxel_faces);
+
+  // The set of labels of an object changes only if some label is moved to or
+  // from it.
+  const DenseLabelMap& label_ids = old_impl.GetLabelIds();
+  std::vector<uint64_t> changed_object_ids;
+  for (const uint64_t label : label_ids.ids()) {
+    const uint64_t old_id = old_impl.GetObjectId(label);
+    const uint64_t new_id = impl.GetObjectId(label);
+    if (old_id != new_id) {
+      changed_object_ids.push_back(old_id);
+      changed_object_ids.push_back(new_id);
+    }
+  }
+  std::sort(changed_object_ids.begin(), changed_object_ids.end());
+  impl.SetLabels(label_ids, old_impl.GetLabelBoxes(),
+                 old_impl.GetLabelVoxelCounts());
+  impl.Resize(impl.object_ids.size());
+
+  const auto unchanged = [&](uint64_t object_id) {
+    return !std::binary_search(changed_object_ids.begin(),
+                               changed_object_ids.end(), object_id);
+  };
+  impl.ShareCachedMeshes(old_impl, unchanged);
+  impl.ShareSurfaceStatistics(old_impl, unchanged);
+  return result;
+}
+
+template <class Label>
+OnDemandObjectMeshGenerator
+OnDemandObjectMeshGenerator::ReleaseUnsimplifiedMeshes(
+    const Label* labels, const int64_t* strides) const {
+  // The objects are unchanged, so all cached meshes and statistics are shared.
+  OnDemandObjectMeshGenerator result =
+      UpdateEquivalences(labels, strides, impl_->equivalences);
+  if (result) {
+    result.impl_->preview_meshes = impl_->preview_meshes;
+    result.impl_->disk_cache_prefix = impl_->disk_cache_prefix;
+  }
+  return result;
+}
+
+std::shared_ptr<const std::string>
+OnDemandObjectMeshGenerator::GetSimplifiedMesh(uint64_t object_id, int lod) {
+  static const std::shared_ptr<const std::string> empty_string(
+      new std::string);
+  const int num_lods = impl_->simplify_options.num_lods;
+  if (lod < 0 || lod >= num_lods) {
+    return empty_string;
+  }
+  impl_->WaitForLabels();
+  const int64_t index = impl_->object_ids.Find(object_id);
+  if (index == -1 || !impl_->WaitForObject(index)) {
+    return empty_string;
+  }
+  // Return a reference to a single level that shares ownership of all levels
+  // of the object, so that it remains valid even if evicted from the cache.
+  auto meshes = GetEncodedLods(index);
+  const std::string* mesh = &(*meshes)[lod];
+  return std::shared_ptr<const std::string>(std::move(meshes), mesh);
+}
+
+std::shared_ptr<const std::string> OnDemandObjectMeshGenerator::GetGzippedMesh(
+    uint64_t object_id, int lod) {
+  static const std::shared_ptr<const std::string> empty_string(
+      new std::string);
+  const int num_lods = impl_->simplify_options.num_lods;
+  if (lod < 0 || lod >= num_lods || !sharding::HaveGzip()) {
+    return empty_string;
+  }
+  impl_->WaitForLabels();
+  const int64_t index = impl_->object_ids.Find(object_id);
+  if (index == -1 || !impl_->WaitForObject(index)) {
+    return empty_string;
+  }
+  std::shared_ptr<const Impl::EncodedLods> gzipped;
+  {
+    std::lock_guard<std::mutex> lock(impl_->cache_mutex);
+    gzipped = impl_->LookupGzippedMeshes(index);
+  }
+  if (!gzipped) {
+    auto meshes = GetEncodedLods(index);
+    auto new_gzipped = std::make_shared<Impl::EncodedLods>(num_lods);
+    for (int i = 0; i < num_lods; ++i) {
+      if (!(*meshes)[i].empty() &&
+          !sharding::GzipCompress((*meshes)[i], &(*new_gzipped)[i])) {
+        return empty_string;
+      }
+    }
+    std::lock_guard<std::mutex> lock(impl_->cache_mutex);
+    impl_->InsertGzippedMeshes(index, meshes, new_gzipped);
+    gzipped = std::move(new_gzipped);
+  }
+  const std::string* mesh = &(*gzipped)[lod];
+  return std::shared_ptr<const std::string>(std::move(gzipped), mesh);
+}
+
+std::shared_ptr<const std::string> OnDemandObjectMeshGenerator::GetPreviewMesh(
+    uint64_t object_id) {
+  static const std::shared_ptr<const std::string> empty_string(
+      new std::string);
+  impl_->WaitForPreview();
+  auto it = impl_->preview_meshes.find(object_id);
+  if (it == impl_->preview_meshes.end()) return empty_string;
+  return it->second;
+}
+
+namespace {
+// Serves RequestSimplifiedMesh for all generators.  Never destroyed, since
+// requests may still be running at exit.
+WorkerPool& GetMeshRequestPool() {
+  static WorkerPool* pool = new WorkerPool;
+  return *pool;
+}
+}  // namespace
+
+void OnDemandObjectMeshGenerator::RequestSimplifiedMesh(
+    uint64_t object_id, int lod, int priority,
+    std::function<void(std::shared_ptr<const std::string>)> callback,
+    bool gzip) {
+  // During a background build even the lookup of the object may wait, so it
+  // is left to the worker thread.
+  if (impl_->build_done) {
+    const int64_t index = impl_->object_ids.Find(object_id);
+    if (lod < 0 || lod >= impl_->simplify_options.num_lods || index == -1) {
+      callback(gzip ? GetGzippedMesh(object_id, lod)
+                    : GetSimplifiedMesh(object_id, lod));
+      return;
+    }
+    std::shared_ptr<const Impl::EncodedLods> meshes;
+    {
+      std::lock_guard<std::mutex> lock(impl_->cache_mutex);
+      meshes = gzip ? impl_->LookupGzippedMeshes(index)
+                    : impl_->LookupCachedMeshes(index);
+    }
+    if (meshes) {
+      const std::string* mesh = &(*meshes)[lod];
+      callback(std::shared_ptr<const std::string>(std::move(meshes), mesh));
+      return;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(impl_->queue_mutex);
+    ++impl_->queued_requests;
+  }
+  OnDemandObjectMeshGenerator generator = *this;
+  GetMeshRequestPool().Schedule(
+      priority, [generator, object_id, lod, callback, gzip]() mutable {
+        {
+          std::lock_guard<std::mutex> lock(generator.impl_->queue_mutex);
+          --generator.impl_->queued_requests;
+        }
+        callback(gzip ? generator.GetGzippedMesh(object_id, lod)
+                      : generator.GetSimplifiedMesh(object_id, lod));
+      });
+}
+
+bool OnDemandObjectMeshGenerator::StreamSimplifiedMesh(
+    uint64_t object_id, int lod, size_t fragment_triangles,
+    const std::function<void(std::shared_ptr<const std::string>)>& callback) {
+  if (lod < 0 || lod >= impl_->simplify_options.num_lods) return false;
+  impl_->WaitForLabels();
+  const int64_t index = impl_->object_ids.Find(object_id);
+  if (index == -1 || !impl_->WaitForObject(index)) return false;
+  trace_events::ObjectScope object_scope(object_id);
+  trace_events::Span span("StreamSimplifiedMesh");
+  const auto send_whole_mesh =
+      [&](std::shared_ptr<const std::vector<std::string>> meshes) {
+        const std::string* mesh = &(*meshes)[lod];
+        if (mesh->empty()) return false;
+        callback(std::shared_ptr<const std::string>(std::move(meshes), mesh));
+        return true;
+      };
+
+  auto object_start = std::chrono::steady_clock::now();
+  auto lap_start = object_start;
+  MeshingStatistics statistics;
+  TriangleMesh unsimplified_mesh;
+  auto& in_progress = impl_->in_progress[index];
+  auto& lock_stripe = impl_->GetLockStripe(index);
+  {
+    std::unique_lock<std::mutex> lock(lock_stripe.mutex);
+    // A computation of the whole object in progress caches its meshes.
+    lock_stripe.computed.wait(lock, [&] { return !in_progress; });
+    std::shared_ptr<const Impl::EncodedLods> meshes;
+    {
+      std::lock_guard<std::mutex> cache_lock(impl_->cache_mutex);
+      meshes = impl_->LookupCachedMeshes(index);
+    }
+    if (meshes) {
+      lock.unlock();
+      return send_whole_mesh(std::move(meshes));
+    }
+    // Marking the object prevents its unsimplified mesh from being released
+    // while it is copied.
+    in_progress = 1;
+  }
+  impl_->CopyUnsimplifiedMesh(index, &unsimplified_mesh);
+  {
+    std::lock_guard<std::mutex> lock(lock_stripe.mutex);
+    in_progress = 0;
+  }
+  lock_stripe.computed.notify_all();
+  statistics.march_ns += LapNanoseconds(&lap_start);
+
+  const size_t num_triangles = unsimplified_mesh.triangles.size();
+  if (num_triangles == 0) return false;
+  if (fragment_triangles == 0 || num_triangles <= fragment_triangles) {
+    unsimplified_mesh = TriangleMesh();
+    return send_whole_mesh(GetEncodedLods(index));
+  }
+  std::vector<TriangleMesh> fragments;
+  PartitionTriangleMesh(
+      unsimplified_mesh,
+      (num_triangles + fragment_triangles - 1) / fragment_triangles,
+      &fragments);
+  unsimplified_mesh = TriangleMesh();
+
+  SimplifyOptions options = impl_->simplify_options;
+  options.num_lods = lod + 1;
+  // The vertices shared by adjacent fragments lie on their boundaries.
+  options.lock_boundary_vertices = true;
+  std::mutex callback_mutex;
+  // On a worker thread of RequestMeshFragments, which is otherwise occupied by
+  // concurrent requests, the fragments are simplified one at a time.
+  ParallelFor(fragments.size(), options.num_threads, [&](size_t i) {
+    trace_events::ObjectScope fragment_object_scope(object_id);
+    TriangleMesh& fragment = fragments[i];
+    // The caps of the whole mesh are apportioned by number of triangles.
+    SimplifyOptions fragment_options = options;
+    const double share =
+        static_cast<double>(fragment.triangles.size()) / num_triangles;
+    if (options.max_triangles != 0) {
+      fragment_options.max_triangles =
+          std::max<size_t>(1, options.max_triangles * share);
+    }
+    if (options.max_mesh_bytes != 0) {
+      fragment_options.max_mesh_bytes =
+          std::max<size_t>(1, options.max_mesh_bytes * share);
+    }
+    std::vector<std::string> encoded_lods(lod + 1);
+    MeshingStatistics fragment_statistics;
+    impl_->SimplifyAndEncode(fragment_options, &fragment, encoded_lods.data(),
+                             &fragment_statistics);
+    fragment = TriangleMesh();
+    auto encoded =
+        std::make_shared<const std::string>(std::move(encoded_lods[lod]));
+    std::lock_guard<std::mutex> lock(callback_mutex);
+    statistics.convert_ns += fragment_statistics.convert_ns;
+    statistics.simplify_ns += fragment_statistics.simplify_ns;
+    statistics.encode_ns += fragment_statistics.encode_ns;
+    statistics.triangles_in += fragment_statistics.triangles_in;
+    statistics.triangles_out += fragment_statistics.triangles_out;
+    statistics.bytes_out += fragment_statistics.bytes_out;
+    callback(std::move(encoded));
+  });
+  impl_->RecordStatistics(object_id, statistics,
+                          LapNanoseconds(&object_start));
+  return true;
+}
+
+void OnDemandObjectMeshGenerator::RequestMeshFragments(
+    uint64_t object_id, int lod, int priority, size_t fragment_triangles,
+    std::function<void(std::shared_ptr<const std::string>)> callback) {
+  {
+    std::lock_guard<std::mutex> lock(impl_->queue_mutex);
+    ++impl_->queued_requests;
+  }
+  OnDemandObjectMeshGenerator generator = *this;
+  GetMeshRequestPool().Schedule(
+      priority,
+      [generator, object_id, lod, fragment_triangles, callback]() mutable {
+        {
+          std::lock_guard<std::mutex> lock(generator.impl_->queue_mutex);
+          --generator.impl_->queued_requests;
+        }
+        generator.StreamSimplifiedMesh(object_id, lod, fragment_triangles,
+                                       callback);
+        callback(nullptr);
+      });
+}
+
+std::shared_ptr<const std::vector<std::string>>
+OnDemandObjectMeshGenerator::GetEncodedLods(size_t index) {
+  trace_events::ObjectScope object_scope(impl_->object_ids.ids()[index]);
+  trace_events::Span span("GetEncodedLods");
+  {
+    std::lock_guard<std::mutex> lock(impl_->cache_mutex);
+    if (auto meshes = impl_->LookupCachedMeshes(index)) {
+      return meshes;
+    }
+  }
+  auto& in_progress = impl_->in_progress[index];
+  auto& lock_stripe = impl_->GetLockStripe(index);
+  {
+    std::unique_lock<std::mutex> lock(lock_stripe.mutex);
+    // If another thread is already computing this object, wait for it rather
+    // than duplicating the work.
+    if (in_progress) {
+      trace_events::Span wait_span("GetEncodedLods.wait");
+      lock_stripe.computed.wait(lock, [&] { return !in_progress; });
+    }
+    {
+      std::lock_guard<std::mutex> cache_lock(impl_->cache_mutex);
+      if (auto meshes = impl_->LookupCachedMeshes(index)) {
+        return meshes;
+      }
+      ++impl_->cache_statistics.misses;
+    }
+    in_progress = 1;
+  }
+
+  auto new_meshes =
+      std::make_shared<Impl::EncodedLods>(impl_->simplify_options.num_lods);
+  const bool use_disk_cache = !impl_->disk_cache_prefix.empty();
+  bool disk_hit = false, disk_write = false, shared_hit = false;
+  if (use_disk_cache &&
+      ReadCachedLods(impl_->GetDiskCachePath(index), new_meshes.get())) {
+    disk_hit = true;
+    impl_->ReleaseUnsimplifiedMesh(index);
+  } else {
+    shared_hit = ComputeSimplifiedMeshes(index, new_meshes->data());
+    disk_write = use_disk_cache &&
+                 WriteCachedLods(impl_->GetDiskCachePath(index), *new_meshes);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(lock_stripe.mutex);
+    {
+      std::lock_guard<std::mutex> cache_lock(impl_->cache_mutex);
+      impl_->cache_statistics.disk_hits += disk_hit;
+      impl_->cache_statistics.disk_writes += disk_write;
+      impl_->cache_statistics.shared_hits += shared_hit;
+      impl_->InsertCachedMeshes(index, new_meshes);
+    }
+    in_progress = 0;
+  }
+  lock_stripe.computed.notify_all();
+  return new_meshes;
+}
+
+void OnDemandObjectMeshGenerator::GetSimplifiedMeshes(
+    const uint64_t* object_ids, size_t num_objects, int lod,
+    std::shared_ptr<const std::string>* meshes, int num_threads) {
+  ParallelFor(num_objects, num_threads, [&](size_t i) {
+    meshes[i] = GetSimplifiedMesh(object_ids[i], lod);
+  });
+}
+
+std::vector<size_t> OnDemandObjectMeshGenerator::GetPrecomputeOrder() {
+  const size_t num_objects = impl_->object_ids.size();
+  // Estimated cost and dense index of each object.
+  std::vector<std::pair<uint64_t, size_t>> objects(num_objects);
+  for (size_t index = 0; index < num_objects; ++index) {
+    uint64_t cost = 0;
+    {
+      // The unsimplified mesh may concurrently be taken by another thread
+      // that marks the object as in progress.
+      std::lock_guard<std::mutex> lock(impl_->GetLockStripe(index).mutex);
+      if (!impl_->in_progress[index]) {
+        cost = impl_->GetUnsimplifiedMeshBytes(index);
+      }
+    }
+    if (cost == 0 && !impl_->bounding_boxes.empty()) {
+      const auto& box = impl_->bounding_boxes[index];
+      cost = 1;
+      for (int i = 0; i < 3; ++i) {
+        cost *= static_cast<uint64_t>(box.end[i] - box.start[i]);
+      }
+    }
+    objects[index] = std::make_pair(cost, index);
+  }
+  std::sort(objects.begin(), objects.end(),
+            std::greater<std::pair<uint64_t, size_t>>());
+  std::vector<size_t> order(num_objects);
+  for (size_t i = 0; i < num_objects; ++i) order[i] = objects[i].second;
+  return order;
+}
+
+void OnDemandObjectMeshGenerator::PrecomputeAll(int num_threads) {
+  WaitUntilBuilt();
+  const std::vector<size_t> order = GetPrecomputeOrder();
+  ParallelFor(order.size(), num_threads,
+              [&](size_t i) { GetEncodedLods(order[i]); });
+}
+
+void OnDemandObjectMeshGenerator::PrecomputeInBackground(
+    std::function<void()> done) {
+  WaitUntilBuilt();
+  const std::vector<size_t> order = GetPrecomputeOrder();
+  if (order.empty()) {
+    if (done) done();
+    return;
+  }
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(impl_->queue_mutex);
+    generation = impl_->background_generation;
+    impl_->queued_background += order.size();
+  }
+  // Number of queued computations that have not yet finished.
+  auto remaining = std::make_shared<std::atomic<size_t>>(order.size());
+  auto& pool = GetMeshRequestPool();
+  for (const size_t index : order) {
+    OnDemandObjectMeshGenerator generator = *this;
+    pool.Schedule(kBackgroundPriority, [generator, index, generation,
+                                        remaining, done]() mutable {
+      if (generator.StartBackgroundComputation(index, generation)) {
+        generator.GetEncodedLods(index);
+      }
+      if (--*remaining == 0 && done) done();
+    });
+  }
+}
+
+bool OnDemandObjectMeshGenerator::StartBackgroundComputation(
+    size_t index, uint64_t generation) {
+  Impl& impl = *impl_;
+  {
+    std::lock_guard<std::mutex> lock(impl.queue_mutex);
+    if (impl.background_generation != generation) return false;
+    --impl.queued_background;
+  }
+  {
+    // Skip objects that a request has computed or is computing, rather than
+    // counting a cache hit or waiting for it.
+    std::lock_guard<std::mutex> lock(impl.GetLockStripe(index).mutex);
+    if (impl.in_progress[index]) return false;
+  }
+  std::lock_guard<std::mutex> lock(impl.cache_mutex);
+  return !impl.cached_meshes[index];
+}
+
+void OnDemandObjectMeshGenerator::CancelBackground() {
+  std::lock_guard<std::mutex> lock(impl_->queue_mutex);
+  ++impl_->background_generation;
+  impl_->queued_background = 0;
+}
+
+double OnDemandObjectMeshGenerator::build_progress() const {
+  const Impl& impl = *impl_;
+  const int64_t total = impl.build_scan_planes + impl.build_march_planes;
+  if ((impl.build_done && !impl.build_cancelled) || total == 0) return 1;
+  int64_t done = impl.progress.marched_planes;
+  {
+    std::lock_guard<std::mutex> lock(impl_->build_mutex);
+    if (impl.labels_ready) done += impl.build_scan_planes;
+  }
+  return std::min(1.0, static_cast<double>(done) / total);
+}
+
+bool OnDemandObjectMeshGenerator::IsBuilt() const {
+  return impl_->build_done && !impl_->build_cancelled;
+}
+
+void OnDemandObjectMeshGenerator::CancelBuild() {
+  std::lock_guard<std::mutex> lock(impl_->build_mutex);
+  if (!impl_->build_done) impl_->progress.cancelled = true;
+}
+
+bool OnDemandObjectMeshGenerator::build_cancelled() const {
+  return impl_->build_done && impl_->build_cancelled;
+}
+
+void OnDemandObjectMeshGenerator::WaitUntilBuilt() const {
+  impl_->WaitForBuild();
+}
+
+bool OnDemandObjectMeshGenerator::ComputeSimplifiedMeshes(
+    size_t index, std::string* encoded_lods) {
+  trace_events::ObjectScope object_scope(impl_->object_ids.ids()[index]);
+  trace_events::Span span("ComputeSimplifiedMeshes", "triangles");
+  auto object_start = std::chrono::steady_clock::now();
+  auto lap_start = object_start;
+  MeshingStatistics statistics;
+  TriangleMesh unsimplified_mesh;
+  impl_->TakeUnsimplifiedMesh(index, &unsimplified_mesh);
+  statistics.march_ns += LapNanoseconds(&lap_start);
+  span.set_size(unsimplified_mesh.triangles.size());
+  if (unsimplified_mesh.triangles.empty()) {
+    // The object has no surface within the volume.
+    return false;
+  }
+  auto& shared_store = GetSharedMeshStore();
+  const bool use_shared_store = shared_store.capacity() != 0;
+  std::shared_ptr<SharedMemoryCache> shared_segment;
+  {
+    auto& segment = GetSharedMeshSegment();
+    std::lock_guard<std::mutex> lock(segment.mutex);
+    shared_segment = segment.cache;
+  }
+  const int num_lods = impl_->simplify_options.num_lods;
+  uint64_t shared_key = 0;
+  if (use_shared_store || shared_segment) {
+    shared_key = HashEncodeOptions(
+        HashTriangleMesh(unsimplified_mesh), impl_->voxel_size.data(),
+        impl_->offset.data(), impl_->simplify_options, impl_->encoding,
+        impl_->optimize_vertex_cache, impl_->vertex_normals,
+        impl_->voxel_faces);
+    if (use_shared_store) {
+      if (auto meshes = shared_store.Find(shared_key)) {
+        std::copy(meshes->begin(), meshes->end(), encoded_lods);
+        return true;
+      }
+    }
+    // The segment outlives the process, so its keys include the version.
+    std::string serialized;
+    if (shared_segment &&
+        shared_segment->Find(MixHash(shared_key, kMeshCacheVersion),
+                             &serialized) &&
+        ParseLods(serialized, num_lods, encoded_lods)) {
+      if (use_shared_store) {
+        shared_store.Insert(
+            shared_key, std::make_shared<const SharedMeshStore::EncodedLods>(
+                            encoded_lods, encoded_lods + num_lods));
+      }
+      return true;
+    }
+  }
+  impl_->SimplifyAndEncode(impl_->simplify_options, &unsimplified_mesh,
+                           encoded_lods, &statistics);
+  impl_->RecordStatistics(impl_->object_ids.ids()[index], statistics,
+                          LapNanoseconds(&object_start));
+  if (use_shared_store) {
+    shared_store.Insert(shared_key,
+                        std::make_shared<const SharedMeshStore::EncodedLods>(
+                            encoded_lods, encoded_lods + num_lods));
+  }
+  if (shared_segment) {
+    shared_segment->Insert(MixHash(shared_key, kMeshCacheVersion),
+                           SerializeLods(encoded_lods, num_lods));
+  }
+  return false;
+}
+
+void SetSharedMeshStoreCapacity(size_t max_bytes) {
+  GetSharedMeshStore().SetCapacity(max_bytes);
+}
+
+size_t GetSharedMeshStoreCapacity() {
+  return GetSharedMeshStore().capacity();
+}
+
+bool SetSharedMeshSegment(const std::string& path, size_t max_bytes,
+                          std::string* error) {
+  std::shared_ptr<SharedMemoryCache> cache;
+  if (!path.empty()) {
+    cache = std::make_shared<SharedMemoryCache>();
+    if (!cache->Open(path, max_bytes, error)) return false;
+  }
+  auto& segment = GetSharedMeshSegment();
+  std::lock_guard<std::mutex> lock(segment.mutex);
+  segment.cache = std::move(cache);
+  return true;
+}
+
+bool ReleaseFreeMemory() {
+#if defined(__GLIBC__)
+  return malloc_trim(0) != 0;
+#else
+  return false;
+#endif
+}
+
+constexpr size_t OnDemandObjectMeshGenerator::Impl::kNumLockStripes;
+
+std::array<int64_t, 3> OnDemandObjectMeshGenerator::volume_size() const {
+  return impl_->size;
+}
+
+std::array<float, 3> OnDemandObjectMeshGenerator::voxel_size() const {
+  return impl_->voxel_size;
+}
+
+int OnDemandObjectMeshGenerator::num_lods() const {
+  return impl_->simplify_options.num_lods;
+}
+
+MeshEncoding OnDemandObjectMeshGenerator::encoding() const {
+  return impl_->encoding;
+}
+
+VertexNormalEncoding OnDemandObjectMeshGenerator::vertex_normals() const {
+  return impl_->vertex_normals;
+}
+
+const std::vector<uint64_t>& OnDemandObjectMeshGenerator::object_ids() const {
+  WaitUntilBuilt();
+  return impl_->object_ids.ids();
+}
+
+CacheStatistics OnDemandObjectMeshGenerator::GetCacheStatistics() const {
+  std::lock_guard<std::mutex> lock(impl_->cache_mutex);
+  return impl_->cache_statistics;
+}
+
+MeshingStatistics OnDemandObjectMeshGenerator::GetMeshingStatistics() const {
+  MeshingStatistics statistics;
+  {
+    std::lock_guard<std::mutex> lock(impl_->statistics_mutex);
+    statistics = impl_->meshing_statistics;
+  }
+  std::lock_guard<std::mutex> lock(impl_->queue_mutex);
+  statistics.queued_requests = impl_->queued_requests;
+  statistics.queued_background = impl_->queued_background;
+  return statistics;
+}
+
+namespace {
+template <class T>
+size_t GetVectorBytes(const std::vector<T>& v) {
+  return v.capacity() * sizeof(T);
+}
+}  // namespace
+
+MemoryStatistics OnDemandObjectMeshGenerator::GetMemoryStatistics() const {
+  Impl& impl = *impl_;
+  MemoryStatistics statistics;
+  statistics.construction_bytes = impl.progress.working_bytes.bytes;
+  statistics.peak_construction_bytes = impl.progress.working_bytes.peak_bytes;
+  statistics.simplification_bytes = impl.simplification_bytes.bytes;
+  statistics.peak_simplification_bytes =
+      impl.simplification_bytes.peak_bytes;
+  statistics.label_copy_bytes = impl.label_copy_bytes;
+  {
+    std::lock_guard<std::mutex> lock(impl.statistics_mutex);
+    statistics.unsimplified_bytes = impl.meshing_statistics.unsimplified_bytes;
+  }
+  {
+    std::lock_guard<std::mutex> lock(impl.cache_mutex);
+    statistics.cached_bytes = impl.cache_statistics.num_bytes;
+  }
+  // The remaining members are only final once construction is done.
+  if (!impl.build_done) return statistics;
+  for (const auto& p : impl.preview_meshes) {
+    statistics.preview_bytes += p.second->size();
+  }
+  statistics.index_bytes =
+      impl.object_ids.num_bytes() + impl.label_ids.num_bytes() +
+      GetVectorBytes(impl.bounding_boxes) +
+      GetVectorBytes(impl.voxel_counts) +
+      GetVectorBytes(impl.boundary_cube_counts) +
+      GetVectorBytes(impl.surface_areas) + GetVectorBytes(impl.label_boxes) +
+      GetVectorBytes(impl.label_voxel_counts) +
+      GetVectorBytes(impl.in_progress) + GetVectorBytes(impl.cached_meshes) +
+      GetVectorBytes(impl.gzipped_meshes) +
+      GetVectorBytes(impl.lru_positions) +
+      GetVectorBytes(impl.unsimplified_meshes) +
+      GetVectorBytes(impl.compact_meshes);
+  return statistics;
+}
+
+std::vector<ObjectStatistics>
+OnDemandObjectMeshGenerator::GetObjectStatistics() const {
+  WaitUntilBuilt();
+  const Impl& impl = *impl_;
+  std::vector<ObjectStatistics> result(impl.object_ids.size());
+  for (size_t index = 0; index < result.size(); ++index) {
+    auto& statistics = result[index];
+    statistics.object_id = impl.object_ids.ids()[index];
+    if (!impl.bounding_boxes.empty()) {
+      const auto& box = impl.bounding_boxes[index];
+      for (int i = 0; i < 3; ++i) {
+        statistics.start[i] = box.start[i];
+        statistics.end[i] = box.end[i];
+      }
+      statistics.num_voxels = impl.voxel_counts[index];
     }
-    simplify_options.max_quadrics_error *= voxel_volume * voxel_volume;
-    if (!SimplifyMesh(simplify_options, &triangle_mesh)) {
-      // Can't happen.
-      return empty_string;
+    if (!impl.surface_areas.empty()) {
+      statistics.num_boundary_cubes = impl.boundary_cube_counts[index];
+      statistics.surface_area = impl.surface_areas[index];
     }
   }
-  std::string encoded = EncodeMesh(triangle_mesh);
-  return impl_->simplified_meshes.emplace(object_id, std::move(encoded))
-      .first->second;
+  return result;
 }
 
 #define DO_INSTANTIATE(Label)                                           \
   template OnDemandObjectMeshGenerator::OnDemandObjectMeshGenerator(    \
       const Label* labels, const int64_t* size, const int64_t* strides, \
       const float voxel_size[3], const float offset[3],                 \
-      const SimplifyOptions& simplify_options);                         \
+      const SimplifyOptions& simplify_options,                          \
+      const MeshingOptions& meshing_options);                           \
+  template OnDemandObjectMeshGenerator                                  \
+  OnDemandObjectMeshGenerator::UpdateRegion(                            \
+      const Label* labels, const int64_t* strides,                      \
+      const int64_t region_start[3], const int64_t region_end[3]) const; \
+  template OnDemandObjectMeshGenerator                                  \
+  OnDemandObjectMeshGenerator::UpdateEquivalences(                      \
+      const Label* labels, const int64_t* strides,                      \
+      std::shared_ptr<const LabelEquivalences> equivalences) const;     \
+  template OnDemandObjectMeshGenerator                                  \
+  OnDemandObjectMeshGenerator::ReleaseUnsimplifiedMeshes(               \
+      const Label* labels, const int64_t* strides) const;               \
 /**/
 DO_INSTANTIATE(uint8_t)
 DO_INSTANTIATE(uint16_t)
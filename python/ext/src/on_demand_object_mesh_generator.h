@@ -17,13 +17,47 @@
 #ifndef NEUROGLANCER_ON_DEMAND_OBJECT_MESH_GENERATOR_H
 #define NEUROGLANCER_ON_DEMAND_OBJECT_MESH_GENERATOR_H
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
+
+#include "mesh_objects.h"
 
 namespace neuroglancer {
 namespace meshing {
 
+// Implementation used to simplify meshes.
+enum class SimplifierEngine {
+  // OpenMesh decimater, which requires converting each mesh into a halfedge
+  // data structure.
+  kOpenMesh,
+
+  // Halfedge collapses performed directly on the vertex and triangle arrays
+  // (see quadric_simplifier.h).  Uses the same collapse criteria as kOpenMesh,
+  // but the results are not identical since collapses of equal priority may
+  // be performed in a different order.
+  kFlatArrays,
+};
+
+// Priority queue of collapses used by SimplifierEngine::kFlatArrays.  Both
+// perform collapses in order of increasing error.
+enum class SimplifierQueue {
+  // Binary heap in which each vertex records the position of its entry, so
+  // that the entry is updated in place when the vertex is requeued.
+  kIndexedHeap,
+
+  // Binary heap to which each requeued vertex adds a new entry, with stale
+  // entries skipped when popped.  Avoids the scattered position updates of
+  // kIndexedHeap at the cost of a larger heap, which can be faster for meshes
+  // with millions of vertices.  Collapses of equal priority may be performed
+  // in a different order than with kIndexedHeap.
+  kLazyHeap,
+};
+
 struct SimplifyOptions {
   // Maximum quadrics error.  Set this to a negative value to disable
   // simplification.
@@ -34,26 +68,596 @@ struct SimplifyOptions {
   double max_normal_angle_deviation = 90;
 
   bool lock_boundary_vertices = true;
+
+  // Number of levels of detail to generate per object.  Level 0 is simplified
+  // with max_quadrics_error, and each level `i > 0` is derived by further
+  // simplifying level `i - 1` with a maximum quadrics error of
+  // `max_quadrics_error * pow(lod_quadrics_error_factor, i)`.
+  int num_lods = 1;
+
+  double lod_quadrics_error_factor = 4;
+
+  // Hard caps on the size of each level of detail.  A mesh that exceeds a cap
+  // after simplification within the maximum quadrics error is simplified
+  // further, in order of increasing error but without an error bound, until it
+  // is within all caps or no further collapse is permitted.  The caps also
+  // apply if the maximum quadrics error is negative.  A value of 0 means no
+  // cap.
+
+  // Maximum number of triangles.
+  size_t max_triangles = 0;
+
+  // Maximum number of triangles, as a fraction of the number of triangles of
+  // the unsimplified mesh.
+  double max_triangle_ratio = 0;
+
+  // Maximum size in bytes of the encoded mesh.
+  size_t max_mesh_bytes = 0;
+
+  SimplifierEngine engine = SimplifierEngine::kOpenMesh;
+
+  // Only used by SimplifierEngine::kFlatArrays.
+  SimplifierQueue queue = SimplifierQueue::kIndexedHeap;
+
+  // If non-zero, meshes with more than this many triangles are divided into
+  // spatial cells of about this many triangles each, which are simplified in
+  // parallel with the vertices shared between cells locked.  The merged mesh
+  // is then simplified again to remove the seams.  Only supported by
+  // SimplifierEngine::kFlatArrays.
+  size_t partition_triangles = 0;
+
+  // Number of threads used for partitioned simplification, or 0 to use the
+  // number of hardware threads.
+  int num_threads = 0;
+};
+
+// Format of the encoded meshes returned by OnDemandObjectMeshGenerator.
+enum class MeshEncoding {
+  // uint32le num_vertices, followed by float32le vertex positions [x, y, z],
+  // followed by uint32le triangle vertex indices.
+  kRaw,
+
+  // Vertex positions quantized relative to the bounding box of the mesh, with
+  // the narrowest vertex index type.  All values are little endian:
+  //
+  //   uint32 0xffffffff (distinguishes this from kRaw)
+  //   uint32 position_bits (16 or 10)
+  //   uint32 num_vertices
+  //   uint32 num_triangles
+  //   float32 origin[3], scale[3]
+  //   positions, where the position of a vertex is `origin + scale * q` for
+  //     its quantized position `q`: for 16 bits, uint16 [x, y, z] per vertex
+  //     padded to a multiple of 4 bytes; for 10 bits, one uint32 per vertex
+  //     with x, y, z in bits 0-9, 10-19, 20-29
+  //   triangle vertex indices, uint16 if num_vertices <= 65536, else uint32
+  kQuantized16,
+  kQuantized10,
+};
+
+// Per-vertex normals optionally appended to the encoded meshes.  The normal of
+// each vertex is the sum of the cross products of the edges of its triangles,
+// i.e. of their normals weighted by area, and is computed after
+// simplification.  It is stored normalized in the octahedral encoding of
+// Cigolle et al., "A Survey of Efficient Representations for Independent Unit
+// Vectors" (JCGT 2014), as two little-endian signed normalized integers per
+// vertex, as decoded by the client.
+//
+// With MeshEncoding::kRaw, the normals follow the triangle vertex indices,
+// padded with zeros to a multiple of 4 bytes, and are followed by the uint32le
+// word `0xffffff00 | bits`, where `bits` is the number of bits per integer.
+// With the quantized encodings, the position_bits word of the header is
+// `position_bits | (bits << 8)`, and the normals follow the triangle vertex
+// indices at the next multiple of 4 bytes, padded to a multiple of 4 bytes.
+enum class VertexNormalEncoding {
+  kNone,
+  kOctahedral8,
+  kOctahedral16,
+};
+
+struct MeshingOptions {
+  // If true, construction only computes the bounding box of each object, and
+  // the surface of an object is computed by marching over just its bounding box
+  // when its mesh is first requested.  The label array must then remain valid
+  // for the lifetime of the generator.
+  bool lazy = false;
+
+  // If non-zero, the volume is meshed in blocks of this many cubes along each
+  // dimension, which bounds the working set when the labels are, for example,
+  // memory mapped.  Ignored in lazy mode.
+  std::array<int64_t, 3> block_size = {{0, 0, 0}};
+
+  // Number of threads used to compute the unsimplified meshes at construction,
+  // or 0 to use the number of hardware threads.  Ignored in lazy mode.
+  int num_threads = 0;
+
+  // If non-zero, the least recently used simplified meshes are evicted once
+  // their total encoded size exceeds this many bytes, and recomputed from the
+  // bounding box of the object if requested again.  As in lazy mode, the label
+  // array must then remain valid for the lifetime of the generator.
+  size_t max_cache_bytes = 0;
+
+  MeshEncoding encoding = MeshEncoding::kRaw;
+
+  // If true, the triangles of each encoded mesh are reordered to improve the
+  // post-transform vertex cache hit rate when rendered, and the vertices are
+  // renumbered in order of first use (see vertex_cache_optimizer.h).  The
+  // geometry and the encoded size are unchanged.
+  bool optimize_vertex_cache = false;
+
+  VertexNormalEncoding vertex_normals = VertexNormalEncoding::kNone;
+
+  // If non-null, labels are merged into objects as specified, and each object
+  // is meshed as the union of its labels, as if the volume had been relabeled
+  // (see LabelEquivalences in mesh_objects.h).
+  std::shared_ptr<const LabelEquivalences> equivalences;
+
+  // If true, the unsimplified meshes computed at construction are retained
+  // until simplified as CompactTriangleMesh (see mesh_objects.h) rather than as
+  // TriangleMesh, which reduces their memory several-fold at the cost of
+  // converting each mesh once in each direction.  Ignored in lazy mode.
+  bool compact_meshes = false;
+
+  // If non-null, only the objects whose ids are in this sorted vector are
+  // meshed, and all other objects are treated as absent from the volume.  This
+  // saves the time and memory of meshing objects that are never requested.
+  std::shared_ptr<const std::vector<uint64_t>> allowed_ids;
+
+  // Algorithm used to compute the unsimplified meshes at construction (see
+  // MeshObjects).  Ignored in lazy mode and with a block size, in which case
+  // marching cubes is used.
+  MeshingEngine engine = MeshingEngine::kMarchingCubes;
+
+  // If non-empty, an existing directory in which the encoded meshes of each
+  // object are stored once computed, and from which they are read rather than
+  // computed when not in memory.  Files are named by a hash of the label
+  // values, the volume size and all options that affect the encoded meshes,
+  // so a generator for unchanged labels and options, e.g. after a restart,
+  // serves the stored meshes without simplifying them, and, in lazy mode,
+  // without marching cubes.  Files of other volumes or options are ignored,
+  // and failures to read or write the directory only cost recomputation.
+  // Computing the hash takes one pass over the labels at construction.  Not
+  // used by generators returned by UpdateRegion and UpdateEquivalences.
+  std::string cache_directory;
+
+  // If true, construction returns immediately, and the work it would do is
+  // done on a separate thread, which can be monitored with build_progress and
+  // stopped with CancelBuild.  The label array must then remain valid until
+  // the build is done.  Requests for meshes wait only for the objects they
+  // need: first for the scan of the labels, and then, with the marching cubes
+  // engine, for the z slabs of the march that contain the object, which are
+  // marched in increasing z order (see MeshingProgress in mesh_objects.h).
+  // Methods that need all objects, such as object_ids and PrecomputeAll, wait
+  // for the whole build.
+  bool background = false;
+
+  // If positive along each dimension, construction also computes a coarse
+  // preview mesh of each object, for display until its full-resolution mesh
+  // is available (see GetPreviewMesh).  The labels are downsampled by this
+  // factor, taking the most frequent label of each window, and the result is
+  // meshed and simplified to a single level of detail, with the voxel size
+  // and offset scaled to match.  This takes a fraction of the time of the
+  // full-resolution meshes, so with `background` it is done first, and with
+  // `lazy` it is most of the work of construction.  Not computed for
+  // generators returned by UpdateRegion and UpdateEquivalences.
+  std::array<int64_t, 3> preview_factor = {{0, 0, 0}};
+
+  // If true, and the labels are not stored with x varying fastest and then y,
+  // construction first copies them into that layout with `num_threads` threads
+  // (see CopyLabelsXFastest in mesh_objects.h) and reads only the copy, so the
+  // cost of meshing does not depend on the order of the strides.  The copy is
+  // released once construction is done, except in lazy mode or with a limited
+  // cache size, in which it is retained for the lifetime of the generator.
+  // Ignored with a block size.  Not used by generators returned by
+  // UpdateRegion and UpdateEquivalences.
+  bool relayout_labels = false;
+
+  // If true, the unsimplified mesh of each object computed at construction is
+  // shrunk to fit once complete, releasing the capacity left over by the
+  // march, which is otherwise retained until the mesh is simplified.  Ignored
+  // with `compact_meshes`, whose meshes have no spare capacity.
+  bool shrink_unsimplified_meshes = false;
+
+  // If true, memory freed during construction is returned to the operating
+  // system once it is done (see ReleaseFreeMemory).
+  bool release_memory_after_build = false;
+
+  // If true, the mesh of each object is the surface of its voxels, with
+  // coplanar faces merged into rectangles (see MeshObjectVoxelFaces in
+  // voxel_faces.h), computed from its bounding box when first requested as in
+  // lazy mode, and encoded without simplification, so `simplify_options`
+  // other than `num_lods` are ignored.  This is an order of magnitude cheaper
+  // than marching cubes followed by simplification, for interactive use where
+  // latency matters more than smoothness.  Preview meshes are still computed
+  // by marching cubes.
+  bool voxel_faces = false;
+};
+
+struct CacheStatistics {
+  // Number of requests served from the cache.
+  uint64_t hits = 0;
+  // Number of requests that computed the simplified meshes of an object, or
+  // read them from MeshingOptions::cache_directory.
+  uint64_t misses = 0;
+  // Number of misses served from MeshingOptions::cache_directory, and of
+  // objects whose computed meshes were stored in it.
+  uint64_t disk_hits = 0;
+  uint64_t disk_writes = 0;
+  // Number of misses served from the shared mesh store (see
+  // SetSharedMeshStoreCapacity) or the shared mesh segment (see
+  // SetSharedMeshSegment).
+  uint64_t shared_hits = 0;
+  // Number of objects whose meshes were evicted from the cache.
+  uint64_t evictions = 0;
+  // Number of objects currently cached, and the total encoded size of their
+  // meshes.
+  uint64_t num_cached = 0;
+  uint64_t num_bytes = 0;
+};
+
+// Counters of the work done to compute simplified meshes.  Times are
+// cumulative wall-clock nanoseconds, summed over all threads.
+struct MeshingStatistics {
+  // Time spent computing unsimplified meshes by marching cubes, both at
+  // construction and on demand.
+  uint64_t march_ns = 0;
+  // Time spent preparing unsimplified meshes for simplification: converting
+  // them to halfedge meshes for SimplifierEngine::kOpenMesh, or transforming
+  // their vertex positions for SimplifierEngine::kFlatArrays.
+  uint64_t convert_ns = 0;
+  uint64_t simplify_ns = 0;
+  // Time spent encoding meshes, including vertex cache reordering.
+  uint64_t encode_ns = 0;
+
+  // Number of objects whose simplified meshes were computed, counting
+  // recomputations after eviction.
+  uint64_t num_objects = 0;
+  // Total number of triangles of their unsimplified meshes, and of all of
+  // their encoded levels of detail.
+  uint64_t triangles_in = 0;
+  uint64_t triangles_out = 0;
+  // Total encoded size of all levels of detail computed.
+  uint64_t bytes_out = 0;
+
+  // Object whose simplified meshes took the longest to compute, excluding
+  // marching cubes at construction, and the time taken.
+  uint64_t slowest_object_id = 0;
+  uint64_t slowest_object_ns = 0;
+  // Object with the most unsimplified triangles, and their number.
+  uint64_t largest_object_id = 0;
+  uint64_t largest_object_triangles = 0;
+
+  // Memory currently retained by the unsimplified meshes computed at
+  // construction that have not yet been simplified, including unused
+  // capacity.
+  uint64_t unsimplified_bytes = 0;
+
+  // Current number of requests queued by RequestSimplifiedMesh, and of
+  // objects queued by PrecomputeInBackground, that have not yet started.
+  uint64_t queued_requests = 0;
+  uint64_t queued_background = 0;
+};
+
+// Memory currently retained by a generator, by category, in bytes.  The peaks
+// are over the lifetime of the generator.
+struct MemoryStatistics {
+  // Working memory of the march at construction other than the meshes
+  // themselves (see MeshingProgress::working_bytes), which is zero once it is
+  // done, and its peak.
+  uint64_t construction_bytes = 0;
+  uint64_t peak_construction_bytes = 0;
+  // Unsimplified meshes computed at construction and not yet simplified (see
+  // MeshingStatistics::unsimplified_bytes).
+  uint64_t unsimplified_bytes = 0;
+  // Cached simplified meshes, including their gzipped copies (see
+  // CacheStatistics::num_bytes), and the encoded preview meshes.
+  uint64_t cached_bytes = 0;
+  uint64_t preview_bytes = 0;
+  // Estimated temporary memory of the simplifications in progress, e.g. the
+  // halfedge meshes and decimater of SimplifierEngine::kOpenMesh, and its
+  // peak.
+  uint64_t simplification_bytes = 0;
+  uint64_t peak_simplification_bytes = 0;
+  // Copy of the labels made for MeshingOptions::relayout_labels.
+  uint64_t label_copy_bytes = 0;
+  // Per-object indices: ids, bounding boxes and statistics.
+  uint64_t index_bytes = 0;
+};
+
+// Statistics of a single object that are obtained while scanning or marching
+// the volume, so that objects can be filtered or framed without requesting
+// their meshes.
+struct ObjectStatistics {
+  uint64_t object_id = 0;
+  // Half-open bounding box of the voxels of the object, in voxels, in the order
+  // x, y, z.  Empty (start == end) if not known.  May be larger than the
+  // object after UpdateRegion.
+  std::array<int64_t, 3> start = {{0, 0, 0}};
+  std::array<int64_t, 3> end = {{0, 0, 0}};
+  // Number of voxels of the object, or -1 if not known.
+  int64_t num_voxels = -1;
+  // Number of 2x2x2 voxel cubes that contain both the object and some other
+  // object or background, and the area of its unsimplified surface in the
+  // units of the voxel size, or -1 if not known.
+  int64_t num_boundary_cubes = -1;
+  double surface_area = -1;
 };
 
 class OnDemandObjectMeshGenerator {
   struct Impl;
 
  public:
+  // Computes the unsimplified mesh of an object from a bounding box containing
+  // all of its voxels.
+  using MeshObjectFunction = std::function<void(
+      uint64_t object_id, const BoundingBox& bounding_box, TriangleMesh* mesh)>;
+
   OnDemandObjectMeshGenerator() = default;
 
   // Label must be one of uint8_t, uint16_t, uint32_t, uint64_t.
   template <class Label>
-  OnDemandObjectMeshGenerator(const Label* labels, const int64_t* size,
-                              const int64_t* strides, const float voxel_size[3],
-                              const float offset[3],
-                              const SimplifyOptions& simplify_options);
+  OnDemandObjectMeshGenerator(
+      const Label* labels, const int64_t* size, const int64_t* strides,
+      const float voxel_size[3], const float offset[3],
+      const SimplifyOptions& simplify_options,
+      const MeshingOptions& meshing_options = MeshingOptions());
+
+  // Returns the encoded mesh of the specified level of detail, which must be in
+  // [0, num_lods()), or an empty string if there is no such object.  All
+  // levels of an object are computed when any of them is first requested.
+  //
+  // This may be called concurrently from multiple threads.  Concurrent
+  // requests for the same object wait for a single computation.  The returned
+  // mesh remains valid even if it is subsequently evicted from the cache.
+  std::shared_ptr<const std::string> GetSimplifiedMesh(uint64_t object_id,
+                                                       int lod = 0);
+
+  // Returns the mesh returned by GetSimplifiedMesh compressed in the gzip
+  // format, or an empty string if that mesh is empty or gzip is not supported
+  // (see sharding::HaveGzip).  All levels of an object are compressed when any
+  // of them is first requested, and cached along with its meshes, so that
+  // they can be served with Content-Encoding: gzip without compressing them
+  // again.
+  std::shared_ptr<const std::string> GetGzippedMesh(uint64_t object_id,
+                                                    int lod = 0);
+
+  // Obtains the encoded mesh of the specified level of detail, as by
+  // GetSimplifiedMesh, without waiting for it to be computed.  If the object
+  // does not exist or its meshes are cached, `callback` is called with the
+  // result before returning.  Otherwise the computation is queued on a pool of
+  // worker threads, one per hardware thread, shared by all generators, and
+  // `callback` is called on the worker thread.  Queued requests of higher
+  // `priority` are served first.  The generator is retained until `callback`
+  // has returned.  If `gzip` is true, the mesh is as returned by
+  // GetGzippedMesh, and is also compressed on the worker thread.
+  void RequestSimplifiedMesh(
+      uint64_t object_id, int lod, int priority,
+      std::function<void(std::shared_ptr<const std::string>)> callback,
+      bool gzip = false);
+
+  // Computes the encoded mesh of the specified level of detail of an object as
+  // a sequence of independently encoded spatial fragments, and calls
+  // `callback` with each fragment as soon as it is computed, so that a large
+  // object can be displayed long before all of it is simplified.
+  //
+  // The unsimplified mesh is divided into cells of about `fragment_triangles`
+  // triangles each by PartitionTriangleMesh (see quadric_simplifier.h), which
+  // are simplified in parallel by up to SimplifyOptions::num_threads threads,
+  // or one at a time if called by a WorkerPool task, e.g. by
+  // RequestMeshFragments, with their boundary vertices locked, so that
+  // adjacent fragments join without gaps.  Any maximum numbers of triangles
+  // or bytes are apportioned among the fragments by their numbers of
+  // unsimplified triangles.  The fragments are not cached, and `callback` is
+  // called by one thread at a time.  If the meshes of the object are cached,
+  // or its unsimplified mesh has at most `fragment_triangles` triangles,
+  // `callback` is instead called once with the mesh returned by
+  // GetSimplifiedMesh.
+  //
+  // Returns false, without calling `callback`, if there is no such object or
+  // level of detail, or the object has no surface.
+  bool StreamSimplifiedMesh(
+      uint64_t object_id, int lod, size_t fragment_triangles,
+      const std::function<void(std::shared_ptr<const std::string>)>& callback);
+
+  // Same as StreamSimplifiedMesh, but queued on the worker threads of
+  // RequestSimplifiedMesh with the specified `priority` rather than run on the
+  // calling thread.  `callback` is called on the worker thread with each
+  // fragment and then with null, to mark the end of the fragments.  The
+  // generator is retained until `callback` has returned.
+  void RequestMeshFragments(
+      uint64_t object_id, int lod, int priority, size_t fragment_triangles,
+      std::function<void(std::shared_ptr<const std::string>)> callback);
+
+  // Returns the encoded preview mesh of an object (see
+  // MeshingOptions::preview_factor), or an empty string if there is no
+  // preview or the object has no surface in it, e.g. because it is smaller
+  // than the preview factor.  In a background build, waits only for the
+  // preview to be computed.  May be called concurrently.
+  std::shared_ptr<const std::string> GetPreviewMesh(uint64_t object_id);
+
+  // Retrieves the meshes of `num_objects` objects, as by GetSimplifiedMesh,
+  // using up to `num_threads` threads.  If `num_threads` is 0, the number of
+  // hardware threads is used.
+  void GetSimplifiedMeshes(const uint64_t* object_ids, size_t num_objects,
+                           int lod, std::shared_ptr<const std::string>* meshes,
+                           int num_threads = 0);
+
+  // Computes and caches the meshes of all objects using up to `num_threads`
+  // threads, or the number of hardware threads if `num_threads` is 0.  Objects
+  // are scheduled in decreasing order of the size of their unsimplified mesh
+  // (or of their bounding box in lazy mode), so that the largest objects do not
+  // delay completion, and each unsimplified mesh is released as soon as its
+  // object is done.  If the cache size is limited, only the most recently
+  // computed meshes remain cached.
+  void PrecomputeAll(int num_threads = 0);
+
+  // Priority of the computations queued by PrecomputeInBackground, below that
+  // of any request likely to be queued by RequestSimplifiedMesh.
+  static constexpr int kBackgroundPriority = -(1 << 30);
+
+  // Queues the computation of the meshes of all objects, in the same order as
+  // PrecomputeAll, on the worker threads of RequestSimplifiedMesh with
+  // kBackgroundPriority, and returns immediately.  Requests are therefore
+  // served before any background computation that has not yet started.
+  // Objects that are cached or in progress by the time their turn comes are
+  // skipped.  If not null, `done` is called, on a worker thread or before
+  // returning, once every queued computation has finished, been skipped or
+  // been cancelled.
+  void PrecomputeInBackground(std::function<void()> done = nullptr);
+
+  // Cancels the background computations that have not yet started, e.g. once
+  // this generator has been superseded by UpdateRegion.
+  void CancelBackground();
+
+  // Fraction in [0, 1] of the work of a MeshingOptions::background build that
+  // is done, counting each z plane scanned or marched equally; 1 once the
+  // build is complete, or if there is none.
+  double build_progress() const;
+
+  // Returns true once construction is complete, and not cancelled.
+  bool IsBuilt() const;
+
+  // Stops a MeshingOptions::background build once the z slabs in progress are
+  // marched, e.g. once the labels are about to change.  The generator then
+  // only serves the objects whose unsimplified meshes were complete, and
+  // UpdateRegion and UpdateEquivalences return invalid generators.  Has no
+  // effect once the build is complete.
+  void CancelBuild();
+
+  // Returns true if CancelBuild stopped the build before it was complete.
+  bool build_cancelled() const;
+
+  // Waits until construction is complete or cancelled.
+  void WaitUntilBuilt() const;
+
+  // Returns a generator for `labels`, which must have the same size as the
+  // labels of this generator and may differ from them only within the region
+  // [region_start, region_end).  The cached meshes of objects unaffected by the
+  // change are shared with this generator.  All other meshes are computed on
+  // demand from the bounding box of the object, as in lazy mode, so `labels`
+  // must remain valid for the lifetime of the returned generator.
+  //
+  // Returns an invalid generator if this generator does not have the bounding
+  // boxes of its objects, which is the case in chunked mode without a cache
+  // size limit.
+  template <class Label>
+  OnDemandObjectMeshGenerator UpdateRegion(const Label* labels,
+                                           const int64_t* strides,
+                                           const int64_t region_start[3],
+                                           const int64_t region_end[3]) const;
+
+  // Returns a generator for the same labels as this generator, with the labels
+  // merged into objects according to `equivalences` rather than the
+  // equivalences of this generator, e.g. after segments are merged or split.
+  // The volume is not remeshed: the cached meshes of objects whose set of
+  // labels is unchanged are shared with this generator, and all other meshes
+  // are computed on demand from the bounding box of the object, as in lazy
+  // mode, so `labels` must remain valid for the lifetime of the returned
+  // generator.  A null `equivalences` makes each label its own object.
+  //
+  // Returns an invalid generator under the same conditions as UpdateRegion.
+  template <class Label>
+  OnDemandObjectMeshGenerator UpdateEquivalences(
+      const Label* labels, const int64_t* strides,
+      std::shared_ptr<const LabelEquivalences> equivalences) const;
+
+  // Returns a generator for the same labels as this generator that retains
+  // none of its unsimplified meshes, e.g. to reclaim their memory once the
+  // frequently requested objects are cached.  The cached meshes, preview
+  // meshes and statistics are shared with this generator, which itself is not
+  // modified, so its meshes are only released once it is destroyed.  All other
+  // meshes are computed on demand from the bounding box of the object, as in
+  // lazy mode, so `labels` must remain valid for the lifetime of the returned
+  // generator.
+  //
+  // Returns an invalid generator under the same conditions as UpdateRegion.
+  template <class Label>
+  OnDemandObjectMeshGenerator ReleaseUnsimplifiedMeshes(
+      const Label* labels, const int64_t* strides) const;
+
+  // Size of the label volume, in the order x, y, z.
+  std::array<int64_t, 3> volume_size() const;
+
+  // Size of a voxel in the units of the mesh vertex positions.
+  std::array<float, 3> voxel_size() const;
+
+  int num_lods() const;
+
+  MeshEncoding encoding() const;
+
+  VertexNormalEncoding vertex_normals() const;
+
+  // Sorted ids of all objects.
+  const std::vector<uint64_t>& object_ids() const;
+
+  CacheStatistics GetCacheStatistics() const;
+
+  MeshingStatistics GetMeshingStatistics() const;
+
+  MemoryStatistics GetMemoryStatistics() const;
+
+  // Returns the statistics of all objects, in increasing order of object id.
+  //
+  // Bounding boxes and voxel counts are computed along with the distinct labels
+  // of the volume, and so are not known in chunked mode unless the cache size
+  // is limited.  Boundary cube counts are counted by the march at construction,
+  // and so are not known in lazy or chunked mode, and surface areas are
+  // computed from the meshes of that march, and so are not known in lazy mode.
+  // Generators returned by UpdateRegion and UpdateEquivalences retain the
+  // statistics of unaffected objects, and the voxel counts of all objects whose
+  // labels are unaffected.
+  std::vector<ObjectStatistics> GetObjectStatistics() const;
 
-  const std::string& GetSimplifiedMesh(uint64_t object_id);
   explicit operator bool() { return bool(impl_); }
   std::shared_ptr<Impl> impl_;
+
+ private:
+  // Computes all levels of detail of the object with the specified dense
+  // index.  Leaves `encoded_lods` empty if the object has no surface.  Returns
+  // true if they were obtained from the shared mesh store (see
+  // SetSharedMeshStoreCapacity) rather than computed.
+  bool ComputeSimplifiedMeshes(size_t index, std::string* encoded_lods);
+
+  // Returns the dense indices of all objects in the order in which
+  // PrecomputeAll computes them.
+  std::vector<size_t> GetPrecomputeOrder();
+
+  // Returns whether the background computation of the object with the
+  // specified dense index, queued at `generation`, should proceed.
+  bool StartBackgroundComputation(size_t index, uint64_t generation);
+
+  // Returns all levels of detail of the object with the specified dense index,
+  // computing them if they are not cached.
+  std::shared_ptr<const std::vector<std::string>> GetEncodedLods(size_t index);
 };
 
+// Sets the maximum total encoded size of a process-wide store of simplified
+// meshes shared by all generators, or 0 (the initial default) to disable it.
+// The store is keyed by a hash of the unsimplified mesh of an object and of
+// all options that affect its encoded meshes, but not the object id, so a
+// generator recreated after the labels change, e.g. by
+// LocalVolume.invalidate, serves the objects whose surfaces are unchanged
+// without simplifying them again.  The least recently used meshes are evicted
+// once the capacity is exceeded.
+void SetSharedMeshStoreCapacity(size_t max_bytes);
+
+size_t GetSharedMeshStoreCapacity();
+
+// Attaches the process to a cache of simplified meshes in a shared memory
+// segment backed by the file `path`, e.g. in /dev/shm, which is created with a
+// total size of `max_bytes` if it does not exist, or detaches it if `path` is
+// empty.  All processes attached to the same file, e.g. several servers behind
+// a load balancer, then reuse the meshes simplified by any of them.  Meshes
+// are keyed like those of the shared mesh store, which is consulted first, and
+// the oldest are overwritten once the segment is full (see SharedMemoryCache).
+// Returns false with `error` set on failure, e.g. on Windows.
+bool SetSharedMeshSegment(const std::string& path, size_t max_bytes,
+                          std::string* error);
+
+// Returns memory freed by the process, e.g. by released meshes, to the
+// operating system, where the allocator supports it (glibc).  Returns false if
+// it does not, or if no memory was returned.
+bool ReleaseFreeMemory();
+
 }  // namespace meshing
 }  // namespace neuroglancer
 
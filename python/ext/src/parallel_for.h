@@ -0,0 +1,97 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEUROGLANCER_PARALLEL_FOR_H_
+#define NEUROGLANCER_PARALLEL_FOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace neuroglancer {
+
+namespace internal {
+// Maximum number of threads that ParallelFor calls on the current thread may
+// use, or 0 if not limited.
+inline int& ThreadBudget() {
+  static thread_local int budget = 0;
+  return budget;
+}
+}  // namespace internal
+
+// Limits the ParallelFor calls made on the current thread during its lifetime,
+// including those nested within them, to `num_threads` threads in total, or
+// lifts the limit if 0.
+class ThreadBudgetScope {
+ public:
+  explicit ThreadBudgetScope(int num_threads)
+      : previous_budget_(internal::ThreadBudget()) {
+    internal::ThreadBudget() = num_threads;
+  }
+  ~ThreadBudgetScope() { internal::ThreadBudget() = previous_budget_; }
+
+  ThreadBudgetScope(const ThreadBudgetScope&) = delete;
+  ThreadBudgetScope& operator=(const ThreadBudgetScope&) = delete;
+
+ private:
+  int previous_budget_;
+};
+
+// Calls `fn(i)` for each `i` in [0, n) using up to `num_threads` threads, or
+// the number of hardware threads if `num_threads` is 0.  The calling thread is
+// one of them.  Indices are claimed one at a time in increasing order, so
+// that threads stay busy even if the costs of the calls vary widely.
+//
+// The threads are also limited by the ThreadBudgetScope of the calling
+// thread, if any, and divide the threads requested among the ParallelFor
+// calls nested within `fn`, so that, e.g., meshes simplified in parallel by a
+// ParallelFor over objects do not each start another set of threads.
+inline void ParallelFor(size_t n, int num_threads,
+                        const std::function<void(size_t)>& fn) {
+  const int budget = internal::ThreadBudget();
+  if (num_threads <= 0) {
+    num_threads =
+        budget > 0 ? budget : std::max(1u, std::thread::hardware_concurrency());
+  } else if (budget > 0) {
+    num_threads = std::min(num_threads, budget);
+  }
+  const int total_threads = num_threads;
+  num_threads = static_cast<int>(std::min(static_cast<size_t>(num_threads), n));
+  const int nested_budget =
+      std::max(1, total_threads / std::max(1, num_threads));
+  std::atomic<size_t> next_index(0);
+  const auto worker = [&] {
+    ThreadBudgetScope budget_scope(nested_budget);
+    for (size_t i; (i = next_index++) < n;) {
+      fn(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_PARALLEL_FOR_H_
@@ -0,0 +1,87 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "parallel_for.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace {
+
+// Records the maximum number of threads concurrently in `Run`.
+class ConcurrencyCounter {
+ public:
+  void Run() {
+    const int active = ++active_;
+    int max_active = max_active_;
+    while (active > max_active &&
+           !max_active_.compare_exchange_weak(max_active, active)) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    --active_;
+  }
+
+  int max_active() const { return max_active_; }
+
+ private:
+  std::atomic<int> active_{0};
+  std::atomic<int> max_active_{0};
+};
+
+TEST(ParallelForTest, CallsEachIndexOnce) {
+  std::vector<std::atomic<int>> counts(100);
+  ParallelFor(counts.size(), 4, [&](size_t i) { ++counts[i]; });
+  for (const auto& count : counts) EXPECT_EQ(1, count);
+}
+
+TEST(ParallelForTest, NestedCallsShareTheThreads) {
+  ConcurrencyCounter counter;
+  ParallelFor(4, 2, [&](size_t) {
+    ParallelFor(8, 0, [&](size_t) { counter.Run(); });
+  });
+  EXPECT_LE(counter.max_active(), 2);
+}
+
+TEST(ParallelForTest, NestedCallsUseThreadsLeftUnused) {
+  ConcurrencyCounter counter;
+  // A single outer index leaves 3 of the 4 threads to the nested call.
+  ParallelFor(1, 4, [&](size_t) {
+    ParallelFor(16, 0, [&](size_t) { counter.Run(); });
+  });
+  EXPECT_GT(counter.max_active(), 1);
+  EXPECT_LE(counter.max_active(), 4);
+}
+
+TEST(ParallelForTest, ThreadBudgetScope) {
+  ConcurrencyCounter counter;
+  {
+    ThreadBudgetScope budget_scope(3);
+    ParallelFor(16, 8, [&](size_t) { counter.Run(); });
+  }
+  EXPECT_LE(counter.max_active(), 3);
+  // The budget is restored.
+  ConcurrencyCounter unlimited_counter;
+  ParallelFor(16, 8, [&](size_t) { unlimited_counter.Run(); });
+  EXPECT_GT(unlimited_counter.max_active(), 3);
+}
+
+}  // namespace
+}  // namespace neuroglancer
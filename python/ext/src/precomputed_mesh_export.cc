@@ -0,0 +1,269 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "precomputed_mesh_export.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "parallel_for.h"
+#include "worker_pool.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+namespace {
+
+// Meshes encoded with MeshEncoding::kRaw are sequences of little-endian 32-bit
+// words.
+uint32_t LoadWord(const char* input) {
+  const auto* bytes = reinterpret_cast<const unsigned char*>(input);
+  return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) |
+         (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+}
+
+void StoreWord(uint32_t value, char* output) {
+  for (int i = 0; i < 4; ++i) {
+    output[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+}
+
+// Returns the number of triangles of a mesh encoded with MeshEncoding::kRaw.
+size_t GetNumTriangles(const std::string& mesh) {
+  if (mesh.size() < 4) return 0;
+  const size_t vertex_bytes = size_t(LoadWord(mesh.data())) * 12;
+  if (mesh.size() < 4 + vertex_bytes) return 0;
+  return (mesh.size() - 4 - vertex_bytes) / 12;
+}
+
+bool WriteFile(const std::string& path, const std::string& contents,
+               std::string* error) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(contents.data(), contents.size());
+  file.close();
+  if (!file) {
+    *error = "Failed to write " + path;
+    return false;
+  }
+  return true;
+}
+
+// File prepared for writing.  Unsplit fragments share the encoded mesh
+// returned by the generator.
+struct PendingFile {
+  std::string name;
+  std::shared_ptr<const std::string> contents;
+};
+
+}  // namespace
+
+void SplitRawMesh(const std::string& mesh,
+                  const std::array<float, 3>& fragment_size,
+                  std::vector<std::array<int64_t, 3>>* positions,
+                  std::vector<std::string>* fragments) {
+  positions->clear();
+  fragments->clear();
+  const size_t num_triangles = GetNumTriangles(mesh);
+  if (num_triangles == 0) return;
+  const uint32_t num_vertices = LoadWord(mesh.data());
+  const char* vertex_data = mesh.data() + 4;
+  const char* index_data = vertex_data + size_t(num_vertices) * 12;
+  const auto get_index = [&](size_t triangle, int i) {
+    return LoadWord(index_data + triangle * 12 + i * 4);
+  };
+
+  // Grid position of each triangle, paired with its index, sorted so that the
+  // triangles of each fragment are consecutive and in their original order.
+  std::vector<std::pair<std::array<int64_t, 3>, size_t>> cells(num_triangles);
+  for (size_t triangle = 0; triangle < num_triangles; ++triangle) {
+    auto& position = cells[triangle].first;
+    for (int j = 0; j < 3; ++j) {
+      float centroid = 0;
+      for (int i = 0; i < 3; ++i) {
+        const uint32_t word =
+            LoadWord(vertex_data + size_t(get_index(triangle, i)) * 12 + j * 4);
+        float coordinate;
+        std::memcpy(&coordinate, &word, sizeof(float));
+        centroid += coordinate;
+      }
+      position[j] = static_cast<int64_t>(
+          std::floor(centroid / 3 / fragment_size[j]));
+    }
+    cells[triangle].second = triangle;
+  }
+  std::sort(cells.begin(), cells.end());
+
+  // New index of each vertex within the current fragment.
+  constexpr uint32_t kNotUsed = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> new_indices(num_vertices, kNotUsed);
+  std::vector<uint32_t> used_vertices;
+  for (size_t begin = 0, end; begin < num_triangles; begin = end) {
+    end = begin + 1;
+    while (end < num_triangles && cells[end].first == cells[begin].first) {
+      ++end;
+    }
+    used_vertices.clear();
+    for (size_t i = begin; i < end; ++i) {
+      for (int k = 0; k < 3; ++k) {
+        const uint32_t vertex = get_index(cells[i].second, k);
+        if (new_indices[vertex] == kNotUsed) {
+          new_indices[vertex] = static_cast<uint32_t>(used_vertices.size());
+          used_vertices.push_back(vertex);
+        }
+      }
+    }
+    std::string fragment(4 + used_vertices.size() * 12 + (end - begin) * 12,
+                         '\0');
+    char* output = &fragment[0];
+    StoreWord(static_cast<uint32_t>(used_vertices.size()), output);
+    output += 4;
+    for (const uint32_t vertex : used_vertices) {
+      std::memcpy(output, vertex_data + size_t(vertex) * 12, 12);
+      output += 12;
+    }
+    for (size_t i = begin; i < end; ++i) {
+      for (int k = 0; k < 3; ++k) {
+        StoreWord(new_indices[get_index(cells[i].second, k)], output);
+        output += 4;
+      }
+    }
+    for (const uint32_t vertex : used_vertices) new_indices[vertex] = kNotUsed;
+    positions->push_back(cells[begin].first);
+    fragments->push_back(std::move(fragment));
+  }
+}
+
+bool ExportPrecomputedMeshes(OnDemandObjectMeshGenerator& generator,
+                             const std::string& directory,
+                             const PrecomputedMeshExportOptions& options,
+                             std::string* error) {
+  if (generator.encoding() != MeshEncoding::kRaw ||
+      generator.vertex_normals() != VertexNormalEncoding::kNone) {
+    *error =
+        "Precomputed meshes require the raw mesh encoding without vertex "
+        "normals";
+    return false;
+  }
+  if (options.lod < 0 || options.lod >= generator.num_lods()) {
+    *error = "Invalid level of detail";
+    return false;
+  }
+  const std::string prefix =
+      directory.empty() || directory.back() == '/' ? directory
+                                                   : directory + "/";
+  if (!WriteFile(prefix + "info", "{\"@type\":\"neuroglancer_legacy_mesh\"}",
+                 error)) {
+    return false;
+  }
+  bool split = true;
+  for (const float size : options.fragment_size) {
+    if (!(size > 0)) split = false;
+  }
+
+  // Guards the members below, which are shared with the writer threads.
+  std::mutex mutex;
+  // Notified when files have been written.
+  std::condition_variable written;
+  size_t pending_bytes = 0;
+  bool failed = false;
+  std::string first_error;
+  {
+    WorkerPool writers(std::max(1, options.num_writer_threads));
+    const auto& object_ids = generator.object_ids();
+    ParallelFor(object_ids.size(), options.num_threads, [&](size_t i) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed) return;
+      }
+      const uint64_t object_id = object_ids[i];
+      auto mesh = generator.GetSimplifiedMesh(object_id, options.lod);
+      if (GetNumTriangles(*mesh) == 0) return;
+      const std::string name_prefix = std::to_string(object_id) + ":0";
+      auto files = std::make_shared<std::vector<PendingFile>>();
+      if (split) {
+        std::vector<std::array<int64_t, 3>> positions;
+        std::vector<std::string> fragments;
+        SplitRawMesh(*mesh, options.fragment_size, &positions, &fragments);
+        for (size_t j = 0; j < fragments.size(); ++j) {
+          files->push_back(PendingFile{
+              name_prefix + ":" + std::to_string(positions[j][0]) + "_" +
+                  std::to_string(positions[j][1]) + "_" +
+                  std::to_string(positions[j][2]),
+              std::make_shared<const std::string>(std::move(fragments[j]))});
+        }
+      } else {
+        files->push_back(PendingFile{name_prefix + ":0", std::move(mesh)});
+      }
+      // The manifest is written last, so that it never refers to fragments
+      // that have not been written.
+      std::string manifest = "{\"fragments\":[";
+      for (size_t j = 0; j < files->size(); ++j) {
+        if (j != 0) manifest += ",";
+        manifest += "\"" + (*files)[j].name + "\"";
+      }
+      manifest += "]}";
+      files->push_back(PendingFile{
+          name_prefix, std::make_shared<const std::string>(std::move(manifest))});
+      size_t num_bytes = 0;
+      for (const auto& file : *files) num_bytes += file.contents->size();
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        written.wait(lock, [&] {
+          return failed || pending_bytes == 0 ||
+                 pending_bytes + num_bytes <= options.max_pending_bytes;
+        });
+        if (failed) return;
+        pending_bytes += num_bytes;
+      }
+      writers.Schedule(0, [&, files, num_bytes] {
+        std::string write_error;
+        bool ok = true;
+        for (const auto& file : *files) {
+          if (!WriteFile(prefix + file.name, *file.contents, &write_error)) {
+            ok = false;
+            break;
+          }
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          pending_bytes -= num_bytes;
+          if (!ok && !failed) {
+            failed = true;
+            first_error = std::move(write_error);
+          }
+        }
+        written.notify_all();
+      });
+    });
+    // Destroying `writers` waits for the remaining files to be written.
+  }
+  if (failed) {
+    *error = std::move(first_error);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace meshing
+}  // namespace neuroglancer
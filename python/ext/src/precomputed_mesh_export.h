@@ -0,0 +1,87 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEUROGLANCER_PRECOMPUTED_MESH_EXPORT_H_
+#define NEUROGLANCER_PRECOMPUTED_MESH_EXPORT_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "on_demand_object_mesh_generator.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+struct PrecomputedMeshExportOptions {
+  // Level of detail of the generator to export.  The legacy format has a
+  // single level, so other levels must be exported to separate directories.
+  int lod = 0;
+
+  // If positive along all dimensions, the mesh of each object is split into
+  // fragments by a grid of cells of this size, in the units of the vertex
+  // positions, with each triangle assigned to the cell containing its
+  // centroid.  Otherwise each object has a single fragment.
+  std::array<float, 3> fragment_size = {{0, 0, 0}};
+
+  // Number of threads used to compute the meshes, or 0 to use the number of
+  // hardware threads.
+  int num_threads = 0;
+
+  // Number of threads used to write the files.
+  int num_writer_threads = 4;
+
+  // Maximum total size of the files that have been prepared but not yet
+  // written.  Mesh computation waits while the limit is exceeded, so that it
+  // does not run ahead of slow storage.
+  size_t max_pending_bytes = 256 << 20;
+};
+
+// Writes the meshes of all objects of `generator`, which must use
+// MeshEncoding::kRaw, to the existing `directory` in the legacy precomputed
+// mesh format: an `info` file, a JSON manifest named `<object-id>:0` for each
+// object with a non-empty mesh, and its fragment files, named
+// `<object-id>:0:<x>_<y>_<z>` by the grid position of the fragment, or
+// `<object-id>:0:0` if the mesh is not split.
+//
+// Meshes are computed in parallel as by GetSimplifiedMeshes, and so are
+// retained by the mesh cache of `generator` as usual; limit its cache size to
+// bound the memory used to export a large volume.
+//
+// Returns false, and sets `*error`, if the generator does not use
+// MeshEncoding::kRaw or a file cannot be written.  No further meshes are
+// computed after the first error, but the files already written remain.
+bool ExportPrecomputedMeshes(OnDemandObjectMeshGenerator& generator,
+                             const std::string& directory,
+                             const PrecomputedMeshExportOptions& options,
+                             std::string* error);
+
+// Splits a mesh encoded with MeshEncoding::kRaw into fragments by a grid of
+// cells of size `fragment_size`, as for PrecomputedMeshExportOptions.  Each
+// fragment is also encoded with MeshEncoding::kRaw, and contains only the
+// vertices used by its triangles.  The grid positions of the fragments are
+// stored in `positions`, in increasing order.
+void SplitRawMesh(const std::string& mesh,
+                  const std::array<float, 3>& fragment_size,
+                  std::vector<std::array<int64_t, 3>>* positions,
+                  std::vector<std::string>* fragments);
+
+}  // namespace meshing
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_PRECOMPUTED_MESH_EXPORT_H_
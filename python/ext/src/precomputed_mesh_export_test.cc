@@ -0,0 +1,148 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "precomputed_mesh_export.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace meshing {
+namespace {
+
+using Triangle = std::array<std::array<float, 3>, 3>;
+
+// Returns the triangles of a mesh encoded with MeshEncoding::kRaw, by vertex
+// position, in sorted order.
+std::vector<Triangle> GetTriangles(const std::string& mesh) {
+  uint32_t num_vertices;
+  std::memcpy(&num_vertices, mesh.data(), 4);
+  std::vector<float> positions(num_vertices * 3);
+  std::memcpy(positions.data(), mesh.data() + 4, positions.size() * 4);
+  std::vector<uint32_t> indices((mesh.size() - 4 - positions.size() * 4) / 4);
+  std::memcpy(indices.data(), mesh.data() + 4 + positions.size() * 4,
+              indices.size() * 4);
+  std::vector<Triangle> triangles(indices.size() / 3);
+  for (size_t i = 0; i < indices.size(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      triangles[i / 3][i % 3][j] = positions[indices[i] * 3 + j];
+    }
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+class PrecomputedMeshExportTest : public ::testing::Test {
+ protected:
+  PrecomputedMeshExportTest() : labels_(20 * 18 * 16) {
+    for (int64_t z = 0; z < 16; ++z) {
+      for (int64_t y = 0; y < 18; ++y) {
+        for (int64_t x = 0; x < 20; ++x) {
+          uint32_t label = 0;
+          if (x >= 2 && x < 17 && y >= 3 && y < 15 && z >= 2 && z < 13) {
+            label = 1;
+          }
+          if (x >= 5 && x < 9 && y >= 5 && y < 9 && z >= 5 && z < 9) {
+            label = 2;
+          }
+          labels_[x + 20 * (y + 18 * z)] = label;
+        }
+      }
+    }
+    const int64_t size[3] = {20, 18, 16};
+    const int64_t strides[3] = {1, 20, 20 * 18};
+    const float voxel_size[3] = {1, 2, 3};
+    const float offset[3] = {0, 0, 0};
+    SimplifyOptions simplify_options;
+    simplify_options.max_quadrics_error = -1;
+    generator_ = OnDemandObjectMeshGenerator(labels_.data(), size, strides,
+                                             voxel_size, offset,
+                                             simplify_options);
+  }
+
+  std::vector<uint32_t> labels_;
+  OnDemandObjectMeshGenerator generator_;
+};
+
+// Splitting a mesh preserves its triangles.
+TEST_F(PrecomputedMeshExportTest, SplitRawMesh) {
+  const auto mesh = generator_.GetSimplifiedMesh(1);
+  std::vector<std::array<int64_t, 3>> positions;
+  std::vector<std::string> fragments;
+  SplitRawMesh(*mesh, {{8, 8, 8}}, &positions, &fragments);
+  ASSERT_EQ(positions.size(), fragments.size());
+  EXPECT_GT(fragments.size(), 1u);
+  EXPECT_TRUE(std::is_sorted(positions.begin(), positions.end()));
+  std::vector<Triangle> triangles;
+  for (const auto& fragment : fragments) {
+    const auto fragment_triangles = GetTriangles(fragment);
+    triangles.insert(triangles.end(), fragment_triangles.begin(),
+                     fragment_triangles.end());
+  }
+  std::sort(triangles.begin(), triangles.end());
+  EXPECT_EQ(GetTriangles(*mesh), triangles);
+}
+
+TEST_F(PrecomputedMeshExportTest, Export) {
+  const std::string directory = ::testing::TempDir();
+  PrecomputedMeshExportOptions options;
+  options.max_pending_bytes = 1;
+  std::string error;
+  ASSERT_TRUE(
+      ExportPrecomputedMeshes(generator_, directory, options, &error))
+      << error;
+  EXPECT_EQ("{\"@type\":\"neuroglancer_legacy_mesh\"}",
+            ReadFile(directory + "/info"));
+  for (const uint64_t id : {1, 2}) {
+    const std::string name = std::to_string(id) + ":0";
+    EXPECT_EQ("{\"fragments\":[\"" + name + ":0\"]}",
+              ReadFile(directory + "/" + name));
+    EXPECT_EQ(*generator_.GetSimplifiedMesh(id),
+              ReadFile(directory + "/" + name + ":0"));
+  }
+
+  // All of object 2 lies within a single cell.
+  options.fragment_size = {{100, 100, 100}};
+  ASSERT_TRUE(
+      ExportPrecomputedMeshes(generator_, directory, options, &error))
+      << error;
+  EXPECT_EQ("{\"fragments\":[\"2:0:0_0_0\"]}", ReadFile(directory + "/2:0"));
+  EXPECT_EQ(GetTriangles(*generator_.GetSimplifiedMesh(2)),
+            GetTriangles(ReadFile(directory + "/2:0:0_0_0")));
+}
+
+TEST_F(PrecomputedMeshExportTest, Errors) {
+  std::string error;
+  EXPECT_FALSE(ExportPrecomputedMeshes(generator_, "/nonexistent/directory",
+                                       PrecomputedMeshExportOptions(), &error));
+  EXPECT_NE(std::string::npos, error.find("/nonexistent/directory/info"));
+}
+
+}  // namespace
+}  // namespace meshing
+}  // namespace neuroglancer
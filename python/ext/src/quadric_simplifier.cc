@@ -0,0 +1,941 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "quadric_simplifier.h"
+#include "parallel_for.h"
+#include "trace_events.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace neuroglancer {
+namespace meshing {
+
+namespace {
+
+using Index = TriangleMesh::VertexIndex;
+using Triangle = std::array<Index, 3>;
+using Vec3 = std::array<double, 3>;
+
+constexpr Index kInvalidIndex = std::numeric_limits<Index>::max();
+
+Vec3 ToVec3(const std::array<float, 3>& p) { return {{p[0], p[1], p[2]}}; }
+
+Vec3 Subtract(const Vec3& a, const Vec3& b) {
+  return {{a[0] - b[0], a[1] - b[1], a[2] - b[2]}};
+}
+
+Vec3 Cross(const Vec3& a, const Vec3& b) {
+  return {{a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+           a[0] * b[1] - a[1] * b[0]}};
+}
+
+double Dot(const Vec3& a, const Vec3& b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Returns the unit normal of the triangle `(p0, p1, p2)`, or the zero vector
+// if the triangle is degenerate.
+Vec3 TriangleNormal(const Vec3& p0, const Vec3& p1, const Vec3& p2) {
+  Vec3 n = Cross(Subtract(p1, p0), Subtract(p2, p0));
+  const double length = std::sqrt(Dot(n, n));
+  if (length != 0) {
+    for (int i = 0; i < 3; ++i) n[i] /= length;
+  }
+  return n;
+}
+
+bool TriangleContains(const Triangle& triangle, Index v) {
+  return triangle[0] == v || triangle[1] == v || triangle[2] == v;
+}
+
+// Symmetric 4x4 error quadric, as in OpenMesh::Geometry::QuadricT.
+struct Quadric {
+  // Upper triangle of the matrix, row by row.
+  double m[10] = {};
+
+  // Adds `weight` times the quadric of the plane `dot(n, x) + offset = 0`.
+  void AddPlane(const Vec3& n, double offset, double weight) {
+    const double a = n[0], b = n[1], c = n[2], d = offset;
+    m[0] += weight * a * a;
+    m[1] += weight * a * b;
+    m[2] += weight * a * c;
+    m[3] += weight * a * d;
+    m[4] += weight * b * b;
+    m[5] += weight * b * c;
+    m[6] += weight * b * d;
+    m[7] += weight * c * c;
+    m[8] += weight * c * d;
+    m[9] += weight * d * d;
+  }
+
+  Quadric& operator+=(const Quadric& other) {
+    for (int i = 0; i < 10; ++i) m[i] += other.m[i];
+    return *this;
+  }
+
+  double Evaluate(const Vec3& p) const {
+    const double x = p[0], y = p[1], z = p[2];
+    return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x +
+           m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y + m[7] * z * z +
+           2 * m[8] * z + m[9];
+  }
+};
+
+// Sets `errors[i]` to the error of collapsing a vertex with quadric `q0` into
+// the vertex `targets[i]`, the sum of their quadrics evaluated at the position
+// of `targets[i]`, for each `i < n`.  The summed quadrics and positions are
+// gathered a block at a time into structure-of-arrays form, in which the
+// evaluation of the 10-coefficient symmetric form compiles to vector
+// arithmetic.  The errors are identical to those of Quadric::Evaluate.
+void EvaluateCollapseErrors(const Quadric& q0,
+                            const std::vector<Quadric>& quadrics,
+                            const VertexPositions& positions,
+                            const Index* targets, size_t n, double* errors) {
+  constexpr size_t kBlockSize = 16;
+  double m[10][kBlockSize], x[kBlockSize], y[kBlockSize], z[kBlockSize];
+  for (size_t start = 0; start < n; start += kBlockSize) {
+    const size_t count = std::min(kBlockSize, n - start);
+    for (size_t i = 0; i < count; ++i) {
+      const Quadric& q1 = quadrics[targets[start + i]];
+      for (int j = 0; j < 10; ++j) m[j][i] = q0.m[j] + q1.m[j];
+      const auto& p = positions[targets[start + i]];
+      x[i] = p[0];
+      y[i] = p[1];
+      z[i] = p[2];
+    }
+    double* block_errors = errors + start;
+    for (size_t i = 0; i < count; ++i) {
+      block_errors[i] =
+          m[0][i] * x[i] * x[i] + 2 * m[1][i] * x[i] * y[i] +
+          2 * m[2][i] * x[i] * z[i] + 2 * m[3][i] * x[i] +
+          m[4][i] * y[i] * y[i] + 2 * m[5][i] * y[i] * z[i] +
+          2 * m[6][i] * y[i] + m[7][i] * z[i] * z[i] + 2 * m[8][i] * z[i] +
+          m[9][i];
+    }
+  }
+}
+
+// Binary min-heap of vertices keyed by the priority of their best collapse.
+// Entries store the priority inline and each vertex records its position, so
+// that the priority of any vertex can be updated in logarithmic time.
+class VertexHeap {
+ public:
+  explicit VertexHeap(size_t num_vertices)
+      : positions_(num_vertices, kInvalidIndex) {}
+
+  bool empty() const { return entries_.empty(); }
+
+  // Inserts `v`, or updates its priority if it is already in the heap.
+  void Update(Index v, float priority) {
+    Index pos = positions_[v];
+    if (pos == kInvalidIndex) {
+      entries_.push_back(Entry{priority, v});
+      SiftUp(entries_.size() - 1);
+      return;
+    }
+    const float old_priority = entries_[pos].priority;
+    entries_[pos].priority = priority;
+    if (priority < old_priority) {
+      SiftUp(pos);
+    } else {
+      SiftDown(pos);
+    }
+  }
+
+  void Remove(Index v) {
+    const Index pos = positions_[v];
+    if (pos == kInvalidIndex) return;
+    positions_[v] = kInvalidIndex;
+    const Entry last = entries_.back();
+    entries_.pop_back();
+    if (pos == entries_.size()) return;
+    entries_[pos] = last;
+    positions_[last.vertex] = pos;
+    SiftUp(pos);
+    SiftDown(positions_[last.vertex]);
+  }
+
+  // Removes and returns the vertex with the lowest priority.
+  Index Pop() {
+    const Index v = entries_[0].vertex;
+    Remove(v);
+    return v;
+  }
+
+ private:
+  struct Entry {
+    float priority;
+    Index vertex;
+  };
+
+  void Place(size_t pos, const Entry& entry) {
+    entries_[pos] = entry;
+    positions_[entry.vertex] = pos;
+  }
+
+  void SiftUp(size_t pos) {
+    const Entry entry = entries_[pos];
+    while (pos > 0) {
+      const size_t parent = (pos - 1) / 2;
+      if (!(entry.priority < entries_[parent].priority)) break;
+      Place(pos, entries_[parent]);
+      pos = parent;
+    }
+    Place(pos, entry);
+  }
+
+  void SiftDown(size_t pos) {
+    const Entry entry = entries_[pos];
+    const size_t size = entries_.size();
+    while (true) {
+      size_t child = 2 * pos + 1;
+      if (child >= size) break;
+      if (child + 1 < size &&
+          entries_[child + 1].priority < entries_[child].priority) {
+        ++child;
+      }
+      if (!(entries_[child].priority < entry.priority)) break;
+      Place(pos, entries_[child]);
+      pos = child;
+    }
+    Place(pos, entry);
+  }
+
+  std::vector<Entry> entries_;
+  std::vector<Index> positions_;
+};
+
+// Min-heap of vertices with the same interface as VertexHeap, in which
+// updates and removals do not move existing entries.  Instead, each vertex
+// has a stamp that is incremented whenever its priority changes, and entries
+// whose stamp is out of date are discarded when they reach the top.  The stamp
+// of a vertex is odd while it is queued.  Equal priorities are popped in
+// order of increasing vertex index.
+class LazyVertexHeap {
+ public:
+  explicit LazyVertexHeap(size_t num_vertices)
+      : stamps_(num_vertices, 0), num_queued_(0) {}
+
+  bool empty() const { return num_queued_ == 0; }
+
+  void Update(Index v, float priority) {
+    uint32_t& stamp = stamps_[v];
+    if (stamp & 1) {
+      stamp += 2;
+    } else {
+      ++stamp;
+      ++num_queued_;
+    }
+    entries_.push_back(Entry{priority, v, stamp});
+    std::push_heap(entries_.begin(), entries_.end(), Compare());
+    // Bound the number of stale entries, so that memory use remains
+    // proportional to the number of vertices.
+    if (entries_.size() > 2 * stamps_.size() + 16) Compact();
+  }
+
+  void Remove(Index v) {
+    uint32_t& stamp = stamps_[v];
+    if (!(stamp & 1)) return;
+    ++stamp;
+    --num_queued_;
+  }
+
+  Index Pop() {
+    while (true) {
+      const Entry entry = entries_.front();
+      std::pop_heap(entries_.begin(), entries_.end(), Compare());
+      entries_.pop_back();
+      if (entry.stamp == stamps_[entry.vertex]) {
+        Remove(entry.vertex);
+        return entry.vertex;
+      }
+    }
+  }
+
+ private:
+  struct Entry {
+    float priority;
+    Index vertex;
+    uint32_t stamp;
+  };
+
+  // Orders `std::push_heap` and `std::pop_heap` as a min-heap.
+  struct Compare {
+    bool operator()(const Entry& a, const Entry& b) const {
+      if (a.priority != b.priority) return b.priority < a.priority;
+      return b.vertex < a.vertex;
+    }
+  };
+
+  void Compact() {
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                  [this](const Entry& entry) {
+                                    return entry.stamp !=
+                                           stamps_[entry.vertex];
+                                  }),
+                   entries_.end());
+    std::make_heap(entries_.begin(), entries_.end(), Compare());
+  }
+
+  std::vector<Entry> entries_;
+  std::vector<uint32_t> stamps_;
+  size_t num_queued_;
+};
+
+// Halfedge collapse simplification following OpenMesh::Decimater::DecimaterT
+// with ModQuadricT and ModNormalFlippingT: each vertex `v0` is queued with its
+// cheapest legal collapse into a neighbor `v1`, which keeps its position, and
+// after each collapse the former neighbors of `v0` are requeued.  `Queue` is
+// VertexHeap or LazyVertexHeap.
+template <class Queue>
+class Simplifier {
+ public:
+  // If specified, vertices for which `extra_locked` is non-zero are locked in
+  // addition to the boundary vertices, and `initial_quadrics` are used as the
+  // quadrics of the vertices instead of computing them from the faces.
+  Simplifier(const SimplifyOptions& options, TriangleMesh* mesh,
+             const uint8_t* extra_locked = nullptr,
+             const Quadric* initial_quadrics = nullptr)
+      : max_error_(options.max_quadrics_error),
+        min_cos_(std::cos(options.max_normal_angle_deviation * M_PI / 180.0)),
+        num_faces_(0),
+        positions_(mesh->vertex_positions),
+        triangles_(mesh->triangles),
+        heap_(mesh->vertex_positions.size()) {
+    const size_t num_vertices = positions_.size();
+    const size_t num_faces = triangles_.size();
+
+    // Triangles that reference a vertex more than once are dropped, like the
+    // degenerate faces rejected when building an OpenMesh mesh.
+    face_removed_.resize(num_faces);
+    face_ref_count_.assign(num_vertices, 0);
+    for (size_t f = 0; f < num_faces; ++f) {
+      const auto& triangle = triangles_[f];
+      if (triangle[0] == triangle[1] || triangle[1] == triangle[2] ||
+          triangle[0] == triangle[2]) {
+        face_removed_[f] = 1;
+        continue;
+      }
+      ++num_faces_;
+      for (Index v : triangle) ++face_ref_count_[v];
+    }
+    face_ref_begin_.resize(num_vertices);
+    size_t num_refs = 0;
+    for (size_t v = 0; v < num_vertices; ++v) {
+      face_ref_begin_[v] = num_refs;
+      num_refs += face_ref_count_[v];
+    }
+    face_refs_.resize(num_refs);
+    {
+      std::vector<size_t> next_ref = face_ref_begin_;
+      for (size_t f = 0; f < num_faces; ++f) {
+        if (face_removed_[f]) continue;
+        for (Index v : triangles_[f]) face_refs_[next_ref[v]++] = f;
+      }
+    }
+
+    face_normals_.resize(num_faces);
+    if (initial_quadrics) {
+      quadrics_.assign(initial_quadrics, initial_quadrics + num_vertices);
+    } else {
+      quadrics_.resize(num_vertices);
+    }
+    for (size_t f = 0; f < num_faces; ++f) {
+      if (face_removed_[f]) continue;
+      const auto& triangle = triangles_[f];
+      const Vec3 p0 = ToVec3(positions_[triangle[0]]),
+                 p1 = ToVec3(positions_[triangle[1]]),
+                 p2 = ToVec3(positions_[triangle[2]]);
+      face_normals_[f] = TriangleNormal(p0, p1, p2);
+      if (initial_quadrics) continue;
+      // Plane quadric weighted by the triangle area, as in ModQuadricT.
+      Vec3 n = Cross(Subtract(p1, p0), Subtract(p2, p0));
+      double area = std::sqrt(Dot(n, n));
+      if (area > FLT_MIN) {
+        for (int i = 0; i < 3; ++i) n[i] /= area;
+        area *= 0.5;
+      }
+      Quadric q;
+      q.AddPlane(n, -Dot(p0, n), area);
+      for (Index v : triangle) quadrics_[v] += q;
+    }
+
+    // A vertex is on the boundary if one of its edges has a single incident
+    // face.  Collapses permitted by IsCollapseLegal preserve this property for
+    // the remaining vertices, so it is only computed once.
+    boundary_.resize(num_vertices);
+    locked_.resize(num_vertices);
+    vertex_removed_.resize(num_vertices);
+    for (size_t v = 0; v < num_vertices; ++v) {
+      bool boundary = (face_ref_count_[v] == 0);
+      for (size_t r = face_ref_begin_[v], end = r + face_ref_count_[v];
+           r < end && !boundary; ++r) {
+        for (Index u : triangles_[face_refs_[r]]) {
+          if (u != v && CountEdgeFaces(v, u) == 1) {
+            boundary = true;
+            break;
+          }
+        }
+      }
+      boundary_[v] = boundary;
+      locked_[v] = (boundary && options.lock_boundary_vertices) ||
+                   (extra_locked && extra_locked[v]);
+    }
+    targets_.assign(num_vertices, kInvalidIndex);
+  }
+
+  // Simplifies the mesh, as described for SimplifyTriangleMesh.  If
+  // specified, `kept_vertices` is set to the original index of each remaining
+  // vertex, and `kept_quadrics` to its accumulated quadric.
+  void Simplify(size_t max_triangles,
+                std::vector<Index>* kept_vertices = nullptr,
+                std::vector<Quadric>* kept_quadrics = nullptr) {
+    Decimate(0);
+    if (max_triangles != 0 && num_faces_ > max_triangles) {
+      max_error_ = std::numeric_limits<double>::infinity();
+      Decimate(max_triangles);
+    }
+    if (kept_vertices || kept_quadrics) {
+      for (size_t v = 0; v < positions_.size(); ++v) {
+        if (vertex_removed_[v]) continue;
+        if (kept_vertices) kept_vertices->push_back(v);
+        if (kept_quadrics) kept_quadrics->push_back(quadrics_[v]);
+      }
+    }
+    Compact();
+  }
+
+ private:
+  // Performs collapses in order of increasing error until none remains or
+  // the mesh has at most `min_faces` faces.
+  void Decimate(size_t min_faces) {
+    for (size_t v = 0; v < positions_.size(); ++v) {
+      UpdateVertex(v);
+    }
+    while (!heap_.empty() && num_faces_ > min_faces) {
+      const Index v0 = heap_.Pop();
+      const Index v1 = targets_[v0];
+      // The error and normal criteria were checked when `v0` was queued, but
+      // the topology may have changed since.
+      GetNeighbors(v0, &neighbors0_);
+      if (!IsCollapseLegal(v0, v1, neighbors0_)) continue;
+      support_.swap(neighbors0_);
+      Collapse(v0, v1);
+      for (Index v : support_) {
+        UpdateVertex(v);
+      }
+    }
+  }
+
+  // Calls `fn(f)` for each remaining face `f` incident to `v`.
+  template <class Fn>
+  void ForEachFace(Index v, Fn fn) const {
+    for (size_t r = face_ref_begin_[v], end = r + face_ref_count_[v]; r < end;
+         ++r) {
+      const Index f = face_refs_[r];
+      if (!face_removed_[f]) fn(f);
+    }
+  }
+
+  // Computes the sorted, distinct neighbors of `v`.
+  void GetNeighbors(Index v, std::vector<Index>* neighbors) const {
+    neighbors->clear();
+    ForEachFace(v, [&](Index f) {
+      for (Index u : triangles_[f]) {
+        if (u != v) neighbors->push_back(u);
+      }
+    });
+    std::sort(neighbors->begin(), neighbors->end());
+    neighbors->erase(std::unique(neighbors->begin(), neighbors->end()),
+                     neighbors->end());
+  }
+
+  size_t CountEdgeFaces(Index a, Index b) const {
+    size_t count = 0;
+    ForEachFace(a, [&](Index f) {
+      if (TriangleContains(triangles_[f], b)) ++count;
+    });
+    return count;
+  }
+
+  size_t GetValence(Index v) {
+    GetNeighbors(v, &valence_neighbors_);
+    return valence_neighbors_.size();
+  }
+
+  // Checks the topological conditions of DecimaterT::is_collapse_legal and
+  // TriConnectivity::is_collapse_ok for collapsing `v0` into `v1`.
+  // `neighbors0` must be the neighbors of `v0`.
+  bool IsCollapseLegal(Index v0, Index v1,
+                       const std::vector<Index>& neighbors0) {
+    if (locked_[v0] || vertex_removed_[v0] || vertex_removed_[v1]) {
+      return false;
+    }
+    if (neighbors0.size() < 3) return false;
+
+    // Vertices opposite to the edge in its incident faces.
+    Index opposite[2];
+    size_t num_edge_faces = 0;
+    bool non_manifold = false;
+    ForEachFace(v0, [&](Index f) {
+      const auto& triangle = triangles_[f];
+      if (!TriangleContains(triangle, v1)) return;
+      if (num_edge_faces == 2) {
+        non_manifold = true;
+        return;
+      }
+      for (Index u : triangle) {
+        if (u != v0 && u != v1) opposite[num_edge_faces] = u;
+      }
+      ++num_edge_faces;
+    });
+    if (num_edge_faces == 0 || non_manifold) return false;
+    const bool boundary_edge = (num_edge_faces == 1);
+
+    // A boundary vertex may only be collapsed along a boundary edge.
+    if (boundary_[v0] && (!boundary_[v1] || !boundary_edge)) return false;
+
+    if (!boundary_edge && opposite[0] == opposite[1]) return false;
+
+    // Collapsing a face with two boundary edges would leave a dangling edge.
+    for (size_t i = 0; i < num_edge_faces; ++i) {
+      if (CountEdgeFaces(v0, opposite[i]) == 1 &&
+          CountEdgeFaces(v1, opposite[i]) == 1) {
+        return false;
+      }
+    }
+
+    // Link condition: the only common neighbors of `v0` and `v1` may be the
+    // opposite vertices.
+    GetNeighbors(v1, &neighbors1_);
+    {
+      auto it0 = neighbors0.begin(), end0 = neighbors0.end();
+      auto it1 = neighbors1_.begin(), end1 = neighbors1_.end();
+      while (it0 != end0 && it1 != end1) {
+        if (*it0 < *it1) {
+          ++it0;
+        } else if (*it1 < *it0) {
+          ++it1;
+        } else {
+          const Index u = *it0;
+          if (u != opposite[0] && (boundary_edge || u != opposite[1])) {
+            return false;
+          }
+          ++it0;
+          ++it1;
+        }
+      }
+    }
+
+    // Collapsing an edge of a tetrahedron would leave two coincident faces.
+    if (!boundary_edge && CountEdgeFaces(opposite[0], opposite[1]) != 0 &&
+        GetValence(opposite[0]) == 3 && GetValence(opposite[1]) == 3) {
+      return false;
+    }
+    return true;
+  }
+
+  // Returns true if moving `v0` to the position of `v1` rotates the normals
+  // of the faces of `v0` that remain by at most the maximum deviation.
+  bool IsNormalDeviationLegal(Index v0, Index v1) const {
+    const Vec3 p1 = ToVec3(positions_[v1]);
+    bool legal = true;
+    ForEachFace(v0, [&](Index f) {
+      const auto& triangle = triangles_[f];
+      if (!legal || TriangleContains(triangle, v1)) return;
+      Vec3 p[3];
+      for (int i = 0; i < 3; ++i) {
+        p[i] = triangle[i] == v0 ? p1 : ToVec3(positions_[triangle[i]]);
+      }
+      if (Dot(face_normals_[f], TriangleNormal(p[0], p[1], p[2])) < min_cos_) {
+        legal = false;
+      }
+    });
+    return legal;
+  }
+
+  // Returns the neighbor into which `v0` is most cheaply collapsed, or
+  // `kInvalidIndex` if there is no legal collapse.
+  Index ComputeTarget(Index v0, float* priority) {
+    if (vertex_removed_[v0] || locked_[v0]) return kInvalidIndex;
+    GetNeighbors(v0, &neighbors0_);
+    // The collapse errors are cheap to evaluate, so candidates are sorted by
+    // error and the more expensive legality checks are only performed until
+    // the first legal collapse is found.
+    errors_.resize(neighbors0_.size());
+    EvaluateCollapseErrors(quadrics_[v0], quadrics_, positions_,
+                           neighbors0_.data(), neighbors0_.size(),
+                           errors_.data());
+    candidates_.clear();
+    for (size_t i = 0; i < neighbors0_.size(); ++i) {
+      // Rounding can make the error of a collapse within a plane slightly
+      // negative.
+      const double error = std::max(0.0, errors_[i]);
+      if (!(error < max_error_)) continue;
+      candidates_.push_back(
+          std::make_pair(static_cast<float>(error), neighbors0_[i]));
+    }
+    std::sort(candidates_.begin(), candidates_.end());
+    for (const auto& candidate : candidates_) {
+      const Index v1 = candidate.second;
+      // The normal deviation check only visits the faces of `v0`, so it is
+      // cheaper than the topological checks and is performed first.
+      if (!IsNormalDeviationLegal(v0, v1) ||
+          !IsCollapseLegal(v0, v1, neighbors0_)) {
+        continue;
+      }
+      *priority = candidate.first;
+      return v1;
+    }
+    return kInvalidIndex;
+  }
+
+  void UpdateVertex(Index v) {
+    float priority;
+    const Index target = ComputeTarget(v, &priority);
+    targets_[v] = target;
+    if (target == kInvalidIndex) {
+      heap_.Remove(v);
+    } else {
+      heap_.Update(v, priority);
+    }
+  }
+
+  void Collapse(Index v0, Index v1) {
+    new_face_refs_.clear();
+    ForEachFace(v1, [&](Index f) {
+      if (TriangleContains(triangles_[f], v0)) {
+        face_removed_[f] = 1;
+        --num_faces_;
+      } else {
+        new_face_refs_.push_back(f);
+      }
+    });
+    ForEachFace(v0, [&](Index f) {
+      for (Index& v : triangles_[f]) {
+        if (v == v0) v = v1;
+      }
+      new_face_refs_.push_back(f);
+    });
+    // The faces of `v1` are appended as a new range; the old ranges of `v0`
+    // and `v1` become unused.
+    face_ref_begin_[v1] = face_refs_.size();
+    face_ref_count_[v1] = new_face_refs_.size();
+    face_refs_.insert(face_refs_.end(), new_face_refs_.begin(),
+                      new_face_refs_.end());
+    face_ref_count_[v0] = 0;
+    vertex_removed_[v0] = 1;
+    quadrics_[v1] += quadrics_[v0];
+    for (Index f : new_face_refs_) {
+      const auto& triangle = triangles_[f];
+      face_normals_[f] = TriangleNormal(ToVec3(positions_[triangle[0]]),
+                                        ToVec3(positions_[triangle[1]]),
+                                        ToVec3(positions_[triangle[2]]));
+    }
+  }
+
+  // Removes the collapsed vertices and faces from the mesh arrays.
+  void Compact() {
+    std::vector<Index> new_indices(positions_.size(), kInvalidIndex);
+    Index num_vertices = 0;
+    for (size_t v = 0; v < positions_.size(); ++v) {
+      if (vertex_removed_[v]) continue;
+      new_indices[v] = num_vertices;
+      positions_[num_vertices++] = positions_[v];
+    }
+    positions_.resize(num_vertices);
+    size_t num_faces = 0;
+    for (size_t f = 0; f < triangles_.size(); ++f) {
+      if (face_removed_[f]) continue;
+      auto& triangle = triangles_[num_faces++];
+      for (int i = 0; i < 3; ++i) triangle[i] = new_indices[triangles_[f][i]];
+    }
+    triangles_.resize(num_faces);
+  }
+
+  double max_error_;
+  const double min_cos_;
+  // Number of remaining faces.
+  size_t num_faces_;
+  VertexPositions& positions_;
+  std::vector<Triangle>& triangles_;
+  std::vector<uint8_t> face_removed_, vertex_removed_, boundary_, locked_;
+  std::vector<Vec3> face_normals_;
+  std::vector<Quadric> quadrics_;
+  // The faces incident to vertex `v` are `face_refs_[face_ref_begin_[v] +
+  // i]` for `i < face_ref_count_[v]`, which may include removed faces.
+  std::vector<Index> face_refs_;
+  std::vector<size_t> face_ref_begin_;
+  std::vector<Index> face_ref_count_;
+  // Best collapse target of each queued vertex.
+  std::vector<Index> targets_;
+  Queue heap_;
+  // Scratch buffers.
+  std::vector<Index> neighbors0_, neighbors1_, valence_neighbors_, support_,
+      new_face_refs_;
+  std::vector<std::pair<float, Index>> candidates_;
+  std::vector<double> errors_;
+};
+
+// Divides the bounding box of `mesh`, which has at least one vertex, into a
+// grid of at least `num_cells` spatial cells of similar extent, and stores the
+// index of the cell containing the centroid of each triangle in
+// `triangle_cells`.  Returns the number of cells of the grid.
+size_t AssignTriangleCells(const TriangleMesh& mesh, size_t num_cells,
+                           std::vector<uint32_t>* triangle_cells) {
+  const auto& positions = mesh.vertex_positions;
+  const auto& triangles = mesh.triangles;
+  std::array<float, 3> lower = positions[0], upper = positions[0];
+  for (const auto& p : positions) {
+    for (int i = 0; i < 3; ++i) {
+      lower[i] = std::min(lower[i], p[i]);
+      upper[i] = std::max(upper[i], p[i]);
+    }
+  }
+  // Repeatedly split the axis along which the cells are longest.
+  std::array<size_t, 3> grid{{1, 1, 1}};
+  while (grid[0] * grid[1] * grid[2] < num_cells) {
+    int axis = 0;
+    for (int i = 1; i < 3; ++i) {
+      if ((upper[i] - lower[i]) / grid[i] >
+          (upper[axis] - lower[axis]) / grid[axis]) {
+        axis = i;
+      }
+    }
+    ++grid[axis];
+  }
+  triangle_cells->resize(triangles.size());
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    size_t cell = 0;
+    for (int i = 2; i >= 0; --i) {
+      const float centroid = (positions[triangles[t][0]][i] +
+                              positions[triangles[t][1]][i] +
+                              positions[triangles[t][2]][i]) /
+                             3;
+      const float extent = upper[i] - lower[i];
+      size_t c = extent > 0 ? static_cast<size_t>((centroid - lower[i]) /
+                                                  extent * grid[i])
+                            : 0;
+      cell = cell * grid[i] + std::min(c, grid[i] - 1);
+    }
+    (*triangle_cells)[t] = cell;
+  }
+  return grid[0] * grid[1] * grid[2];
+}
+
+// Divides `mesh` into a grid of `num_cells` spatial cells of similar extent
+// by assigning each triangle to the cell containing its centroid.  The cells
+// are simplified in parallel, as by Simplifier, with the vertices shared by
+// more than one cell locked.  `mesh` is then replaced by the union of the
+// simplified cells, and `quadrics` is set to the accumulated quadric of each
+// of its vertices.
+template <class Queue>
+void SimplifyCells(const SimplifyOptions& options, size_t num_cells,
+                   TriangleMesh* mesh, std::vector<Quadric>* quadrics) {
+  auto& positions = mesh->vertex_positions;
+  const auto& triangles = mesh->triangles;
+  const size_t num_vertices = positions.size();
+
+  // Sort the triangles by cell.
+  std::vector<uint32_t> triangle_cells;
+  num_cells = AssignTriangleCells(*mesh, num_cells, &triangle_cells);
+  std::vector<size_t> cell_begin(num_cells + 1);
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    ++cell_begin[triangle_cells[t] + 1];
+  }
+  for (size_t c = 0; c < num_cells; ++c) {
+    cell_begin[c + 1] += cell_begin[c];
+  }
+  std::vector<Index> cell_triangles(triangles.size());
+  {
+    std::vector<size_t> next = cell_begin;
+    for (size_t t = 0; t < triangles.size(); ++t) {
+      cell_triangles[next[triangle_cells[t]]++] = t;
+    }
+  }
+
+  // Vertices referenced by triangles of more than one cell.
+  std::vector<uint8_t> shared(num_vertices);
+  {
+    std::vector<uint32_t> vertex_cells(num_vertices, kInvalidIndex);
+    for (size_t t = 0; t < triangles.size(); ++t) {
+      for (Index v : triangles[t]) {
+        if (vertex_cells[v] == kInvalidIndex) {
+          vertex_cells[v] = triangle_cells[t];
+        } else if (vertex_cells[v] != triangle_cells[t]) {
+          shared[v] = 1;
+        }
+      }
+    }
+  }
+
+  // Original indices, quadrics and simplified mesh of the remaining vertices
+  // of each cell.
+  std::vector<std::vector<Index>> cell_vertices(num_cells);
+  std::vector<std::vector<Quadric>> cell_quadrics(num_cells);
+  std::vector<TriangleMesh> cell_meshes(num_cells);
+  ParallelFor(num_cells, options.num_threads, [&](size_t c) {
+    trace_events::Span span("SimplifyMesh.cell", "triangles",
+                            cell_begin[c + 1] - cell_begin[c]);
+    std::vector<Index> vertices;
+    for (size_t i = cell_begin[c]; i < cell_begin[c + 1]; ++i) {
+      for (Index v : triangles[cell_triangles[i]]) vertices.push_back(v);
+    }
+    std::sort(vertices.begin(), vertices.end());
+    vertices.erase(std::unique(vertices.begin(), vertices.end()),
+                   vertices.end());
+    auto& cell_mesh = cell_meshes[c];
+    std::vector<uint8_t> locked(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      cell_mesh.vertex_positions.push_back(positions[vertices[i]]);
+      locked[i] = shared[vertices[i]];
+    }
+    for (size_t i = cell_begin[c]; i < cell_begin[c + 1]; ++i) {
+      Triangle triangle;
+      for (int j = 0; j < 3; ++j) {
+        triangle[j] =
+            std::lower_bound(vertices.begin(), vertices.end(),
+                             triangles[cell_triangles[i]][j]) -
+            vertices.begin();
+      }
+      cell_mesh.triangles.push_back(triangle);
+    }
+    std::vector<Index> kept_vertices;
+    Simplifier<Queue> simplifier(options, &cell_mesh, locked.data());
+    simplifier.Simplify(0, &kept_vertices, &cell_quadrics[c]);
+    for (auto& v : kept_vertices) v = vertices[v];
+    cell_vertices[c] = std::move(kept_vertices);
+  });
+
+  // Merge the cells, keeping the remaining vertices in their original order.
+  // Each shared vertex is kept by all of its cells since it is locked, and its
+  // quadric is the sum of its quadrics in those cells.
+  std::vector<Index> new_indices(num_vertices, kInvalidIndex);
+  for (const auto& vertices : cell_vertices) {
+    for (Index v : vertices) new_indices[v] = 0;
+  }
+  Index num_kept = 0;
+  for (size_t v = 0; v < num_vertices; ++v) {
+    if (new_indices[v] == kInvalidIndex) continue;
+    new_indices[v] = num_kept;
+    positions[num_kept++] = positions[v];
+  }
+  positions.resize(num_kept);
+  quadrics->assign(num_kept, Quadric());
+  std::vector<Triangle> new_triangles;
+  for (size_t c = 0; c < num_cells; ++c) {
+    const auto& vertices = cell_vertices[c];
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      (*quadrics)[new_indices[vertices[i]]] += cell_quadrics[c][i];
+    }
+    for (const auto& triangle : cell_meshes[c].triangles) {
+      new_triangles.push_back({{new_indices[vertices[triangle[0]]],
+                                new_indices[vertices[triangle[1]]],
+                                new_indices[vertices[triangle[2]]]}});
+    }
+  }
+  mesh->triangles = std::move(new_triangles);
+}
+
+template <class Queue>
+void SimplifyTriangleMeshWithQueue(const SimplifyOptions& options,
+                                   TriangleMesh* mesh, size_t max_triangles) {
+  const size_t num_triangles = mesh->triangles.size();
+  if (options.partition_triangles != 0 &&
+      num_triangles > options.partition_triangles &&
+      options.max_quadrics_error >= 0) {
+    // The seams between the cells are simplified by a final pass over the
+    // merged mesh, which continues from the accumulated quadrics.
+    std::vector<Quadric> quadrics;
+    SimplifyCells<Queue>(options,
+                  (num_triangles + options.partition_triangles - 1) /
+                      options.partition_triangles,
+                  mesh, &quadrics);
+    Simplifier<Queue> simplifier(options, mesh, nullptr, quadrics.data());
+    simplifier.Simplify(max_triangles);
+    return;
+  }
+  Simplifier<Queue> simplifier(options, mesh);
+  simplifier.Simplify(max_triangles);
+}
+
+}  // namespace
+
+void PartitionTriangleMesh(const TriangleMesh& mesh, size_t num_cells,
+                           std::vector<TriangleMesh>* cells) {
+  cells->clear();
+  if (mesh.triangles.empty()) return;
+  std::vector<uint32_t> triangle_cells;
+  num_cells =
+      AssignTriangleCells(mesh, std::max<size_t>(num_cells, 1),
+                          &triangle_cells);
+  std::vector<size_t> cell_begin(num_cells + 1);
+  for (uint32_t c : triangle_cells) ++cell_begin[c + 1];
+  for (size_t c = 0; c < num_cells; ++c) {
+    cell_begin[c + 1] += cell_begin[c];
+  }
+  std::vector<Index> cell_triangles(mesh.triangles.size());
+  {
+    std::vector<size_t> next = cell_begin;
+    for (size_t t = 0; t < mesh.triangles.size(); ++t) {
+      cell_triangles[next[triangle_cells[t]]++] = t;
+    }
+  }
+  // Index of each vertex within the last cell that referenced it.  Since the
+  // triangles are visited by cell, a vertex is added to each cell once.
+  std::vector<uint32_t> vertex_cells(mesh.vertex_positions.size(),
+                                     kInvalidIndex);
+  std::vector<Index> cell_indices(mesh.vertex_positions.size());
+  for (size_t c = 0; c < num_cells; ++c) {
+    if (cell_begin[c] == cell_begin[c + 1]) continue;
+    cells->emplace_back();
+    auto& cell = cells->back();
+    for (size_t i = cell_begin[c]; i < cell_begin[c + 1]; ++i) {
+      Triangle triangle;
+      for (int j = 0; j < 3; ++j) {
+        const Index v = mesh.triangles[cell_triangles[i]][j];
+        if (vertex_cells[v] != c) {
+          vertex_cells[v] = c;
+          cell_indices[v] = cell.vertex_positions.size();
+          cell.vertex_positions.push_back(mesh.vertex_positions[v]);
+        }
+        triangle[j] = cell_indices[v];
+      }
+      cell.triangles.push_back(triangle);
+    }
+  }
+}
+
+void SimplifyTriangleMesh(const SimplifyOptions& options, TriangleMesh* mesh,
+                          size_t max_triangles) {
+  switch (options.queue) {
+    case SimplifierQueue::kIndexedHeap:
+      SimplifyTriangleMeshWithQueue<VertexHeap>(options, mesh, max_triangles);
+      break;
+    case SimplifierQueue::kLazyHeap:
+      SimplifyTriangleMeshWithQueue<LazyVertexHeap>(options, mesh,
+                                                    max_triangles);
+      break;
+  }
+}
+
+}  // namespace meshing
+}  // namespace neuroglancer
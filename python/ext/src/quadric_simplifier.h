@@ -0,0 +1,72 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEUROGLANCER_QUADRIC_SIMPLIFIER_H_
+#define NEUROGLANCER_QUADRIC_SIMPLIFIER_H_
+
+#include "on_demand_object_mesh_generator.h"
+#include "voxel_mesh_generator.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+// Simplifies `mesh` in place by repeated halfedge collapses, working directly
+// on its vertex and triangle arrays rather than on a halfedge mesh.
+//
+// The collapse criteria match those of the OpenMesh decimater used for
+// SimplifierEngine::kOpenMesh: the error of a collapse is evaluated with
+// area-weighted plane quadrics and must be less than
+// `options.max_quadrics_error`, no remaining face normal may rotate by more
+// than `options.max_normal_angle_deviation`, boundary vertices are never
+// removed if `options.lock_boundary_vertices` is set, and collapses that would
+// change the topology of the surface are prohibited.  `options.queue` selects
+// the priority queue of collapses, and the `partition_triangles` and
+// `num_threads` members of `options` control partitioned simplification, as
+// described below; the other members are not used.
+//
+// If `max_triangles` is non-zero and the mesh still has more triangles once no
+// collapse within the error bound remains, collapses are continued without the
+// error bound, in order of increasing error, until the mesh has at most
+// `max_triangles` triangles or no further collapse is legal.
+//
+// If `options.partition_triangles` is non-zero and less than the number of
+// triangles, and `options.max_quadrics_error` is non-negative, the mesh is
+// first divided into a grid of spatial cells of about
+// `options.partition_triangles` triangles each, by triangle centroid.  The
+// cells are simplified in parallel within the error bound, with the vertices
+// shared between cells locked, and the merged mesh is then simplified as a
+// whole, continuing from the quadrics accumulated in the cells, to remove the
+// seams and apply `max_triangles`.  Vertices not referenced by any triangle
+// are dropped in this case, and the remaining triangles are ordered by cell.
+//
+// Otherwise, the remaining vertices and triangles keep their relative order.
+void SimplifyTriangleMesh(const SimplifyOptions& options, TriangleMesh* mesh,
+                          size_t max_triangles = 0);
+
+// Divides `mesh` into the same grid of at least `num_cells` spatial cells as
+// partitioned simplification, by triangle centroid, and stores the triangles
+// of each non-empty cell, and the vertices they reference, as a separate mesh
+// in `cells`.  Vertices shared by several cells are copied into each, and lie
+// on the boundary of each cell mesh if `mesh` is closed, so cells simplified
+// with boundary vertices locked still join without gaps.  The triangles of
+// each cell keep their relative order.
+void PartitionTriangleMesh(const TriangleMesh& mesh, size_t num_cells,
+                           std::vector<TriangleMesh>* cells);
+
+}  // namespace meshing
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_QUADRIC_SIMPLIFIER_H_
@@ -0,0 +1,316 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "quadric_simplifier.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace meshing {
+namespace {
+
+using Index = TriangleMesh::VertexIndex;
+
+// Returns a planar `n` by `n` grid of quads in the z = 0 plane, each split
+// into two triangles.
+TriangleMesh MakeGrid(int n) {
+  TriangleMesh mesh;
+  for (int y = 0; y <= n; ++y) {
+    for (int x = 0; x <= n; ++x) {
+      mesh.vertex_positions.push_back({{float(x), float(y), 0}});
+    }
+  }
+  auto index = [n](int x, int y) { return Index(y * (n + 1) + x); };
+  for (int y = 0; y < n; ++y) {
+    for (int x = 0; x < n; ++x) {
+      mesh.triangles.push_back(
+          {{index(x, y), index(x + 1, y), index(x + 1, y + 1)}});
+      mesh.triangles.push_back(
+          {{index(x, y), index(x + 1, y + 1), index(x, y + 1)}});
+    }
+  }
+  return mesh;
+}
+
+// Returns the closed surface of the cube [0, n]^3, with each face divided
+// into an `n` by `n` grid of quads split into two outward-facing triangles.
+TriangleMesh MakeCube(int n) {
+  TriangleMesh mesh;
+  std::map<std::array<float, 3>, Index> vertex_indices;
+  auto get_vertex = [&](const std::array<float, 3>& p) -> Index {
+    auto it = vertex_indices.find(p);
+    if (it != vertex_indices.end()) return it->second;
+    const Index index = mesh.vertex_positions.size();
+    mesh.vertex_positions.push_back(p);
+    vertex_indices[p] = index;
+    return index;
+  };
+  for (int axis = 0; axis < 3; ++axis) {
+    const int u_axis = (axis + 1) % 3, v_axis = (axis + 2) % 3;
+    for (int side = 0; side < 2; ++side) {
+      auto point = [&](int u, int v) {
+        std::array<float, 3> p;
+        p[axis] = side * n;
+        p[u_axis] = u;
+        p[v_axis] = v;
+        return get_vertex(p);
+      };
+      for (int u = 0; u < n; ++u) {
+        for (int v = 0; v < n; ++v) {
+          Index a = point(u, v), b = point(u + 1, v), c = point(u + 1, v + 1),
+                d = point(u, v + 1);
+          if (side == 0) {
+            std::swap(b, d);
+          }
+          mesh.triangles.push_back({{a, b, c}});
+          mesh.triangles.push_back({{a, c, d}});
+        }
+      }
+    }
+  }
+  return mesh;
+}
+
+// Returns the number of edges with exactly one incident triangle.
+size_t CountBoundaryEdges(const TriangleMesh& mesh) {
+  std::map<std::pair<Index, Index>, int> edge_counts;
+  for (const auto& triangle : mesh.triangles) {
+    for (int i = 0; i < 3; ++i) {
+      Index a = triangle[i], b = triangle[(i + 1) % 3];
+      ++edge_counts[std::make_pair(std::min(a, b), std::max(a, b))];
+    }
+  }
+  size_t count = 0;
+  for (const auto& p : edge_counts) {
+    if (p.second == 1) ++count;
+  }
+  return count;
+}
+
+// Returns twice the signed area of the projection of `mesh` onto the z = 0
+// plane.
+double ProjectedArea(const TriangleMesh& mesh) {
+  double area = 0;
+  for (const auto& triangle : mesh.triangles) {
+    const auto& p0 = mesh.vertex_positions[triangle[0]];
+    const auto& p1 = mesh.vertex_positions[triangle[1]];
+    const auto& p2 = mesh.vertex_positions[triangle[2]];
+    area += (p1[0] - p0[0]) * (p2[1] - p0[1]) -
+            (p1[1] - p0[1]) * (p2[0] - p0[0]);
+  }
+  return area;
+}
+
+// Interior vertices of a planar mesh have zero error and are all removed,
+// while the locked boundary is preserved.
+TEST(SimplifyTriangleMeshTest, PlanarGridLockedBoundary) {
+  const int n = 8;
+  TriangleMesh mesh = MakeGrid(n);
+  SimplifyOptions options;
+  SimplifyTriangleMesh(options, &mesh);
+  ASSERT_EQ(4u * n, mesh.vertex_positions.size());
+  for (const auto& p : mesh.vertex_positions) {
+    EXPECT_TRUE(p[0] == 0 || p[0] == n || p[1] == 0 || p[1] == n);
+  }
+  EXPECT_EQ(4u * n, CountBoundaryEdges(mesh));
+  EXPECT_DOUBLE_EQ(2.0 * n * n, ProjectedArea(mesh));
+  for (const auto& triangle : mesh.triangles) {
+    for (Index v : triangle) {
+      EXPECT_LT(v, mesh.vertex_positions.size());
+    }
+  }
+}
+
+// Without locking, boundary vertices may be collapsed along the boundary.
+// Since the quadrics of a planar mesh do not constrain movement within the
+// plane, the grid is reduced to a single triangle.
+TEST(SimplifyTriangleMeshTest, PlanarGridUnlockedBoundary) {
+  const int n = 8;
+  TriangleMesh mesh = MakeGrid(n);
+  SimplifyOptions options;
+  options.lock_boundary_vertices = false;
+  SimplifyTriangleMesh(options, &mesh);
+  EXPECT_EQ(3u, mesh.vertex_positions.size());
+  EXPECT_EQ(1u, mesh.triangles.size());
+  EXPECT_EQ(3u, CountBoundaryEdges(mesh));
+}
+
+// The corners of a cube cannot be removed within a small error bound, and the
+// surface remains closed.
+TEST(SimplifyTriangleMeshTest, CubeKeepsCorners) {
+  const int n = 4;
+  TriangleMesh mesh = MakeCube(n);
+  SimplifyOptions options;
+  options.max_quadrics_error = 0.1;
+  SimplifyTriangleMesh(options, &mesh);
+  std::set<std::array<float, 3>> positions(mesh.vertex_positions.begin(),
+                                           mesh.vertex_positions.end());
+  for (int corner = 0; corner < 8; ++corner) {
+    std::array<float, 3> p{{float((corner & 1) * n),
+                            float((corner >> 1 & 1) * n),
+                            float((corner >> 2) * n)}};
+    EXPECT_EQ(1u, positions.count(p));
+  }
+  EXPECT_LT(mesh.vertex_positions.size(), 6u * n * n + 2);
+  EXPECT_EQ(0u, CountBoundaryEdges(mesh));
+  // Euler characteristic of a sphere.
+  EXPECT_EQ(2 * mesh.vertex_positions.size() - 4, mesh.triangles.size());
+}
+
+// A small maximum normal deviation prevents collapses that fold the surface
+// over the cube edges, so only vertices within the same face are merged.
+TEST(SimplifyTriangleMeshTest, CubeNormalDeviation) {
+  const int n = 4;
+  TriangleMesh mesh = MakeCube(n);
+  SimplifyOptions options;
+  options.max_quadrics_error = 1e6;
+  options.max_normal_angle_deviation = 1;
+  SimplifyTriangleMesh(options, &mesh);
+  for (const auto& triangle : mesh.triangles) {
+    // Each remaining triangle lies within a face of the cube.
+    bool planar = false;
+    for (int axis = 0; axis < 3; ++axis) {
+      const float c = mesh.vertex_positions[triangle[0]][axis];
+      if ((c == 0 || c == n) &&
+          mesh.vertex_positions[triangle[1]][axis] == c &&
+          mesh.vertex_positions[triangle[2]][axis] == c) {
+        planar = true;
+      }
+    }
+    EXPECT_TRUE(planar);
+  }
+  EXPECT_EQ(0u, CountBoundaryEdges(mesh));
+}
+
+// Simplification continues beyond the error bound to meet the triangle cap.
+TEST(SimplifyTriangleMeshTest, MaxTriangles) {
+  const int n = 4;
+  TriangleMesh mesh = MakeCube(n);
+  ASSERT_EQ(12u * n * n, mesh.triangles.size());
+  SimplifyOptions options;
+  options.max_quadrics_error = -1;
+  SimplifyTriangleMesh(options, &mesh, 50);
+  EXPECT_LE(mesh.triangles.size(), 50u);
+  EXPECT_GE(mesh.triangles.size(), 48u);
+  EXPECT_EQ(0u, CountBoundaryEdges(mesh));
+  EXPECT_EQ(2 * mesh.vertex_positions.size() - 4, mesh.triangles.size());
+}
+
+// Partitioned simplification removes the seams between cells, so the result
+// is as coarse as without partitioning.
+TEST(SimplifyTriangleMeshTest, Partitioned) {
+  const int n = 16;
+  SimplifyOptions options;
+  options.max_quadrics_error = 0.1;
+  TriangleMesh unpartitioned = MakeCube(n);
+  SimplifyTriangleMesh(options, &unpartitioned);
+  TriangleMesh mesh = MakeCube(n);
+  options.partition_triangles = 200;
+  options.num_threads = 4;
+  SimplifyTriangleMesh(options, &mesh);
+  EXPECT_EQ(0u, CountBoundaryEdges(mesh));
+  EXPECT_EQ(2 * mesh.vertex_positions.size() - 4, mesh.triangles.size());
+  EXPECT_LE(mesh.vertex_positions.size(),
+            unpartitioned.vertex_positions.size() * 5 / 4);
+  std::set<std::array<float, 3>> positions(mesh.vertex_positions.begin(),
+                                           mesh.vertex_positions.end());
+  for (int corner = 0; corner < 8; ++corner) {
+    std::array<float, 3> p{{float((corner & 1) * n),
+                            float((corner >> 1 & 1) * n),
+                            float((corner >> 2) * n)}};
+    EXPECT_EQ(1u, positions.count(p));
+  }
+}
+
+// Cells simplified independently with their boundaries locked join without
+// gaps, so the union of the cells, with vertices identified by position, is
+// still closed.
+TEST(PartitionTriangleMeshTest, CellsSimplifiedIndependently) {
+  const int n = 16;
+  const TriangleMesh mesh = MakeCube(n);
+  std::vector<TriangleMesh> cells;
+  PartitionTriangleMesh(mesh, 8, &cells);
+  ASSERT_EQ(8u, cells.size());
+  SimplifyOptions options;
+  options.max_quadrics_error = 0.1;
+  options.lock_boundary_vertices = true;
+  size_t num_triangles = 0;
+  TriangleMesh merged;
+  std::map<std::array<float, 3>, Index> vertices;
+  for (auto& cell : cells) {
+    num_triangles += cell.triangles.size();
+    EXPECT_LT(0u, CountBoundaryEdges(cell));
+    SimplifyTriangleMesh(options, &cell);
+    for (const auto& triangle : cell.triangles) {
+      std::array<Index, 3> merged_triangle;
+      for (int i = 0; i < 3; ++i) {
+        const auto& p = cell.vertex_positions[triangle[i]];
+        auto it = vertices.emplace(p, merged.vertex_positions.size()).first;
+        if (it->second == merged.vertex_positions.size()) {
+          merged.vertex_positions.push_back(p);
+        }
+        merged_triangle[i] = it->second;
+      }
+      merged.triangles.push_back(merged_triangle);
+    }
+  }
+  EXPECT_EQ(mesh.triangles.size(), num_triangles);
+  EXPECT_LT(merged.triangles.size(), mesh.triangles.size() / 4);
+  EXPECT_EQ(0u, CountBoundaryEdges(merged));
+
+  PartitionTriangleMesh(mesh, 1, &cells);
+  ASSERT_EQ(1u, cells.size());
+  EXPECT_EQ(mesh.triangles.size(), cells[0].triangles.size());
+  EXPECT_EQ(mesh.vertex_positions.size(), cells[0].vertex_positions.size());
+}
+
+// The lazy queue performs collapses in the same order of increasing error, so
+// it simplifies as far as the indexed queue.
+TEST(SimplifyTriangleMeshTest, LazyHeap) {
+  const int n = 8;
+  SimplifyOptions options;
+  for (size_t max_triangles : {size_t(0), size_t(100)}) {
+    // Without a cap, only the planar interiors of the faces are removed.
+    options.max_quadrics_error = max_triangles == 0 ? 0.1 : -1;
+    TriangleMesh expected = MakeCube(n);
+    SimplifyTriangleMesh(options, &expected, max_triangles);
+    TriangleMesh mesh = MakeCube(n);
+    options.queue = SimplifierQueue::kLazyHeap;
+    SimplifyTriangleMesh(options, &mesh, max_triangles);
+    options.queue = SimplifierQueue::kIndexedHeap;
+    EXPECT_EQ(0u, CountBoundaryEdges(mesh));
+    EXPECT_EQ(2 * mesh.vertex_positions.size() - 4, mesh.triangles.size());
+    EXPECT_EQ(expected.triangles.size(), mesh.triangles.size());
+  }
+}
+
+// Triangles that reference a vertex more than once are dropped.
+TEST(SimplifyTriangleMeshTest, DropsDegenerateTriangles) {
+  TriangleMesh mesh = MakeGrid(1);
+  mesh.triangles.push_back({{0, 0, 1}});
+  SimplifyOptions options;
+  SimplifyTriangleMesh(options, &mesh);
+  EXPECT_EQ(4u, mesh.vertex_positions.size());
+  EXPECT_EQ(2u, mesh.triangles.size());
+}
+
+}  // namespace
+}  // namespace meshing
+}  // namespace neuroglancer
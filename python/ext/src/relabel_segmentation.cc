@@ -0,0 +1,352 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "relabel_segmentation.h"
+
+#include <algorithm>
+
+#include "compress_segmentation.h"
+
+namespace neuroglancer {
+namespace compress_segmentation {
+
+namespace {
+
+constexpr size_t kBlockHeaderSize = 2;
+
+template <class Label>
+constexpr size_t NumWordsPerLabel() {
+  return (sizeof(Label) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+}
+
+template <class Label>
+Label ReadTableEntry(const uint32_t* entry) {
+  Label value = 0;
+  for (size_t word_i = 0; word_i < NumWordsPerLabel<Label>(); ++word_i) {
+    value |= static_cast<Label>(entry[word_i]) << (32 * word_i);
+  }
+  return value;
+}
+
+// Returns the number of bits with which to encode each index into a table of
+// `num_values` values, as for EncodeBlock.
+size_t GetEncodedBits(size_t num_values) {
+  size_t encoded_bits = 0;
+  if (num_values != 1) {
+    encoded_bits = 1;
+    while ((size_t(1) << encoded_bits) < num_values) {
+      encoded_bits *= 2;
+    }
+  }
+  return encoded_bits;
+}
+
+bool IsValidEncodedBits(size_t encoded_bits) {
+  switch (encoded_bits) {
+    case 0:
+    case 1:
+    case 2:
+    case 4:
+    case 8:
+    case 16:
+    case 32:
+      return true;
+    default:
+      return false;
+  }
+}
+
+inline uint32_t ReadIndex(const uint32_t* encoded_values, size_t encoded_bits,
+                          size_t i) {
+  if (encoded_bits == 0) return 0;
+  const size_t bit = i * encoded_bits;
+  return static_cast<uint32_t>(
+      (encoded_values[bit / 32] >> (bit % 32)) &
+      ((uint64_t(1) << encoded_bits) - 1));
+}
+
+// Block of the input channel.
+struct InputBlock {
+  size_t table_offset;
+  size_t encoded_bits;
+  size_t encoded_value_offset;
+  // Number of table entries referenced by the voxels of the block within the
+  // volume.
+  size_t table_size;
+};
+
+}  // namespace
+
+template <class Label>
+bool RelabelChannel(const uint32_t* input, size_t input_size,
+                    const ptrdiff_t volume_size[3],
+                    const ptrdiff_t block_size[3],
+                    const std::unordered_map<Label, Label>& mapping,
+                    std::vector<uint32_t>* output) {
+  constexpr size_t num_32bit_words_per_label = NumWordsPerLabel<Label>();
+  ptrdiff_t grid_size[3];
+  size_t num_blocks = 1;
+  for (size_t i = 0; i < 3; ++i) {
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+    num_blocks *= grid_size[i];
+  }
+  if (num_blocks * kBlockHeaderSize > input_size) return false;
+  const size_t block_voxels = block_size[0] * block_size[1] * block_size[2];
+
+  // The format does not record the size of the tables, so the size of each
+  // table is determined as the number of entries referenced by the blocks
+  // that share it.  This reads the encoded values, but not the tables.
+  std::vector<InputBlock> blocks(num_blocks);
+  std::unordered_map<size_t, size_t> table_sizes;
+  for (size_t block_offset = 0; block_offset < num_blocks; ++block_offset) {
+    const uint32_t* header = input + block_offset * kBlockHeaderSize;
+    auto& block = blocks[block_offset];
+    block.table_offset = header[0] & 0xffffff;
+    block.encoded_bits = header[0] >> 24;
+    block.encoded_value_offset = header[1] & 0xffffff;
+    if (!IsValidEncodedBits(block.encoded_bits)) return false;
+    const size_t encoded_size = (block.encoded_bits * block_voxels + 31) / 32;
+    if (block.encoded_value_offset > input_size ||
+        input_size - block.encoded_value_offset < encoded_size) {
+      return false;
+    }
+    const uint32_t* encoded_values = input + block.encoded_value_offset;
+    const ptrdiff_t block_position[3] = {
+        static_cast<ptrdiff_t>(block_offset % grid_size[0]),
+        static_cast<ptrdiff_t>(block_offset / grid_size[0] % grid_size[1]),
+        static_cast<ptrdiff_t>(block_offset / grid_size[0] / grid_size[1])};
+    ptrdiff_t actual_size[3];
+    for (size_t i = 0; i < 3; ++i) {
+      actual_size[i] = std::min(
+          block_size[i], volume_size[i] - block_position[i] * block_size[i]);
+    }
+    uint32_t max_index = 0;
+    if (block.encoded_bits != 0) {
+      for (ptrdiff_t z = 0; z < actual_size[2]; ++z) {
+        for (ptrdiff_t y = 0; y < actual_size[1]; ++y) {
+          size_t i = block_size[0] * (y + block_size[1] * z);
+          for (ptrdiff_t x = 0; x < actual_size[0]; ++x, ++i) {
+            max_index = std::max(
+                max_index, ReadIndex(encoded_values, block.encoded_bits, i));
+          }
+        }
+      }
+    }
+    block.table_size = size_t(max_index) + 1;
+    auto& table_size = table_sizes[block.table_offset];
+    table_size = std::max(table_size, block.table_size);
+  }
+  for (const auto& p : table_sizes) {
+    if (p.first > input_size ||
+        (input_size - p.first) / num_32bit_words_per_label < p.second) {
+      return false;
+    }
+  }
+
+  const size_t channel_begin = output->size();
+  output->resize(channel_begin + num_blocks * kBlockHeaderSize);
+  EncodedValueCache<Label> cache;
+  std::vector<Label> table, merged_table;
+  std::vector<uint32_t> merged_indices;
+  for (size_t block_offset = 0; block_offset < num_blocks; ++block_offset) {
+    const auto& block = blocks[block_offset];
+    const size_t table_size = table_sizes[block.table_offset];
+    table.resize(table_size);
+    const uint32_t* input_table = input + block.table_offset;
+    for (size_t i = 0; i < table_size; ++i) {
+      const Label value =
+          ReadTableEntry<Label>(input_table + i * num_32bit_words_per_label);
+      auto it = mapping.find(value);
+      table[i] = it == mapping.end() ? value : it->second;
+    }
+    merged_table = table;
+    std::sort(merged_table.begin(), merged_table.end());
+    merged_table.erase(std::unique(merged_table.begin(), merged_table.end()),
+                       merged_table.end());
+    const uint32_t* encoded_values = input + block.encoded_value_offset;
+    const size_t encoded_value_base_offset = output->size() - channel_begin;
+    size_t encoded_bits = block.encoded_bits;
+    if (merged_table.size() == table.size()) {
+      // The entries remain distinct, so the encoded values are unchanged.
+      output->insert(output->end(), encoded_values,
+                     encoded_values + (encoded_bits * block_voxels + 31) / 32);
+    } else {
+      // Re-encode the block with indices into the merged table.  Indices of
+      // the padding beyond the volume, which need not refer to the table, are
+      // set to 0, i.e. the lowest value, as by EncodeBlock.
+      merged_indices.resize(table.size());
+      for (size_t i = 0; i < table.size(); ++i) {
+        merged_indices[i] = static_cast<uint32_t>(
+            std::lower_bound(merged_table.begin(), merged_table.end(),
+                             table[i]) -
+            merged_table.begin());
+      }
+      const size_t old_encoded_bits = encoded_bits;
+      encoded_bits = GetEncodedBits(merged_table.size());
+      const size_t begin = output->size();
+      output->resize(begin + (encoded_bits * block_voxels + 31) / 32);
+      if (encoded_bits != 0) {
+        uint32_t* new_encoded_values = output->data() + begin;
+        for (size_t i = 0; i < block_voxels; ++i) {
+          const uint32_t index =
+              ReadIndex(encoded_values, old_encoded_bits, i);
+          if (index >= table.size()) continue;
+          const size_t bit = i * encoded_bits;
+          new_encoded_values[bit / 32] |= merged_indices[index] << (bit % 32);
+        }
+      }
+      table.swap(merged_table);
+    }
+    size_t table_offset;
+    auto it = cache.find(table);
+    if (it != cache.end()) {
+      table_offset = it->second;
+    } else {
+      table_offset = output->size() - channel_begin;
+      const size_t begin = output->size();
+      output->resize(begin + table.size() * num_32bit_words_per_label);
+      for (size_t i = 0; i < table.size(); ++i) {
+        for (size_t word_i = 0; word_i < num_32bit_words_per_label;
+             ++word_i) {
+          (*output)[begin + i * num_32bit_words_per_label + word_i] =
+              static_cast<uint32_t>(table[i] >> (32 * word_i));
+        }
+      }
+      cache.emplace(table, table_offset);
+    }
+    if (output->size() - channel_begin > (size_t(1) << 24)) return false;
+    uint32_t* header =
+        output->data() + channel_begin + block_offset * kBlockHeaderSize;
+    header[0] = static_cast<uint32_t>(table_offset | (encoded_bits << 24));
+    header[1] = static_cast<uint32_t>(encoded_value_base_offset);
+  }
+  return true;
+}
+
+template <class Label>
+bool RelabelChannels(const uint32_t* input, size_t input_size,
+                     const ptrdiff_t volume_size[4],
+                     const ptrdiff_t block_size[3],
+                     const std::unordered_map<Label, Label>& mapping,
+                     std::vector<uint32_t>* output) {
+  output->clear();
+  if (static_cast<size_t>(volume_size[3]) > input_size) return false;
+  output->resize(volume_size[3]);
+  for (ptrdiff_t channel_i = 0; channel_i < volume_size[3]; ++channel_i) {
+    const size_t channel_offset = input[channel_i];
+    if (channel_offset > input_size) return false;
+    (*output)[channel_i] = output->size();
+    if (!RelabelChannel(input + channel_offset, input_size - channel_offset,
+                        volume_size, block_size, mapping, output)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <class Label>
+bool UpdateChannels(const uint32_t* input, size_t input_size,
+                    const Label* labels, const ptrdiff_t label_strides[4],
+                    const ptrdiff_t volume_size[4],
+                    const ptrdiff_t block_size[3], const ptrdiff_t start[3],
+                    const ptrdiff_t end[3], bool compact,
+                    std::vector<uint32_t>* output) {
+  if (static_cast<size_t>(volume_size[3]) > input_size) return false;
+  ptrdiff_t grid_size[3], grid_start[3], grid_end[3];
+  size_t num_blocks = 1;
+  for (size_t i = 0; i < 3; ++i) {
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+    num_blocks *= grid_size[i];
+    grid_start[i] = start[i] / block_size[i];
+    grid_end[i] =
+        start[i] < end[i] ? (end[i] + block_size[i] - 1) / block_size[i] : 0;
+  }
+  std::vector<uint32_t> appended(input, input + input_size);
+  for (ptrdiff_t channel_i = 0; channel_i < volume_size[3]; ++channel_i) {
+    const size_t channel_offset = input[channel_i];
+    if (channel_offset > input_size ||
+        input_size - channel_offset < num_blocks * kBlockHeaderSize) {
+      return false;
+    }
+    EncodedValueCache<Label> cache;
+    ptrdiff_t block[3];
+    for (block[2] = grid_start[2]; block[2] < grid_end[2]; ++block[2]) {
+      for (block[1] = grid_start[1]; block[1] < grid_end[1]; ++block[1]) {
+        for (block[0] = grid_start[0]; block[0] < grid_end[0]; ++block[0]) {
+          const Label* block_labels = labels + channel_i * label_strides[3];
+          ptrdiff_t actual_size[3];
+          for (size_t i = 0; i < 3; ++i) {
+            const ptrdiff_t origin = block[i] * block_size[i];
+            actual_size[i] =
+                std::min(block_size[i], volume_size[i] - origin);
+            block_labels += origin * label_strides[i];
+          }
+          const size_t encoded_value_base_offset =
+              appended.size() - channel_offset;
+          size_t encoded_bits, table_offset;
+          EncodeBlock(block_labels, label_strides, block_size, actual_size,
+                      channel_offset, &encoded_bits, &table_offset, &cache,
+                      &appended);
+          if (appended.size() - channel_offset > (size_t(1) << 24)) {
+            return false;
+          }
+          uint32_t* header =
+              appended.data() + channel_offset +
+              (block[0] + grid_size[0] * (block[1] + grid_size[1] * block[2])) *
+                  kBlockHeaderSize;
+          header[0] =
+              static_cast<uint32_t>(table_offset | (encoded_bits << 24));
+          header[1] = static_cast<uint32_t>(encoded_value_base_offset);
+        }
+      }
+    }
+  }
+  if (!compact) {
+    output->swap(appended);
+    return true;
+  }
+  return RelabelChannels(appended.data(), appended.size(), volume_size,
+                         block_size, std::unordered_map<Label, Label>(),
+                         output);
+}
+
+#define DO_INSTANTIATE(Label)                                        \
+  template bool RelabelChannel<Label>(                               \
+      const uint32_t* input, size_t input_size,                      \
+      const ptrdiff_t volume_size[3], const ptrdiff_t block_size[3], \
+      const std::unordered_map<Label, Label>& mapping,               \
+      std::vector<uint32_t>* output);                                \
+  template bool RelabelChannels<Label>(                              \
+      const uint32_t* input, size_t input_size,                      \
+      const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3], \
+      const std::unordered_map<Label, Label>& mapping,               \
+      std::vector<uint32_t>* output);                                \
+  template bool UpdateChannels<Label>(                               \
+      const uint32_t* input, size_t input_size, const Label* labels, \
+      const ptrdiff_t label_strides[4],                              \
+      const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3], \
+      const ptrdiff_t start[3],                                      \
+      const ptrdiff_t end[3], bool compact,                          \
+      std::vector<uint32_t>* output);                                \
+/**/
+
+DO_INSTANTIATE(uint32_t)
+DO_INSTANTIATE(uint64_t)
+
+#undef DO_INSTANTIATE
+
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
@@ -0,0 +1,138 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Implements modification of the compressed segmentation format produced by
+// compress_segmentation.h without decoding or re-encoding unchanged blocks:
+// relabeling, and updating the blocks of a changed region.
+//
+// Labels are stored only in the per-block value tables, so a mapping of labels
+// is applied by rewriting the tables.  The encoded values of a block are
+// rewritten only if the mapping merges entries of its table, in which case the
+// merged table is sorted and the block is encoded with the fewest bits, as by
+// EncodeBlock.  Otherwise the block keeps its encoded values and the order of
+// its table, which decoders do not depend on.  The output is validated as by
+// DecompressChannel.
+//
+// An update re-encodes only the blocks that intersect the changed region, and
+// appends them to the existing encoding, leaving the data of the replaced
+// blocks unreferenced until the encoding is compacted.
+//
+// Only uint32 and uint64 volumes are supported.
+
+#ifndef NEUROGLANCER_RELABEL_SEGMENTATION_H_
+#define NEUROGLANCER_RELABEL_SEGMENTATION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace neuroglancer {
+namespace compress_segmentation {
+
+// Relabels a single channel.
+//
+// Args:
+//
+//   input: Pointer to the start of the encoded channel.
+//
+//   input_size: Number of 32-bit words available at input.
+//
+//   volume_size: Extent of the x, y, and z dimensions of the channel.
+//
+//   block_size: Extent of the x, y, and z dimensions of the block.
+//
+//   mapping: New label of each label to change.  Labels not in `mapping` are
+//       unchanged.
+//
+//   output: Vector to which the relabeled channel will be appended.  Table
+//       offsets are relative to the start of the appended channel.
+//
+// Returns false if the input is invalid, leaving `output` unspecified.
+template <class Label>
+bool RelabelChannel(const uint32_t* input, size_t input_size,
+                    const ptrdiff_t volume_size[3],
+                    const ptrdiff_t block_size[3],
+                    const std::unordered_map<Label, Label>& mapping,
+                    std::vector<uint32_t>* output);
+
+// Relabels each channel of the output of CompressChannels, as for
+// RelabelChannel.
+//
+// Args:
+//
+//   volume_size: Extent of the x, y, z, and channel dimensions.
+//
+//   output: Vector where output will be stored.  Any existing content is
+//       cleared.
+//
+// The other arguments are as for RelabelChannel.  Tables shared across
+// channels are written in each channel that uses them.
+template <class Label>
+bool RelabelChannels(const uint32_t* input, size_t input_size,
+                     const ptrdiff_t volume_size[4],
+                     const ptrdiff_t block_size[3],
+                     const std::unordered_map<Label, Label>& mapping,
+                     std::vector<uint32_t>* output);
+
+// Updates the output of CompressChannels after the labels within the box
+// [start, end) of each channel have changed, re-encoding only the blocks that
+// intersect the box.
+//
+// The new blocks are encoded as by EncodeBlock, sharing tables among
+// themselves, and appended to a copy of the input, and their headers are
+// rewritten.  The data of the replaced blocks remains in the output, unless
+// `compact` is true, in which case each channel is rewritten as by
+// RelabelChannels with an empty mapping, which for input produced by
+// CompressChannels gives exactly the encoding of the updated labels.
+//
+// Args:
+//
+//   input: Pointer to the start of the encoded channels.
+//
+//   input_size: Number of 32-bit words available at input.
+//
+//   labels: Pointer to the first element of the updated labels.  Only the
+//       blocks intersecting the box are read.
+//
+//   label_strides: Stride in Label units between consecutive elements of
+//       `labels` in the x, y, z, and channel dimensions.
+//
+//   volume_size: Extent of the x, y, z, and channel dimensions.
+//
+//   block_size: Extent of the x, y, and z dimensions of the block.
+//
+//   start, end: Bounds of the changed box of each channel, which must satisfy
+//       0 <= start <= end <= volume_size.
+//
+//   output: Vector where output will be stored.  Any existing content is
+//       cleared.
+//
+// Returns false if the input is invalid, or if an offset of the updated
+// encoding does not fit in 24 bits, leaving `output` unspecified.
+template <class Label>
+bool UpdateChannels(const uint32_t* input, size_t input_size,
+                    const Label* labels, const ptrdiff_t label_strides[4],
+                    const ptrdiff_t volume_size[4],
+                    const ptrdiff_t block_size[3], const ptrdiff_t start[3],
+                    const ptrdiff_t end[3], bool compact,
+                    std::vector<uint32_t>* output);
+
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_RELABEL_SEGMENTATION_H_
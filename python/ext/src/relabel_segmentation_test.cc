@@ -0,0 +1,188 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "relabel_segmentation.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "compress_segmentation.h"
+#include "decompress_segmentation.h"
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace compress_segmentation {
+namespace {
+
+// Volume with partial blocks at the upper bounds, and blocks of up to 16
+// distinct labels.
+constexpr ptrdiff_t kVolumeSize[4] = {19, 13, 11, 2};
+constexpr ptrdiff_t kInputStrides[4] = {1, 19, 19 * 13, 19 * 13 * 11};
+constexpr ptrdiff_t kBlockSize[3] = {8, 4, 4};
+
+template <class Label>
+std::vector<Label> MakeVolume() {
+  std::vector<Label> input(kVolumeSize[0] * kVolumeSize[1] * kVolumeSize[2] *
+                           kVolumeSize[3]);
+  uint64_t state = 1;
+  for (auto& value : input) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    value = static_cast<Label>((state >> 60) * 0x100000001ull);
+  }
+  return input;
+}
+
+template <class Label>
+std::vector<Label> ApplyMapping(
+    std::vector<Label> input, const std::unordered_map<Label, Label>& mapping) {
+  for (auto& value : input) {
+    auto it = mapping.find(value);
+    if (it != mapping.end()) value = it->second;
+  }
+  return input;
+}
+
+// A mapping that preserves the order of labels leaves the tables of blocks it
+// does not merge sorted, so the result matches encoding the relabeled volume.
+template <class Label>
+void TestOrderPreservingMapping() {
+  const auto input = MakeVolume<Label>();
+  std::unordered_map<Label, Label> mapping;
+  for (uint64_t i = 0; i < 16; ++i) {
+    mapping[static_cast<Label>(i * 0x100000001ull)] =
+        static_cast<Label>((i < 12 ? i / 4 : i) * 0x100000001ull);
+  }
+  std::vector<uint32_t> encoded, expected, output;
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &encoded);
+  const auto relabeled = ApplyMapping(input, mapping);
+  CompressChannels(relabeled.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &expected);
+  ASSERT_TRUE(RelabelChannels(encoded.data(), encoded.size(), kVolumeSize,
+                              kBlockSize, mapping, &output));
+  EXPECT_EQ(expected, output);
+  EXPECT_LT(output.size(), encoded.size());
+}
+
+TEST(RelabelChannelsTest, OrderPreservingUint32) {
+  TestOrderPreservingMapping<uint32_t>();
+}
+
+TEST(RelabelChannelsTest, OrderPreservingUint64) {
+  TestOrderPreservingMapping<uint64_t>();
+}
+
+// An arbitrary mapping, including labels not present in the volume, decodes
+// to the relabeled volume.
+TEST(RelabelChannelsTest, ArbitraryMapping) {
+  const auto input = MakeVolume<uint64_t>();
+  std::unordered_map<uint64_t, uint64_t> mapping;
+  for (uint64_t i = 0; i < 20; ++i) {
+    mapping[i * 0x100000001ull] = (i * 7 % 5) << 40;
+  }
+  std::vector<uint32_t> encoded, output;
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &encoded);
+  ASSERT_TRUE(RelabelChannels(encoded.data(), encoded.size(), kVolumeSize,
+                              kBlockSize, mapping, &output));
+  std::vector<uint64_t> decoded(input.size());
+  const ptrdiff_t start[3] = {0, 0, 0};
+  ASSERT_TRUE(DecompressChannels(output.data(), output.size(), kVolumeSize,
+                                 kBlockSize, start, kVolumeSize, kInputStrides,
+                                 decoded.data()));
+  EXPECT_EQ(ApplyMapping(input, mapping), decoded);
+
+  // An empty mapping leaves the encoding unchanged.
+  mapping.clear();
+  ASSERT_TRUE(RelabelChannels(encoded.data(), encoded.size(), kVolumeSize,
+                              kBlockSize, mapping, &output));
+  EXPECT_EQ(encoded, output);
+}
+
+// Updating the blocks of a changed box decodes to the changed volume, and
+// once compacted is identical to encoding it.
+template <class Label>
+void TestUpdate() {
+  const auto input = MakeVolume<Label>();
+  std::vector<uint32_t> encoded;
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &encoded);
+  const ptrdiff_t start[3] = {5, 3, 2};
+  const ptrdiff_t end[3] = {19, 7, 3};
+  auto changed = input;
+  for (ptrdiff_t c = 0; c < kVolumeSize[3]; ++c) {
+    for (ptrdiff_t z = start[2]; z < end[2]; ++z) {
+      for (ptrdiff_t y = start[1]; y < end[1]; ++y) {
+        for (ptrdiff_t x = start[0]; x < end[0]; ++x) {
+          changed[x * kInputStrides[0] + y * kInputStrides[1] +
+                  z * kInputStrides[2] + c * kInputStrides[3]] =
+              static_cast<Label>(100 + (x + y) % 3);
+        }
+      }
+    }
+  }
+  std::vector<uint32_t> expected;
+  CompressChannels(changed.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &expected);
+  std::vector<uint32_t> output;
+  ASSERT_TRUE(UpdateChannels(encoded.data(), encoded.size(), changed.data(),
+                             kInputStrides, kVolumeSize, kBlockSize, start,
+                             end, /*compact=*/false, &output));
+  // The new blocks are appended after the unchanged data of channel 0 that
+  // follows its 3 * 4 * 3 block headers.
+  ASSERT_GT(output.size(), encoded.size());
+  EXPECT_TRUE(std::equal(encoded.begin() + encoded[0] + 3 * 4 * 3 * 2,
+                         encoded.begin() + encoded[1],
+                         output.begin() + encoded[0] + 3 * 4 * 3 * 2));
+  std::vector<Label> decoded(changed.size());
+  const ptrdiff_t decode_start[3] = {0, 0, 0};
+  ASSERT_TRUE(DecompressChannels(output.data(), output.size(), kVolumeSize,
+                                 kBlockSize, decode_start, kVolumeSize,
+                                 kInputStrides, decoded.data()));
+  EXPECT_EQ(changed, decoded);
+  ASSERT_TRUE(UpdateChannels(encoded.data(), encoded.size(), changed.data(),
+                             kInputStrides, kVolumeSize, kBlockSize, start,
+                             end, /*compact=*/true, &output));
+  EXPECT_EQ(expected, output);
+
+  // An empty box leaves the encoding unchanged.
+  ASSERT_TRUE(UpdateChannels(encoded.data(), encoded.size(), changed.data(),
+                             kInputStrides, kVolumeSize, kBlockSize, start,
+                             start, /*compact=*/false, &output));
+  EXPECT_EQ(encoded, output);
+}
+
+TEST(UpdateChannelsTest, Uint32) { TestUpdate<uint32_t>(); }
+
+TEST(UpdateChannelsTest, Uint64) { TestUpdate<uint64_t>(); }
+
+TEST(RelabelChannelsTest, Invalid) {
+  const auto input = MakeVolume<uint32_t>();
+  std::vector<uint32_t> encoded, output;
+  CompressChannels(input.data(), kInputStrides, kVolumeSize, kBlockSize,
+                   &encoded);
+  const std::unordered_map<uint32_t, uint32_t> mapping{{1, 2}};
+  EXPECT_FALSE(RelabelChannels(encoded.data(), encoded.size() / 2,
+                               kVolumeSize, kBlockSize, mapping, &output));
+  // Invalid number of encoding bits in the first block header.
+  encoded[2] |= 3 << 24;
+  EXPECT_FALSE(RelabelChannels(encoded.data(), encoded.size(), kVolumeSize,
+                               kBlockSize, mapping, &output));
+}
+
+}  // namespace
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
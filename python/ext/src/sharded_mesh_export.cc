@@ -0,0 +1,503 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sharded_mesh_export.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+#include "trace_events.h"
+
+#ifdef NEUROGLANCER_DRACO
+#include "draco/compression/encode.h"
+#include "draco/mesh/mesh.h"
+#endif
+
+namespace neuroglancer {
+namespace meshing {
+
+namespace {
+
+// Maximum number of levels of detail, such that the octree positions at level
+// 0 fit in 21 bits for Morton codes.
+constexpr int kMaxLods = 21;
+
+uint32_t LoadWord(const char* input) {
+  const auto* bytes = reinterpret_cast<const unsigned char*>(input);
+  return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) |
+         (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+}
+
+void AppendWord(uint32_t value, std::string* output) {
+  for (int i = 0; i < 4; ++i) {
+    output->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+void AppendFloat(float value, std::string* output) {
+  uint32_t word;
+  std::memcpy(&word, &value, sizeof(float));
+  AppendWord(word, output);
+}
+
+std::string FormatFloat(float value) {
+  std::ostringstream stream;
+  stream.precision(std::numeric_limits<float>::max_digits10);
+  stream << value;
+  return stream.str();
+}
+
+// Returns the Morton code of an octree position, with x in the least
+// significant bit, which orders positions as the client requires.
+uint64_t EncodeMorton(const std::array<uint32_t, 3>& position) {
+  uint64_t code = 0;
+  for (int bit = 0; bit < kMaxLods; ++bit) {
+    for (int i = 0; i < 3; ++i) {
+      code |= uint64_t((position[i] >> bit) & 1) << (3 * bit + i);
+    }
+  }
+  return code;
+}
+
+std::array<uint32_t, 3> DecodeMorton(uint64_t code) {
+  std::array<uint32_t, 3> position = {{0, 0, 0}};
+  for (int bit = 0; bit < kMaxLods; ++bit) {
+    for (int i = 0; i < 3; ++i) {
+      position[i] |= uint32_t((code >> (3 * bit + i)) & 1) << bit;
+    }
+  }
+  return position;
+}
+
+// Vertex position in units of the octree nodes of level 0, relative to the
+// grid origin of the object.
+using Point = std::array<double, 3>;
+
+// Clips the convex polygon `input` to the half-space `point[axis] <= value`
+// if `below`, or `point[axis] >= value` otherwise.  The intersection of an
+// edge with the plane is computed from its endpoints in a canonical order, so
+// that the edges shared by adjacent triangles are clipped identically.
+void ClipPolygon(const std::vector<Point>& input, int axis, double value,
+                 bool below, std::vector<Point>* output) {
+  output->clear();
+  const size_t n = input.size();
+  for (size_t i = 0; i < n; ++i) {
+    const Point& a = input[i];
+    const Point& b = input[(i + 1) % n];
+    const double da = a[axis] - value, db = b[axis] - value;
+    if (below ? da <= 0 : da >= 0) output->push_back(a);
+    if ((da < 0 && db > 0) || (da > 0 && db < 0)) {
+      const Point& p = std::min(a, b);
+      const Point& q = std::max(a, b);
+      const double t = (value - p[axis]) / (q[axis] - p[axis]);
+      Point intersection;
+      for (int j = 0; j < 3; ++j) {
+        intersection[j] = p[j] + t * (q[j] - p[j]);
+      }
+      intersection[axis] = value;
+      output->push_back(intersection);
+    }
+  }
+}
+
+// Quantized fragment of one octree node.
+struct NodeMesh {
+  QuantizedMesh mesh;
+  // Maps packed quantized positions to vertex indices.
+  std::unordered_map<uint64_t, uint32_t> vertex_indices;
+};
+
+// Clips the triangles of one level of detail, encoded with MeshEncoding::kRaw,
+// to cells of `cell_size` and adds them to the quantized fragments of the
+// octree nodes of `node_size`, keyed by their Morton code.
+void AddClippedTriangles(const std::string& encoded, const Point& grid_origin,
+                         double chunk_size, int64_t cell_size,
+                         int64_t node_size, int64_t grid_size,
+                         int vertex_quantization_bits,
+                         std::map<uint64_t, NodeMesh>* nodes) {
+  const uint32_t num_vertices = LoadWord(encoded.data());
+  const char* vertex_data = encoded.data() + 4;
+  const char* index_data = vertex_data + size_t(num_vertices) * 12;
+  const size_t num_indices =
+      (encoded.size() - 4 - size_t(num_vertices) * 12) / 4;
+  std::vector<Point> points(num_vertices);
+  for (uint32_t i = 0; i < num_vertices; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      const uint32_t word = LoadWord(vertex_data + i * 12 + j * 4);
+      float coordinate;
+      std::memcpy(&coordinate, &word, sizeof(float));
+      points[i][j] = (coordinate - grid_origin[j]) / chunk_size;
+    }
+  }
+  const int64_t num_cells = grid_size / cell_size;
+  const auto get_cell = [&](double u) {
+    return std::min(num_cells - 1,
+                    std::max(int64_t(0), static_cast<int64_t>(
+                                             std::floor(u / cell_size))));
+  };
+  const double max_quantized =
+      double((uint32_t(1) << vertex_quantization_bits) - 1);
+
+  const auto add_vertex = [&](NodeMesh* node,
+                              const std::array<uint32_t, 3>& node_position,
+                              const Point& point) {
+    uint64_t key = 0;
+    std::array<uint32_t, 3> quantized;
+    for (int j = 0; j < 3; ++j) {
+      const double t = (point[j] - double(node_position[j]) * node_size) /
+                       node_size;
+      quantized[j] = static_cast<uint32_t>(std::min(
+          max_quantized, std::max(0.0, std::round(t * max_quantized))));
+      key |= uint64_t(quantized[j]) << (16 * j);
+    }
+    auto it = node->vertex_indices.emplace(
+        key, static_cast<uint32_t>(node->vertex_indices.size()));
+    if (it.second) {
+      node->mesh.positions.insert(node->mesh.positions.end(), quantized.begin(),
+                                  quantized.end());
+    }
+    return it.first->second;
+  };
+
+  const auto add_polygon = [&](const std::array<int64_t, 3>& cell,
+                               const std::vector<Point>& polygon) {
+    if (polygon.size() < 3) return;
+    std::array<uint32_t, 3> node_position;
+    for (int j = 0; j < 3; ++j) {
+      node_position[j] = static_cast<uint32_t>(cell[j] * cell_size / node_size);
+    }
+    NodeMesh& node = (*nodes)[EncodeMorton(node_position)];
+    const uint32_t first = add_vertex(&node, node_position, polygon[0]);
+    uint32_t previous = add_vertex(&node, node_position, polygon[1]);
+    for (size_t i = 2; i < polygon.size(); ++i) {
+      const uint32_t current = add_vertex(&node, node_position, polygon[i]);
+      // Triangles that are degenerate after quantization are dropped.
+      if (first != previous && previous != current && current != first) {
+        node.mesh.indices.push_back(first);
+        node.mesh.indices.push_back(previous);
+        node.mesh.indices.push_back(current);
+      }
+      previous = current;
+    }
+  };
+
+  std::vector<Point> polygon, clipped;
+  for (size_t triangle = 0; triangle + 3 <= num_indices; triangle += 3) {
+    std::array<Point, 3> vertices;
+    std::array<int64_t, 3> lower, upper;
+    for (int i = 0; i < 3; ++i) {
+      vertices[i] = points[LoadWord(index_data + (triangle + i) * 4)];
+    }
+    for (int j = 0; j < 3; ++j) {
+      const auto minmax = std::minmax({vertices[0][j], vertices[1][j],
+                                       vertices[2][j]});
+      lower[j] = get_cell(minmax.first);
+      upper[j] = get_cell(minmax.second);
+    }
+    std::array<int64_t, 3> cell;
+    for (cell[2] = lower[2]; cell[2] <= upper[2]; ++cell[2]) {
+      for (cell[1] = lower[1]; cell[1] <= upper[1]; ++cell[1]) {
+        for (cell[0] = lower[0]; cell[0] <= upper[0]; ++cell[0]) {
+          polygon.assign(vertices.begin(), vertices.end());
+          // Only the planes that the triangle crosses are clipped, so that
+          // vertices outside the grid due to rounding are retained.
+          for (int j = 0; j < 3; ++j) {
+            if (cell[j] > lower[j]) {
+              ClipPolygon(polygon, j, double(cell[j] * cell_size),
+                          /*below=*/false, &clipped);
+              std::swap(polygon, clipped);
+            }
+            if (cell[j] < upper[j]) {
+              ClipPolygon(polygon, j, double((cell[j] + 1) * cell_size),
+                          /*below=*/true, &clipped);
+              std::swap(polygon, clipped);
+            }
+          }
+          add_polygon(cell, polygon);
+        }
+      }
+    }
+  }
+}
+
+#ifdef NEUROGLANCER_DRACO
+bool EncodeDracoFragment(const QuantizedMesh& mesh, int compression_level,
+                         std::string* output) {
+  trace_events::Span span("EncodeDracoFragment", "triangles",
+                          mesh.indices.size() / 3);
+  const uint32_t num_vertices =
+      static_cast<uint32_t>(mesh.positions.size() / 3);
+  draco::Mesh draco_mesh;
+  draco_mesh.set_num_points(num_vertices);
+  // The client requires integer positions, without Draco quantization.
+  draco::GeometryAttribute attribute;
+  attribute.Init(draco::GeometryAttribute::POSITION, nullptr, 3,
+                 draco::DT_INT32, false, sizeof(int32_t) * 3, 0);
+  const int attribute_id =
+      draco_mesh.AddAttribute(attribute, /*identity_mapping=*/true,
+                              num_vertices);
+  auto* position_attribute = draco_mesh.attribute(attribute_id);
+  for (uint32_t i = 0; i < num_vertices; ++i) {
+    int32_t position[3];
+    for (int j = 0; j < 3; ++j) {
+      position[j] = static_cast<int32_t>(mesh.positions[i * 3 + j]);
+    }
+    position_attribute->SetAttributeValue(draco::AttributeValueIndex(i),
+                                          position);
+  }
+  for (size_t i = 0; i + 3 <= mesh.indices.size(); i += 3) {
+    draco::Mesh::Face face;
+    for (int j = 0; j < 3; ++j) {
+      face[j] = draco::PointIndex(mesh.indices[i + j]);
+    }
+    draco_mesh.AddFace(face);
+  }
+  draco::Encoder encoder;
+  const int speed = 10 - compression_level;
+  encoder.SetSpeedOptions(speed, speed);
+  draco::EncoderBuffer buffer;
+  if (!encoder.EncodeMeshToBuffer(draco_mesh, &buffer).ok()) return false;
+  output->assign(buffer.data(), buffer.size());
+  return true;
+}
+#endif  // NEUROGLANCER_DRACO
+
+}  // namespace
+
+bool HaveDracoEncoder() {
+#ifdef NEUROGLANCER_DRACO
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool EncodeMultiresolutionMesh(
+    const std::vector<std::shared_ptr<const std::string>>& lods,
+    float lod_scale, int vertex_quantization_bits,
+    const FragmentEncoder& encode_fragment, MultiresolutionMesh* result,
+    std::string* error) {
+  result->fragment_data.clear();
+  result->manifest.clear();
+  const int num_lods = static_cast<int>(lods.size());
+  if (num_lods == 0 || num_lods > kMaxLods) {
+    *error = "Invalid number of levels of detail";
+    return false;
+  }
+
+  // Returns the number of vertices of a level, or -1 if it has no triangles.
+  const auto get_num_vertices = [](const std::string& encoded) -> int64_t {
+    if (encoded.size() < 4) return -1;
+    const uint32_t num_vertices = LoadWord(encoded.data());
+    if (encoded.size() <= 4 + size_t(num_vertices) * 12) return -1;
+    return num_vertices;
+  };
+  if (get_num_vertices(*lods[0]) < 0) return true;
+
+  // Bounding box of the vertices of all levels.
+  Point lower, upper;
+  lower.fill(std::numeric_limits<double>::infinity());
+  upper.fill(-std::numeric_limits<double>::infinity());
+  for (const auto& lod : lods) {
+    const std::string& encoded = *lod;
+    const int64_t num_vertices = get_num_vertices(encoded);
+    for (int64_t i = 0; i < num_vertices; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        const uint32_t word = LoadWord(encoded.data() + 4 + i * 12 + j * 4);
+        float coordinate;
+        std::memcpy(&coordinate, &word, sizeof(float));
+        lower[j] = std::min(lower[j], double(coordinate));
+        upper[j] = std::max(upper[j], double(coordinate));
+      }
+    }
+  }
+
+  // The grid origin and chunk shape are stored as float32, so the vertices
+  // are transformed with their rounded values.
+  std::array<float, 3> grid_origin;
+  double extent = 0;
+  for (int j = 0; j < 3; ++j) {
+    grid_origin[j] = static_cast<float>(lower[j]);
+    if (grid_origin[j] > lower[j]) {
+      grid_origin[j] = std::nextafter(grid_origin[j],
+                                      -std::numeric_limits<float>::infinity());
+    }
+    extent = std::max(extent, upper[j] - grid_origin[j]);
+  }
+  const int64_t grid_size = int64_t(1) << (num_lods - 1);
+  // Padded so that the vertices at the upper bound lie within the grid.
+  float chunk_size =
+      static_cast<float>(extent * (1 + 1.0 / 1024) / grid_size);
+  if (!(chunk_size > 0)) chunk_size = 1;
+  const Point origin = {{grid_origin[0], grid_origin[1], grid_origin[2]}};
+
+  // Morton codes of the nodes of each level, including empty nodes that are
+  // the parents of nodes of the level below, as the client requires.
+  std::vector<std::map<uint64_t, NodeMesh>> lod_nodes(num_lods);
+  std::vector<std::set<uint64_t>> lod_keys(num_lods);
+  for (int lod = 0; lod < num_lods; ++lod) {
+    const int64_t node_size = int64_t(1) << lod;
+    if (get_num_vertices(*lods[lod]) >= 0) {
+      AddClippedTriangles(*lods[lod], origin, chunk_size,
+                          lod == 0 ? 1 : node_size / 2, node_size, grid_size,
+                          vertex_quantization_bits, &lod_nodes[lod]);
+    }
+    for (const auto& node : lod_nodes[lod]) lod_keys[lod].insert(node.first);
+    if (lod > 0) {
+      for (const uint64_t child : lod_keys[lod - 1]) {
+        lod_keys[lod].insert(child >> 3);
+      }
+    }
+  }
+
+  std::string& manifest = result->manifest;
+  for (int i = 0; i < 3; ++i) AppendFloat(chunk_size, &manifest);
+  for (int i = 0; i < 3; ++i) AppendFloat(grid_origin[i], &manifest);
+  AppendWord(static_cast<uint32_t>(num_lods), &manifest);
+  for (int lod = 0; lod < num_lods; ++lod) {
+    AppendFloat(std::ldexp(lod_scale, lod), &manifest);
+  }
+  for (int i = 0; i < num_lods * 3; ++i) AppendFloat(0, &manifest);
+  for (int lod = 0; lod < num_lods; ++lod) {
+    AppendWord(static_cast<uint32_t>(lod_keys[lod].size()), &manifest);
+  }
+  std::string fragment;
+  for (int lod = 0; lod < num_lods; ++lod) {
+    std::vector<std::array<uint32_t, 3>> positions;
+    for (const uint64_t key : lod_keys[lod]) {
+      positions.push_back(DecodeMorton(key));
+    }
+    for (int j = 0; j < 3; ++j) {
+      for (const auto& position : positions) {
+        AppendWord(position[j], &manifest);
+      }
+    }
+    for (const uint64_t key : lod_keys[lod]) {
+      auto it = lod_nodes[lod].find(key);
+      fragment.clear();
+      if (it != lod_nodes[lod].end() && !it->second.mesh.indices.empty()) {
+        if (!encode_fragment(it->second.mesh, &fragment)) {
+          *error = "Failed to encode mesh fragment";
+          return false;
+        }
+        // Release the fragment once encoded.
+        lod_nodes[lod].erase(it);
+      }
+      AppendWord(static_cast<uint32_t>(fragment.size()), &manifest);
+      result->fragment_data += fragment;
+    }
+  }
+  return true;
+}
+
+bool ExportShardedMultiresolutionMeshes(
+    OnDemandObjectMeshGenerator& generator, const std::string& directory,
+    const MultiresolutionMeshExportOptions& options, std::string* error) {
+  const auto& sharding = options.sharding;
+  if (generator.encoding() != MeshEncoding::kRaw ||
+      generator.vertex_normals() != VertexNormalEncoding::kNone) {
+    *error =
+        "Multi-resolution meshes require the raw mesh encoding without vertex "
+        "normals";
+    return false;
+  }
+  if (generator.num_lods() > kMaxLods) {
+    *error = "Too many levels of detail";
+    return false;
+  }
+  if (options.vertex_quantization_bits != 10 &&
+      options.vertex_quantization_bits != 16) {
+    *error = "vertex_quantization_bits must be 10 or 16";
+    return false;
+  }
+  if (!sharding.Validate(error)) return false;
+  FragmentEncoder encode_fragment = options.encode_fragment;
+  if (!encode_fragment) {
+#ifdef NEUROGLANCER_DRACO
+    const int level =
+        std::min(10, std::max(0, options.draco_compression_level));
+    encode_fragment = [level](const QuantizedMesh& mesh, std::string* output) {
+      return EncodeDracoFragment(mesh, level, output);
+    };
+#else
+    *error = "Multi-resolution meshes require Draco, which is not available";
+    return false;
+#endif
+  }
+  const std::string prefix =
+      directory.empty() || directory.back() == '/' ? directory
+                                                   : directory + "/";
+  const auto voxel_size = generator.voxel_size();
+  const float lod_scale =
+      std::min({voxel_size[0], voxel_size[1], voxel_size[2]});
+
+  const int num_lods = generator.num_lods();
+  const auto compute_object = [&](uint64_t object_id,
+                                  std::string* fragment_data,
+                                  std::string* manifest,
+                                  std::string* object_error) {
+    std::vector<std::shared_ptr<const std::string>> lods;
+    for (int lod = 0; lod < num_lods; ++lod) {
+      lods.push_back(generator.GetSimplifiedMesh(object_id, lod));
+    }
+    MultiresolutionMesh mesh;
+    if (!EncodeMultiresolutionMesh(lods, lod_scale,
+                                   options.vertex_quantization_bits,
+                                   encode_fragment, &mesh, object_error)) {
+      return false;
+    }
+    // The fragment data precedes the manifest, which is the chunk indexed by
+    // the object id.
+    *fragment_data = std::move(mesh.fragment_data);
+    *manifest = std::move(mesh.manifest);
+    return true;
+  };
+  sharding::ShardedWriteOptions write_options;
+  write_options.num_threads = options.num_threads;
+  write_options.max_pending_bytes = options.max_pending_bytes;
+  if (!sharding::WriteShardedChunks(sharding, directory, generator.object_ids(),
+                                    compute_object, write_options, error)) {
+    return false;
+  }
+
+  const std::string info =
+      "{\"@type\":\"neuroglancer_multilod_draco\","
+      "\"vertex_quantization_bits\":" +
+      std::to_string(options.vertex_quantization_bits) +
+      ",\"transform\":[1,0,0,0,0,1,0,0,0,0,1,0],"
+      "\"lod_scale_multiplier\":" +
+      FormatFloat(options.lod_scale_multiplier) +
+      ",\"sharding\":" + sharding.ToJson() + "}";
+  std::ofstream file(prefix + "info", std::ios::binary | std::ios::trunc);
+  file.write(info.data(), info.size());
+  file.close();
+  if (!file) {
+    *error = "Failed to write " + prefix + "info";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace meshing
+}  // namespace neuroglancer
@@ -0,0 +1,125 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Writer of the sharded multi-resolution mesh format read by the Neuroglancer
+// client (src/neuroglancer/datasource/precomputed/meshes.md and sharded.md).
+
+#ifndef NEUROGLANCER_SHARDED_MESH_EXPORT_H_
+#define NEUROGLANCER_SHARDED_MESH_EXPORT_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "on_demand_object_mesh_generator.h"
+#include "sharding.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+// Mesh fragment with vertex positions quantized to
+// [0, 2^vertex_quantization_bits).
+struct QuantizedMesh {
+  // Vertex positions [x, y, z].
+  std::vector<uint32_t> positions;
+  // Triangle vertex indices.
+  std::vector<uint32_t> indices;
+};
+
+// Encodes a mesh fragment.  Returns false on failure.
+using FragmentEncoder =
+    std::function<bool(const QuantizedMesh& mesh, std::string* output)>;
+
+// Returns whether this module was built with the Draco encoder, which is the
+// case if NEUROGLANCER_DRACO is defined.
+bool HaveDracoEncoder();
+
+struct MultiresolutionMeshExportOptions {
+  sharding::ShardingSpec sharding;
+
+  // Number of bits of the quantized vertex positions of each fragment.  Must
+  // be 10 or 16.
+  int vertex_quantization_bits = 16;
+
+  // Written to the `info` file.  Level of detail `i` of each object has a
+  // scale of `2^i` times the smallest voxel dimension of the generator, which
+  // the client multiplies by this factor.
+  float lod_scale_multiplier = 1;
+
+  // Draco compression level, from 0 (fastest) to 10 (smallest).
+  int draco_compression_level = 7;
+
+  // If set, encodes the fragments instead of Draco, which is not readable by
+  // the client but allows this module to be used without Draco.
+  FragmentEncoder encode_fragment;
+
+  // Number of threads used to compute and encode the meshes, or 0 to use the
+  // number of hardware threads.
+  int num_threads = 0;
+
+  // Maximum total size of the objects that have been encoded but not yet
+  // written.  Objects are written in the order of the shard files, so an
+  // object that is slow to compute holds back the objects after it.
+  size_t max_pending_bytes = 256 << 20;
+};
+
+// Fragment data and manifest of one object in the multi-resolution format.
+struct MultiresolutionMesh {
+  std::string fragment_data;
+  std::string manifest;
+};
+
+// Builds the multi-resolution mesh of one object from its levels of detail,
+// encoded with MeshEncoding::kRaw from finest to coarsest.
+//
+// The octree of each object spans the bounding box of its vertices with cubic
+// nodes, such that the coarsest level has a single node.  Each level of
+// detail is clipped to its octree nodes, and levels above 0 also to the 2x2x2
+// subdivision of their nodes, as the format requires.  `lod_scale` is the
+// scale of level 0, which doubles with each level.
+//
+// Returns false, and sets `*error`, if a fragment cannot be encoded.  Leaves
+// `*result` empty if the object has no triangles.
+bool EncodeMultiresolutionMesh(
+    const std::vector<std::shared_ptr<const std::string>>& lods,
+    float lod_scale, int vertex_quantization_bits,
+    const FragmentEncoder& encode_fragment, MultiresolutionMesh* result,
+    std::string* error);
+
+// Writes the meshes of all objects of `generator`, which must use
+// MeshEncoding::kRaw, to the existing `directory` in the sharded
+// multi-resolution (`neuroglancer_multilod_draco`) format, with one level of
+// detail for each level of the generator.
+//
+// The objects are computed in parallel and written in a single pass over the
+// shard files, each consisting of the shard index, the fragment data and
+// manifest of each object, and the minishard indices.  Shards without any
+// objects are not written.  The `info` file is written last.
+//
+// Returns false, and sets `*error`, if the options are invalid, Draco is
+// required but not available, or a file cannot be written.
+bool ExportShardedMultiresolutionMeshes(
+    OnDemandObjectMeshGenerator& generator, const std::string& directory,
+    const MultiresolutionMeshExportOptions& options, std::string* error);
+
+}  // namespace meshing
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_SHARDED_MESH_EXPORT_H_
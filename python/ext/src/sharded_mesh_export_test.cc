@@ -0,0 +1,330 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sharded_mesh_export.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace meshing {
+namespace {
+
+// Encodes fragments as uint32le num_vertices, followed by the quantized
+// positions and the indices as uint32le.
+bool EncodeTestFragment(const QuantizedMesh& mesh, std::string* output) {
+  const uint32_t num_vertices = mesh.positions.size() / 3;
+  output->assign(reinterpret_cast<const char*>(&num_vertices), 4);
+  output->append(reinterpret_cast<const char*>(mesh.positions.data()),
+                 mesh.positions.size() * 4);
+  output->append(reinterpret_cast<const char*>(mesh.indices.data()),
+                 mesh.indices.size() * 4);
+  return true;
+}
+
+template <class T>
+T Load(const std::string& data, size_t offset) {
+  T value;
+  std::memcpy(&value, data.data() + offset, sizeof(T));
+  return value;
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+using Vector = std::array<double, 3>;
+
+double TriangleArea(const Vector& a, const Vector& b, const Vector& c) {
+  Vector u, v;
+  for (int i = 0; i < 3; ++i) {
+    u[i] = b[i] - a[i];
+    v[i] = c[i] - a[i];
+  }
+  const double x = u[1] * v[2] - u[2] * v[1];
+  const double y = u[2] * v[0] - u[0] * v[2];
+  const double z = u[0] * v[1] - u[1] * v[0];
+  return std::sqrt(x * x + y * y + z * z) / 2;
+}
+
+// Returns the area of a mesh encoded with MeshEncoding::kRaw.
+double RawMeshArea(const std::string& mesh) {
+  const uint32_t num_vertices = Load<uint32_t>(mesh, 0);
+  const size_t index_offset = 4 + num_vertices * 12;
+  double area = 0;
+  for (size_t offset = index_offset; offset < mesh.size(); offset += 12) {
+    Vector vertices[3];
+    for (int i = 0; i < 3; ++i) {
+      const uint32_t index = Load<uint32_t>(mesh, offset + i * 4);
+      for (int j = 0; j < 3; ++j) {
+        vertices[i][j] = Load<float>(mesh, 4 + index * 12 + j * 4);
+      }
+    }
+    area += TriangleArea(vertices[0], vertices[1], vertices[2]);
+  }
+  return area;
+}
+
+uint64_t Morton(uint32_t x, uint32_t y, uint32_t z) {
+  uint64_t code = 0;
+  for (int bit = 0; bit < 21; ++bit) {
+    code |= uint64_t((x >> bit) & 1) << (3 * bit);
+    code |= uint64_t((y >> bit) & 1) << (3 * bit + 1);
+    code |= uint64_t((z >> bit) & 1) << (3 * bit + 2);
+  }
+  return code;
+}
+
+// Decoded manifest of a multi-resolution mesh.
+struct Manifest {
+  float chunk_shape[3];
+  float grid_origin[3];
+  std::vector<float> lod_scales;
+  // Fragment positions and sizes of each level of detail.
+  std::vector<std::vector<std::array<uint32_t, 3>>> positions;
+  std::vector<std::vector<uint32_t>> sizes;
+};
+
+Manifest DecodeManifest(const std::string& data) {
+  Manifest manifest;
+  for (int i = 0; i < 3; ++i) {
+    manifest.chunk_shape[i] = Load<float>(data, i * 4);
+    manifest.grid_origin[i] = Load<float>(data, 12 + i * 4);
+  }
+  const uint32_t num_lods = Load<uint32_t>(data, 24);
+  size_t offset = 28;
+  for (uint32_t lod = 0; lod < num_lods; ++lod) {
+    manifest.lod_scales.push_back(Load<float>(data, offset + lod * 4));
+  }
+  offset += num_lods * 16;
+  std::vector<uint32_t> num_fragments;
+  for (uint32_t lod = 0; lod < num_lods; ++lod) {
+    num_fragments.push_back(Load<uint32_t>(data, offset));
+    offset += 4;
+  }
+  manifest.positions.resize(num_lods);
+  manifest.sizes.resize(num_lods);
+  for (uint32_t lod = 0; lod < num_lods; ++lod) {
+    const uint32_t n = num_fragments[lod];
+    manifest.positions[lod].resize(n);
+    for (int j = 0; j < 3; ++j) {
+      for (uint32_t i = 0; i < n; ++i) {
+        manifest.positions[lod][i][j] = Load<uint32_t>(data, offset);
+        offset += 4;
+      }
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+      manifest.sizes[lod].push_back(Load<uint32_t>(data, offset));
+      offset += 4;
+    }
+  }
+  EXPECT_EQ(data.size(), offset);
+  return manifest;
+}
+
+class ShardedMeshExportTest : public ::testing::Test {
+ protected:
+  ShardedMeshExportTest() : labels_(20 * 18 * 16) {
+    for (int64_t z = 0; z < 16; ++z) {
+      for (int64_t y = 0; y < 18; ++y) {
+        for (int64_t x = 0; x < 20; ++x) {
+          uint32_t label = 0;
+          if (x >= 2 && x < 17 && y >= 3 && y < 15 && z >= 2 && z < 13) {
+            label = 1;
+          }
+          if (x >= 5 && x < 9 && y >= 5 && y < 9 && z >= 5 && z < 9) {
+            label = 2;
+          }
+          labels_[x + 20 * (y + 18 * z)] = label;
+        }
+      }
+    }
+    const int64_t size[3] = {20, 18, 16};
+    const int64_t strides[3] = {1, 20, 20 * 18};
+    const float voxel_size[3] = {2, 1.5, 3};
+    const float offset[3] = {1, 2, 3};
+    SimplifyOptions simplify_options;
+    simplify_options.num_lods = 3;
+    generator_ = OnDemandObjectMeshGenerator(labels_.data(), size, strides,
+                                             voxel_size, offset,
+                                             simplify_options);
+  }
+
+  std::vector<std::shared_ptr<const std::string>> GetLods(uint64_t id) {
+    std::vector<std::shared_ptr<const std::string>> lods;
+    for (int lod = 0; lod < generator_.num_lods(); ++lod) {
+      lods.push_back(generator_.GetSimplifiedMesh(id, lod));
+    }
+    return lods;
+  }
+
+  std::vector<uint32_t> labels_;
+  OnDemandObjectMeshGenerator generator_;
+};
+
+TEST_F(ShardedMeshExportTest, EncodeMultiresolutionMesh) {
+  const auto lods = GetLods(1);
+  MultiresolutionMesh result;
+  std::string error;
+  ASSERT_TRUE(EncodeMultiresolutionMesh(lods, 1.5, 16, EncodeTestFragment,
+                                        &result, &error))
+      << error;
+  const Manifest manifest = DecodeManifest(result.manifest);
+  ASSERT_EQ(3u, manifest.lod_scales.size());
+  EXPECT_EQ(1.5f, manifest.lod_scales[0]);
+  EXPECT_EQ(6.0f, manifest.lod_scales[2]);
+  ASSERT_EQ(1u, manifest.positions[2].size());
+  EXPECT_EQ((std::array<uint32_t, 3>{{0, 0, 0}}), manifest.positions[2][0]);
+
+  size_t offset = 0;
+  double lod0_area = 0;
+  for (int lod = 0; lod < 3; ++lod) {
+    const auto& positions = manifest.positions[lod];
+    for (size_t i = 0; i < positions.size(); ++i) {
+      const auto& position = positions[i];
+      if (i > 0) {
+        const auto& prior = positions[i - 1];
+        EXPECT_LT(Morton(prior[0], prior[1], prior[2]),
+                  Morton(position[0], position[1], position[2]));
+      }
+      // Each node has a parent in the next level.
+      if (lod < 2) {
+        bool found = false;
+        for (const auto& parent : manifest.positions[lod + 1]) {
+          found = found || (parent[0] == position[0] / 2 &&
+                            parent[1] == position[1] / 2 &&
+                            parent[2] == position[2] / 2);
+        }
+        EXPECT_TRUE(found);
+      }
+      const std::string fragment =
+          result.fragment_data.substr(offset, manifest.sizes[lod][i]);
+      offset += fragment.size();
+      if (fragment.empty()) continue;
+      const uint32_t num_vertices = Load<uint32_t>(fragment, 0);
+      for (size_t j = 4 + num_vertices * 12; j < fragment.size(); j += 12) {
+        Vector vertices[3];
+        // Octants that may contain the triangle, as partitioned by the client.
+        unsigned int mask = 0xff;
+        for (int k = 0; k < 3; ++k) {
+          const uint32_t index = Load<uint32_t>(fragment, j + k * 4);
+          ASSERT_LT(index, num_vertices);
+          for (int d = 0; d < 3; ++d) {
+            const uint32_t q = Load<uint32_t>(fragment, 4 + index * 12 + d * 4);
+            ASSERT_LT(q, 65536u);
+            if (q < 32768) mask &= d == 0 ? 0x55 : d == 1 ? 0x33 : 0x0f;
+            if (q > 32768) mask &= d == 0 ? 0xaa : d == 1 ? 0xcc : 0xf0;
+            vertices[k][d] =
+                manifest.grid_origin[d] +
+                manifest.chunk_shape[d] * (position[d] + q / 65535.0);
+          }
+        }
+        if (lod > 0) {
+          EXPECT_NE(0u, mask);
+        } else {
+          lod0_area += TriangleArea(vertices[0], vertices[1], vertices[2]);
+        }
+      }
+    }
+  }
+  EXPECT_EQ(result.fragment_data.size(), offset);
+  EXPECT_GT(manifest.positions[0].size(), 1u);
+  // Clipping preserves the surface, up to quantization.
+  const double area = RawMeshArea(*lods[0]);
+  EXPECT_NEAR(area, lod0_area, area * 1e-3);
+}
+
+TEST_F(ShardedMeshExportTest, Export) {
+  const std::string directory = ::testing::TempDir();
+  MultiresolutionMeshExportOptions options;
+  options.sharding.hash = sharding::ShardingSpec::Hash::kIdentity;
+  options.sharding.minishard_bits = 1;
+  options.sharding.shard_bits = 1;
+  options.encode_fragment = EncodeTestFragment;
+  options.max_pending_bytes = 1;
+  std::string error;
+  ASSERT_TRUE(ExportShardedMultiresolutionMeshes(generator_, directory,
+                                                 options, &error))
+      << error;
+  EXPECT_EQ(
+      "{\"@type\":\"neuroglancer_multilod_draco\","
+      "\"vertex_quantization_bits\":16,"
+      "\"transform\":[1,0,0,0,0,1,0,0,0,0,1,0],\"lod_scale_multiplier\":1,"
+      "\"sharding\":" +
+          options.sharding.ToJson() + "}",
+      ReadFile(directory + "/info"));
+
+  // With the identity hash, object 1 is in shard 0, minishard 1, and object 2
+  // in shard 1, minishard 0.
+  for (const uint64_t id : {1, 2}) {
+    const std::string shard =
+        ReadFile(directory + "/" + std::to_string(id - 1) + ".shard");
+    const uint64_t minishard = id & 1;
+    const uint64_t index_end = 32;
+    ASSERT_GE(shard.size(), index_end);
+    for (uint64_t i = 0; i < 2; ++i) {
+      const uint64_t start = Load<uint64_t>(shard, i * 16);
+      const uint64_t end = Load<uint64_t>(shard, i * 16 + 8);
+      EXPECT_EQ(i == minishard ? 24u : 0u, end - start);
+    }
+    const uint64_t minishard_start =
+        index_end + Load<uint64_t>(shard, minishard * 16);
+    EXPECT_EQ(id, Load<uint64_t>(shard, minishard_start));
+    const uint64_t manifest_start =
+        index_end + Load<uint64_t>(shard, minishard_start + 8);
+    const uint64_t manifest_size = Load<uint64_t>(shard, minishard_start + 16);
+
+    MultiresolutionMesh expected;
+    ASSERT_TRUE(EncodeMultiresolutionMesh(GetLods(id), 1.5, 16,
+                                          EncodeTestFragment, &expected,
+                                          &error));
+    EXPECT_EQ(expected.manifest, shard.substr(manifest_start, manifest_size));
+    // The fragment data immediately precedes the manifest.
+    EXPECT_EQ(index_end + expected.fragment_data.size(), manifest_start);
+    EXPECT_EQ(expected.fragment_data,
+              shard.substr(index_end, expected.fragment_data.size()));
+  }
+}
+
+TEST_F(ShardedMeshExportTest, Errors) {
+  MultiresolutionMeshExportOptions options;
+  std::string error;
+  if (!HaveDracoEncoder()) {
+    EXPECT_FALSE(ExportShardedMultiresolutionMeshes(
+        generator_, ::testing::TempDir(), options, &error));
+    EXPECT_NE(std::string::npos, error.find("Draco"));
+  }
+  options.encode_fragment = EncodeTestFragment;
+  options.vertex_quantization_bits = 12;
+  EXPECT_FALSE(ExportShardedMultiresolutionMeshes(
+      generator_, ::testing::TempDir(), options, &error));
+  options.vertex_quantization_bits = 10;
+  EXPECT_FALSE(ExportShardedMultiresolutionMeshes(
+      generator_, "/nonexistent/directory", options, &error));
+  EXPECT_NE(std::string::npos, error.find("/nonexistent/directory/"));
+}
+
+}  // namespace
+}  // namespace meshing
+}  // namespace neuroglancer
@@ -0,0 +1,139 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sharded_segmentation_export.h"
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "compress_segmentation.h"
+
+namespace neuroglancer {
+namespace compress_segmentation {
+
+namespace {
+
+// Returns the number of bits of the coordinates of a grid dimension of
+// `size` cells.
+int GetCoordinateBits(uint64_t size) {
+  int bits = 0;
+  while (bits < 64 && (uint64_t(1) << bits) < size) ++bits;
+  return bits;
+}
+
+}  // namespace
+
+uint64_t GetCompressedMortonCode(const uint64_t position[3],
+                                 const uint64_t grid_size[3]) {
+  uint64_t code = 0;
+  int j = 0;
+  for (int i = 0; i < 64; ++i) {
+    for (int dim = 0; dim < 3 && j < 64; ++dim) {
+      if ((uint64_t(1) << i) < grid_size[dim]) {
+        code |= ((position[dim] >> i) & 1) << j;
+        ++j;
+      }
+    }
+  }
+  return code;
+}
+
+template <class Label>
+bool ExportShardedSegmentation(const Label* input,
+                               const ptrdiff_t input_strides[3],
+                               const ptrdiff_t volume_size[3],
+                               const std::string& directory,
+                               const ShardedSegmentationExportOptions& options,
+                               std::string* error) {
+  uint64_t grid_size[3];
+  int total_bits = 0;
+  for (int i = 0; i < 3; ++i) {
+    if (volume_size[i] < 0 || options.chunk_size[i] <= 0 ||
+        options.block_size[i] <= 0) {
+      *error = "chunk_size and block_size must consist of positive integers";
+      return false;
+    }
+    grid_size[i] = (volume_size[i] + options.chunk_size[i] - 1) /
+                   options.chunk_size[i];
+    total_bits += GetCoordinateBits(grid_size[i]);
+  }
+  if (total_bits > 64) {
+    *error = "Too many chunks for 64-bit chunk identifiers";
+    return false;
+  }
+
+  // Grid position of each chunk id.
+  std::unordered_map<uint64_t, std::array<uint64_t, 3>> positions;
+  std::vector<uint64_t> chunk_ids;
+  uint64_t position[3];
+  for (position[2] = 0; position[2] < grid_size[2]; ++position[2]) {
+    for (position[1] = 0; position[1] < grid_size[1]; ++position[1]) {
+      for (position[0] = 0; position[0] < grid_size[0]; ++position[0]) {
+        const uint64_t chunk_id = GetCompressedMortonCode(position, grid_size);
+        positions[chunk_id] = {{position[0], position[1], position[2]}};
+        chunk_ids.push_back(chunk_id);
+      }
+    }
+  }
+
+  const auto encode_chunk = [&](uint64_t chunk_id, std::string* prefix,
+                                std::string* data, std::string* chunk_error) {
+    const auto& chunk_position = positions.at(chunk_id);
+    const Label* chunk_input = input;
+    ptrdiff_t chunk_size[4], strides[4];
+    for (int i = 0; i < 3; ++i) {
+      const ptrdiff_t start = chunk_position[i] * options.chunk_size[i];
+      chunk_size[i] = std::min(options.chunk_size[i], volume_size[i] - start);
+      strides[i] = input_strides[i];
+      chunk_input += start * input_strides[i];
+    }
+    chunk_size[3] = 1;
+    strides[3] = 0;
+    std::vector<uint32_t> encoded;
+    CompressChannels(chunk_input, strides, chunk_size, options.block_size,
+                     &encoded);
+    data->assign(reinterpret_cast<const char*>(encoded.data()),
+                 encoded.size() * sizeof(uint32_t));
+    return true;
+  };
+  sharding::ShardedWriteOptions write_options;
+  write_options.num_threads = options.num_threads;
+  write_options.max_pending_bytes = options.max_pending_bytes;
+  return sharding::WriteShardedChunks(options.sharding, directory,
+                                      std::move(chunk_ids), encode_chunk,
+                                      write_options, error);
+}
+
+#define DO_INSTANTIATE(Label)                                       \
+  template bool ExportShardedSegmentation<Label>(                   \
+      const Label* input, const ptrdiff_t input_strides[3],         \
+      const ptrdiff_t volume_size[3], const std::string& directory, \
+      const ShardedSegmentationExportOptions& options,              \
+      std::string* error);                                          \
+/**/
+
+DO_INSTANTIATE(uint8_t)
+DO_INSTANTIATE(uint16_t)
+DO_INSTANTIATE(uint32_t)
+DO_INSTANTIATE(uint64_t)
+
+#undef DO_INSTANTIATE
+
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
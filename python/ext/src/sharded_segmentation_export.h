@@ -0,0 +1,88 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Writer of sharded precomputed segmentation volumes with the
+// compressed_segmentation encoding, as read by the Neuroglancer client
+// (src/neuroglancer/datasource/precomputed/volume.md and sharded.md).
+
+#ifndef NEUROGLANCER_SHARDED_SEGMENTATION_EXPORT_H_
+#define NEUROGLANCER_SHARDED_SEGMENTATION_EXPORT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "sharding.h"
+
+namespace neuroglancer {
+namespace compress_segmentation {
+
+// Returns the "compressed Morton code" of the chunk at `position` in a grid
+// of `grid_size` chunks, in the order x, y, z, which identifies the chunk in
+// the sharded format.
+uint64_t GetCompressedMortonCode(const uint64_t position[3],
+                                 const uint64_t grid_size[3]);
+
+struct ShardedSegmentationExportOptions {
+  sharding::ShardingSpec sharding;
+
+  // Extent of the x, y, and z dimensions of each chunk.  Chunks at the upper
+  // bounds of the volume are clipped to it, as the client expects.
+  ptrdiff_t chunk_size[3] = {64, 64, 64};
+
+  // Extent of the x, y, and z dimensions of the compressed_segmentation
+  // blocks.
+  ptrdiff_t block_size[3] = {8, 8, 8};
+
+  // Number of threads used to encode the chunks, or 0 to use the number of
+  // hardware threads.  Each chunk is encoded by a single thread.
+  int num_threads = 0;
+
+  // Maximum total size of the encoded chunks that have not yet been written.
+  size_t max_pending_bytes = 256 << 20;
+};
+
+// Writes the chunks of a single-channel segmentation volume to the existing
+// `directory` in the sharded format, encoded with CompressChannels (and then
+// gzip compressed if specified by `options.sharding`).  The `info` file,
+// which describes the scales of the volume, is left to the caller.
+//
+// The chunks are encoded in parallel and written in a single pass over the
+// shard files, as for sharding::WriteShardedChunks.
+//
+// Args:
+//
+//   input: Pointer to the first element.
+//
+//   input_strides: Stride in Label units between consecutive elements in the
+//       x, y, and z dimensions.
+//
+//   volume_size: Extent of the x, y, and z dimensions.
+//
+// Returns false, and sets `*error`, if the options are invalid, the chunk ids
+// do not fit in 64 bits, or a file cannot be written.
+template <class Label>
+bool ExportShardedSegmentation(const Label* input,
+                               const ptrdiff_t input_strides[3],
+                               const ptrdiff_t volume_size[3],
+                               const std::string& directory,
+                               const ShardedSegmentationExportOptions& options,
+                               std::string* error);
+
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_SHARDED_SEGMENTATION_EXPORT_H_
@@ -0,0 +1,159 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sharded_segmentation_export.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "decompress_segmentation.h"
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace compress_segmentation {
+namespace {
+
+uint64_t LoadUint64(const std::string& data, size_t offset) {
+  uint64_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+// Adds the chunks of a shard file with raw encodings to `chunks`.
+void ReadShard(const std::string& shard, int minishard_bits,
+               std::map<uint64_t, std::string>* chunks) {
+  const uint64_t index_end = uint64_t(16) << minishard_bits;
+  ASSERT_GE(shard.size(), index_end);
+  for (uint64_t minishard = 0; minishard < (1u << minishard_bits);
+       ++minishard) {
+    const uint64_t start = index_end + LoadUint64(shard, minishard * 16);
+    const uint64_t end = index_end + LoadUint64(shard, minishard * 16 + 8);
+    const uint64_t n = (end - start) / 24;
+    uint64_t id = 0, offset = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+      id += LoadUint64(shard, start + i * 8);
+      offset += LoadUint64(shard, start + (n + i) * 8);
+      const uint64_t size = LoadUint64(shard, start + (2 * n + i) * 8);
+      (*chunks)[id] = shard.substr(index_end + offset, size);
+      offset += size;
+    }
+  }
+}
+
+TEST(GetCompressedMortonCodeTest, Basic) {
+  const uint64_t grid_size[3] = {3, 2, 2};
+  // Bits 0-2 are bit 0 of x, y and z, and bit 3 is bit 1 of x.
+  const uint64_t a[3] = {2, 1, 1};
+  EXPECT_EQ(14u, GetCompressedMortonCode(a, grid_size));
+  const uint64_t b[3] = {1, 0, 1};
+  EXPECT_EQ(5u, GetCompressedMortonCode(b, grid_size));
+  const uint64_t single[3] = {1, 1, 1};
+  const uint64_t zero[3] = {0, 0, 0};
+  EXPECT_EQ(0u, GetCompressedMortonCode(zero, single));
+}
+
+TEST(ExportShardedSegmentationTest, RoundTrip) {
+  const ptrdiff_t volume_size[3] = {10, 7, 5};
+  const ptrdiff_t strides[3] = {1, 10, 70};
+  std::vector<uint64_t> labels(10 * 7 * 5);
+  std::mt19937 generator(1);
+  for (auto& label : labels) label = generator() % 4 + (uint64_t(1) << 40);
+
+  const std::string directory = ::testing::TempDir();
+  ShardedSegmentationExportOptions options;
+  options.sharding.hash = sharding::ShardingSpec::Hash::kIdentity;
+  options.sharding.minishard_bits = 1;
+  options.sharding.shard_bits = 1;
+  for (int i = 0; i < 3; ++i) {
+    options.chunk_size[i] = 4;
+    options.block_size[i] = 2;
+  }
+  options.num_threads = 3;
+  options.max_pending_bytes = 1;
+  std::string error;
+  ASSERT_TRUE(ExportShardedSegmentation(labels.data(), strides, volume_size,
+                                        directory, options, &error))
+      << error;
+
+  std::map<uint64_t, std::string> chunks;
+  ReadShard(ReadFile(directory + "/0.shard"), 1, &chunks);
+  ReadShard(ReadFile(directory + "/1.shard"), 1, &chunks);
+  // The grid of 3x2x2 chunks has compressed Morton codes [0, 16).
+  ASSERT_EQ(12u, chunks.size());
+
+  std::vector<uint64_t> decoded(labels.size());
+  const uint64_t grid_size[3] = {3, 2, 2};
+  uint64_t position[3];
+  for (position[2] = 0; position[2] < 2; ++position[2]) {
+    for (position[1] = 0; position[1] < 2; ++position[1]) {
+      for (position[0] = 0; position[0] < 3; ++position[0]) {
+        const uint64_t id = GetCompressedMortonCode(position, grid_size);
+        ASSERT_EQ(1u, chunks.count(id));
+        const std::string& chunk = chunks[id];
+        ASSERT_EQ(0u, chunk.size() % 4);
+        std::vector<uint32_t> words(chunk.size() / 4);
+        std::memcpy(words.data(), chunk.data(), chunk.size());
+        ptrdiff_t chunk_size[4] = {0, 0, 0, 1};
+        ptrdiff_t start[3] = {0, 0, 0};
+        uint64_t* output = decoded.data();
+        for (int i = 0; i < 3; ++i) {
+          const ptrdiff_t offset = position[i] * 4;
+          chunk_size[i] = std::min<ptrdiff_t>(4, volume_size[i] - offset);
+          output += offset * strides[i];
+        }
+        const ptrdiff_t output_strides[4] = {1, 10, 70, 0};
+        ASSERT_TRUE(DecompressChannels(words.data(), words.size(), chunk_size,
+                                       options.block_size, start, chunk_size,
+                                       output_strides, output));
+      }
+    }
+  }
+  EXPECT_EQ(labels, decoded);
+}
+
+TEST(ExportShardedSegmentationTest, Errors) {
+  const uint32_t labels[1] = {1};
+  const ptrdiff_t strides[3] = {1, 1, 1};
+  const ptrdiff_t volume_size[3] = {1, 1, 1};
+  ShardedSegmentationExportOptions options;
+  options.chunk_size[1] = 0;
+  std::string error;
+  EXPECT_FALSE(ExportShardedSegmentation(labels, strides, volume_size,
+                                         ::testing::TempDir(), options,
+                                         &error));
+  options.chunk_size[1] = 1;
+  options.sharding.shard_bits = 70;
+  EXPECT_FALSE(ExportShardedSegmentation(labels, strides, volume_size,
+                                         ::testing::TempDir(), options,
+                                         &error));
+  EXPECT_EQ("Invalid sharding specification", error);
+}
+
+}  // namespace
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
@@ -0,0 +1,405 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sharding.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+#ifdef NEUROGLANCER_ZLIB
+#include <zlib.h>
+#endif
+
+#include "parallel_for.h"
+
+namespace neuroglancer {
+namespace sharding {
+
+namespace {
+
+uint32_t RotateLeft(uint32_t x, int r) { return (x << r) | (x >> (32 - r)); }
+
+uint32_t MurmurHash3Mix(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+void AppendUint64(uint64_t value, std::string* output) {
+  for (int i = 0; i < 8; ++i) {
+    output->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+const char* GetEncodingName(ShardingSpec::Encoding encoding) {
+  return encoding == ShardingSpec::Encoding::kGzip ? "gzip" : "raw";
+}
+
+// Writes a single shard file: the shard index, followed by the chunks, each
+// preceded by its prefix, followed by the minishard indices.  Chunks must be
+// written in order of minishard, and of id within each minishard.
+class ShardFileWriter {
+ public:
+  ShardFileWriter(const ShardingSpec& sharding, const std::string& path)
+      : sharding_(sharding),
+        path_(path),
+        file_(path, std::ios::binary | std::ios::trunc),
+        minishards_(size_t(1) << sharding.minishard_bits) {
+    // Placeholder for the shard index, which is written by Close.
+    const std::string index(minishards_.size() * 16, '\0');
+    file_.write(index.data(), index.size());
+  }
+
+  bool Write(uint64_t minishard, uint64_t chunk_id, const std::string& prefix,
+             const std::string& data, std::string* error) {
+    file_.write(prefix.data(), prefix.size());
+    offset_ += prefix.size();
+    file_.write(data.data(), data.size());
+    minishards_[minishard].push_back(
+        ChunkEntry{chunk_id, offset_, data.size()});
+    offset_ += data.size();
+    return Check(error);
+  }
+
+  bool Close(std::string* error) {
+    std::string shard_index;
+    std::string minishard_index, encoded;
+    for (const auto& entries : minishards_) {
+      minishard_index.clear();
+      uint64_t previous_id = 0, previous_end = 0;
+      for (const auto& entry : entries) {
+        AppendUint64(entry.id - previous_id, &minishard_index);
+        previous_id = entry.id;
+      }
+      for (const auto& entry : entries) {
+        AppendUint64(entry.offset - previous_end, &minishard_index);
+        previous_end = entry.offset + entry.size;
+      }
+      for (const auto& entry : entries) {
+        AppendUint64(entry.size, &minishard_index);
+      }
+      const std::string* index = &minishard_index;
+      if (!entries.empty() && sharding_.minishard_index_encoding ==
+                                  ShardingSpec::Encoding::kGzip) {
+        if (!GzipCompress(minishard_index, &encoded)) {
+          *error = "Failed to compress minishard index of " + path_;
+          return false;
+        }
+        index = &encoded;
+      }
+      AppendUint64(offset_, &shard_index);
+      AppendUint64(offset_ + index->size(), &shard_index);
+      file_.write(index->data(), index->size());
+      offset_ += index->size();
+    }
+    file_.seekp(0);
+    file_.write(shard_index.data(), shard_index.size());
+    file_.close();
+    return Check(error);
+  }
+
+ private:
+  struct ChunkEntry {
+    uint64_t id;
+    // Offset relative to the end of the shard index.
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  bool Check(std::string* error) {
+    if (!file_) {
+      *error = "Failed to write " + path_;
+      return false;
+    }
+    return true;
+  }
+
+  const ShardingSpec& sharding_;
+  std::string path_;
+  std::ofstream file_;
+  // Offset of the end of the file relative to the end of the shard index.
+  uint64_t offset_ = 0;
+  std::vector<std::vector<ChunkEntry>> minishards_;
+};
+
+}  // namespace
+
+uint64_t MurmurHash3_x86_128Hash64Bits(uint64_t input) {
+  const uint32_t c1 = 0x239b961b;
+  const uint32_t c2 = 0xab0e9789;
+  const uint32_t c3 = 0x38b34ae5;
+  uint32_t h1 = 0, h2 = 0, h3 = 0, h4 = 0;
+
+  uint32_t k2 = static_cast<uint32_t>(input >> 32) * c2;
+  k2 = RotateLeft(k2, 16);
+  k2 *= c3;
+  h2 ^= k2;
+
+  uint32_t k1 = static_cast<uint32_t>(input) * c1;
+  k1 = RotateLeft(k1, 15);
+  k1 *= c2;
+  h1 ^= k1;
+
+  const uint32_t length = 8;
+  h1 ^= length;
+  h2 ^= length;
+  h3 ^= length;
+  h4 ^= length;
+
+  h1 += h2;
+  h1 += h3;
+  h1 += h4;
+  h2 += h1;
+  h3 += h1;
+  h4 += h1;
+
+  h1 = MurmurHash3Mix(h1);
+  h2 = MurmurHash3Mix(h2);
+  h3 = MurmurHash3Mix(h3);
+  h4 = MurmurHash3Mix(h4);
+
+  h1 += h2;
+  h1 += h3;
+  h1 += h4;
+  h2 += h1;
+  return uint64_t(h1) | (uint64_t(h2) << 32);
+}
+
+bool HaveGzip() {
+#ifdef NEUROGLANCER_ZLIB
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool GzipCompress(const std::string& input, std::string* output) {
+  return GzipCompress(input.data(), input.size(), output);
+}
+
+bool GzipCompress(const char* input, size_t input_size, std::string* output) {
+#ifdef NEUROGLANCER_ZLIB
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  // A window of 15 bits, plus 16 to write a gzip rather than zlib header.
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  output->resize(deflateBound(&stream, input_size));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input));
+  stream.avail_in = static_cast<uInt>(input_size);
+  stream.next_out = reinterpret_cast<Bytef*>(&(*output)[0]);
+  stream.avail_out = static_cast<uInt>(output->size());
+  const bool ok = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+  output->resize(stream.total_out);
+  deflateEnd(&stream);
+  return ok;
+#else
+  return false;
+#endif
+}
+
+bool ShardingSpec::Validate(std::string* error) const {
+  if (preshift_bits < 0 || preshift_bits > 64 || minishard_bits < 0 ||
+      minishard_bits > 32 || shard_bits < 0 ||
+      minishard_bits + shard_bits > 64) {
+    *error = "Invalid sharding specification";
+    return false;
+  }
+  if ((minishard_index_encoding == Encoding::kGzip ||
+       data_encoding == Encoding::kGzip) &&
+      !HaveGzip()) {
+    *error = "gzip encoding requires zlib, which is not available";
+    return false;
+  }
+  return true;
+}
+
+uint64_t ShardingSpec::GetShard(uint64_t chunk_id, uint64_t* minishard) const {
+  uint64_t hashed = preshift_bits >= 64 ? 0 : chunk_id >> preshift_bits;
+  if (hash == Hash::kMurmurHash3_x86_128) {
+    hashed = MurmurHash3_x86_128Hash64Bits(hashed);
+  }
+  const auto low_bits = [](uint64_t value, int bits) {
+    return bits >= 64 ? value : value & ((uint64_t(1) << bits) - 1);
+  };
+  *minishard = low_bits(hashed, minishard_bits);
+  return minishard_bits >= 64 ? 0
+                              : low_bits(hashed >> minishard_bits, shard_bits);
+}
+
+std::string ShardingSpec::GetShardFileName(uint64_t shard) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%0*llx.shard", (shard_bits + 3) / 4,
+                static_cast<unsigned long long>(shard));
+  return name;
+}
+
+std::string ShardingSpec::ToJson() const {
+  return std::string("{\"@type\":\"neuroglancer_uint64_sharded_v1\","
+                     "\"hash\":\"") +
+         (hash == Hash::kIdentity ? "identity" : "murmurhash3_x86_128") +
+         "\",\"preshift_bits\":" + std::to_string(preshift_bits) +
+         ",\"minishard_bits\":" + std::to_string(minishard_bits) +
+         ",\"shard_bits\":" + std::to_string(shard_bits) +
+         ",\"minishard_index_encoding\":\"" +
+         GetEncodingName(minishard_index_encoding) +
+         "\",\"data_encoding\":\"" + GetEncodingName(data_encoding) + "\"}";
+}
+
+bool WriteShardedChunks(const ShardingSpec& sharding,
+                        const std::string& directory,
+                        std::vector<uint64_t> chunk_ids,
+                        const ShardedChunkFunction& compute_chunk,
+                        const ShardedWriteOptions& options,
+                        std::string* error) {
+  if (!sharding.Validate(error)) return false;
+  const std::string prefix =
+      directory.empty() || directory.back() == '/' ? directory
+                                                   : directory + "/";
+
+  // Chunks in the order in which they are written.
+  struct Item {
+    uint64_t shard;
+    uint64_t minishard;
+    uint64_t chunk_id;
+  };
+  std::vector<Item> items;
+  items.reserve(chunk_ids.size());
+  for (const uint64_t chunk_id : chunk_ids) {
+    Item item;
+    item.chunk_id = chunk_id;
+    item.shard = sharding.GetShard(chunk_id, &item.minishard);
+    items.push_back(item);
+  }
+  chunk_ids.clear();
+  std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+    return std::tie(a.shard, a.minishard, a.chunk_id) <
+           std::tie(b.shard, b.minishard, b.chunk_id);
+  });
+
+  // Computed chunk that has not yet been written.
+  struct PendingChunk {
+    std::string prefix;
+    std::string data;
+  };
+
+  // Accessed only by the thread that is writing, as indicated by `writing`.
+  std::unique_ptr<ShardFileWriter> shard_writer;
+  uint64_t current_shard = 0;
+  std::string write_error;
+  const auto write_item = [&](const Item& item, const PendingChunk& chunk) {
+    if (chunk.data.empty()) return true;
+    if (shard_writer && current_shard != item.shard) {
+      const bool ok = shard_writer->Close(&write_error);
+      shard_writer.reset();
+      if (!ok) return false;
+    }
+    if (!shard_writer) {
+      current_shard = item.shard;
+      shard_writer.reset(new ShardFileWriter(
+          sharding, prefix + sharding.GetShardFileName(item.shard)));
+    }
+    return shard_writer->Write(item.minishard, item.chunk_id, chunk.prefix,
+                               chunk.data, &write_error);
+  };
+
+  // Guards the members below.
+  std::mutex mutex;
+  // Notified when chunks have been written.
+  std::condition_variable written;
+  std::vector<std::unique_ptr<PendingChunk>> pending(items.size());
+  size_t pending_bytes = 0;
+  size_t next_to_write = 0;
+  bool writing = false;
+  bool failed = false;
+  std::string first_error;
+  const auto fail = [&](std::string message) {
+    if (!failed) {
+      failed = true;
+      first_error = std::move(message);
+    }
+  };
+  ParallelFor(items.size(), options.num_threads, [&](size_t i) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      written.wait(lock, [&] {
+        return failed || i == next_to_write ||
+               pending_bytes <= options.max_pending_bytes;
+      });
+      if (failed) return;
+    }
+    std::unique_ptr<PendingChunk> chunk(new PendingChunk);
+    std::string chunk_error;
+    bool ok = compute_chunk(items[i].chunk_id, &chunk->prefix, &chunk->data,
+                            &chunk_error);
+    if (ok && !chunk->data.empty() &&
+        sharding.data_encoding == ShardingSpec::Encoding::kGzip) {
+      std::string encoded;
+      ok = GzipCompress(chunk->data, &encoded);
+      if (!ok) chunk_error = "Failed to compress chunk data";
+      chunk->data = std::move(encoded);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!ok) {
+      fail(std::move(chunk_error));
+      written.notify_all();
+      return;
+    }
+    pending_bytes += chunk->prefix.size() + chunk->data.size();
+    pending[i] = std::move(chunk);
+    // Chunks are written in order by whichever thread finds the next one
+    // ready, while the other threads continue computing.
+    if (writing) return;
+    writing = true;
+    while (!failed && next_to_write < items.size() && pending[next_to_write]) {
+      const size_t index = next_to_write;
+      std::unique_ptr<PendingChunk> ready = std::move(pending[index]);
+      lock.unlock();
+      const bool written_ok = write_item(items[index], *ready);
+      lock.lock();
+      pending_bytes -= ready->prefix.size() + ready->data.size();
+      ++next_to_write;
+      if (!written_ok) fail(write_error);
+      written.notify_all();
+    }
+    writing = false;
+  });
+  if (shard_writer) {
+    if (!shard_writer->Close(&write_error)) fail(write_error);
+  }
+  if (failed) {
+    *error = std::move(first_error);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace sharding
+}  // namespace neuroglancer
@@ -0,0 +1,118 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Writer of the `neuroglancer_uint64_sharded_v1` format read by the
+// Neuroglancer client (src/neuroglancer/datasource/precomputed/sharded.md).
+
+#ifndef NEUROGLANCER_SHARDING_H_
+#define NEUROGLANCER_SHARDING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace neuroglancer {
+namespace sharding {
+
+// Returns the low 8 bytes of MurmurHash3_x86_128, with a seed of 0, of the
+// little-endian encoding of `input`, as a little-endian number.
+uint64_t MurmurHash3_x86_128Hash64Bits(uint64_t input);
+
+// Returns whether gzip encoding is supported, which is the case if this module
+// was built with zlib (NEUROGLANCER_ZLIB).
+bool HaveGzip();
+
+// Compresses `input` in the gzip format.  Returns false if gzip is not
+// supported or compression fails.
+bool GzipCompress(const std::string& input, std::string* output);
+bool GzipCompress(const char* input, size_t input_size, std::string* output);
+
+struct ShardingSpec {
+  enum class Hash {
+    kIdentity,
+    kMurmurHash3_x86_128,
+  };
+
+  enum class Encoding {
+    kRaw,
+    kGzip,
+  };
+
+  Hash hash = Hash::kMurmurHash3_x86_128;
+  int preshift_bits = 0;
+  int minishard_bits = 0;
+  int shard_bits = 0;
+  Encoding minishard_index_encoding = Encoding::kRaw;
+  Encoding data_encoding = Encoding::kRaw;
+
+  // Returns false, and sets `*error`, if the numbers of bits are out of range
+  // or gzip encoding is specified but not supported.
+  bool Validate(std::string* error) const;
+
+  // Returns the shard of `chunk_id`, and sets `*minishard` to its minishard.
+  uint64_t GetShard(uint64_t chunk_id, uint64_t* minishard) const;
+
+  // Returns the name of the file of `shard`.
+  std::string GetShardFileName(uint64_t shard) const;
+
+  // Returns the JSON sharding specification.
+  std::string ToJson() const;
+};
+
+// Computes the data of the chunk `chunk_id`.  `prefix`, if not empty, is
+// written immediately before the data in the shard file without being part of
+// the chunk, as for the fragment data that precedes a multi-resolution mesh
+// manifest.  The chunk is omitted if `data` is left empty.  Returns false, and
+// sets `*error`, on failure.
+using ShardedChunkFunction =
+    std::function<bool(uint64_t chunk_id, std::string* prefix,
+                       std::string* data, std::string* error)>;
+
+struct ShardedWriteOptions {
+  // Number of threads used to compute the chunks, or 0 to use the number of
+  // hardware threads.
+  int num_threads = 0;
+
+  // Maximum total size of the chunks that have been computed but not yet
+  // written.  Chunks are written in the order of the shard files, so a chunk
+  // that is slow to compute holds back the chunks after it.
+  size_t max_pending_bytes = 256 << 20;
+};
+
+// Computes the chunks `chunk_ids`, which must be distinct, in parallel with
+// `compute_chunk`, and writes them to the shard files in the existing
+// `directory` in a single pass.  The data of each chunk is gzip compressed by
+// the computing thread if specified by `sharding`.  Each shard file is written
+// sequentially as the chunks become ready, in the order of minishard and
+// chunk id, with a placeholder for the shard index at the start that is filled
+// in once its minishard indices have been appended.  Shards without any
+// chunks are not written.
+//
+// Returns false, and sets `*error`, if `sharding` is invalid, a chunk cannot
+// be computed, or a file cannot be written.  No further chunks are computed
+// after the first error.
+bool WriteShardedChunks(const ShardingSpec& sharding,
+                        const std::string& directory,
+                        std::vector<uint64_t> chunk_ids,
+                        const ShardedChunkFunction& compute_chunk,
+                        const ShardedWriteOptions& options, std::string* error);
+
+}  // namespace sharding
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_SHARDING_H_
@@ -0,0 +1,218 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sharding.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#ifdef NEUROGLANCER_ZLIB
+#include <zlib.h>
+#endif
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace sharding {
+namespace {
+
+uint64_t LoadUint64(const std::string& data, size_t offset) {
+  uint64_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+// Decodes a shard file as the client does, returning the chunks by id.
+std::map<uint64_t, std::string> ReadShard(const std::string& shard,
+                                          int minishard_bits) {
+  std::map<uint64_t, std::string> chunks;
+  const uint64_t index_end = uint64_t(16) << minishard_bits;
+  for (uint64_t minishard = 0; minishard < (1u << minishard_bits);
+       ++minishard) {
+    const uint64_t start = index_end + LoadUint64(shard, minishard * 16);
+    const uint64_t end = index_end + LoadUint64(shard, minishard * 16 + 8);
+    EXPECT_EQ(0u, (end - start) % 24);
+    const uint64_t n = (end - start) / 24;
+    uint64_t id = 0, offset = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+      id += LoadUint64(shard, start + i * 8);
+      offset += LoadUint64(shard, start + (n + i) * 8);
+      const uint64_t size = LoadUint64(shard, start + (2 * n + i) * 8);
+      chunks[id] = shard.substr(index_end + offset, size);
+      offset += size;
+    }
+  }
+  return chunks;
+}
+
+TEST(MurmurHash3Test, MatchesClient) {
+  EXPECT_EQ(0x4772b084e028ae41u, MurmurHash3_x86_128Hash64Bits(0));
+  EXPECT_EQ(0xe8bd67d616d4ce9au, MurmurHash3_x86_128Hash64Bits(1));
+  EXPECT_EQ(0x708036264c109d93u,
+            MurmurHash3_x86_128Hash64Bits(0x0123456789abcdefu));
+}
+
+TEST(ShardingSpecTest, Basic) {
+  ShardingSpec sharding;
+  sharding.hash = ShardingSpec::Hash::kIdentity;
+  sharding.preshift_bits = 1;
+  sharding.minishard_bits = 2;
+  sharding.shard_bits = 5;
+  uint64_t minishard;
+  EXPECT_EQ(0x15u, sharding.GetShard(0x1ab, &minishard));
+  EXPECT_EQ(1u, minishard);
+  EXPECT_EQ("15.shard", sharding.GetShardFileName(0x15));
+  sharding.data_encoding = ShardingSpec::Encoding::kGzip;
+  EXPECT_EQ(
+      "{\"@type\":\"neuroglancer_uint64_sharded_v1\",\"hash\":\"identity\","
+      "\"preshift_bits\":1,\"minishard_bits\":2,\"shard_bits\":5,"
+      "\"minishard_index_encoding\":\"raw\",\"data_encoding\":\"gzip\"}",
+      sharding.ToJson());
+  EXPECT_EQ("0.shard", ShardingSpec().GetShardFileName(0));
+}
+
+TEST(ShardingSpecTest, Validate) {
+  std::string error;
+  EXPECT_TRUE(ShardingSpec().Validate(&error));
+  ShardingSpec sharding;
+  sharding.minishard_bits = 40;
+  EXPECT_FALSE(sharding.Validate(&error));
+  sharding.minishard_bits = 0;
+  sharding.data_encoding = ShardingSpec::Encoding::kGzip;
+  EXPECT_EQ(HaveGzip(), sharding.Validate(&error));
+}
+
+TEST(WriteShardedChunksTest, Basic) {
+  const std::string directory = ::testing::TempDir();
+  std::remove((directory + "/1.shard").c_str());
+  ShardingSpec sharding;
+  sharding.hash = ShardingSpec::Hash::kIdentity;
+  sharding.minishard_bits = 1;
+  sharding.shard_bits = 1;
+  // Chunk 6 is empty and omitted; shard 1 has no chunks and is not written.
+  std::vector<uint64_t> chunk_ids = {5, 8, 4, 1, 6, 0};
+  ShardedWriteOptions options;
+  options.num_threads = 3;
+  options.max_pending_bytes = 1;
+  std::string error;
+  ASSERT_TRUE(WriteShardedChunks(
+      sharding, directory, chunk_ids,
+      [](uint64_t id, std::string* prefix, std::string* data,
+         std::string* error) {
+        if (id == 6) return true;
+        *prefix = std::string(id, 'p');
+        *data = "chunk" + std::to_string(id);
+        return true;
+      },
+      options, &error))
+      << error;
+  const std::string shard = ReadFile(directory + "/0.shard");
+  const auto chunks = ReadShard(shard, 1);
+  ASSERT_EQ(5u, chunks.size());
+  for (const auto& chunk : chunks) {
+    EXPECT_EQ("chunk" + std::to_string(chunk.first), chunk.second);
+  }
+  // Each chunk is preceded by its prefix, in order of minishard and id.
+  EXPECT_EQ("chunk0", shard.substr(32, 6));
+  EXPECT_EQ("ppppchunk4", shard.substr(38, 10));
+  EXPECT_FALSE(std::ifstream(directory + "/1.shard").good());
+}
+
+TEST(WriteShardedChunksTest, Error) {
+  ShardingSpec sharding;
+  std::string error;
+  EXPECT_FALSE(WriteShardedChunks(
+      sharding, ::testing::TempDir(), {1, 2, 3},
+      [](uint64_t id, std::string* prefix, std::string* data,
+         std::string* error) {
+        *data = "x";
+        if (id != 2) return true;
+        *error = "failed";
+        return false;
+      },
+      ShardedWriteOptions(), &error));
+  EXPECT_EQ("failed", error);
+
+  EXPECT_FALSE(WriteShardedChunks(
+      sharding, "/nonexistent/directory", {1},
+      [](uint64_t id, std::string* prefix, std::string* data,
+         std::string* error) {
+        *data = "x";
+        return true;
+      },
+      ShardedWriteOptions(), &error));
+  EXPECT_NE(std::string::npos, error.find("Failed to write"));
+}
+
+#ifdef NEUROGLANCER_ZLIB
+std::string GunzipOrDie(const std::string& input) {
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  EXPECT_EQ(Z_OK, inflateInit2(&stream, 15 + 16));
+  std::string output(1 << 16, '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream.avail_in = input.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+  stream.avail_out = output.size();
+  EXPECT_EQ(Z_STREAM_END, inflate(&stream, Z_FINISH));
+  output.resize(stream.total_out);
+  inflateEnd(&stream);
+  return output;
+}
+
+TEST(WriteShardedChunksTest, Gzip) {
+  const std::string directory = ::testing::TempDir();
+  ShardingSpec sharding;
+  sharding.minishard_index_encoding = ShardingSpec::Encoding::kGzip;
+  sharding.data_encoding = ShardingSpec::Encoding::kGzip;
+  const std::string data(1000, 'a');
+  std::string error;
+  ASSERT_TRUE(WriteShardedChunks(
+      sharding, directory, {7},
+      [&](uint64_t id, std::string* prefix, std::string* chunk,
+          std::string* error) {
+        *chunk = data;
+        return true;
+      },
+      ShardedWriteOptions(), &error))
+      << error;
+  const std::string shard = ReadFile(directory + "/0.shard");
+  const uint64_t start = 16 + LoadUint64(shard, 0);
+  const uint64_t end = 16 + LoadUint64(shard, 8);
+  const std::string index = GunzipOrDie(shard.substr(start, end - start));
+  ASSERT_EQ(24u, index.size());
+  EXPECT_EQ(7u, LoadUint64(index, 0));
+  const std::string chunk =
+      shard.substr(16 + LoadUint64(index, 8), LoadUint64(index, 16));
+  EXPECT_LT(chunk.size(), data.size());
+  EXPECT_EQ(data, GunzipOrDie(chunk));
+}
+#endif  // NEUROGLANCER_ZLIB
+
+}  // namespace
+}  // namespace sharding
+}  // namespace neuroglancer
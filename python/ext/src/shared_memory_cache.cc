@@ -0,0 +1,262 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared_memory_cache.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace neuroglancer {
+
+namespace {
+
+constexpr uint64_t kMagic = 0x6e67736863616368ull;  // "ngshcach"
+// Version of the layout, which must match that of an existing file.
+constexpr uint64_t kVersion = 1;
+// Number of consecutive index slots in which a key may be stored.
+constexpr uint64_t kBucketSize = 4;
+// Expected mean size of a value, which determines the number of index slots.
+constexpr uint64_t kExpectedValueSize = 2048;
+constexpr size_t kMinBytes = 64 * 1024;
+// Each value is preceded by its key, size and checksum.
+constexpr uint64_t kRecordHeaderSize = 24;
+
+inline uint64_t MixHash(uint64_t hash, uint64_t value) {
+  hash = (hash ^ value) * 0x9e3779b97f4a7c15ull;
+  return hash ^ (hash >> 32);
+}
+
+uint64_t Checksum(uint64_t key, const char* data, size_t size) {
+  uint64_t hash = MixHash(key, static_cast<uint64_t>(size));
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    hash = MixHash(hash, word);
+  }
+  uint64_t last = 0;
+  std::memcpy(&last, data + i, size - i);
+  return MixHash(hash, last);
+}
+
+}  // namespace
+
+struct SharedMemoryCache::Header {
+  uint64_t magic;
+  uint64_t version;
+  uint64_t num_slots;
+  uint64_t data_size;
+  // Total number of bytes of the ring buffer ever reserved by writers; the
+  // record at position p (stored at offset p % data_size) is intact while
+  // head <= p + data_size.
+  std::atomic<uint64_t> head;
+  uint64_t padding[3];
+};
+
+struct SharedMemoryCache::Slot {
+  std::atomic<uint64_t> key;
+  // Position of the record plus 1, or 0 if empty.
+  std::atomic<uint64_t> position;
+};
+
+SharedMemoryCache::~SharedMemoryCache() {
+#ifndef _WIN32
+  if (mapping_) munmap(mapping_, mapping_size_);
+#endif
+}
+
+bool SharedMemoryCache::Open(const std::string& path, size_t max_bytes,
+                             std::string* error) {
+#ifdef _WIN32
+  *error = "shared memory caches are not supported on Windows";
+  return false;
+#else
+  if (mapping_) {
+    *error = "already open";
+    return false;
+  }
+  std::atomic<uint64_t> test_atomic(0);
+  if (!test_atomic.is_lock_free()) {
+    *error = "64-bit atomics are not lock-free on this platform";
+    return false;
+  }
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    *error = path + ": " + std::strerror(errno);
+    return false;
+  }
+  // Serializes the initialization of a new file among processes.
+  flock(fd, LOCK_EX);
+  bool initialize = false;
+  struct stat file_stat;
+  size_t size = 0;
+  if (fstat(fd, &file_stat) != 0) {
+    *error = path + ": " + std::strerror(errno);
+  } else if (file_stat.st_size != 0) {
+    size = static_cast<size_t>(file_stat.st_size);
+  } else if (max_bytes < kMinBytes) {
+    *error = "max_bytes must be at least " + std::to_string(kMinBytes);
+  } else if (ftruncate(fd, static_cast<off_t>(max_bytes)) != 0) {
+    *error = path + ": " + std::strerror(errno);
+  } else {
+    size = max_bytes;
+    initialize = true;
+  }
+  void* mapping = MAP_FAILED;
+  if (size >= sizeof(Header)) {
+    mapping =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+      *error = path + ": " + std::strerror(errno);
+    }
+  } else if (size != 0) {
+    *error = path + " is not a shared memory cache";
+  }
+  bool valid = false;
+  if (mapping != MAP_FAILED) {
+    Header* header = static_cast<Header*>(mapping);
+    if (initialize) {
+      // The new file is zero-filled, so the head and index are already
+      // initialized.
+      const uint64_t usable = size - sizeof(Header);
+      uint64_t num_slots = kBucketSize;
+      while (num_slots * 2 * (sizeof(Slot) + kExpectedValueSize) <= usable) {
+        num_slots *= 2;
+      }
+      header->num_slots = num_slots;
+      header->data_size = (usable - num_slots * sizeof(Slot)) & ~uint64_t(7);
+      header->version = kVersion;
+      header->magic = kMagic;
+    }
+    const uint64_t num_slots = header->num_slots;
+    if (header->magic != kMagic || header->version != kVersion ||
+        num_slots < kBucketSize || (num_slots & (num_slots - 1)) != 0 ||
+        num_slots > size / sizeof(Slot) ||
+        header->data_size + num_slots * sizeof(Slot) + sizeof(Header) >
+            size ||
+        header->data_size < kRecordHeaderSize * 4) {
+      *error = path + " is not a shared memory cache of a compatible version";
+      munmap(mapping, size);
+    } else {
+      valid = true;
+      mapping_ = static_cast<char*>(mapping);
+      mapping_size_ = size;
+      header_ = header;
+      num_slots_ = num_slots;
+      slots_ = reinterpret_cast<Slot*>(mapping_ + sizeof(Header));
+      data_ = mapping_ + sizeof(Header) + num_slots * sizeof(Slot);
+      data_size_ = header->data_size;
+    }
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  return valid;
+#endif
+}
+
+bool SharedMemoryCache::Find(uint64_t key, std::string* value) const {
+  if (!mapping_) return false;
+  for (uint64_t i = 0; i < kBucketSize; ++i) {
+    const Slot& slot = slots_[(key + i) & (num_slots_ - 1)];
+    if (slot.key.load(std::memory_order_acquire) != key) continue;
+    const uint64_t stored_position =
+        slot.position.load(std::memory_order_acquire);
+    if (stored_position == 0) continue;
+    const uint64_t position = stored_position - 1;
+    auto is_intact = [&] {
+      return header_->head.load(std::memory_order_acquire) <=
+             position + data_size_;
+    };
+    if (!is_intact()) continue;
+    const uint64_t offset = position % data_size_;
+    const char* record = data_ + offset;
+    uint64_t record_header[3];
+    std::memcpy(record_header, record, kRecordHeaderSize);
+    if (record_header[0] != key ||
+        record_header[1] > data_size_ - offset - kRecordHeaderSize) {
+      continue;
+    }
+    value->assign(record + kRecordHeaderSize, record_header[1]);
+    // Orders the copy before checking that the record was not overwritten
+    // meanwhile.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!is_intact() ||
+        Checksum(key, value->data(), value->size()) != record_header[2]) {
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+void SharedMemoryCache::Insert(uint64_t key, const std::string& value) {
+  if (!mapping_) return;
+  const uint64_t size = value.size();
+  const uint64_t record_size = kRecordHeaderSize + ((size + 7) & ~uint64_t(7));
+  if (record_size > data_size_ / 4) return;
+  // Reserves the record, skipping the end of the ring buffer if it does not
+  // fit there, so that records are contiguous.
+  auto& head = header_->head;
+  uint64_t reserved = head.load(std::memory_order_relaxed);
+  uint64_t position;
+  do {
+    position = reserved;
+    const uint64_t offset = position % data_size_;
+    if (offset + record_size > data_size_) position += data_size_ - offset;
+  } while (!head.compare_exchange_weak(reserved, position + record_size,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_relaxed));
+  char* record = data_ + position % data_size_;
+  const uint64_t record_header[3] = {key, size,
+                                     Checksum(key, value.data(), size)};
+  std::memcpy(record, record_header, kRecordHeaderSize);
+  std::memcpy(record + kRecordHeaderSize, value.data(), size);
+  // If the ring wrapped around meanwhile, the record may be partly overwritten.
+  if (head.load(std::memory_order_acquire) > position + data_size_) return;
+  // Replaces the slot of the key if present, and otherwise the slot of the
+  // oldest record in the bucket.
+  Slot* target = nullptr;
+  uint64_t oldest_position = ~uint64_t(0);
+  for (uint64_t i = 0; i < kBucketSize; ++i) {
+    Slot& slot = slots_[(key + i) & (num_slots_ - 1)];
+    if (slot.key.load(std::memory_order_relaxed) == key) {
+      target = &slot;
+      break;
+    }
+    const uint64_t slot_position =
+        slot.position.load(std::memory_order_relaxed);
+    if (slot_position < oldest_position) {
+      oldest_position = slot_position;
+      target = &slot;
+    }
+  }
+  // A reader that sees the new key also sees the new position, and a reader
+  // that sees the new position with the previous key finds a record with a
+  // different key, which is a miss.
+  target->position.store(position + 1, std::memory_order_release);
+  target->key.store(key, std::memory_order_release);
+}
+
+}  // namespace neuroglancer
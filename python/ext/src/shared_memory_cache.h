@@ -0,0 +1,78 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEUROGLANCER_SHARED_MEMORY_CACHE_H_
+#define NEUROGLANCER_SHARED_MEMORY_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace neuroglancer {
+
+// Cache of byte strings keyed by 64-bit hashes, stored in a memory-mapped
+// file, e.g. in /dev/shm, that any number of processes may map at once, so
+// that a value computed by one process is available to all of them.
+//
+// Lookups and insertions are lock-free.  Values are appended to a ring buffer,
+// so that the oldest are overwritten once it is full, and an open-addressed
+// index maps each key to its most recent value.  A reader validates a value
+// after copying it, against the position up to which the ring has been
+// reserved and a checksum, so a value overwritten concurrently, or by a writer
+// in a process that stopped midway, is a miss rather than corrupt data.
+//
+// Not supported on Windows, where Open always fails.
+class SharedMemoryCache {
+ public:
+  SharedMemoryCache() = default;
+  ~SharedMemoryCache();
+
+  SharedMemoryCache(const SharedMemoryCache&) = delete;
+  SharedMemoryCache& operator=(const SharedMemoryCache&) = delete;
+
+  // Maps the file at `path`, first creating it with a total size of
+  // `max_bytes` if it does not exist or is empty.  An existing file keeps its
+  // size.  Returns false with `error` set if the file cannot be created or
+  // mapped, or has an incompatible layout.
+  bool Open(const std::string& path, size_t max_bytes, std::string* error);
+
+  // Sets `value` to the value with the specified key and returns true, or
+  // returns false if it is not stored.
+  bool Find(uint64_t key, std::string* value) const;
+
+  // Stores `value` with the specified key, unless it is larger than a quarter
+  // of the ring buffer.
+  void Insert(uint64_t key, const std::string& value);
+
+  // Returns the size of the ring buffer, or 0 if not open.
+  size_t capacity() const { return data_size_; }
+
+ private:
+  struct Header;
+  struct Slot;
+
+  char* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  Header* header_ = nullptr;
+  Slot* slots_ = nullptr;
+  char* data_ = nullptr;
+  uint64_t num_slots_ = 0;
+  uint64_t data_size_ = 0;
+};
+
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_SHARED_MEMORY_CACHE_H_
@@ -0,0 +1,127 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared_memory_cache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace {
+
+#ifndef _WIN32
+
+// Returns the path of a new empty temporary file, which Open initializes.
+std::string MakeTemporaryPath() {
+  char path[] = "/tmp/shared_memory_cache_testXXXXXX";
+  const int fd = mkstemp(path);
+  EXPECT_GE(fd, 0);
+  close(fd);
+  return path;
+}
+
+TEST(SharedMemoryCacheTest, SharedBetweenMappings) {
+  const std::string path = MakeTemporaryPath();
+  std::string error;
+  // Separate mappings of the same file behave like separate processes.
+  SharedMemoryCache a, b;
+  ASSERT_TRUE(a.Open(path, 1 << 20, &error)) << error;
+  ASSERT_TRUE(b.Open(path, 1 << 16, &error)) << error;
+  EXPECT_EQ(a.capacity(), b.capacity());
+  EXPECT_GT(a.capacity(), 900000u);
+  std::string value;
+  EXPECT_FALSE(b.Find(1, &value));
+  a.Insert(1, "hello");
+  a.Insert(0, "");
+  ASSERT_TRUE(b.Find(1, &value));
+  EXPECT_EQ("hello", value);
+  ASSERT_TRUE(b.Find(0, &value));
+  EXPECT_EQ("", value);
+  b.Insert(1, "replaced");
+  ASSERT_TRUE(a.Find(1, &value));
+  EXPECT_EQ("replaced", value);
+  std::remove(path.c_str());
+}
+
+TEST(SharedMemoryCacheTest, OverwritesOldestValues) {
+  const std::string path = MakeTemporaryPath();
+  std::string error;
+  SharedMemoryCache cache;
+  ASSERT_TRUE(cache.Open(path, 1 << 16, &error)) << error;
+  const std::string large(cache.capacity() / 5, 'x');
+  for (uint64_t key = 10; key < 20; ++key) {
+    cache.Insert(key, large + std::to_string(key));
+  }
+  std::string value;
+  EXPECT_FALSE(cache.Find(10, &value));
+  ASSERT_TRUE(cache.Find(19, &value));
+  EXPECT_EQ(large + "19", value);
+  // Values larger than a quarter of the capacity are not stored.
+  cache.Insert(20, std::string(cache.capacity() / 3, 'y'));
+  EXPECT_FALSE(cache.Find(20, &value));
+  std::remove(path.c_str());
+}
+
+TEST(SharedMemoryCacheTest, ConcurrentWriters) {
+  const std::string path = MakeTemporaryPath();
+  std::string error;
+  SharedMemoryCache cache;
+  ASSERT_TRUE(cache.Open(path, 1 << 16, &error)) << error;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, t] {
+      std::string value;
+      for (uint64_t i = 0; i < 2000; ++i) {
+        const uint64_t key = i % 50;
+        if (cache.Find(key, &value)) {
+          // Values are never corrupt, even when overwritten concurrently.
+          EXPECT_EQ(std::string(100 + key, 'a' + key % 26), value);
+        }
+        cache.Insert(key, std::string(100 + key, 'a' + key % 26));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  std::remove(path.c_str());
+}
+
+TEST(SharedMemoryCacheTest, RejectsInvalidFiles) {
+  const std::string path = MakeTemporaryPath();
+  std::string error;
+  SharedMemoryCache cache;
+  EXPECT_FALSE(cache.Open(path, 1024, &error));
+  EXPECT_FALSE(error.empty());
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  std::fputs(std::string(100000, 'z').c_str(), file);
+  std::fclose(file);
+  EXPECT_FALSE(cache.Open(path, 1 << 20, &error));
+  EXPECT_EQ(0u, cache.capacity());
+  std::remove(path.c_str());
+}
+
+#endif  // _WIN32
+
+}  // namespace
+}  // namespace neuroglancer
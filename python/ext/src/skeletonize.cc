@@ -0,0 +1,425 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "skeletonize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+
+namespace neuroglancer {
+namespace meshing {
+
+namespace {
+
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+
+// States of the voxels of the padded bounding box.
+enum VoxelState : uint8_t {
+  kBackground,
+  // Part of the object, in a component not yet skeletonized.
+  kUnvisited,
+  // Part of the component being skeletonized, and not yet within the
+  // invalidation distance of its skeleton.
+  kTarget,
+  // Part of a component that has been skeletonized, or within the
+  // invalidation distance of the skeleton of the current component.
+  kInvalidated,
+};
+
+// Replaces the `n` values of `f` spaced `stride` apart, some of which may be
+// infinite, by the squared distance transform `min_q f[q] + weight * (p -
+// q)^2`, computed from the lower envelope of the parabolas rooted at the finite
+// values (Felzenszwalb and Huttenlocher).  `values`, `vertices` and
+// `boundaries` are scratch space.
+void DistanceTransform1d(float* f, int64_t n, int64_t stride, double weight,
+                         std::vector<double>* values,
+                         std::vector<int64_t>* vertices,
+                         std::vector<double>* boundaries) {
+  values->resize(n);
+  vertices->resize(n);
+  boundaries->resize(n);
+  for (int64_t q = 0; q < n; ++q) {
+    (*values)[q] = f[q * stride];
+  }
+  // Parabolas of the lower envelope, each of which is lowest from
+  // `(*boundaries)[i]` on.
+  int64_t k = -1;
+  for (int64_t q = 0; q < n; ++q) {
+    if ((*values)[q] == kInfinity) continue;
+    double s = -kInfinity;
+    while (k >= 0) {
+      const int64_t p = (*vertices)[k];
+      s = (((*values)[q] + weight * q * q) - ((*values)[p] + weight * p * p)) /
+          (2 * weight * (q - p));
+      if (s > (*boundaries)[k]) break;
+      --k;
+    }
+    if (k < 0) s = -kInfinity;
+    ++k;
+    (*vertices)[k] = q;
+    (*boundaries)[k] = s;
+  }
+  if (k < 0) return;
+  for (int64_t p = 0, j = 0; p < n; ++p) {
+    while (j < k && (*boundaries)[j + 1] < p) ++j;
+    const int64_t q = (*vertices)[j];
+    f[p * stride] =
+        static_cast<float>((*values)[q] + weight * (p - q) * (p - q));
+  }
+}
+
+// Runs Dijkstra's algorithm from `source` over the 26-connected voxels whose
+// state is `state`, with a step to voxel `v` of length `length` costing `length
+// * weight(v)`.  The `distances` of those voxels must be infinite, and are set
+// to the cost of the shortest path from `source`.  If `parents` is not null,
+// the previous voxel of each shortest path is stored in it.  The voxels
+// reached are appended to `order` in order of increasing distance.
+template <class Weight>
+void Dijkstra(const std::vector<uint8_t>& states, uint8_t state,
+              uint32_t source, const int64_t neighbor_offsets[26],
+              const float neighbor_lengths[26], const Weight& weight,
+              std::vector<float>* distances, std::vector<uint32_t>* parents,
+              std::vector<uint32_t>* order) {
+  using Entry = std::pair<float, uint32_t>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+  (*distances)[source] = 0;
+  if (parents) (*parents)[source] = source;
+  queue.emplace(0.0f, source);
+  while (!queue.empty()) {
+    const Entry entry = queue.top();
+    queue.pop();
+    const uint32_t v = entry.second;
+    if (entry.first > (*distances)[v]) continue;
+    order->push_back(v);
+    for (int i = 0; i < 26; ++i) {
+      const uint32_t u = static_cast<uint32_t>(v + neighbor_offsets[i]);
+      if (states[u] != state) continue;
+      const float distance = entry.first + neighbor_lengths[i] * weight(u);
+      if (distance < (*distances)[u]) {
+        (*distances)[u] = distance;
+        if (parents) (*parents)[u] = v;
+        queue.emplace(distance, u);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+template <class Label>
+bool SkeletonizeObject(const Label* labels, const Vector3d& size,
+                       const Vector3d& strides, uint64_t object_id,
+                       const BoundingBox& bounding_box,
+                       const SkeletonizeOptions& options, Skeleton* output,
+                       const LabelEquivalences* equivalences) {
+  output->vertex_positions.clear();
+  output->edges.clear();
+  output->radii.clear();
+  // The box is padded by a background voxel on each side, so that every voxel
+  // of the object has 26 neighbors in the box and a finite distance to the
+  // boundary.
+  Vector3d start, dims;
+  for (int i = 0; i < 3; ++i) {
+    start[i] = std::max(int64_t(0), bounding_box.start[i]);
+    const int64_t end = std::min(size[i], bounding_box.end[i]);
+    if (object_id == 0 || end <= start[i]) return true;
+    dims[i] = end - start[i] + 2;
+  }
+  const int64_t num_voxels = dims[0] * dims[1] * dims[2];
+  if (num_voxels >= (int64_t(1) << 32)) return false;
+
+  std::vector<uint8_t> states(num_voxels, kBackground);
+  for (int64_t z = 1; z + 1 < dims[2]; ++z) {
+    for (int64_t y = 1; y + 1 < dims[1]; ++y) {
+      const Label* row = labels + (start[0] - 1) * strides[0] +
+                         (start[1] + y - 1) * strides[1] +
+                         (start[2] + z - 1) * strides[2];
+      uint8_t* state = &states[dims[0] * (y + dims[1] * z)];
+      for (int64_t x = 1; x + 1 < dims[0]; ++x) {
+        const uint64_t label = row[x * strides[0]];
+        if (label != 0 &&
+            (equivalences ? equivalences->Find(label) : label) == object_id) {
+          state[x] = kUnvisited;
+        }
+      }
+    }
+  }
+
+  // Distance from each voxel to the nearest background voxel.
+  std::vector<float> boundary_distances(num_voxels);
+  for (int64_t i = 0; i < num_voxels; ++i) {
+    boundary_distances[i] = states[i] == kBackground ? 0 : kInfinity;
+  }
+  {
+    std::vector<double> values, boundaries;
+    std::vector<int64_t> vertices;
+    int64_t axis_strides[3] = {1, dims[0], dims[0] * dims[1]};
+    for (int axis = 0; axis < 3; ++axis) {
+      const int64_t a = (axis + 1) % 3, b = (axis + 2) % 3;
+      const double weight =
+          double(options.voxel_size[axis]) * options.voxel_size[axis];
+      for (int64_t j = 0; j < dims[b]; ++j) {
+        for (int64_t i = 0; i < dims[a]; ++i) {
+          DistanceTransform1d(
+              &boundary_distances[i * axis_strides[a] + j * axis_strides[b]],
+              dims[axis], axis_strides[axis], weight, &values, &vertices,
+              &boundaries);
+        }
+      }
+    }
+    for (auto& d : boundary_distances) d = std::sqrt(d);
+  }
+
+  int64_t neighbor_offsets[26];
+  float neighbor_lengths[26];
+  {
+    int i = 0;
+    for (int64_t dz = -1; dz <= 1; ++dz) {
+      for (int64_t dy = -1; dy <= 1; ++dy) {
+        for (int64_t dx = -1; dx <= 1; ++dx) {
+          if (dx == 0 && dy == 0 && dz == 0) continue;
+          neighbor_offsets[i] = dx + dims[0] * (dy + dims[1] * dz);
+          neighbor_lengths[i] = std::sqrt(
+              dx * dx * options.voxel_size[0] * options.voxel_size[0] +
+              dy * dy * options.voxel_size[1] * options.voxel_size[1] +
+              dz * dz * options.voxel_size[2] * options.voxel_size[2]);
+          ++i;
+        }
+      }
+    }
+  }
+
+  std::vector<float> distances(num_voxels, kInfinity);
+  std::vector<float> weights(num_voxels);
+  std::vector<uint32_t> parents(num_voxels);
+  std::vector<uint32_t> order;
+  std::unordered_map<uint32_t, uint32_t> vertex_indices;
+  std::vector<uint32_t> path;
+  const auto unit_weight = [](uint32_t) { return 1.0f; };
+  const auto get_position = [&](uint32_t v, int64_t position[3]) {
+    position[0] = v % dims[0];
+    position[1] = (v / dims[0]) % dims[1];
+    position[2] = v / (dims[0] * dims[1]);
+  };
+  const auto add_vertex = [&](uint32_t v) {
+    const uint32_t index = static_cast<uint32_t>(output->num_vertices());
+    int64_t position[3];
+    get_position(v, position);
+    for (int i = 0; i < 3; ++i) {
+      output->vertex_positions.push_back(
+          static_cast<float>(position[i] - 1 + start[i]));
+    }
+    output->radii.push_back(boundary_distances[v]);
+    vertex_indices.emplace(v, index);
+    return index;
+  };
+  // Invalidates the target voxels within the invalidation distance of `v`.
+  const auto invalidate = [&](uint32_t v) {
+    const double radius = options.invalidation_scale * boundary_distances[v] +
+                          options.invalidation_constant;
+    int64_t center[3], lower[3], upper[3];
+    get_position(v, center);
+    for (int i = 0; i < 3; ++i) {
+      const int64_t extent =
+          static_cast<int64_t>(radius / options.voxel_size[i]);
+      lower[i] = std::max(int64_t(0), center[i] - extent);
+      upper[i] = std::min(dims[i] - 1, center[i] + extent);
+    }
+    const double radius_squared = radius * radius;
+    for (int64_t z = lower[2]; z <= upper[2]; ++z) {
+      const double dz = (z - center[2]) * options.voxel_size[2];
+      for (int64_t y = lower[1]; y <= upper[1]; ++y) {
+        const double dy = (y - center[1]) * options.voxel_size[1];
+        const double dzy = dz * dz + dy * dy;
+        if (dzy > radius_squared) continue;
+        uint8_t* row = &states[dims[0] * (y + dims[1] * z)];
+        for (int64_t x = lower[0]; x <= upper[0]; ++x) {
+          const double dx = (x - center[0]) * options.voxel_size[0];
+          if (row[x] == kTarget && dzy + dx * dx <= radius_squared) {
+            row[x] = kInvalidated;
+          }
+        }
+      }
+    }
+  };
+
+  for (int64_t seed = 0; seed < num_voxels; ++seed) {
+    if (states[seed] != kUnvisited) continue;
+    // The root is the voxel of the component farthest from the seed.
+    order.clear();
+    Dijkstra(states, kUnvisited, static_cast<uint32_t>(seed), neighbor_offsets,
+             neighbor_lengths, unit_weight, &distances, nullptr, &order);
+    const uint32_t root = order.back();
+    float max_boundary_distance = 0;
+    for (uint32_t v : order) {
+      states[v] = kTarget;
+      distances[v] = kInfinity;
+      max_boundary_distance =
+          std::max(max_boundary_distance, boundary_distances[v]);
+    }
+    // Targets are considered in order of decreasing distance from the root.
+    order.clear();
+    Dijkstra(states, kTarget, root, neighbor_offsets, neighbor_lengths,
+             unit_weight, &distances, nullptr, &order);
+    for (uint32_t v : order) {
+      distances[v] = kInfinity;
+      weights[v] =
+          1 + options.penalty_scale *
+                  std::pow(1 - boundary_distances[v] / max_boundary_distance,
+                           options.penalty_exponent);
+    }
+    std::vector<uint32_t> targets;
+    targets.swap(order);
+    Dijkstra(states, kTarget, root, neighbor_offsets, neighbor_lengths,
+             [&](uint32_t v) { return weights[v]; }, &distances, &parents,
+             &order);
+
+    vertex_indices.clear();
+    add_vertex(root);
+    invalidate(root);
+    for (size_t i = targets.size(); i-- > 0;) {
+      const uint32_t target = targets[i];
+      if (states[target] != kTarget) continue;
+      // Adds the path from the target to the nearest voxel already in the
+      // skeleton.
+      path.clear();
+      uint32_t v = target;
+      uint32_t previous_index = add_vertex(v);
+      path.push_back(v);
+      while (true) {
+        v = parents[v];
+        auto it = vertex_indices.find(v);
+        const bool joined = it != vertex_indices.end();
+        const uint32_t index = joined ? it->second : add_vertex(v);
+        output->edges.push_back(previous_index);
+        output->edges.push_back(index);
+        if (joined) break;
+        previous_index = index;
+        path.push_back(v);
+      }
+      for (uint32_t u : path) invalidate(u);
+    }
+    for (uint32_t v : targets) states[v] = kInvalidated;
+  }
+  return true;
+}
+
+struct OnDemandSkeletonGenerator::Impl {
+  // Computes the skeleton of an object from its bounding box.
+  std::function<bool(uint64_t object_id, const BoundingBox& bounding_box,
+                     Skeleton* skeleton)>
+      skeletonize_object;
+
+  DenseLabelMap object_ids;
+  std::vector<BoundingBox> bounding_boxes;
+
+  // Cached skeleton of each object, in the order of `object_ids`.
+  struct Entry {
+    std::mutex mutex;
+    bool done = false;
+    std::shared_ptr<const Skeleton> skeleton;
+  };
+  std::unique_ptr<Entry[]> entries;
+};
+
+template <class Label>
+OnDemandSkeletonGenerator::OnDemandSkeletonGenerator(
+    const Label* labels, const int64_t* size, const int64_t* strides,
+    const SkeletonizeOptions& options,
+    std::shared_ptr<const LabelEquivalences> equivalences)
+    : impl_(new Impl) {
+  const Vector3d size_vec{{size[0], size[1], size[2]}};
+  const Vector3d strides_vec{{strides[0], strides[1], strides[2]}};
+  if (equivalences && equivalences->empty()) equivalences.reset();
+  DenseLabelMap label_ids(ComputeDistinctLabels(labels, size_vec, strides_vec));
+  std::vector<BoundingBox> label_boxes;
+  ComputeBoundingBoxes(labels, size_vec, strides_vec, label_ids, &label_boxes);
+  if (!equivalences) {
+    impl_->object_ids = std::move(label_ids);
+    impl_->bounding_boxes = std::move(label_boxes);
+  } else {
+    // The bounding box of an object is the union of those of its labels.
+    impl_->object_ids =
+        DenseLabelMap(ComputeObjectIds(label_ids.ids(), *equivalences));
+    impl_->bounding_boxes.assign(impl_->object_ids.size(),
+                                 BoundingBox{size_vec, {{0, 0, 0}}});
+    for (size_t i = 0; i < label_ids.size(); ++i) {
+      const int64_t index =
+          impl_->object_ids.Find(equivalences->Find(label_ids.ids()[i]));
+      if (index == -1) continue;
+      auto& box = impl_->bounding_boxes[index];
+      for (int j = 0; j < 3; ++j) {
+        box.start[j] = std::min(box.start[j], label_boxes[i].start[j]);
+        box.end[j] = std::max(box.end[j], label_boxes[i].end[j]);
+      }
+    }
+  }
+  impl_->entries.reset(new Impl::Entry[impl_->object_ids.size()]);
+  impl_->skeletonize_object = [=](uint64_t object_id,
+                                  const BoundingBox& bounding_box,
+                                  Skeleton* skeleton) {
+    return SkeletonizeObject(labels, size_vec, strides_vec, object_id,
+                             bounding_box, options, skeleton,
+                             equivalences.get());
+  };
+}
+
+std::shared_ptr<const Skeleton> OnDemandSkeletonGenerator::GetSkeleton(
+    uint64_t object_id) {
+  const int64_t index = impl_->object_ids.Find(object_id);
+  if (index == -1) return nullptr;
+  auto& entry = impl_->entries[index];
+  std::lock_guard<std::mutex> lock(entry.mutex);
+  if (!entry.done) {
+    auto skeleton = std::make_shared<Skeleton>();
+    if (impl_->skeletonize_object(object_id, impl_->bounding_boxes[index],
+                                  skeleton.get())) {
+      entry.skeleton = std::move(skeleton);
+    }
+    entry.done = true;
+  }
+  return entry.skeleton;
+}
+
+const std::vector<uint64_t>& OnDemandSkeletonGenerator::object_ids() const {
+  return impl_->object_ids.ids();
+}
+
+#define DO_INSTANTIATE(Label)                                                \
+  template bool SkeletonizeObject<Label>(                                    \
+      const Label* labels, const Vector3d& size, const Vector3d& strides,    \
+      uint64_t object_id, const BoundingBox& bounding_box,                   \
+      const SkeletonizeOptions& options, Skeleton* output,                   \
+      const LabelEquivalences* equivalences);                                \
+  template OnDemandSkeletonGenerator::OnDemandSkeletonGenerator<Label>(      \
+      const Label* labels, const int64_t* size, const int64_t* strides,      \
+      const SkeletonizeOptions& options,                                     \
+      std::shared_ptr<const LabelEquivalences> equivalences);                \
+/**/
+DO_INSTANTIATE(uint8_t)
+DO_INSTANTIATE(uint16_t)
+DO_INSTANTIATE(uint32_t)
+DO_INSTANTIATE(uint64_t)
+#undef DO_INSTANTIATE
+
+}  // namespace meshing
+}  // namespace neuroglancer
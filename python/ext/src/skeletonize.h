@@ -0,0 +1,130 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEUROGLANCER_SKELETONIZE_H_
+#define NEUROGLANCER_SKELETONIZE_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "mesh_objects.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+// Parameters of SkeletonizeObject.  Distances are in the units of
+// `voxel_size`.
+struct SkeletonizeOptions {
+  // Physical size of a voxel along x, y and z.
+  float voxel_size[3] = {1, 1, 1};
+
+  // Once a path has been added to the skeleton, the voxels within
+  // `invalidation_scale * r + invalidation_constant` of each voxel of the path,
+  // where `r` is the distance from that voxel to the boundary of the object,
+  // are not used as targets of further paths.  Larger values give fewer,
+  // smoother branches.
+  float invalidation_scale = 4;
+  float invalidation_constant = 10;
+
+  // Paths are found by Dijkstra's algorithm with the cost of each step
+  // multiplied by `1 + penalty_scale * (1 - r / max_r) ^ penalty_exponent`,
+  // where `max_r` is the largest distance to the boundary, so that they
+  // follow the center of the object.
+  float penalty_scale = 100000;
+  float penalty_exponent = 4;
+};
+
+// Skeleton as a set of vertices and the edges between them, as encoded by
+// neuroglancer.skeleton.Skeleton.
+struct Skeleton {
+  // Position of each vertex, as 3 consecutive coordinates x, y, z in voxels.
+  std::vector<float> vertex_positions;
+
+  // Pairs of vertex indices.
+  std::vector<uint32_t> edges;
+
+  // Distance from each vertex to the boundary of the object, in the units of
+  // `voxel_size`.
+  std::vector<float> radii;
+
+  size_t num_vertices() const { return radii.size(); }
+};
+
+// Computes the skeleton of a single object by the TEASAR algorithm, considering
+// only the voxels in `bounding_box`, which must contain every voxel of the
+// object.  If `equivalences` is not null, the object consists of the labels
+// mapped to `object_id`, as for MeshObjects.
+//
+// Each 26-connected component of the object is skeletonized separately: its
+// root is the voxel farthest from an arbitrary voxel, and paths to the root are
+// added from the farthest voxel not yet within the invalidation distance of the
+// skeleton until every voxel is.  Vertices are at the positions of the voxels
+// on the paths, and the skeleton of an object without voxels is empty.
+//
+// Returns false if the bounding box, padded by a voxel on each side, has 2^32
+// voxels or more.
+//
+// Label must be one of uint8_t, uint16_t, uint32_t, uint64_t.
+template <class Label>
+bool SkeletonizeObject(const Label* labels, const Vector3d& size,
+                       const Vector3d& strides, uint64_t object_id,
+                       const BoundingBox& bounding_box,
+                       const SkeletonizeOptions& options, Skeleton* output,
+                       const LabelEquivalences* equivalences = nullptr);
+
+// Computes skeletons of the objects of a volume when they are first requested,
+// and caches them.  The bounding box of every object is computed at
+// construction, so that each skeleton is computed from just that box.
+//
+// Copies share the same cache.  The label array must remain valid as long as
+// any copy exists.
+class OnDemandSkeletonGenerator {
+  struct Impl;
+
+ public:
+  OnDemandSkeletonGenerator() = default;
+
+  // If `equivalences` is not null, each object consists of the labels mapped
+  // to it, as for MeshObjects.
+  //
+  // Label must be one of uint8_t, uint16_t, uint32_t, uint64_t.
+  template <class Label>
+  OnDemandSkeletonGenerator(
+      const Label* labels, const int64_t* size, const int64_t* strides,
+      const SkeletonizeOptions& options,
+      std::shared_ptr<const LabelEquivalences> equivalences = nullptr);
+
+  // Returns the skeleton of the specified object, or nullptr if there is no
+  // such object or its bounding box is too large to skeletonize.
+  //
+  // This may be called concurrently from multiple threads.  Concurrent
+  // requests for the same object wait for a single computation.
+  std::shared_ptr<const Skeleton> GetSkeleton(uint64_t object_id);
+
+  // Returns the sorted ids of the objects of the volume.
+  const std::vector<uint64_t>& object_ids() const;
+
+  explicit operator bool() const { return bool(impl_); }
+
+ private:
+  std::shared_ptr<Impl> impl_;
+};
+
+}  // namespace meshing
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_SKELETONIZE_H_
@@ -0,0 +1,169 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "skeletonize.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace meshing {
+namespace {
+
+// Volume of `size` voxels, with x varying fastest.
+struct Volume {
+  explicit Volume(const Vector3d& size)
+      : size(size), labels(size[0] * size[1] * size[2]) {}
+
+  void Fill(const Vector3d& start, const Vector3d& end, uint32_t label) {
+    for (int64_t z = start[2]; z < end[2]; ++z) {
+      for (int64_t y = start[1]; y < end[1]; ++y) {
+        for (int64_t x = start[0]; x < end[0]; ++x) {
+          labels[x + size[0] * (y + size[1] * z)] = label;
+        }
+      }
+    }
+  }
+
+  Vector3d strides() const { return {{1, size[0], size[0] * size[1]}}; }
+
+  Vector3d size;
+  std::vector<uint32_t> labels;
+};
+
+// Returns the number of vertices of `skeleton` with exactly one edge.
+size_t CountEndpoints(const Skeleton& skeleton) {
+  std::vector<int> degrees(skeleton.num_vertices());
+  for (uint32_t v : skeleton.edges) ++degrees[v];
+  return std::count(degrees.begin(), degrees.end(), 1);
+}
+
+TEST(SkeletonizeObjectTest, Tube) {
+  Volume volume(Vector3d{{50, 9, 9}});
+  volume.Fill({{5, 2, 2}}, {{45, 7, 7}}, 1);
+  Skeleton skeleton;
+  const BoundingBox box{{{5, 2, 2}}, {{45, 7, 7}}};
+  ASSERT_TRUE(SkeletonizeObject(volume.labels.data(), volume.size,
+                                volume.strides(), 1, box, SkeletonizeOptions(),
+                                &skeleton));
+  ASSERT_GT(skeleton.num_vertices(), 30u);
+  EXPECT_EQ(skeleton.num_vertices() * 3, skeleton.vertex_positions.size());
+  EXPECT_EQ((skeleton.num_vertices() - 1) * 2, skeleton.edges.size());
+  EXPECT_EQ(2u, CountEndpoints(skeleton));
+  float min_x = 100, max_x = 0;
+  for (size_t i = 0; i < skeleton.num_vertices(); ++i) {
+    const float* position = &skeleton.vertex_positions[i * 3];
+    min_x = std::min(min_x, position[0]);
+    max_x = std::max(max_x, position[0]);
+    EXPECT_GE(skeleton.radii[i], 1) << i;
+    EXPECT_LE(skeleton.radii[i], 3) << i;
+    // The penalty keeps the path on the axis of the tube away from the corners
+    // at its ends.
+    if (position[0] >= 8 && position[0] < 42) {
+      EXPECT_EQ(4, position[1]) << i;
+      EXPECT_EQ(4, position[2]) << i;
+      EXPECT_EQ(3, skeleton.radii[i]) << i;
+    }
+  }
+  EXPECT_EQ(5, min_x);
+  EXPECT_EQ(44, max_x);
+}
+
+TEST(SkeletonizeObjectTest, Branches) {
+  // A T of three arms.
+  Volume volume(Vector3d{{60, 40, 7}});
+  volume.Fill({{2, 2, 2}}, {{58, 5, 5}}, 1);
+  volume.Fill({{28, 2, 2}}, {{31, 38, 5}}, 1);
+  Skeleton skeleton;
+  const BoundingBox box{{{2, 2, 2}}, {{58, 38, 5}}};
+  ASSERT_TRUE(SkeletonizeObject(volume.labels.data(), volume.size,
+                                volume.strides(), 1, box, SkeletonizeOptions(),
+                                &skeleton));
+  EXPECT_EQ((skeleton.num_vertices() - 1) * 2, skeleton.edges.size());
+  EXPECT_EQ(3u, CountEndpoints(skeleton));
+}
+
+TEST(SkeletonizeObjectTest, ComponentsAndEquivalences) {
+  Volume volume(Vector3d{{40, 7, 7}});
+  volume.Fill({{1, 1, 1}}, {{15, 6, 6}}, 1);
+  volume.Fill({{15, 1, 1}}, {{30, 6, 6}}, 2);
+  volume.Fill({{33, 1, 1}}, {{39, 6, 6}}, 3);
+  SkeletonizeOptions options;
+  options.invalidation_constant = 2;
+  const BoundingBox box{{{0, 0, 0}}, {{40, 7, 7}}};
+
+  // Labels 1 and 3 are each a single component.
+  Skeleton skeleton;
+  ASSERT_TRUE(SkeletonizeObject(volume.labels.data(), volume.size,
+                                volume.strides(), 1, box, options, &skeleton));
+  EXPECT_EQ((skeleton.num_vertices() - 1) * 2, skeleton.edges.size());
+
+  // Object 1 consists of all three labels, in two components.
+  LabelEquivalences equivalences({{2, 1}, {3, 1}});
+  ASSERT_TRUE(SkeletonizeObject(volume.labels.data(), volume.size,
+                                volume.strides(), 1, box, options, &skeleton,
+                                &equivalences));
+  EXPECT_EQ((skeleton.num_vertices() - 2) * 2, skeleton.edges.size());
+  EXPECT_EQ(4u, CountEndpoints(skeleton));
+
+  // Label 2 no longer belongs to object 2.
+  ASSERT_TRUE(SkeletonizeObject(volume.labels.data(), volume.size,
+                                volume.strides(), 2, box, options, &skeleton,
+                                &equivalences));
+  EXPECT_EQ(0u, skeleton.num_vertices());
+  EXPECT_EQ(0u, skeleton.edges.size());
+}
+
+TEST(OnDemandSkeletonGeneratorTest, Cached) {
+  Volume volume(Vector3d{{40, 7, 7}});
+  volume.Fill({{1, 1, 1}}, {{15, 6, 6}}, 1);
+  volume.Fill({{15, 1, 1}}, {{30, 6, 6}}, 2);
+  const Vector3d strides = volume.strides();
+  OnDemandSkeletonGenerator generator(volume.labels.data(), volume.size.data(),
+                                      strides.data(), SkeletonizeOptions());
+  EXPECT_EQ(std::vector<uint64_t>({1, 2}), generator.object_ids());
+  auto skeleton = generator.GetSkeleton(2);
+  ASSERT_TRUE(skeleton);
+  EXPECT_EQ(2u, CountEndpoints(*skeleton));
+  for (size_t i = 0; i < skeleton->num_vertices(); ++i) {
+    EXPECT_GE(skeleton->vertex_positions[i * 3], 15);
+    EXPECT_LT(skeleton->vertex_positions[i * 3], 30);
+  }
+  EXPECT_EQ(skeleton, generator.GetSkeleton(2));
+  EXPECT_FALSE(generator.GetSkeleton(3));
+
+  auto equivalences = std::make_shared<LabelEquivalences>(
+      std::vector<std::pair<uint64_t, uint64_t>>{{2, 1}});
+  OnDemandSkeletonGenerator merged(volume.labels.data(), volume.size.data(),
+                                   strides.data(), SkeletonizeOptions(),
+                                   equivalences);
+  EXPECT_EQ(std::vector<uint64_t>({1}), merged.object_ids());
+  skeleton = merged.GetSkeleton(1);
+  ASSERT_TRUE(skeleton);
+  float min_x = 100, max_x = 0;
+  for (size_t i = 0; i < skeleton->num_vertices(); ++i) {
+    min_x = std::min(min_x, skeleton->vertex_positions[i * 3]);
+    max_x = std::max(max_x, skeleton->vertex_positions[i * 3]);
+  }
+  EXPECT_EQ(1, min_x);
+  EXPECT_EQ(29, max_x);
+}
+
+}  // namespace
+}  // namespace meshing
+}  // namespace neuroglancer
@@ -0,0 +1,283 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace_events.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace neuroglancer {
+namespace trace_events {
+
+namespace internal {
+
+std::atomic<bool> enabled(false);
+
+int64_t NowNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace internal
+
+namespace {
+
+static_assert((kEventsPerThread & (kEventsPerThread - 1)) == 0,
+              "kEventsPerThread must be a power of two");
+
+// Slot of a ring.  The fields are atomic, since GetChromeTraceJson may read a
+// slot while its thread overwrites it; such events are then discarded.
+struct Event {
+  std::atomic<const char*> name;
+  std::atomic<const char*> size_name;
+  std::atomic<uint64_t> object_id;
+  std::atomic<uint64_t> size;
+  std::atomic<int64_t> start_ns;
+  std::atomic<int64_t> duration_ns;
+};
+
+// Copy of an event read from a ring.
+struct EventCopy {
+  const char* name;
+  const char* size_name;
+  uint64_t object_id;
+  uint64_t size;
+  int64_t start_ns;
+  int64_t duration_ns;
+  size_t ring_index;
+};
+
+// Ring of the events recorded by one thread at a time.  Only its thread
+// writes the events, `num_started` and `num_written`, as a sequence lock: it
+// increments `num_started` before overwriting a slot, and `num_written` once
+// the event is complete.
+struct Ring {
+  explicit Ring(size_t index)
+      : events(new Event[kEventsPerThread]), index(index) {}
+
+  std::unique_ptr<Event[]> events;
+  const size_t index;
+  // Number of events ever started and completed; event i is in slot
+  // i % kEventsPerThread.
+  std::atomic<uint64_t> num_started{0};
+  std::atomic<uint64_t> num_written{0};
+  // Events before this one have been cleared.  Guarded by Registry::mutex.
+  uint64_t num_cleared = 0;
+  // Whether a running thread owns the ring.  Guarded by Registry::mutex.
+  bool owned = false;
+};
+
+struct Registry {
+  std::mutex mutex;
+  // Rings are never freed, since there are at most as many as threads that
+  // ever recorded spans concurrently.
+  std::vector<std::unique_ptr<Ring>> rings;
+};
+
+Registry& GetRegistry() {
+  static Registry* registry = new Registry;
+  return *registry;
+}
+
+// Ring owned by the current thread, acquired when it first records a span and
+// released when it exits.
+class ThreadRing {
+ public:
+  ~ThreadRing() {
+    if (!ring_) return;
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    ring_->owned = false;
+  }
+
+  Ring* get() {
+    if (ring_) return ring_;
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& ring : registry.rings) {
+      if (!ring->owned) {
+        ring_ = ring.get();
+        break;
+      }
+    }
+    if (!ring_) {
+      registry.rings.emplace_back(new Ring(registry.rings.size()));
+      ring_ = registry.rings.back().get();
+    }
+    ring_->owned = true;
+    return ring_;
+  }
+
+ private:
+  Ring* ring_ = nullptr;
+};
+
+thread_local ThreadRing thread_ring;
+
+// Object id of the innermost ObjectScope of the thread, or 0 if none, since
+// label 0 is never an object.
+thread_local uint64_t current_object_id = 0;
+
+// Appends the events of `ring` that are retained and were not overwritten
+// while being read to `output`, and returns the number of events written.
+// Must be called with Registry::mutex held.
+uint64_t ReadRing(const Ring& ring, std::vector<EventCopy>* output) {
+  const uint64_t end = ring.num_written.load(std::memory_order_acquire);
+  const uint64_t begin = std::max(
+      ring.num_cleared, end < kEventsPerThread ? 0 : end - kEventsPerThread);
+  const size_t output_start = output->size();
+  for (uint64_t i = begin; i < end; ++i) {
+    const Event& event = ring.events[i % kEventsPerThread];
+    EventCopy copy;
+    copy.name = event.name.load(std::memory_order_relaxed);
+    copy.size_name = event.size_name.load(std::memory_order_relaxed);
+    copy.object_id = event.object_id.load(std::memory_order_relaxed);
+    copy.size = event.size.load(std::memory_order_relaxed);
+    copy.start_ns = event.start_ns.load(std::memory_order_relaxed);
+    copy.duration_ns = event.duration_ns.load(std::memory_order_relaxed);
+    copy.ring_index = ring.index;
+    output->push_back(copy);
+  }
+  // Events whose slots the thread may have started overwriting while they
+  // were read are discarded.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t num_started = ring.num_started.load(std::memory_order_relaxed);
+  if (num_started > kEventsPerThread &&
+      num_started - kEventsPerThread > begin) {
+    const uint64_t num_overwritten =
+        std::min(end, num_started - kEventsPerThread) - begin;
+    output->erase(output->begin() + output_start,
+                  output->begin() + output_start + num_overwritten);
+  }
+  return end;
+}
+
+// Appends `ns` nanoseconds as microseconds, the unit of Chrome traces.
+void AppendMicroseconds(int64_t ns, std::string* output) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%" PRId64 ".%03d", ns / 1000,
+           static_cast<int>(ns % 1000));
+  *output += buffer;
+}
+
+}  // namespace
+
+namespace internal {
+
+void RecordSpan(const char* name, const char* size_name, uint64_t size,
+                int64_t start_ns) {
+  const int64_t end_ns = NowNanoseconds();
+  Ring& ring = *thread_ring.get();
+  const uint64_t i = ring.num_written.load(std::memory_order_relaxed);
+  // Readers check `num_started` after reading a slot, so the slot must not be
+  // modified before the increment is visible.
+  ring.num_started.store(i + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  Event& event = ring.events[i % kEventsPerThread];
+  event.name.store(name, std::memory_order_relaxed);
+  event.size_name.store(size_name, std::memory_order_relaxed);
+  event.object_id.store(current_object_id, std::memory_order_relaxed);
+  event.size.store(size, std::memory_order_relaxed);
+  event.start_ns.store(start_ns, std::memory_order_relaxed);
+  event.duration_ns.store(end_ns - start_ns, std::memory_order_relaxed);
+  ring.num_written.store(i + 1, std::memory_order_release);
+}
+
+}  // namespace internal
+
+void SetEnabled(bool enabled) {
+  internal::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+ObjectScope::ObjectScope(uint64_t object_id)
+    : previous_object_id_(current_object_id) {
+  current_object_id = object_id;
+}
+
+ObjectScope::~ObjectScope() { current_object_id = previous_object_id_; }
+
+std::string GetChromeTraceJson(bool clear) {
+  std::vector<EventCopy> events;
+  size_t num_rings;
+  {
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    num_rings = registry.rings.size();
+    for (const auto& ring : registry.rings) {
+      const uint64_t end = ReadRing(*ring, &events);
+      if (clear) ring->num_cleared = end;
+    }
+  }
+  std::sort(events.begin(), events.end(),
+            [](const EventCopy& a, const EventCopy& b) {
+              return a.start_ns < b.start_ns;
+            });
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  for (size_t ring_index = 0; ring_index < num_rings; ++ring_index) {
+    if (!first) json += ',';
+    first = false;
+    const std::string tid = std::to_string(ring_index);
+    json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid +
+            ",\"args\":{\"name\":\"thread slot " + tid + "\"}}";
+  }
+  for (const auto& event : events) {
+    if (!first) json += ',';
+    first = false;
+    json += "{\"name\":\"";
+    json += event.name;
+    json += "\",\"cat\":\"neuroglancer\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+    json += std::to_string(event.ring_index);
+    json += ",\"ts\":";
+    AppendMicroseconds(event.start_ns, &json);
+    json += ",\"dur\":";
+    AppendMicroseconds(event.duration_ns, &json);
+    json += ",\"args\":{";
+    bool first_arg = true;
+    if (event.object_id != 0) {
+      // As in Neuroglancer JSON states, 64-bit ids are strings, since they
+      // may exceed the precision of JSON numbers in JavaScript.
+      json += "\"object_id\":\"" + std::to_string(event.object_id) + "\"";
+      first_arg = false;
+    }
+    if (event.size_name) {
+      if (!first_arg) json += ',';
+      json += "\"";
+      json += event.size_name;
+      json += "\":" + std::to_string(event.size);
+    }
+    json += "}}";
+  }
+  json += "]}";
+  return json;
+}
+
+void Clear() {
+  auto& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (const auto& ring : registry.rings) {
+    ring->num_cleared = ring->num_written.load(std::memory_order_acquire);
+  }
+}
+
+}  // namespace trace_events
+}  // namespace neuroglancer
@@ -0,0 +1,122 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Optional process-wide tracing of the native meshing and encoding code, as
+// spans exported in the Chrome trace event format, which chrome://tracing and
+// Perfetto display as a timeline of each thread.
+//
+// Each thread records its spans in its own ring buffer of kEventsPerThread
+// events, without locking, overwriting its oldest events once full.  Rings
+// are reused by later threads once their thread exits, so that the
+// short-lived threads of ParallelFor do not accumulate rings; the "tid" of an
+// exported event identifies the ring, i.e. a slot of concurrently running
+// threads, rather than a thread.  While tracing is disabled, which is the
+// default, a Span only costs a relaxed atomic load.
+
+#ifndef NEUROGLANCER_TRACE_EVENTS_H_
+#define NEUROGLANCER_TRACE_EVENTS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace neuroglancer {
+namespace trace_events {
+
+// Number of events retained by the ring of each thread.
+constexpr size_t kEventsPerThread = 8192;
+
+namespace internal {
+extern std::atomic<bool> enabled;
+// Returns the current time in nanoseconds since an arbitrary epoch.
+int64_t NowNanoseconds();
+void RecordSpan(const char* name, const char* size_name, uint64_t size,
+                int64_t start_ns);
+}  // namespace internal
+
+// Starts or stops recording spans.  Spans already recorded are retained.
+void SetEnabled(bool enabled);
+
+inline bool IsEnabled() {
+  return internal::enabled.load(std::memory_order_relaxed);
+}
+
+// Records the wall-clock time from its construction to its destruction as a
+// span named `name`, if tracing was enabled at construction.  The span is
+// tagged with the object id of the innermost enclosing ObjectScope of the
+// thread, if any, and with `size` under the key `size_name`, if not null,
+// e.g. the number of triangles or voxels processed.  `name` and `size_name`
+// must be string literals, or otherwise outlive all traces, and must not
+// require escaping in JSON.
+class Span {
+ public:
+  explicit Span(const char* name, const char* size_name = nullptr,
+                uint64_t size = 0)
+      : name_(name),
+        size_name_(size_name),
+        size_(size),
+        start_ns_(IsEnabled() ? internal::NowNanoseconds() : -1) {}
+
+  ~Span() {
+    if (start_ns_ >= 0) {
+      internal::RecordSpan(name_, size_name_, size_, start_ns_);
+    }
+  }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+  // Sets the size, e.g. once the output size is known.
+  void set_size(uint64_t size) { size_ = size; }
+
+ private:
+  const char* name_;
+  const char* size_name_;
+  uint64_t size_;
+  // Negative if tracing was disabled.
+  int64_t start_ns_;
+};
+
+// Tags the spans ending on the current thread during its lifetime with
+// `object_id`.  Scopes nest; a span recorded on another thread, e.g. by
+// ParallelFor, needs its own scope.
+class ObjectScope {
+ public:
+  explicit ObjectScope(uint64_t object_id);
+  ~ObjectScope();
+
+  ObjectScope(const ObjectScope&) = delete;
+  ObjectScope& operator=(const ObjectScope&) = delete;
+
+ private:
+  uint64_t previous_object_id_;
+};
+
+// Returns the spans retained by all rings as a JSON object in the Chrome trace
+// event format, ordered by start time.  Timestamps are those of
+// std::chrono::steady_clock, e.g. CLOCK_MONOTONIC on Linux, so that traces
+// returned by successive calls can be merged.  Spans recorded concurrently
+// may be omitted.  If `clear`, the returned spans are discarded from the rings.
+std::string GetChromeTraceJson(bool clear = false);
+
+// Discards all spans recorded so far.
+void Clear();
+
+}  // namespace trace_events
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_TRACE_EVENTS_H_
@@ -0,0 +1,144 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace_events.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "parallel_for.h"
+
+namespace neuroglancer {
+namespace trace_events {
+namespace {
+
+size_t CountOccurrences(const std::string& text, const std::string& pattern) {
+  size_t count = 0;
+  for (size_t pos = text.find(pattern); pos != std::string::npos;
+       pos = text.find(pattern, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+size_t CountSpans(const std::string& json) {
+  return CountOccurrences(json, "\"ph\":\"X\"");
+}
+
+TEST(TraceEventsTest, DisabledByDefault) {
+  Clear();
+  { Span span("Ignored"); }
+  EXPECT_EQ(0u, CountSpans(GetChromeTraceJson()));
+}
+
+TEST(TraceEventsTest, RecordsSpansWithObjectIdAndSize) {
+  Clear();
+  SetEnabled(true);
+  {
+    ObjectScope object_scope(42);
+    Span outer("Outer");
+    { Span inner("Inner", "triangles", 7); }
+    Span resized("Resized", "bytes");
+    resized.set_size(100);
+  }
+  { Span untagged("Untagged"); }
+  SetEnabled(false);
+  { Span ignored("Ignored"); }
+  const std::string json = GetChromeTraceJson(/*clear=*/true);
+  EXPECT_EQ(0u, json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+  EXPECT_EQ(4u, CountSpans(json));
+  EXPECT_NE(std::string::npos,
+            json.find("\"name\":\"Inner\",\"cat\":\"neuroglancer\""));
+  EXPECT_NE(std::string::npos,
+            json.find("\"args\":{\"object_id\":\"42\",\"triangles\":7}"));
+  EXPECT_NE(std::string::npos,
+            json.find("\"args\":{\"object_id\":\"42\",\"bytes\":100}"));
+  EXPECT_EQ(3u, CountOccurrences(json, "\"object_id\":\"42\""));
+  const size_t untagged = json.find("\"name\":\"Untagged\"");
+  ASSERT_NE(std::string::npos, untagged);
+  EXPECT_EQ(json.find("\"args\":{}}", untagged),
+            json.find("\"args\":", untagged));
+  EXPECT_EQ(std::string::npos, json.find("Ignored"));
+  // The outer span starts first.
+  EXPECT_LT(json.find("\"name\":\"Outer\""), json.find("\"name\":\"Inner\""));
+  // Cleared.
+  EXPECT_EQ(0u, CountSpans(GetChromeTraceJson()));
+}
+
+TEST(TraceEventsTest, RetainsLatestEventsOfEachThread) {
+  Clear();
+  SetEnabled(true);
+  const size_t num_spans = kEventsPerThread + 100;
+  for (size_t i = 0; i < num_spans; ++i) {
+    Span span("Span", "index", i);
+  }
+  SetEnabled(false);
+  const std::string json = GetChromeTraceJson(/*clear=*/true);
+  EXPECT_EQ(kEventsPerThread, CountSpans(json));
+  EXPECT_EQ(std::string::npos, json.find("\"index\":99}"));
+  EXPECT_NE(std::string::npos, json.find("\"index\":100}"));
+  EXPECT_NE(std::string::npos,
+            json.find("\"index\":" + std::to_string(num_spans - 1) + "}"));
+}
+
+TEST(TraceEventsTest, RecordsSpansOfConcurrentThreads) {
+  Clear();
+  SetEnabled(true);
+  const size_t num_spans = 1000;
+  // Successive ParallelFor calls start new threads, which reuse the rings of
+  // the threads that have exited.
+  for (int repetition = 0; repetition < 3; ++repetition) {
+    ParallelFor(num_spans, 4, [&](size_t i) {
+      ObjectScope object_scope(i + 1);
+      Span span("Span");
+    });
+  }
+  SetEnabled(false);
+  const std::string json = GetChromeTraceJson(/*clear=*/true);
+  EXPECT_EQ(3 * num_spans, CountSpans(json));
+  EXPECT_EQ(3u, CountOccurrences(json, "\"object_id\":\"1000\"}"));
+}
+
+TEST(TraceEventsTest, ReadsWhileThreadsRecord) {
+  Clear();
+  SetEnabled(true);
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; ++i) {
+    threads.emplace_back([&] {
+      while (!stop) {
+        Span span("Span", "size", 1);
+      }
+    });
+  }
+  for (int i = 0; i < 20; ++i) {
+    const std::string json = GetChromeTraceJson(/*clear=*/i % 2 == 0);
+    // Every span read is complete.
+    EXPECT_EQ(CountSpans(json), CountOccurrences(json, "\"size\":1}"));
+    EXPECT_LE(CountSpans(json), 2 * kEventsPerThread);
+  }
+  stop = true;
+  for (auto& thread : threads) thread.join();
+  SetEnabled(false);
+  Clear();
+}
+
+}  // namespace
+}  // namespace trace_events
+}  // namespace neuroglancer
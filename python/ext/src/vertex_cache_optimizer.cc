@@ -0,0 +1,195 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "vertex_cache_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace neuroglancer {
+namespace meshing {
+
+namespace {
+
+using Index = TriangleMesh::VertexIndex;
+using Triangle = std::array<Index, 3>;
+
+constexpr Index kInvalidIndex = std::numeric_limits<Index>::max();
+
+// Parameters of the vertex scoring function, as suggested by Forsyth.  The
+// cache is modeled as LRU with `kCacheSize` entries.
+constexpr size_t kCacheSize = 32;
+constexpr float kCacheDecayPower = 1.5f;
+constexpr float kLastTriangleScore = 0.75f;
+constexpr float kValenceBoostScale = 2.0f;
+constexpr float kValenceBoostPower = 0.5f;
+
+// Returns the score of a vertex at `cache_position` (or -1 if it is not in the
+// cache) that is used by `num_remaining` triangles not yet emitted.
+float VertexScore(int cache_position, uint32_t num_remaining) {
+  if (num_remaining == 0) return -1;
+  float score = 0;
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      // The vertices of the most recent triangle are penalized slightly, to
+      // discourage long thin strips.
+      score = kLastTriangleScore;
+    } else {
+      score = std::pow(1.0f - static_cast<float>(cache_position - 3) /
+                                  (kCacheSize - 3),
+                       kCacheDecayPower);
+    }
+  }
+  // Vertices with few remaining triangles are favored so that they can be
+  // retired from the cache.
+  return score + kValenceBoostScale *
+                     std::pow(static_cast<float>(num_remaining),
+                              -kValenceBoostPower);
+}
+
+}  // namespace
+
+void OptimizeVertexCache(TriangleMesh* mesh) {
+  auto& triangles = mesh->triangles;
+  auto& positions = mesh->vertex_positions;
+  const size_t num_triangles = triangles.size();
+  const size_t num_vertices = positions.size();
+  if (num_triangles == 0) return;
+
+  // For each vertex, the triangles not yet emitted that use it are stored in
+  // `vertex_triangles[vertex_triangle_begin[v], ... + num_remaining[v])`.
+  std::vector<uint32_t> num_remaining(num_vertices);
+  for (const auto& triangle : triangles) {
+    for (Index v : triangle) ++num_remaining[v];
+  }
+  std::vector<size_t> vertex_triangle_begin(num_vertices + 1);
+  for (size_t v = 0; v < num_vertices; ++v) {
+    vertex_triangle_begin[v + 1] = vertex_triangle_begin[v] + num_remaining[v];
+  }
+  std::vector<Index> vertex_triangles(vertex_triangle_begin[num_vertices]);
+  {
+    std::vector<size_t> next(vertex_triangle_begin.begin(),
+                             vertex_triangle_begin.end() - 1);
+    for (size_t t = 0; t < num_triangles; ++t) {
+      for (Index v : triangles[t]) vertex_triangles[next[v]++] = t;
+    }
+  }
+
+  std::vector<int> cache_positions(num_vertices, -1);
+  std::vector<float> vertex_scores(num_vertices);
+  for (size_t v = 0; v < num_vertices; ++v) {
+    vertex_scores[v] = VertexScore(-1, num_remaining[v]);
+  }
+  auto triangle_score = [&](Index t) {
+    const auto& triangle = triangles[t];
+    return vertex_scores[triangle[0]] + vertex_scores[triangle[1]] +
+           vertex_scores[triangle[2]];
+  };
+  std::vector<uint8_t> emitted(num_triangles);
+  Index best_triangle = 0;
+  float best_score = triangle_score(0);
+  for (size_t t = 1; t < num_triangles; ++t) {
+    const float score = triangle_score(t);
+    if (score > best_score) {
+      best_score = score;
+      best_triangle = t;
+    }
+  }
+
+  std::vector<Triangle> new_triangles;
+  new_triangles.reserve(num_triangles);
+  std::vector<Index> cache, new_cache;
+  // Triangles before `next_unemitted` have all been emitted.
+  size_t next_unemitted = 0;
+  while (new_triangles.size() < num_triangles) {
+    if (best_triangle == kInvalidIndex) {
+      // No triangle uses a cached vertex; continue from the first triangle
+      // not yet emitted.
+      while (emitted[next_unemitted]) ++next_unemitted;
+      best_triangle = next_unemitted;
+    }
+    const Triangle triangle = triangles[best_triangle];
+    new_triangles.push_back(triangle);
+    emitted[best_triangle] = 1;
+    for (Index v : triangle) {
+      auto begin = vertex_triangles.begin() + vertex_triangle_begin[v];
+      auto end = begin + num_remaining[v];
+      std::iter_swap(std::find(begin, end, best_triangle), end - 1);
+      --num_remaining[v];
+    }
+
+    // Move the vertices of the triangle to the front of the cache.
+    new_cache.clear();
+    for (Index v : triangle) {
+      if (std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end()) {
+        new_cache.push_back(v);
+      }
+    }
+    for (Index v : cache) {
+      if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+        new_cache.push_back(v);
+      }
+    }
+    for (size_t i = 0; i < new_cache.size(); ++i) {
+      const Index v = new_cache[i];
+      cache_positions[v] = i < kCacheSize ? static_cast<int>(i) : -1;
+      vertex_scores[v] = VertexScore(cache_positions[v], num_remaining[v]);
+    }
+
+    // Update the scores of the triangles affected, including those of
+    // vertices just evicted, and choose the best of them.
+    best_triangle = kInvalidIndex;
+    best_score = -1;
+    for (Index v : new_cache) {
+      for (size_t i = vertex_triangle_begin[v],
+                  end = vertex_triangle_begin[v] + num_remaining[v];
+           i < end; ++i) {
+        const Index t = vertex_triangles[i];
+        const float score = triangle_score(t);
+        if (score > best_score) {
+          best_score = score;
+          best_triangle = t;
+        }
+      }
+    }
+    if (new_cache.size() > kCacheSize) new_cache.resize(kCacheSize);
+    cache.swap(new_cache);
+  }
+
+  // Renumber the vertices in order of first use.
+  std::vector<Index> new_indices(num_vertices, kInvalidIndex);
+  Index num_used = 0;
+  for (auto& triangle : new_triangles) {
+    for (auto& v : triangle) {
+      if (new_indices[v] == kInvalidIndex) new_indices[v] = num_used++;
+      v = new_indices[v];
+    }
+  }
+  for (size_t v = 0; v < num_vertices; ++v) {
+    if (new_indices[v] == kInvalidIndex) new_indices[v] = num_used++;
+  }
+  VertexPositions new_positions(num_vertices);
+  for (size_t v = 0; v < num_vertices; ++v) {
+    new_positions[new_indices[v]] = positions[v];
+  }
+  positions.swap(new_positions);
+  triangles.swap(new_triangles);
+}
+
+}  // namespace meshing
+}  // namespace neuroglancer
@@ -0,0 +1,39 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEUROGLANCER_VERTEX_CACHE_OPTIMIZER_H_
+#define NEUROGLANCER_VERTEX_CACHE_OPTIMIZER_H_
+
+#include "voxel_mesh_generator.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+// Reorders the triangles of `mesh` to improve the hit rate of the
+// post-transform vertex cache of a GPU, using the greedy algorithm of
+// Forsyth, "Linear-Speed Vertex Cache Optimisation" (2006).  The vertices are
+// then renumbered in order of first use by the reordered triangles, which
+// improves the locality of vertex fetches.  Vertices not referenced by any
+// triangle are moved to the end.
+//
+// The vertex order within each triangle, and therefore its orientation, is
+// preserved.
+void OptimizeVertexCache(TriangleMesh* mesh);
+
+}  // namespace meshing
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_VERTEX_CACHE_OPTIMIZER_H_
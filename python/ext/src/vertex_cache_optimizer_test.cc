@@ -0,0 +1,128 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "vertex_cache_optimizer.h"
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <set>
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace meshing {
+namespace {
+
+using Index = TriangleMesh::VertexIndex;
+using Position = std::array<float, 3>;
+
+// Returns a planar `n` by `n` grid of quads, each split into two triangles,
+// with the triangles in random order.
+TriangleMesh MakeShuffledGrid(int n) {
+  TriangleMesh mesh;
+  for (int y = 0; y <= n; ++y) {
+    for (int x = 0; x <= n; ++x) {
+      mesh.vertex_positions.push_back({{float(x), float(y), 0}});
+    }
+  }
+  auto index = [n](int x, int y) { return Index(y * (n + 1) + x); };
+  for (int y = 0; y < n; ++y) {
+    for (int x = 0; x < n; ++x) {
+      mesh.triangles.push_back(
+          {{index(x, y), index(x + 1, y), index(x + 1, y + 1)}});
+      mesh.triangles.push_back(
+          {{index(x, y), index(x + 1, y + 1), index(x, y + 1)}});
+    }
+  }
+  std::mt19937 generator(42);
+  std::shuffle(mesh.triangles.begin(), mesh.triangles.end(), generator);
+  return mesh;
+}
+
+// Returns the average number of vertex cache misses per triangle when `mesh`
+// is rendered with a FIFO cache of `cache_size` entries.
+double AverageCacheMissRatio(const TriangleMesh& mesh, size_t cache_size) {
+  std::deque<Index> cache;
+  size_t misses = 0;
+  for (const auto& triangle : mesh.triangles) {
+    for (Index v : triangle) {
+      if (std::find(cache.begin(), cache.end(), v) != cache.end()) continue;
+      ++misses;
+      cache.push_back(v);
+      if (cache.size() > cache_size) cache.pop_front();
+    }
+  }
+  return static_cast<double>(misses) / mesh.triangles.size();
+}
+
+// Returns the triangles of `mesh` by vertex position, with each rotated so
+// that its smallest position is first.
+std::multiset<std::array<Position, 3>> TrianglePositions(
+    const TriangleMesh& mesh) {
+  std::multiset<std::array<Position, 3>> result;
+  for (const auto& triangle : mesh.triangles) {
+    std::array<Position, 3> p;
+    for (int i = 0; i < 3; ++i) p[i] = mesh.vertex_positions[triangle[i]];
+    std::rotate(p.begin(), std::min_element(p.begin(), p.end()), p.end());
+    result.insert(p);
+  }
+  return result;
+}
+
+TEST(OptimizeVertexCacheTest, ImprovesCacheMissRatio) {
+  TriangleMesh mesh = MakeShuffledGrid(32);
+  const double original_ratio = AverageCacheMissRatio(mesh, 16);
+  const auto original_triangles = TrianglePositions(mesh);
+  const size_t num_vertices = mesh.vertex_positions.size();
+  OptimizeVertexCache(&mesh);
+  const double optimized_ratio = AverageCacheMissRatio(mesh, 16);
+  EXPECT_GT(original_ratio, 1.2);
+  EXPECT_LT(optimized_ratio, 0.8);
+  // The triangles and their orientations are unchanged.
+  EXPECT_EQ(num_vertices, mesh.vertex_positions.size());
+  EXPECT_EQ(original_triangles, TrianglePositions(mesh));
+}
+
+TEST(OptimizeVertexCacheTest, RenumbersVerticesInOrderOfFirstUse) {
+  TriangleMesh mesh = MakeShuffledGrid(4);
+  // An unreferenced vertex is moved to the end.
+  const Position unused{{-1, -1, -1}};
+  mesh.vertex_positions.insert(mesh.vertex_positions.begin(), unused);
+  for (auto& triangle : mesh.triangles) {
+    for (auto& v : triangle) ++v;
+  }
+  OptimizeVertexCache(&mesh);
+  Index next = 0;
+  for (const auto& triangle : mesh.triangles) {
+    for (Index v : triangle) {
+      EXPECT_LE(v, next);
+      if (v == next) ++next;
+    }
+  }
+  EXPECT_EQ(mesh.vertex_positions.size() - 1, next);
+  EXPECT_EQ(unused, mesh.vertex_positions.back());
+}
+
+TEST(OptimizeVertexCacheTest, EmptyMesh) {
+  TriangleMesh mesh;
+  OptimizeVertexCache(&mesh);
+  EXPECT_TRUE(mesh.triangles.empty());
+}
+
+}  // namespace
+}  // namespace meshing
+}  // namespace neuroglancer
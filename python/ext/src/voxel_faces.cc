@@ -0,0 +1,276 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "voxel_faces.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace neuroglancer {
+namespace meshing {
+
+namespace {
+
+using voxel_mesh_generator::VertexIndex;
+
+// Accumulates rectangles into a TriangleMesh, sharing the vertices of their
+// corners.  Corners are specified by integer coordinates `c`, at position
+// `c - 0.5`, within [origin, origin + 2^21) along each dimension.
+class RectangleMeshBuilder {
+ public:
+  RectangleMeshBuilder(const Vector3d& origin, TriangleMesh* output)
+      : origin_(origin), output_(output) {}
+
+  // Adds the rectangle perpendicular to dimension `d` at `lo[d]`, which
+  // equals `hi[d]`, spanning [lo, hi] along the other dimensions, facing
+  // towards increasing `d` if `positive`.
+  void Add(int d, bool positive, const Vector3d& lo, const Vector3d& hi) {
+    const int u = (d + 1) % 3, v = (d + 2) % 3;
+    Vector3d corner = lo;
+    const VertexIndex p00 = GetVertex(corner);
+    corner[u] = hi[u];
+    const VertexIndex p10 = GetVertex(corner);
+    corner[v] = hi[v];
+    const VertexIndex p11 = GetVertex(corner);
+    corner[u] = lo[u];
+    const VertexIndex p01 = GetVertex(corner);
+    // (u, v, d) is right-handed, so counterclockwise in the (u, v) plane
+    // faces towards increasing `d`.
+    auto& triangles = output_->triangles;
+    if (positive) {
+      triangles.push_back({{p00, p10, p11}});
+      triangles.push_back({{p00, p11, p01}});
+    } else {
+      triangles.push_back({{p00, p11, p10}});
+      triangles.push_back({{p00, p01, p11}});
+    }
+  }
+
+ private:
+  VertexIndex GetVertex(const Vector3d& corner) {
+    const uint64_t key = uint64_t(corner[0] - origin_[0]) |
+                         (uint64_t(corner[1] - origin_[1]) << 21) |
+                         (uint64_t(corner[2] - origin_[2]) << 42);
+    auto& positions = output_->vertex_positions;
+    bool inserted;
+    const VertexIndex index = vertex_map_.FindOrInsert(
+        key, static_cast<VertexIndex>(positions.size()), &inserted);
+    if (inserted) {
+      positions.push_back({{corner[0] - 0.5f, corner[1] - 0.5f,
+                            corner[2] - 0.5f}});
+    }
+    return index;
+  }
+
+  Vector3d origin_;
+  TriangleMesh* output_;
+  voxel_mesh_generator::VertexIndexHashMap vertex_map_;
+};
+
+// Run of faces perpendicular to x or y between the voxels at `k - 1` and `k`
+// along that dimension, spanning voxels [start, end) along the other of x and
+// y, and the z planes from `z_start` onward.
+struct FaceRun {
+  int64_t k;
+  int64_t start;
+  int64_t end;
+  int64_t z_start;
+  bool positive;
+};
+
+// Appends to `runs` the runs of faces between `before` and `after`, the
+// memberships of `n` voxels spaced `stride` apart on either side of the faces
+// at `k`, or null if all outside the object.  Faces are positive where only
+// the voxel before is in the object.  Voxel `i` is at `offset + i`.
+void AppendFaceRuns(int64_t k, const uint8_t* before, const uint8_t* after,
+                    int64_t n, ptrdiff_t stride, int64_t offset, int64_t z,
+                    std::vector<FaceRun>* runs) {
+  const auto get_face = [&](int64_t i) {
+    return (before ? before[i * stride] : 0) - (after ? after[i * stride] : 0);
+  };
+  for (int64_t i = 0; i < n;) {
+    const int face = get_face(i);
+    if (face == 0) {
+      ++i;
+      continue;
+    }
+    const int64_t start = i;
+    while (++i < n && get_face(i) == face) {
+    }
+    runs->push_back(FaceRun{k, offset + start, offset + i, z, face > 0});
+  }
+}
+
+// Extends the runs of `open` that continue into plane `z` as the same runs of
+// `runs`, both sorted by `k` and then `start`, and adds the rectangles of the
+// others, which end at plane `z`, perpendicular to dimension `d`.  `open` is
+// then replaced by `runs`.
+void ExtendFaceRuns(int d, int64_t z, std::vector<FaceRun>* open,
+                    std::vector<FaceRun>* runs,
+                    RectangleMeshBuilder* builder) {
+  const auto close = [&](const FaceRun& run) {
+    Vector3d lo, hi;
+    lo[d] = hi[d] = run.k;
+    lo[1 - d] = run.start;
+    hi[1 - d] = run.end;
+    lo[2] = run.z_start;
+    hi[2] = z;
+    builder->Add(d, run.positive, lo, hi);
+  };
+  size_t i = 0;
+  for (auto& run : *runs) {
+    // Close the open runs up to and including the one starting at the same
+    // position, unless it is the same run.
+    while (i < open->size() &&
+           ((*open)[i].k < run.k ||
+            ((*open)[i].k == run.k && (*open)[i].start <= run.start))) {
+      const FaceRun& old = (*open)[i++];
+      if (old.k == run.k && old.start == run.start && old.end == run.end &&
+          old.positive == run.positive) {
+        run.z_start = old.z_start;
+        break;
+      }
+      close(old);
+    }
+  }
+  for (; i < open->size(); ++i) close((*open)[i]);
+  std::swap(*open, *runs);
+  runs->clear();
+}
+
+// Adds the rectangles of the faces perpendicular to z at plane `z`, where
+// `faces` specifies the orientation of the face of each of the `nx * ny`
+// voxels starting at `origin`, as +1, -1, or 0 if there is none.  Rectangles
+// are grown greedily, first along x and then along y.  Clears `faces`.
+void AddGreedyRectangles(int64_t z, const Vector3d& origin, int64_t nx,
+                         int64_t ny, std::vector<int8_t>* faces,
+                         RectangleMeshBuilder* builder) {
+  int8_t* f = faces->data();
+  for (int64_t y = 0; y < ny; ++y) {
+    for (int64_t x = 0; x < nx; ++x) {
+      const int8_t face = f[x + nx * y];
+      if (face == 0) continue;
+      int64_t x_end = x + 1;
+      while (x_end < nx && f[x_end + nx * y] == face) ++x_end;
+      int64_t y_end = y + 1;
+      for (; y_end < ny; ++y_end) {
+        const int8_t* row = f + nx * y_end;
+        if (!std::all_of(row + x, row + x_end,
+                         [&](int8_t value) { return value == face; })) {
+          break;
+        }
+      }
+      for (int64_t j = y; j < y_end; ++j) {
+        std::fill(f + x + nx * j, f + x_end + nx * j, 0);
+      }
+      builder->Add(2, face > 0, Vector3d{origin[0] + x, origin[1] + y, z},
+                   Vector3d{origin[0] + x_end, origin[1] + y_end, z});
+    }
+  }
+}
+
+}  // namespace
+
+template <class Label>
+void MeshObjectVoxelFaces(const Label* labels, const Vector3d& size,
+                          const Vector3d& strides, uint64_t object_id,
+                          const BoundingBox& bounding_box,
+                          TriangleMesh* output,
+                          const LabelEquivalences* equivalences) {
+  output->clear();
+  if (object_id == 0) return;
+  Vector3d start, end;
+  for (int i = 0; i < 3; ++i) {
+    start[i] = std::max(bounding_box.start[i], int64_t(0));
+    end[i] = std::min(bounding_box.end[i], size[i]);
+    if (start[i] >= end[i]) return;
+  }
+  const int64_t nx = end[0] - start[0], ny = end[1] - start[1];
+  // Whether each voxel of the previous and current z plane of the bounding
+  // box is in the object.
+  std::vector<uint8_t> previous(nx * ny), current(nx * ny);
+  std::vector<int8_t> z_faces(nx * ny);
+  // Labels are mapped to objects one run of equal labels at a time.
+  Label cached_label = 0;
+  bool cached_in_object = false;
+  const auto in_object = [&](Label label) {
+    if (label != cached_label) {
+      cached_label = label;
+      cached_in_object =
+          (equivalences ? equivalences->Find(label) : label) == object_id;
+    }
+    return cached_in_object;
+  };
+  RectangleMeshBuilder builder(start, output);
+  std::vector<FaceRun> open_runs[2], runs[2];
+  // Plane `end[2]` is outside the box, and closes the remaining runs.
+  for (int64_t z = start[2]; z <= end[2]; ++z) {
+    if (z < end[2]) {
+      for (int64_t y = start[1]; y < end[1]; ++y) {
+        const Label* row = labels + start[0] * strides[0] + y * strides[1] +
+                           z * strides[2];
+        uint8_t* out = &current[nx * (y - start[1])];
+        for (int64_t x = 0; x < nx; ++x) {
+          out[x] = in_object(row[x * strides[0]]);
+        }
+      }
+    } else {
+      std::fill(current.begin(), current.end(), 0);
+    }
+    // Faces on the boundary of the volume are omitted.
+    if (z > 0 && z < size[2]) {
+      for (int64_t i = 0; i < nx * ny; ++i) {
+        z_faces[i] = previous[i] - current[i];
+      }
+      AddGreedyRectangles(z, start, nx, ny, &z_faces, &builder);
+    }
+    if (z < end[2]) {
+      for (int64_t k = std::max(start[0], int64_t(1));
+           k <= std::min(end[0], size[0] - 1); ++k) {
+        AppendFaceRuns(
+            k, k > start[0] ? &current[k - 1 - start[0]] : nullptr,
+            k < end[0] ? &current[k - start[0]] : nullptr, ny, nx, start[1],
+            z, &runs[0]);
+      }
+      for (int64_t k = std::max(start[1], int64_t(1));
+           k <= std::min(end[1], size[1] - 1); ++k) {
+        AppendFaceRuns(
+            k, k > start[1] ? &current[nx * (k - 1 - start[1])] : nullptr,
+            k < end[1] ? &current[nx * (k - start[1])] : nullptr, nx, 1,
+            start[0], z, &runs[1]);
+      }
+    }
+    ExtendFaceRuns(0, z, &open_runs[0], &runs[0], &builder);
+    ExtendFaceRuns(1, z, &open_runs[1], &runs[1], &builder);
+    std::swap(previous, current);
+  }
+}
+
+#define DO_INSTANTIATE(Label)                                              \
+  template void MeshObjectVoxelFaces<Label>(                               \
+      const Label* labels, const Vector3d& size, const Vector3d& strides,  \
+      uint64_t object_id, const BoundingBox& bounding_box,                 \
+      TriangleMesh* output, const LabelEquivalences* equivalences);        \
+/**/
+DO_INSTANTIATE(uint8_t)
+DO_INSTANTIATE(uint16_t)
+DO_INSTANTIATE(uint32_t)
+DO_INSTANTIATE(uint64_t)
+#undef DO_INSTANTIATE
+
+}  // namespace meshing
+}  // namespace neuroglancer
@@ -0,0 +1,59 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEUROGLANCER_VOXEL_FACES_H_
+#define NEUROGLANCER_VOXEL_FACES_H_
+
+#include <cstdint>
+
+#include "mesh_objects.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+// Computes the surface of a single object as the faces of its voxels that
+// border voxels of other objects or background, with coplanar faces of the
+// same orientation merged into rectangles, each of two triangles, sharing
+// their corner vertices.  This is much cheaper than marching cubes followed by
+// simplification, at the cost of a blocky surface with T-junctions, e.g. to
+// preview the result of an edit.
+//
+// The labels within `bounding_box`, which must contain every voxel of the
+// object, are read once, one z plane at a time.  Faces perpendicular to z are
+// merged greedily within each plane; faces perpendicular to x and y are merged
+// into runs along the rows of each plane, which are then extended along z
+// while the following planes have the same runs.  If `equivalences` is not
+// null, the object consists of the labels mapped to `object_id`, as for
+// MeshObjects.
+//
+// Vertex positions are relative to the origin of the full volume, in the same
+// units as those of MeshObjects, in which the center of each voxel has integer
+// coordinates, so voxel faces lie halfway between voxel centers.  As with
+// MeshObjects, the surface does not extend to the faces on the boundary of
+// the volume, and triangles have the same orientation.
+//
+// Label must be one of uint8_t, uint16_t, uint32_t, uint64_t.
+template <class Label>
+void MeshObjectVoxelFaces(const Label* labels, const Vector3d& size,
+                          const Vector3d& strides, uint64_t object_id,
+                          const BoundingBox& bounding_box,
+                          TriangleMesh* output,
+                          const LabelEquivalences* equivalences = nullptr);
+
+}  // namespace meshing
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_VOXEL_FACES_H_
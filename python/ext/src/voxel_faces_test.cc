@@ -0,0 +1,200 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "voxel_faces.h"
+
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace meshing {
+namespace {
+
+// Signed volume enclosed by `mesh`, positive if its triangles face outward.
+double ComputeSignedVolume(const TriangleMesh& mesh) {
+  double volume = 0;
+  for (const auto& triangle : mesh.triangles) {
+    double a[3], b[3], c[3];
+    for (int i = 0; i < 3; ++i) {
+      a[i] = mesh.vertex_positions[triangle[0]][i];
+      b[i] = mesh.vertex_positions[triangle[1]][i];
+      c[i] = mesh.vertex_positions[triangle[2]][i];
+    }
+    volume += (a[0] * (b[1] * c[2] - b[2] * c[1]) +
+               a[1] * (b[2] * c[0] - b[0] * c[2]) +
+               a[2] * (b[0] * c[1] - b[1] * c[0])) /
+              6;
+  }
+  return volume;
+}
+
+// Volume of random labels in [1, num_labels], within a border of background.
+std::vector<uint32_t> MakeRandomVolume(const Vector3d& size, int num_labels) {
+  std::mt19937 generator(7);
+  std::uniform_int_distribution<uint32_t> distribution(1, num_labels);
+  std::vector<uint32_t> labels(size[0] * size[1] * size[2]);
+  for (int64_t z = 1; z + 1 < size[2]; ++z) {
+    for (int64_t y = 1; y + 1 < size[1]; ++y) {
+      for (int64_t x = 1; x + 1 < size[0]; ++x) {
+        labels[x + size[0] * (y + size[1] * z)] = distribution(generator);
+      }
+    }
+  }
+  return labels;
+}
+
+TEST(MeshObjectVoxelFacesTest, SingleVoxel) {
+  const Vector3d size{5, 5, 5};
+  const Vector3d strides{1, 5, 25};
+  std::vector<uint8_t> labels(125);
+  labels[2 + 5 * (2 + 5 * 2)] = 3;
+  TriangleMesh mesh;
+  MeshObjectVoxelFaces(labels.data(), size, strides, 3,
+                       BoundingBox{{2, 2, 2}, {3, 3, 3}}, &mesh);
+  EXPECT_EQ(12u, mesh.triangles.size());
+  ASSERT_EQ(8u, mesh.vertex_positions.size());
+  for (const auto& position : mesh.vertex_positions) {
+    for (float coordinate : position) {
+      EXPECT_TRUE(coordinate == 1.5f || coordinate == 2.5f) << coordinate;
+    }
+  }
+  EXPECT_DOUBLE_EQ(1, ComputeSignedVolume(mesh));
+}
+
+// Each side of a box is merged into a single rectangle.
+TEST(MeshObjectVoxelFacesTest, Box) {
+  const Vector3d size{6, 6, 7};
+  const Vector3d strides{1, 6, 36};
+  std::vector<uint16_t> labels(6 * 6 * 7, 1);
+  for (int64_t z = 1; z < 5; ++z) {
+    for (int64_t y = 1; y < 3; ++y) {
+      for (int64_t x = 1; x < 4; ++x) labels[x + 6 * (y + 6 * z)] = 2;
+    }
+  }
+  TriangleMesh mesh;
+  MeshObjectVoxelFaces(labels.data(), size, strides, 2,
+                       BoundingBox{{0, 0, 0}, size}, &mesh);
+  EXPECT_EQ(12u, mesh.triangles.size());
+  EXPECT_EQ(8u, mesh.vertex_positions.size());
+  EXPECT_DOUBLE_EQ(3 * 2 * 4, ComputeSignedVolume(mesh));
+}
+
+// Faces on the boundary of the volume are omitted, as with MeshObject.
+TEST(MeshObjectVoxelFacesTest, VolumeBoundary) {
+  const Vector3d size{4, 3, 2};
+  const Vector3d strides{1, 4, 12};
+  std::vector<uint32_t> labels(24, 5);
+  TriangleMesh mesh;
+  MeshObjectVoxelFaces(labels.data(), size, strides, 5,
+                       BoundingBox{{0, 0, 0}, size}, &mesh);
+  EXPECT_TRUE(mesh.triangles.empty());
+  // Only the face at x = 1.5 between the two halves remains.
+  for (int64_t i = 2; i < 24; i += 4) labels[i] = labels[i + 1] = 6;
+  MeshObjectVoxelFaces(labels.data(), size, strides, 5,
+                       BoundingBox{{0, 0, 0}, {2, 3, 2}}, &mesh);
+  EXPECT_EQ(2u, mesh.triangles.size());
+  for (const auto& position : mesh.vertex_positions) {
+    EXPECT_EQ(1.5f, position[0]);
+  }
+}
+
+// The enclosed volume of each object is its number of voxels, with the same
+// orientation as the marching cubes surface, and the total area is the number
+// of faces between voxels of different labels.
+TEST(MeshObjectVoxelFacesTest, RandomVolume) {
+  const Vector3d size{13, 11, 9};
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  const auto labels = MakeRandomVolume(size, 3);
+  std::unordered_map<uint64_t, int64_t> voxel_counts, face_counts;
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x) {
+        const int64_t i = x + size[0] * (y + size[1] * z);
+        const uint32_t label = labels[i];
+        ++voxel_counts[label];
+        const int64_t position[3] = {x, y, z};
+        for (int d = 0; d < 3; ++d) {
+          if (position[d] + 1 == size[d]) continue;
+          const uint32_t other = labels[i + strides[d]];
+          if (other != label) {
+            ++face_counts[label];
+            ++face_counts[other];
+          }
+        }
+      }
+    }
+  }
+  const float scale[3] = {1, 1, 1};
+  for (uint64_t object_id = 1; object_id <= 3; ++object_id) {
+    TriangleMesh mesh, marching_cubes_mesh;
+    const BoundingBox box{{1, 1, 1}, {size[0] - 1, size[1] - 1, size[2] - 1}};
+    MeshObjectVoxelFaces(labels.data(), size, strides, object_id, box, &mesh);
+    MeshObject(labels.data(), size, strides, object_id, box,
+               &marching_cubes_mesh);
+    EXPECT_NEAR(voxel_counts[object_id], ComputeSignedVolume(mesh), 1e-6)
+        << "object=" << object_id;
+    EXPECT_GT(ComputeSignedVolume(marching_cubes_mesh), 0)
+        << "object=" << object_id;
+    EXPECT_NEAR(face_counts[object_id], ComputeSurfaceArea(mesh, scale), 1e-6)
+        << "object=" << object_id;
+    EXPECT_LT(static_cast<int64_t>(mesh.triangles.size()),
+              2 * face_counts[object_id]);
+  }
+}
+
+// The result does not depend on the strides or on the bounding box, as long
+// as it contains the object, and equivalences merge labels.
+TEST(MeshObjectVoxelFacesTest, StridesAndEquivalences) {
+  const Vector3d size{10, 8, 12};
+  const Vector3d strides{1, size[0], size[0] * size[1]};
+  const auto labels = MakeRandomVolume(size, 4);
+  std::vector<uint32_t> relabeled(labels.size()), transposed(labels.size());
+  const LabelEquivalences equivalences({{2, 1}, {4, 3}});
+  const Vector3d transposed_strides{size[1] * size[2], size[2], 1};
+  for (int64_t z = 0; z < size[2]; ++z) {
+    for (int64_t y = 0; y < size[1]; ++y) {
+      for (int64_t x = 0; x < size[0]; ++x) {
+        const int64_t i = x + size[0] * (y + size[1] * z);
+        relabeled[i] = static_cast<uint32_t>(equivalences.Find(labels[i]));
+        transposed[x * transposed_strides[0] + y * transposed_strides[1] +
+                   z * transposed_strides[2]] = labels[i];
+      }
+    }
+  }
+  const BoundingBox full_box{{0, 0, 0}, size};
+  const BoundingBox box{{1, 1, 1}, {size[0] - 1, size[1] - 1, size[2] - 1}};
+  TriangleMesh expected, actual;
+  MeshObjectVoxelFaces(labels.data(), size, strides, 2, full_box, &expected);
+  EXPECT_FALSE(expected.triangles.empty());
+  MeshObjectVoxelFaces(transposed.data(), size, transposed_strides, 2, box,
+                       &actual);
+  EXPECT_EQ(expected.vertex_positions, actual.vertex_positions);
+  EXPECT_EQ(expected.triangles, actual.triangles);
+
+  MeshObjectVoxelFaces(relabeled.data(), size, strides, 1, box, &expected);
+  MeshObjectVoxelFaces(labels.data(), size, strides, 1, box, &actual,
+                       &equivalences);
+  EXPECT_FALSE(expected.triangles.empty());
+  EXPECT_EQ(expected.vertex_positions, actual.vertex_positions);
+  EXPECT_EQ(expected.triangles, actual.triangles);
+}
+
+}  // namespace
+}  // namespace meshing
+}  // namespace neuroglancer
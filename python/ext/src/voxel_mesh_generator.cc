@@ -16,6 +16,8 @@
 
 #include "voxel_mesh_generator.h"
 
+#include <algorithm>
+
 namespace neuroglancer {
 namespace meshing {
 namespace voxel_mesh_generator {
@@ -420,6 +422,87 @@ VertexPositionMap::VertexPositionMap(const Vector3d& volume_size)
   }
 }
 
+constexpr uint64_t VertexIndexHashMap::kEmptyKey;
+constexpr uint64_t VertexIndexHashMap::kHashMultiplier;
+constexpr size_t VertexIndexHashMap::kMinSlots;
+
+void VertexIndexHashMap::Reserve(size_t n) {
+  if (n == 0) return;
+  size_t num_slots = kMinSlots;
+  while (num_slots < 2 * n) num_slots *= 2;
+  if (num_slots > slots_.size()) Rehash(num_slots);
+}
+
+void VertexIndexHashMap::Rehash(size_t num_slots) {
+  std::vector<Slot> old_slots(num_slots, Slot{kEmptyKey, 0});
+  old_slots.swap(slots_);
+  shift_ = 64;
+  for (size_t n = num_slots; n > 1; n /= 2) --shift_;
+  const size_t mask = num_slots - 1;
+  for (const Slot& old_slot : old_slots) {
+    if (old_slot.key == kEmptyKey) continue;
+    size_t i = (old_slot.key * kHashMultiplier) >> shift_;
+    while (slots_[i].key != kEmptyKey) i = (i + 1) & mask;
+    slots_[i] = old_slot;
+  }
+}
+
+constexpr VertexIndex SequentialVertexMap::kInvalidVertexIndex;
+constexpr int SequentialVertexMap::kZEdgePlane;
+
+SequentialVertexMap::SequentialVertexMap(const VertexPositionMap& map)
+    : plane_stride_(map.volume_size()[0]) {
+  const size_t plane_size = map.volume_size()[0] * map.volume_size()[1];
+  for (auto& plane : xy_edge_planes_) {
+    plane.assign(plane_size * 2 * 2, kInvalidVertexIndex);
+  }
+  z_edge_plane_.assign(plane_size * 2, kInvalidVertexIndex);
+
+  for (int edge_i = 0; edge_i < 12; ++edge_i) {
+    auto const& corner_index_pair =
+        cube_edge_index_to_corner_index_pair_table[edge_i];
+    const Vector3d& a = cube_corner_position_offsets[corner_index_pair[0]];
+    const Vector3d& b = cube_corner_position_offsets[corner_index_pair[1]];
+    auto& edge = edge_slots_[edge_i];
+    if (a[2] != b[2]) {
+      edge.plane = kZEdgePlane;
+      edge.slot_offset = a[0] + plane_stride_ * a[1];
+    } else {
+      edge.plane = static_cast<int>(a[2]);
+      if (a[0] != b[0]) {
+        // x edge
+        edge.slot_offset = 2 * plane_stride_ * a[1];
+      } else {
+        // y edge
+        edge.slot_offset = 2 * a[0] + 1;
+      }
+    }
+  }
+}
+
+void SequentialVertexMap::AdvanceToSlice(int64_t z) {
+  if (z == current_z_ + 1) {
+    // The upper plane of x and y edges of the previous slice becomes the lower
+    // plane of this slice.
+    auto& plane = xy_edge_planes_[(z + 1) & 1];
+    std::fill(plane.begin(), plane.end(), kInvalidVertexIndex);
+  } else {
+    for (auto& plane : xy_edge_planes_) {
+      std::fill(plane.begin(), plane.end(), kInvalidVertexIndex);
+    }
+  }
+  std::fill(z_edge_plane_.begin(), z_edge_plane_.end(), kInvalidVertexIndex);
+  current_z_ = z;
+}
+
+const int* GetCubeEdgeCornerIndices(int edge_i) {
+  return cube_edge_index_to_corner_index_pair_table[edge_i];
+}
+
+const int* GetCubeTriangleEdges(uint8_t corners_present) {
+  return triangle_table[corners_present];
+}
+
 template <class VertexMap>
 void AddCube(const Vector3d& voxel_position, uint8_t corners_present,
              const VertexPositionMap& map, VertexMap* vertex_map,
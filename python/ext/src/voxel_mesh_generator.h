@@ -21,9 +21,9 @@
 #define NEUROGLANCER_VOXEL_MESH_GENERATOR_H_
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <limits>
-#include <unordered_map>
 #include <vector>
 
 namespace neuroglancer {
@@ -48,6 +48,12 @@ struct TriangleMesh {
     return vertex_positions.size() * sizeof(float) * 3 +
            triangles.size() * sizeof(VertexIndex) * 3;
   }
+
+  // Memory used by the vectors, including unused capacity.
+  size_t num_retained_bytes() const {
+    return vertex_positions.capacity() * sizeof(float) * 3 +
+           triangles.capacity() * sizeof(VertexIndex) * 3;
+  }
 };
 
 namespace voxel_mesh_generator {
@@ -123,26 +129,23 @@ class VertexPositionMap {
       cube_edge_midpoint_vertex_position_offsets_;
 };
 
-// This class maintains a mapping from vertex linear positions to
-// vertex indices for multiple VertexPositions objects, each
-// corresponding to distinct label values.  This can only be used when
-// successive calls have non-decreasing values of
-// base_linear_position.  Use the less efficient HashedVertexMap when
-// that constraint can't be satisfied.
+// This class maintains a mapping from cube edges to vertex indices for
+// multiple VertexPositions objects, each corresponding to distinct label
+// values.  This can only be used when successive calls have non-decreasing
+// values of base_voxel_position[2].  Use the less efficient HashedVertexMap
+// when that constraint can't be satisfied.
+//
+// Since a cube only shares vertices with cubes in the same or adjacent z slice,
+// only the edges of the current slice of cubes are retained: two z planes of
+// x and y edges, and one plane of z edges.  Memory usage is therefore
+// 40 * volume_size[0] * volume_size[1] bytes.
 class SequentialVertexMap {
  public:
-  SequentialVertexMap(const VertexPositionMap& map) {
-    size_t buffer_size =
-        map.volume_size()[0] * 2 * map.volume_size()[1] * 2 * 2 * 2;
-    size_t buffer_size_power_of_two = 1;
-    while (buffer_size_power_of_two < buffer_size) {
-      buffer_size_power_of_two *= 2;
-    }
-    vertex_index_.resize(buffer_size_power_of_two,
-                         {{0, 0},
-                          {std::numeric_limits<VertexLinearPosition>::max(),
-                           std::numeric_limits<VertexLinearPosition>::max()}});
-    linear_position_mask_ = buffer_size_power_of_two - 1;
+  explicit SequentialVertexMap(const VertexPositionMap& map);
+
+  // Returns the memory used by the edge planes of a map for `volume_size`.
+  static size_t GetNumBytes(const Vector3d& volume_size) {
+    return volume_size[0] * volume_size[1] * 10 * sizeof(VertexIndex);
   }
 
   // Selector specifies the presence of the first corner of the edge
@@ -153,36 +156,133 @@ class SequentialVertexMap {
                          VertexLinearPosition base_vertex_linear_position,
                          const Vector3d& base_voxel_position, int edge_i,
                          int selector, VertexPositions* vertex_positions) {
-    VertexLinearPosition edge_midpoint_vertex_linear_position =
-        base_vertex_linear_position +
-        map.GetCubeEdgeMidpointVertexLinearPositionOffset(edge_i);
+    if (base_voxel_position[2] != current_z_) {
+      AdvanceToSlice(base_voxel_position[2]);
+    }
+    const EdgeSlot& edge = edge_slots_[edge_i];
+    const size_t base_slot =
+        base_voxel_position[0] + plane_stride_ * base_voxel_position[1];
+    VertexIndex* plane;
+    size_t slot;
+    if (edge.plane == kZEdgePlane) {
+      plane = z_edge_plane_.data();
+      slot = base_slot;
+    } else {
+      plane = xy_edge_planes_[(current_z_ + edge.plane) & 1].data();
+      slot = 2 * base_slot;
+    }
+    VertexIndex& vertex_index = plane[2 * (slot + edge.slot_offset) + selector];
+    if (vertex_index != kInvalidVertexIndex) {
+      return vertex_index;
+    }
+    vertex_index = static_cast<VertexIndex>(vertex_positions->size());
+    vertex_positions->push_back(
+        map.GetEdgeMidpointVertexPosition(base_voxel_position, edge_i));
+    return vertex_index;
+  }
+
+ private:
+  static constexpr VertexIndex kInvalidVertexIndex =
+      std::numeric_limits<VertexIndex>::max();
+
+  // Values of EdgeSlot::plane.  The x and y edges of a cube lie either in the
+  // plane of its lower z face (0) or of its upper z face (1).
+  static constexpr int kZEdgePlane = 2;
+
+  struct EdgeSlot {
+    int plane;
+    // Offset of the edge slot relative to the slot of the cube origin.
+    size_t slot_offset;
+  };
+
+  // Discards the edges that are not shared with cubes in slice `z`.
+  void AdvanceToSlice(int64_t z);
+
+  int64_t current_z_ = -2;
+  size_t plane_stride_;
+  std::array<EdgeSlot, 12> edge_slots_;
+  // Planes of x and y edges at even and odd voxel z coordinates.  Each voxel
+  // position has an x edge slot followed by a y edge slot, and each slot holds
+  // a vertex index per selector value.
+  std::array<std::vector<VertexIndex>, 2> xy_edge_planes_;
+  // Plane of z edges for the current slice, with one slot per voxel position.
+  std::vector<VertexIndex> z_edge_plane_;
+};
 
-    auto& p = vertex_index_[edge_midpoint_vertex_linear_position &
-                            linear_position_mask_];
-    if (p.second[selector] == edge_midpoint_vertex_linear_position) {
-      return p.first[selector];
+// Hash map from 64-bit keys to vertex indices, using open addressing with
+// linear probing.  Entries are stored inline in a single array whose size is a
+// power of two, which avoids the per-entry allocation and pointer chasing of
+// std::unordered_map.  The key kEmptyKey is reserved.
+class VertexIndexHashMap {
+ public:
+  static constexpr uint64_t kEmptyKey = std::numeric_limits<uint64_t>::max();
+
+  explicit VertexIndexHashMap(size_t expected_size = 0) {
+    Reserve(expected_size);
+  }
+
+  // Ensures that `n` entries can be stored without rehashing.
+  void Reserve(size_t n);
+
+  // Returns the value of `key`, inserting `value` if `key` is not present.
+  // Sets `*inserted` to whether `value` was inserted.
+  VertexIndex FindOrInsert(uint64_t key, VertexIndex value, bool* inserted) {
+    if (2 * (size_ + 1) > slots_.size()) {
+      Rehash(slots_.empty() ? kMinSlots : 2 * slots_.size());
+    }
+    for (size_t i = (key * kHashMultiplier) >> shift_;;
+         i = (i + 1) & (slots_.size() - 1)) {
+      Slot& slot = slots_[i];
+      if (slot.key == key) {
+        *inserted = false;
+        return slot.value;
+      }
+      if (slot.key == kEmptyKey) {
+        slot.key = key;
+        slot.value = value;
+        ++size_;
+        *inserted = true;
+        return value;
+      }
     }
-    p.second[selector] = edge_midpoint_vertex_linear_position;
-    VertexIndex edge_midpoint_vertex_index = p.first[selector] =
-        static_cast<VertexIndex>(vertex_positions->size());
-    auto edge_midpoint_vertex_position =
-        map.GetEdgeMidpointVertexPosition(base_voxel_position, edge_i);
-    vertex_positions->push_back(edge_midpoint_vertex_position);
-    return edge_midpoint_vertex_index;
+  }
+
+  size_t size() const { return size_; }
+
+  void clear() {
+    slots_.clear();
+    size_ = 0;
   }
 
  private:
-  std::vector<std::pair<std::array<VertexIndex, 2>,
-                        std::array<VertexLinearPosition, 2>>>
-      vertex_index_;
-  VertexLinearPosition linear_position_mask_;
+  // Fibonacci hashing: the high bits of the product index the slots.
+  static constexpr uint64_t kHashMultiplier = 0x9e3779b97f4a7c15ull;
+  static constexpr size_t kMinSlots = 16;
+
+  struct Slot {
+    uint64_t key;
+    VertexIndex value;
+  };
+
+  // Reinserts the entries into `num_slots` slots, a power of two.
+  void Rehash(size_t num_slots);
+
+  // At most half of the slots are occupied.
+  std::vector<Slot> slots_;
+  size_t size_ = 0;
+  int shift_ = 64;
 };
 
 // This class maintains a mapping from vertex linear positions to
 // vertex indices within a VertexPositions object.  The mapping is
-// maintained using an unordered_map for full generality.
+// maintained using a VertexIndexHashMap for full generality.
 class HashedVertexMap {
  public:
+  // `expected_num_vertices` may be estimated from the number of boundary
+  // cubes of the objects, each of which produces about one vertex.
+  explicit HashedVertexMap(size_t expected_num_vertices = 0)
+      : vertex_index_(expected_num_vertices) {}
+
   VertexIndex operator()(const VertexPositionMap& map,
                          VertexLinearPosition base_vertex_linear_position,
                          const Vector3d& base_voxel_position, int edge_i,
@@ -194,31 +294,34 @@ class HashedVertexMap {
     VertexLinearPosition key =
         edge_midpoint_vertex_linear_position * 2 + selector;
 
-    auto it = vertex_index_.find(key);
-    if (it != vertex_index_.end()) {
-      return it->second;
+    bool inserted;
+    VertexIndex edge_midpoint_vertex_index = vertex_index_.FindOrInsert(
+        key, static_cast<VertexIndex>(vertex_positions->size()), &inserted);
+    if (inserted) {
+      vertex_positions->push_back(
+          map.GetEdgeMidpointVertexPosition(base_voxel_position, edge_i));
     }
-    VertexIndex edge_midpoint_vertex_index =
-        static_cast<VertexIndex>(vertex_index_.size());
-    vertex_index_.emplace(key, edge_midpoint_vertex_index);
-    auto edge_midpoint_vertex_position =
-        map.GetEdgeMidpointVertexPosition(base_voxel_position, edge_i);
-    vertex_positions->push_back(edge_midpoint_vertex_position);
     return edge_midpoint_vertex_index;
   }
 
-  const std::unordered_map<VertexLinearPosition, VertexIndex>& vertex_index()
-      const {
-    return vertex_index_;
-  }
-  std::unordered_map<VertexLinearPosition, VertexIndex>& vertex_index() {
-    return vertex_index_;
+  void Reserve(size_t expected_num_vertices) {
+    vertex_index_.Reserve(expected_num_vertices);
   }
 
  private:
-  std::unordered_map<VertexLinearPosition, VertexIndex> vertex_index_;
+  VertexIndexHashMap vertex_index_;
 };
 
+// Returns the indices, as used by cube_corner_position_offsets, of the two
+// corners of cube edge `edge_i` in [0, 12).  The first corner is the one with
+// the lower position.
+const int* GetCubeEdgeCornerIndices(int edge_i);
+
+// Returns the cube edge indices of the vertices of the triangles that AddCube
+// produces for `corners_present`, three per triangle and terminated by -1.
+// AddCube outputs the vertices of each triangle in the reverse order.
+const int* GetCubeTriangleEdges(uint8_t corners_present);
+
 // Processes a cube that correspond to the 2*2*2 block of voxels at voxel
 // positions [position, position+1].
 //
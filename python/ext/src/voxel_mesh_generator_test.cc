@@ -0,0 +1,104 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "voxel_mesh_generator.h"
+
+#include <map>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace meshing {
+namespace voxel_mesh_generator {
+namespace {
+
+TEST(VertexIndexHashMapTest, FindOrInsert) {
+  std::mt19937_64 generator(1);
+  std::map<uint64_t, VertexIndex> expected;
+  VertexIndexHashMap map;
+  for (VertexIndex i = 0; i < 10000; ++i) {
+    // Few distinct keys, so that many are inserted more than once.
+    const uint64_t key = generator() % 5000 * 0x100000001ull;
+    bool inserted;
+    const VertexIndex value = map.FindOrInsert(key, i, &inserted);
+    auto p = expected.emplace(key, i);
+    EXPECT_EQ(p.second, inserted);
+    EXPECT_EQ(p.first->second, value);
+  }
+  EXPECT_EQ(expected.size(), map.size());
+  map.Reserve(100000);
+  for (const auto& p : expected) {
+    bool inserted;
+    EXPECT_EQ(p.second, map.FindOrInsert(p.first, 0, &inserted));
+    EXPECT_FALSE(inserted);
+  }
+  map.clear();
+  EXPECT_EQ(0u, map.size());
+  bool inserted;
+  EXPECT_EQ(7u, map.FindOrInsert(0, 7, &inserted));
+  EXPECT_TRUE(inserted);
+}
+
+// Adds the cubes of a random volume of labels 0 and 1, in increasing z order,
+// to the mesh of label 1.
+template <class VertexMap>
+TriangleMesh MeshRandomVolume(const Vector3d& size, VertexMap* vertex_map) {
+  std::mt19937 generator(2);
+  std::vector<uint8_t> labels(size[0] * size[1] * size[2]);
+  for (auto& label : labels) label = generator() % 3 == 0;
+  const VertexPositionMap map(size);
+  TriangleMesh mesh;
+  Vector3d position;
+  for (position[2] = 0; position[2] + 1 < size[2]; ++position[2]) {
+    for (position[1] = 0; position[1] + 1 < size[1]; ++position[1]) {
+      for (position[0] = 0; position[0] + 1 < size[0]; ++position[0]) {
+        uint8_t corners_present = 0;
+        for (int i = 0; i < 8; ++i) {
+          const auto& offset = cube_corner_position_offsets[i];
+          const int64_t x = position[0] + offset[0];
+          const int64_t y = position[1] + offset[1];
+          const int64_t z = position[2] + offset[2];
+          if (labels[x + size[0] * (y + size[1] * z)]) {
+            corners_present |= 1 << i;
+          }
+        }
+        AddCube(position, corners_present, map, vertex_map, &mesh);
+      }
+    }
+  }
+  return mesh;
+}
+
+TEST(HashedVertexMapTest, MatchesSequentialVertexMap) {
+  const Vector3d size{9, 7, 6};
+  SequentialVertexMap sequential_vertex_map((VertexPositionMap(size)));
+  const TriangleMesh expected =
+      MeshRandomVolume(size, &sequential_vertex_map);
+  ASSERT_FALSE(expected.triangles.empty());
+  for (size_t expected_num_vertices : {0, 1000}) {
+    HashedVertexMap hashed_vertex_map(expected_num_vertices);
+    const TriangleMesh actual = MeshRandomVolume(size, &hashed_vertex_map);
+    EXPECT_EQ(expected.vertex_positions, actual.vertex_positions);
+    EXPECT_EQ(expected.triangles, actual.triangles);
+  }
+}
+
+}  // namespace
+}  // namespace voxel_mesh_generator
+}  // namespace meshing
+}  // namespace neuroglancer
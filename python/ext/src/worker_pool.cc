@@ -0,0 +1,72 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "parallel_for.h"
+
+namespace neuroglancer {
+
+WorkerPool::WorkerPool(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this] { RunTasks(); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_queued_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkerPool::Schedule(int priority, std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push(Task{priority, next_sequence_++, std::move(task)});
+  }
+  task_queued_.notify_one();
+}
+
+void WorkerPool::RunTasks() {
+  ThreadBudgetScope budget_scope(1);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    task_queued_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+    if (tasks_.empty()) return;
+    // The top of a priority_queue is const, so the function is copied rather
+    // than moved out.
+    std::function<void()> fn = tasks_.top().fn;
+    tasks_.pop();
+    lock.unlock();
+    fn();
+    // Release anything captured by the task before waiting for the next one.
+    fn = nullptr;
+    lock.lock();
+  }
+}
+
+}  // namespace neuroglancer
@@ -0,0 +1,84 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEUROGLANCER_WORKER_POOL_H_
+#define NEUROGLANCER_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace neuroglancer {
+
+// Fixed set of threads that run scheduled tasks asynchronously, in order of
+// decreasing priority, and in the order scheduled among tasks of equal
+// priority.
+//
+// Unlike ParallelFor, the caller does not wait for the tasks, so that long
+// computations such as mesh simplification do not tie up the threads that
+// request them.  Since the tasks of concurrent requests already occupy the
+// threads, the ParallelFor calls made by a task run on its thread alone (see
+// ThreadBudgetScope).
+class WorkerPool {
+ public:
+  // Starts `num_threads` threads, or one per hardware thread if 0.
+  explicit WorkerPool(int num_threads = 0);
+
+  // Runs the tasks that are still queued, then stops the threads.
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // Queues `task` to be run by one of the threads.
+  void Schedule(int priority, std::function<void()> task);
+
+  int num_threads() const { return static_cast<int>(threads_.size()); }
+
+ private:
+  struct Task {
+    int priority;
+    // Order in which the task was scheduled.
+    uint64_t sequence;
+    std::function<void()> fn;
+  };
+
+  // Orders the queue so that the top is the task to run next.
+  struct RunsLater {
+    bool operator()(const Task& a, const Task& b) const {
+      if (a.priority != b.priority) return a.priority < b.priority;
+      return a.sequence > b.sequence;
+    }
+  };
+
+  void RunTasks();
+
+  std::mutex mutex_;
+  // Notified when a task is queued or the pool is stopping.
+  std::condition_variable task_queued_;
+  std::priority_queue<Task, std::vector<Task>, RunsLater> tasks_;
+  uint64_t next_sequence_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_WORKER_POOL_H_
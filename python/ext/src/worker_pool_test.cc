@@ -0,0 +1,91 @@
+/**
+ * @license
+ * Copyright 2016 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "worker_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "parallel_for.h"
+
+namespace neuroglancer {
+namespace {
+
+TEST(WorkerPoolTest, RunsInPriorityOrder) {
+  std::vector<int> order;
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool started = false, release = false;
+  {
+    WorkerPool pool(1);
+    // Block the only thread until all other tasks are queued.
+    pool.Schedule(0, [&] {
+      std::unique_lock<std::mutex> lock(mutex);
+      started = true;
+      changed.notify_all();
+      changed.wait(lock, [&] { return release; });
+    });
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [&] { return started; });
+    }
+    pool.Schedule(1, [&] { order.push_back(1); });
+    pool.Schedule(5, [&] { order.push_back(5); });
+    pool.Schedule(1, [&] { order.push_back(2); });
+    pool.Schedule(-3, [&] { order.push_back(-3); });
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      release = true;
+    }
+    changed.notify_all();
+    // The destructor runs the queued tasks.
+  }
+  EXPECT_EQ(std::vector<int>({5, 1, 2, -3}), order);
+}
+
+TEST(WorkerPoolTest, ManyThreads) {
+  std::atomic<int> count(0);
+  {
+    WorkerPool pool(4);
+    EXPECT_EQ(4, pool.num_threads());
+    for (int i = 0; i < 1000; ++i) {
+      pool.Schedule(i % 7, [&] { ++count; });
+    }
+  }
+  EXPECT_EQ(1000, count.load());
+}
+
+TEST(WorkerPoolTest, ParallelForRunsOnTaskThread) {
+  std::vector<std::thread::id> thread_ids(8);
+  std::thread::id task_thread_id;
+  {
+    WorkerPool pool(2);
+    pool.Schedule(0, [&] {
+      task_thread_id = std::this_thread::get_id();
+      ParallelFor(thread_ids.size(), 4, [&](size_t i) {
+        thread_ids[i] = std::this_thread::get_id();
+      });
+    });
+  }
+  for (const auto& id : thread_ids) EXPECT_EQ(task_thread_id, id);
+}
+
+}  // namespace
+}  // namespace neuroglancer
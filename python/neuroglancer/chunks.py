@@ -37,3 +37,152 @@ def encode_npz(subvol):
 
 def encode_raw(subvol):
     return subvol.tostring('C')
+
+
+# Block size of the compressed_segmentation encoding of served chunks.
+COMPRESSED_SEGMENTATION_BLOCK_SIZE = (8, 8, 8)
+
+
+def encode_compressed_segmentation(subvol, block_size=COMPRESSED_SEGMENTATION_BLOCK_SIZE,
+                                   num_threads=1, out=None, share_tables=False):
+    """Encodes a 3-d or 4-d 8-, 16-, 32- or 64-bit integer array in the compressed_segmentation
+    format.  8- and 16-bit arrays are read directly and encoded as if widened to uint32.
+
+    The dimensions of `subvol` are taken in the order x, y, z[, channel], which matches the
+    Fortran-order chunks returned by `encode_npz`.  Blocks are encoded using `num_threads` threads,
+    or the number of hardware threads if 0, which does not affect the output.
+
+    The exact size of the encoding is determined before it is written, so it is written directly
+    into the returned bytes object.  If `out` is a writable buffer, such as a numpy array or
+    bytearray, the encoding is instead written to its start and the number of bytes written is
+    returned; ValueError is raised if it is too small.
+
+    If `share_tables` is true, a value table used by blocks of several channels is written only
+    once, in the last of those channels, and referenced from earlier channels by an offset beyond
+    their end.  This is valid for decoders, such as the Neuroglancer client, that read each channel
+    from the full chunk.
+    """
+    from . import _neuroglancer
+    return _neuroglancer.compress_segmentation(subvol, block_size, num_threads=num_threads,
+                                               out=out, share_tables=share_tables)
+
+
+# Block sizes among which `choose_compressed_segmentation_block_size` chooses by default.
+COMPRESSED_SEGMENTATION_BLOCK_SIZE_CANDIDATES = ((8, 8, 8), (4, 4, 4), (16, 16, 16))
+
+
+def choose_compressed_segmentation_block_size(
+        subvol, chunk_size, candidates=COMPRESSED_SEGMENTATION_BLOCK_SIZE_CANDIDATES,
+        max_samples=16, num_threads=1):
+    """Returns the block size among `candidates` with which chunks of `chunk_size` of the 3-d
+    (x, y, z) integer array `subvol` encode most compactly in the compressed_segmentation format.
+
+    Sparse labels favor larger blocks, which need fewer headers, and dense labels smaller blocks,
+    which need fewer bits per value.  Since the block size is recorded once per volume scale, a
+    single size is chosen by encoding up to `max_samples` evenly spaced chunks with each candidate;
+    ties favor earlier candidates.
+    """
+    from . import _neuroglancer
+    candidates = [tuple(int(x) for x in c) for c in candidates]
+    index = _neuroglancer.choose_compressed_segmentation_block_size(
+        subvol, tuple(int(x) for x in chunk_size), candidates, max_samples=max_samples,
+        num_threads=num_threads)
+    return candidates[index]
+
+
+def decode_compressed_segmentation(data, shape, dtype,
+                                   block_size=COMPRESSED_SEGMENTATION_BLOCK_SIZE, start=None,
+                                   end=None):
+    """Decodes compressed_segmentation data of a 3-d or 4-d volume.
+
+    `shape` gives the (x, y, z[, channel]) size of the encoded volume, and the result is a
+    Fortran-order array with the same number of dimensions.  If `start` and `end` (x, y, z) are
+    specified, only that box of each channel is decoded, reading just the blocks that intersect
+    it.
+    """
+    from . import _neuroglancer
+    volume_size = tuple(shape) + (1, ) * (4 - len(shape))
+    result = _neuroglancer.decompress_segmentation(
+        data, volume_size, np.dtype(dtype), block_size,
+        start=None if start is None else tuple(start),
+        end=None if end is None else tuple(end))
+    if len(shape) == 3:
+        result = result[..., 0]
+    return result
+
+
+def compressed_segmentation_label_counts(data, shape, dtype,
+                                         block_size=COMPRESSED_SEGMENTATION_BLOCK_SIZE):
+    """Returns the distinct labels of compressed_segmentation data of a 3-d or 4-d volume, in
+    increasing order, and the number of voxels of each, as `np.unique(..., return_counts=True)`
+    would for the decoded volume.
+
+    Only the block tables and a histogram of the encoded indices of each block with more than one
+    label are read, which is much faster than decoding.
+    """
+    from . import _neuroglancer
+    volume_size = tuple(shape) + (1, ) * (4 - len(shape))
+    return _neuroglancer.compressed_segmentation_label_counts(data, volume_size, np.dtype(dtype),
+                                                              block_size)
+
+
+def relabel_compressed_segmentation(data, shape, dtype, mapping,
+                                    block_size=COMPRESSED_SEGMENTATION_BLOCK_SIZE):
+    """Returns compressed_segmentation data of a 3-d or 4-d volume with each label that is a key of
+    `mapping` replaced by its value.
+
+    Labels are stored only in the value tables of the blocks, so only the tables are rewritten;
+    the encoded values of a block are re-encoded only if the mapping merges labels within it.
+    This is much cheaper than decoding, relabeling and re-encoding the volume.
+    """
+    from . import _neuroglancer
+    volume_size = tuple(shape) + (1, ) * (4 - len(shape))
+    mapping = {int(k): int(v) for k, v in mapping.items()}
+    return _neuroglancer.relabel_compressed_segmentation(data, volume_size, np.dtype(dtype),
+                                                         block_size, mapping)
+
+
+def update_compressed_segmentation(data, labels, start, end,
+                                   block_size=COMPRESSED_SEGMENTATION_BLOCK_SIZE, compact=False):
+    """Returns compressed_segmentation `data` of the 3-d or 4-d (x, y, z[, channel]) 32- or 64-bit
+    integer array `labels`, whose labels outside the (x, y, z) box [`start`, `end`) are unchanged.
+
+    Only the blocks intersecting the box are re-encoded; they are appended to each channel and
+    their headers rewritten, leaving the data of the replaced blocks unreferenced.  If `compact`
+    is true, that data is removed and the result equals `encode_compressed_segmentation(labels)`.
+    """
+    from . import _neuroglancer
+    return _neuroglancer.update_compressed_segmentation(
+        data, labels, block_size, tuple(int(x) for x in start), tuple(int(x) for x in end),
+        compact=compact)
+
+
+def downsample_compressed_segmentation(data, shape, dtype, factor,
+                                       block_size=COMPRESSED_SEGMENTATION_BLOCK_SIZE,
+                                       num_threads=1):
+    """Downsamples compressed_segmentation data of a 3-d or 4-d volume by the (x, y, z) `factor`,
+    taking the most frequent label of each window, and returns the encoding of the result, of shape
+    ceil(shape / factor), with the same block size.
+
+    The result equals that of decoding, mode downsampling and re-encoding, but if `block_size` is
+    a multiple of `factor`, blocks with a single label are not decoded.
+    """
+    from . import _neuroglancer
+    volume_size = tuple(shape) + (1, ) * (4 - len(shape))
+    return _neuroglancer.downsample_compressed_segmentation(
+        data, volume_size, np.dtype(dtype), block_size, tuple(int(x) for x in factor),
+        num_threads=num_threads)
+
+
+def read_compressed_segmentation_value(data, shape, dtype, position,
+                                       block_size=COMPRESSED_SEGMENTATION_BLOCK_SIZE):
+    """Returns the value at the (x, y, z[, channel]) `position` of compressed_segmentation data.
+
+    Only the header of the containing block, one word of its encoded values, and one table entry
+    are read.
+    """
+    from . import _neuroglancer
+    volume_size = tuple(shape) + (1, ) * (4 - len(shape))
+    position = tuple(position) + (0, ) * (4 - len(position))
+    return _neuroglancer.read_compressed_segmentation_value(data, volume_size, np.dtype(dtype),
+                                                            block_size, position)
@@ -19,11 +19,42 @@ import math
 import numpy as np
 
 
+# Data types supported by the `downsample` function of the C extension module, by method.
+_NATIVE_DTYPES = {
+    'average': frozenset(np.dtype(t) for t in ('int8', 'uint8', 'int16', 'uint16', 'int32',
+                                               'uint32', 'int64', 'uint64', 'float32',
+                                               'float64')),
+    'mode': frozenset(np.dtype(t) for t in ('int8', 'uint8', 'int16', 'uint16', 'int32',
+                                            'uint32', 'int64', 'uint64')),
+}
+
+
+def _native_downsample(array, factor, method):
+    """Downsamples with the C extension module.
+
+    @return: The downsampled array, or None if the extension module is unavailable or does not
+        support the data type.
+    """
+    array = np.asarray(array)
+    if array.dtype.newbyteorder('=') not in _NATIVE_DTYPES[method]:
+        return None
+    try:
+        from . import _neuroglancer
+    except ImportError:
+        return None
+    return _neuroglancer.downsample(array, tuple(int(f) for f in factor), method=method)
+
+
 def downsample_with_averaging(array, factor):
     """Downsample x by factor using averaging.
 
+    Uses the C extension module if available, in which case integer means are rounded toward zero.
+
     @return: The downsampled array, of the same type as x.
     """
+    result = _native_downsample(array, factor, 'average')
+    if result is not None:
+        return result
     factor = tuple(factor)
     output_shape = tuple(int(math.ceil(s / f)) for s, f in zip(array.shape, factor))
     temp = np.zeros(output_shape, dtype=np.float32)
@@ -42,3 +73,23 @@ def downsample_with_striding(array, factor):
     @return: The downsampled array, of the same type as x.
     """
     return array[tuple(np.s_[::f] for f in factor)]
+
+
+def downsample_with_mode(array, factor):
+    """Downsample x by factor using the most frequent value of each window, as is appropriate for
+    segmentation labels.  Ties are broken in favor of the value that occurs first in the window, in
+    C order.
+
+    @return: The downsampled array, of the same type as x.
+    """
+    result = _native_downsample(array, factor, 'mode')
+    if result is not None:
+        return result
+    factor = tuple(factor)
+    output_shape = tuple(int(math.ceil(s / f)) for s, f in zip(array.shape, factor))
+    output = np.empty(output_shape, dtype=array.dtype)
+    for index in np.ndindex(output_shape):
+        window = array[tuple(np.s_[i * f:(i + 1) * f] for i, f in zip(index, factor))]
+        values, first, counts = np.unique(window.ravel(), return_index=True, return_counts=True)
+        output[index] = values[np.lexsort((first, -counts))[0]]
+    return output
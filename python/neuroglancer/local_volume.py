@@ -15,19 +15,33 @@
 from __future__ import absolute_import, division, print_function
 
 import collections
+import concurrent.futures
+import json
 import math
+import os
 import threading
 
 import numpy as np
 import six
 
-from . import downsample, downsample_scales
-from .chunks import encode_jpeg, encode_npz, encode_raw
+from . import downsample, downsample_scales, mesh_request_trace
+from .chunks import (COMPRESSED_SEGMENTATION_BLOCK_SIZE,
+                     choose_compressed_segmentation_block_size, encode_compressed_segmentation,
+                     encode_jpeg, encode_npz, encode_raw)
 from .coordinate_space import CoordinateSpace
+from . import skeleton
 from . import trackable_state
 from .random_token import make_random_token
 
 
+# Default maximum total size of the encoded chunks cached by each `LocalVolume`.
+DEFAULT_MAX_CHUNK_CACHE_BYTES = 64 * 1024 * 1024
+
+# Default number of unsimplified triangles of the fragments of
+# `LocalVolume.request_object_mesh_fragments`.
+DEFAULT_MESH_FRAGMENT_TRIANGLES = 1 << 17
+
+
 class MeshImplementationNotAvailable(Exception):
     pass
 
@@ -37,6 +51,104 @@ class MeshesNotSupportedForVolume(Exception):
 class InvalidObjectIdForMesh(Exception):
     pass
 
+def set_default_mesh_num_threads(num_threads):
+    """Sets the number of threads used to compute meshes for volumes whose `mesh_options` do not
+    specify `num_threads`, or 0 (the initial default) to use the number of hardware threads."""
+    try:
+        from . import _neuroglancer
+    except ImportError:
+        raise MeshImplementationNotAvailable()
+    _neuroglancer.set_default_mesh_num_threads(num_threads)
+
+
+def set_shared_mesh_store_bytes(max_bytes):
+    """Sets the maximum total encoded size of a process-wide store of simplified meshes shared by
+    all volumes, or 0 (the initial default) to disable it.
+
+    Meshes are stored by a hash of the unsimplified surface of each object and of the mesh options,
+    so after `LocalVolume.invalidate`, the objects whose surfaces did not change are served from
+    the store rather than simplified again.  The least recently used meshes are evicted once
+    `max_bytes` is exceeded.
+    """
+    try:
+        from . import _neuroglancer
+    except ImportError:
+        raise MeshImplementationNotAvailable()
+    _neuroglancer.set_shared_mesh_store_bytes(max_bytes)
+
+
+def gzip_available():
+    """Returns whether meshes and chunks can be served compressed in the gzip format, which
+    requires the C extension module built with zlib."""
+    try:
+        from . import _neuroglancer
+    except ImportError:
+        return False
+    return _neuroglancer.have_gzip()
+
+
+def set_shared_mesh_segment(path, max_bytes=256 * 1024 * 1024):
+    """Attaches this process to a cache of simplified meshes in a shared memory segment backed by
+    the file `path`, e.g. in /dev/shm, which is created with a total size of `max_bytes` if it does
+    not exist, or detaches it if `path` is None.
+
+    All processes attached to the same file, e.g. several servers behind a load balancer, reuse the
+    meshes simplified by any of them.  Meshes are keyed like those of the store enabled by
+    `set_shared_mesh_store_bytes`, which is consulted first, and are counted as 'shared_hits' by
+    `LocalVolume.get_mesh_cache_statistics`.  Lookups and insertions are lock-free, and the oldest
+    meshes are overwritten once the segment is full.  Not supported on Windows.
+    """
+    try:
+        from . import _neuroglancer
+    except ImportError:
+        raise MeshImplementationNotAvailable()
+    _neuroglancer.set_shared_mesh_segment(path, max_bytes)
+
+
+def release_free_memory():
+    """Returns memory freed by this process, e.g. by meshes released by
+    `LocalVolume.release_unsimplified_meshes`, to the operating system, so that the resident size
+    of a server that holds several volumes reflects the memory they actually retain.
+
+    Only supported with glibc.  Returns whether any memory was returned.
+    """
+    try:
+        from . import _neuroglancer
+    except ImportError:
+        raise MeshImplementationNotAvailable()
+    return _neuroglancer.release_free_memory()
+
+
+def set_native_tracing_enabled(enabled):
+    """Starts or stops recording trace spans of the native meshing and encoding code: marching
+    cubes slabs, conversion, simplification and encoding of each object's meshes, compression of
+    compressed_segmentation chunks, and Draco encoding.
+
+    Spans are tagged with the object id, as a string, and a size, e.g. the number of triangles,
+    and are kept in a ring buffer per thread, so only the latest spans of each thread are
+    retained.  Retrieve them with `get_native_trace`.
+    """
+    try:
+        from . import _neuroglancer
+    except ImportError:
+        raise MeshImplementationNotAvailable()
+    _neuroglancer.set_tracing_enabled(enabled)
+
+
+def get_native_trace(clear=False):
+    """Returns the trace spans recorded since `set_native_tracing_enabled` was called, as a JSON
+    string in the Chrome trace event format, which chrome://tracing and https://ui.perfetto.dev
+    display as a timeline of the threads.  If `clear`, the returned spans are discarded.
+
+    Timestamps are in microseconds of the monotonic clock, i.e. `time.monotonic()` on Linux.
+    """
+    try:
+        from . import _neuroglancer
+    except ImportError:
+        raise MeshImplementationNotAvailable()
+    return _neuroglancer.get_chrome_trace(clear=clear)
+
+
 class LocalVolume(trackable_state.ChangeNotifier):
     def __init__(self,
                  data,
@@ -50,7 +162,9 @@ class LocalVolume(trackable_state.ChangeNotifier):
                  chunk_layout=None,
                  max_downsampling=downsample_scales.DEFAULT_MAX_DOWNSAMPLING,
                  max_downsampled_size=downsample_scales.DEFAULT_MAX_DOWNSAMPLED_SIZE,
-                 max_downsampling_scales=downsample_scales.DEFAULT_MAX_DOWNSAMPLING_SCALES):
+                 max_downsampling_scales=downsample_scales.DEFAULT_MAX_DOWNSAMPLING_SCALES,
+                 segmentation_downsampling='striding',
+                 max_chunk_cache_bytes=DEFAULT_MAX_CHUNK_CACHE_BYTES):
         """Initializes a LocalVolume.
 
         @param data: Source data.
@@ -61,11 +175,26 @@ class LocalVolume(trackable_state.ChangeNotifier):
         @param max_downsampling: Maximum amount by which on-the-fly downsampling may reduce the
             volume of a chunk.  For example, 4x4x4 downsampling reduces the volume by 64.
 
+        @param segmentation_downsampling: Method by which 'segmentation' volumes are downsampled:
+            'striding', to take the first voxel of each window, or 'mode', to take the most frequent
+            label, which preserves small objects better at the cost of more computation.  'image'
+            volumes are always downsampled by averaging.
+
+        @param max_chunk_cache_bytes: Maximum total size of the encoded chunks served by
+            `get_encoded_subvolume` that are cached, so that repeated requests, e.g. when panning
+            back and forth, are not sliced, downsampled and encoded again.  The least recently used
+            chunks are evicted first, and `invalidate` removes the chunks of the modified region.
+            0 disables the cache, which also requires the C extension module.
+
         @param volume_type: either 'image' or 'segmentation'.  If not specified, guessed from the
             data type.
 
         @param voxel_size: Sequence [x, y, z] of floats.  Specifies the voxel size.
 
+        @param encoding: Format in which chunks are served: 'npz', 'raw', 'jpeg', or
+            'compressed_segmentation'.  'compressed_segmentation' requires uint32 or uint64 data
+            of rank 3, or of rank 4 with the channel dimension last, and the C extension module.
+
         @param mesh_options: A dict with the following keys specifying options for mesh
             simplification for 'segmentation' volumes:
 
@@ -80,6 +209,135 @@ class LocalVolume(trackable_state.ChangeNotifier):
 
                 - lock_boundary_vertices: bool.  Retain all vertices along mesh surface boundaries,
                   which can only occur at the boundary of the volume.  Defaults to true.
+
+                - num_lods: int.  Number of levels of detail to generate for each object.  Level 0
+                  is simplified according to `max_quadrics_error`, and each subsequent level is
+                  derived by further simplifying the previous level with the maximum quadrics error
+                  multiplied by `lod_quadrics_error_factor`.  Defaults to 1.
+
+                - lod_quadrics_error_factor: float.  Defaults to 4.
+
+                - lazy: bool.  Compute the surface of each object only when its mesh is first
+                  requested, by marching over just its bounding box, rather than computing the
+                  surfaces of all objects up front.  The volume data must not be modified without
+                  calling `invalidate`.  Defaults to false.
+
+                - block_size: sequence of 3 ints.  Mesh the volume in blocks of this many voxels
+                  along each dimension, merging the per-block surfaces, which bounds the working set
+                  when `data` is, for example, a memory-mapped array much larger than RAM.  Ignored
+                  if `lazy` is true.  Defaults to meshing the whole volume at once.
+
+                - max_cache_bytes: int.  If non-zero, the least recently used simplified meshes are
+                  evicted once their total encoded size exceeds this many bytes, and recomputed from
+                  the volume if requested again.  As with `lazy`, the volume data must not be
+                  modified without calling `invalidate`.  Defaults to 0, meaning no limit.
+
+                - encoding: str.  Format of the encoded meshes.  Either 'raw', for float32 vertex
+                  positions and uint32 indices, or 'quantized16' or 'quantized10', for vertex
+                  positions quantized to 16 or 10 bits per coordinate relative to the bounding box
+                  of each mesh and uint16 indices where possible.  Quantizing reduces the size of
+                  the meshes about 2x, with a maximum error of half the bounding box size divided by
+                  (2**bits - 1).  Defaults to 'raw'.
+
+                - simplifier: str.  Either 'openmesh', to simplify meshes with the OpenMesh
+                  decimater, or 'flat', to perform the same quadric-error edge collapses directly on
+                  the vertex and triangle arrays, which avoids building a halfedge mesh.  Both
+                  respect the same error, normal deviation and boundary constraints, but may not
+                  produce identical meshes.  Defaults to 'openmesh'.
+
+                - simplifier_queue: str.  Priority queue of collapses used by simplifier='flat':
+                  'indexed', a heap whose entries are updated in place, or 'lazy', a heap to which
+                  updated vertices are re-added with stale entries skipped, which avoids scattered
+                  writes and can be faster for meshes with millions of vertices.  Both collapse in
+                  order of increasing error, but ties may be broken differently.  Defaults to
+                  'indexed'.
+
+                - max_triangles: int.  Hard cap on the number of triangles of each level of detail.
+                  A mesh that still exceeds the cap after simplification within
+                  `max_quadrics_error` is simplified further, beyond that error, until it is within
+                  the cap or no further collapse preserves its topology.  Defaults to 0, meaning no
+                  cap.
+
+                - max_triangle_ratio: float.  Same as `max_triangles`, but as a fraction of the
+                  number of triangles of the unsimplified mesh.  Defaults to 0, meaning no cap.
+
+                - max_mesh_bytes: int.  Hard cap, in the same manner, on the encoded size in bytes
+                  of each level of detail.  Defaults to 0, meaning no cap.
+                - partition_triangles: int.  If non-zero, meshes with more than this many triangles
+                  are divided into spatial cells of about this many triangles, which are simplified
+                  in parallel before a final pass over the merged mesh removes the seams between
+                  them.  Requires simplifier='flat'.  Defaults to 0, meaning no partitioning.
+                - optimize_vertex_cache: bool.  If True, the triangles of each mesh are reordered
+                  to improve GPU vertex cache reuse when rendered, and the vertices are renumbered
+                  in order of first use.  Does not change the geometry or the encoded size.
+                  Defaults to False.
+                - vertex_normals: str.  Either 'none', or 'octahedral8' or 'octahedral16' to append
+                  to each encoded mesh the area-weighted normal of each vertex of the simplified
+                  mesh, in the octahedral encoding with 2 signed integers of 8 or 16 bits per
+                  vertex, so that the client need not compute them.  With the 'raw' encoding the
+                  normals are followed by a uint32 trailer 0xffffff00 | bits; with the quantized
+                  encodings the bits are stored in bits 8-15 of the header's position bits word.
+                  Not supported by the mesh exporters.  Defaults to 'none'.
+                - num_threads: int.  Number of threads used to compute the surfaces of all objects
+                  up front, by marching over z slabs of the volume in parallel, or 0 to use the
+                  number of hardware threads.  Ignored if `lazy` is true.  Defaults to the value set
+                  by `set_default_mesh_num_threads`.
+                - object_ids: sequence of ints.  If specified, only the objects with these ids are
+                  meshed, and the meshes of all other objects are unavailable, which saves the time
+                  and memory of meshing objects that are never viewed.  Defaults to meshing all
+                  objects.
+                - compact_meshes: bool.  If True, the surfaces computed up front are retained until
+                  simplified with integer vertex positions of 16 bits per coordinate where possible,
+                  and without unused capacity, which reduces their memory several-fold at the cost
+                  of converting each surface once in each direction.  The meshes are unchanged.
+                  Ignored if `lazy` is true.  Defaults to False.
+                - meshing_engine: str.  Algorithm used to compute the surfaces up front, either
+                  'marching_cubes' or 'flying_edges', which divides the work among the threads by
+                  rows of voxels rather than by z slabs.  The surfaces are the same up to vertex
+                  and triangle order.  Ignored if `lazy` is true or `block_size` is specified.
+                  Defaults to 'marching_cubes'.
+                - cache_directory: str.  An existing directory in which the simplified meshes of
+                  each object are stored once computed, and from which they are read rather than
+                  computed when not in memory.  Files are named by a hash of the volume data and of
+                  all options that affect the meshes, so a volume with unchanged data and options,
+                  e.g. after a restart, serves the stored meshes without simplifying them, and, if
+                  `lazy` is true, without computing surfaces.  Hashing takes one pass over `data`.
+                  Defaults to no directory.
+                - background: bool.  Construct the mesh generator on a native thread, so that
+                  creating it returns immediately rather than after the volume is scanned and the
+                  surfaces of all objects are computed.  Meshes are requested as usual meanwhile:
+                  with the default 'marching_cubes' engine, an object becomes available as soon as
+                  the z slabs covering its bounding box are done.  The progress is reported by
+                  `get_mesh_build_progress`, and `invalidate` and `set_mesh_equivalences` stop an
+                  unfinished construction.  Defaults to True.
+
+                - preview_factor: sequence of 3 ints.  If specified, a coarse preview mesh of each
+                  object is also computed, from the volume downsampled by this factor along each
+                  dimension to its most frequent label, and returned by `get_object_preview_mesh`.
+                  This takes a fraction of the time of the full-resolution meshes, so it is done
+                  first in a background construction, and is most of the work of construction if
+                  `lazy` is true.  Not recomputed by `invalidate` with a region.  Defaults to no
+                  preview.
+                - relayout_labels: bool.  If True and `data` is not a contiguous C-order array,
+                  e.g. a Fortran-order array or a view with a step, it is first copied in parallel,
+                  one small tile at a time, into C order, and the surfaces are computed from the
+                  copy.  This makes the cost of computing surfaces insensitive to the memory order
+                  of `data`, at the cost of the memory of the copy, which is retained if `lazy` is
+                  true or `max_cache_bytes` is non-zero.  Ignored if `block_size` is specified, and
+                  not used by `invalidate` with a region.  Defaults to False.
+                - shrink_unsimplified_meshes: bool.  If True, the surface of each object computed up
+                  front is shrunk to fit once complete, releasing the spare capacity left over by
+                  its computation, which is otherwise retained until it is simplified.  Ignored if
+                  `compact_meshes` is true.  Defaults to False.
+                - release_memory_after_build: bool.  If True, the memory freed during construction
+                  is returned to the operating system once it is done, as by
+                  `release_free_memory`.  Defaults to False.
+                - voxel_faces: bool.  If True, the mesh of each object is the blocky surface of its
+                  voxels, with coplanar faces merged into rectangles, computed from its bounding box
+                  when first requested as if `lazy` were true, and not simplified, so the
+                  simplification options other than `num_lods` are ignored.  This is an order of
+                  magnitude faster than computing and simplifying a smooth surface, for example to
+                  show edits instantly.  Preview meshes are still smooth.  Defaults to False.
         """
         super(LocalVolume, self).__init__()
         self.token = make_random_token()
@@ -106,6 +364,10 @@ class LocalVolume(trackable_state.ChangeNotifier):
         self.data_type = np.dtype(data.dtype).name
         if self.data_type == 'float64':
             self.data_type = 'float32'
+        if encoding == 'compressed_segmentation':
+            if (self.data_type not in ('uint32', 'uint64') or rank not in (3, 4)):
+                raise ValueError(
+                    'compressed_segmentation encoding requires uint32 or uint64 data of rank 3 or 4')
         self.encoding = encoding
         if volume_type is None:
             if self.rank == 3 and (self.data_type == 'uint16' or
@@ -120,6 +382,8 @@ class LocalVolume(trackable_state.ChangeNotifier):
         self._mesh_generator_pending = None
         self._mesh_generator_lock = threading.Condition()
         self._mesh_options = mesh_options.copy() if mesh_options is not None else dict()
+        self._mesh_equivalences = None
+        self._mesh_request_trace = None
 
         self.max_voxels_per_chunk_log2 = max_voxels_per_chunk_log2
 
@@ -131,10 +395,21 @@ class LocalVolume(trackable_state.ChangeNotifier):
                 chunk_layout = 'isotropic'
         self.chunk_layout = chunk_layout
 
+        if segmentation_downsampling not in ('striding', 'mode'):
+            raise ValueError('segmentation_downsampling must be \'striding\' or \'mode\'')
+        self.segmentation_downsampling = segmentation_downsampling
         self.max_downsampling = max_downsampling
         self.max_downsampled_size = max_downsampled_size
         self.max_downsampling_scales = max_downsampling_scales
 
+        self._chunk_cache = None
+        if max_chunk_cache_bytes:
+            try:
+                from . import _neuroglancer
+                self._chunk_cache = _neuroglancer.EncodedChunkCache(max_chunk_cache_bytes)
+            except ImportError:
+                pass
+
     def info(self):
         info = dict(dataType=self.data_type,
                     encoding=self.encoding,
@@ -151,10 +426,19 @@ class LocalVolume(trackable_state.ChangeNotifier):
         )
         if self.max_voxels_per_chunk_log2 is not None:
             info['maxVoxelsPerChunkLog2'] = self.max_voxels_per_chunk_log2
+        if self.encoding == 'compressed_segmentation':
+            info['compressedSegmentationBlockSize'] = COMPRESSED_SEGMENTATION_BLOCK_SIZE
 
         return info
 
-    def get_encoded_subvolume(self, data_format, start, end, scale_key):
+    def get_encoded_subvolume(self, data_format, start, end, scale_key, gzip=False):
+        """Returns the chunk [start, end) of the scale `scale_key`, encoded in `data_format`, and
+        its content type.
+
+        If `gzip` is true, the encoded chunk is compressed in the gzip format, to be served with
+        Content-Encoding: gzip, by the C extension module with the GIL released.  Compressed and
+        uncompressed chunks are cached separately, as specified by `max_chunk_cache_bytes`.
+        """
         rank = self.rank
         if len(start) != rank or len(end) != rank:
             raise ValueError('Invalid request')
@@ -167,6 +451,35 @@ class LocalVolume(trackable_state.ChangeNotifier):
         if np.any(end < start) or np.any(start < 0) or np.any(end > downsampled_shape):
             raise ValueError('Out of bounds data request.')
 
+        content_type = 'image/jpeg' if data_format == 'jpeg' else 'application/octet-stream'
+        chunk_cache = self._chunk_cache
+        if chunk_cache is not None:
+            cache_key = '%s/%s/%s/%s' % (data_format, scale_key, ','.join(str(x) for x in start),
+                                         ','.join(str(x) for x in end))
+            if gzip:
+                cache_key += '/gzip'
+            data = chunk_cache.get(cache_key)
+            if data is not None:
+                return data, content_type
+            # Obtained before reading `data`, so that the chunk is not cached if the volume is
+            # invalidated meanwhile.
+            generation = chunk_cache.generation()
+
+        if gzip:
+            from . import _neuroglancer
+            data, _ = self.get_encoded_subvolume(data_format, start, end, scale_key)
+            data = _neuroglancer.gzip_compress(data)
+        else:
+            data = self._encode_subvolume(data_format, start, end, downsample_factor)
+        if chunk_cache is not None:
+            chunk_cache.insert(cache_key, generation,
+                               [int(x) * int(f) for x, f in zip(start, downsample_factor)],
+                               [min(int(x) * int(f), n)
+                                for x, f, n in zip(end, downsample_factor, self.shape)], data)
+        return data, content_type
+
+    def _encode_subvolume(self, data_format, start, end, downsample_factor):
+        rank = self.rank
         indexing_expr = tuple(np.s_[start[i] * downsample_factor[i]:end[i] * downsample_factor[i]]
                               for i in range(rank))
         subvol = np.array(self.data[indexing_expr], copy=False)
@@ -176,27 +489,444 @@ class LocalVolume(trackable_state.ChangeNotifier):
         if np.any(downsample_factor != 1):
             if self.volume_type == 'image':
                 subvol = downsample.downsample_with_averaging(subvol, downsample_factor)
+            elif self.segmentation_downsampling == 'mode':
+                subvol = downsample.downsample_with_mode(subvol, downsample_factor)
             else:
                 subvol = downsample.downsample_with_striding(subvol, downsample_factor)
-        content_type = 'application/octet-stream'
         if data_format == 'jpeg':
-            data = encode_jpeg(subvol)
-            content_type = 'image/jpeg'
+            return encode_jpeg(subvol)
         elif data_format == 'npz':
-            data = encode_npz(subvol)
+            return encode_npz(subvol)
         elif data_format == 'raw':
-            data = encode_raw(subvol)
+            return encode_raw(subvol)
+        elif data_format == 'compressed_segmentation' and self.encoding == data_format:
+            return encode_compressed_segmentation(subvol)
+        raise ValueError('Invalid data format requested.')
+
+    def get_chunk_cache_statistics(self):
+        """Returns a dict of the 'hits', 'misses', 'num_cached' and 'num_bytes' of the cache of
+        encoded chunks, or None if it is disabled."""
+        if self._chunk_cache is None:
+            return None
+        return self._chunk_cache.get_statistics()
+
+    def get_object_mesh(self, object_id, lod=0, gzip=False):
+        """Returns the encoded mesh of an object as a read-only memoryview.
+
+        The memoryview references the cached mesh, which avoids a copy.  If `gzip` is true, the mesh
+        is compressed in the gzip format, to be served with Content-Encoding: gzip; the compressed
+        meshes are cached along with the meshes.
+        """
+        self._trace_mesh_request(object_id, lod)
+        mesh_generator = self._get_mesh_generator()
+        if gzip:
+            data = mesh_generator.get_gzipped_mesh(object_id, lod)
         else:
-            raise ValueError('Invalid data format requested.')
-        return data, content_type
+            data = mesh_generator.get_mesh(object_id, lod)
+        if data is None:
+            raise InvalidObjectIdForMesh()
+        return data
+
+    def get_object_preview_mesh(self, object_id):
+        """Returns the encoded preview mesh of an object as a read-only memoryview.
 
-    def get_object_mesh(self, object_id):
+        Requires the `preview_factor` mesh option.  The preview is in the same encoding as
+        `get_object_mesh`, with a single level of detail.  Raises `InvalidObjectIdForMesh` if there
+        is no preview of the object, e.g. because it is smaller than the preview factor.
+        """
         mesh_generator = self._get_mesh_generator()
-        data = mesh_generator.get_mesh(object_id)
+        data = mesh_generator.get_preview_mesh(object_id)
         if data is None:
             raise InvalidObjectIdForMesh()
         return data
 
+    def request_object_mesh(self, object_id, lod=0, priority=0, executor=None, gzip=False):
+        """Requests the encoded mesh of an object without waiting for it to be computed.
+
+        Returns a `concurrent.futures.Future` whose result is the mesh as returned by
+        `get_object_mesh`.  Meshes are computed by a pool of native worker threads, so no Python
+        thread is blocked while a mesh is simplified, and requests of higher `priority` are served
+        first.  If the mesh generator does not exist yet, it is created on `executor`, or on the
+        calling thread if `executor` is None, since that scans the whole volume, and meshes it
+        too if the `background` mesh option is false and `lazy` is not set.  If `gzip` is true, the
+        result is as by `get_object_mesh` with `gzip`, also compressed on a native worker thread.
+        """
+        self._trace_mesh_request(object_id, lod)
+        future = concurrent.futures.Future()
+
+        def handle_mesh(data):
+            if data is None:
+                future.set_exception(InvalidObjectIdForMesh())
+            else:
+                future.set_result(data)
+
+        def request():
+            try:
+                self._get_mesh_generator().request_mesh(object_id, lod, handle_mesh,
+                                                        priority=priority, gzip=gzip)
+            except Exception as e:
+                future.set_exception(e)
+
+        if executor is None or self._mesh_generator is not None:
+            request()
+        else:
+            executor.submit(request)
+        return future
+
+    def request_object_mesh_fragments(self, object_id, on_fragment, lod=0, priority=0,
+                                      executor=None,
+                                      fragment_triangles=DEFAULT_MESH_FRAGMENT_TRIANGLES):
+        """Requests the encoded mesh of an object as a sequence of spatial fragments, each delivered
+        as soon as it is computed, so that a large object can be displayed before all of it is
+        simplified.
+
+        `on_fragment` is called from a native worker thread with each fragment, a memoryview in the
+        same encoding as `get_object_mesh` that can be decoded and displayed independently.  The
+        unsimplified mesh is divided into cells of about `fragment_triangles` triangles, which are
+        simplified one at a time by the worker thread, leaving the other worker threads to other
+        requests, with their boundaries locked so that adjacent fragments join without gaps.  The
+        fragments are not cached; a mesh that is cached, e.g. by `get_object_mesh`, or of an
+        object with at most `fragment_triangles` triangles, is delivered as a single fragment.
+        `priority` and `executor` are as for `request_object_mesh`.
+
+        Returns a `concurrent.futures.Future` whose result is the number of fragments, set once
+        the last one has been delivered, or which raises `InvalidObjectIdForMesh` if there is no
+        mesh.
+        """
+        self._trace_mesh_request(object_id, lod)
+        future = concurrent.futures.Future()
+        num_fragments = [0]
+
+        def handle_fragment(data):
+            if data is not None:
+                num_fragments[0] += 1
+                on_fragment(data)
+            elif num_fragments[0] == 0:
+                future.set_exception(InvalidObjectIdForMesh())
+            else:
+                future.set_result(num_fragments[0])
+
+        def request():
+            try:
+                self._get_mesh_generator().request_mesh_fragments(
+                    object_id, lod, handle_fragment, fragment_triangles, priority=priority)
+            except Exception as e:
+                future.set_exception(e)
+
+        if executor is None or self._mesh_generator is not None:
+            request()
+        else:
+            executor.submit(request)
+        return future
+
+    def start_mesh_request_trace(self):
+        """Starts recording the mesh requests and invalidations of this volume.
+
+        Returns a `mesh_request_trace.MeshRequestTrace` to which each subsequent mesh request, by
+        `get_object_mesh`, `request_object_mesh`, `request_object_mesh_fragments` or
+        `get_object_meshes`, and each call to `invalidate` is appended with its time, until
+        `stop_mesh_request_trace` is called.  The saved trace, together with `data`, e.g. saved
+        with `numpy.save`, can be replayed by `mesh_request_trace.replay_mesh_request_trace` or
+        the `neuroglancer.tool.replay_mesh_trace` tool.
+        """
+        trace = mesh_request_trace.MeshRequestTrace(
+            voxel_size=self.dimensions.scales, mesh_options=self._mesh_options,
+            equivalences=self._mesh_equivalences)
+        self._mesh_request_trace = trace
+        return trace
+
+    def stop_mesh_request_trace(self):
+        """Stops recording, and returns the trace of `start_mesh_request_trace`, or None."""
+        trace = self._mesh_request_trace
+        self._mesh_request_trace = None
+        return trace
+
+    def _trace_mesh_request(self, object_id, lod):
+        trace = self._mesh_request_trace
+        if trace is not None:
+            trace.record_mesh_request(object_id, lod)
+
+    def get_object_meshes(self, object_ids, lod=0):
+        """Returns a dict mapping each of `object_ids` to a memoryview of its encoded mesh.
+
+        The meshes are computed in parallel.  Raises `InvalidObjectIdForMesh` if any object has no
+        mesh.
+        """
+        for object_id in object_ids:
+            self._trace_mesh_request(object_id, lod)
+        mesh_generator = self._get_mesh_generator()
+        meshes = mesh_generator.get_meshes(object_ids, lod)
+        if any(data is None for data in meshes.values()):
+            raise InvalidObjectIdForMesh()
+        return meshes
+
+    def precompute_object_meshes(self, num_threads=0, background=False):
+        """Computes and caches the meshes of all objects in parallel.
+
+        Larger objects are scheduled first.  If `num_threads` is 0, the number of hardware threads
+        is used.  The partitioned simplification of each object, if enabled by
+        `partition_triangles`, uses the threads left unused by the objects rather than additional
+        ones.
+
+        If `background` is true, the computations are instead queued on the native worker threads
+        of `request_object_mesh`, behind any requests, and this returns immediately; `num_threads`
+        is then ignored.  The queued computations are cancelled by `cancel_mesh_precompute` and
+        when the volume is invalidated.
+        """
+        if background:
+            self._get_mesh_generator().precompute_in_background()
+        else:
+            self._get_mesh_generator().precompute_all(num_threads)
+
+    def cancel_mesh_precompute(self):
+        """Cancels the background mesh computations that have not yet started."""
+        mesh_generator = self._mesh_generator
+        if mesh_generator is not None:
+            mesh_generator.cancel_background()
+
+    def get_mesh_build_progress(self):
+        """Returns the fraction in [0, 1] of the construction of the mesh generator that is done.
+
+        Returns 0 if the mesh generator has not been created yet.
+        """
+        mesh_generator = self._mesh_generator
+        if mesh_generator is None:
+            return 0.0
+        return mesh_generator.build_progress()
+
+    def wait_for_mesh_build(self):
+        """Waits for the construction of the mesh generator, creating it if necessary.
+
+        Returns True if it completed, or False if it was stopped by `cancel_mesh_build`.
+        """
+        return self._get_mesh_generator().wait_until_built()
+
+    def cancel_mesh_build(self):
+        """Stops an unfinished background construction of the mesh generator.
+
+        The meshes of objects completed before cancellation remain available, and other meshes are
+        empty until the volume is invalidated.
+        """
+        mesh_generator = self._mesh_generator
+        if mesh_generator is not None:
+            mesh_generator.cancel_build()
+
+    def get_mesh_cache_statistics(self):
+        """Returns a dict of mesh cache counters.
+
+        The keys are 'hits', 'misses', 'disk_hits', 'disk_writes', 'shared_hits', 'evictions',
+        'num_cached', and 'num_bytes'.  'disk_hits' counts the misses served from the
+        `cache_directory` mesh option, and 'disk_writes' the objects whose meshes were stored in
+        it.  'shared_hits' counts the misses served from the store enabled by
+        `set_shared_mesh_store_bytes` or the segment attached by `set_shared_mesh_segment`.
+        """
+        return self._get_mesh_generator().get_cache_statistics()
+
+    def get_mesh_stats(self):
+        """Returns a dict of mesh generation counters, for monitoring.
+
+        In addition to the keys of `get_mesh_cache_statistics`, includes:
+
+        - 'march_ns', 'convert_ns', 'simplify_ns', 'encode_ns': cumulative wall-clock time in
+          nanoseconds, summed over all threads, spent computing unsimplified meshes, preparing them
+          for simplification, simplifying, and encoding.
+        - 'num_objects': number of objects whose meshes were computed.
+        - 'triangles_in', 'triangles_out': total number of triangles before simplification, and in
+          all encoded levels of detail.
+        - 'bytes_out': total encoded size of all levels of detail computed.
+        - 'slowest_object_id', 'slowest_object_ns': the object that took longest to compute.
+        - 'largest_object_id', 'largest_object_triangles': the object with the most triangles
+          before simplification.
+        - 'unsimplified_bytes': memory retained by the surfaces computed up front that have not yet
+          been simplified.
+        - 'queued_requests', 'queued_background': the numbers of mesh requests and background
+          computations that are queued and have not yet started.
+        """
+        return self._get_mesh_generator().stats()
+
+    def get_mesh_memory_statistics(self):
+        """Returns a dict of the memory currently retained by the mesh generator, in bytes.
+
+        - 'construction_bytes', 'peak_construction_bytes': working memory of the computation of
+          the surfaces up front with the 'marching_cubes' engine, other than the surfaces
+          themselves, which is 0 once it is done, and its peak.
+        - 'unsimplified_bytes': surfaces computed up front that have not yet been simplified.
+        - 'cached_bytes': cached simplified meshes, including their gzip-compressed copies.
+        - 'preview_bytes': preview meshes (see the `preview_factor` mesh option).
+        - 'simplification_bytes', 'peak_simplification_bytes': estimated temporary memory of the
+          simplifications in progress, and its peak.
+        - 'label_copy_bytes': copy of `data` made for the `relayout_labels` mesh option.
+        - 'index_bytes': per-object ids, bounding boxes and statistics.
+
+        'preview_bytes' and 'index_bytes' are 0 until construction is done.  After
+        `release_unsimplified_meshes`, the peaks start over.
+        """
+        return self._get_mesh_generator().get_memory_statistics()
+
+    def release_unsimplified_meshes(self):
+        """Releases the surfaces computed up front that have not yet been simplified.
+
+        The cached and preview meshes are kept, and the meshes of all other objects are then
+        computed from `data` on demand, as if the `lazy` mesh option were true.  This reclaims the
+        'unsimplified_bytes' of `get_mesh_memory_statistics` once the frequently viewed objects are
+        cached, e.g. to fit several large volumes in one server; `release_free_memory` then
+        returns the memory to the operating system.  Waits for a background construction to
+        complete.  Returns False if the mesh generator does not support this, which is the case
+        with `block_size` and without `max_cache_bytes`, or if the volume was invalidated
+        meanwhile.
+        """
+        mesh_generator = self._get_mesh_generator()
+        new_mesh_generator = mesh_generator.release_unsimplified_meshes(self.data.transpose())
+        if new_mesh_generator is None:
+            return False
+        with self._mesh_generator_lock:
+            if self._mesh_generator is not mesh_generator:
+                return False
+            self._mesh_generator = new_mesh_generator
+            self._mesh_generator_lock.notify_all()
+        mesh_generator.cancel_background()
+        return True
+
+    def get_object_statistics(self):
+        """Returns a dict of per-object statistics gathered while meshing, as numpy arrays.
+
+        The arrays are in increasing order of object id:
+
+        - 'object_ids': the object ids.
+        - 'start', 'end': arrays of shape ``(num_objects, rank)`` specifying the half-open bounding
+          box of each object in voxels, in the order of the dimensions of the volume, or an empty
+          box if not known.
+        - 'num_voxels': the number of voxels of each object.
+        - 'num_boundary_cubes': the number of 2x2x2 voxel cubes that contain both the object and
+          some other object or background.
+        - 'surface_area': the area of the unsimplified mesh, in the units of the dimensions.
+
+        Counts and areas are -1 where not known, e.g. boundary cube counts and surface areas with
+        the ``lazy`` mesh option, and after `invalidate` for the objects that overlap the
+        invalidated region.
+        """
+        return self._get_mesh_generator().object_statistics()
+
+    def export_precomputed_meshes(self, path, lod=0, fragment_size=None, num_threads=0,
+                                  num_writer_threads=4, max_pending_bytes=256 << 20):
+        """Writes the meshes of all objects to the directory `path` in the legacy precomputed mesh
+        format, creating it if necessary.
+
+        The meshes are computed in parallel with `num_threads` threads, or the number of hardware
+        threads if 0, and written by `num_writer_threads` native threads.  Computation waits while
+        more than `max_pending_bytes` of files await writing.  If `fragment_size` is specified, as a
+        sequence of 3 sizes in the units of the dimensions, each mesh is split into fragments by a
+        grid of cells of that size.  Requires the 'raw' mesh encoding without vertex normals.
+        """
+        if not os.path.isdir(path):
+            os.makedirs(path)
+        kwargs = dict(lod=lod, num_threads=num_threads, num_writer_threads=num_writer_threads,
+                      max_pending_bytes=max_pending_bytes)
+        if fragment_size is not None:
+            kwargs['fragment_size'] = tuple(float(x) for x in fragment_size)
+        self._get_mesh_generator().export_precomputed(path, **kwargs)
+
+    def export_sharded_multiresolution_meshes(self, path, vertex_quantization_bits=16,
+                                              lod_scale_multiplier=1.0, preshift_bits=0,
+                                              minishard_bits=0, shard_bits=0,
+                                              hash='murmurhash3_x86_128',
+                                              draco_compression_level=7, num_threads=0,
+                                              max_pending_bytes=256 << 20):
+        """Writes the meshes of all objects to the directory `path` in the sharded multi-resolution
+        (``neuroglancer_multilod_draco``) format, creating it if necessary.
+
+        Each level of detail of the mesh generator becomes a level of the octree of each object,
+        split into Draco-encoded fragments.  The shard files are written in a single pass as the
+        meshes are computed, with `num_threads` threads or the number of hardware threads if 0.
+        Computation waits while more than `max_pending_bytes` of encoded objects await writing.
+        The sharding is specified by `preshift_bits`, `minishard_bits`, `shard_bits` and `hash`,
+        as in the ``neuroglancer_uint64_sharded_v1`` format; the minishard indices and manifests
+        are not compressed.
+
+        Requires the 'raw' mesh encoding without vertex normals, and raises `NotImplementedError` if the native extension
+        was built without Draco.
+        """
+        if not os.path.isdir(path):
+            os.makedirs(path)
+        self._get_mesh_generator().export_sharded_multiresolution(
+            path, vertex_quantization_bits=vertex_quantization_bits,
+            lod_scale_multiplier=float(lod_scale_multiplier), preshift_bits=preshift_bits,
+            minishard_bits=minishard_bits, shard_bits=shard_bits, hash=hash,
+            draco_compression_level=draco_compression_level, num_threads=num_threads,
+            max_pending_bytes=max_pending_bytes)
+
+    def export_sharded_segmentation(self, path, chunk_size=(64, 64, 64),
+                                    block_size=COMPRESSED_SEGMENTATION_BLOCK_SIZE, preshift_bits=0,
+                                    minishard_bits=0, shard_bits=0, hash='murmurhash3_x86_128',
+                                    minishard_index_encoding='raw', data_encoding='raw',
+                                    num_threads=0, max_pending_bytes=256 << 20):
+        """Writes the volume to the directory `path` as a sharded precomputed segmentation volume
+        with the compressed_segmentation encoding, creating it if necessary.
+
+        The volume is written as a single scale, without downsampling, in the subdirectory named by
+        its resolution in nanometers (or in the units of the dimensions if they are not meters),
+        along with the `info` file.  The dimensions of the volume are taken in the order x, y, z.
+        Chunks of `chunk_size` are encoded in parallel with `num_threads` threads, or the number of
+        hardware threads if 0, and packed into the shard files in a single pass; encoding waits
+        while more than `max_pending_bytes` of chunks await writing.  The sharding is specified as
+        in the ``neuroglancer_uint64_sharded_v1`` format; gzip encodings require the native
+        extension to be built with zlib.
+
+        If `block_size` is ``'auto'``, the compressed_segmentation block size is chosen by
+        `choose_compressed_segmentation_block_size` from a sample of the chunks.
+
+        Requires a rank 3 volume of 8-, 16-, 32- or 64-bit integers; labels of fewer than 64 bits
+        are written as uint32.
+        """
+        from . import _neuroglancer
+        dtype = np.dtype(self.data.dtype)
+        if self.rank != 3 or dtype.kind not in 'iu' or dtype.itemsize not in (1, 2, 4, 8):
+            raise ValueError('Sharded segmentation export requires a rank 3 integer volume')
+        # Rounded to undo the conversion of nanometers to meters.
+        resolution = [
+            round(float(scale * 1e9 if unit == 'm' else scale), 9)
+            for scale, unit in zip(self.dimensions.scales, self.dimensions.units)
+        ]
+        if block_size == 'auto':
+            block_size = choose_compressed_segmentation_block_size(
+                self.data, chunk_size, num_threads=num_threads)
+        key = '_'.join('%g' % x for x in resolution)
+        scale_path = os.path.join(path, key)
+        if not os.path.isdir(scale_path):
+            os.makedirs(scale_path)
+        _neuroglancer.export_sharded_segmentation(
+            self.data, scale_path, chunk_size=tuple(int(x) for x in chunk_size),
+            block_size=tuple(int(x) for x in block_size), preshift_bits=preshift_bits,
+            minishard_bits=minishard_bits, shard_bits=shard_bits, hash=hash,
+            minishard_index_encoding=minishard_index_encoding, data_encoding=data_encoding,
+            num_threads=num_threads, max_pending_bytes=max_pending_bytes)
+        info = {
+            '@type': 'neuroglancer_multiscale_volume',
+            'type': 'segmentation',
+            'data_type': 'uint64' if dtype.itemsize == 8 else 'uint32',
+            'num_channels': 1,
+            'scales': [{
+                'key': key,
+                'size': [int(x) for x in self.shape],
+                'voxel_offset': [int(x) for x in self.voxel_offset],
+                'resolution': resolution,
+                'chunk_sizes': [[int(x) for x in chunk_size]],
+                'encoding': 'compressed_segmentation',
+                'compressed_segmentation_block_size': [int(x) for x in block_size],
+                'sharding': {
+                    '@type': 'neuroglancer_uint64_sharded_v1',
+                    'hash': hash,
+                    'preshift_bits': preshift_bits,
+                    'minishard_bits': minishard_bits,
+                    'shard_bits': shard_bits,
+                    'minishard_index_encoding': minishard_index_encoding,
+                    'data_encoding': data_encoding,
+                },
+            }],
+        }
+        with open(os.path.join(path, 'info'), 'w') as f:
+            json.dump(info, f)
+
     def _get_mesh_generator(self):
         if self._mesh_generator is not None:
             return self._mesh_generator
@@ -205,7 +935,8 @@ class LocalVolume(trackable_state.ChangeNotifier):
                 if self._mesh_generator is not None:
                     return self._mesh_generator
                 if self._mesh_generator_pending is not None:
-                    while self._mesh_generator is None:
+                    while (self._mesh_generator is None and
+                           self._mesh_generator_pending is not None):
                         self._mesh_generator_lock.wait()
                     if self._mesh_generator is not None:
                         return self._mesh_generator
@@ -220,9 +951,12 @@ class LocalVolume(trackable_state.ChangeNotifier):
                 pending_obj = object()
                 self._mesh_generator_pending = pending_obj
             data = self.data
+            mesh_options = dict({'background': True}, **self._mesh_options)
+            if self._mesh_equivalences is not None:
+                mesh_options = dict(mesh_options, equivalences=self._mesh_equivalences)
             new_mesh_generator = _neuroglancer.OnDemandObjectMeshGenerator(
                 data.transpose(),
-                self.dimensions.scales, np.zeros(3), **self._mesh_options)
+                self.dimensions.scales, np.zeros(3), **mesh_options)
             with self._mesh_generator_lock:
                 if self._mesh_generator_pending is not pending_obj:
                     continue
@@ -238,9 +972,174 @@ class LocalVolume(trackable_state.ChangeNotifier):
         """
         return self
 
-    def invalidate(self):
-        """Mark the data invalidated.  Clients will refetch the volume."""
+    def invalidate(self, start=None, end=None):
+        """Mark the data invalidated.  Clients will refetch the volume.
+
+        @param start: Optional sequence of 3 ints.  If `start` and `end` are specified, only the
+            voxels within [start, end) of `data` were modified.  Only the meshes of objects in or
+            adjacent to this region are then recomputed, rather than the meshes of all objects.
+        @param end: Optional sequence of 3 ints.
+        """
+        trace = self._mesh_request_trace
+        if trace is not None:
+            trace.record_invalidate(start, end)
+        if self._chunk_cache is not None:
+            if start is not None and end is not None:
+                self._chunk_cache.invalidate([int(x) for x in start], [int(x) for x in end])
+            else:
+                self._chunk_cache.invalidate()
+        pending_obj = None
         with self._mesh_generator_lock:
+            mesh_generator = self._mesh_generator
+            self._mesh_generator = None
             self._mesh_generator_pending = None
+            if mesh_generator is not None:
+                # A cancelled construction is not updated, but recreated on demand.
+                mesh_generator.cancel_build()
+                mesh_generator.cancel_background()
+            if start is not None and end is not None and mesh_generator is not None:
+                pending_obj = object()
+                self._mesh_generator_pending = pending_obj
+            self._mesh_generator_lock.notify_all()
+        if pending_obj is not None:
+            new_mesh_generator = None
+            try:
+                new_mesh_generator = mesh_generator.update_region(
+                    self.data.transpose(), tuple(start), tuple(end))
+            finally:
+                with self._mesh_generator_lock:
+                    if self._mesh_generator_pending is pending_obj:
+                        # If the update is not supported, the generator is recreated on demand.
+                        self._mesh_generator = new_mesh_generator
+                        self._mesh_generator_pending = None
+                    self._mesh_generator_lock.notify_all()
+        self._dispatch_changed_callbacks()
+
+    def set_mesh_equivalences(self, equivalences):
+        """Sets the label equivalences under which 'segmentation' volumes are meshed.
+
+        The mesh of each object is the surface of the union of the labels mapped to it, computed
+        directly from `data` without relabeling it.  Only the meshes of objects whose set of labels
+        changes are recomputed.
+
+        @param equivalences: An `EquivalenceMap`, in which case each label is mapped to the
+            smallest label equivalent to it, a dict mapping labels to object ids, or None to mesh
+            each label separately.  Labels not mapped are their own object ids, and labels mapped
+            to 0 are treated as background.
+        """
+        if equivalences is not None:
+            if isinstance(equivalences, dict):
+                pairs = list(equivalences.items())
+            else:
+                pairs = [(x, equivalences[x]) for x in equivalences]
+            pairs = [(x, y) for x, y in pairs if x != y]
+            equivalences = np.array(pairs, dtype=np.uint64).reshape(-1, 2)
+        pending_obj = None
+        with self._mesh_generator_lock:
+            self._mesh_equivalences = equivalences
+            mesh_generator = self._mesh_generator
             self._mesh_generator = None
+            self._mesh_generator_pending = None
+            if mesh_generator is not None:
+                # A cancelled construction is not updated, but recreated on demand.
+                mesh_generator.cancel_build()
+                mesh_generator.cancel_background()
+                pending_obj = object()
+                self._mesh_generator_pending = pending_obj
+            self._mesh_generator_lock.notify_all()
+        if pending_obj is not None:
+            new_mesh_generator = None
+            try:
+                new_mesh_generator = mesh_generator.update_equivalences(
+                    self.data.transpose(), equivalences)
+            finally:
+                with self._mesh_generator_lock:
+                    if self._mesh_generator_pending is pending_obj:
+                        # If the update is not supported, the generator is recreated on demand.
+                        self._mesh_generator = new_mesh_generator
+                        self._mesh_generator_pending = None
+                    self._mesh_generator_lock.notify_all()
         self._dispatch_changed_callbacks()
+
+
+class LocalVolumeSkeletonSource(skeleton.SkeletonSource):
+    """Skeletons of the objects of a 'segmentation' `LocalVolume`, computed natively.
+
+    The skeleton of each object is computed by the TEASAR algorithm from the voxels of the object
+    when it is first requested, and then cached.  The objects are those the volume is meshed under:
+    if `LocalVolume.set_mesh_equivalences` was called, the skeleton of an object spans the union of
+    its labels.  Modifying the volume through `LocalVolume.invalidate` or
+    `LocalVolume.set_mesh_equivalences` discards the cached skeletons.
+
+    Vertex positions are in voxels, like those of the meshes of the volume, and each vertex has a
+    'radius' attribute, its distance to the boundary of the object in units of the smallest voxel
+    dimension.
+    """
+
+    def __init__(self, volume, skeleton_options=None):
+        """Initializes the source.
+
+        @param volume: A `LocalVolume` of rank 3 with integer data.
+
+        @param skeleton_options: A dict with the following optional keys, distances being in units
+            of the smallest voxel dimension:
+
+            invalidation_scale: Once a branch has been added to the skeleton, no further branch
+              ends within `invalidation_scale * r + invalidation_constant` of any of its voxels,
+              where `r` is the distance from that voxel to the boundary.  Defaults to 4.
+
+            invalidation_constant: Defaults to 10.  Larger values of both give fewer, smoother
+              branches.
+
+            penalty_scale, penalty_exponent: Branches are the shortest paths under a cost of
+              `1 + penalty_scale * (1 - r / max_r) ** penalty_exponent` per unit length, where
+              `max_r` is the largest distance to the boundary, which keeps them near the center of
+              the object.  Default to 100000 and 4.
+        """
+        super(LocalVolumeSkeletonSource, self).__init__(volume.dimensions,
+                                                        voxel_offset=volume.voxel_offset)
+        self.volume = volume
+        self.vertex_attributes['radius'] = skeleton.VertexAttributeInfo(
+            data_type=np.float32, num_components=1)
+        self._skeleton_options = dict(skeleton_options or {})
+        self._skeleton_generator = None
+        self._skeleton_generator_lock = threading.Lock()
+        # Incremented when the volume changes, so that a generator constructed concurrently is
+        # not retained.
+        self._volume_generation = 0
+        volume.add_changed_callback(self.invalidate)
+
+    def _get_skeleton_generator(self):
+        with self._skeleton_generator_lock:
+            if self._skeleton_generator is not None:
+                return self._skeleton_generator
+            generation = self._volume_generation
+        try:
+            from . import _neuroglancer
+        except ImportError:
+            raise MeshImplementationNotAvailable()
+        volume = self.volume
+        if not (volume.rank == 3 and volume.data_type in ('uint8', 'uint16', 'uint32', 'uint64')):
+            raise MeshesNotSupportedForVolume()
+        scales = np.array(volume.dimensions.scales, dtype=np.float64)
+        options = dict(voxel_size=tuple(scales / scales.min()), **self._skeleton_options)
+        if volume._mesh_equivalences is not None:
+            options['equivalences'] = volume._mesh_equivalences
+        generator = _neuroglancer.OnDemandSkeletonGenerator(volume.data.transpose(), **options)
+        with self._skeleton_generator_lock:
+            if self._volume_generation == generation:
+                self._skeleton_generator = generator
+        return generator
+
+    def get_skeleton(self, object_id):
+        result = self._get_skeleton_generator().get_skeleton(object_id)
+        if result is None:
+            return None
+        vertex_positions, edges, radii = result
+        return skeleton.Skeleton(vertex_positions, edges, vertex_attributes=dict(radius=radii))
+
+    def invalidate(self):
+        with self._skeleton_generator_lock:
+            self._skeleton_generator = None
+            self._volume_generation += 1
+        super(LocalVolumeSkeletonSource, self).invalidate()
@@ -0,0 +1,209 @@
+# @license
+# Copyright 2016 Google Inc.
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Recording and replay of the mesh requests served by a `LocalVolume`.
+
+A trace records the `get_mesh` requests and invalidations of a volume, with their times, as
+returned by `LocalVolume.start_mesh_request_trace`.  `replay_mesh_request_trace` replays a saved
+trace against the native mesh generator with a number of concurrent clients and reports the latency
+percentiles, throughput and peak memory, so that caching and threading changes can be judged on a
+realistic load rather than on microbenchmarks.
+"""
+
+from __future__ import absolute_import, division, print_function
+
+import json
+import sys
+import threading
+import time
+
+import numpy as np
+
+
+def _to_json(value):
+    if isinstance(value, np.ndarray):
+        return value.tolist()
+    if isinstance(value, np.generic):
+        return value.item()
+    raise TypeError('%r is not JSON serializable' % (value,))
+
+
+class MeshRequestTrace(object):
+    """Mesh requests and invalidations of a volume, with the mesh options and voxel size needed to
+    recreate its mesh generator.
+
+    Each event is a dict with the 'time' in seconds since the trace started and its 'type':
+    'get_mesh', with the 'object_id' and 'lod' requested, or 'invalidate', with the 'start' and
+    'end' of the modified region, or None if the whole volume was invalidated.
+    """
+
+    def __init__(self, voxel_size, mesh_options=None, equivalences=None, events=None):
+        self.voxel_size = [float(x) for x in voxel_size]
+        self.mesh_options = dict(mesh_options or {})
+        self.equivalences = equivalences
+        self.events = list(events or [])
+        self._lock = threading.Lock()
+        self._start_time = time.time()
+
+    def _record(self, event):
+        with self._lock:
+            event['time'] = time.time() - self._start_time
+            self.events.append(event)
+
+    def record_mesh_request(self, object_id, lod):
+        self._record(dict(type='get_mesh', object_id=int(object_id), lod=int(lod)))
+
+    def record_invalidate(self, start=None, end=None):
+        if start is not None and end is not None:
+            start = [int(x) for x in start]
+            end = [int(x) for x in end]
+        else:
+            start = end = None
+        self._record(dict(type='invalidate', start=start, end=end))
+
+    def save(self, path):
+        """Saves the trace as JSON lines: a header with the options, then one line per event."""
+        with self._lock:
+            events = list(self.events)
+        with open(path, 'w') as f:
+            header = dict(voxel_size=self.voxel_size, mesh_options=self.mesh_options,
+                          equivalences=self.equivalences)
+            f.write(json.dumps(header, default=_to_json) + '\n')
+            for event in events:
+                f.write(json.dumps(event) + '\n')
+
+    @staticmethod
+    def load(path):
+        with open(path, 'r') as f:
+            lines = [json.loads(line) for line in f if line.strip()]
+        if not lines:
+            raise ValueError('Empty mesh request trace: %r' % (path,))
+        header = lines[0]
+        return MeshRequestTrace(voxel_size=header['voxel_size'],
+                                mesh_options=header.get('mesh_options'),
+                                equivalences=header.get('equivalences'),
+                                events=lines[1:])
+
+
+def _get_peak_rss_bytes():
+    try:
+        import resource
+    except ImportError:
+        return None
+    peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    # Reported in kilobytes on Linux and in bytes on macOS.
+    return peak if sys.platform == 'darwin' else peak * 1024
+
+
+def replay_mesh_request_trace(trace, data, num_clients=1, speed=1.0, mesh_options=None):
+    """Replays the events of `trace` against a native mesh generator for `data`.
+
+    The generator is constructed as by `LocalVolume` from `data`, which should be the labels of the
+    traced volume, with the traced mesh options updated by `mesh_options`.  The events are issued in
+    order by `num_clients` threads, each waiting for its previous request to complete before taking
+    the next event.  If `speed` is positive, no event is issued before its traced time divided by
+    `speed`, and the latency of a request is measured from that time, so that it includes any wait
+    for a free client; if `speed` is 0, events are issued as fast as the clients allow and the
+    latency is measured from issue.  An invalidation of a region updates the generator for that
+    region, and one of the whole volume discards it, to be recreated by the next request, as by
+    `LocalVolume.invalidate`.  The data itself is not modified.
+
+    Returns a dict with the 'num_requests' replayed; the 'p50', 'p95' and 'p99' latencies, and
+    'max', in seconds; the 'throughput' in requests per second over the replay; the
+    'construction_seconds' spent constructing generators; the 'num_invalidations'; and the
+    'peak_rss_bytes' of the process, or None if not available.
+    """
+    from . import _neuroglancer
+
+    options = dict({'background': True}, **trace.mesh_options)
+    if trace.equivalences is not None:
+        options['equivalences'] = np.array(trace.equivalences, dtype=np.uint64).reshape(-1, 2)
+    options.update(mesh_options or {})
+    transposed_data = data.transpose()
+    voxel_size = trace.voxel_size
+    lock = threading.Lock()
+    generator = [None]
+    construction_seconds = [0.0]
+
+    def get_generator():
+        with lock:
+            if generator[0] is None:
+                construction_start = time.time()
+                generator[0] = _neuroglancer.OnDemandObjectMeshGenerator(
+                    transposed_data, voxel_size, np.zeros(3), **options)
+                construction_seconds[0] += time.time() - construction_start
+            return generator[0]
+
+    events = trace.events
+    next_event = [0]
+    latencies = []
+    num_invalidations = [0]
+    errors = []
+
+    def run_client():
+        while True:
+            with lock:
+                if next_event[0] == len(events) or errors:
+                    return
+                event = events[next_event[0]]
+                next_event[0] += 1
+            issue_time = time.time()
+            if speed > 0:
+                scheduled_time = replay_start + event['time'] / speed
+                if scheduled_time > issue_time:
+                    time.sleep(scheduled_time - issue_time)
+                issue_time = scheduled_time
+            try:
+                if event['type'] == 'get_mesh':
+                    get_generator().get_mesh(event['object_id'], event['lod'])
+                    latency = time.time() - issue_time
+                    with lock:
+                        latencies.append(latency)
+                elif event['type'] == 'invalidate':
+                    with lock:
+                        old_generator = generator[0]
+                        generator[0] = None
+                        num_invalidations[0] += 1
+                        if old_generator is not None:
+                            old_generator.cancel_build()
+                            old_generator.cancel_background()
+                        if old_generator is not None and event['start'] is not None:
+                            generator[0] = old_generator.update_region(
+                                transposed_data, tuple(event['start']), tuple(event['end']))
+                else:
+                    raise ValueError('Invalid mesh request trace event: %r' % (event,))
+            except Exception as e:
+                with lock:
+                    errors.append(e)
+                return
+
+    get_generator()
+    replay_start = time.time()
+    clients = [threading.Thread(target=run_client) for _ in range(max(1, num_clients))]
+    for client in clients:
+        client.start()
+    for client in clients:
+        client.join()
+    replay_seconds = time.time() - replay_start
+    if errors:
+        raise errors[0]
+
+    result = dict(num_requests=len(latencies),
+                  throughput=len(latencies) / replay_seconds if replay_seconds > 0 else 0.0,
+                  construction_seconds=construction_seconds[0],
+                  num_invalidations=num_invalidations[0],
+                  peak_rss_bytes=_get_peak_rss_bytes())
+    for name, percentile in (('p50', 50), ('p95', 95), ('p99', 99), ('max', 100)):
+        result[name] = float(np.percentile(latencies, percentile)) if latencies else None
+    return result
@@ -19,6 +19,7 @@ import json
 import multiprocessing
 import re
 import socket
+import struct
 import sys
 import threading
 import weakref
@@ -70,6 +71,7 @@ class Server(object):
             max_workers=multiprocessing.cpu_count())
 
         self.ioloop = ioloop
+        self.gzip_available = local_volume.gzip_available()
         sockjs_router = sockjs.tornado.SockJSRouter(
             SockJSHandler, SOCKET_PATH_REGEX_WITHOUT_GROUP, io_loop=ioloop)
         sockjs_router.neuroglancer_server = self
@@ -124,10 +126,42 @@ class Server(object):
         return viewer.volume_manager.volumes.get(volume_token)
 
 
+# Chunk formats that are not already compressed, and so are served compressed in the gzip format if
+# the client accepts it.
+GZIP_DATA_FORMATS = frozenset(['raw', 'compressed_segmentation'])
+
+
 class BaseRequestHandler(tornado.web.RequestHandler):
     def initialize(self, server):
         self.server = server
 
+    def accepts_gzip(self):
+        """Returns whether the response may be compressed natively in the gzip format."""
+        return (self.server.gzip_available
+                and 'gzip' in self.request.headers.get('Accept-Encoding', ''))
+
+    def set_vary_accept_encoding(self):
+        """Marks the response as depending on Accept-Encoding, so that caches do not serve a
+        compressed response to a client that did not accept it.  This is set on every response of a
+        handler that calls `accepts_gzip`, including the uncompressed ones.
+        """
+        self.set_header('Vary', 'Accept-Encoding')
+
+    def finish_with_buffer(self, data):
+        """Finishes the request with the contents of a buffer object, such as a memoryview.
+
+        Since `write` only accepts `bytes`, the headers are flushed with an explicit Content-Length
+        and the buffer is then written directly to the connection, which avoids copying it.
+        """
+        if isinstance(data, bytes):
+            self.finish(data)
+            return
+        data = memoryview(data)
+        self.set_header('Content-Length', data.nbytes)
+        self.flush()
+        self.request.connection.write(data)
+        self.finish()
+
 class StaticPathHandler(BaseRequestHandler):
     def get(self, viewer_token, path):
         if viewer_token != self.server.token and viewer_token not in self.server.viewers:
@@ -170,6 +204,7 @@ class SkeletonInfoHandler(BaseRequestHandler):
 class SubvolumeHandler(BaseRequestHandler):
     @asynchronous
     def get(self, data_format, token, scale_key, start, end):
+        self.set_vary_accept_encoding()
         start_pos = np.array(start.split(','), dtype=np.int64)
         end_pos = np.array(end.split(','), dtype=np.int64)
         vol = self.server.get_volume(token)
@@ -177,6 +212,8 @@ class SubvolumeHandler(BaseRequestHandler):
             self.send_error(404)
             return
 
+        gzip = data_format in GZIP_DATA_FORMATS and self.accepts_gzip()
+
         def handle_subvolume_result(f):
             try:
                 data, content_type = f.result()
@@ -185,45 +222,88 @@ class SubvolumeHandler(BaseRequestHandler):
                 return
 
             self.set_header('Content-type', content_type)
-            self.finish(data)
+            if gzip:
+                self.set_header('Content-Encoding', 'gzip')
+            self.finish_with_buffer(data)
 
         self.server.executor.submit(
             vol.get_encoded_subvolume,
-            data_format=data_format, start=start_pos, end=end_pos, scale_key=scale_key).add_done_callback(
+            data_format=data_format, start=start_pos, end=end_pos, scale_key=scale_key,
+            gzip=gzip).add_done_callback(
                 lambda f: self.server.ioloop.add_callback(lambda: handle_subvolume_result(f)))
 
 
 class MeshHandler(BaseRequestHandler):
     @asynchronous
     def get(self, key, object_id):
+        self.set_vary_accept_encoding()
         object_id = int(object_id)
+        try:
+            lod = int(self.get_argument('lod', '0'))
+        except ValueError:
+            self.send_error(400, message='Invalid level of detail')
+            return
         vol = self.server.get_volume(key)
         if vol is None or not isinstance(vol, local_volume.LocalVolume):
             self.send_error(404)
             return
 
+        if self.get_argument('stream', '0') == '1':
+            self.stream_mesh(vol, object_id, lod)
+            return
+
         def handle_mesh_result(f):
-            try:
-                encoded_mesh = f.result()
-            except local_volume.MeshImplementationNotAvailable:
-                self.send_error(501, message='Mesh implementation not available')
+            encoded_mesh = self.get_mesh_result(f)
+            if encoded_mesh is None:
                 return
-            except local_volume.MeshesNotSupportedForVolume:
-                self.send_error(405, message='Meshes not supported for volume')
-                return
-            except local_volume.InvalidObjectIdForMesh:
-                self.send_error(404, message='Mesh not available for specified object id')
-                return
-            except ValueError as e:
-                self.send_error(400, message=e.args[0])
-                return
-
             self.set_header('Content-type', 'application/octet-stream')
-            self.finish(encoded_mesh)
-
-        self.server.executor.submit(vol.get_object_mesh, object_id).add_done_callback(
+            if gzip:
+                self.set_header('Content-Encoding', 'gzip')
+            self.finish_with_buffer(encoded_mesh)
+
+        # Meshes are computed, and compressed, by native worker threads, so that simplification
+        # does not tie up the executor threads that serve chunk requests.
+        gzip = self.accepts_gzip()
+        vol.request_object_mesh(object_id, lod, executor=self.server.executor,
+                                gzip=gzip).add_done_callback(
             lambda f: self.server.ioloop.add_callback(lambda: handle_mesh_result(f)))
 
+    def get_mesh_result(self, f):
+        """Returns the result of a mesh request, or sends the error response and returns None."""
+        try:
+            return f.result()
+        except local_volume.MeshImplementationNotAvailable:
+            self.send_error(501, message='Mesh implementation not available')
+        except local_volume.MeshesNotSupportedForVolume:
+            self.send_error(405, message='Meshes not supported for volume')
+        except local_volume.InvalidObjectIdForMesh:
+            self.send_error(404, message='Mesh not available for specified object id')
+        except ValueError as e:
+            self.send_error(400, message=e.args[0])
+        return None
+
+    def stream_mesh(self, vol, object_id, lod):
+        """Sends the mesh as the fragments of `LocalVolume.request_object_mesh_fragments`, in a
+        chunked response, each as soon as it is computed.  Each fragment is written as its uint32le
+        byte length followed by its encoding.
+        """
+        self.set_header('Content-type', 'application/octet-stream')
+
+        def write_fragment(data):
+            self.write(struct.pack('<I', data.nbytes) + data.tobytes())
+            self.flush()
+
+        def handle_done(f):
+            if self.get_mesh_result(f) is not None:
+                self.finish()
+
+        # The fragments are queued on the I/O loop before the future completes.
+        ioloop = self.server.ioloop
+        vol.request_object_mesh_fragments(
+            object_id, lambda data: ioloop.add_callback(lambda: write_fragment(data)), lod,
+            executor=self.server.executor).add_done_callback(
+                lambda f: ioloop.add_callback(lambda: handle_done(f)))
+
 
 class SkeletonHandler(BaseRequestHandler):
     @asynchronous
@@ -232,12 +312,19 @@ class SkeletonHandler(BaseRequestHandler):
         vol = self.server.get_volume(key)
         if vol is None or not isinstance(vol, skeleton.SkeletonSource):
             self.send_error(404)
+            return
 
         def handle_result(f):
             try:
                 encoded_skeleton = f.result()
-            except:
-                self.send_error(500, message=e.args[0])
+            except local_volume.MeshImplementationNotAvailable:
+                self.send_error(501, message='Skeleton implementation not available')
+                return
+            except local_volume.MeshesNotSupportedForVolume:
+                self.send_error(405, message='Skeletons not supported for volume')
+                return
+            except Exception as e:
+                self.send_error(500, message=str(e))
                 return
             if encoded_skeleton is None:
                 self.send_error(404, message='Skeleton not available for specified object id')
@@ -0,0 +1,72 @@
+#!/usr/bin/env python
+# @license
+# Copyright 2016 Google Inc.
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Tool for replaying a recorded mesh request trace to measure mesh serving latency.
+
+Record a trace from a live volume:
+
+    trace = volume.start_mesh_request_trace()
+    ...  # Interact with the viewer.
+    volume.stop_mesh_request_trace().save('trace.jsonl')
+    numpy.save('labels.npy', volume.data)
+
+Then replay it, e.g. with 8 concurrent clients, as fast as they allow:
+
+python -m neuroglancer.tool.replay_mesh_trace --trace trace.jsonl --labels labels.npy --clients 8 --speed 0
+"""
+
+from __future__ import absolute_import, division, print_function
+
+import argparse
+import json
+
+import numpy as np
+
+from neuroglancer import mesh_request_trace
+
+
+def main(args=None):
+    ap = argparse.ArgumentParser()
+    ap.add_argument('--trace', required=True, help='Trace saved by MeshRequestTrace.save.')
+    ap.add_argument('--labels', required=True,
+                    help='.npy file of the labels of the traced volume.')
+    ap.add_argument('--clients', type=int, default=1, help='Number of concurrent clients.')
+    ap.add_argument('--speed', type=float, default=1.0,
+                    help='Replay speed relative to the traced times, or 0 for as fast as possible.')
+    ap.add_argument('--mesh-options', type=json.loads, default=None,
+                    help='JSON object of mesh options overriding the traced ones.')
+    ap.add_argument('--repeat', type=int, default=1, help='Number of replays.')
+    parsed_args = ap.parse_args(args)
+
+    trace = mesh_request_trace.MeshRequestTrace.load(parsed_args.trace)
+    data = np.load(parsed_args.labels, mmap_mode='r')
+    for _ in range(parsed_args.repeat):
+        result = mesh_request_trace.replay_mesh_request_trace(trace,
+                                                              data,
+                                                              num_clients=parsed_args.clients,
+                                                              speed=parsed_args.speed,
+                                                              mesh_options=parsed_args.mesh_options)
+        print('requests: %d, invalidations: %d, construction: %.3f s' %
+              (result['num_requests'], result['num_invalidations'],
+               result['construction_seconds']))
+        if result['num_requests']:
+            print('latency p50: %.2f ms, p95: %.2f ms, p99: %.2f ms, max: %.2f ms' %
+                  tuple(result[k] * 1000 for k in ('p50', 'p95', 'p99', 'max')))
+        print('throughput: %.1f requests/s' % result['throughput'])
+        if result['peak_rss_bytes'] is not None:
+            print('peak RSS: %.1f MiB' % (result['peak_rss_bytes'] / (1024 * 1024)))
+
+
+if __name__ == '__main__':
+    main()
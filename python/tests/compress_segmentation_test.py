@@ -0,0 +1,347 @@
+# @license
+# Copyright 2016 Google Inc.
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from __future__ import absolute_import
+
+import gzip
+import json
+import os
+import struct
+
+import numpy as np
+import pytest
+from neuroglancer import chunks
+from neuroglancer import local_volume
+from neuroglancer import viewer_state
+
+
+def _decompress(encoded, shape, dtype, block_size):
+    """Decodes the compressed_segmentation format, for a 4-d (x, y, z, channel) shape."""
+    words = np.frombuffer(encoded, dtype='<u4')
+    table_words = np.dtype(dtype).itemsize // 4
+    result = np.zeros(shape, dtype=dtype, order='F')
+    grid_size = [-(-shape[i] // block_size[i]) for i in range(3)]
+    for channel in range(shape[3]):
+        base = int(words[channel])
+        for bz in range(grid_size[2]):
+            for by in range(grid_size[1]):
+                for bx in range(grid_size[0]):
+                    block = bx + grid_size[0] * (by + grid_size[1] * bz)
+                    header = base + 2 * block
+                    table_offset = base + int(words[header] & 0xffffff)
+                    bits = int(words[header] >> 24)
+                    values_offset = base + int(words[header + 1] & 0xffffff)
+                    for z in range(block_size[2]):
+                        for y in range(block_size[1]):
+                            for x in range(block_size[0]):
+                                pos = (bx * block_size[0] + x, by * block_size[1] + y,
+                                       bz * block_size[2] + z)
+                                if any(pos[i] >= shape[i] for i in range(3)):
+                                    continue
+                                index = 0
+                                if bits:
+                                    bit = bits * (x + block_size[0] * (y + block_size[1] * z))
+                                    index = (int(words[values_offset + bit // 32]) >>
+                                             (bit % 32)) & ((1 << bits) - 1)
+                                entry = table_offset + index * table_words
+                                value = 0
+                                for i in range(table_words):
+                                    value |= int(words[entry + i]) << (32 * i)
+                                result[pos + (channel, )] = value
+    return result
+
+
+@pytest.mark.parametrize('dtype', ['uint32', 'uint64'])
+def test_compress_segmentation_round_trip(dtype):
+    pytest.importorskip('neuroglancer._neuroglancer')
+    rng = np.random.RandomState(0)
+    data = rng.randint(0, 5, size=(10, 9, 7, 2)).astype(dtype)
+    data[:8, :8, :, 0] = 3
+    if dtype == 'uint64':
+        data[0, 0, 0, 1] = 2**40 + 1
+    block_size = (8, 4, 4)
+    encoded = chunks.encode_compressed_segmentation(data, block_size)
+    np.testing.assert_array_equal(_decompress(encoded, data.shape, dtype, block_size), data)
+    assert chunks.encode_compressed_segmentation(data, block_size, num_threads=3) == encoded
+    out = bytearray(len(encoded) + 3)
+    assert chunks.encode_compressed_segmentation(data, block_size, out=out) == len(encoded)
+    assert bytes(out[:len(encoded)]) == encoded
+    with pytest.raises(ValueError):
+        chunks.encode_compressed_segmentation(data, block_size, out=bytearray(len(encoded) - 4))
+    # Tables shared across channels.
+    shared = chunks.encode_compressed_segmentation(data[..., [0, 0]], block_size,
+                                                   share_tables=True)
+    assert len(shared) < len(chunks.encode_compressed_segmentation(data[..., [0, 0]], block_size))
+    np.testing.assert_array_equal(
+        _decompress(shared, data.shape, dtype, block_size), data[..., [0, 0]])
+    # Strided input, and 3-d input with a single channel.
+    transposed = np.asfortranarray(data[..., 1]).transpose()
+    encoded = chunks.encode_compressed_segmentation(transposed, block_size)
+    np.testing.assert_array_equal(
+        _decompress(encoded, transposed.shape + (1, ), dtype, block_size)[..., 0], transposed)
+
+
+@pytest.mark.parametrize('dtype', ['uint32', 'uint64'])
+def test_decode_compressed_segmentation(dtype):
+    pytest.importorskip('neuroglancer._neuroglancer')
+    rng = np.random.RandomState(0)
+    data = rng.randint(0, 5, size=(10, 9, 7, 2)).astype(dtype)
+    data[:8, :8, :, 0] = 3
+    if dtype == 'uint64':
+        data[0, 0, 0, 1] = 2**40 + 1
+    block_size = (8, 4, 4)
+    encoded = chunks.encode_compressed_segmentation(data, block_size)
+    decoded = chunks.decode_compressed_segmentation(encoded, data.shape, dtype, block_size)
+    assert decoded.dtype == np.dtype(dtype)
+    np.testing.assert_array_equal(decoded, data)
+    np.testing.assert_array_equal(
+        chunks.decode_compressed_segmentation(encoded, data.shape, dtype, block_size,
+                                              start=(3, 2, 1), end=(10, 5, 7)),
+        data[3:10, 2:5, 1:7])
+    for position in [(0, 0, 0, 1), (9, 8, 6, 0), (4, 5, 3, 1)]:
+        assert chunks.read_compressed_segmentation_value(encoded, data.shape, dtype, position,
+                                                         block_size) == data[position]
+    # 3-d input.
+    encoded = chunks.encode_compressed_segmentation(data[..., 1], block_size)
+    np.testing.assert_array_equal(
+        chunks.decode_compressed_segmentation(encoded, data.shape[:3], dtype, block_size),
+        data[..., 1])
+    with pytest.raises(ValueError):
+        chunks.decode_compressed_segmentation(encoded[:len(encoded) // 2], data.shape[:3], dtype,
+                                              block_size)
+    with pytest.raises(ValueError):
+        chunks.decode_compressed_segmentation(encoded, data.shape[:3], dtype, block_size,
+                                              start=(0, 0, 0), end=(11, 9, 7))
+
+
+@pytest.mark.parametrize('dtype', ['uint8', 'uint16'])
+def test_compress_segmentation_narrow(dtype):
+    pytest.importorskip('neuroglancer._neuroglancer')
+    rng = np.random.RandomState(0)
+    data = rng.randint(0, 200, size=(10, 9, 7, 2)).astype(dtype)
+    block_size = (8, 4, 4)
+    encoded = chunks.encode_compressed_segmentation(data, block_size)
+    assert encoded == chunks.encode_compressed_segmentation(data.astype('uint32'), block_size)
+    np.testing.assert_array_equal(_decompress(encoded, data.shape, 'uint32', block_size), data)
+
+
+@pytest.mark.parametrize('dtype', ['uint32', 'uint64'])
+def test_compressed_segmentation_label_counts(dtype):
+    pytest.importorskip('neuroglancer._neuroglancer')
+    rng = np.random.RandomState(0)
+    data = rng.randint(0, 10, size=(10, 9, 7, 2)).astype(dtype) * 1000
+    data[:8, :4, :4] = 3
+    block_size = (8, 4, 4)
+    encoded = chunks.encode_compressed_segmentation(data, block_size)
+    labels, counts = chunks.compressed_segmentation_label_counts(encoded, data.shape, dtype,
+                                                                 block_size=block_size)
+    expected_labels, expected_counts = np.unique(data, return_counts=True)
+    assert labels.dtype == np.dtype(dtype)
+    np.testing.assert_array_equal(labels, expected_labels)
+    np.testing.assert_array_equal(counts, expected_counts)
+
+
+@pytest.mark.parametrize('dtype', ['uint32', 'uint64'])
+def test_relabel_compressed_segmentation(dtype):
+    pytest.importorskip('neuroglancer._neuroglancer')
+    rng = np.random.RandomState(0)
+    data = rng.randint(0, 10, size=(10, 9, 7, 2)).astype(dtype)
+    block_size = (8, 4, 4)
+    encoded = chunks.encode_compressed_segmentation(data, block_size)
+    mapping = {1: 2, 3: 2, 4: 100, 9: 0, 50: 7}
+    relabeled = chunks.relabel_compressed_segmentation(encoded, data.shape, dtype, mapping,
+                                                       block_size=block_size)
+    expected = data.copy()
+    for k, v in mapping.items():
+        expected[data == k] = v
+    np.testing.assert_array_equal(
+        chunks.decode_compressed_segmentation(relabeled, data.shape, dtype, block_size), expected)
+    with pytest.raises(ValueError):
+        chunks.relabel_compressed_segmentation(encoded[:16], data.shape, dtype, mapping,
+                                               block_size=block_size)
+
+
+@pytest.mark.parametrize('dtype', [np.uint32, np.uint64])
+def test_update_compressed_segmentation(dtype):
+    pytest.importorskip('neuroglancer._neuroglancer')
+    rng = np.random.RandomState(0)
+    data = rng.randint(0, 10, size=(10, 9, 7, 2)).astype(dtype)
+    block_size = (8, 4, 4)
+    encoded = chunks.encode_compressed_segmentation(data, block_size)
+    data[2:5, 3:9, 1:2] = rng.randint(5, 20, size=(3, 6, 1, 2))
+    start, end = (2, 3, 1), (5, 9, 2)
+    updated = chunks.update_compressed_segmentation(encoded, data, start, end,
+                                                    block_size=block_size)
+    np.testing.assert_array_equal(
+        chunks.decode_compressed_segmentation(updated, data.shape, dtype, block_size), data)
+    compacted = chunks.update_compressed_segmentation(encoded, data, start, end,
+                                                      block_size=block_size, compact=True)
+    assert compacted == chunks.encode_compressed_segmentation(data, block_size)
+    with pytest.raises(ValueError):
+        chunks.update_compressed_segmentation(encoded, data, start, (11, 9, 2),
+                                              block_size=block_size)
+
+
+@pytest.mark.parametrize('factor', [(2, 2, 2), (3, 2, 1)])
+def test_downsample_compressed_segmentation(factor):
+    pytest.importorskip('neuroglancer._neuroglancer')
+    from neuroglancer import downsample
+    rng = np.random.RandomState(0)
+    # Mostly single-valued blocks.
+    data = np.repeat(rng.randint(0, 5, size=(3, 5, 4)), 4, axis=1)[:, :19, :]
+    data = np.repeat(np.repeat(data, 8, axis=0)[:21], 4, axis=2)[..., :15].astype(np.uint64)
+    data[3:7, 2:9, 5:8] = rng.randint(0, 3, size=(4, 7, 3))
+    block_size = (8, 4, 4)
+    encoded = chunks.encode_compressed_segmentation(data, block_size)
+    downsampled = chunks.downsample_compressed_segmentation(encoded, data.shape, data.dtype,
+                                                            factor, block_size=block_size,
+                                                            num_threads=2)
+    expected = downsample.downsample_with_mode(data, factor)
+    assert downsampled == chunks.encode_compressed_segmentation(expected, block_size)
+
+
+def test_compress_segmentation_invalid():
+    pytest.importorskip('neuroglancer._neuroglancer')
+    with pytest.raises(ValueError):
+        chunks.encode_compressed_segmentation(np.zeros((4, 4, 4), dtype=np.float32))
+    with pytest.raises(ValueError):
+        chunks.encode_compressed_segmentation(np.zeros((4, 4, 4), dtype=np.uint32), (0, 8, 8))
+
+
+def test_choose_compressed_segmentation_block_size():
+    pytest.importorskip('neuroglancer._neuroglancer')
+    candidates = ((8, 8, 8), (4, 4, 4), (16, 16, 16))
+    data = np.full((32, 32, 16), 3, dtype=np.uint32)
+    assert chunks.choose_compressed_segmentation_block_size(
+        data, (16, 16, 16), candidates) == (16, 16, 16)
+    # Each 4x4x4 cube of its own label.
+    x, y, z = np.indices(data.shape) // 4
+    data = (1 + x + 8 * (y + 8 * z)).astype(np.uint32)
+    assert chunks.choose_compressed_segmentation_block_size(
+        data, (16, 16, 16), candidates, num_threads=2) == (4, 4, 4)
+    with pytest.raises(ValueError):
+        chunks.choose_compressed_segmentation_block_size(data, (16, 16, 16), [])
+
+
+def test_local_volume_compressed_segmentation():
+    pytest.importorskip('neuroglancer._neuroglancer')
+    data = np.arange(6 * 5 * 4, dtype=np.uint64).reshape((6, 5, 4)) % 3
+    dimensions = viewer_state.CoordinateSpace(names=['x', 'y', 'z'],
+                                              scales=[1, 1, 1],
+                                              units=['m', 'm', 'm'])
+    vol = local_volume.LocalVolume(data, dimensions=dimensions,
+                                   encoding='compressed_segmentation')
+    info = vol.info()
+    assert info['encoding'] == 'compressed_segmentation'
+    block_size = info['compressedSegmentationBlockSize']
+    encoded, content_type = vol.get_encoded_subvolume(
+        data_format='compressed_segmentation', start=np.array([0, 1, 0]),
+        end=np.array([6, 5, 3]), scale_key='1,1,1')
+    assert content_type == 'application/octet-stream'
+    np.testing.assert_array_equal(
+        _decompress(encoded, (6, 4, 3, 1), 'uint64', block_size)[..., 0], data[:, 1:5, :3])
+    with pytest.raises(ValueError):
+        local_volume.LocalVolume(data.astype(np.float32), dimensions=dimensions,
+                                 encoding='compressed_segmentation')
+
+
+
+def test_local_volume_chunk_cache():
+    pytest.importorskip('neuroglancer._neuroglancer')
+    data = np.arange(6 * 5 * 4, dtype=np.uint64).reshape((6, 5, 4)) % 3
+    dimensions = viewer_state.CoordinateSpace(names=['x', 'y', 'z'],
+                                              scales=[1, 1, 1],
+                                              units=['m', 'm', 'm'])
+    vol = local_volume.LocalVolume(data, dimensions=dimensions, encoding='compressed_segmentation')
+
+    def get_chunk(start, end):
+        return bytes(vol.get_encoded_subvolume(data_format='compressed_segmentation',
+                                               start=np.array(start), end=np.array(end),
+                                               scale_key='1,1,1')[0])
+
+    first = get_chunk([0, 0, 0], [6, 5, 2])
+    second = get_chunk([0, 0, 2], [6, 5, 4])
+    assert get_chunk([0, 0, 0], [6, 5, 2]) == first
+    statistics = vol.get_chunk_cache_statistics()
+    assert (statistics['hits'], statistics['misses'], statistics['num_cached']) == (1, 2, 2)
+    # Only the chunk intersecting the modified region is recomputed.
+    data[1, 1, 3] = 7
+    vol.invalidate(start=(1, 1, 3), end=(2, 2, 4))
+    assert get_chunk([0, 0, 0], [6, 5, 2]) == first
+    updated = get_chunk([0, 0, 2], [6, 5, 4])
+    assert updated != second
+    assert updated == chunks.encode_compressed_segmentation(data[:, :, 2:])
+    assert vol.get_chunk_cache_statistics()['misses'] == 3
+    vol.invalidate()
+    assert vol.get_chunk_cache_statistics()['num_cached'] == 0
+
+    if local_volume.gzip_available():
+        compressed = vol.get_encoded_subvolume(data_format='compressed_segmentation',
+                                               start=np.array([0, 0, 0]), end=np.array([6, 5, 2]),
+                                               scale_key='1,1,1', gzip=True)[0]
+        assert gzip.decompress(bytes(compressed)) == first
+
+
+def _read_shard(path, minishard_bits):
+    """Returns the chunks of a shard file with raw encodings, by chunk id."""
+    with open(path, 'rb') as f:
+        shard = f.read()
+    index_end = 16 << minishard_bits
+    chunks_by_id = {}
+    for minishard in range(1 << minishard_bits):
+        start, end = struct.unpack_from('<QQ', shard, minishard * 16)
+        index = np.frombuffer(shard[index_end + start:index_end + end],
+                              dtype='<u8').reshape(3, -1)
+        ids = np.cumsum(index[0])
+        offset = 0
+        for chunk_id, delta, size in zip(ids, index[1], index[2]):
+            offset += int(delta)
+            chunks_by_id[int(chunk_id)] = shard[index_end + offset:index_end + offset + int(size)]
+            offset += int(size)
+    return chunks_by_id
+
+
+def test_local_volume_export_sharded_segmentation(tmpdir):
+    pytest.importorskip('neuroglancer._neuroglancer')
+    rng = np.random.RandomState(0)
+    data = rng.randint(0, 4, size=(10, 7, 5)).astype(np.uint16)
+    dimensions = viewer_state.CoordinateSpace(names=['x', 'y', 'z'],
+                                              scales=[4, 4, 40],
+                                              units=['nm', 'nm', 'nm'])
+    vol = local_volume.LocalVolume(data, dimensions=dimensions)
+    path = str(tmpdir.join('volume'))
+    block_size = (2, 2, 2)
+    vol.export_sharded_segmentation(path, chunk_size=(4, 4, 4), block_size=block_size,
+                                    minishard_bits=1, hash='identity', num_threads=2)
+    with open(os.path.join(path, 'info'), 'r') as f:
+        info = json.load(f)
+    assert info['data_type'] == 'uint32'
+    scale = info['scales'][0]
+    assert scale['key'] == '4_4_40'
+    assert scale['size'] == [10, 7, 5]
+    assert scale['sharding']['hash'] == 'identity'
+    chunks_by_id = _read_shard(os.path.join(path, '4_4_40', '0.shard'), 1)
+    # The grid of 3x2x2 chunks; the compressed Morton code interleaves bit 0 of x, y and z, then
+    # bit 1 of x.
+    assert len(chunks_by_id) == 12
+    for x in range(3):
+        for y in range(2):
+            for z in range(2):
+                chunk_id = (x & 1) | (y << 1) | (z << 2) | ((x >> 1) << 3)
+                box = data[4 * x:4 * x + 4, 4 * y:4 * y + 4, 4 * z:4 * z + 4]
+                decoded = _decompress(chunks_by_id[chunk_id], box.shape + (1, ), 'uint32',
+                                      block_size)
+                np.testing.assert_array_equal(decoded[..., 0], box)
+    with pytest.raises(ValueError):
+        vol.export_sharded_segmentation(path, hash='invalid')
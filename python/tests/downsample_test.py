@@ -0,0 +1,81 @@
+# @license
+# Copyright 2016 Google Inc.
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from __future__ import absolute_import
+
+import math
+
+import numpy as np
+import pytest
+from neuroglancer import _neuroglancer
+from neuroglancer import downsample
+
+
+def _windows(array, factor):
+    output_shape = tuple(int(math.ceil(s / f)) for s, f in zip(array.shape, factor))
+    for index in np.ndindex(output_shape):
+        yield index, array[tuple(np.s_[i * f:(i + 1) * f] for i, f in zip(index, factor))]
+
+
+@pytest.mark.parametrize('dtype', ['uint8', 'int16', 'uint32', 'int64', 'float32', 'float64'])
+@pytest.mark.parametrize('order', ['C', 'F'])
+def test_average(dtype, order):
+    rng = np.random.RandomState(0)
+    array = np.asarray(rng.randint(-100 if np.dtype(dtype).kind != 'u' else 0, 100,
+                                   size=(7, 5, 9)),
+                       dtype=dtype, order=order)
+    factor = (2, 3, 4)
+    result = _neuroglancer.downsample(array, factor)
+    assert result.dtype == array.dtype
+    assert result.shape == (4, 2, 3)
+    for index, window in _windows(array, factor):
+        expected = window.astype(np.float64).mean()
+        if array.dtype.kind != 'f':
+            expected = np.trunc(expected)
+        np.testing.assert_allclose(result[index], expected, rtol=1e-6)
+
+
+@pytest.mark.parametrize('dtype', ['uint8', 'uint16', 'int32', 'uint64'])
+def test_mode(dtype):
+    rng = np.random.RandomState(1)
+    array = np.asarray(rng.randint(0, 3, size=(6, 7, 5)), dtype=dtype)[:, ::-1]
+    factor = (2, 2, 3)
+    result = downsample.downsample_with_mode(array, factor)
+    assert result.dtype == array.dtype
+    for index, window in _windows(array, factor):
+        values = list(window.ravel())
+        counts = [values.count(v) for v in values]
+        assert result[index] == values[counts.index(max(counts))]
+
+
+def test_mode_matches_striding_for_distinct_values():
+    array = np.arange(6 * 8, dtype=np.uint64).reshape(6, 8)
+    np.testing.assert_array_equal(
+        downsample.downsample_with_mode(array, (2, 3)),
+        downsample.downsample_with_striding(array, (2, 3)))
+
+
+def test_out():
+    array = np.arange(16, dtype=np.uint32).reshape(4, 4)
+    out = np.zeros((2, 2), dtype=np.uint32)
+    assert _neuroglancer.downsample(array, (2, 2), out=out) is out
+    np.testing.assert_array_equal(out, [[2, 4], [10, 12]])
+    with pytest.raises(ValueError):
+        _neuroglancer.downsample(array, (2, 2), out=np.zeros((3, 2), dtype=np.uint32))
+    with pytest.raises(ValueError):
+        _neuroglancer.downsample(array, (2, 2), out=np.zeros((2, 2), dtype=np.uint64))
+    with pytest.raises(ValueError):
+        _neuroglancer.downsample(array, (2, 2, 2))
+    with pytest.raises(ValueError):
+        _neuroglancer.downsample(array.astype(np.float32), (2, 2), method='mode')
@@ -0,0 +1,71 @@
+# @license
+# Copyright 2016 Google Inc.
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from __future__ import absolute_import
+
+import numpy as np
+from neuroglancer import local_volume
+from neuroglancer import mesh_request_trace
+from neuroglancer import viewer_state
+
+
+def _make_volume():
+    data = np.zeros((10, 8, 8), dtype=np.uint32)
+    data[1:5, 1:7, 1:7] = 1
+    data[5:9, 1:7, 1:7] = 2
+    dimensions = viewer_state.CoordinateSpace(names=['x', 'y', 'z'],
+                                              scales=[1, 1, 1],
+                                              units=['m', 'm', 'm'],)
+    return local_volume.LocalVolume(data, dimensions=dimensions,
+                                    mesh_options=dict(max_quadrics_error=1e6))
+
+
+def test_record_and_replay(tmpdir):
+    vol = _make_volume()
+    vol.get_object_mesh(1)
+    trace = vol.start_mesh_request_trace()
+    vol.get_object_mesh(1)
+    vol.get_object_meshes([1, 2])
+    vol.invalidate((0, 0, 0), (5, 8, 8))
+    vol.request_object_mesh(2).result()
+    vol.invalidate()
+    vol.get_object_mesh(1)
+    assert vol.stop_mesh_request_trace() is trace
+    vol.get_object_mesh(2)
+
+    assert [event['type'] for event in trace.events] == [
+        'get_mesh', 'get_mesh', 'get_mesh', 'invalidate', 'get_mesh', 'invalidate', 'get_mesh'
+    ]
+    assert [event.get('object_id') for event in trace.events] == [1, 1, 2, None, 2, None, 1]
+    assert trace.events[3]['start'] == [0, 0, 0]
+    assert trace.events[3]['end'] == [5, 8, 8]
+    assert trace.events[5]['start'] is None
+    times = [event['time'] for event in trace.events]
+    assert times == sorted(times)
+
+    path = str(tmpdir.join('trace.jsonl'))
+    trace.save(path)
+    loaded = mesh_request_trace.MeshRequestTrace.load(path)
+    assert loaded.events == trace.events
+    assert loaded.voxel_size == [1, 1, 1]
+    assert loaded.mesh_options == dict(max_quadrics_error=1e6)
+
+    for num_clients in (1, 3):
+        result = mesh_request_trace.replay_mesh_request_trace(loaded, vol.data,
+                                                              num_clients=num_clients, speed=0)
+        assert result['num_requests'] == 5
+        assert result['num_invalidations'] == 2
+        assert 0 <= result['p50'] <= result['p95'] <= result['p99'] <= result['max']
+        assert result['throughput'] > 0
+        assert result['construction_seconds'] > 0
@@ -14,9 +14,16 @@
 
 from __future__ import absolute_import
 
+import gzip
+import json
 import os
+import struct
 
 import numpy as np
+import pytest
+from six.moves import urllib
+import neuroglancer
+from neuroglancer import equivalence_map
 from neuroglancer import local_volume
 from neuroglancer import viewer_state
 from neuroglancer import test_util
@@ -24,6 +31,27 @@ from neuroglancer import test_util
 testdata_dir = os.path.join(os.path.dirname(__file__), '..', 'testdata', 'mesh')
 
 
+def _make_simple_volume(**mesh_options):
+    data = np.array(
+        [
+            [[1, 1, 1, 2, 2, 2], [1, 1, 1, 2, 2, 2], [1, 1, 1, 2, 2, 2]],
+            [[1, 1, 1, 2, 2, 2], [1, 1, 1, 2, 2, 2], [1, 1, 1, 2, 2, 2]],
+        ],
+        dtype=np.uint64).transpose()
+    data = np.pad(data, 1, 'constant')
+    dimensions = viewer_state.CoordinateSpace(names=['x', 'y', 'z'],
+                                              scales=[1, 1, 1],
+                                              units=['m', 'm', 'm'],)
+    vol = local_volume.LocalVolume(
+        data, dimensions=dimensions,
+        mesh_options=dict(
+            max_quadrics_error=1e6,
+            **mesh_options
+        ),
+    )
+    return vol
+
+
 def test_simple_mesh():
     data = np.array(
         [
@@ -43,3 +71,687 @@ def test_simple_mesh():
     )
     test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'), vol.get_object_mesh(1))
     test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'), vol.get_object_mesh(2))
+
+
+# Options that change how the meshes are computed, stored or released, but not the meshes.
+@pytest.mark.parametrize('mesh_options', [
+    dict(lazy=True),
+    dict(background=False),
+    dict(compact_meshes=True),
+    dict(shrink_unsimplified_meshes=True, release_memory_after_build=True),
+    dict(preview_factor=(2, 2, 2)),
+    dict(preview_factor=(2, 2, 2), lazy=True),
+])
+def test_simple_mesh_options(mesh_options):
+    vol = _make_simple_volume(**mesh_options)
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'), vol.get_object_mesh(1))
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'), vol.get_object_mesh(2))
+
+
+def test_simple_mesh_cache_eviction():
+    # Small enough that only a single mesh fits in the cache.
+    vol = _make_simple_volume(max_cache_bytes=1)
+    for _ in range(2):
+        test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'),
+                                        vol.get_object_mesh(1))
+        test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'),
+                                        vol.get_object_mesh(2))
+    stats = vol.get_mesh_cache_statistics()
+    assert stats['misses'] == 4
+    assert stats['evictions'] == 3
+    assert stats['num_cached'] == 1
+    vol.get_object_mesh(2)
+    assert vol.get_mesh_cache_statistics()['hits'] == 1
+
+
+def test_simple_mesh_cache_directory(tmpdir):
+    cache_directory = str(tmpdir)
+    vol = _make_simple_volume(cache_directory=cache_directory, lazy=True)
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'), vol.get_object_mesh(1))
+    stats = vol.get_mesh_cache_statistics()
+    assert stats['disk_hits'] == 0
+    assert stats['disk_writes'] == 1
+
+    # A new volume with the same data and options reads the stored mesh.
+    vol = _make_simple_volume(cache_directory=cache_directory, lazy=True)
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'), vol.get_object_mesh(1))
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'), vol.get_object_mesh(2))
+    stats = vol.get_mesh_stats()
+    assert stats['disk_hits'] == 1
+    assert stats['disk_writes'] == 1
+    assert stats['num_objects'] == 1
+
+    # Other options do not share the stored meshes.
+    vol = _make_simple_volume(cache_directory=cache_directory, encoding='quantized16')
+    vol.get_object_mesh(1)
+    assert vol.get_mesh_cache_statistics()['disk_hits'] == 0
+
+
+def test_simple_mesh_shared_store():
+    local_volume.set_shared_mesh_store_bytes(1 << 20)
+    try:
+        vol = _make_simple_volume()
+        vol.get_object_mesh(1)
+        vol.get_object_mesh(2)
+        assert vol.get_mesh_cache_statistics()['shared_hits'] == 0
+
+        # Only the surface of object 2 changes, so the mesh of object 1 is reused.
+        vol.data[6, 2, 1] = 0
+        vol.invalidate()
+        vol.get_object_mesh(1)
+        vol.get_object_mesh(2)
+        stats = vol.get_mesh_stats()
+        assert stats['shared_hits'] == 1
+        assert stats['num_objects'] == 1
+    finally:
+        local_volume.set_shared_mesh_store_bytes(0)
+
+
+def test_simple_mesh_gzip():
+    if not local_volume.gzip_available():
+        pytest.skip('gzip compression is not available')
+    vol = _make_simple_volume()
+    compressed = vol.get_object_mesh(1, gzip=True)
+    assert gzip.decompress(bytes(compressed)) == bytes(vol.get_object_mesh(1))
+    assert vol.request_object_mesh(2, gzip=True).result() == vol.get_object_mesh(2, gzip=True)
+
+
+def _serve_volume(vol):
+    """Registers `vol` with the server of a new viewer, which must be kept alive while it is served.
+
+    Returns the viewer and the URL prefix under which the volume is served.
+    """
+    viewer = neuroglancer.Viewer()
+    viewer.volume_manager.register_volume(vol)
+    return viewer, '%s/neuroglancer/%%s/%s' % (neuroglancer.server.get_server_url(),
+                                               viewer.volume_manager.get_volume_key(vol))
+
+
+def _fetch(url, accept_encoding=None):
+    """Returns the headers and body of a GET request."""
+    request = urllib.request.Request(url)
+    if accept_encoding is not None:
+        request.add_header('Accept-Encoding', accept_encoding)
+    response = urllib.request.urlopen(request)
+    try:
+        return response.info(), response.read()
+    finally:
+        response.close()
+
+
+def test_simple_mesh_server_gzip():
+    vol = _make_simple_volume()
+    viewer, url = _serve_volume(vol)
+    end = ','.join(str(x) for x in vol.shape)
+    chunk_url = url % 'raw' + '/1,1,1/0,0,0/' + end
+    expected_chunk = bytes(vol.get_encoded_subvolume('raw', [0, 0, 0], vol.shape, '1,1,1')[0])
+    for accept_encoding in [None, 'identity', 'gzip']:
+        compressed = accept_encoding == 'gzip' and local_volume.gzip_available()
+        for request_url, expected in [(url % 'mesh' + '/1', bytes(vol.get_object_mesh(1))),
+                                      (chunk_url, expected_chunk)]:
+            headers, body = _fetch(request_url, accept_encoding)
+            # Sent with the uncompressed responses too, so that caches keep them apart from the
+            # compressed ones.
+            assert headers.get('Vary') == 'Accept-Encoding'
+            if compressed:
+                assert headers.get('Content-Encoding') == 'gzip'
+                body = gzip.decompress(body)
+            else:
+                assert headers.get('Content-Encoding') is None
+            assert body == expected
+    del viewer
+
+
+def test_mesh_lods():
+    # A ball, whose surface is simplified further at each level of detail.
+    grid = np.indices((24, 24, 24)) - 11.5
+    data = (np.sum(grid**2, axis=0) < 10**2).astype(np.uint64)
+    dimensions = viewer_state.CoordinateSpace(names=['x', 'y', 'z'],
+                                              scales=[1, 1, 1],
+                                              units=['m', 'm', 'm'],)
+    vol = local_volume.LocalVolume(
+        data, dimensions=dimensions,
+        mesh_options=dict(max_quadrics_error=0.1, num_lods=3, lod_quadrics_error_factor=10.0),
+    )
+    num_triangles = [
+        _decode_raw_mesh(vol.get_object_mesh(1, lod=lod))[1].shape[0] for lod in range(3)
+    ]
+    assert num_triangles[0] > 0
+    assert num_triangles[0] >= num_triangles[1] >= num_triangles[2]
+    assert num_triangles[2] < num_triangles[0]
+
+    for lod in [-1, 3]:
+        with pytest.raises(ValueError):
+            vol.get_object_mesh(1, lod=lod)
+        with pytest.raises(ValueError):
+            vol.request_object_mesh(1, lod=lod).result()
+
+    # The server forwards the `lod` parameter, and rejects levels that are out of range.
+    viewer, url = _serve_volume(vol)
+    for lod in range(3):
+        _, body = _fetch(url % 'mesh' + '/1?lod=%d' % lod)
+        assert body == bytes(vol.get_object_mesh(1, lod=lod))
+    with pytest.raises(urllib.error.HTTPError) as exc_info:
+        _fetch(url % 'mesh' + '/1?lod=3')
+    assert exc_info.value.code == 400
+    del viewer
+
+
+def test_simple_mesh_shared_segment(tmpdir):
+    if os.name == 'nt':
+        pytest.skip('Shared mesh segments are not supported on Windows')
+    local_volume.set_shared_mesh_segment(str(tmpdir.join('meshes')), 1 << 20)
+    try:
+        vol = _make_simple_volume()
+        mesh = vol.get_object_mesh(1)
+        assert vol.get_mesh_cache_statistics()['shared_hits'] == 0
+
+        # Another process attached to the segment would reuse the mesh, like a new volume does.
+        other_vol = _make_simple_volume()
+        assert other_vol.get_object_mesh(1) == mesh
+        assert other_vol.get_mesh_cache_statistics()['shared_hits'] == 1
+    finally:
+        local_volume.set_shared_mesh_segment(None)
+
+
+def test_simple_mesh_preview():
+    vol = _make_simple_volume(preview_factor=(2, 2, 2), lazy=True)
+    preview = vol.get_object_preview_mesh(2)
+    num_vertices = struct.unpack('<I', preview[:4])[0]
+    positions = np.frombuffer(preview[4:4 + 12 * num_vertices], dtype='<f4').reshape(-1, 3)
+    assert num_vertices > 0
+    # The preview is within a preview voxel of the full-resolution mesh.
+    full = vol.get_object_mesh(2)
+    num_full_vertices = struct.unpack('<I', full[:4])[0]
+    full_positions = np.frombuffer(full[4:4 + 12 * num_full_vertices],
+                                   dtype='<f4').reshape(-1, 3)
+    assert np.all(positions >= full_positions.min(axis=0) - 2)
+    assert np.all(positions <= full_positions.max(axis=0) + 2)
+
+    vol = _make_simple_volume()
+    with pytest.raises(local_volume.InvalidObjectIdForMesh):
+        vol.get_object_preview_mesh(2)
+
+
+def test_simple_mesh_batch():
+    vol = _make_simple_volume()
+    meshes = vol.get_object_meshes([2, 1])
+    assert sorted(meshes.keys()) == [1, 2]
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'), meshes[1])
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'), meshes[2])
+
+
+def test_simple_mesh_invalidate_region():
+    vol = _make_simple_volume()
+    vol.get_object_mesh(1)
+    vol.get_object_mesh(2)
+    # Relabel a corner of object 2 as new object 3.
+    vol.data[5:7, 1:3, 1:2] = 3
+    vol.invalidate(start=(5, 1, 1), end=(7, 3, 2))
+    expected_vol = local_volume.LocalVolume(vol.data.copy(), dimensions=vol.dimensions,
+                                            mesh_options=dict(max_quadrics_error=1e6))
+    for object_id in [1, 2, 3]:
+        assert vol.get_object_mesh(object_id) == expected_vol.get_object_mesh(object_id)
+
+
+def test_simple_mesh_equivalences():
+    for mesh_options in [dict(), dict(lazy=True)]:
+        vol = _make_simple_volume(**mesh_options)
+        original = {object_id: vol.get_object_mesh(object_id) for object_id in [1, 2]}
+        vol.data[5:7, 1:3, 1:2] = 3
+        vol.invalidate()
+        # Merge 3 into 2, which leaves the mesh of 1 unchanged, and then 2 into 1.
+        vol.set_mesh_equivalences({3: 2})
+        assert vol.get_object_mesh(1) == original[1]
+        assert vol.get_object_mesh(2) == original[2]
+        with pytest.raises(local_volume.InvalidObjectIdForMesh):
+            vol.get_object_mesh(3)
+        vol.set_mesh_equivalences(equivalence_map.EquivalenceMap([[1, 2, 3]]))
+        merged_data = np.where(vol.data != 0, 1, 0).astype(np.uint64)
+        expected_vol = local_volume.LocalVolume(merged_data, dimensions=vol.dimensions,
+                                                mesh_options=dict(max_quadrics_error=1e6))
+        assert vol.get_object_mesh(1) == expected_vol.get_object_mesh(1)
+        with pytest.raises(local_volume.InvalidObjectIdForMesh):
+            vol.get_object_mesh(2)
+        vol.set_mesh_equivalences(None)
+        expected_vol = local_volume.LocalVolume(vol.data.copy(), dimensions=vol.dimensions,
+                                                mesh_options=dict(max_quadrics_error=1e6))
+        for object_id in [1, 2, 3]:
+            assert vol.get_object_mesh(object_id) == expected_vol.get_object_mesh(object_id)
+
+
+def test_simple_mesh_int64_equivalences():
+    # Signed integer arrays are accepted like Python ints.
+    vol = _make_simple_volume(equivalences=np.array([[2, 1]], dtype=np.int64))
+    vol.get_object_mesh(1)
+    with pytest.raises(local_volume.InvalidObjectIdForMesh):
+        vol.get_object_mesh(2)
+
+
+def test_simple_mesh_object_ids():
+    for mesh_options in [dict(), dict(lazy=True), dict(block_size=[4, 4, 4])]:
+        vol = _make_simple_volume(object_ids=[2, 5], **mesh_options)
+        test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'),
+                                        vol.get_object_mesh(2))
+        with pytest.raises(local_volume.InvalidObjectIdForMesh):
+            vol.get_object_mesh(1)
+    # Signed integer arrays are accepted like Python ints.
+    vol = _make_simple_volume(object_ids=np.array([2, 5], dtype=np.int64))
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'), vol.get_object_mesh(2))
+
+
+def test_simple_mesh_request():
+    for mesh_options in [dict(), dict(lazy=True), dict(max_cache_bytes=1)]:
+        vol = _make_simple_volume(**mesh_options)
+        futures = [vol.request_object_mesh(object_id, priority=object_id) for object_id in [1, 2]]
+        test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'),
+                                        futures[0].result(timeout=60))
+        test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'),
+                                        futures[1].result(timeout=60))
+        with pytest.raises(local_volume.InvalidObjectIdForMesh):
+            vol.request_object_mesh(3).result(timeout=60)
+
+
+def test_simple_mesh_fragments():
+    for mesh_options in [dict(), dict(lazy=True), dict(compact_meshes=True)]:
+        vol = _make_simple_volume(**mesh_options)
+        fragments = []
+        num_fragments = vol.request_object_mesh_fragments(
+            1, lambda data: fragments.append(bytes(data)),
+            fragment_triangles=8).result(timeout=60)
+        assert num_fragments == len(fragments) > 1
+        lower = np.full(3, np.inf)
+        upper = np.full(3, -np.inf)
+        for fragment in fragments:
+            num_vertices = struct.unpack('<I', fragment[:4])[0]
+            positions = np.frombuffer(fragment[4:4 + 12 * num_vertices],
+                                      dtype='<f4').reshape(-1, 3)
+            indices = np.frombuffer(fragment[4 + 12 * num_vertices:], dtype='<u4')
+            assert len(indices) > 0 and len(indices) % 3 == 0
+            assert indices.max() < num_vertices
+            lower = np.minimum(lower, positions.min(axis=0))
+            upper = np.maximum(upper, positions.max(axis=0))
+        # The fragments together span the whole mesh, which is simplified further since none of
+        # its vertices are locked.
+        mesh = bytes(vol.get_object_mesh(1))
+        num_vertices = struct.unpack('<I', mesh[:4])[0]
+        positions = np.frombuffer(mesh[4:4 + 12 * num_vertices], dtype='<f4').reshape(-1, 3)
+        assert np.all(lower <= positions.min(axis=0))
+        assert np.all(upper >= positions.max(axis=0))
+
+        # A cached mesh is sent as a single fragment.
+        fragments = []
+        assert vol.request_object_mesh_fragments(
+            1, fragments.append, fragment_triangles=8).result(timeout=60) == 1
+        assert fragments[0] == vol.get_object_mesh(1)
+        with pytest.raises(local_volume.InvalidObjectIdForMesh):
+            vol.request_object_mesh_fragments(3, fragments.append).result(timeout=60)
+
+
+def test_simple_mesh_precompute_in_background():
+    vol = _make_simple_volume(lazy=True)
+    vol.precompute_object_meshes(background=True)
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'),
+                                    vol.request_object_mesh(1, priority=1).result(timeout=60))
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'),
+                                    vol.get_object_mesh(2))
+    stats = vol.get_mesh_stats()
+    assert stats['queued_requests'] == 0
+    assert stats['queued_background'] <= 2
+    vol.cancel_mesh_precompute()
+    assert vol.get_mesh_stats()['queued_background'] == 0
+    assert vol.get_mesh_stats()['num_objects'] == 2
+
+
+def test_simple_mesh_compact():
+    vol = _make_simple_volume(compact_meshes=True)
+    assert vol.wait_for_mesh_build()
+    assert vol.get_mesh_stats()['unsimplified_bytes'] > 0
+    vol.get_object_mesh(1)
+    vol.get_object_mesh(2)
+    assert vol.get_mesh_stats()['unsimplified_bytes'] == 0
+
+
+@pytest.mark.parametrize('shrink', [False, True])
+def test_simple_mesh_memory_statistics(shrink):
+    vol = _make_simple_volume(shrink_unsimplified_meshes=shrink, release_memory_after_build=True,
+                              preview_factor=(2, 2, 2))
+    assert vol.wait_for_mesh_build()
+    memory = vol.get_mesh_memory_statistics()
+    assert memory['construction_bytes'] == 0
+    assert memory['unsimplified_bytes'] == vol.get_mesh_stats()['unsimplified_bytes'] > 0
+    assert memory['cached_bytes'] == 0
+    assert memory['simplification_bytes'] == memory['peak_simplification_bytes'] == 0
+    assert memory['label_copy_bytes'] == 0
+    assert memory['index_bytes'] > 0
+    assert memory['preview_bytes'] > 0
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'), vol.get_object_mesh(1))
+    memory = vol.get_mesh_memory_statistics()
+    assert memory['cached_bytes'] == len(vol.get_object_mesh(1))
+    assert memory['simplification_bytes'] == 0
+    assert memory['peak_simplification_bytes'] > 0
+
+
+def test_simple_mesh_release_unsimplified_meshes():
+    vol = _make_simple_volume(preview_factor=(2, 2, 2))
+    mesh1 = vol.get_object_mesh(1)
+    preview1 = vol.get_object_preview_mesh(1)
+    assert vol.get_mesh_memory_statistics()['unsimplified_bytes'] > 0
+    assert vol.release_unsimplified_meshes()
+    memory = vol.get_mesh_memory_statistics()
+    assert memory['unsimplified_bytes'] == 0
+    assert memory['cached_bytes'] == len(mesh1)
+    assert vol.get_object_preview_mesh(1) == preview1
+    # The cached mesh is kept, and the other is computed from the data.
+    assert vol.get_object_mesh(1) == mesh1
+    assert vol.get_mesh_cache_statistics()['misses'] == 1
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'), vol.get_object_mesh(2))
+    local_volume.release_free_memory()
+
+
+@pytest.mark.parametrize('lazy', [False, True])
+def test_simple_mesh_relayout_labels(lazy):
+    vol = _make_simple_volume(relayout_labels=True, lazy=lazy)
+    vol.data = np.asfortranarray(vol.data)
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'), vol.get_object_mesh(1))
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'), vol.get_object_mesh(2))
+
+
+def test_simple_mesh_background_build():
+    vol = _make_simple_volume()
+    assert vol.get_mesh_build_progress() == 0
+    assert vol.wait_for_mesh_build()
+    assert vol.get_mesh_build_progress() == 1
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'), vol.get_object_mesh(1))
+
+    vol = _make_simple_volume(background=False)
+    vol.get_mesh_stats()
+    assert vol.get_mesh_build_progress() == 1
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'), vol.get_object_mesh(2))
+
+    # Cancellation races with the construction, which either completes or stops.
+    vol = _make_simple_volume()
+    vol.get_mesh_stats()
+    vol.cancel_mesh_build()
+    vol.wait_for_mesh_build()
+    assert 0 <= vol.get_mesh_build_progress() <= 1
+    # The invalidated volume is meshed again from scratch if the construction stopped.
+    vol.invalidate([0, 0, 0], [1, 1, 1])
+    assert vol.wait_for_mesh_build()
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'), vol.get_object_mesh(1))
+
+
+def test_simple_mesh_object_statistics():
+    stats = _make_simple_volume().get_object_statistics()
+    np.testing.assert_array_equal(stats['object_ids'], [1, 2])
+    np.testing.assert_array_equal(stats['start'], [[1, 1, 1], [4, 1, 1]])
+    np.testing.assert_array_equal(stats['end'], [[4, 4, 3], [7, 4, 3]])
+    np.testing.assert_array_equal(stats['num_voxels'], [18, 18])
+    assert np.all(stats['num_boundary_cubes'] > 0)
+    assert np.all(stats['surface_area'] > 0)
+
+    lazy_stats = _make_simple_volume(lazy=True).get_object_statistics()
+    np.testing.assert_array_equal(lazy_stats['num_voxels'], [18, 18])
+    np.testing.assert_array_equal(lazy_stats['num_boundary_cubes'], [-1, -1])
+    np.testing.assert_array_equal(lazy_stats['surface_area'], [-1, -1])
+
+
+def test_simple_mesh_flying_edges():
+    stats = _make_simple_volume().get_object_statistics()
+    fe_stats = _make_simple_volume(meshing_engine='flying_edges').get_object_statistics()
+    np.testing.assert_array_equal(fe_stats['num_boundary_cubes'], stats['num_boundary_cubes'])
+    np.testing.assert_allclose(fe_stats['surface_area'], stats['surface_area'])
+    with pytest.raises(ValueError):
+        _make_simple_volume(meshing_engine='dual_contouring').get_object_statistics()
+
+
+def test_simple_mesh_export_precomputed(tmpdir):
+    vol = _make_simple_volume()
+    path = str(tmpdir.join('mesh'))
+    vol.export_precomputed_meshes(path)
+    with open(os.path.join(path, 'info'), 'r') as f:
+        assert f.read() == '{"@type":"neuroglancer_legacy_mesh"}'
+    for object_id in [1, 2]:
+        with open(os.path.join(path, '%d:0' % object_id), 'r') as f:
+            assert f.read() == '{"fragments":["%d:0:0"]}' % object_id
+        test_util.check_golden_contents(
+            os.path.join(testdata_dir, 'simple%d' % object_id),
+            open(os.path.join(path, '%d:0:0' % object_id), 'rb').read())
+
+    with pytest.raises(ValueError):
+        _make_simple_volume(encoding='quantized16').export_precomputed_meshes(path)
+
+
+def test_simple_mesh_export_sharded_multiresolution(tmpdir):
+    vol = _make_simple_volume()
+    path = str(tmpdir.join('mesh'))
+    try:
+        vol.export_sharded_multiresolution_meshes(path, shard_bits=1, hash='identity')
+    except NotImplementedError:
+        pytest.skip('native extension built without Draco')
+    with open(os.path.join(path, 'info'), 'r') as f:
+        info = json.load(f)
+    assert info['@type'] == 'neuroglancer_multilod_draco'
+    assert info['sharding']['shard_bits'] == 1
+    assert sorted(os.listdir(path)) == ['0.shard', '1.shard', 'info']
+
+
+def test_simple_mesh_quantized():
+    with open(os.path.join(testdata_dir, 'simple1'), 'rb') as f:
+        raw_mesh = f.read()
+    num_vertices = struct.unpack('<I', raw_mesh[:4])[0]
+    num_triangles = (len(raw_mesh) - 4 - 12 * num_vertices) // 12
+    raw_vertices = np.frombuffer(raw_mesh, dtype='<f4', count=num_vertices * 3,
+                                 offset=4).reshape(-1, 3)
+    raw_indices = np.frombuffer(raw_mesh, dtype='<u4', offset=4 + 12 * num_vertices)
+    for position_bits in [16, 10]:
+        vol = _make_simple_volume(encoding='quantized%d' % position_bits)
+        mesh = vol.get_object_mesh(1)
+        header = struct.unpack('<IIII6f', mesh[:40])
+        assert header[:4] == (0xffffffff, position_bits, num_vertices, num_triangles)
+        origin = np.array(header[4:7])
+        scale = np.array(header[7:10])
+        if position_bits == 16:
+            quantized = np.frombuffer(mesh, dtype='<u2', count=num_vertices * 3,
+                                      offset=40).reshape(-1, 3)
+            index_offset = 40 + (num_vertices * 6 + 3) // 4 * 4
+        else:
+            words = np.frombuffer(mesh, dtype='<u4', count=num_vertices, offset=40)
+            quantized = np.stack([(words >> (10 * i)) & 1023 for i in range(3)], axis=-1)
+            index_offset = 40 + num_vertices * 4
+        np.testing.assert_allclose(origin + scale * quantized, raw_vertices,
+                                   atol=np.max(scale) / 2 + 1e-6)
+        np.testing.assert_array_equal(np.frombuffer(mesh, dtype='<u2', offset=index_offset),
+                                      raw_indices)
+
+
+def _decode_raw_mesh(mesh):
+    mesh = bytes(mesh)
+    num_vertices = struct.unpack('<I', mesh[:4])[0]
+    vertices = np.frombuffer(mesh, dtype='<f4', count=num_vertices * 3, offset=4).reshape(-1, 3)
+    indices = np.frombuffer(mesh, dtype='<u4', offset=4 + 12 * num_vertices).reshape(-1, 3)
+    return vertices, indices
+
+
+def _decode_octahedral_normals(encoded, bits):
+    u, v = (encoded.astype(np.float64) / (2**(bits - 1) - 1)).T
+    z = 1 - np.abs(u) - np.abs(v)
+    folded = z < 0
+    x = np.where(folded, (1 - np.abs(v)) * np.where(u < 0, -1, 1), u)
+    y = np.where(folded, (1 - np.abs(u)) * np.where(v < 0, -1, 1), v)
+    normals = np.stack([x, y, z], axis=-1)
+    return normals / np.linalg.norm(normals, axis=-1, keepdims=True)
+
+
+def test_simple_mesh_vertex_normals():
+    expected_mesh = bytes(_make_simple_volume().get_object_mesh(1))
+    vertices, _ = _decode_raw_mesh(expected_mesh)
+    for bits in [8, 16]:
+        vol = _make_simple_volume(vertex_normals='octahedral%d' % bits)
+        mesh = bytes(vol.get_object_mesh(1))
+        assert struct.unpack('<I', mesh[-4:])[0] == 0xffffff00 | bits
+        normals_size = (len(vertices) * bits // 4 + 3) // 4 * 4
+        assert mesh[:len(expected_mesh)] == expected_mesh
+        assert len(mesh) == len(expected_mesh) + normals_size + 4
+        encoded = np.frombuffer(mesh, dtype='<i%d' % (bits // 8), count=len(vertices) * 2,
+                                offset=len(expected_mesh)).reshape(-1, 2)
+        normals = _decode_octahedral_normals(encoded, bits)
+        # The object is a box, so each normal points away from its center.
+        center = (vertices.min(axis=0) + vertices.max(axis=0)) / 2
+        assert np.all(np.sum(normals * (vertices - center), axis=-1) > 0)
+
+    vol = _make_simple_volume(vertex_normals='octahedral16', encoding='quantized16')
+    mesh = bytes(vol.get_object_mesh(1))
+    assert struct.unpack('<I', mesh[4:8])[0] == 16 | (16 << 8)
+    with pytest.raises(ValueError):
+        _make_simple_volume(vertex_normals='float').get_object_mesh(1)
+
+
+def test_simple_mesh_flat_simplifier():
+    vol = _make_simple_volume()
+    flat_vol = _make_simple_volume(simplifier='flat')
+    for object_id in [1, 2]:
+        expected_vertices, expected_indices = _decode_raw_mesh(vol.get_object_mesh(object_id))
+        vertices, indices = _decode_raw_mesh(flat_vol.get_object_mesh(object_id))
+        np.testing.assert_array_equal(vertices.min(axis=0), expected_vertices.min(axis=0))
+        np.testing.assert_array_equal(vertices.max(axis=0), expected_vertices.max(axis=0))
+        assert 0 < len(indices) <= 2 * len(expected_indices)
+        # The simplified surface remains closed: each edge is shared by two triangles.
+        edges = np.sort(np.concatenate([indices[:, [0, 1]], indices[:, [1, 2]],
+                                        indices[:, [2, 0]]]), axis=1)
+        _, counts = np.unique(edges, axis=0, return_counts=True)
+        assert np.all(counts == 2)
+
+
+def test_simple_mesh_voxel_faces():
+    vol = _make_simple_volume()
+    voxel_vol = _make_simple_volume(voxel_faces=True)
+    for object_id in [1, 2]:
+        expected_vertices, _ = _decode_raw_mesh(vol.get_object_mesh(object_id))
+        vertices, indices = _decode_raw_mesh(voxel_vol.get_object_mesh(object_id))
+        np.testing.assert_array_equal(vertices.min(axis=0), expected_vertices.min(axis=0))
+        np.testing.assert_array_equal(vertices.max(axis=0), expected_vertices.max(axis=0))
+        # Each object is a box, whose sides are each merged into a single rectangle.
+        assert len(vertices) == 8
+        assert len(indices) == 12
+        np.testing.assert_array_equal(vertices % 1, 0.5)
+
+
+def test_mesh_size_caps():
+    z, y, x = np.mgrid[:16, :16, :16]
+    data = (((x - 7.5)**2 + (y - 7.5)**2 + (z - 7.5)**2) < 36).astype(np.uint64)
+    dimensions = viewer_state.CoordinateSpace(names=['x', 'y', 'z'],
+                                              scales=[1, 1, 1],
+                                              units=['m', 'm', 'm'],)
+
+    def get_mesh(**mesh_options):
+        vol = local_volume.LocalVolume(data, dimensions=dimensions,
+                                       mesh_options=dict(max_quadrics_error=-1, **mesh_options))
+        return vol.get_object_mesh(1)
+
+    num_triangles = len(_decode_raw_mesh(get_mesh())[1])
+    for simplifier in ['openmesh', 'flat']:
+        assert len(_decode_raw_mesh(get_mesh(simplifier=simplifier, max_triangles=100))[1]) <= 100
+        assert len(_decode_raw_mesh(get_mesh(simplifier=simplifier,
+                                             max_triangle_ratio=0.25))[1]) <= num_triangles // 4
+        assert len(get_mesh(simplifier=simplifier, max_mesh_bytes=2000)) <= 2000
+        assert len(get_mesh(simplifier=simplifier, max_mesh_bytes=2000,
+                            encoding='quantized16')) <= 2000
+
+
+def test_simple_mesh_precompute():
+    vol = _make_simple_volume()
+    vol.precompute_object_meshes(num_threads=2)
+    stats = vol.get_mesh_cache_statistics()
+    assert stats['misses'] == 2
+    assert stats['num_cached'] == 2
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple1'), vol.get_object_mesh(1))
+    test_util.check_golden_contents(os.path.join(testdata_dir, 'simple2'), vol.get_object_mesh(2))
+    assert vol.get_mesh_cache_statistics()['hits'] == 2
+
+
+def test_simple_mesh_precompute_partitioned_thread_count():
+    vol = _make_simple_volume(simplifier='flat', partition_triangles=4, background=False)
+    vol.get_mesh_stats()
+    local_volume.get_native_trace(clear=True)
+    local_volume.set_native_tracing_enabled(True)
+    try:
+        vol.precompute_object_meshes(num_threads=2)
+    finally:
+        local_volume.set_native_tracing_enabled(False)
+    trace = json.loads(local_volume.get_native_trace(clear=True))
+    spans = [event for event in trace['traceEvents'] if event['ph'] == 'X']
+    assert any(event['name'] == 'SimplifyMesh.cell' for event in spans)
+    # The cells of each object are simplified by the thread simplifying the object, rather than by
+    # additional threads, each of which would record its spans under another tid.
+    assert len(set(event['tid'] for event in spans)) <= 2
+
+
+def test_simple_mesh_stats():
+    vol = _make_simple_volume()
+    stats = vol.get_mesh_stats()
+    assert stats['num_objects'] == 0
+    vol.get_object_mesh(1)
+    vol.get_object_mesh(2)
+    vol.get_object_mesh(2)
+    stats = vol.get_mesh_stats()
+    assert stats['num_objects'] == 2
+    assert stats['misses'] == 2
+    assert stats['hits'] == 1
+    assert stats['triangles_in'] >= stats['triangles_out'] > 0
+    assert stats['bytes_out'] == stats['num_bytes']
+    assert stats['slowest_object_id'] in (1, 2)
+    assert stats['largest_object_id'] in (1, 2)
+    assert stats['slowest_object_ns'] > 0
+
+
+def test_native_trace():
+    local_volume.get_native_trace(clear=True)
+    local_volume.set_native_tracing_enabled(True)
+    try:
+        vol = _make_simple_volume()
+        vol.get_object_mesh(1)
+        vol.get_object_mesh(2)
+    finally:
+        local_volume.set_native_tracing_enabled(False)
+    trace = json.loads(local_volume.get_native_trace(clear=True))
+    spans = [event for event in trace['traceEvents'] if event['ph'] == 'X']
+    names = set(event['name'] for event in spans)
+    assert {'MeshObjects', 'SimplifyMesh', 'EncodeMesh', 'GetEncodedLods'} <= names
+    simplified = [event for event in spans if event['name'] == 'SimplifyMesh']
+    assert sorted(set(event['args']['object_id'] for event in simplified)) == ['1', '2']
+    assert all(event['args']['triangles'] > 0 for event in simplified)
+    assert all(event['dur'] >= 0 for event in spans)
+    # Cleared.
+    trace = json.loads(local_volume.get_native_trace())
+    assert not [event for event in trace['traceEvents'] if event['ph'] == 'X']
+
+
+def test_mesh_num_threads():
+    # Long enough along z to be split into several slabs.
+    z, y, x = np.mgrid[:80, :12, :12]
+    data = ((((x - 5.5)**2 + (y - 5.5)**2) < 16 + z % 7).astype(np.uint64) *
+            (1 + z // 30)).transpose()
+    dimensions = viewer_state.CoordinateSpace(names=['x', 'y', 'z'],
+                                              scales=[1, 1, 1],
+                                              units=['m', 'm', 'm'],)
+
+    def get_triangles(object_id, **mesh_options):
+        vol = local_volume.LocalVolume(data, dimensions=dimensions,
+                                       mesh_options=dict(max_quadrics_error=-1, **mesh_options))
+        vertices, indices = _decode_raw_mesh(vol.get_object_mesh(object_id))
+        # Compare triangles by the positions of their vertices, since vertex and triangle order
+        # depend on the number of threads.
+        return sorted(tuple(vertices[i].tolist() for i in triangle) for triangle in indices)
+
+    for object_id in [1, 2, 3]:
+        expected = get_triangles(object_id, num_threads=1)
+        assert get_triangles(object_id, num_threads=4) == expected
+        assert get_triangles(object_id, num_threads=0) == expected
+        assert get_triangles(object_id, num_threads=3, block_size=[8, 8, 40]) == expected
+
+    local_volume.set_default_mesh_num_threads(2)
+    try:
+        assert get_triangles(1) == get_triangles(1, num_threads=1)
+    finally:
+        local_volume.set_default_mesh_num_threads(0)
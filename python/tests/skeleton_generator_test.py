@@ -0,0 +1,77 @@
+# @license
+# Copyright 2016 Google Inc.
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from __future__ import absolute_import
+
+import struct
+
+import numpy as np
+from neuroglancer import local_volume
+from neuroglancer import viewer_state
+
+
+def _make_tube_volume():
+    data = np.zeros((50, 9, 9), dtype=np.uint32)
+    data[5:45, 2:7, 2:7] = 1
+    dimensions = viewer_state.CoordinateSpace(names=['x', 'y', 'z'],
+                                              scales=[1, 1, 1],
+                                              units=['m', 'm', 'm'],)
+    vol = local_volume.LocalVolume(data, dimensions=dimensions)
+    return vol, local_volume.LocalVolumeSkeletonSource(vol)
+
+
+def test_tube_skeleton():
+    vol, source = _make_tube_volume()
+    skeleton = source.get_skeleton(1)
+    positions = skeleton.vertex_positions
+    num_vertices = positions.shape[0]
+    assert num_vertices > 30
+    # A single path, from one end of the tube to the other.
+    assert skeleton.edges.shape == (num_vertices - 1, 2)
+    assert positions[:, 0].min() == 5
+    assert positions[:, 0].max() == 44
+    interior = (positions[:, 0] >= 8) & (positions[:, 0] < 42)
+    np.testing.assert_array_equal(positions[interior, 1:], 4)
+    radius = skeleton.vertex_attributes['radius']
+    assert radius.shape == (num_vertices,)
+    np.testing.assert_array_equal(radius[interior], 3)
+
+    encoded = skeleton.encode(source)
+    assert struct.unpack('<II', encoded[:8]) == (num_vertices, num_vertices - 1)
+    assert len(encoded) == 8 + num_vertices * 12 + (num_vertices - 1) * 8 + num_vertices * 4
+
+    assert source.get_skeleton(2) is None
+
+
+def test_skeleton_invalidate():
+    vol, source = _make_tube_volume()
+    assert source.get_skeleton(1).vertex_positions[:, 0].max() == 44
+    changes = []
+    source.add_changed_callback(lambda: changes.append(None))
+    vol.data[25:45] = 0
+    vol.invalidate()
+    assert len(changes) == 1
+    assert source.get_skeleton(1).vertex_positions[:, 0].max() == 24
+
+
+def test_skeleton_equivalences():
+    vol, source = _make_tube_volume()
+    vol.data[25:45][vol.data[25:45] == 1] = 2
+    skeleton = source.get_skeleton(2)
+    assert skeleton.vertex_positions[:, 0].min() == 25
+    vol.set_mesh_equivalences({2: 1})
+    assert source.get_skeleton(2) is None
+    skeleton = source.get_skeleton(1)
+    assert skeleton.vertex_positions[:, 0].min() == 5
+    assert skeleton.vertex_positions[:, 0].max() == 44
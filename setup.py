@@ -173,19 +173,30 @@ class BundleClientCommand(distutils.command.build.build):
 
 local_sources = [
     '_neuroglancer.cc',
+    'compress_segmentation.cc',
+    'decompress_segmentation.cc',
+    'downsample.cc',
+    'downsample_segmentation.cc',
+    'encoded_chunk_cache.cc',
     'openmesh_dependencies.cc',
     'on_demand_object_mesh_generator.cc',
+    'precomputed_mesh_export.cc',
+    'relabel_segmentation.cc',
+    'shared_memory_cache.cc',
+    'sharded_mesh_export.cc',
+    'sharded_segmentation_export.cc',
+    'sharding.cc',
+    'skeletonize.cc',
+    'trace_events.cc',
+    'voxel_faces.cc',
     'voxel_mesh_generator.cc',
     'mesh_objects.cc',
+    'quadric_simplifier.cc',
+    'vertex_cache_optimizer.cc',
+    'worker_pool.cc',
 ]
 
-USE_OMP = False
-if USE_OMP:
-    openmp_flags = ['-fopenmp']
-else:
-    openmp_flags = []
-
-extra_compile_args = ['-std=c++11', '-fvisibility=hidden', '-O3'] + openmp_flags
+extra_compile_args = ['-std=c++11', '-fvisibility=hidden', '-O3']
 if platform.system() == 'Darwin':
     extra_compile_args.insert(0, '-stdlib=libc++')
 
@@ -197,6 +208,28 @@ if platform.system() == 'Darwin':
 if platform.system() == 'Windows':
     extra_compile_args.append('/d2FH4-')
 
+# The multi-resolution mesh exporter encodes mesh fragments with Draco only if
+# the NEUROGLANCER_DRACO_DIR environment variable specifies the installation
+# prefix of the draco library, e.g. /usr/local.
+ext_include_dirs = [openmesh_dir]
+ext_library_dirs = []
+ext_libraries = []
+ext_define_macros = [
+    ('_USE_MATH_DEFINES', None),  # Needed by OpenMesh when used with MSVC
+]
+draco_dir = os.environ.get('NEUROGLANCER_DRACO_DIR')
+if draco_dir:
+    ext_include_dirs.append(os.path.join(draco_dir, 'include'))
+    ext_library_dirs.append(os.path.join(draco_dir, 'lib'))
+    ext_libraries.append('draco')
+    ext_define_macros.append(('NEUROGLANCER_DRACO', None))
+
+# gzip encoding of the sharded format requires zlib, which is part of the
+# system on Linux and macOS.
+if platform.system() != 'Windows':
+    ext_libraries.append('z')
+    ext_define_macros.append(('NEUROGLANCER_ZLIB', None))
+
 # Copied from setuptools_scm, can be removed once a released version of
 # setuptools_scm supports `version_scheme=no-guess-dev`.
 #
@@ -268,12 +301,11 @@ setuptools.setup(
             'neuroglancer._neuroglancer',
             sources=[os.path.join(src_dir, name) for name in local_sources],
             language='c++',
-            include_dirs=[openmesh_dir],
-            define_macros=[
-                ('_USE_MATH_DEFINES', None),  # Needed by OpenMesh when used with MSVC
-            ],
-            extra_compile_args=extra_compile_args,
-            extra_link_args=openmp_flags),
+            include_dirs=ext_include_dirs,
+            library_dirs=ext_library_dirs,
+            libraries=ext_libraries,
+            define_macros=ext_define_macros,
+            extra_compile_args=extra_compile_args),
     ],
     cmdclass={
         'sdist': SdistCommand,
@@ -16,10 +16,11 @@
 
 import {WithParameters} from 'neuroglancer/chunk_manager/backend';
 import {MeshSourceParameters, SkeletonSourceParameters, VolumeChunkEncoding, VolumeChunkSourceParameters} from 'neuroglancer/datasource/python/base';
-import {assignMeshFragmentData, decodeTriangleVertexPositionsAndIndices, FragmentChunk, ManifestChunk, MeshSource} from 'neuroglancer/mesh/backend';
+import {assignMeshFragmentData, decodeTriangleVertexPositionsAndIndices, FragmentChunk, ManifestChunk, MeshSource, RawMeshData} from 'neuroglancer/mesh/backend';
 import {SkeletonChunk, SkeletonSource} from 'neuroglancer/skeleton/backend';
 import {decodeSkeletonChunk} from 'neuroglancer/skeleton/decode_precomputed_skeleton';
 import {ChunkDecoder} from 'neuroglancer/sliceview/backend_chunk_decoders';
+import {decodeCompressedSegmentationChunk} from 'neuroglancer/sliceview/backend_chunk_decoders/compressed_segmentation';
 import {decodeJpegChunk} from 'neuroglancer/sliceview/backend_chunk_decoders/jpeg';
 import {decodeNdstoreNpzChunk} from 'neuroglancer/sliceview/backend_chunk_decoders/ndstoreNpz';
 import {decodeRawChunk} from 'neuroglancer/sliceview/backend_chunk_decoders/raw';
@@ -33,6 +34,7 @@ let chunkDecoders = new Map<VolumeChunkEncoding, ChunkDecoder>();
 chunkDecoders.set(VolumeChunkEncoding.NPZ, decodeNdstoreNpzChunk);
 chunkDecoders.set(VolumeChunkEncoding.JPEG, decodeJpegChunk);
 chunkDecoders.set(VolumeChunkEncoding.RAW, decodeRawChunk);
+chunkDecoders.set(VolumeChunkEncoding.COMPRESSED_SEGMENTATION, decodeCompressedSegmentationChunk);
 
 @registerSharedObject() export class PythonVolumeChunkSource extends
 (WithParameters(VolumeChunkSource, VolumeChunkSourceParameters)) {
@@ -60,9 +62,109 @@ chunkDecoders.set(VolumeChunkEncoding.RAW, decodeRawChunk);
   }
 }
 
+// Value of the first 32-bit word of a quantized mesh, which would otherwise be the number of
+// vertices.
+const QUANTIZED_MESH_MARKER = 0xffffffff;
+
+// Upper 24 bits of the last 32-bit word of a raw mesh followed by vertex normals, whose lower 8
+// bits specify the number of bits per normal component.  This word would otherwise be a vertex
+// index.
+const RAW_MESH_NORMALS_MARKER = 0xffffff00;
+
+/**
+ * Decodes the octahedron-encoded vertex normals with `bits` (8 or 16) bits per component starting
+ * at `offset` into the 2x8-bit representation used by the mesh layer.
+ */
+function decodeVertexNormals(
+    dv: DataView, offset: number, numVertices: number, bits: number): Uint8Array {
+  const vertexNormals = new Uint8Array(numVertices * 2);
+  if (bits === 8) {
+    vertexNormals.set(new Uint8Array(dv.buffer, dv.byteOffset + offset, numVertices * 2));
+  } else if (bits === 16) {
+    for (let i = 0; i < numVertices * 2; ++i, offset += 2) {
+      vertexNormals[i] = Math.round(dv.getInt16(offset, true) * (127 / 32767));
+    }
+  } else {
+    throw new Error(`Unsupported number of vertex normal bits: ${bits}.`);
+  }
+  return vertexNormals;
+}
+
+/**
+ * Decodes a mesh with quantized vertex positions, as produced by the `quantized16` and
+ * `quantized10` encodings of the Python mesh generator.
+ */
+function decodeQuantizedMesh(response: ArrayBuffer): RawMeshData {
+  const dv = new DataView(response);
+  const positionBitsWord = dv.getUint32(4, true);
+  const positionBits = positionBitsWord & 0xff;
+  const normalBits = (positionBitsWord >>> 8) & 0xff;
+  const numVertices = dv.getUint32(8, true);
+  const numTriangles = dv.getUint32(12, true);
+  const headerSize = 40;
+  const vertexPositions = new Float32Array(numVertices * 3);
+  const origin = [0, 0, 0], scale = [0, 0, 0];
+  for (let i = 0; i < 3; ++i) {
+    origin[i] = dv.getFloat32(16 + 4 * i, true);
+    scale[i] = dv.getFloat32(28 + 4 * i, true);
+  }
+  let offset = headerSize;
+  if (positionBits === 16) {
+    for (let i = 0; i < numVertices * 3; ++i, offset += 2) {
+      vertexPositions[i] = origin[i % 3] + scale[i % 3] * dv.getUint16(offset, true);
+    }
+    offset = headerSize + Math.ceil(numVertices * 6 / 4) * 4;
+  } else if (positionBits === 10) {
+    for (let i = 0; i < numVertices; ++i, offset += 4) {
+      const word = dv.getUint32(offset, true);
+      for (let j = 0; j < 3; ++j) {
+        vertexPositions[i * 3 + j] = origin[j] + scale[j] * ((word >>> (10 * j)) & 1023);
+      }
+    }
+  } else {
+    throw new Error(`Unsupported number of vertex position bits: ${positionBits}.`);
+  }
+  const numIndices = numTriangles * 3;
+  const indices = new Uint32Array(numIndices);
+  if (numVertices <= 65536) {
+    for (let i = 0; i < numIndices; ++i, offset += 2) {
+      indices[i] = dv.getUint16(offset, true);
+    }
+  } else {
+    for (let i = 0; i < numIndices; ++i, offset += 4) {
+      indices[i] = dv.getUint32(offset, true);
+    }
+  }
+  if (normalBits !== 0) {
+    offset = Math.ceil(offset / 4) * 4;
+    const vertexNormals = decodeVertexNormals(dv, offset, numVertices, normalBits);
+    return {vertexPositions, indices, vertexNormals};
+  }
+  return {vertexPositions, indices};
+}
+
 export function decodeFragmentChunk(chunk: FragmentChunk, response: ArrayBuffer) {
   let dv = new DataView(response);
   let numVertices = dv.getUint32(0, true);
+  if (numVertices === QUANTIZED_MESH_MARKER) {
+    assignMeshFragmentData(chunk, decodeQuantizedMesh(response));
+    return;
+  }
+  const positionsEnd = 4 + 12 * numVertices;
+  const trailer = response.byteLength >= positionsEnd + 4 ?
+      dv.getUint32(response.byteLength - 4, true) :
+      0;
+  if ((trailer & 0xffffff00) >>> 0 === RAW_MESH_NORMALS_MARKER) {
+    const normalBits = trailer & 0xff;
+    const normalsSize = Math.ceil(numVertices * normalBits / 4 / 4) * 4;
+    const normalsOffset = response.byteLength - 4 - normalsSize;
+    const meshData = decodeTriangleVertexPositionsAndIndices(
+        response, Endianness.LITTLE, /*vertexByteOffset=*/ 4, numVertices,
+        /*indexByteOffset=*/ undefined, /*numTriangles=*/ (normalsOffset - positionsEnd) / 12);
+    meshData.vertexNormals = decodeVertexNormals(dv, normalsOffset, numVertices, normalBits);
+    assignMeshFragmentData(chunk, meshData);
+    return;
+  }
   assignMeshFragmentData(
       chunk,
       decodeTriangleVertexPositionsAndIndices(
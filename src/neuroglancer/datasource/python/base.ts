@@ -19,7 +19,8 @@ import {VertexAttributeInfo} from 'neuroglancer/skeleton/base';
 export enum VolumeChunkEncoding {
   JPEG,
   NPZ,
-  RAW
+  RAW,
+  COMPRESSED_SEGMENTATION
 }
 
 export class PythonSourceParameters {
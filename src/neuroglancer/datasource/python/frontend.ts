@@ -33,6 +33,7 @@ import {makeDefaultVolumeChunkSpecifications, VolumeSourceOptions, VolumeType} f
 import {MultiscaleVolumeChunkSource as MultiscaleVolumeChunkSource, VolumeChunkSource} from 'neuroglancer/sliceview/volume/frontend';
 import {transposeNestedArrays} from 'neuroglancer/util/array';
 import {Borrowed, Owned} from 'neuroglancer/util/disposable';
+import {vec3} from 'neuroglancer/util/geom';
 import {fetchOk} from 'neuroglancer/util/http_request';
 import {parseFixedLengthArray, verifyEnumString, verifyFiniteFloat, verifyInt, verifyObject, verifyObjectAsMap, verifyObjectProperty, verifyOptionalObjectProperty, verifyPositiveInt} from 'neuroglancer/util/json';
 import * as matrix from 'neuroglancer/util/matrix';
@@ -149,6 +150,7 @@ export class PythonMultiscaleVolumeChunkSource extends MultiscaleVolumeChunkSour
   dataType: DataType;
   volumeType: VolumeType;
   encoding: VolumeChunkEncoding;
+  compressedSegmentationBlockSize: vec3|undefined;
   generation: number;
   modelSpace: CoordinateSpace;
   downsamplingLayout: ChunkLayoutPreference;
@@ -177,6 +179,11 @@ export class PythonMultiscaleVolumeChunkSource extends MultiscaleVolumeChunkSour
         verifyObjectProperty(response, 'volumeType', x => verifyEnumString(x, VolumeType));
     this.encoding =
         verifyObjectProperty(response, 'encoding', x => verifyEnumString(x, VolumeChunkEncoding));
+    if (this.encoding === VolumeChunkEncoding.COMPRESSED_SEGMENTATION) {
+      this.compressedSegmentationBlockSize = verifyObjectProperty(
+          response, 'compressedSegmentationBlockSize',
+          x => parseFixedLengthArray(vec3.create(), x, verifyPositiveInt));
+    }
     const rank = baseModelSpace.rank;
     this.subsourceToModelTransform = subsourceToModelTransform;
     const shape = verifyObjectProperty(
@@ -219,7 +226,7 @@ export class PythonMultiscaleVolumeChunkSource extends MultiscaleVolumeChunkSour
 
   getSources(volumeSourceOptions: VolumeSourceOptions) {
     const downsampleDims: number[] = [];
-    const {rank, volumeType, dataType, shape, encoding} = this;
+    const {rank, volumeType, dataType, shape, encoding, compressedSegmentationBlockSize} = this;
     const effectiveDisplayScales = new Float32Array(rank);
     const {multiscaleToViewTransform, modelChannelDimensionIndices} = volumeSourceOptions;
     for (let modelDim = 0; modelDim < rank; ++modelDim) {
@@ -263,6 +270,7 @@ export class PythonMultiscaleVolumeChunkSource extends MultiscaleVolumeChunkSour
                        upperVoxelBound: downsampledShape,
                        volumeSourceOptions,
                        chunkLayoutPreference,
+                       compressedSegmentationBlockSize,
                      })
                   .map(spec => {
                     return {
@@ -83,12 +83,27 @@ export class ManifestChunk extends Chunk {
 }
 
 export interface RawMeshData {
-  vertexPositions: Float32Array|Uint32Array;
+  vertexPositions: Float32Array|Uint32Array|Uint16Array;
   indices: MeshVertexIndices;
+  /**
+   * If true, `indices` specifies triangle strips separated by the maximum value of the index type,
+   * rather than independent triangles.
+   */
+  strips?: boolean;
+  /**
+   * If specified, the normal of each vertex in the 2x8-bit octahedron representation produced by
+   * `encodeNormals32fx3ToOctahedron8x2`, which are used rather than computing them.
+   */
+  vertexNormals?: Uint8Array;
 }
 
 export interface RawPartitionedMeshData extends RawMeshData {
   subChunkOffsets: Uint32Array;
+  /**
+   * If specified, the vertices referenced by sub-chunk `i` are the contiguous range
+   * `[subChunkVertexOffsets[i], subChunkVertexOffsets[i + 1])`.
+   */
+  subChunkVertexOffsets?: Uint32Array;
 }
 
 function serializeMeshData(data: EncodedMeshData, msg: any, transfers: any[]) {
@@ -163,30 +178,49 @@ export function decodeJsonManifestChunk(
  * @param positions The vertex positions in [x0, y0, z0, x1, y1, z1, ...] format.
  * @param indices The indices of the triangle vertices.  Each triplet of consecutive values
  *     specifies a triangle.
+ * @param strips If true, `indices` instead specifies triangle strips separated by the maximum value
+ *     of the index type, as for primitive restart.  Every other triangle of a strip is reversed so
+ *     that all triangles retain the orientation of the first.
  */
 export function computeVertexNormals(
     positions: Float32Array|Uint8Array|Uint16Array|Uint32Array,
-    indices: Uint8Array|Uint16Array|Uint32Array) {
+    indices: Uint8Array|Uint16Array|Uint32Array, strips = false) {
   const faceNormal = vec3.create();
   const v1v0 = vec3.create();
   const v2v1 = vec3.create();
   let vertexNormals = new Float32Array(positions.length);
   let numIndices = indices.length;
-  for (let i = 0; i < numIndices; i += 3) {
-    let i0 = indices[i] * 3, i1 = indices[i + 1] * 3, i2 = indices[i + 2] * 3;
+  const restartIndex = ~0 >>> (32 - 8 * indices.BYTES_PER_ELEMENT);
+  const step = strips ? 1 : 3;
+  let stripStart = 0;
+  for (let i = 0; i + 2 < numIndices; i += step) {
+    let i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
+    if (strips) {
+      if (i2 === restartIndex) {
+        // Skip to the start of the next strip.
+        stripStart = i + 3;
+        i += 2;
+        continue;
+      }
+      if ((i - stripStart) & 1) {
+        const t = i0;
+        i0 = i1;
+        i1 = t;
+      }
+    }
+    const offset0 = i0 * 3, offset1 = i1 * 3, offset2 = i2 * 3;
     for (let j = 0; j < 3; ++j) {
-      v1v0[j] = positions[i1 + j] - positions[i0 + j];
-      v2v1[j] = positions[i2 + j] - positions[i1 + j];
+      v1v0[j] = positions[offset1 + j] - positions[offset0 + j];
+      v2v1[j] = positions[offset2 + j] - positions[offset1 + j];
     }
     vec3.cross(faceNormal, v1v0, v2v1);
     vec3.normalize(faceNormal, faceNormal);
 
-    for (let k = 0; k < 3; ++k) {
-      let index = indices[i + k];
-      let offset = index * 3;
-      for (let j = 0; j < 3; ++j) {
-        vertexNormals[offset + j] += faceNormal[j];
-      }
+    for (let j = 0; j < 3; ++j) {
+      const x = faceNormal[j];
+      vertexNormals[offset0 + j] += x;
+      vertexNormals[offset1 + j] += x;
+      vertexNormals[offset2 + j] += x;
     }
   }
   // Normalize all vertex normals.
@@ -620,22 +654,27 @@ export class MultiscaleMeshLayer extends withSegmentationLayerBackendState
 function convertMeshData(
     data: RawMeshData&{subChunkOffsets?: Uint32Array},
     vertexPositionFormat: VertexPositionFormat): EncodedMeshData {
-  const normals = computeVertexNormals(data.vertexPositions, data.indices);
-  const encodedNormals = new Uint8Array(normals.length / 3 * 2);
-  encodeNormals32fx3ToOctahedron8x2(encodedNormals, normals);
+  let encodedNormals = data.vertexNormals;
+  if (encodedNormals === undefined) {
+    const normals = computeVertexNormals(data.vertexPositions, data.indices, data.strips);
+    encodedNormals = new Uint8Array(normals.length / 3 * 2);
+    encodeNormals32fx3ToOctahedron8x2(encodedNormals, normals);
+  }
   let encodedIndices: MeshVertexIndices;
   let strips: boolean;
-  if (CONVERT_TO_TRIANGLE_STRIPS) {
+  if (CONVERT_TO_TRIANGLE_STRIPS && !data.strips) {
     encodedIndices = computeTriangleStrips(data.indices, data.subChunkOffsets);
     strips = true;
   } else {
+    // Conversion to 16-bit indices also maps the 32-bit restart index of triangle strips to the
+    // 16-bit restart index.
     if (data.indices.BYTES_PER_ELEMENT === 4 && data.vertexPositions.length / 3 < 65535) {
       encodedIndices = new Uint16Array(data.indices.length);
       encodedIndices.set(data.indices);
     } else {
       encodedIndices = data.indices;
     }
-    strips = false;
+    strips = data.strips === true;
   }
   let encodedVertexPositions: EncodedVertexPositions;
   if (vertexPositionFormat === VertexPositionFormat.uint10) {
@@ -659,6 +698,11 @@ function convertMeshData(
   } else {
     encodedVertexPositions = data.vertexPositions as Float32Array;
   }
+  if (encodedIndices === data.indices && encodedVertexPositions !== data.vertexPositions &&
+      encodedIndices.buffer === data.vertexPositions.buffer) {
+    // Don't retain the unconverted vertex positions decoded into the same buffer as the indices.
+    encodedIndices = encodedIndices.slice();
+  }
   return {
     vertexPositions: encodedVertexPositions,
     vertexNormals: encodedNormals,
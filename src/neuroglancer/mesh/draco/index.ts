@@ -20,6 +20,28 @@ import dracoWasmUrl from './neuroglancer_draco.wasm';
 
 let decodeResult: RawPartitionedMeshData|Error|undefined = undefined;
 let numPartitions = 0;
+let uint16Positions = false;
+let requestedOptions: DracoDecodeOptions = {};
+
+export interface DracoDecodeOptions {
+  /**
+   * Decode the faces of each partition as triangle strips separated by primitive restart indices,
+   * and set `strips` in the result.
+   */
+  triangleStrips?: boolean;
+
+  /**
+   * Decode the vertices referenced by each partition as a separate contiguous range, specified by
+   * `subChunkVertexOffsets` in the result, duplicating the vertices shared by multiple partitions.
+   * This allows the vertices of each partition to be stored separately.
+   */
+  compactPartitions?: boolean;
+}
+
+// Output regions larger than this are freed after each decode rather than retained by the module
+// for reuse.
+const MAX_RETAINED_OUTPUT_BYTES = 16 * 1024 * 1024;
+let outputBytes = 0;
 
 let wasmModule: WebAssembly.WebAssemblyInstantiatedSource|undefined;
 
@@ -27,6 +49,27 @@ const libraryEnv = {
   emscripten_notify_memory_growth: (memoryIndex: number) => {
     memoryIndex;
   },
+  neuroglancer_draco_receive_decoded_output: function(
+      numIndices: number, numVertices: number, numDecodedPartitions: number,
+      outputPointer: number) {
+    const memory = wasmModule!.instance.exports.memory as WebAssembly.Memory;
+    const numOffsets = numDecodedPartitions + 1;
+    const numHeaderWords = requestedOptions.compactPartitions ? 2 * numOffsets : numOffsets;
+    const header = new Uint32Array(memory.buffer, outputPointer, numHeaderWords).slice();
+    // The indices and vertex positions are adjacent in the output region, and are copied out of
+    // wasm memory with a single copy into a single ArrayBuffer.
+    const dataBytes = getMeshDataBytes(numIndices, numVertices, uint16Positions);
+    outputBytes = numHeaderWords * 4 + dataBytes;
+    const dataOffset = outputPointer + numHeaderWords * 4;
+    decodeResult = {
+      ...getMeshData(
+          memory.buffer.slice(dataOffset, dataOffset + dataBytes), numIndices, numVertices,
+          uint16Positions),
+      ...getPartitionOffsets(header, numOffsets, requestedOptions),
+    };
+  },
+  // Used by builds of neuroglancer_draco.wasm that pass the indices, vertex positions and
+  // partition offsets separately.
   neuroglancer_draco_receive_decoded_mesh: function(
       numFaces: number, numVertices: number, indicesPointer: number, vertexPositionsPointer: number,
       subchunkOffsetsPointer: number) {
@@ -48,6 +91,49 @@ const libraryEnv = {
     throw `proc exit: ${code}`;
   },
 };
+
+/**
+ * Returns the number of bytes of the indices and vertex positions of a decoded mesh.  The uint16
+ * vertex positions are padded to a multiple of 4 bytes.
+ */
+function getMeshDataBytes(numIndices: number, numVertices: number, uint16Positions: boolean) {
+  return numIndices * 4 + (uint16Positions ? Math.ceil(3 * numVertices / 2) : 3 * numVertices) * 4;
+}
+
+/**
+ * Returns views of the indices and vertex positions of a decoded mesh copied into `data`.
+ */
+function getMeshData(
+    data: ArrayBuffer, numIndices: number, numVertices: number, uint16Positions: boolean) {
+  const indices = new Uint32Array(data, 0, numIndices);
+  const vertexPositions = uint16Positions ?
+      new Uint16Array(data, numIndices * 4, 3 * numVertices) :
+      new Uint32Array(data, numIndices * 4, 3 * numVertices);
+  return {indices, vertexPositions};
+}
+
+/**
+ * Returns the `subChunkOffsets`, `subChunkVertexOffsets` and `strips` properties of a decoded mesh
+ * given the `header` of its output region.
+ */
+function getPartitionOffsets(
+    header: Uint32Array, numOffsets: number, options: DracoDecodeOptions) {
+  return {
+    subChunkOffsets: header.subarray(0, numOffsets),
+    subChunkVertexOffsets: options.compactPartitions ?
+        header.subarray(numOffsets, 2 * numOffsets) :
+        undefined,
+    strips: options.triangleStrips === true,
+  };
+}
+
+/**
+ * Returns true if vertex positions with `vertexQuantizationBits` are decoded as uint16 rather than
+ * uint32 components, which halves the size of the decoded positions.
+ */
+function useUint16Positions(vertexQuantizationBits: number) {
+  return vertexQuantizationBits <= 16;
+}
 const dracoModulePromise = (async () => {
   const response = await fetch(dracoWasmUrl);
   const wasmCode = await response.arrayBuffer();
@@ -59,16 +145,36 @@ const dracoModulePromise = (async () => {
   return m;
 })();
 
+/**
+ * Decodes a draco mesh, partitioning its faces by a regular octree of depth `partitionDepth` over
+ * the quantized vertex position range.  The resultant `subChunkOffsets` has `8**partitionDepth + 1`
+ * entries, and the partitions of each octree node are contiguous.  A depth of 0 yields a single
+ * partition, and a depth of 1 the 8 octants.
+ *
+ * If `vertexQuantizationBits <= 16`, the vertex positions are decoded as a `Uint16Array`.
+ *
+ * Builds of the wasm module that call `neuroglancer_draco_receive_decoded_mesh` ignore `options`.
+ */
 export async function decodeDracoPartitioned(
-    buffer: Uint8Array, vertexQuantizationBits: number,
-    partition: boolean): Promise<RawPartitionedMeshData> {
+    buffer: Uint8Array, vertexQuantizationBits: number, partitionDepth: number,
+    options: DracoDecodeOptions = {}): Promise<RawPartitionedMeshData> {
   const m = await dracoModulePromise;
   const offset = (m.instance.exports.malloc as Function)(buffer.byteLength);
   const heap = new Uint8Array((m.instance.exports.memory as WebAssembly.Memory).buffer);
   heap.set(buffer, offset);
-  numPartitions = partition ? 8 : 1;
+  numPartitions = 2 ** (3 * partitionDepth);
+  // Builds of neuroglancer_draco.wasm that call `neuroglancer_draco_receive_decoded_mesh` ignore
+  // the last argument and always output uint32 vertex positions.
+  uint16Positions = useUint16Positions(vertexQuantizationBits);
+  requestedOptions = options;
   const code = (m.instance.exports.neuroglancer_draco_decode as Function)(
-      offset, buffer.byteLength, partition, vertexQuantizationBits);
+      offset, buffer.byteLength, partitionDepth, vertexQuantizationBits, uint16Positions,
+      options.triangleStrips === true, options.compactPartitions === true);
+  const freeOutput = m.instance.exports.neuroglancer_draco_free_output as Function|undefined;
+  if (freeOutput !== undefined && outputBytes > MAX_RETAINED_OUTPUT_BYTES) {
+    freeOutput();
+  }
+  outputBytes = 0;
   if (code === 0) {
     const r = decodeResult;
     decodeResult = undefined;
@@ -77,3 +183,80 @@ export async function decodeDracoPartitioned(
   }
   throw new Error(`Failed to decode draco mesh: ${code}`);
 }
+
+/**
+ * Decodes multiple draco meshes as by `decodeDracoPartitioned`, but with a single call into the
+ * wasm module, which reduces the per-mesh overhead for many small fragments.  The result for each
+ * mesh that fails to decode is an `Error`.
+ */
+export async function decodeDracoPartitionedBatch(
+    buffers: Uint8Array[], vertexQuantizationBits: number, partitionDepth: number,
+    options: DracoDecodeOptions = {}): Promise<(RawPartitionedMeshData|Error)[]> {
+  const m = await dracoModulePromise;
+  const decodeBatch = m.instance.exports.neuroglancer_draco_decode_batch as Function|undefined;
+  if (decodeBatch === undefined) {
+    // Build of neuroglancer_draco.wasm without batch decoding.
+    const results: (RawPartitionedMeshData|Error)[] = [];
+    for (const buffer of buffers) {
+      try {
+        results.push(
+            await decodeDracoPartitioned(buffer, vertexQuantizationBits, partitionDepth, options));
+      } catch (e) {
+        results.push(e instanceof Error ? e : new Error(`${e}`));
+      }
+    }
+    return results;
+  }
+  const numFragments = buffers.length;
+  let inputSize = 4 * numFragments;
+  for (const buffer of buffers) inputSize += buffer.byteLength;
+  const offset = (m.instance.exports.malloc as Function)(inputSize);
+  let memory = (m.instance.exports.memory as WebAssembly.Memory).buffer;
+  new Uint32Array(memory, offset, numFragments).set(buffers.map(buffer => buffer.byteLength));
+  const heap = new Uint8Array(memory);
+  let fragmentOffset = offset + 4 * numFragments;
+  for (const buffer of buffers) {
+    heap.set(buffer, fragmentOffset);
+    fragmentOffset += buffer.byteLength;
+  }
+  const uint16Positions = useUint16Positions(vertexQuantizationBits);
+  const outputPointer = decodeBatch(
+                            offset, numFragments, partitionDepth, vertexQuantizationBits,
+                            uint16Positions, options.triangleStrips === true,
+                            options.compactPartitions === true) as number;
+  if (outputPointer === 0) {
+    throw new Error('Failed to decode draco meshes');
+  }
+  // Memory may have grown during decoding.
+  memory = (m.instance.exports.memory as WebAssembly.Memory).buffer;
+  const output = new Uint32Array(memory, outputPointer);
+  const numOffsets = 2 ** (3 * partitionDepth) + 1;
+  const numHeaderWords = options.compactPartitions ? 2 * numOffsets : numOffsets;
+  const results: (RawPartitionedMeshData|Error)[] = [];
+  for (let i = 0; i < numFragments; ++i) {
+    const descriptorOffset = 1 + 4 * i;
+    const code = output[descriptorOffset];
+    if (code !== 0) {
+      results.push(new Error(`Failed to decode draco mesh: ${code}`));
+      continue;
+    }
+    const numIndices = output[descriptorOffset + 1];
+    const numVertices = output[descriptorOffset + 2];
+    const meshOffset = output[descriptorOffset + 3];
+    const header = output.slice(meshOffset, meshOffset + numHeaderWords);
+    // As for `decodeDracoPartitioned`, the indices and vertex positions of each mesh are copied
+    // into a single ArrayBuffer.
+    const dataOffset = outputPointer + (meshOffset + numHeaderWords) * 4;
+    const dataBytes = getMeshDataBytes(numIndices, numVertices, uint16Positions);
+    results.push({
+      ...getMeshData(
+          memory.slice(dataOffset, dataOffset + dataBytes), numIndices, numVertices,
+          uint16Positions),
+      ...getPartitionOffsets(header, numOffsets, options),
+    });
+  }
+  if (output[0] * 4 > MAX_RETAINED_OUTPUT_BYTES) {
+    (m.instance.exports.neuroglancer_draco_free_output as Function)();
+  }
+  return results;
+}
@@ -1,10 +1,29 @@
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
 
 #include "draco/compression/decode.h"
-#include "draco/mesh/mesh_stripifier.h"
+
+#ifdef NEUROGLANCER_DRACO_TRACE
+#include "trace_events.h"
+#endif
 
 namespace {
+
+#ifdef NEUROGLANCER_DRACO_TRACE
+/// Trace span of the native build, exported by `python/ext/src/trace_events.h`.
+using TraceSpan = neuroglancer::trace_events::Span;
+#else
+/// No-op in the wasm build, which does not record traces.
+struct TraceSpan {
+  explicit TraceSpan(const char *, const char * = nullptr, std::uint64_t = 0) {}
+  ~TraceSpan() {}
+};
+#endif
+
 struct FreeDeleter {
   void operator()(void *p) const { ::free(p); }
 };
@@ -21,32 +40,232 @@ constexpr std::uint8_t first_bit_lookup_table[256] = {
     6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
     5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0};
 
-}  // namespace
+/// Maximum octree depth by which faces may be partitioned, corresponding to 32768 partitions.
+constexpr int kMaxPartitionDepth = 5;
 
-extern "C" {
-extern void neuroglancer_draco_receive_decoded_mesh(unsigned int num_indices,
-                                                    unsigned int num_positions, const void *indices,
-                                                    const void *vertex_positions,
-                                                    const void *subchunk_offsets);
+/// Buffer of 32-bit words retained across decodes to avoid allocating it for each mesh.
+struct Buffer {
+  std::uint32_t *data = nullptr;
+  std::size_t capacity = 0;
+};
 
-int neuroglancer_draco_decode(char *input, unsigned int input_size, bool partition,
-                              int vertex_quantization_bits) {
-  std::unique_ptr<char[], FreeDeleter> input_deleter(input);
-  draco::DecoderBuffer decoder_buffer;
-  decoder_buffer.Init(input, input_size);
-  draco::Decoder decoder;
-  decoder.SetSkipAttributeTransform(draco::GeometryAttribute::POSITION);
-  auto decoded_mesh_statusor = decoder.DecodeMeshFromBuffer(&decoder_buffer);
+/// Output region, passed to `neuroglancer_draco_receive_decoded_output` or returned by
+/// `neuroglancer_draco_decode_batch`.
+Buffer output_buffer;
+
+/// Scratch space for the partition of each face, and for computing triangle strips.
+Buffer scratch_buffer;
+
+/// Grows `buffer` to at least `size` words, preserving its first `preserved_size` words.  Returns
+/// false if allocation fails.
+bool ReserveBuffer(Buffer *buffer, std::size_t size, std::size_t preserved_size) {
+  if (size <= buffer->capacity) return true;
+  // Grow geometrically when appending, as by `neuroglancer_draco_decode_batch`.
+  const std::size_t capacity = preserved_size ? std::max(size, buffer->capacity * 2) : size;
+  std::uint32_t *data;
+  if (preserved_size) {
+    data = static_cast<std::uint32_t *>(::realloc(buffer->data, sizeof(std::uint32_t) * capacity));
+    if (!data) return false;
+  } else {
+    ::free(buffer->data);
+    buffer->data = nullptr;
+    buffer->capacity = 0;
+    data = static_cast<std::uint32_t *>(::malloc(sizeof(std::uint32_t) * capacity));
+    if (!data) return false;
+  }
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return true;
+}
+
+void FreeBuffer(Buffer *buffer) {
+  ::free(buffer->data);
+  buffer->data = nullptr;
+  buffer->capacity = 0;
+}
+
+struct DecodedMesh {
+  unsigned int num_indices;
+  unsigned int num_vertices;
+  /// Number of words written to the output region.
+  std::size_t size;
+};
+
+struct DecodeOptions {
+  int partition_depth;
+  int vertex_quantization_bits;
+  /// If true, vertex positions are output as uint16 rather than uint32 components, which requires
+  /// `vertex_quantization_bits <= 16`.
+  bool uint16_positions;
+  /// If true, the faces of each partition are output as triangle strips separated by
+  /// `kRestartIndex` rather than as independent triangles.
+  bool triangle_strips;
+  /// If true, the vertices referenced by each partition are output as a separate contiguous range,
+  /// duplicating the vertices shared by multiple partitions.
+  bool compact_partitions;
+};
+
+/// Returns 0 if `options` are valid, or else the error code for the invalid option.
+int ValidateDecodeOptions(const DecodeOptions &options) {
+  if (options.partition_depth < 0 || options.partition_depth > kMaxPartitionDepth ||
+      options.partition_depth > options.vertex_quantization_bits) {
+    return 6;
+  }
+  if (options.uint16_positions && options.vertex_quantization_bits > 16) return 8;
+  return 0;
+}
+
+/// Returns the number of words of the vertex positions in the output.
+std::size_t GetVertexPositionsSize(const DecodeOptions &options, std::size_t num_vertices) {
+  return options.uint16_positions ? (3 * num_vertices + 1) / 2 : 3 * num_vertices;
+}
+
+/// Index that separates triangle strips, which WebGL 2 always treats as a primitive restart.
+constexpr std::uint32_t kRestartIndex = ~static_cast<std::uint32_t>(0);
+
+/// Returns the number of words of the edge table used by `EmitTriangleStrips` for `num_indices`
+/// triangle indices: the smallest power of 2 that is at least twice the number of edges.
+std::size_t GetEdgeTableSize(std::size_t num_indices) {
+  std::size_t size = 1;
+  while (size < 2 * num_indices) size *= 2;
+  return size;
+}
+
+std::uint32_t HashEdge(std::uint32_t a, std::uint32_t b) {
+  std::uint32_t h = a * 0x9e3779b1u + b;
+  h ^= h >> 15;
+  h *= 0x85ebca77u;
+  return h ^ (h >> 13);
+}
+
+/// Returns the next corner of the triangle containing `corner`.
+std::uint32_t NextCorner(std::uint32_t corner) {
+  return corner % 3 == 2 ? corner - 2 : corner + 1;
+}
+
+/// Converts the triangles `triangles[0, num_indices)`, of which each triplet of vertex indices
+/// specifies a triangle, to triangle strips each followed by `kRestartIndex`, and writes them to
+/// `output`, which must have space for `num_indices / 3 * 4` indices.
+///
+/// Directed edges are identified by the corner at which they start.  A strip is only extended
+/// across an edge that the adjacent triangle traverses in the opposite direction, so that the
+/// triangles of the strips retain the orientation of the input triangles.
+///
+/// `triangles` is overwritten.  `adjacency` and `edge_table` must have space for `num_indices`
+/// and `GetEdgeTableSize(num_indices)` words, respectively.
+///
+/// Returns the end of the output.
+std::uint32_t *EmitTriangleStrips(std::uint32_t *triangles, std::size_t num_indices,
+                                  std::uint32_t *adjacency, std::uint32_t *edge_table,
+                                  std::uint32_t *output) {
+  constexpr std::uint32_t kEmpty = ~static_cast<std::uint32_t>(0);
+  const std::size_t edge_table_size = GetEdgeTableSize(num_indices);
+  const std::uint32_t mask = static_cast<std::uint32_t>(edge_table_size - 1);
+  std::fill(edge_table, edge_table + edge_table_size, kEmpty);
+  std::fill(adjacency, adjacency + num_indices, kEmpty);
+
+  // Links each directed edge with an unlinked opposite edge of another triangle, if any.
+  for (std::uint32_t corner = 0; corner < num_indices; ++corner) {
+    const std::uint32_t a = triangles[corner], b = triangles[NextCorner(corner)];
+    std::uint32_t bucket = HashEdge(b, a) & mask;
+    for (std::uint32_t probe = 1;; ++probe) {
+      const std::uint32_t other = edge_table[bucket];
+      if (other == kEmpty) break;
+      if (triangles[other] == b && triangles[NextCorner(other)] == a &&
+          adjacency[other] == kEmpty && other / 3 != corner / 3) {
+        adjacency[other] = corner;
+        adjacency[corner] = other;
+        break;
+      }
+      bucket = (bucket + probe) & mask;
+    }
+    bucket = HashEdge(a, b) & mask;
+    for (std::uint32_t probe = 1; edge_table[bucket] != kEmpty; ++probe) {
+      bucket = (bucket + probe) & mask;
+    }
+    edge_table[bucket] = corner;
+  }
+
+  // The first index of each triangle is set to `kRestartIndex` once it has been emitted.
+  const auto is_emitted = [&](std::uint32_t corner) {
+    return triangles[corner - corner % 3] == kRestartIndex;
+  };
+  for (std::uint32_t base = 0; base < num_indices; base += 3) {
+    if (triangles[base] == kRestartIndex) continue;
+    // Choose an edge across which the strip can be extended, or else emit an isolated triangle.
+    std::uint32_t corner = base;
+    for (std::uint32_t i = 0; i < 3; ++i) {
+      const std::uint32_t other = adjacency[base + i];
+      if (other != kEmpty && !is_emitted(other)) {
+        corner = base + i;
+        break;
+      }
+    }
+    // Emits the triangle as the rotation of its vertices that ends with the chosen edge.
+    const std::uint32_t next_corner = NextCorner(corner);
+    *output++ = triangles[NextCorner(next_corner)];
+    *output++ = triangles[corner];
+    *output++ = triangles[next_corner];
+    triangles[base] = kRestartIndex;
+    // The orientation of each triangle after the first in a strip alternates, and the edge
+    // across which the strip continues is the one shared with the last two vertices emitted.
+    bool odd = true;
+    while (true) {
+      const std::uint32_t other = adjacency[corner];
+      if (other == kEmpty || is_emitted(other)) break;
+      const std::uint32_t other_next = NextCorner(other), other_opposite = NextCorner(other_next);
+      *output++ = triangles[other_opposite];
+      corner = odd ? other_opposite : other_next;
+      triangles[other - other % 3] = kRestartIndex;
+      odd = !odd;
+    }
+    *output++ = kRestartIndex;
+  }
+  return output;
+}
+
+/// Decodes the draco mesh of `input_size` bytes at `input` using `decoder`, and writes it to the
+/// output region at `output_offset`, preserving the preceding words, as:
+///
+///   std::uint32_t subchunk_offsets[8^partition_depth + 1];
+///   std::uint32_t subchunk_vertex_offsets[8^partition_depth + 1];  // if compact_partitions
+///   std::uint32_t indices[num_indices];
+///   std::uint32_t vertex_positions[3 * num_vertices];
+///
+/// or, if `options.uint16_positions` is set, `std::uint16_t vertex_positions[3 * num_vertices]`
+/// padded to a multiple of 4 bytes.
+///
+/// The indices are written directly to the output region in partition order, with `num_indices`
+/// equal to `3 * num_faces`.  If `options.triangle_strips` is set, the faces of each partition are
+/// instead converted to triangle strips by `EmitTriangleStrips`, and `subchunk_offsets` specifies
+/// the strips of each partition.  The restart index following the last strip is omitted.
+///
+/// If `options.compact_partitions` is set, the vertices referenced by partition `i` are
+/// `[subchunk_vertex_offsets[i], subchunk_vertex_offsets[i + 1])`, in order of first reference,
+/// and its indices are remapped to that range.  Unreferenced vertices are dropped, and vertices
+/// shared by multiple partitions are duplicated, so that the partitions can be stored separately.
+///
+/// If `partition_depth` is non-zero, the faces are partitioned by a regular octree of that depth
+/// over the quantized vertex position range, ordered such that the partitions of each octree node
+/// are contiguous.  A depth of 1 partitions the faces into the 8 octants.  Otherwise, there is a
+/// single partition.
+///
+/// Returns 0 on success, or a non-zero error code.
+int DecodeMesh(draco::Decoder *decoder, draco::DecoderBuffer *decoder_buffer, const char *input,
+               std::size_t input_size, const DecodeOptions &options, std::size_t output_offset,
+               DecodedMesh *result) {
+  const int partition_depth = options.partition_depth;
+  const int vertex_quantization_bits = options.vertex_quantization_bits;
+  TraceSpan span("DecodeMesh", "bytes", input_size);
+  decoder_buffer->Init(input, input_size);
+  auto decoded_mesh_statusor = [&] {
+    TraceSpan decode_span("DecodeMesh.decode", "bytes", input_size);
+    return decoder->DecodeMeshFromBuffer(decoder_buffer);
+  }();
   if (!decoded_mesh_statusor.ok()) return 1;
   auto *decoded_mesh = decoded_mesh_statusor.value().get();
   auto num_vertices = decoded_mesh->num_points();
   auto num_faces = decoded_mesh->num_faces();
-  // draco::MeshStripifier stripifier;
-  // constexpr std::uint32_t restart_index = ~static_cast<std::uint32_t>(0);
-  // if (!stripifier.GenerateTriangleStripsWithPrimitiveRestart(*decoded_mesh, restart_index,
-  //                                                            std::back_inserter(indices))) {
-  //   return 2;
-  // }
   const auto *position_att = decoded_mesh->GetNamedAttribute(draco::GeometryAttribute::POSITION);
   if (!position_att) {
     return 3;
@@ -59,31 +278,72 @@ int neuroglancer_draco_decode(char *input, unsigned int input_size, bool partiti
   }
   if (position_att->size() != num_vertices) return 1000 + position_att->size();
 
-  std::unique_ptr<std::uint32_t[], FreeDeleter> indices(
-      static_cast<std::uint32_t *>(::malloc(sizeof(std::uint32_t) * 3 * num_faces)));
-  for (unsigned int face_i = 0; face_i < num_faces; ++face_i) {
+  // Vertex indices of a face, remapped to attribute value indices.
+  const bool mapping_identity = position_att->is_mapping_identity();
+  const auto get_face_indices = [&](unsigned int face_i, std::uint32_t *face_indices) {
     const auto &face = decoded_mesh->face(draco::FaceIndex(face_i));
     for (int i = 0; i < 3; ++i) {
-      indices[face_i * 3 + i] = face[i].value();
+      face_indices[i] =
+          mapping_identity ? face[i].value() : position_att->mapped_index(face[i]).value();
     }
+  };
+
+  auto *vertex_positions = reinterpret_cast<const std::uint32_t *>(
+      position_att->GetAddress(draco::AttributeValueIndex(0)));
+  const unsigned int num_partitions = 1u << (3 * partition_depth);
+  // Each partition references at most 3 vertices per face.
+  const std::size_t max_output_vertices =
+      options.compact_partitions
+          ? std::min(std::size_t(3) * num_faces, std::size_t(num_partitions) * num_vertices)
+          : num_vertices;
+  // Triangle strips require at most 4 indices per face, including the restart indices.
+  const std::size_t max_num_indices = (options.triangle_strips ? 4 : 3) * num_faces;
+  const std::size_t header_size = (num_partitions + 1) * (options.compact_partitions ? 2 : 1);
+  if (!ReserveBuffer(&output_buffer,
+                     output_offset + header_size + max_num_indices +
+                         GetVertexPositionsSize(options, max_output_vertices),
+                     output_offset)) {
+    return 7;
   }
+  std::uint32_t *subchunk_offsets = output_buffer.data + output_offset;
+  std::uint32_t *subchunk_vertex_offsets = subchunk_offsets + num_partitions + 1;
+  std::uint32_t *indices = output_buffer.data + output_offset + header_size;
 
-  if (!position_att->is_mapping_identity()) {
-    // Remap indices
-    for (size_t i = 0; i < num_faces * 3; ++i) {
-      indices[i] = position_att->mapped_index(draco::PointIndex(indices[i])).value();
-    }
+  // The scratch buffer holds the partition of each face, followed by the partitioned triangles
+  // when they are converted to triangle strips, and the source vertex of each output vertex when
+  // the partitions are compacted.  These are followed by temporary space for compacting the
+  // partitions and for computing triangle strips.
+  const std::size_t face_partitions_size = partition_depth ? num_faces : 0;
+  const std::size_t triangles_end =
+      face_partitions_size + (options.triangle_strips ? 3 * num_faces : 0);
+  const std::size_t preserved_scratch_size =
+      triangles_end + (options.compact_partitions ? max_output_vertices : 0);
+  if (!ReserveBuffer(&scratch_buffer,
+                     preserved_scratch_size + (options.compact_partitions ? num_vertices : 0), 0)) {
+    return 7;
   }
+  std::uint32_t *triangles =
+      options.triangle_strips ? scratch_buffer.data + face_partitions_size : indices;
+  if (partition_depth == 0) {
+    subchunk_offsets[0] = 0;
+    subchunk_offsets[1] = num_faces * 3;
+    for (unsigned int face_i = 0; face_i < num_faces; ++face_i) {
+      get_face_indices(face_i, triangles + face_i * 3);
+    }
+  } else {
+    TraceSpan partition_span("DecodeMesh.partition", "faces", num_faces);
+    // Partition point of each level along each axis, relative to the origin of the current cell.
+    // At level 0, this equals `(2^vertex_quantization_bits - 1) / 2 + 1`.
+    const auto get_partition_offset = [&](int level) -> std::uint32_t {
+      return std::uint32_t(1) << (vertex_quantization_bits - 1 - level);
+    };
 
-  auto *vertex_positions = reinterpret_cast<const std::uint32_t *>(
-      position_att->GetAddress(draco::AttributeValueIndex(0)));
-  if (partition) {
-    const auto get_vertex_mask = [&](auto *v_pos) {
-      const std::uint32_t partition_point =
-          (std::numeric_limits<std::uint32_t>::max() >> (32 - vertex_quantization_bits)) / 2 + 1;
-      // mask is 1 if point can be included in octree node
+    // Returns the mask of the octants of a cell, partitioned at `partition_point`, that may
+    // contain the vertex.  The mask is 1 if the point can be included in the octree node.
+    const auto get_vertex_mask = [&](const std::uint32_t *v_pos,
+                                     const std::uint32_t *partition_point) {
       unsigned int mask = 0xFF;
-      if (v_pos[0] < partition_point) {
+      if (v_pos[0] < partition_point[0]) {
         // mask of octree nodes with x=0
 
         // 0: x=0, y=0, z=0
@@ -96,61 +356,259 @@ int neuroglancer_draco_decode(char *input, unsigned int input_size, bool partiti
         // 7: x=1, y=1, z=1
 
         mask &= 0b01010101;
-      } else if (v_pos[0] > partition_point) {
+      } else if (v_pos[0] > partition_point[0]) {
         mask &= 0b10101010;
       }
-      if (v_pos[1] < partition_point) {
+      if (v_pos[1] < partition_point[1]) {
         mask &= 0b00110011;
-      } else if (v_pos[1] > partition_point) {
+      } else if (v_pos[1] > partition_point[1]) {
         mask &= 0b11001100;
       }
-      if (v_pos[2] < partition_point) {
+      if (v_pos[2] < partition_point[2]) {
         mask &= 0b00001111;
-      } else if (v_pos[2] > partition_point) {
+      } else if (v_pos[2] > partition_point[2]) {
         mask &= 0b11110000;
       }
       return mask;
     };
 
-    std::unique_ptr<std::uint32_t[], FreeDeleter> partitioned_indices(
-        static_cast<std::uint32_t *>(::malloc(sizeof(std::uint32_t) * 3 * num_faces)));
-
-    const auto for_each_face = [&](auto func) {
-      for (size_t i = 0; i < num_faces * 3; i += 3) {
+    // Computes the partition of each face once.  At each level, the face is assigned to the first
+    // octant of the current cell that may contain all three of its vertices, and the partition
+    // index is the concatenation of the octant indices, so that the partitions of each octree
+    // node at a given level are contiguous.  With a depth of 1, these are the 8 octants.
+    std::uint32_t *face_partitions = scratch_buffer.data;
+    std::fill(subchunk_offsets, subchunk_offsets + num_partitions + 1, 0);
+    for (unsigned int face_i = 0; face_i < num_faces; ++face_i) {
+      std::uint32_t face_indices[3];
+      get_face_indices(face_i, face_indices);
+      const std::uint32_t *face_vertex_positions[3];
+      for (int j = 0; j < 3; ++j) {
+        face_vertex_positions[j] = vertex_positions + face_indices[j] * 3;
+      }
+      std::uint32_t origin[3] = {0, 0, 0};
+      std::uint32_t partition_i = 0;
+      for (int level = 0; level < partition_depth; ++level) {
+        const std::uint32_t partition_offset = get_partition_offset(level);
+        std::uint32_t partition_point[3];
+        for (int k = 0; k < 3; ++k) {
+          partition_point[k] = origin[k] + partition_offset;
+        }
         unsigned int mask = 0xFF;
         for (int j = 0; j < 3; ++j) {
-          mask &= get_vertex_mask(vertex_positions + indices[i + j] * 3);
+          mask &= get_vertex_mask(face_vertex_positions[j], partition_point);
+        }
+        const unsigned int octant = first_bit_lookup_table[mask];
+        for (int k = 0; k < 3; ++k) {
+          if ((octant >> k) & 1) origin[k] += partition_offset;
         }
-        func(i, first_bit_lookup_table[mask]);
+        partition_i = partition_i * 8 + octant;
       }
-    };
-
-    std::uint32_t subchunk_offsets[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
-    for_each_face(
-        [&](size_t i, unsigned int partition_i) { subchunk_offsets[partition_i + 1] += 3; });
+      face_partitions[face_i] = partition_i;
+      subchunk_offsets[partition_i + 1] += 3;
+    }
 
     std::uint32_t sum = 0;
-    for (int i = 0; i < 8; ++i) {
+    for (unsigned int i = 0; i < num_partitions; ++i) {
       auto count = subchunk_offsets[i + 1];
       subchunk_offsets[i + 1] = sum;
       sum += count;
     }
 
-    for_each_face([&](size_t i, unsigned int partition_i) {
+    // Writes the faces directly to their partitions of the output.
+    for (unsigned int face_i = 0; face_i < num_faces; ++face_i) {
+      const std::uint32_t partition_i = face_partitions[face_i];
       auto offset = subchunk_offsets[partition_i + 1];
       subchunk_offsets[partition_i + 1] += 3;
-      for (int j = 0; j < 3; ++j) {
-        partitioned_indices[offset + j] = indices[i + j];
+      get_face_indices(face_i, triangles + offset);
+    }
+  }
+
+  std::size_t num_output_vertices = num_vertices;
+  if (options.compact_partitions) {
+    TraceSpan compaction_span("DecodeMesh.compaction", "faces", num_faces);
+    std::uint32_t *vertex_sources = scratch_buffer.data + triangles_end;
+    // Output index of each input vertex, which belongs to the current partition only if it is at
+    // least the first output vertex of the partition.
+    std::uint32_t *vertex_map = scratch_buffer.data + preserved_scratch_size;
+    constexpr std::uint32_t kUnassigned = ~static_cast<std::uint32_t>(0);
+    std::fill(vertex_map, vertex_map + num_vertices, kUnassigned);
+    std::uint32_t num_assigned = 0;
+    for (unsigned int i = 0; i < num_partitions; ++i) {
+      const std::uint32_t partition_begin = num_assigned;
+      subchunk_vertex_offsets[i] = partition_begin;
+      for (std::uint32_t j = subchunk_offsets[i], end = subchunk_offsets[i + 1]; j < end; ++j) {
+        std::uint32_t &mapped = vertex_map[triangles[j]];
+        if (mapped == kUnassigned || mapped < partition_begin) {
+          vertex_sources[num_assigned] = triangles[j];
+          mapped = num_assigned++;
+        }
+        triangles[j] = mapped;
       }
-    });
+    }
+    subchunk_vertex_offsets[num_partitions] = num_assigned;
+    num_output_vertices = num_assigned;
+  }
 
-    neuroglancer_draco_receive_decoded_mesh(num_faces, num_vertices, partitioned_indices.get(),
-                                            vertex_positions, subchunk_offsets);
+  std::size_t num_indices = 3 * num_faces;
+  if (options.triangle_strips && num_faces != 0) {
+    TraceSpan strip_span("DecodeMesh.strip", "faces", num_faces);
+    std::size_t max_partition_indices = 0;
+    for (unsigned int i = 0; i < num_partitions; ++i) {
+      max_partition_indices = std::max(max_partition_indices,
+                                       std::size_t(subchunk_offsets[i + 1] - subchunk_offsets[i]));
+    }
+    if (!ReserveBuffer(&scratch_buffer,
+                       preserved_scratch_size + max_partition_indices +
+                           GetEdgeTableSize(max_partition_indices),
+                       preserved_scratch_size)) {
+      return 7;
+    }
+    triangles = scratch_buffer.data + face_partitions_size;
+    std::uint32_t *adjacency = scratch_buffer.data + preserved_scratch_size;
+    std::uint32_t *edge_table = adjacency + max_partition_indices;
+    std::uint32_t *output = indices;
+    for (unsigned int i = 0; i < num_partitions; ++i) {
+      const std::uint32_t begin = subchunk_offsets[i], end = subchunk_offsets[i + 1];
+      subchunk_offsets[i] = output - indices;
+      output = EmitTriangleStrips(triangles + begin, end - begin, adjacency, edge_table, output);
+    }
+    // Omits the last restart index, which empty partitions at the end would otherwise start after.
+    num_indices = output - indices - 1;
+    for (unsigned int i = num_partitions; i > 0 && subchunk_offsets[i - 1] > num_indices; --i) {
+      subchunk_offsets[i - 1] = num_indices;
+    }
+    subchunk_offsets[num_partitions] = num_indices;
+  }
+
+  if (options.compact_partitions) {
+    const std::uint32_t *vertex_sources = scratch_buffer.data + triangles_end;
+    if (options.uint16_positions) {
+      auto *output_positions = reinterpret_cast<std::uint16_t *>(indices + num_indices);
+      for (std::size_t i = 0; i < num_output_vertices; ++i) {
+        const std::uint32_t *source = vertex_positions + vertex_sources[i] * 3;
+        for (int j = 0; j < 3; ++j) {
+          output_positions[i * 3 + j] = static_cast<std::uint16_t>(source[j]);
+        }
+      }
+    } else {
+      std::uint32_t *output_positions = indices + num_indices;
+      for (std::size_t i = 0; i < num_output_vertices; ++i) {
+        std::memcpy(output_positions + i * 3, vertex_positions + vertex_sources[i] * 3,
+                    sizeof(std::uint32_t) * 3);
+      }
+    }
+  } else if (options.uint16_positions) {
+    auto *output_positions = reinterpret_cast<std::uint16_t *>(indices + num_indices);
+    for (std::size_t i = 0; i < 3 * num_vertices; ++i) {
+      output_positions[i] = static_cast<std::uint16_t>(vertex_positions[i]);
+    }
   } else {
-    std::uint32_t subchunk_offsets[2] = {0, num_faces * 3};
-    neuroglancer_draco_receive_decoded_mesh(num_faces, num_vertices, indices.get(),
-                                            vertex_positions, subchunk_offsets);
+    std::memcpy(indices + num_indices, vertex_positions, sizeof(std::uint32_t) * 3 * num_vertices);
+  }
+  result->num_indices = num_indices;
+  result->num_vertices = num_output_vertices;
+  result->size = header_size + num_indices + GetVertexPositionsSize(options, num_output_vertices);
+  return 0;
+}
+
+}  // namespace
+
+extern "C" {
+/// Receives the decoded mesh, as a single region of wasm memory in the layout written by
+/// `DecodeMesh`, with `num_partitions` partitions.
+///
+/// The region remains owned by the module and is reused by the next decode, so it must be copied
+/// out before then.
+extern void neuroglancer_draco_receive_decoded_output(unsigned int num_indices,
+                                                      unsigned int num_vertices,
+                                                      unsigned int num_partitions,
+                                                      const void *output);
+
+/// Decodes the draco mesh `input`, which is freed, and passes the result to
+/// `neuroglancer_draco_receive_decoded_output`.  See `DecodeMesh` for the partitioning and the
+/// vertex position format.
+int neuroglancer_draco_decode(char *input, unsigned int input_size, int partition_depth,
+                              int vertex_quantization_bits, bool uint16_positions,
+                              bool triangle_strips, bool compact_partitions) {
+  std::unique_ptr<char[], FreeDeleter> input_deleter(input);
+  const DecodeOptions options = {partition_depth, vertex_quantization_bits, uint16_positions,
+                                 triangle_strips, compact_partitions};
+  if (int error = ValidateDecodeOptions(options)) return error;
+  draco::DecoderBuffer decoder_buffer;
+  draco::Decoder decoder;
+  decoder.SetSkipAttributeTransform(draco::GeometryAttribute::POSITION);
+  DecodedMesh result;
+  if (int error = DecodeMesh(&decoder, &decoder_buffer, input, input_size, options,
+                             /*output_offset=*/0, &result)) {
+    return error;
   }
+  neuroglancer_draco_receive_decoded_output(result.num_indices, result.num_vertices,
+                                            1u << (3 * partition_depth), output_buffer.data);
   return 0;
 }
+
+/// Decodes `num_fragments` draco meshes with a single decoder, avoiding the per-call overhead of
+/// `neuroglancer_draco_decode` for many small fragments.
+///
+/// `input`, which is freed, consists of `std::uint32_t fragment_sizes[num_fragments]`, the size in
+/// bytes of each fragment, followed by the concatenated fragments.
+///
+/// Returns the output region, which remains owned by the module and is reused by the next decode,
+/// or nullptr if the options are invalid or allocation fails.  The output region consists of:
+///
+///   std::uint32_t size;  // total size of the output region in words
+///   struct {
+///     std::uint32_t error;  // 0 on success, otherwise as returned by neuroglancer_draco_decode
+///     std::uint32_t num_indices;
+///     std::uint32_t num_vertices;
+///     std::uint32_t offset;  // offset in words of the decoded mesh within the output region
+///   } fragments[num_fragments];
+///
+/// followed by the decoded meshes, each in the layout written by `DecodeMesh`.
+const std::uint32_t *neuroglancer_draco_decode_batch(char *input, unsigned int num_fragments,
+                                                     int partition_depth,
+                                                     int vertex_quantization_bits,
+                                                     bool uint16_positions,
+                                                     bool triangle_strips,
+                                                     bool compact_partitions) {
+  std::unique_ptr<char[], FreeDeleter> input_deleter(input);
+  const DecodeOptions options = {partition_depth, vertex_quantization_bits, uint16_positions,
+                                 triangle_strips, compact_partitions};
+  if (ValidateDecodeOptions(options)) return nullptr;
+  TraceSpan span("neuroglancer_draco_decode_batch", "fragments", num_fragments);
+  constexpr std::size_t kFragmentDescriptorSize = 4;
+  std::size_t output_size = 1 + kFragmentDescriptorSize * num_fragments;
+  if (!ReserveBuffer(&output_buffer, output_size, 0)) return nullptr;
+  const std::size_t fragment_sizes_bytes = sizeof(std::uint32_t) * num_fragments;
+  const char *fragment = input + fragment_sizes_bytes;
+  draco::DecoderBuffer decoder_buffer;
+  draco::Decoder decoder;
+  decoder.SetSkipAttributeTransform(draco::GeometryAttribute::POSITION);
+  for (unsigned int fragment_i = 0; fragment_i < num_fragments; ++fragment_i) {
+    std::uint32_t fragment_size;
+    std::memcpy(&fragment_size, input + sizeof(std::uint32_t) * fragment_i, sizeof(fragment_size));
+    DecodedMesh result = {0, 0, 0};
+    const int error = DecodeMesh(&decoder, &decoder_buffer, fragment, fragment_size, options,
+                                 output_size, &result);
+    if (error == 7) return nullptr;
+    // The output region may have been reallocated.
+    std::uint32_t *descriptor =
+        output_buffer.data + 1 + kFragmentDescriptorSize * fragment_i;
+    descriptor[0] = error;
+    descriptor[1] = error ? 0 : result.num_indices;
+    descriptor[2] = error ? 0 : result.num_vertices;
+    descriptor[3] = output_size;
+    if (!error) output_size += result.size;
+    fragment += fragment_size;
+  }
+  output_buffer.data[0] = output_size;
+  return output_buffer.data;
+}
+
+/// Frees the buffers retained for reuse by `neuroglancer_draco_decode` and
+/// `neuroglancer_draco_decode_batch`, e.g. after decoding an unusually large mesh.
+void neuroglancer_draco_free_output() {
+  FreeBuffer(&output_buffer);
+  FreeBuffer(&scratch_buffer);
+}
 }
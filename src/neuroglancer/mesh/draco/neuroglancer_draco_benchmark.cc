@@ -0,0 +1,203 @@
+/**
+ * @license
+ * Copyright 2021 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark of a native build of `neuroglancer_draco.cc`, for profiling the decoder with native
+// tools.
+//
+// Usage:
+//
+//   neuroglancer_draco_benchmark [--bits=N] [--depth=N] [--uint16] [--strips] [--compact]
+//                                [--batch] [--repetitions=N] [--trace=PATH] FRAGMENT...
+//
+// Each FRAGMENT is a file containing a single draco-encoded mesh, such as a fragment of a
+// precomputed multiscale mesh, which is decoded with `--bits` vertex quantization bits (default
+// 10) and partitioned with an octree of depth `--depth` (default 1).  `--uint16`, `--strips` and
+// `--compact` select uint16 vertex positions, triangle strip output and per-partition vertex
+// compaction, respectively.  With `--batch`, all fragments are decoded by a single call to
+// `neuroglancer_draco_decode_batch`.
+//
+// As in the browser, each fragment is first copied to a newly allocated input buffer, which the
+// decoder frees.  The best time of the repetitions is reported.  With `--trace`, the trace spans
+// of the decoding phases are written to PATH in the Chrome trace event format.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "trace_events.h"
+
+extern "C" {
+int neuroglancer_draco_decode(char *input, unsigned int input_size, int partition_depth,
+                              int vertex_quantization_bits, bool uint16_positions,
+                              bool triangle_strips, bool compact_partitions);
+const std::uint32_t *neuroglancer_draco_decode_batch(char *input, unsigned int num_fragments,
+                                                     int partition_depth,
+                                                     int vertex_quantization_bits,
+                                                     bool uint16_positions, bool triangle_strips,
+                                                     bool compact_partitions);
+void neuroglancer_draco_free_output();
+}
+
+namespace {
+
+struct Totals {
+  std::size_t num_indices = 0;
+  std::size_t num_vertices = 0;
+  std::size_t num_errors = 0;
+};
+
+Totals totals;
+
+bool ReadFile(const char *path, std::string *contents) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) return false;
+  contents->assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  return true;
+}
+
+char *CopyToNewBuffer(const std::string &data) {
+  char *buffer = static_cast<char *>(std::malloc(std::max<std::size_t>(data.size(), 1)));
+  std::memcpy(buffer, data.data(), data.size());
+  return buffer;
+}
+
+}  // namespace
+
+extern "C" void neuroglancer_draco_receive_decoded_output(unsigned int num_indices,
+                                                          unsigned int num_vertices,
+                                                          unsigned int num_partitions,
+                                                          const void *output) {
+  totals.num_indices += num_indices;
+  totals.num_vertices += num_vertices;
+}
+
+int main(int argc, char **argv) {
+  int bits = 10, depth = 1, repetitions = 5;
+  bool uint16_positions = false, triangle_strips = false, compact_partitions = false,
+       batch = false;
+  std::vector<std::string> fragments;
+  std::string trace_path;
+  std::size_t input_bytes = 0;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (!std::strncmp(arg, "--bits=", 7)) {
+      bits = std::atoi(arg + 7);
+    } else if (!std::strncmp(arg, "--depth=", 8)) {
+      depth = std::atoi(arg + 8);
+    } else if (!std::strcmp(arg, "--uint16")) {
+      uint16_positions = true;
+    } else if (!std::strcmp(arg, "--strips")) {
+      triangle_strips = true;
+    } else if (!std::strcmp(arg, "--compact")) {
+      compact_partitions = true;
+    } else if (!std::strcmp(arg, "--batch")) {
+      batch = true;
+    } else if (!std::strncmp(arg, "--repetitions=", 14)) {
+      repetitions = std::max(1, std::atoi(arg + 14));
+    } else if (!std::strncmp(arg, "--trace=", 8)) {
+      trace_path = arg + 8;
+    } else if (arg[0] == '-') {
+      fragments.clear();
+      break;
+    } else {
+      std::string contents;
+      if (!ReadFile(arg, &contents)) {
+        std::fprintf(stderr, "Failed to read fragment: %s\n", arg);
+        return 1;
+      }
+      input_bytes += contents.size();
+      fragments.push_back(std::move(contents));
+    }
+  }
+  if (fragments.empty()) {
+    std::fprintf(stderr,
+                 "Usage: %s [--bits=N] [--depth=N] [--uint16] [--strips] [--compact] "
+                 "[--batch] [--repetitions=N] [--trace=PATH] FRAGMENT...\n",
+                 argv[0]);
+    return 1;
+  }
+
+  // Input of `neuroglancer_draco_decode_batch`: the size of each fragment followed by the
+  // concatenated fragments.
+  std::string batch_input;
+  if (batch) {
+    for (const auto &fragment : fragments) {
+      const std::uint32_t size = fragment.size();
+      batch_input.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    }
+    for (const auto &fragment : fragments) batch_input += fragment;
+  }
+
+  neuroglancer::trace_events::SetEnabled(!trace_path.empty());
+  double best = 0;
+  Totals best_totals;
+  for (int repetition = 0; repetition < repetitions; ++repetition) {
+    totals = Totals();
+    const auto start = std::chrono::steady_clock::now();
+    if (batch) {
+      const std::uint32_t *output =
+          neuroglancer_draco_decode_batch(CopyToNewBuffer(batch_input), fragments.size(), depth,
+                                          bits, uint16_positions, triangle_strips,
+                                          compact_partitions);
+      if (!output) {
+        std::fprintf(stderr, "Batch decode failed\n");
+        return 1;
+      }
+      for (std::size_t i = 0; i < fragments.size(); ++i) {
+        const std::uint32_t *descriptor = output + 1 + 4 * i;
+        if (descriptor[0]) ++totals.num_errors;
+        totals.num_indices += descriptor[1];
+        totals.num_vertices += descriptor[2];
+      }
+    } else {
+      for (const auto &fragment : fragments) {
+        if (neuroglancer_draco_decode(CopyToNewBuffer(fragment), fragment.size(), depth, bits,
+                                      uint16_positions, triangle_strips, compact_partitions)) {
+          ++totals.num_errors;
+        }
+      }
+    }
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (repetition == 0 || seconds < best) {
+      best = seconds;
+      best_totals = totals;
+    }
+  }
+  neuroglancer_draco_free_output();
+  if (!trace_path.empty()) {
+    std::ofstream trace(trace_path, std::ios::binary);
+    trace << neuroglancer::trace_events::GetChromeTraceJson();
+    if (!trace) {
+      std::fprintf(stderr, "Failed to write trace: %s\n", trace_path.c_str());
+      return 1;
+    }
+  }
+
+  std::printf("%zu fragments, %zu bytes: %10.3f ms %10.1f fragments/s %8.1f MiB/s\n",
+              fragments.size(), input_bytes, best * 1e3, fragments.size() / best,
+              input_bytes / best / (1024.0 * 1024.0));
+  std::printf("indices=%zu vertices=%zu errors=%zu\n", best_totals.num_indices,
+              best_totals.num_vertices, best_totals.num_errors);
+  return best_totals.num_errors ? 1 : 0;
+}
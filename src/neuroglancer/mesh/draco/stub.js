@@ -1,6 +1,6 @@
 // Used when compiling wasm module.
 mergeInto(LibraryManager.library, {
-  neuroglancer_draco_receive_decoded_mesh: function() {
+  neuroglancer_draco_receive_decoded_output: function() {
     alert(arguments);
   },
 });